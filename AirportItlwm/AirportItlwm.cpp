@@ -697,7 +697,7 @@ UInt32 AirportItlwm::outputPacket(mbuf_t m, void *param)
     IOReturn ret = kIOReturnOutputSuccess;
     struct _ifnet *ifp = &fHalService->get80211Controller()->ic_ac.ac_if;
     
-    if (fHalService->get80211Controller()->ic_state != IEEE80211_S_RUN || ifp->if_snd.queue == NULL) {
+    if (fHalService->get80211Controller()->ic_state != IEEE80211_S_RUN || ifp->if_snd.ifq_flows == NULL) {
         if (m && mbuf_type(m) != MBUF_TYPE_FREE)
             freePacket(m);
         return kIOReturnOutputDropped;
@@ -718,10 +718,8 @@ UInt32 AirportItlwm::outputPacket(mbuf_t m, void *param)
         ifp->netStat->outputErrors++;
         ret = kIOReturnOutputDropped;
     }
-    if (!ifp->if_snd.queue->lockEnqueue(m)) {
-        freePacket(m);
+    if (ifq_enqueue(&ifp->if_snd, m) != 0)
         ret = kIOReturnOutputDropped;
-    }
     (*ifp->if_start)(ifp);
     return ret;
 }
@@ -731,6 +729,14 @@ UInt32 AirportItlwm::getFeatures() const
     return fHalService->getDriverInfo()->supportedFeatures();
 }
 
+IOReturn AirportItlwm::getChecksumSupport(UInt32 *checksumMask, UInt32 checksumFamily, bool isOutput)
+{
+    if (checksumFamily != kChecksumFamilyTCPIP)
+        return kIOReturnUnsupported;
+    *checksumMask = fHalService->getDriverInfo()->supportedChecksums(isOutput);
+    return kIOReturnSuccess;
+}
+
 IOReturn AirportItlwm::setPromiscuousMode(IOEnetPromiscuousMode mode)
 {
     return kIOReturnSuccess;
@@ -235,6 +235,7 @@ public:
     virtual IOReturn getPacketFilters(const OSSymbol *group, UInt32 *filters) const override;
     virtual IOReturn selectMedium(const IONetworkMedium *medium) override;
     virtual UInt32 getFeatures() const override;
+    virtual IOReturn getChecksumSupport(UInt32 *checksumMask, UInt32 checksumFamily, bool isOutput) override;
     
 public:
     IOInterruptEventSource* fInterrupt;
@@ -543,7 +543,7 @@ UInt32 AirportItlwm::outputPacket(mbuf_t m, void *param)
     IOReturn ret = kIOReturnOutputSuccess;
     struct _ifnet *ifp = &fHalService->get80211Controller()->ic_ac.ac_if;
     
-    if (fHalService->get80211Controller()->ic_state != IEEE80211_S_RUN || ifp->if_snd.queue == NULL) {
+    if (fHalService->get80211Controller()->ic_state != IEEE80211_S_RUN || ifp->if_snd.ifq_flows == NULL) {
         if (m && mbuf_type(m) != MBUF_TYPE_FREE)
             freePacket(m);
         return kIOReturnOutputDropped;
@@ -572,10 +572,8 @@ UInt32 AirportItlwm::outputPacket(mbuf_t m, void *param)
         if (dump)
             IOFree((void*)dump, 3 * len + 1);
     }
-    if (!ifp->if_snd.queue->lockEnqueue(m)) {
-        freePacket(m);
+    if (ifq_enqueue(&ifp->if_snd, m) != 0)
         ret = kIOReturnOutputDropped;
-    }
     (*ifp->if_start)(ifp);
     return ret;
 }
@@ -617,6 +615,14 @@ UInt32 AirportItlwm::getFeatures() const
     return fHalService->getDriverInfo()->supportedFeatures();
 }
 
+IOReturn AirportItlwm::getChecksumSupport(UInt32 *checksumMask, UInt32 checksumFamily, bool isOutput)
+{
+    if (checksumFamily != kChecksumFamilyTCPIP)
+        return kIOReturnUnsupported;
+    *checksumMask = fHalService->getDriverInfo()->supportedChecksums(isOutput);
+    return kIOReturnSuccess;
+}
+
 IOReturn AirportItlwm::setPromiscuousMode(IOEnetPromiscuousMode mode)
 {
     return kIOReturnSuccess;
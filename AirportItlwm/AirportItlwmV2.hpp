@@ -79,6 +79,7 @@ public:
     virtual IOReturn setMulticastMode(IOEnetMulticastMode mode) override;
     virtual IOReturn setMulticastList(IOEthernetAddress* addr, UInt32 len) override;
     virtual UInt32 getFeatures() const override;
+    virtual IOReturn getChecksumSupport(UInt32 *checksumMask, UInt32 checksumFamily, bool isOutput) override;
     virtual const OSString * newVendorString() const override;
     virtual const OSString * newModelString() const override;
     virtual IOReturn selectMedium(const IONetworkMedium *medium) override;
@@ -119,6 +119,23 @@ struct ioctl_tx_power {
     unsigned int version;
 };
 
+struct ioctl_txq_stats {
+    unsigned int version;
+    uint32_t len;           //packets queued
+    uint32_t backlog;       //bytes queued
+    uint32_t maxlen;
+    uint32_t active_flows;
+    uint32_t new_flows;     //flows that became active
+    uint32_t max_sojourn_us;    //worst queueing delay seen
+    uint64_t enqueued;
+    uint64_t dequeued;
+    uint64_t overlimit_drops;
+    uint64_t codel_drops;
+    uint64_t ack_drops;     //TCP ACKs replaced by newer ones
+    uint64_t lock_contended;    //producer spun on the queue lock
+    uint64_t start_deferred;    //Tx kicks that found the work loop busy
+};
+
 /*
  * 802.11 ciphers.
  */
@@ -29,6 +29,7 @@ enum IOCTL_IDS {
     IOCTL_80211_SCAN_RESULT,
     IOCTL_80211_TX_POWER_LEVEL,
     IOCTL_80211_NW_BSSID,
+    IOCTL_80211_TXQ_STATS,
     
     IOCTL_ID_MAX
 };
@@ -31,6 +31,8 @@ public:
     
     virtual UInt32 supportedFeatures() = 0;
 
+    virtual UInt32 supportedChecksums(bool isOutput) = 0;
+
     virtual const char *getFirmwareCountryCode() = 0;
 
     virtual uint32_t getTxQueueSize() = 0;
@@ -26,6 +26,15 @@ initWithController(IOEthernetController *controller, IOWorkLoop *workloop, IOCom
     this->mainWorkLoop->retain();
     this->mainCommandGate = commandGate;
     this->mainCommandGate->retain();
+    this->deferredStart = IOInterruptEventSource::interruptEventSource(this, &ItlHalService::deferredStartAction);
+    if (this->deferredStart == NULL)
+        return false;
+    if (this->mainWorkLoop->addEventSource(this->deferredStart) != kIOReturnSuccess) {
+        this->deferredStart->release();
+        this->deferredStart = NULL;
+        return false;
+    }
+    this->deferredStart->enable();
     this->inner_attr = lck_attr_alloc_init();
     this->inner_gp_attr = lck_grp_attr_alloc_init();
     this->inner_gp = lck_grp_alloc_init("itlwm_tsleep", this->inner_gp_attr);
@@ -51,6 +60,33 @@ getMainWorkLoop()
     return this->mainWorkLoop;
 }
 
+/*
+ * if_start found the gate busy. Note the kick on the send queue and have
+ * the work loop run it once the gate is released, whoever held it: the
+ * Rx and Tx completion paths take the kick on their way out, but timers
+ * and ioctls do not.
+ *
+ * There is one ifnet per controller. The first kick publishes it with a
+ * barrier, before the event is signalled, and it never changes after.
+ */
+void ItlHalService::
+deferStart(struct _ifnet *ifp)
+{
+    OSCompareAndSwapPtr(NULL, ifp, (void * volatile *)&this->deferredStartIfp);
+    ifq_defer_start(&ifp->if_snd);
+    this->deferredStart->interruptOccurred(NULL, NULL, 0);
+}
+
+void ItlHalService::
+deferredStartAction(OSObject *owner, IOInterruptEventSource *sender, int count)
+{
+    ItlHalService *that = (ItlHalService *)owner;
+    struct _ifnet *ifp = __atomic_load_n(&that->deferredStartIfp, __ATOMIC_ACQUIRE);
+    
+    if (ifp != NULL && ifq_take_deferred_start(&ifp->if_snd))
+        (*ifp->if_start)(ifp);
+}
+
 void ItlHalService::
 wakeupOn(void *ident)
 {
@@ -76,6 +112,13 @@ void ItlHalService::
 free()
 {
     XYLog("%s\n", __PRETTY_FUNCTION__);
+    if (this->deferredStart) {
+        this->deferredStart->disable();
+        if (this->mainWorkLoop)
+            this->mainWorkLoop->removeEventSource(this->deferredStart);
+        this->deferredStart->release();
+        this->deferredStart = NULL;
+    }
     if (this->mainWorkLoop) {
         this->mainWorkLoop->release();
     }
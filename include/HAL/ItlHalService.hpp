@@ -19,6 +19,7 @@
 #include <IOKit/IOLib.h>
 #include <IOKit/IOService.h>
 #include <IOKit/IOCommandGate.h>
+#include <IOKit/IOInterruptEventSource.h>
 #include <IOKit/IOWorkLoop.h>
 #include <IOKit/pci/IOPCIDevice.h>
 #include <IOKit/network/IOEthernetController.h>
@@ -65,10 +66,17 @@ protected:
     
     IOWorkLoop *getMainWorkLoop();
     
+    void deferStart(struct _ifnet *ifp);
+    
+private:
+    static void deferredStartAction(OSObject *owner, IOInterruptEventSource *sender, int count);
+    
 private:
     IOEthernetController *controller;
     IOCommandGate *mainCommandGate;
     IOWorkLoop *mainWorkLoop;
+    IOInterruptEventSource *deferredStart;
+    struct _ifnet *deferredStartIfp;     /* set once by deferStart() */
 
     lck_grp_t *inner_gp;
     lck_grp_attr_t *inner_gp_attr;
@@ -0,0 +1,506 @@
+/*
+* Copyright (C) 2020  钟先耀
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#ifndef ItlMvmReorder_hpp
+#define ItlMvmReorder_hpp
+
+#include <net80211/ieee80211_var.h>
+
+/*
+ * RX duplicate detection and A-MPDU re-ordering shared by the MVM firmware
+ * drivers (iwm and iwx). Both devices report de-aggregated frames with the
+ * same MPDU descriptor layout and keep identical per-BAID reorder state,
+ * so the code is written once against a traits class which provides the
+ * driver's types, register constants and its frame input routine:
+ *
+ *  hal_type, softc_type, node_type, rxba_type, buffer_type, entry_type,
+ *  desc_type, dup_type
+ *  max_tid_count, station_id, invalid_baid, consec_drops_delba,
+ *  reorder_timeout_usec, amsdu_subframe_idx_mask, amsdu_last_subframe,
+ *  mflg2_amsdu, reorder_baid_mask, reorder_baid_shift, reorder_nssn_mask,
+ *  reorder_sn_mask, reorder_sn_shift, reorder_ba_old_sn
+ *  rx_frame(), rxba_from_buf(), hal_from_softc(), rx_buffer(),
+ *  rx_entries(), rx_dup_data()
+ *
+ * Frames of a BA session may arrive on several RX queues when firmware
+ * spreads flows with RSS. The NSSN firmware reports is only consistent
+ * with the frames of the queue it was delivered on, so duplicate detection
+ * and the reorder window are kept per queue; drivers with a single RX
+ * queue pass queue 0.
+ */
+template <class T>
+class ItlMvmReorder {
+    typedef typename T::hal_type hal_type;
+    typedef typename T::softc_type softc_type;
+    typedef typename T::node_type node_type;
+    typedef typename T::rxba_type rxba_type;
+    typedef typename T::buffer_type buffer_type;
+    typedef typename T::entry_type entry_type;
+    typedef typename T::desc_type desc_type;
+    typedef typename T::dup_type dup_type;
+
+public:
+    /*
+     * Drop duplicate 802.11 retransmissions
+     * (IEEE 802.11-2012: 9.3.2.10 "Duplicate detection and recovery")
+     * and handle pseudo-duplicate frames which result from deaggregation
+     * of A-MSDU frames in hardware.
+     */
+    static int
+    detect_duplicate(softc_type *sc, mbuf_t m, desc_type *desc,
+                     struct ieee80211_rxinfo *rxi, int queue)
+    {
+        struct ieee80211com *ic = &sc->sc_ic;
+        node_type *in = (node_type *)ic->ic_bss;
+        dup_type *dup_data = T::rx_dup_data(in, queue);
+        uint8_t tid = T::max_tid_count, subframe_idx;
+        struct ieee80211_frame *wh = mtod(m, struct ieee80211_frame *);
+        uint8_t type = wh->i_fc[0] & IEEE80211_FC0_TYPE_MASK;
+        uint8_t subtype = wh->i_fc[0] & IEEE80211_FC0_SUBTYPE_MASK;
+        int hasqos = ieee80211_has_qos(wh);
+        uint16_t seq;
+
+        if (type == IEEE80211_FC0_TYPE_CTL ||
+            (hasqos && (subtype & IEEE80211_FC0_SUBTYPE_NODATA)) ||
+            IEEE80211_IS_MULTICAST(wh->i_addr1))
+            return 0;
+
+        if (hasqos) {
+            tid = (ieee80211_get_qos(wh) & IEEE80211_QOS_TID);
+            if (tid > T::max_tid_count)
+                tid = T::max_tid_count;
+        }
+
+        /* If this wasn't a part of an A-MSDU the sub-frame index will be 0 */
+        subframe_idx = desc->amsdu_info & T::amsdu_subframe_idx_mask;
+
+        seq = letoh16(*(u_int16_t *)wh->i_seq) >> IEEE80211_SEQ_SEQ_SHIFT;
+        if ((wh->i_fc[1] & IEEE80211_FC1_RETRY) &&
+            dup_data->last_seq[tid] == seq &&
+            dup_data->last_sub_frame[tid] >= subframe_idx)
+            return 1;
+
+        /*
+         * Allow the same frame sequence number for all A-MSDU subframes
+         * following the first subframe.
+         * Otherwise these subframes would be discarded as replays.
+         */
+        if (dup_data->last_seq[tid] == seq &&
+            subframe_idx > dup_data->last_sub_frame[tid] &&
+            (desc->mac_flags2 & T::mflg2_amsdu)) {
+            rxi->rxi_flags |= IEEE80211_RXI_SAME_SEQ;
+        }
+
+        dup_data->last_seq[tid] = seq;
+        dup_data->last_sub_frame[tid] = subframe_idx;
+
+        return 0;
+    }
+
+    /* Same as SEQ_LT() in net80211, which is private to it. */
+    static int
+    seq_lt(uint16_t a, uint16_t b)
+    {
+        return ((uint16_t)(a - b) & 0xfff) > 2048;
+    }
+
+    /*
+     * Returns true if sn2 - buffer_size < sn1 < sn2.
+     * To be used only in order to compare reorder buffer head with NSSN.
+     * We fully trust NSSN unless it is behind us due to reorder timeout.
+     * Reorder timeout can only bring us up to buffer_size SNs ahead of NSSN.
+     */
+    static int
+    is_sn_less(uint16_t sn1, uint16_t sn2, uint16_t buffer_size)
+    {
+        return seq_lt(sn1, sn2) && !seq_lt(sn1, sn2 - buffer_size);
+    }
+
+    static void
+    release_frames(hal_type *hal, softc_type *sc, struct ieee80211_node *ni,
+                   rxba_type *rxba, buffer_type *reorder_buf, uint16_t nssn,
+                   struct mbuf_list *ml)
+    {
+        entry_type *entries = T::rx_entries(rxba, reorder_buf);
+        uint16_t ssn = reorder_buf->head_sn;
+
+        /* ignore nssn smaller than head sn - this can happen due to timeout */
+        if (is_sn_less(nssn, ssn, reorder_buf->buf_size))
+            goto set_timer;
+
+        /*
+         * NSSN may be more than a window ahead after a jump; stored frames
+         * are all within one window of the head, so stop once none is left
+         * rather than leave them behind the new head.
+         */
+        while (seq_lt(ssn, nssn) && reorder_buf->num_stored) {
+            int index = ssn % reorder_buf->buf_size;
+            mbuf_t m;
+            int chanidx, is_shortpre;
+            uint32_t rx_pkt_status, rate_n_flags, device_timestamp;
+            struct ieee80211_rxinfo *rxi;
+
+            /* This data is the same for all A-MSDU subframes. */
+            chanidx = entries[index].chanidx;
+            rx_pkt_status = entries[index].rx_pkt_status;
+            is_shortpre = entries[index].is_shortpre;
+            rate_n_flags = entries[index].rate_n_flags;
+            device_timestamp = entries[index].device_timestamp;
+            rxi = &entries[index].rxi;
+
+            /*
+             * Empty the list. Will have more than one frame for A-MSDU.
+             * Empty list is valid as well since nssn indicates frames were
+             * received.
+             */
+            while ((m = ml_dequeue(&entries[index].frames)) != NULL) {
+                T::rx_frame(hal, sc, m, chanidx, rx_pkt_status, is_shortpre,
+                            rate_n_flags, device_timestamp, rxi, ml);
+                reorder_buf->num_stored--;
+
+                /*
+                 * Allow the same frame sequence number and CCMP PN for
+                 * all A-MSDU subframes following the first subframe.
+                 * Otherwise they would be discarded as replays.
+                 */
+                rxi->rxi_flags |= IEEE80211_RXI_SAME_SEQ;
+                rxi->rxi_flags |= IEEE80211_RXI_HWDEC_SAME_PN;
+            }
+
+            ssn = (ssn + 1) & 0xfff;
+        }
+        reorder_buf->head_sn = nssn;
+
+    set_timer:
+        if (reorder_buf->num_stored && !reorder_buf->removed) {
+            timeout_add_usec(&reorder_buf->reorder_timer,
+                             T::reorder_timeout_usec);
+        } else
+            timeout_del(&reorder_buf->reorder_timer);
+    }
+
+    static int
+    oldsn_workaround(softc_type *sc, struct ieee80211_node *ni, int tid,
+                     buffer_type *buffer, uint32_t reorder_data, uint32_t gp2)
+    {
+        struct ieee80211com *ic = &sc->sc_ic;
+
+        if (gp2 != buffer->consec_oldsn_ampdu_gp2) {
+            /* we have a new (A-)MPDU ... */
+
+            /*
+             * reset counter to 0 if we didn't have any oldsn in
+             * the last A-MPDU (as detected by GP2 being identical)
+             */
+            if (!buffer->consec_oldsn_prev_drop)
+                buffer->consec_oldsn_drops = 0;
+
+            /* either way, update our tracking state */
+            buffer->consec_oldsn_ampdu_gp2 = gp2;
+            buffer->consec_oldsn_prev_drop = 0;
+        } else if (buffer->consec_oldsn_prev_drop) {
+            /*
+             * tracking state didn't change, and we had an old SN
+             * indication before - do nothing in this case, we
+             * already noted this one down and are waiting for the
+             * next A-MPDU (by GP2)
+             */
+            return 0;
+        }
+
+        /* return unless this MPDU has old SN */
+        if (!(reorder_data & T::reorder_ba_old_sn))
+            return 0;
+
+        /* update state */
+        buffer->consec_oldsn_prev_drop = 1;
+        buffer->consec_oldsn_drops++;
+
+        /* if limit is reached, send del BA and reset state */
+        if (buffer->consec_oldsn_drops == T::consec_drops_delba) {
+            XYLog("reached %d old SN frames, stopping BA session on TID %d\n",
+                  T::consec_drops_delba, tid);
+            ieee80211_delba_request(ic, ni, IEEE80211_REASON_UNSPECIFIED,
+                                    0, tid);
+            buffer->consec_oldsn_prev_drop = 0;
+            buffer->consec_oldsn_drops = 0;
+            return 1;
+        }
+
+        return 0;
+    }
+
+    /*
+     * Handle re-ordering of frames which were de-aggregated in hardware.
+     * Returns 1 if the MPDU was consumed (buffered or dropped).
+     * Returns 0 if the MPDU should be passed to upper layer.
+     */
+    static int
+    rx_reorder(hal_type *hal, softc_type *sc, mbuf_t m, int chanidx,
+               desc_type *desc, int is_shortpre, int rate_n_flags,
+               uint32_t device_timestamp, struct ieee80211_rxinfo *rxi,
+               int queue, struct mbuf_list *ml)
+    {
+        struct ieee80211com *ic = &sc->sc_ic;
+        struct ieee80211_frame *wh;
+        struct ieee80211_node *ni;
+        rxba_type *rxba;
+        buffer_type *buffer;
+        uint32_t reorder_data = le32toh(desc->reorder_data);
+        int is_amsdu = (desc->mac_flags2 & T::mflg2_amsdu);
+        int last_subframe = (desc->amsdu_info & T::amsdu_last_subframe);
+        uint8_t tid;
+        uint8_t subframe_idx = (desc->amsdu_info &
+                                T::amsdu_subframe_idx_mask);
+        entry_type *entries;
+        int index;
+        uint16_t nssn, sn;
+        uint8_t baid, type, subtype;
+        int hasqos;
+
+        wh = mtod(m, struct ieee80211_frame *);
+        hasqos = ieee80211_has_qos(wh);
+        tid = hasqos ? ieee80211_get_qos(wh) & IEEE80211_QOS_TID : 0;
+
+        type = wh->i_fc[0] & IEEE80211_FC0_TYPE_MASK;
+        subtype = wh->i_fc[0] & IEEE80211_FC0_SUBTYPE_MASK;
+
+        /*
+         * We are only interested in Block Ack requests and unicast QoS data.
+         */
+        if (IEEE80211_IS_MULTICAST(wh->i_addr1))
+            return 0;
+        if (hasqos) {
+            if (subtype & IEEE80211_FC0_SUBTYPE_NODATA)
+                return 0;
+        } else {
+            if (type != IEEE80211_FC0_TYPE_CTL ||
+                subtype != IEEE80211_FC0_SUBTYPE_BAR)
+                return 0;
+        }
+
+        baid = (reorder_data & T::reorder_baid_mask) >>
+            T::reorder_baid_shift;
+        if (baid == T::invalid_baid || baid >= nitems(sc->sc_rxba_data))
+            return 0;
+
+        rxba = &sc->sc_rxba_data[baid];
+        buffer = T::rx_buffer(rxba, queue);
+        if (buffer->buf_size == 0 || tid != rxba->tid ||
+            rxba->sta_id != T::station_id)
+            return 0;
+
+        if (rxba->timeout != 0)
+            getmicrouptime(&rxba->last_rx);
+
+        /* Bypass A-MPDU re-ordering in net80211. */
+        rxi->rxi_flags |= IEEE80211_RXI_AMPDU_DONE;
+
+        nssn = reorder_data & T::reorder_nssn_mask;
+        sn = (reorder_data & T::reorder_sn_mask) >> T::reorder_sn_shift;
+
+        entries = T::rx_entries(rxba, buffer);
+
+        if (!buffer->valid) {
+            if (reorder_data & T::reorder_ba_old_sn)
+                return 0;
+            buffer->valid = 1;
+        }
+
+        ni = ieee80211_find_rxnode(ic, wh);
+        if (type == IEEE80211_FC0_TYPE_CTL &&
+            subtype == IEEE80211_FC0_SUBTYPE_BAR) {
+            release_frames(hal, sc, ni, rxba, buffer, nssn, ml);
+            goto drop;
+        }
+
+        /*
+         * If there was a significant jump in the nssn - adjust.
+         * If the SN is smaller than the NSSN it might need to first go into
+         * the reorder buffer, in which case we just release up to it and the
+         * rest of the function will take care of storing it and releasing up
+         * to the nssn.
+         */
+        if (!is_sn_less(nssn, buffer->head_sn + buffer->buf_size,
+                        buffer->buf_size) ||
+            !seq_lt(sn, buffer->head_sn + buffer->buf_size)) {
+            uint16_t min_sn = seq_lt(sn, nssn) ? sn : nssn;
+            ic->ic_stats.is_ht_rx_frame_above_ba_winend++;
+            release_frames(hal, sc, ni, rxba, buffer, min_sn, ml);
+        }
+
+        if (oldsn_workaround(sc, ni, tid, buffer, reorder_data,
+                             device_timestamp)) {
+            /* BA session will be torn down. */
+            ic->ic_stats.is_ht_rx_ba_window_jump++;
+            goto drop;
+        }
+
+        /* drop any outdated packets */
+        if (seq_lt(sn, buffer->head_sn)) {
+            ic->ic_stats.is_ht_rx_frame_below_ba_winstart++;
+            goto drop;
+        }
+
+        /* release immediately if allowed by nssn and no stored frames */
+        if (!buffer->num_stored && seq_lt(sn, nssn)) {
+            if (is_sn_less(buffer->head_sn, nssn, buffer->buf_size) &&
+                (!is_amsdu || last_subframe))
+                buffer->head_sn = nssn;
+            ieee80211_release_node(ic, ni);
+            return 0;
+        }
+
+        /*
+         * release immediately if there are no stored frames, and the sn is
+         * equal to the head.
+         * This can happen due to reorder timer, where NSSN is behind head_sn.
+         * When we released everything, and we got the next frame in the
+         * sequence, according to the NSSN we can't release immediately,
+         * while technically there is no hole and we can move forward.
+         */
+        if (!buffer->num_stored && sn == buffer->head_sn) {
+            if (!is_amsdu || last_subframe)
+                buffer->head_sn = (buffer->head_sn + 1) & 0xfff;
+            ieee80211_release_node(ic, ni);
+            return 0;
+        }
+
+        index = sn % buffer->buf_size;
+
+        /*
+         * Check if we already stored this frame
+         * As AMSDU is either received or not as whole, logic is simple:
+         * If we have frames in that position in the buffer and the last frame
+         * originated from AMSDU had a different SN then it is a
+         * retransmission. If it is the same SN then if the subframe index is
+         * incrementing it is the same AMSDU - otherwise it is a
+         * retransmission.
+         */
+        if (!ml_empty(&entries[index].frames)) {
+            if (!is_amsdu) {
+                ic->ic_stats.is_ht_rx_ba_no_buf++;
+                goto drop;
+            } else if (sn != buffer->last_amsdu ||
+                       buffer->last_sub_index >= subframe_idx) {
+                ic->ic_stats.is_ht_rx_ba_no_buf++;
+                goto drop;
+            }
+        } else {
+            /* This data is the same for all A-MSDU subframes. */
+            entries[index].chanidx = chanidx;
+            entries[index].is_shortpre = is_shortpre;
+            entries[index].rate_n_flags = rate_n_flags;
+            entries[index].device_timestamp = device_timestamp;
+            memcpy(&entries[index].rxi, rxi, sizeof(entries[index].rxi));
+        }
+
+        /* put in reorder buffer */
+        ml_enqueue(&entries[index].frames, m);
+        buffer->num_stored++;
+        getmicrouptime(&entries[index].reorder_time);
+
+        if (is_amsdu) {
+            buffer->last_amsdu = sn;
+            buffer->last_sub_index = subframe_idx;
+        }
+
+        /*
+         * We cannot trust NSSN for AMSDU sub-frames that are not the last.
+         * The reason is that NSSN advances on the first sub-frame, and may
+         * cause the reorder buffer to advance before all the sub-frames
+         * arrive.
+         * Example: reorder buffer contains SN 0 & 2, and we receive AMSDU with
+         * SN 1. NSSN for first sub frame will be 3 with the result of driver
+         * releasing SN 0,1, 2. When sub-frame 1 arrives - reorder buffer is
+         * already ahead and it will be dropped.
+         * If the last sub-frame is not on this queue - we will get frame
+         * release notification with up to date NSSN.
+         */
+        if (!is_amsdu || last_subframe)
+            release_frames(hal, sc, ni, rxba, buffer, nssn, ml);
+
+        ieee80211_release_node(ic, ni);
+        return 1;
+
+    drop:
+        mbuf_freem(m);
+        ieee80211_release_node(ic, ni);
+        return 1;
+    }
+
+    static void
+    reorder_timer_expired(void *arg)
+    {
+        struct mbuf_list ml = MBUF_LIST_INITIALIZER();
+        buffer_type *buf = (buffer_type *)arg;
+        rxba_type *rxba = T::rxba_from_buf(buf);
+        entry_type *entries = T::rx_entries(rxba, buf);
+        softc_type *sc = rxba->sc;
+        hal_type *hal = T::hal_from_softc(sc);
+        struct ieee80211com *ic = &sc->sc_ic;
+        struct ieee80211_node *ni = ic->ic_bss;
+        int i, s;
+        uint16_t sn = 0, index = 0;
+        int expired = 0;
+        int cont = 0;
+        struct timeval now, timeout, expiry;
+
+        if (!buf->num_stored || buf->removed)
+            return;
+
+        s = splnet();
+        getmicrouptime(&now);
+        USEC_TO_TIMEVAL(T::reorder_timeout_usec, &timeout);
+
+        for (i = 0; i < buf->buf_size ; i++) {
+            index = (buf->head_sn + i) % buf->buf_size;
+
+            if (ml_empty(&entries[index].frames)) {
+                /*
+                 * If there is a hole and the next frame didn't expire
+                 * we want to break and not advance SN.
+                 */
+                cont = 0;
+                continue;
+            }
+            timeradd(&entries[index].reorder_time, &timeout, &expiry);
+            if (!cont && timercmp(&now, &expiry, <))
+                break;
+
+            expired = 1;
+            /* continue until next hole after this expired frame */
+            cont = 1;
+            sn = (buf->head_sn + (i + 1)) & 0xfff;
+        }
+
+        if (expired) {
+            /* SN is set to the last expired frame + 1 */
+            release_frames(hal, sc, ni, rxba, buf, sn, &ml);
+            if_input(&sc->sc_ic.ic_if, &ml);
+            ic->ic_stats.is_ht_rx_ba_window_gap_timeout++;
+        } else {
+            /*
+             * If no frame expired and there are stored frames, index is now
+             * pointing to the first unexpired frame - modify reorder timeout
+             * accordingly.
+             */
+            timeout_add_usec(&buf->reorder_timer, T::reorder_timeout_usec);
+        }
+
+        splx(s);
+    }
+};
+
+#endif /* ItlMvmReorder_hpp */
@@ -0,0 +1,168 @@
+/*
+* Copyright (C) 2020  钟先耀
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#ifndef ItlTxLimit_hpp
+#define ItlTxLimit_hpp
+
+#include <stdint.h>
+
+/*
+ * Adaptive per-ring fill limit, in the spirit of Linux' dynamic queue
+ * limits.  The limit grows when the ring was stopped on it at one Tx
+ * completion and the hardware has gone through all of that backlog by
+ * the next one (it likely starved), and shrinks by half the smallest
+ * backlog seen over ITL_TXLIM_HOLD when the ring never drained.  It is
+ * also capped to ITL_TXLIM_AIRTIME worth of bytes at the drain rate
+ * measured from Tx completions, so slow links do not queue far more
+ * airtime than needed.
+ *
+ * The state only depends on the byte counts and timestamps the driver
+ * passes in, so it can be driven by a simulator outside the kernel.
+ */
+#define ITL_TXLIM_MIN        16384
+#define ITL_TXLIM_INIT        65536
+#define ITL_TXLIM_MAX        (1024 * 1024)
+#define ITL_TXLIM_HOLD        100000000ULL    /* 100ms, in ns */
+#define ITL_TXLIM_AIRTIME    8        /* ms */
+
+struct itl_tx_limit {
+    uint32_t    bytes;        /* bytes on the ring */
+    uint32_t    limit;
+    uint32_t    lowest_slack;
+    bool        stopped;    /* ring is stopped on the limit */
+    bool        prev_ovlimit;    /* was stopped at the last completion */
+    uint32_t    prev_backlog;    /* bytes left at the last completion */
+    uint64_t    slack_start;
+    uint64_t    last_done;
+    bool        busy;        /* ring was not empty at last_done */
+    uint32_t    rate;        /* drain rate EWMA, bytes per ms */
+};
+
+class ItlTxLimit {
+public:
+    static void
+    init(struct itl_tx_limit *lim)
+    {
+        *lim = itl_tx_limit();
+        lim->limit = ITL_TXLIM_INIT;
+        lim->lowest_slack = UINT32_MAX;
+    }
+
+    /* Forget what is on the ring, keeping what was learned about it. */
+    static void
+    reset(struct itl_tx_limit *lim)
+    {
+        lim->bytes = 0;
+        lim->stopped = false;
+        lim->prev_ovlimit = false;
+        lim->prev_backlog = 0;
+        lim->last_done = 0;
+        lim->busy = false;
+    }
+
+    /* Account len bytes put on the ring; returns whether to stop it. */
+    static bool
+    queued(struct itl_tx_limit *lim, uint32_t len)
+    {
+        lim->bytes += len;
+        if (lim->bytes >= lim->limit)
+            lim->stopped = true;
+        return lim->stopped;
+    }
+
+    /* Account len bytes taken off the ring, sent or flushed. */
+    static void
+    dequeued(struct itl_tx_limit *lim, uint32_t len)
+    {
+        lim->bytes -= lim->bytes < len ? lim->bytes : len;
+    }
+
+    static bool
+    is_open(const struct itl_tx_limit *lim)
+    {
+        return lim->bytes < lim->limit;
+    }
+
+    /*
+     * Adjust the limit after done bytes were reported sent at time now
+     * (ns), once they have been dequeued.  Only Tx completions may call
+     * this, since their timestamps also give the drain rate.
+     */
+    static void
+    completed(struct itl_tx_limit *lim, uint32_t done, uint64_t now)
+    {
+        uint32_t limit = lim->limit, cap = ITL_TXLIM_MAX;
+        uint64_t sample;
+
+        if (done == 0)
+            return;
+
+        /*
+         * Drain rate.  An interval that started on an empty ring includes
+         * idle time and only bounds the rate from below, which is still
+         * needed to lift the cap again after the link sped up.
+         */
+        if (lim->last_done != 0 && now > lim->last_done) {
+            sample = (uint64_t)done * 1000000 / (now - lim->last_done);
+            if (sample > ITL_TXLIM_MAX)
+                sample = ITL_TXLIM_MAX;
+            if (lim->rate == 0)
+                lim->rate = (uint32_t)sample;
+            else if (lim->busy || sample > lim->rate)
+                lim->rate = (lim->rate * 7 + (uint32_t)sample) / 8;
+        }
+        lim->last_done = now;
+        lim->busy = lim->bytes != 0;
+
+        /*
+         * The ring reopens as soon as it drops below the limit and may be
+         * refilled before the next completion, so an empty ring at that
+         * point is not the only sign of starvation: also look at whether
+         * the backlog left at the previous completion, while stopped on
+         * the limit, has been sent in full since.
+         */
+        if ((lim->stopped && lim->bytes == 0) ||
+            (lim->prev_ovlimit && done >= lim->prev_backlog)) {
+            limit += done;
+            lim->slack_start = now;
+            lim->lowest_slack = UINT32_MAX;
+        } else if (lim->bytes != 0) {
+            /* Backlog that never drained was not needed to keep busy. */
+            if (lim->bytes < lim->lowest_slack)
+                lim->lowest_slack = lim->bytes;
+            if (now - lim->slack_start > ITL_TXLIM_HOLD) {
+                limit -= limit < lim->lowest_slack / 2 ? limit :
+                    lim->lowest_slack / 2;
+                lim->slack_start = now;
+                lim->lowest_slack = UINT32_MAX;
+            }
+        }
+        lim->prev_ovlimit = lim->stopped && lim->bytes != 0;
+        lim->prev_backlog = lim->bytes;
+
+        if (lim->rate != 0 && lim->rate * ITL_TXLIM_AIRTIME < cap)
+            cap = lim->rate * ITL_TXLIM_AIRTIME;
+        if (cap < ITL_TXLIM_MIN)
+            cap = ITL_TXLIM_MIN;
+        if (limit < ITL_TXLIM_MIN)
+            limit = ITL_TXLIM_MIN;
+        if (limit > cap)
+            limit = cap;
+        lim->limit = limit;
+        if (lim->bytes < limit)
+            lim->stopped = false;
+    }
+};
+
+#endif /* ItlTxLimit_hpp */
@@ -108,6 +108,7 @@ ieee80211_begin_bgscan(struct _ifnet *ifp)
         return;
     }
     
+    ieee80211_chanhist_prepare(ic);
     if (ic->ic_bgscan_start != NULL && ic->ic_bgscan_start(ic) == 0) {
         /*
          * Free the nodes table to ensure we get an up-to-date view
@@ -124,7 +125,8 @@ ieee80211_begin_bgscan(struct _ifnet *ifp)
             XYLog("%s: begin background scan\n", ifp->if_xname);
         
         /* Driver calls ieee80211_end_scan() when done. */
-    }
+    } else
+        ic->ic_chanhist.ch_partial = 0;
 }
 
 void
@@ -149,6 +151,8 @@ ieee80211_begin_cache_bgscan(struct _ifnet *ifp)
     }
     ic->ic_last_cache_scan_ts = tv.tv_sec;
     
+    /* Cache scans must report all networks around us. */
+    ic->ic_chanhist.ch_partial = 0;
     if (ic->ic_bgscan_start != NULL && ic->ic_bgscan_start(ic) == 0) {
         ic->ic_flags |= IEEE80211_F_BGSCAN;
         DPRINTF(("%s: begin cache background scan\n", ifp->if_xname));
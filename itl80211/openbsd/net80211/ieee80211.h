@@ -694,6 +694,20 @@ enum {
 #define IEEE80211_ACTION_SA_QUERY_REQ	0
 #define IEEE80211_ACTION_SA_QUERY_RESP	1
 
+/*
+ * Radio Measurement Action field values (see 802.11-2016 9.6.7.1
+ * Table 9-333).
+ */
+#define IEEE80211_ACTION_RM_NEIGHBOR_REQ	4
+#define IEEE80211_ACTION_RM_NEIGHBOR_RESP	5
+
+/*
+ * WNM Action field values (see 802.11-2016 9.6.14.1 Table 9-364).
+ */
+#define IEEE80211_ACTION_BTM_QUERY		6
+#define IEEE80211_ACTION_BTM_REQ		7
+#define IEEE80211_ACTION_BTM_RESP		8
+
 /*
  * HT Action field values (see 802.11-2012 8.5.12 Table 8-229).
  */
@@ -963,6 +977,7 @@ enum ieee80211_edca_ac {
  */
 #define IEEE80211_AUTH_ALG_OPEN			0x0000
 #define IEEE80211_AUTH_ALG_SHARED		0x0001
+#define IEEE80211_AUTH_ALG_FT			0x0002	/* 11r */
 #define IEEE80211_AUTH_ALG_LEAP			0x0080
 
 /*
@@ -1236,6 +1251,81 @@ struct ieee80211_ptk {
 #define IEEE80211_PMKID_LEN	16
 #define IEEE80211_SMKID_LEN	16
 
+/*
+ * Mobility Domain element (see 802.11-2016 9.4.2.47).
+ */
+#define IEEE80211_MDE_LEN		3
+#define IEEE80211_MDE_FT_OVER_DS	0x01
+#define IEEE80211_MDE_FT_RESOURCE_REQ	0x02
+
+/*
+ * Fast BSS Transition element (see 802.11-2016 9.4.2.48).
+ * Offsets are relative to the start of the element body.
+ */
+#define IEEE80211_FTE_MIC_OFF		2	/* after MIC Control */
+#define IEEE80211_FTE_MIC_LEN		16
+#define IEEE80211_FTE_ANONCE_OFF	18
+#define IEEE80211_FTE_SNONCE_OFF	50
+#define IEEE80211_FTE_SUBELEM_OFF	82
+#define IEEE80211_FTE_SUBELEM_R1KH_ID	1
+#define IEEE80211_FTE_SUBELEM_GTK	2
+#define IEEE80211_FTE_SUBELEM_R0KH_ID	3
+#define IEEE80211_FTE_SUBELEM_IGTK	4
+#define IEEE80211_FT_R0KH_MAXLEN	48
+#define IEEE80211_FTE_MAXLEN					\
+	(IEEE80211_FTE_SUBELEM_OFF +				\
+	 2 + IEEE80211_ADDR_LEN +	/* R1KH-ID */		\
+	 2 + IEEE80211_FT_R0KH_MAXLEN)	/* R0KH-ID */
+
+/*
+ * RM Enabled Capabilities element (see 802.11-2016 9.4.2.45). We only
+ * advertise support for neighbor reports.
+ */
+#define IEEE80211_RMCAP_LEN		5
+#define IEEE80211_RMCAP_NBR_REPORT	0x02	/* octet 0 */
+
+/*
+ * Neighbor Report element (see 802.11-2016 9.4.2.37): BSSID, BSSID
+ * Information, Operating Class, Channel Number and PHY Type, followed
+ * by optional subelements.
+ */
+#define IEEE80211_NBR_REPORT_MINLEN	13
+#define IEEE80211_NBR_BSSINFO_REACH_MASK	0x00000003
+#define IEEE80211_NBR_BSSINFO_REACH_NO		1
+#define IEEE80211_NBR_BSSINFO_REACH_UNKNOWN	2
+#define IEEE80211_NBR_BSSINFO_REACH_YES		3
+#define IEEE80211_NBR_BSSINFO_SECURITY		0x00000004
+#define IEEE80211_NBR_BSSINFO_KEYSCOPE		0x00000008
+#define IEEE80211_NBR_BSSINFO_MDID		0x00000400
+#define IEEE80211_NBR_BSSINFO_HT		0x00000800
+#define IEEE80211_NBR_BSSINFO_VHT		0x00001000
+#define IEEE80211_NBR_SUBELEM_BTM_PREF		3
+
+/*
+ * Extended Capabilities element (see 802.11-2016 9.4.2.27). We only
+ * advertise BSS Transition Management support.
+ */
+#define IEEE80211_XCAPS_LEN		3
+#define IEEE80211_XCAPS_BSS_TRANS	0x08	/* octet 2 */
+
+/*
+ * BSS Transition Management Request frame (see 802.11-2016 9.6.14.9).
+ */
+#define IEEE80211_BTM_REQ_CAND_LIST	0x01	/* Preferred Candidate List */
+#define IEEE80211_BTM_REQ_ABRIDGED	0x02
+#define IEEE80211_BTM_REQ_DISASSOC	0x04	/* Disassociation Imminent */
+#define IEEE80211_BTM_REQ_BSS_TERM	0x08	/* BSS Termination Included */
+#define IEEE80211_BTM_REQ_ESS_DISASSOC	0x10	/* ESS Disassoc. Imminent */
+#define IEEE80211_BTM_BSS_TERM_LEN	12	/* BSS Termination Duration */
+
+/*
+ * BSS Transition Management Response status codes (see 802.11-2016
+ * 9.6.14.10 Table 9-365).
+ */
+#define IEEE80211_BTM_STATUS_ACCEPT		0
+#define IEEE80211_BTM_STATUS_REJECT_UNSPEC	1
+#define IEEE80211_BTM_STATUS_REJECT_NO_CAND	7
+
 /*
  * Key Data Encapsulation (see Table 62).
  */
@@ -472,6 +472,145 @@ ieee80211_derive_pmkid(enum ieee80211_akm akm, const u_int8_t *pmk,
 		ieee80211_pmkid_sha1(pmk, aa, spa, pmkid);
 }
 
+/*
+ * Derive the top of the FT key hierarchy, PMK-R0, along with its name
+ * PMKR0Name (see 802.11-2016 12.7.1.7.3).  For FT-PSK the XXKey is the
+ * PSK itself.
+ */
+void
+ieee80211_derive_pmk_r0(const u_int8_t *xxkey, const u_int8_t *ssid,
+    u_int ssidlen, const u_int8_t *mdid, const u_int8_t *r0kh,
+    u_int r0khlen, const u_int8_t *s0kh, u_int8_t *pmk_r0,
+    u_int8_t *pmk_r0_name)
+{
+	u_int8_t buf[1 + IEEE80211_NWID_LEN + 2 + 1 +
+	    IEEE80211_FT_R0KH_MAXLEN + IEEE80211_ADDR_LEN];
+	u_int8_t r0kd[IEEE80211_PMK_LEN + 16];
+	u_int8_t digest[SHA256_DIGEST_LENGTH];
+	SHA2_CTX ctx;
+	u_int8_t *frm = buf;
+
+	/* SSIDlength || SSID || MDID || R0KHlength || R0KH-ID || S0KH-ID */
+	*frm++ = ssidlen;
+	memcpy(frm, ssid, ssidlen); frm += ssidlen;
+	memcpy(frm, mdid, 2); frm += 2;
+	*frm++ = r0khlen;
+	memcpy(frm, r0kh, r0khlen); frm += r0khlen;
+	IEEE80211_ADDR_COPY(frm, s0kh); frm += IEEE80211_ADDR_LEN;
+
+	ieee80211_kdf(xxkey, IEEE80211_PMK_LEN, (const u_int8_t *)"FT-R0", 5,
+	    buf, frm - buf, r0kd, sizeof(r0kd));
+	memcpy(pmk_r0, r0kd, IEEE80211_PMK_LEN);
+
+	/* PMKR0Name = Truncate-128(SHA-256("FT-R0N" || PMK-R0Name-Salt)) */
+	SHA256Init(&ctx);
+	SHA256Update(&ctx, "FT-R0N", 6);
+	SHA256Update(&ctx, &r0kd[IEEE80211_PMK_LEN], 16);
+	SHA256Final(digest, &ctx);
+	memcpy(pmk_r0_name, digest, IEEE80211_PMKID_LEN);
+
+	explicit_bzero(r0kd, sizeof(r0kd));
+}
+
+/*
+ * Derive the key held by the target AP, PMK-R1, and its name PMKR1Name
+ * (see 802.11-2016 12.7.1.7.4).
+ */
+void
+ieee80211_derive_pmk_r1(const u_int8_t *pmk_r0, const u_int8_t *pmk_r0_name,
+    const u_int8_t *r1kh, const u_int8_t *s1kh, u_int8_t *pmk_r1,
+    u_int8_t *pmk_r1_name)
+{
+	u_int8_t buf[2 * IEEE80211_ADDR_LEN];
+	u_int8_t digest[SHA256_DIGEST_LENGTH];
+	SHA2_CTX ctx;
+
+	IEEE80211_ADDR_COPY(&buf[0], r1kh);
+	IEEE80211_ADDR_COPY(&buf[IEEE80211_ADDR_LEN], s1kh);
+	ieee80211_kdf(pmk_r0, IEEE80211_PMK_LEN, (const u_int8_t *)"FT-R1", 5,
+	    buf, sizeof(buf), pmk_r1, IEEE80211_PMK_LEN);
+
+	/* PMKR1Name = Truncate-128(SHA-256("FT-R1N" || PMKR0Name || ...)) */
+	SHA256Init(&ctx);
+	SHA256Update(&ctx, "FT-R1N", 6);
+	SHA256Update(&ctx, pmk_r0_name, IEEE80211_PMKID_LEN);
+	SHA256Update(&ctx, buf, sizeof(buf));
+	SHA256Final(digest, &ctx);
+	memcpy(pmk_r1_name, digest, IEEE80211_PMKID_LEN);
+}
+
+/*
+ * Derive the PTK of an FT AKM from PMK-R1 (see 802.11-2016 12.7.1.7.5).
+ * Unlike ieee80211_derive_ptk() the KDF output length depends on the
+ * pairwise cipher, so only the needed part of the PTK is filled in.
+ */
+void
+ieee80211_derive_ft_ptk(const u_int8_t *pmk_r1, const u_int8_t *snonce,
+    const u_int8_t *anonce, const u_int8_t *bssid, const u_int8_t *sta,
+    enum ieee80211_cipher cipher, struct ieee80211_ptk *ptk)
+{
+	u_int8_t buf[2 * EAPOL_KEY_NONCE_LEN + 2 * IEEE80211_ADDR_LEN];
+
+	memcpy(&buf[0], snonce, EAPOL_KEY_NONCE_LEN);
+	memcpy(&buf[32], anonce, EAPOL_KEY_NONCE_LEN);
+	IEEE80211_ADDR_COPY(&buf[64], bssid);
+	IEEE80211_ADDR_COPY(&buf[70], sta);
+
+	memset(ptk, 0, sizeof(*ptk));
+	ieee80211_kdf(pmk_r1, IEEE80211_PMK_LEN, (const u_int8_t *)"FT-PTK", 6,
+	    buf, sizeof(buf), (u_int8_t *)ptk,
+	    sizeof(ptk->kck) + sizeof(ptk->kek) +
+	    ieee80211_cipher_keylen(cipher));
+}
+
+/*
+ * Compute the MIC field of a Fast BSS Transition element carried in a
+ * Reassociation Request (seq 5) or Response (seq 6) frame, see
+ * 802.11-2016 13.8.4.  The MIC field of the FTE is taken as zero.
+ */
+void
+ieee80211_ft_mic(const u_int8_t *kck, const u_int8_t *sta,
+    const u_int8_t *bssid, u_int8_t seq, const u_int8_t *rsnie,
+    const u_int8_t *mde, const u_int8_t *fte, u_int8_t *mic)
+{
+	static const u_int8_t zero[IEEE80211_FTE_MIC_LEN] = { 0 };
+	AES_CMAC_CTX ctx;
+
+	AES_CMAC_Init(&ctx);
+	AES_CMAC_SetKey(&ctx, kck);
+	AES_CMAC_Update(&ctx, sta, IEEE80211_ADDR_LEN);
+	AES_CMAC_Update(&ctx, bssid, IEEE80211_ADDR_LEN);
+	AES_CMAC_Update(&ctx, &seq, 1);
+	AES_CMAC_Update(&ctx, rsnie, 2 + rsnie[1]);
+	AES_CMAC_Update(&ctx, mde, 2 + mde[1]);
+	AES_CMAC_Update(&ctx, fte, 2 + IEEE80211_FTE_MIC_OFF);
+	AES_CMAC_Update(&ctx, zero, sizeof(zero));
+	AES_CMAC_Update(&ctx, &fte[2 + IEEE80211_FTE_MIC_OFF +
+	    IEEE80211_FTE_MIC_LEN],
+	    fte[1] - IEEE80211_FTE_MIC_OFF - IEEE80211_FTE_MIC_LEN);
+	AES_CMAC_Final(mic, &ctx);
+}
+
+/*
+ * Unwrap a group key delivered in a GTK or IGTK subelement of the FTE
+ * using the KEK of the PTK.  The output is 8 bytes shorter than the input.
+ */
+int
+ieee80211_ft_unwrap_key(const u_int8_t *kek, const u_int8_t *in,
+    u_int len, u_int8_t *out)
+{
+	aes_key_wrap_ctx ctx;
+	int error;
+
+	/* Wrapped Key length must be a multiple of 8 */
+	if (len < 16 + 8 || (len & 7) != 0)
+		return 1;
+	aes_key_wrap_set_key(&ctx, kek, 16);
+	error = aes_key_unwrap(&ctx, in, out, (len - 8) / 8);
+	explicit_bzero(&ctx, sizeof(ctx));
+	return error;
+}
+
 typedef union _ANY_CTX {
 	HMAC_MD5_CTX	md5;
 	HMAC_SHA1_CTX	sha1;
@@ -59,7 +59,8 @@ enum ieee80211_akm {
 	IEEE80211_AKM_8021X		= 0x00000001,
 	IEEE80211_AKM_PSK		= 0x00000002,
 	IEEE80211_AKM_SHA256_8021X	= 0x00000004,	/* 11w */
-	IEEE80211_AKM_SHA256_PSK	= 0x00000008	/* 11w */
+	IEEE80211_AKM_SHA256_PSK	= 0x00000008,	/* 11w */
+	IEEE80211_AKM_FT_PSK		= 0x00000010	/* 11r */
 };
 
 #define IEEE80211_TKIP_HDRLEN	8
@@ -95,7 +96,14 @@ static __inline int
 ieee80211_is_sha256_akm(enum ieee80211_akm akm)
 {
 	return akm == IEEE80211_AKM_SHA256_8021X ||
-	    akm == IEEE80211_AKM_SHA256_PSK;
+	    akm == IEEE80211_AKM_SHA256_PSK ||
+	    akm == IEEE80211_AKM_FT_PSK;
+}
+
+static __inline int
+ieee80211_is_ft_akm(enum ieee80211_akm akm)
+{
+	return akm == IEEE80211_AKM_FT_PSK;
 }
 
 struct ieee80211_key {
@@ -173,6 +181,19 @@ void	ieee80211_derive_ptk(enum ieee80211_akm, const u_int8_t *,
 	    const u_int8_t *, const u_int8_t *, const u_int8_t *,
 	    const u_int8_t *, struct ieee80211_ptk *);
 int	ieee80211_cipher_keylen(enum ieee80211_cipher);
+void	ieee80211_derive_pmk_r0(const u_int8_t *, const u_int8_t *, u_int,
+	    const u_int8_t *, const u_int8_t *, u_int, const u_int8_t *,
+	    u_int8_t *, u_int8_t *);
+void	ieee80211_derive_pmk_r1(const u_int8_t *, const u_int8_t *,
+	    const u_int8_t *, const u_int8_t *, u_int8_t *, u_int8_t *);
+void	ieee80211_derive_ft_ptk(const u_int8_t *, const u_int8_t *,
+	    const u_int8_t *, const u_int8_t *, const u_int8_t *,
+	    enum ieee80211_cipher, struct ieee80211_ptk *);
+void	ieee80211_ft_mic(const u_int8_t *, const u_int8_t *,
+	    const u_int8_t *, u_int8_t, const u_int8_t *, const u_int8_t *,
+	    const u_int8_t *, u_int8_t *);
+int	ieee80211_ft_unwrap_key(const u_int8_t *, const u_int8_t *, u_int,
+	    u_int8_t *);
 
 int	ieee80211_wep_set_key(struct ieee80211com *, struct ieee80211_key *);
 void	ieee80211_wep_delete_key(struct ieee80211com *,
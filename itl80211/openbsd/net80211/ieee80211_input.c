@@ -132,6 +132,10 @@ void    ieee80211_recv_sa_query_req(struct ieee80211com *, mbuf_t,
 void    ieee80211_recv_sa_query_resp(struct ieee80211com *, mbuf_t,
                                      struct ieee80211_node *);
 #endif
+void    ieee80211_recv_nbr_resp(struct ieee80211com *, mbuf_t,
+                                struct ieee80211_node *);
+void    ieee80211_recv_btm_req(struct ieee80211com *, mbuf_t,
+                               struct ieee80211_node *);
 void    ieee80211_recv_action(struct ieee80211com *, mbuf_t,
                               struct ieee80211_node *);
 #ifndef IEEE80211_STA_ONLY
@@ -439,14 +443,25 @@ ieee80211_inputm(struct _ifnet *ifp, mbuf_t m, struct ieee80211_node *ni,
         ni->ni_inact = 0;
         
         if (ic->ic_state == IEEE80211_S_RUN && ic->ic_bgscan_start) {
-            /* Cancel or start background scan based on RSSI. */
-            if ((*ic->ic_node_checkrssi)(ic, ni))
+            int roam;
+            
+            if (ni == ic->ic_bss)
+                ieee80211_roam_input(ic, ni);
+            /*
+             * Cancel or start background scan based on RSSI, its
+             * trend, and TX failures.
+             */
+            roam = ieee80211_roam_needed(ic);
+            if (roam == IEEE80211_ROAM_NONE)
                 timeout_del(&ic->ic_bgscan_timeout);
             else if (!timeout_pending(&ic->ic_bgscan_timeout) &&
                      (ic->ic_flags & IEEE80211_F_BGSCAN) == 0 &&
-                     (ic->ic_flags & IEEE80211_F_DESBSSID) == 0)
+                     (ic->ic_flags & IEEE80211_F_DESBSSID) == 0) {
+                if (roam == IEEE80211_ROAM_EARLY)
+                    ic->ic_roam.r_early++;
                 timeout_add_msec(&ic->ic_bgscan_timeout,
                                  500 * (ic->ic_bgscan_fail + 1));
+            }
         }
     }
     
@@ -1270,6 +1285,12 @@ ieee80211_amsdu_decap(struct ieee80211com *ic, mbuf_t m,
     wh = mtod(m, struct ieee80211_frame *);
     mcast = IEEE80211_IS_MULTICAST(wh->i_addr1);
     
+    /*
+     * Checksum status reported by hardware for the A-MSDU as a whole
+     * does not apply to the individual subframes split off below.
+     */
+    mbuf_clear_csum_performed(m);
+    
     /* strip 802.11 header */
     mbuf_adj(m, hdrlen);
     
@@ -1459,6 +1480,8 @@ ieee80211_parse_rsn_akm(const u_int8_t selector[4])
                 return IEEE80211_AKM_8021X;
             case 2:    /* PSK */
                 return IEEE80211_AKM_PSK;
+            case 4:    /* FT using PSK (802.11r) */
+                return IEEE80211_AKM_FT_PSK;
             case 5:    /* IEEE 802.1X with SHA256 KDF */
                 return IEEE80211_AKM_SHA256_8021X;
             case 6:    /* PSK with SHA256 KDF */
@@ -1668,6 +1691,10 @@ ieee80211_recv_probe_resp(struct ieee80211com *ic, mbuf_t m,
     const uint8_t *vhtopmode;
     const uint8_t *hecap;
     const uint8_t *heopmode;
+    const uint8_t *bssload;
+    const uint8_t *mde;
+    const uint8_t *rmcap;
+    const uint8_t *xcaps;
     u_int16_t capinfo, bintval;
     u_int8_t chan, bchan, erp, dtim_count, dtim_period;
     int is_new;
@@ -1708,7 +1735,7 @@ ieee80211_recv_probe_resp(struct ieee80211com *ic, mbuf_t m,
     capinfo = LE_READ_2(frm); frm += 2;
     
     ssid = rates = xrates = edcaie = wmmie = rsnie = wpaie = csa = vhtcap = vhtopmode = hecap = heopmode = NULL;
-    htcaps = htop = NULL;
+    htcaps = htop = bssload = mde = rmcap = xcaps = NULL;
     if (rxi->rxi_chan)
          bchan = rxi->rxi_chan;
      else
@@ -1772,6 +1799,30 @@ ieee80211_recv_probe_resp(struct ieee80211com *ic, mbuf_t m,
                     dtim_period = frm[3];
                 }
                 break;
+            case IEEE80211_ELEMID_QBSS_LOAD:
+                if (frm[1] < 5) {
+                    ic->ic_stats.is_rx_elem_toosmall++;
+                    break;
+                }
+                bssload = frm;
+                break;
+            case IEEE80211_ELEMID_MDE:
+                if (frm[1] < IEEE80211_MDE_LEN) {
+                    ic->ic_stats.is_rx_elem_toosmall++;
+                    break;
+                }
+                mde = frm;
+                break;
+            case IEEE80211_ELEMID_RM:
+                if (frm[1] < IEEE80211_RMCAP_LEN) {
+                    ic->ic_stats.is_rx_elem_toosmall++;
+                    break;
+                }
+                rmcap = frm;
+                break;
+            case IEEE80211_ELEMID_XCAPS:
+                xcaps = frm;
+                break;
             case IEEE80211_ELEMID_VENDOR:
                 if (frm[1] < 4) {
                     ic->ic_stats.is_rx_elem_toosmall++;
@@ -1877,7 +1928,7 @@ ieee80211_recv_probe_resp(struct ieee80211com *ic, mbuf_t m,
 #endif
     
     if ((ni = ieee80211_find_node(ic, wh->i_addr2)) == NULL) {
-        ni = ieee80211_alloc_node(ic, wh->i_addr2);
+        ni = ieee80211_alloc_scan_node(ic, wh->i_addr2);
         if (ni == NULL)
             return;
         is_new = 1;
@@ -1898,10 +1949,32 @@ ieee80211_recv_probe_resp(struct ieee80211com *ic, mbuf_t m,
     if (hecap != NULL && heopmode != NULL) {
         ieee80211_setup_hecaps(ni, hecap + 3, hecap[1] - 1);
         ieee80211_setup_heop(ni, heopmode + 3, heopmode[1] - 1);
-    }
+    } else
+        ni->ni_flags &= ~IEEE80211_NODE_HECAP;
     
     ni->ni_dtimcount = dtim_count;
     ni->ni_dtimperiod = dtim_period;
+    if (bssload != NULL) {
+        ni->ni_bssload_stacnt = LE_READ_2(bssload + 2);
+        ni->ni_bssload_chutil = bssload[4];
+        ni->ni_flags |= IEEE80211_NODE_BSSLOAD;
+    } else
+        ni->ni_flags &= ~IEEE80211_NODE_BSSLOAD;
+    if (mde != NULL) {
+        memcpy(ni->ni_mdid, mde + 2, 2);
+        ni->ni_ftcap = mde[4];
+        ni->ni_flags |= IEEE80211_NODE_MDE;
+    } else
+        ni->ni_flags &= ~IEEE80211_NODE_MDE;
+    if (rmcap != NULL && (rmcap[2] & IEEE80211_RMCAP_NBR_REPORT))
+        ni->ni_flags |= IEEE80211_NODE_RMCAP;
+    else
+        ni->ni_flags &= ~IEEE80211_NODE_RMCAP;
+    if (xcaps != NULL && xcaps[1] >= IEEE80211_XCAPS_LEN &&
+        (xcaps[4] & IEEE80211_XCAPS_BSS_TRANS))
+        ni->ni_flags |= IEEE80211_NODE_BTM;
+    else
+        ni->ni_flags &= ~IEEE80211_NODE_BTM;
 #ifdef AIRPORT
     ni->ni_age_ts = airport_up_time();
 #endif
@@ -2113,6 +2186,9 @@ ieee80211_recv_probe_resp(struct ieee80211com *ic, mbuf_t m,
             ni->ni_rssi = rxi->rxi_rssi;
     } else
         ni->ni_rssi = rxi->rxi_rssi;
+    ni->ni_scanseq = ic->ic_scanseq;
+    ieee80211_roam_neighbor(ic, ni);
+    ieee80211_chanhist_add(ic, ni);
     ni->ni_rstamp = rxi->rxi_tstamp;
     memcpy(ni->ni_tstamp, tstamp, sizeof(ni->ni_tstamp));
     ni->ni_intval = bintval;
@@ -2231,6 +2307,288 @@ ieee80211_recv_probe_req(struct ieee80211com *ic, mbuf_t m,
 }
 #endif	/* IEEE80211_STA_ONLY */
 
+/*
+ * Find a subelement of a Fast BSS Transition element.
+ */
+static const u_int8_t *
+ieee80211_ft_subelem(const u_int8_t *fte, u_int8_t id)
+{
+    const u_int8_t *frm, *efrm;
+    
+    frm = fte + 2 + IEEE80211_FTE_SUBELEM_OFF;
+    efrm = fte + 2 + fte[1];
+    while (frm + 2 <= efrm) {
+        if (frm + 2 + frm[1] > efrm)
+            break;
+        if (frm[0] == id)
+            return frm;
+        frm += 2 + frm[1];
+    }
+    return NULL;
+}
+
+/*
+ * Check that the RSNE of an FT frame names the expected PMK and that the
+ * MDE and FTE belong to the current transition.
+ */
+static int
+ieee80211_ft_check_ies(struct ieee80211com *ic, const u_int8_t *rsnie,
+                       const u_int8_t *mde, const u_int8_t *fte, const u_int8_t *pmkid)
+{
+    struct ieee80211_ft *ft = &ic->ic_ft;
+    struct ieee80211_rsnparams rsn;
+    const u_int8_t *r0kh;
+    
+    if (rsnie == NULL || mde == NULL || fte == NULL ||
+        fte[1] < IEEE80211_FTE_SUBELEM_OFF)
+        return 1;
+    if (memcmp(&mde[2], ft->ft_mdid, 2) != 0)
+        return 1;
+    if (ieee80211_parse_rsn(ic, rsnie, &rsn) != 0 ||
+        rsn.rsn_npmkids != 1 ||
+        memcmp(rsn.rsn_pmkids, pmkid, IEEE80211_PMKID_LEN) != 0)
+        return 1;
+    if (memcmp(&fte[2 + IEEE80211_FTE_SNONCE_OFF], ft->ft_snonce,
+               EAPOL_KEY_NONCE_LEN) != 0)
+        return 1;
+    r0kh = ieee80211_ft_subelem(fte, IEEE80211_FTE_SUBELEM_R0KH_ID);
+    if (r0kh == NULL || r0kh[1] != ft->ft_r0khlen ||
+        memcmp(&r0kh[2], ft->ft_r0kh, ft->ft_r0khlen) != 0)
+        return 1;
+    return 0;
+}
+
+/*
+ * Give up on an 802.11r transition and authenticate to the target AP with
+ * open system authentication and a 4-way handshake instead.
+ */
+static void
+ieee80211_ft_fallback(struct ieee80211com *ic)
+{
+    struct ieee80211_ft *ft = &ic->ic_ft;
+    
+    DPRINTF(("FT to %s failed, falling back to full authentication\n",
+             ether_sprintf(ic->ic_bss->ni_bssid)));
+    ft->ft_flags &= ~(IEEE80211_FT_F_VALID | IEEE80211_FT_F_ROAM);
+    ft->ft_nfallback++;
+    ic->ic_bss->ni_flags &= ~IEEE80211_NODE_PMKID;
+    IEEE80211_SEND_MGMT(ic, ic->ic_bss, IEEE80211_FC0_SUBTYPE_AUTH,
+                        IEEE80211_AUTH_OPEN_REQUEST);
+}
+
+/*
+ * Process an FT Authentication Response (see 802.11-2016 13.5.2), derive
+ * PMK-R1 and the PTK for the target AP and go on to reassociation.
+ */
+static void
+ieee80211_recv_ft_auth(struct ieee80211com *ic,
+                       const struct ieee80211_frame *wh, const u_int8_t *frm,
+                       const u_int8_t *efrm, u_int16_t seq, u_int16_t status)
+{
+    struct ieee80211_ft *ft = &ic->ic_ft;
+    struct ieee80211_node *ni = ic->ic_bss;
+    const u_int8_t *rsnie, *mde, *fte, *r1kh;
+    
+    if (ic->ic_state != IEEE80211_S_AUTH ||
+        !ieee80211_ft_roaming(ic, ni) ||
+        !IEEE80211_ADDR_EQ(wh->i_addr3, ni->ni_bssid) ||
+        seq != IEEE80211_AUTH_OPEN_RESPONSE) {
+        ic->ic_stats.is_rx_bad_auth++;
+        return;
+    }
+    if (status != IEEE80211_STATUS_SUCCESS) {
+        ic->ic_stats.is_rx_auth_fail++;
+        ieee80211_ft_fallback(ic);
+        return;
+    }
+    
+    rsnie = mde = fte = NULL;
+    while (frm + 2 <= efrm) {
+        if (frm + 2 + frm[1] > efrm)
+            break;
+        switch (frm[0]) {
+            case IEEE80211_ELEMID_RSN:
+                rsnie = frm;
+                break;
+            case IEEE80211_ELEMID_MDE:
+                if (frm[1] >= IEEE80211_MDE_LEN)
+                    mde = frm;
+                break;
+            case IEEE80211_ELEMID_FTE:
+                fte = frm;
+                break;
+        }
+        frm += 2 + frm[1];
+    }
+    if (ieee80211_ft_check_ies(ic, rsnie, mde, fte,
+                               ft->ft_pmk_r0_name) != 0 ||
+        (r1kh = ieee80211_ft_subelem(fte,
+                                     IEEE80211_FTE_SUBELEM_R1KH_ID)) == NULL ||
+        r1kh[1] != IEEE80211_ADDR_LEN) {
+        ic->ic_stats.is_rx_elem_missing++;
+        ieee80211_ft_fallback(ic);
+        return;
+    }
+    IEEE80211_ADDR_COPY(ft->ft_r1kh, &r1kh[2]);
+    memcpy(ft->ft_anonce, &fte[2 + IEEE80211_FTE_ANONCE_OFF],
+           EAPOL_KEY_NONCE_LEN);
+    
+    /* PMK-R1 and PTK for the target AP */
+    ieee80211_derive_pmk_r1(ft->ft_pmk_r0, ft->ft_pmk_r0_name, ft->ft_r1kh,
+                            ic->ic_myaddr, ni->ni_pmk, ft->ft_pmk_r1_name);
+    ni->ni_flags |= IEEE80211_NODE_PMK;
+    ieee80211_derive_ft_ptk(ni->ni_pmk, ft->ft_snonce, ft->ft_anonce,
+                            ni->ni_bssid, ic->ic_myaddr, ni->ni_rsncipher, &ni->ni_ptk);
+    /* the reassociation request names PMK-R1 */
+    memcpy(ni->ni_pmkid, ft->ft_pmk_r1_name, IEEE80211_PMKID_LEN);
+    ni->ni_flags |= IEEE80211_NODE_PMKID;
+    
+    /* drop the previous AP's pairwise key, as open authentication does */
+    ni->ni_flags &= ~IEEE80211_NODE_TXRXPROT;
+    ni->ni_port_valid = 0;
+    ni->ni_replaycnt_ok = 0;
+    (*ic->ic_delete_key)(ic, ni, &ni->ni_pairwise_key);
+    
+    ieee80211_new_state(ic, IEEE80211_S_ASSOC,
+                        wh->i_fc[0] & IEEE80211_FC0_SUBTYPE_MASK);
+}
+
+/*
+ * Remember the MDE and FTE of a (Re)Association Response; message 2 of
+ * the 4-way handshake must repeat them.
+ */
+static int
+ieee80211_ft_save_ies(struct ieee80211_ft *ft, const u_int8_t *mde,
+                      const u_int8_t *fte)
+{
+    if (2 + mde[1] + 2 + fte[1] > sizeof(ft->ft_ie))
+        return 1;
+    memcpy(ft->ft_ie, mde, 2 + mde[1]);
+    memcpy(&ft->ft_ie[2 + mde[1]], fte, 2 + fte[1]);
+    ft->ft_ielen = 2 + mde[1] + 2 + fte[1];
+    return 0;
+}
+
+/*
+ * Process the MDE and FTE of a (Re)Association Response when the FT-PSK
+ * AKM is used.  For the initial association within a mobility domain the
+ * key holder IDs are recorded for the 4-way handshake; for a transition
+ * the FTE MIC is verified and the keys it carries are unwrapped.
+ */
+static int
+ieee80211_ft_assoc_resp(struct ieee80211com *ic, struct ieee80211_node *ni,
+                        const u_int8_t *rsnie, const u_int8_t *mde, const u_int8_t *fte)
+{
+    struct ieee80211_ft *ft = &ic->ic_ft;
+    const u_int8_t *r0kh, *r1kh, *gtk, *igtk;
+    u_int8_t mic[IEEE80211_FTE_MIC_LEN];
+    u_int8_t key[32 + 8];
+    struct ieee80211_key *k;
+    int keylen, kid;
+    
+    if (mde == NULL || fte == NULL || fte[1] < IEEE80211_FTE_SUBELEM_OFF)
+        return 1;
+    
+    if (!ieee80211_ft_roaming(ic, ni)) {
+        r0kh = ieee80211_ft_subelem(fte, IEEE80211_FTE_SUBELEM_R0KH_ID);
+        r1kh = ieee80211_ft_subelem(fte, IEEE80211_FTE_SUBELEM_R1KH_ID);
+        if (r0kh == NULL || r0kh[1] == 0 ||
+            r0kh[1] > IEEE80211_FT_R0KH_MAXLEN ||
+            r1kh == NULL || r1kh[1] != IEEE80211_ADDR_LEN ||
+            ieee80211_ft_save_ies(ft, mde, fte) != 0)
+            return 1;
+        /* a new key hierarchy is confirmed by message 3 */
+        ft->ft_flags &= ~IEEE80211_FT_F_VALID;
+        memcpy(ft->ft_mdid, &mde[2], 2);
+        ft->ft_esslen = ni->ni_esslen;
+        memcpy(ft->ft_essid, ni->ni_essid, ni->ni_esslen);
+        ft->ft_r0khlen = r0kh[1];
+        memcpy(ft->ft_r0kh, &r0kh[2], r0kh[1]);
+        IEEE80211_ADDR_COPY(ft->ft_r1kh, &r1kh[2]);
+        return 0;
+    }
+    
+    if (ieee80211_ft_check_ies(ic, rsnie, mde, fte,
+                               ft->ft_pmk_r1_name) != 0 ||
+        memcmp(&fte[2 + IEEE80211_FTE_ANONCE_OFF], ft->ft_anonce,
+               EAPOL_KEY_NONCE_LEN) != 0 ||
+        (r1kh = ieee80211_ft_subelem(fte,
+                                     IEEE80211_FTE_SUBELEM_R1KH_ID)) == NULL ||
+        r1kh[1] != IEEE80211_ADDR_LEN ||
+        !IEEE80211_ADDR_EQ(&r1kh[2], ft->ft_r1kh))
+        return 1;
+    
+    /* check the FTE MIC using KCK (transaction seq 6) */
+    ieee80211_ft_mic(ni->ni_ptk.kck, ic->ic_myaddr, ni->ni_bssid, 6,
+                     rsnie, mde, fte, mic);
+    if (timingsafe_bcmp(mic, &fte[2 + IEEE80211_FTE_MIC_OFF],
+                        IEEE80211_FTE_MIC_LEN) != 0) {
+        DPRINTF(("FTE MIC failed\n"));
+        ic->ic_stats.is_rx_eapol_badmic++;
+        return 1;
+    }
+    
+    /*
+     * GTK subelement: Key Info [2], Key Length [1], RSC [8], Wrapped Key.
+     */
+    gtk = ieee80211_ft_subelem(fte, IEEE80211_FTE_SUBELEM_GTK);
+    keylen = ieee80211_cipher_keylen(ni->ni_rsngroupcipher);
+    if (gtk == NULL || gtk[1] < 11 || gtk[4] != keylen ||
+        gtk[1] - 11 < keylen + 8 || gtk[1] - 11 > sizeof(key) ||
+        ieee80211_ft_unwrap_key(ni->ni_ptk.kek, &gtk[13], gtk[1] - 11,
+                                key) != 0)
+        return 1;
+    kid = LE_READ_2(&gtk[2]) & 3;
+    k = &ic->ic_nw_keys[kid];
+    memset(k, 0, sizeof(*k));
+    k->k_id = kid;
+    k->k_cipher = ni->ni_rsngroupcipher;
+    k->k_flags = IEEE80211_KEY_GROUP;
+    k->k_rsc[0] = LE_READ_6(&gtk[5]);
+    k->k_len = keylen;
+    memcpy(k->k_key, key, keylen);
+    ft->ft_gtkid = kid;
+    
+    /*
+     * IGTK subelement: Key ID [2], IPN [6], Key Length [1], Wrapped Key.
+     */
+    ft->ft_igtkid = -1;
+    if (ni->ni_flags & IEEE80211_NODE_MFP) {
+        igtk = ieee80211_ft_subelem(fte, IEEE80211_FTE_SUBELEM_IGTK);
+        if (igtk == NULL || igtk[1] != 9 + 16 + 8 || igtk[10] != 16 ||
+            ieee80211_ft_unwrap_key(ni->ni_ptk.kek, &igtk[11], 16 + 8,
+                                    key) != 0)
+            return 1;
+        kid = LE_READ_2(&igtk[2]);
+        if (kid != 4 && kid != 5)
+            return 1;
+        k = &ic->ic_nw_keys[kid];
+        memset(k, 0, sizeof(*k));
+        k->k_id = kid;
+        k->k_cipher = ni->ni_rsngroupmgmtcipher;
+        k->k_flags = IEEE80211_KEY_IGTK;
+        k->k_mgmt_rsc = LE_READ_6(&igtk[4]);
+        k->k_len = 16;
+        memcpy(k->k_key, key, k->k_len);
+        ft->ft_igtkid = kid;
+    }
+    explicit_bzero(key, sizeof(key));
+    
+    /* map PTK to 802.11 key */
+    k = &ni->ni_pairwise_key;
+    memset(k, 0, sizeof(*k));
+    k->k_cipher = ni->ni_rsncipher;
+    k->k_len = ieee80211_cipher_keylen(ni->ni_rsncipher);
+    memcpy(k->k_key, ni->ni_ptk.tk, k->k_len);
+    
+    /* for message 2 should the AP rekey the PTK later on */
+    (void)ieee80211_ft_save_ies(ft, mde, fte);
+    
+    ft->ft_flags &= ~IEEE80211_FT_F_ROAM;
+    ft->ft_flags |= IEEE80211_FT_F_SETKEYS;
+    return 0;
+}
+
 /*-
  * Authentication frame format:
  * [2] Authentication algorithm number
@@ -2259,6 +2617,12 @@ ieee80211_recv_auth(struct ieee80211com *ic, mbuf_t m,
     DPRINTF(("auth %d seq %d from %s\n", algo, seq,
              ether_sprintf((u_int8_t *)wh->i_addr2)));
     
+    if (algo == IEEE80211_AUTH_ALG_FT &&
+        ic->ic_opmode == IEEE80211_M_STA) {
+        ieee80211_recv_ft_auth(ic, wh, frm,
+                               mtod(m, u_int8_t *) + mbuf_len(m), seq, status);
+        return;
+    }
     /* only "open" auth mode is supported */
     if (algo != IEEE80211_AUTH_ALG_OPEN) {
         DPRINTF(("unsupported auth algorithm %d from %s\n",
@@ -2642,6 +3006,7 @@ ieee80211_recv_assoc_resp(struct ieee80211com *ic, mbuf_t m,
     const uint8_t *vhtopmode;
     const uint8_t *hecap;
     const uint8_t *heopmode;
+    const u_int8_t *rsnie, *mde, *fte;
     u_int16_t capinfo, status, associd;
     u_int8_t rate;
     
@@ -2684,6 +3049,7 @@ ieee80211_recv_assoc_resp(struct ieee80211com *ic, mbuf_t m,
     associd = LE_READ_2(frm); frm += 2;
     
     rates = xrates = edcaie = wmmie = htcaps = htop = vhtcap = vhtopmode = hecap = heopmode = NULL;
+    rsnie = mde = fte = NULL;
     while (frm + 2 <= efrm) {
         if (frm + 2 + frm[1] > efrm) {
             ic->ic_stats.is_rx_elem_toosmall++;
@@ -2711,6 +3077,19 @@ ieee80211_recv_assoc_resp(struct ieee80211com *ic, mbuf_t m,
             case IEEE80211_ELEMID_VHT_OPMODE:
                 vhtopmode = frm;
                 break;
+            case IEEE80211_ELEMID_RSN:
+                rsnie = frm;
+                break;
+            case IEEE80211_ELEMID_MDE:
+                if (frm[1] < IEEE80211_MDE_LEN) {
+                    ic->ic_stats.is_rx_elem_toosmall++;
+                    break;
+                }
+                mde = frm;
+                break;
+            case IEEE80211_ELEMID_FTE:
+                fte = frm;
+                break;
             case IEEE80211_ELEMID_VENDOR:
                 if (frm[1] < 4) {
                     ic->ic_stats.is_rx_elem_toosmall++;
@@ -2751,6 +3130,18 @@ ieee80211_recv_assoc_resp(struct ieee80211com *ic, mbuf_t m,
         DPRINTF(("invalid supported rates element\n"));
         return;
     }
+    if ((ic->ic_flags & IEEE80211_F_RSNON) &&
+        ieee80211_is_ft_akm((enum ieee80211_akm)ni->ni_rsnakms) &&
+        ieee80211_ft_assoc_resp(ic, ni, rsnie, mde, fte) != 0) {
+        DPRINTF(("invalid FT elements from %s\n",
+                 ether_sprintf((u_int8_t *)wh->i_addr2)));
+        ic->ic_stats.is_rx_assoc_badrsnie++;
+        ic->ic_ft.ft_flags &= ~(IEEE80211_FT_F_VALID | IEEE80211_FT_F_ROAM);
+        IEEE80211_SEND_MGMT(ic, ni, IEEE80211_FC0_SUBTYPE_DEAUTH,
+                            IEEE80211_REASON_IE_INVALID);
+        ieee80211_new_state(ic, IEEE80211_S_SCAN, -1);
+        return;
+    }
     rate = ieee80211_setup_rates(ic, ni, rates, xrates,
                                  IEEE80211_F_DOSORT | IEEE80211_F_DOFRATE | IEEE80211_F_DONEGO |
                                  IEEE80211_F_DODEL);
@@ -2838,7 +3229,11 @@ ieee80211_recv_assoc_resp(struct ieee80211com *ic, mbuf_t m,
      */
     if (ic->ic_flags & IEEE80211_F_RSNON) {
         /* XXX ic->ic_mgt_timer = 5; */
-        ni->ni_rsn_supp_state = RSNA_SUPP_PTKSTART;
+        /* 802.11r transitions got their keys from the FTE already */
+        if (ic->ic_ft.ft_flags & IEEE80211_FT_F_SETKEYS)
+            ni->ni_rsn_supp_state = RNSA_SUPP_PTKDONE;
+        else
+            ni->ni_rsn_supp_state = RSNA_SUPP_PTKSTART;
     } else if (ic->ic_flags & IEEE80211_F_WEPON)
         ni->ni_flags |= IEEE80211_NODE_TXRXPROT;
     
@@ -3402,6 +3797,136 @@ ieee80211_recv_sa_query_resp(struct ieee80211com *ic, mbuf_t m,
 }
 #endif
 
+/*
+ * Parse the Neighbor Report elements found between frm and efrm into nbr.
+ * Returns the number of entries, at most IEEE80211_NBR_MAX.
+ */
+static int
+ieee80211_parse_nbr(struct ieee80211com *ic, const u_int8_t *frm,
+                    const u_int8_t *efrm, struct ieee80211_nbr *nbr)
+{
+    const u_int8_t *sub, *esub;
+    int n = 0;
+    
+    for (; frm + 2 <= efrm; frm += 2 + frm[1]) {
+        if (frm + 2 + frm[1] > efrm) {
+            ic->ic_stats.is_rx_elem_toobig++;
+            break;
+        }
+        if (frm[0] != IEEE80211_ELEMID_NBR_REPORT)
+            continue;
+        if (frm[1] < IEEE80211_NBR_REPORT_MINLEN) {
+            ic->ic_stats.is_rx_elem_toosmall++;
+            continue;
+        }
+        if (n == IEEE80211_NBR_MAX)
+            break;
+        IEEE80211_ADDR_COPY(nbr[n].nb_bssid, &frm[2]);
+        nbr[n].nb_bssinfo = LE_READ_4(&frm[8]);
+        nbr[n].nb_opclass = frm[12];
+        nbr[n].nb_chan = frm[13];
+        nbr[n].nb_phytype = frm[14];
+        /* lowest usable preference unless told otherwise */
+        nbr[n].nb_pref = 1;
+        esub = frm + 2 + frm[1];
+        for (sub = &frm[2 + IEEE80211_NBR_REPORT_MINLEN];
+             sub + 2 <= esub && sub + 2 + sub[1] <= esub;
+             sub += 2 + sub[1]) {
+            if (sub[0] == IEEE80211_NBR_SUBELEM_BTM_PREF && sub[1] >= 1)
+                nbr[n].nb_pref = sub[2];
+        }
+        n++;
+    }
+    return n;
+}
+
+/*-
+ * Neighbor Report Response frame format:
+ * [1]   Category
+ * [1]   Action
+ * [1]   Dialog Token
+ * [tlv] Neighbor Report elements
+ */
+void
+ieee80211_recv_nbr_resp(struct ieee80211com *ic, mbuf_t m,
+                        struct ieee80211_node *ni)
+{
+    struct ieee80211_nbr nbr[IEEE80211_NBR_MAX];
+    const struct ieee80211_frame *wh;
+    const u_int8_t *frm, *efrm;
+    int n;
+    
+    if (ic->ic_opmode != IEEE80211_M_STA || ni != ic->ic_bss) {
+        DPRINTF(("unexpected neighbor report from %s\n",
+                 ether_sprintf(ni->ni_macaddr)));
+        return;
+    }
+    if (mbuf_len(m) < sizeof(*wh) + 3) {
+        DPRINTF(("frame too short\n"));
+        return;
+    }
+    wh = mtod(m, struct ieee80211_frame *);
+    frm = (const u_int8_t *)&wh[1];
+    efrm = mtod(m, u_int8_t *) + mbuf_len(m);
+    
+    n = ieee80211_parse_nbr(ic, &frm[3], efrm, nbr);
+    ieee80211_nbr_update(ic, frm[2], nbr, n);
+}
+
+/*-
+ * BSS Transition Management Request frame format:
+ * [1]   Category
+ * [1]   Action
+ * [1]   Dialog Token
+ * [1]   Request Mode
+ * [2]   Disassociation Timer
+ * [1]   Validity Interval
+ * [12]  BSS Termination Duration (optional)
+ * [var] Session Information URL (optional)
+ * [tlv] BSS Transition Candidate List Entries (optional)
+ */
+void
+ieee80211_recv_btm_req(struct ieee80211com *ic, mbuf_t m,
+                       struct ieee80211_node *ni)
+{
+    struct ieee80211_nbr nbr[IEEE80211_NBR_MAX];
+    const struct ieee80211_frame *wh;
+    const u_int8_t *frm, *efrm;
+    u_int8_t token, mode;
+    int n = 0;
+    
+    if (ic->ic_opmode != IEEE80211_M_STA || ni != ic->ic_bss ||
+        ic->ic_state != IEEE80211_S_RUN) {
+        DPRINTF(("unexpected BSS transition request from %s\n",
+                 ether_sprintf(ni->ni_macaddr)));
+        return;
+    }
+    if ((ic->ic_flags & IEEE80211_F_RSNON) && !ni->ni_port_valid)
+        return;
+    if (mbuf_len(m) < sizeof(*wh) + 7) {
+        DPRINTF(("frame too short\n"));
+        return;
+    }
+    wh = mtod(m, struct ieee80211_frame *);
+    frm = (const u_int8_t *)&wh[1];
+    efrm = mtod(m, u_int8_t *) + mbuf_len(m);
+    
+    token = frm[2];
+    mode = frm[3];
+    frm += 7;
+    if (mode & IEEE80211_BTM_REQ_BSS_TERM)
+        frm += IEEE80211_BTM_BSS_TERM_LEN;
+    if ((mode & IEEE80211_BTM_REQ_ESS_DISASSOC) && frm < efrm)
+        frm += 1 + frm[0];
+    if (frm > efrm) {
+        DPRINTF(("frame too short\n"));
+        return;
+    }
+    if (mode & IEEE80211_BTM_REQ_CAND_LIST)
+        n = ieee80211_parse_nbr(ic, frm, efrm, nbr);
+    ieee80211_btm_request(ic, token, mode, nbr, n);
+}
+
 /*-
  * Action frame format:
  * [1] Category
@@ -3447,6 +3972,20 @@ ieee80211_recv_action(struct ieee80211com *ic, mbuf_t m,
 #endif
             }
             break;
+        case IEEE80211_CATEG_RADIO_MSRMNT:
+            switch (frm[1]) {
+                case IEEE80211_ACTION_RM_NEIGHBOR_RESP:
+                    ieee80211_recv_nbr_resp(ic, m, ni);
+                    break;
+            }
+            break;
+        case IEEE80211_CATEG_WNM:
+            switch (frm[1]) {
+                case IEEE80211_ACTION_BTM_REQ:
+                    ieee80211_recv_btm_req(ic, m, ni);
+                    break;
+            }
+            break;
         default:
             DPRINTF(("action frame category %d not handled\n", frm[0]));
             break;
@@ -151,6 +151,8 @@ ieee80211_node2req(struct ieee80211com *ic, const struct ieee80211_node *ni,
 		nr->nr_rsnakms |= IEEE80211_WPA_AKM_SHA256_8021X;
 	if (ni->ni_supported_rsnakms & IEEE80211_AKM_SHA256_PSK)
 		nr->nr_rsnakms |= IEEE80211_WPA_AKM_SHA256_PSK;
+	if (ni->ni_supported_rsnakms & IEEE80211_AKM_FT_PSK)
+		nr->nr_rsnakms |= IEEE80211_WPA_AKM_FT_PSK;
 
 	/* Node flags */
 	nr->nr_flags = 0;
@@ -344,6 +346,8 @@ ieee80211_ioctl_setwpaparms(struct ieee80211com *ic,
 		ic->ic_rsnakms |= IEEE80211_AKM_PSK;
 	if (wpa->i_akms & IEEE80211_WPA_AKM_SHA256_PSK)
 		ic->ic_rsnakms |= IEEE80211_AKM_SHA256_PSK;
+	if (wpa->i_akms & IEEE80211_WPA_AKM_FT_PSK)
+		ic->ic_rsnakms |= IEEE80211_AKM_FT_PSK;
 	if (wpa->i_akms & IEEE80211_WPA_AKM_8021X)
 		ic->ic_rsnakms |= IEEE80211_AKM_8021X;
 	if (wpa->i_akms & IEEE80211_WPA_AKM_SHA256_8021X)
@@ -401,6 +405,8 @@ ieee80211_ioctl_getwpaparms(struct ieee80211com *ic,
 		wpa->i_akms |= IEEE80211_WPA_AKM_PSK;
 	if (ic->ic_rsnakms & IEEE80211_AKM_SHA256_PSK)
 		wpa->i_akms |= IEEE80211_WPA_AKM_SHA256_PSK;
+	if (ic->ic_rsnakms & IEEE80211_AKM_FT_PSK)
+		wpa->i_akms |= IEEE80211_WPA_AKM_FT_PSK;
 	if (ic->ic_rsnakms & IEEE80211_AKM_8021X)
 		wpa->i_akms |= IEEE80211_WPA_AKM_8021X;
 	if (ic->ic_rsnakms & IEEE80211_AKM_SHA256_8021X)
@@ -445,6 +451,8 @@ ieee80211_ess_getwpaparms(struct ieee80211_ess *ess,
 		wpa->i_akms |= IEEE80211_WPA_AKM_PSK;
 	if (ess->rsnakms & IEEE80211_AKM_SHA256_PSK)
 		wpa->i_akms |= IEEE80211_WPA_AKM_SHA256_PSK;
+	if (ess->rsnakms & IEEE80211_AKM_FT_PSK)
+		wpa->i_akms |= IEEE80211_WPA_AKM_FT_PSK;
 	if (ess->rsnakms & IEEE80211_AKM_8021X)
 		wpa->i_akms |= IEEE80211_WPA_AKM_8021X;
 	if (ess->rsnakms & IEEE80211_AKM_SHA256_8021X)
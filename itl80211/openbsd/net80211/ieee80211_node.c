@@ -78,6 +78,10 @@ u_int8_t ieee80211_node_getrssi(struct ieee80211com *,
                                 const struct ieee80211_node *);
 int ieee80211_node_checkrssi(struct ieee80211com *,
                              const struct ieee80211_node *);
+int ieee80211_rssi_checkthres(struct ieee80211com *,
+                              const struct ieee80211_channel *, u_int8_t);
+int ieee80211_roam_better(struct ieee80211com *, struct ieee80211_node *,
+                          struct ieee80211_node *);
 int ieee80211_ess_is_better(struct ieee80211com *ic, struct ieee80211_node *,
                             struct ieee80211_node *);
 void ieee80211_node_set_timeouts(struct ieee80211_node *);
@@ -302,6 +306,8 @@ ieee80211_ess_setwpaparms(struct ieee80211_ess *ess,
         ess->rsnakms |= IEEE80211_AKM_PSK;
     if (wpa->i_akms & IEEE80211_WPA_AKM_SHA256_PSK)
         ess->rsnakms |= IEEE80211_AKM_SHA256_PSK;
+    if (wpa->i_akms & IEEE80211_WPA_AKM_FT_PSK)
+        ess->rsnakms |= IEEE80211_AKM_FT_PSK;
     if (wpa->i_akms & IEEE80211_WPA_AKM_8021X)
         ess->rsnakms |= IEEE80211_AKM_8021X;
     if (wpa->i_akms & IEEE80211_WPA_AKM_SHA256_8021X)
@@ -463,17 +469,318 @@ ieee80211_ess_adjust_rssi(struct ieee80211com *ic, struct ieee80211_node *ni)
     return rssi;
 }
 
+/*
+ * Minimum receiver input sensitivity in dBm for each HT/VHT/HE MCS index
+ * on a 20 MHz channel (802.11-2020 Tables 19-23, 21-25 and 27-51).
+ * Every doubling of the channel width costs another 3 dB.
+ */
+static const int8_t ieee80211_mcs_min_rssi[] = {
+    -82, -79, -77, -74, -70, -66, -65, -64, -59, -57, -54, -52
+};
+
+/* Data bits per subcarrier and symbol for each MCS index, times 12. */
+static const uint8_t ieee80211_mcs_bits12[] = {
+    6, 12, 18, 24, 36, 48, 54, 60, 72, 80, 90, 100
+};
+
+/* Minimum receiver input sensitivity for legacy (11a/b/g) rates. */
+static const struct {
+    uint8_t rate;   /* in 500 kbit/s units */
+    int8_t  rssi;   /* in dBm */
+} ieee80211_legacy_min_rssi[] = {
+    {   2, -80 }, {   4, -80 }, {  11, -76 }, {  22, -76 },
+    {  12, -82 }, {  18, -81 }, {  24, -79 }, {  36, -77 },
+    {  48, -74 }, {  72, -70 }, {  96, -66 }, { 108, -65 },
+};
+
+#define IEEE80211_TPUT_MAX_NSS  4
+
+static int
+ieee80211_rssi_dbm(struct ieee80211com *ic, u_int8_t rssi)
+{
+    /*
+     * Drivers which set ic_max_rssi report RSSI normalized to their
+     * minimum of -100 dBm. Otherwise ni_rssi holds a raw dBm value.
+     */
+    if (ic->ic_max_rssi)
+        return (int)rssi - 100;
+    return (int8_t)rssi;
+}
+
+int
+ieee80211_node_rssi_dbm(struct ieee80211com *ic, const struct ieee80211_node *ni)
+{
+    return ieee80211_rssi_dbm(ic, ni->ni_rssi);
+}
+
+static int
+ieee80211_tput_ht_allowed(struct ieee80211com *ic, struct ieee80211_node *ni)
+{
+    /* HT and later are not allowed with WEP or TKIP-only networks. */
+    if (ni->ni_capinfo & IEEE80211_CAPINFO_PRIVACY) {
+        if (ni->ni_rsnprotos == IEEE80211_PROTO_NONE)
+            return 0;
+        if ((ni->ni_rsnciphers & IEEE80211_CIPHER_CCMP) == 0)
+            return 0;
+    }
+    return ((ic->ic_modecaps & (1 << IEEE80211_MODE_11N)) &&
+            (ic->ic_flags & IEEE80211_F_HTON) &&
+            ieee80211_node_supports_ht(ni));
+}
+
+static int
+ieee80211_tput_vht_allowed(struct ieee80211com *ic, struct ieee80211_node *ni)
+{
+    return (IEEE80211_IS_CHAN_5GHZ(ni->ni_chan) &&
+            (ic->ic_modecaps & (1 << IEEE80211_MODE_11AC)) &&
+            (ic->ic_flags & IEEE80211_F_VHTON) &&
+            (ic->ic_userflags & IEEE80211_F_NOVHT) == 0 &&
+            ieee80211_node_supports_vht(ni));
+}
+
+static int
+ieee80211_tput_he_allowed(struct ieee80211com *ic, struct ieee80211_node *ni)
+{
+    return ((ic->ic_modecaps & (1 << IEEE80211_MODE_11AX)) &&
+            (ic->ic_flags & IEEE80211_F_HEON) &&
+            (ni->ni_flags & IEEE80211_NODE_HECAP));
+}
+
+/*
+ * Channel width in MHz we would end up using with this AP. Unlike
+ * ieee80211_{ht,vht,he}_negotiate() this has no side effects, so it
+ * can be used on any node in the scan cache.
+ */
+static int
+ieee80211_tput_chw(struct ieee80211com *ic, struct ieee80211_node *ni,
+                   int vht, int he)
+{
+    const struct ieee80211_vht_operation *he_oper_vht;
+    int chw = 20, chanwidth = IEEE80211_VHT_CHANWIDTH_USE_HT;
+    int seg0 = 0, seg1 = 0;
+    
+    if (ieee80211_node_supports_ht_chan40(ni) &&
+        (ic->ic_htcaps & IEEE80211_HTCAP_CBW20_40) &&
+        IEEE80211_IS_CHAN_HT40(ni->ni_chan)) {
+        if (!IEEE80211_IS_CHAN_2GHZ(ni->ni_chan) ||
+            ((ic->ic_userflags & IEEE80211_F_NOHT40) == 0 &&
+             ((ic->ic_htcaps | ni->ni_htcaps) &
+              IEEE80211_HTCAP_40INTOLERANT) == 0))
+            chw = 40;
+    }
+    
+    if (!IEEE80211_IS_CHAN_5GHZ(ni->ni_chan))
+        return chw;
+    
+    if (he && (ni->ni_he_oper_params & IEEE80211_HE_OPERATION_VHT_OPER_INFO)) {
+        he_oper_vht = (const struct ieee80211_vht_operation *)ni->ni_he_optional;
+        chanwidth = he_oper_vht->chan_width;
+        seg0 = he_oper_vht->center_freq_seg0_idx;
+        seg1 = he_oper_vht->center_freq_seg1_idx;
+    } else if (vht) {
+        chanwidth = ni->ni_vht_chanwidth;
+        seg0 = ni->ni_vht_chan1;
+        seg1 = ni->ni_vht_chan2;
+    }
+    
+    switch (chanwidth) {
+        case IEEE80211_VHT_CHANWIDTH_80MHZ:
+            chw = 80;
+            /* 160 MHz signalled through CCFS1, see ieee80211_vht_negotiate(). */
+            if (seg1 && abs(seg1 - seg0) == 8 &&
+                (ni->ni_vhtcaps & IEEE80211_VHTCAP_SUPP_CHAN_WIDTH_MASK))
+                chw = 160;
+            break;
+        case IEEE80211_VHT_CHANWIDTH_160MHZ:
+        case IEEE80211_VHT_CHANWIDTH_80P80MHZ:
+            chw = (ni->ni_vhtcaps & IEEE80211_VHTCAP_SUPP_CHAN_WIDTH_MASK) ?
+                160 : 80;
+            break;
+        default:
+            break;
+    }
+    
+    return chw;
+}
+
+/*
+ * Highest MCS usable with the given number of spatial streams,
+ * or -1 if the AP does not support that many streams.
+ */
+static int
+ieee80211_tput_max_mcs(struct ieee80211com *ic, struct ieee80211_node *ni,
+                       int nss, int chw, int vht, int he)
+{
+    uint16_t map, ourmap;
+    int ap, our;
+    
+    if (he) {
+        if (chw == 160) {
+            map = le16toh(ni->ni_he_mcs_nss_supp.rx_mcs_160);
+            ourmap = le16toh(ic->ic_he_mcs_nss_supp.tx_mcs_160);
+        } else {
+            map = le16toh(ni->ni_he_mcs_nss_supp.rx_mcs_80);
+            ourmap = le16toh(ic->ic_he_mcs_nss_supp.tx_mcs_80);
+        }
+        ap = (map >> ((nss - 1) * 2)) & IEEE80211_HE_MCS_NOT_SUPPORTED;
+        our = (ourmap >> ((nss - 1) * 2)) & IEEE80211_HE_MCS_NOT_SUPPORTED;
+        if (ap == IEEE80211_HE_MCS_NOT_SUPPORTED ||
+            our == IEEE80211_HE_MCS_NOT_SUPPORTED)
+            return -1;
+        return 7 + 2 * MIN(ap, our);
+    }
+    if (vht) {
+        /* ni_vht_mcsinfo has already been limited to our own caps. */
+        map = le16toh(ni->ni_vht_mcsinfo.rx_mcs_map);
+        ap = (map >> ((nss - 1) * 2)) & IEEE80211_VHT_MCS_NOT_SUPPORTED;
+        if (ap == IEEE80211_VHT_MCS_NOT_SUPPORTED)
+            return -1;
+        /* VHT MCS 9 is not valid on 20 MHz channels with 1 or 2 SS. */
+        if (ap == 2 && chw == 20 && nss < 3)
+            return 8;
+        return 7 + ap;
+    }
+    if (ni->ni_rxmcs[nss - 1] == 0 || ic->ic_sup_mcs[nss - 1] == 0)
+        return -1;
+    return 7;
+}
+
+/* PHY rate in kbit/s, see 802.11-2020 19.3.5, 21.3.5 and 27.3.5. */
+static uint32_t
+ieee80211_tput_phy_rate(int mcs, int nss, int chw, int sgi, int he)
+{
+    static const uint16_t nsd_ht[] = { 52, 108, 234, 468 };
+    static const uint16_t nsd_he[] = { 234, 468, 980, 1960 };
+    uint64_t nsd, tsym;
+    int widx;
+    
+    widx = (chw == 160) ? 3 : (chw == 80) ? 2 : (chw == 40) ? 1 : 0;
+    if (he) {
+        nsd = nsd_he[widx];
+        tsym = 13600; /* 12.8us symbol + 0.8us GI, in ns */
+    } else {
+        nsd = nsd_ht[widx];
+        tsym = sgi ? 3600 : 4000;
+    }
+    return (uint32_t)((nsd * ieee80211_mcs_bits12[mcs] * nss * 1000000ULL) /
+                      (12 * tsym));
+}
+
+static uint32_t
+ieee80211_tput_legacy(struct ieee80211_node *ni, int rssi)
+{
+    uint32_t best = 0, lowest = 0;
+    int i, j, rate;
+    
+    for (i = 0; i < ni->ni_rates.rs_nrates; i++) {
+        rate = ni->ni_rates.rs_rates[i] & IEEE80211_RATE_VAL;
+        if (lowest == 0 || rate < lowest)
+            lowest = rate;
+        for (j = 0; j < nitems(ieee80211_legacy_min_rssi); j++) {
+            if (ieee80211_legacy_min_rssi[j].rate != rate)
+                continue;
+            if (rssi >= ieee80211_legacy_min_rssi[j].rssi && rate > best)
+                best = rate;
+            break;
+        }
+    }
+    /* Too weak for any rate; still rank by how weak it is. */
+    if (best == 0)
+        return (lowest * 500) >> MIN(8, 1 + MAX(0, -82 - rssi) / 3);
+    return best * 500;
+}
+
+/*
+ * Estimate the throughput in kbit/s we could achieve with an AP,
+ * based on its advertised HT/VHT/HE capabilities, the channel width
+ * and number of spatial streams both sides support, the highest MCS
+ * its RSSI can sustain, and its advertised channel load.
+ */
+static uint32_t
+ieee80211_estimate_tput(struct ieee80211com *ic, struct ieee80211_node *ni,
+                        int rssi)
+{
+    uint32_t tput = 0, rate;
+    int ht, vht, he, chw, sgi, nss, maxmcs, mcs, penalty;
+    
+    if (ni->ni_chan == NULL || ni->ni_chan == IEEE80211_CHAN_ANYC)
+        return 0;
+    
+    ht = ieee80211_tput_ht_allowed(ic, ni);
+    vht = ht && ieee80211_tput_vht_allowed(ic, ni);
+    he = ht && ieee80211_tput_he_allowed(ic, ni);
+    
+    if (!ht) {
+        tput = ieee80211_tput_legacy(ni, rssi);
+        goto load;
+    }
+    
+    chw = ieee80211_tput_chw(ic, ni, vht, he);
+    switch (chw) {
+        case 160:
+            sgi = vht && (ni->ni_vhtcaps & IEEE80211_VHTCAP_SHORT_GI_160);
+            break;
+        case 80:
+            sgi = vht && (ni->ni_vhtcaps & IEEE80211_VHTCAP_SHORT_GI_80);
+            break;
+        case 40:
+            sgi = ieee80211_node_supports_ht_sgi40(ni) &&
+                (ic->ic_htcaps & IEEE80211_HTCAP_SGI40);
+            break;
+        default:
+            sgi = ieee80211_node_supports_ht_sgi20(ni) &&
+                (ic->ic_htcaps & IEEE80211_HTCAP_SGI20);
+            break;
+    }
+    
+    /*
+     * Try each stream count; additional streams split the transmit
+     * power, so charge 3 dB for every stream beyond the first.
+     */
+    for (nss = 1; nss <= IEEE80211_TPUT_MAX_NSS; nss++) {
+        maxmcs = ieee80211_tput_max_mcs(ic, ni, nss, chw, vht, he);
+        if (maxmcs < 0)
+            break;
+        penalty = 3 * (nss - 1) +
+            3 * ((chw >= 40) + (chw >= 80) + (chw >= 160));
+        for (mcs = maxmcs; mcs >= 0; mcs--) {
+            if (rssi >= ieee80211_mcs_min_rssi[mcs] + penalty)
+                break;
+        }
+        if (mcs < 0) {
+            if (nss > 1)
+                break;
+            rate = ieee80211_tput_phy_rate(0, 1, chw, sgi, he);
+            rate >>= MIN(8, 1 + (ieee80211_mcs_min_rssi[0] + penalty - rssi) / 3);
+        } else
+            rate = ieee80211_tput_phy_rate(mcs, nss, chw, sgi, he);
+        if (rate > tput)
+            tput = rate;
+    }
+    
+load:
+    /*
+     * Scale by the airtime left over according to the BSS Load element.
+     * Keep a floor so that a busy AP with a much faster PHY still wins.
+     */
+    if (ni->ni_flags & IEEE80211_NODE_BSSLOAD)
+        tput = (uint32_t)(((uint64_t)tput *
+                           MAX(256 - ni->ni_bssload_chutil, 32)) / 256);
+    
+    return tput;
+}
+
+uint32_t
+ieee80211_node_estimate_tput(struct ieee80211com *ic, struct ieee80211_node *ni)
+{
+    return ieee80211_estimate_tput(ic, ni, ieee80211_node_rssi_dbm(ic, ni));
+}
+
 int
 ieee80211_ess_calculate_score(struct ieee80211com *ic,
                               struct ieee80211_node *ni)
 {
     int score = 0;
-    uint8_t	min_5ghz_rssi;
-    
-    if (ic->ic_max_rssi)
-        min_5ghz_rssi = IEEE80211_RSSI_THRES_RATIO_5GHZ;
-    else
-        min_5ghz_rssi = (uint8_t)IEEE80211_RSSI_THRES_5GHZ;
     
     /* not using join any */
     if (ieee80211_get_ess(ic, (const char*)ni->ni_essid, ni->ni_esslen))
@@ -487,17 +794,6 @@ ieee80211_ess_calculate_score(struct ieee80211com *ic,
     if (ni->ni_capinfo & IEEE80211_CAPINFO_PRIVACY)
         score += 4;
     
-    /* 5GHz with a good signal */
-    if (IEEE80211_IS_CHAN_5GHZ(ni->ni_chan) &&
-        ni->ni_rssi > min_5ghz_rssi)
-        score += 2;
-    
-    /* HT/VHT available */
-    if (ieee80211_node_supports_ht(ni))
-        score++;
-    if (ieee80211_node_supports_vht(ni))
-        score++;
-    
     /* Boost this AP if it had no auth/assoc failures in the past. */
     if (ni->ni_fails == 0)
         score += 21;
@@ -510,12 +806,11 @@ ieee80211_ess_calculate_score(struct ieee80211com *ic,
  * We compute a score based on the following attributes:
  *
  *  crypto: wpa2 > wpa1 > wep > open
- *  band: 5 GHz > 2 GHz provided 5 GHz rssi is above threshold
- *  supported standard revisions: 11ac > 11n > 11a/b/g
- *  rssi: rssi1 > rssi2 as a numeric comparison with a slight
- *         disadvantage for 2 GHz APs
+ *  history: APs which did not fail to associate before
  *
- * Crypto carries most weight, followed by band, followed by rssi.
+ * Among APs with equal score the one with the higher estimated
+ * throughput wins, see ieee80211_node_estimate_tput(). This covers
+ * band, channel width, PHY generation, signal strength and load.
  */
 int
 ieee80211_ess_is_better(struct ieee80211com *ic,
@@ -523,22 +818,27 @@ ieee80211_ess_is_better(struct ieee80211com *ic,
 {
     struct _ifnet		*ifp = &ic->ic_if;
     int			 score_cur = 0, score_can = 0;
-    int			 cur_rssi, can_rssi;
+    uint32_t		 tput_cur, tput_can;
     
     score_cur = ieee80211_ess_calculate_score(ic, nicur);
     score_can = ieee80211_ess_calculate_score(ic, nican);
     
-    cur_rssi = ieee80211_ess_adjust_rssi(ic, nicur);
-    can_rssi = ieee80211_ess_adjust_rssi(ic, nican);
+    tput_cur = ieee80211_node_estimate_tput(ic, nicur);
+    tput_can = ieee80211_node_estimate_tput(ic, nican);
     
-    if (can_rssi > cur_rssi)
-        score_can++;
+    if (score_can == score_cur) {
+        if (tput_can > tput_cur ||
+            (tput_can == tput_cur &&
+             ieee80211_ess_adjust_rssi(ic, nican) >
+             ieee80211_ess_adjust_rssi(ic, nicur)))
+            score_can++;
+    }
     
     if ((ifp->if_flags & IFF_DEBUG) && (score_can <= score_cur)) {
         XYLog("%s: AP %s ", ifp->if_xname,
               ether_sprintf(nican->ni_bssid));
         ieee80211_print_essid(nican->ni_essid, nican->ni_esslen);
-        XYLog(" score %d\n", score_can);
+        XYLog(" score %d tput %u kbit/s\n", score_can, tput_can);
     }
     
     return score_can > score_cur;
@@ -725,6 +1025,7 @@ ieee80211_node_attach(struct _ifnet *ifp)
     ic->ic_node_checkrssi = ieee80211_node_checkrssi;
     ic->ic_scangen = 1;
     ic->ic_max_nnodes = ieee80211_cache_size;
+    ieee80211_ft_reset(ic);
     
     if (ic->ic_max_aid == 0)
         ic->ic_max_aid = IEEE80211_AID_DEF;
@@ -1105,7 +1406,8 @@ ieee80211_match_bss(struct ieee80211com *ic, struct ieee80211_node *ni,
         if ((ni->ni_rsnakms & ic->ic_rsnakms) == 0)
             fail |= IEEE80211_NODE_ASSOCFAIL_WPA_PROTO;
         if ((ni->ni_rsnakms & ic->ic_rsnakms &
-             ~(IEEE80211_AKM_PSK | IEEE80211_AKM_SHA256_PSK)) == 0) {
+             ~(IEEE80211_AKM_PSK | IEEE80211_AKM_SHA256_PSK |
+               IEEE80211_AKM_FT_PSK)) == 0) {
             /* AP only supports PSK AKMPs */
             if (!(ic->ic_flags & IEEE80211_F_PSK))
                 fail |= IEEE80211_NODE_ASSOCFAIL_WPA_PROTO;
@@ -1183,6 +1485,7 @@ ieee80211_match_bss(struct ieee80211com *ic, struct ieee80211_node *ni,
 struct ieee80211_node_switch_bss_arg {
     u_int8_t cur_macaddr[IEEE80211_ADDR_LEN];
     u_int8_t sel_macaddr[IEEE80211_ADDR_LEN];
+    int steered;    /* BSS transition requested by our AP */
 };
 
 /* Implements ni->ni_unref_cb(). */
@@ -1210,8 +1513,12 @@ ieee80211_node_switch_bss(struct ieee80211com *ic, struct ieee80211_node *ni)
         return;
     }
     
+    /*
+     * Our AP may be missing from the node cache if we were steered
+     * away from it (802.11v) rather than roamed after a scan.
+     */
     curbs = ieee80211_find_node(ic, sba->cur_macaddr);
-    if (curbs == NULL) {
+    if (curbs == NULL && !sba->steered) {
         free(sba);
         ic->ic_flags &= ~IEEE80211_F_BGSCAN;
         ieee80211_new_state(ic, IEEE80211_S_SCAN, -1);
@@ -1220,15 +1527,61 @@ ieee80211_node_switch_bss(struct ieee80211com *ic, struct ieee80211_node *ni)
     
     if (ifp->if_flags & IFF_DEBUG) {
         XYLog("%s: roaming from %s chan %d ",
-              ifp->if_xname, ether_sprintf(curbs->ni_macaddr),
-              ieee80211_chan2ieee(ic, curbs->ni_chan));
+              ifp->if_xname, ether_sprintf(sba->cur_macaddr),
+              ieee80211_chan2ieee(ic, ic->ic_bss->ni_chan));
         XYLog("to %s chan %d\n", ether_sprintf(selbs->ni_macaddr),
               ieee80211_chan2ieee(ic, selbs->ni_chan));
     }
-    ieee80211_node_newstate(curbs, IEEE80211_STA_CACHE);
+    if (curbs != NULL)
+        ieee80211_node_newstate(curbs, IEEE80211_STA_CACHE);
     ieee80211_node_join_bss(ic, selbs); /* frees arg and ic->ic_bss */
 }
 
+/*
+ * Start switching from our AP curbs to selbs. The caller has set
+ * IEEE80211_F_BGSCAN and clears it again if this fails.
+ */
+static int
+ieee80211_node_leave_bss(struct ieee80211com *ic, struct ieee80211_node *curbs,
+                         struct ieee80211_node *selbs, int steered)
+{
+    struct ieee80211_node_switch_bss_arg *arg;
+    
+    arg = (struct ieee80211_node_switch_bss_arg *)malloc(sizeof(*arg), 0, 0);
+    if (arg == NULL)
+        return ENOMEM;
+    
+    ic->ic_bgscan_fail = 0;
+    
+    /*
+     * We are going to switch APs. Stop A-MPDU Tx and
+     * queue a de-auth frame addressed to our current AP.
+     */
+    ieee80211_stop_ampdu_tx(ic, ic->ic_bss,
+                            IEEE80211_FC0_SUBTYPE_DEAUTH);
+    if (IEEE80211_SEND_MGMT(ic, ic->ic_bss,
+                            IEEE80211_FC0_SUBTYPE_DEAUTH,
+                            IEEE80211_REASON_AUTH_LEAVE) != 0) {
+        free(arg);
+        return ENOMEM;
+    }
+    
+    /* Prevent dispatch of additional data frames to hardware. */
+    ic->ic_xflags |= IEEE80211_F_TX_MGMT_ONLY;
+    
+    /*
+     * Install a callback which will switch us to the new AP once
+     * all dispatched frames have been processed by hardware.
+     */
+    IEEE80211_ADDR_COPY(arg->cur_macaddr, curbs->ni_macaddr);
+    IEEE80211_ADDR_COPY(arg->sel_macaddr, selbs->ni_macaddr);
+    arg->steered = steered;
+    ic->ic_bss->ni_unref_arg = arg;
+    ic->ic_bss->ni_unref_arg_size = sizeof(*arg);
+    ic->ic_bss->ni_unref_cb = ieee80211_node_switch_bss;
+    return 0;
+}
+
 void
 ieee80211_node_join_bss(struct ieee80211com *ic, struct ieee80211_node *selbs, int force_reauth)
 {
@@ -1248,9 +1601,13 @@ ieee80211_node_join_bss(struct ieee80211com *ic, struct ieee80211_node *selbs, i
          memcmp(ic->ic_des_essid, selbs->ni_essid, selbs->ni_esslen) == 0))
         assoc_fail = ic->ic_bss->ni_assoc_fail;
     
+    if (ic->ic_flags & IEEE80211_F_RSNON)
+        ieee80211_ft_prepare(ic, selbs);
+    
     (*ic->ic_node_copy)(ic, ic->ic_bss, selbs);
     ni = ic->ic_bss;
     ni->ni_assoc_fail |= assoc_fail;
+    ieee80211_roam_reset(ic);
     
     ic->ic_curmode = ieee80211_chan2mode(ic, ni->ni_chan);
     
@@ -1321,9 +1678,8 @@ ieee80211_node_choose_bss(struct ieee80211com *ic, int bgscan,
                           struct ieee80211_node **curbs)
 {
     XYLog("%s\n", __FUNCTION__);
-    struct ieee80211_node *ni, *nextbs, *selbs = NULL,
-    *selbs2 = NULL, *selbs5 = NULL;
-    uint8_t min_5ghz_rssi;
+    struct ieee80211_node *ni, *nextbs, *selbs = NULL;
+    uint32_t tput, seltput = 0;
     
     ni = RB_MIN(ieee80211_tree, &ic->ic_tree);
     
@@ -1350,147 +1706,1225 @@ ieee80211_node_choose_bss(struct ieee80211com *ic, int bgscan,
             continue;
         }
         
-        if (ic->ic_caps & IEEE80211_C_SCANALLBAND) {
-            if (IEEE80211_IS_CHAN_2GHZ(ni->ni_chan) &&
-                (selbs2 == NULL || ni->ni_rssi > selbs2->ni_rssi))
-                selbs2 = ni;
-            else if (IEEE80211_IS_CHAN_5GHZ(ni->ni_chan) &&
-                     (selbs5 == NULL || ni->ni_rssi > selbs5->ni_rssi))
-                selbs5 = ni;
-        } else if (selbs == NULL || ni->ni_rssi > selbs->ni_rssi)
+        /*
+         * Pick the AP with the highest estimated throughput. This
+         * prefers a near 5GHz/wide channel AP over a far 2GHz one
+         * while still choosing a strong 2GHz AP over a 5GHz AP at
+         * the edge of its range. RSSI breaks ties.
+         */
+        tput = ieee80211_node_estimate_tput(ic, ni);
+        DPRINTF(("%s candidate ssid=%s mac=%s chan=%d rssi=%d tput=%u kbit/s\n", __FUNCTION__, ni->ni_essid, ether_sprintf(ni->ni_bssid), ieee80211_chan2ieee(ic, ni->ni_chan), ni->ni_rssi, tput));
+        if (selbs == NULL || tput > seltput ||
+            (tput == seltput && ni->ni_rssi > selbs->ni_rssi)) {
             selbs = ni;
+            seltput = tput;
+        }
     }
     
-    if (ic->ic_max_rssi)
-        min_5ghz_rssi = IEEE80211_RSSI_THRES_RATIO_5GHZ;
-    else
-        min_5ghz_rssi = (uint8_t)IEEE80211_RSSI_THRES_5GHZ;
+    return selbs;
+}
+
+static u_int64_t
+ieee80211_roam_uptime(void)
+{
+    struct timeval tv;
     
-    /*
-     * Prefer a 5Ghz AP even if its RSSI is weaker than the best 2Ghz AP
-     * (as long as it meets the minimum RSSI threshold) since the 5Ghz band
-     * is usually less saturated.
-     */
-    if (selbs5 != NULL) {
-        XYLog("%s 5ghz ssid=%s mac=%s rssi=%d\n", __FUNCTION__, selbs5->ni_essid, ether_sprintf(selbs5->ni_bssid), selbs5->ni_rssi);
-    }
-    if (selbs2 != NULL) {
-        XYLog("%s 2ghz ssid=%s mac=%s rssi=%d\n", __FUNCTION__, selbs2->ni_essid, ether_sprintf(selbs2->ni_bssid), selbs2->ni_rssi);
-    }
-    if (selbs5 && (*ic->ic_node_checkrssi)(ic, selbs5))
-        selbs = selbs5;
-    else if (selbs5 && selbs2)
-        selbs = (selbs5->ni_rssi >= selbs2->ni_rssi ? selbs5 : selbs2);
-    else if (selbs2)
-        selbs = selbs2;
-    else if (selbs5)
-        selbs = selbs5;
+    getmicrouptime(&tv);
+    return (u_int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+/* Forget the trends of our previous AP; neighbors are kept. */
+void
+ieee80211_roam_reset(struct ieee80211com *ic)
+{
+    struct ieee80211_roam *r = &ic->ic_roam;
     
-    return selbs;
+    r->r_rssi = 0;
+    r->r_trend = 0;
+    r->r_lastrssi = 0;
+    r->r_txfail = 0;
 }
 
 /*
- * Complete a scan of potential channels.
+ * Feed the RSSI of a frame received from our AP into the smoothed RSSI
+ * and its trend. Frames arrive in bursts, so sample at most every 100ms
+ * to make the smoothing independent of the traffic pattern.
  */
 void
-ieee80211_end_scan(struct _ifnet *ifp)
+ieee80211_roam_input(struct ieee80211com *ic, struct ieee80211_node *ni)
 {
-    struct ieee80211com *ic = (struct ieee80211com *)ifp;
-    struct ieee80211_node *ni, *selbs = NULL, *curbs = NULL;
-    int bgscan = ((ic->ic_flags & IEEE80211_F_BGSCAN) &&
-                  ic->ic_opmode == IEEE80211_M_STA &&
-                  ic->ic_state == IEEE80211_S_RUN);
-    int roamscan = bgscan &&
-                (ic->ic_flags & IEEE80211_F_DISABLE_BG_AUTO_CONNECT) == 0;
+    struct ieee80211_roam *r = &ic->ic_roam;
+    u_int64_t now = ieee80211_roam_uptime();
+    int sample = ni->ni_rssi << 4;
+    int prev, elapsed, slope;
     
-    if (ic->ic_event_handler)
-        (*ic->ic_event_handler)(ic, IEEE80211_EVT_SCAN_DONE, NULL);
+    if (r->r_lastrssi != 0 && now - r->r_lastrssi < 100)
+        return;
     
-    if (ifp->if_flags & IFF_DEBUG)
-        XYLog("%s: end %s scan\n", ifp->if_xname,
-              bgscan ? (roamscan ? "roam" : "background") :
-              ((ic->ic_flags & IEEE80211_F_ASCAN) ?
-               "active" : "passive"));
+    if (r->r_lastrssi == 0 || now - r->r_lastrssi > IEEE80211_ROAM_PREDICT) {
+        r->r_rssi = sample;
+        r->r_trend = 0;
+        r->r_lastrssi = now;
+        return;
+    }
     
-    if (ic->ic_scan_count)
-        ic->ic_flags &= ~IEEE80211_F_ASCAN;
+    elapsed = (int)(now - r->r_lastrssi);
+    prev = r->r_rssi;
+    r->r_rssi += (sample - r->r_rssi) / 4;
+    slope = ((r->r_rssi - prev) * 1000) / elapsed;
+    r->r_trend += (slope - r->r_trend) / 4;
+    r->r_lastrssi = now;
+}
+
+/* Record a TX completion report of ntx data frames from our AP. */
+void
+ieee80211_roam_txstatus(struct ieee80211com *ic, int ntx, int nfail)
+{
+    struct ieee80211_roam *r = &ic->ic_roam;
     
-    if (ic->ic_opmode == IEEE80211_M_STA)
-        ieee80211_clean_inactive_nodes(ic, IEEE80211_INACT_SCAN);
+    if (ntx <= 0 || ic->ic_state != IEEE80211_S_RUN)
+        return;
     
-    ni = RB_MIN(ieee80211_tree, &ic->ic_tree);
+    nfail = MIN(nfail, ntx);
+    r->r_txfail += (((nfail * 100) << 4) / ntx - r->r_txfail) / 16;
+}
+
+/* Track the RSSI of other APs of our ESS seen in beacons and probes. */
+void
+ieee80211_roam_neighbor(struct ieee80211com *ic, struct ieee80211_node *ni)
+{
+    struct ieee80211_roam *r = &ic->ic_roam;
+    struct ieee80211_roam_neighbor *rn, *slot = NULL;
+    struct ieee80211_node *bss = ic->ic_bss;
+    u_int64_t now;
+    int i;
     
-#ifndef IEEE80211_STA_ONLY
-    if (ic->ic_opmode == IEEE80211_M_HOSTAP) {
-        /* XXX off stack? */
-        u_char occupied[howmany(IEEE80211_CHAN_MAX, NBBY)];
-        int i, fail;
-        
-        /*
-         * The passive scan to look for existing AP's completed,
-         * select a channel to camp on.  Identify the channels
-         * that already have one or more AP's and try to locate
-         * an unoccupied one.  If that fails, pick a random
-         * channel from the active set.
-         */
-        memset(occupied, 0, sizeof(occupied));
-        RB_FOREACH(ni, ieee80211_tree, &ic->ic_tree)
-        setbit(occupied, ieee80211_chan2ieee(ic, ni->ni_chan));
-        for (i = 0; i < IEEE80211_CHAN_MAX; i++)
-            if (isset(ic->ic_chan_active, i) && isclr(occupied, i))
-                break;
-        if (i == IEEE80211_CHAN_MAX) {
-            fail = arc4random() & 3;	/* random 0-3 */
-            for (i = 0; i < IEEE80211_CHAN_MAX; i++)
-                if (isset(ic->ic_chan_active, i) && fail-- == 0)
-                    break;
-        }
-        ieee80211_create_ibss(ic, &ic->ic_channels[i]);
+    if (ic->ic_opmode != IEEE80211_M_STA || ic->ic_state != IEEE80211_S_RUN ||
+        bss == NULL || ni == bss ||
+        IEEE80211_ADDR_EQ(ni->ni_macaddr, bss->ni_macaddr))
         return;
-    }
-#endif
-    if (ni == NULL) {
-        DPRINTF(("no scan candidate\n"));
-    notfound:
-        
-#ifndef IEEE80211_STA_ONLY
-        if (ic->ic_opmode == IEEE80211_M_IBSS &&
-            (ic->ic_flags & IEEE80211_F_IBSSON) &&
-            ic->ic_des_esslen != 0) {
-            ieee80211_create_ibss(ic, ic->ic_ibss_chan);
-            return;
-        }
-#endif
-        if (ic->ic_state != IEEE80211_S_RUN) {
-            /*
-             * Reset the list of channels to scan and scan the next mode
-             * if nothing has been found.
-             * If the device scans all bands in one fell swoop, return
-             * current scan results to userspace regardless of mode.
-             * This will loop forever until an access point is found.
-             */
-            ieee80211_reset_scan(ifp);
-            if (ieee80211_next_mode(ifp) == IEEE80211_MODE_AUTO ||
-                (ic->ic_caps & IEEE80211_C_SCANALLBAND))
-                ic->ic_scan_count++;
-            
-            ieee80211_next_scan(ifp);
-        }
+    if (ni->ni_esslen != bss->ni_esslen ||
+        memcmp(ni->ni_essid, bss->ni_essid, bss->ni_esslen) != 0)
         return;
+    
+    now = ieee80211_roam_uptime();
+    for (i = 0; i < IEEE80211_ROAM_NEIGHBORS; i++) {
+        rn = &r->r_nbr[i];
+        if (IEEE80211_ADDR_EQ(rn->rn_macaddr, ni->ni_macaddr)) {
+            slot = rn;
+            break;
+        }
+        if (slot == NULL || rn->rn_lastseen < slot->rn_lastseen)
+            slot = rn;
     }
     
-    /* Possibly switch which ssid we are associated with */
-    if (!bgscan && ic->ic_opmode == IEEE80211_M_STA)
-        ieee80211_switch_ess(ic);
+    if (!IEEE80211_ADDR_EQ(slot->rn_macaddr, ni->ni_macaddr) ||
+        now - slot->rn_lastseen > IEEE80211_ROAM_NEIGHBOR_AGE) {
+        IEEE80211_ADDR_COPY(slot->rn_macaddr, ni->ni_macaddr);
+        slot->rn_rssi = ni->ni_rssi << 4;
+    } else
+        slot->rn_rssi += ((ni->ni_rssi << 4) - slot->rn_rssi) / 4;
+    slot->rn_lastseen = now;
+}
+
+/* Smoothed RSSI of a node if we have been tracking it. */
+static u_int8_t
+ieee80211_roam_node_rssi(struct ieee80211com *ic, struct ieee80211_node *ni)
+{
+    struct ieee80211_roam *r = &ic->ic_roam;
+    struct ieee80211_roam_neighbor *rn;
+    u_int64_t now = ieee80211_roam_uptime();
+    int i;
     
-    selbs = ieee80211_node_choose_bss(ic, bgscan, &curbs);
-    if (bgscan) {
-        struct ieee80211_node_switch_bss_arg *arg;
-        
-        ic->ic_flags &= ~IEEE80211_F_DISABLE_BG_AUTO_CONNECT;
-        if (!roamscan) {
-            ic->ic_flags &= ~IEEE80211_F_BGSCAN;
-            return;
+    if (IEEE80211_ADDR_EQ(ni->ni_macaddr, ic->ic_bss->ni_macaddr)) {
+        if (r->r_lastrssi != 0)
+            return (u_int8_t)(r->r_rssi >> 4);
+        return ni->ni_rssi;
+    }
+    for (i = 0; i < IEEE80211_ROAM_NEIGHBORS; i++) {
+        rn = &r->r_nbr[i];
+        if (IEEE80211_ADDR_EQ(rn->rn_macaddr, ni->ni_macaddr) &&
+            now - rn->rn_lastseen <= IEEE80211_ROAM_NEIGHBOR_AGE)
+            return (u_int8_t)(rn->rn_rssi >> 4);
+    }
+    return ni->ni_rssi;
+}
+
+/*
+ * Decide whether we should look for another AP. Returns
+ * IEEE80211_ROAM_NOW if our link is failing already, and
+ * IEEE80211_ROAM_EARLY if the RSSI trend says it will fail soon.
+ * The smoothed RSSI is used once we have it: with the RSSI of the last
+ * frame, any frame above the threshold would cancel the scan timer at
+ * the edge of the cell.
+ */
+int
+ieee80211_roam_needed(struct ieee80211com *ic)
+{
+    struct ieee80211_roam *r = &ic->ic_roam;
+    struct ieee80211_node *ni = ic->ic_bss;
+    int predicted, weak;
+    
+    if (r->r_lastrssi != 0)
+        weak = !ieee80211_rssi_checkthres(ic, ni->ni_chan, r->r_rssi >> 4);
+    else
+        weak = !(*ic->ic_node_checkrssi)(ic, ni);
+    if (weak || r->r_txfail >= (IEEE80211_ROAM_TXFAIL_THRES << 4))
+        return IEEE80211_ROAM_NOW;
+    
+    if (r->r_lastrssi == 0 || r->r_trend >= 0)
+        return IEEE80211_ROAM_NONE;
+    
+    predicted = (r->r_rssi + (r->r_trend * IEEE80211_ROAM_PREDICT) / 1000) >> 4;
+    if (!ieee80211_rssi_checkthres(ic, ni->ni_chan, MAX(predicted, 0)))
+        return IEEE80211_ROAM_EARLY;
+    
+    return IEEE80211_ROAM_NONE;
+}
+
+/*
+ * After a roaming scan, only move to selbs if its estimated throughput
+ * beats our current AP by a margin. Both sides are judged by smoothed
+ * RSSI so that a single strong beacon does not cause a switch.
+ */
+int
+ieee80211_roam_better(struct ieee80211com *ic, struct ieee80211_node *curbs,
+                      struct ieee80211_node *selbs)
+{
+    struct _ifnet *ifp = &ic->ic_if;
+    uint32_t cur, sel;
+    int hyst;
+    
+    cur = ieee80211_estimate_tput(ic, curbs,
+        ieee80211_rssi_dbm(ic, ieee80211_roam_node_rssi(ic, curbs)));
+    sel = ieee80211_estimate_tput(ic, selbs,
+        ieee80211_rssi_dbm(ic, ieee80211_roam_node_rssi(ic, selbs)));
+    
+    if (ieee80211_roam_needed(ic) == IEEE80211_ROAM_NOW)
+        hyst = IEEE80211_ROAM_TPUT_HYST_WEAK;
+    else
+        hyst = IEEE80211_ROAM_TPUT_HYST;
+    
+    if (ifp->if_flags & IFF_DEBUG)
+        XYLog("%s: roam candidate %s tput %u kbit/s, current %u kbit/s, "
+              "margin %d%%\n", ifp->if_xname,
+              ether_sprintf(selbs->ni_macaddr), sel, cur, hyst);
+    
+    return ((uint64_t)sel * 100 > (uint64_t)cur * (100 + hyst));
+}
+
+static struct ieee80211_chanhist_ess *
+ieee80211_chanhist_lookup(struct ieee80211com *ic, const u_int8_t *essid,
+                          int esslen, int create)
+{
+    struct ieee80211_chanhist *ch = &ic->ic_chanhist;
+    struct ieee80211_chanhist_ess *ce, *slot = NULL;
+    int i;
+    
+    if (esslen == 0)
+        return NULL;
+    
+    for (i = 0; i < IEEE80211_CHANHIST_ESS; i++) {
+        ce = &ch->ch_ess[i];
+        if (ce->ce_esslen == esslen &&
+            memcmp(ce->ce_essid, essid, esslen) == 0)
+            return ce;
+        if (slot == NULL || ce->ce_lastseen < slot->ce_lastseen)
+            slot = ce;
+    }
+    if (!create)
+        return NULL;
+    
+    memset(slot, 0, sizeof(*slot));
+    memcpy(slot->ce_essid, essid, esslen);
+    slot->ce_esslen = esslen;
+    return slot;
+}
+
+/* Remember the channel of an AP which belongs to one of our networks. */
+void
+ieee80211_chanhist_add(struct ieee80211com *ic, struct ieee80211_node *ni)
+{
+    struct ieee80211_chanhist_ess *ce;
+    
+    if (ic->ic_opmode != IEEE80211_M_STA || ni->ni_esslen == 0 ||
+        ni->ni_chan == NULL || ni->ni_chan == IEEE80211_CHAN_ANYC)
+        return;
+    if ((ic->ic_des_esslen != ni->ni_esslen ||
+         memcmp(ic->ic_des_essid, ni->ni_essid, ni->ni_esslen) != 0) &&
+        ieee80211_get_ess(ic, (const char *)ni->ni_essid,
+                          ni->ni_esslen) == NULL)
+        return;
+    
+    ce = ieee80211_chanhist_lookup(ic, ni->ni_essid, ni->ni_esslen, 1);
+    setbit(ce->ce_chans, ieee80211_chan2ieee(ic, ni->ni_chan));
+    ce->ce_lastseen = ieee80211_roam_uptime();
+}
+
+/*
+ * Choose the channels of the next roaming scan. A recent neighbor report
+ * from our AP takes precedence over the channel history. Without either
+ * for our ESS, or after a partial scan missed, all channels are scanned
+ * and the history of our ESS is learned anew.
+ */
+void
+ieee80211_chanhist_prepare(struct ieee80211com *ic)
+{
+    struct ieee80211_chanhist *ch = &ic->ic_chanhist;
+    struct ieee80211_node *ni = ic->ic_bss;
+    struct ieee80211_chanhist_ess *ce;
+    int i, chan, n;
+    
+    ch->ch_partial = 0;
+    if (ic->ic_opmode != IEEE80211_M_STA)
+        return;
+    
+    /* Our AP told us where its neighbors are. */
+    if (!ch->ch_miss && ieee80211_nbr_prepare(ic, ch->ch_scan)) {
+        ch->ch_partial = 1;
+        ch->ch_npartial++;
+        return;
+    }
+    
+    ce = ieee80211_chanhist_lookup(ic, ni->ni_essid, ni->ni_esslen, 0);
+    if (ce == NULL || ch->ch_miss) {
+        if (ce != NULL)
+            memset(ce->ce_chans, 0, sizeof(ce->ce_chans));
+        ch->ch_miss = 0;
+        ch->ch_nfull++;
+        return;
+    }
+    
+    memcpy(ch->ch_scan, ce->ce_chans, sizeof(ch->ch_scan));
+    setbit(ch->ch_scan, ieee80211_chan2ieee(ic, ni->ni_chan));
+    
+    /* Add a few channels in turn to discover APs we do not know yet. */
+    for (i = 0, n = 0; i < IEEE80211_CHAN_MAX &&
+         n < IEEE80211_CHANHIST_EXPLORE; i++) {
+        chan = ch->ch_explore % IEEE80211_CHAN_MAX + 1;
+        ch->ch_explore = chan;
+        if (ic->ic_channels[chan].ic_flags == 0 ||
+            isset(ch->ch_scan, chan))
+            continue;
+        setbit(ch->ch_scan, chan);
+        n++;
+    }
+    
+    ch->ch_partial = 1;
+    ch->ch_npartial++;
+}
+
+/*
+ * Called by drivers while building a background scan request. Returns
+ * non-zero if the channel is not part of the current roaming scan.
+ */
+int
+ieee80211_chanhist_skip(struct ieee80211com *ic, struct ieee80211_channel *c)
+{
+    struct ieee80211_chanhist *ch = &ic->ic_chanhist;
+    
+    if (!ch->ch_partial || isset(ch->ch_scan, ieee80211_chan2ieee(ic, c)))
+        return 0;
+    
+    ch->ch_skipped++;
+    return 1;
+}
+
+/*
+ * A partial scan which found no AP of our ESS besides our own is a miss;
+ * make the next roaming scan cover all channels.
+ */
+static void
+ieee80211_chanhist_end_scan(struct ieee80211com *ic)
+{
+    struct ieee80211_chanhist *ch = &ic->ic_chanhist;
+    struct ieee80211_node *ni, *bss = ic->ic_bss;
+    struct _ifnet *ifp = &ic->ic_if;
+    
+    /* Back on our channel; refresh a stale neighbor report. */
+    ieee80211_nbr_request(ic, 0);
+    
+    if (!ch->ch_partial)
+        return;
+    ch->ch_partial = 0;
+    
+    RB_FOREACH(ni, ieee80211_tree, &ic->ic_tree) {
+        if (ni == bss || IEEE80211_ADDR_EQ(ni->ni_macaddr, bss->ni_macaddr))
+            continue;
+        if (ni->ni_esslen == bss->ni_esslen &&
+            memcmp(ni->ni_essid, bss->ni_essid, bss->ni_esslen) == 0)
+            break;
+    }
+    if (ni == NULL) {
+        ch->ch_miss = 1;
+        ch->ch_nmiss++;
+    }
+    
+    if (ifp->if_flags & IFF_DEBUG)
+        XYLog("%s: partial scan %s, %u/%u partial scans missed, "
+              "%u channels skipped (~%u ms off-channel saved)\n",
+              ifp->if_xname, ni == NULL ? "missed" : "hit", ch->ch_nmiss,
+              ch->ch_npartial, ch->ch_skipped,
+              ch->ch_skipped * IEEE80211_CHANHIST_DWELL);
+}
+
+/*
+ * Remember our AP before the interface goes down so that the first scan
+ * after wakeup can go straight to its channel.
+ */
+void
+ieee80211_resume_save(struct ieee80211com *ic)
+{
+    struct ieee80211_resume *rs = &ic->ic_resume;
+    struct ieee80211_node *ni = ic->ic_bss;
+    struct _ifnet *ifp = &ic->ic_if;
+    
+    rs->rs_saved = 0;
+    rs->rs_wakeup = 0;
+    rs->rs_directed = 0;
+    rs->rs_hit = 0;
+    if (ic->ic_opmode != IEEE80211_M_STA ||
+        ic->ic_state != IEEE80211_S_RUN || ni == NULL)
+        return;
+    
+    IEEE80211_ADDR_COPY(rs->rs_bssid, ni->ni_bssid);
+    memcpy(rs->rs_essid, ni->ni_essid, ni->ni_esslen);
+    rs->rs_esslen = ni->ni_esslen;
+    rs->rs_chan = ni->ni_chan;
+    rs->rs_capinfo = ni->ni_capinfo;
+    rs->rs_nodeflags = ni->ni_flags &
+        (IEEE80211_NODE_HT | IEEE80211_NODE_VHT | IEEE80211_NODE_HE);
+    rs->rs_txrate = ni->ni_txrate;
+    rs->rs_txmcs = ni->ni_txmcs;
+    rs->rs_pmkid = (ic->ic_flags & IEEE80211_F_RSNON) &&
+        ieee80211_pmksa_find(ic, ni, NULL) != NULL;
+    rs->rs_saved = ieee80211_roam_uptime();
+    
+    if (ifp->if_flags & IFF_DEBUG)
+        XYLog("%s: saved %s on channel %d for wakeup%s\n",
+              ifp->if_xname, ether_sprintf(rs->rs_bssid),
+              ieee80211_chan2ieee(ic, rs->rs_chan),
+              rs->rs_pmkid ? " (PMKSA cached)" : "");
+}
+
+/*
+ * Called by drivers when the interface comes back up. Arms a scan of the
+ * saved AP's channel only if the snapshot is still usable for the network
+ * we are configured to join.
+ */
+void
+ieee80211_resume_wakeup(struct ieee80211com *ic)
+{
+    struct ieee80211_resume *rs = &ic->ic_resume;
+    
+    rs->rs_directed = 0;
+    rs->rs_hit = 0;
+    rs->rs_wakeup = ieee80211_roam_uptime();
+    if (rs->rs_saved == 0)
+        return;
+    
+    if (ic->ic_opmode != IEEE80211_M_STA ||
+        rs->rs_wakeup - rs->rs_saved > IEEE80211_RESUME_MAXAGE ||
+        isclr(ic->ic_chan_active, ieee80211_chan2ieee(ic, rs->rs_chan)) ||
+        (ic->ic_des_esslen != 0 && (ic->ic_des_esslen != rs->rs_esslen ||
+         memcmp(ic->ic_des_essid, rs->rs_essid, rs->rs_esslen) != 0)) ||
+        ((ic->ic_flags & IEEE80211_F_DESBSSID) &&
+         !IEEE80211_ADDR_EQ(ic->ic_des_bssid, rs->rs_bssid))) {
+        rs->rs_saved = 0;
+        return;
+    }
+    
+    rs->rs_directed = 1;
+}
+
+/*
+ * Called by drivers while building a foreground scan request. Returns
+ * non-zero if the channel is not part of a directed wakeup scan.
+ */
+int
+ieee80211_resume_skip(struct ieee80211com *ic, struct ieee80211_channel *c)
+{
+    struct ieee80211_resume *rs = &ic->ic_resume;
+    
+    return rs->rs_directed && c != rs->rs_chan;
+}
+
+/*
+ * A directed wakeup scan is only tried once per snapshot. If our AP was
+ * not heard on its channel, or changed its privacy setting, the rescan
+ * which follows covers all channels.
+ */
+static void
+ieee80211_resume_end_scan(struct ieee80211com *ic)
+{
+    struct ieee80211_resume *rs = &ic->ic_resume;
+    struct ieee80211_node *ni;
+    struct _ifnet *ifp = &ic->ic_if;
+    
+    if (!rs->rs_directed)
+        return;
+    rs->rs_directed = 0;
+    rs->rs_saved = 0;
+    
+    ni = ieee80211_find_node(ic, rs->rs_bssid);
+    if (ni != NULL && ni->ni_chan == rs->rs_chan &&
+        ((ni->ni_capinfo ^ rs->rs_capinfo) & IEEE80211_CAPINFO_PRIVACY) == 0) {
+        rs->rs_hit = 1;
+        rs->rs_nfast++;
+    } else
+        rs->rs_nfull++;
+    
+    if (ifp->if_flags & IFF_DEBUG)
+        XYLog("%s: wakeup scan of channel %d %s %s, %u/%u rejoins "
+              "directed\n", ifp->if_xname,
+              ieee80211_chan2ieee(ic, rs->rs_chan),
+              rs->rs_hit ? "found" : "missed", ether_sprintf(rs->rs_bssid),
+              rs->rs_nfast, rs->rs_nfast + rs->rs_nfull);
+}
+
+/*
+ * Called when the link comes up. Reports the time since wakeup and, if we
+ * are back on the same AP with the same PHY mode, starts from the TX rate
+ * which was in use before sleep rather than from the lowest rate.
+ */
+void
+ieee80211_resume_linkup(struct ieee80211com *ic)
+{
+    struct ieee80211_resume *rs = &ic->ic_resume;
+    struct ieee80211_node *ni = ic->ic_bss;
+    struct _ifnet *ifp = &ic->ic_if;
+    u_int64_t elapsed;
+    
+    if (rs->rs_wakeup == 0 || ni == NULL)
+        return;
+    elapsed = ieee80211_roam_uptime() - rs->rs_wakeup;
+    rs->rs_wakeup = 0;
+    
+    if (rs->rs_hit && IEEE80211_ADDR_EQ(ni->ni_bssid, rs->rs_bssid) &&
+        (ni->ni_flags & (IEEE80211_NODE_HT | IEEE80211_NODE_VHT |
+                         IEEE80211_NODE_HE)) == rs->rs_nodeflags) {
+        if (rs->rs_txrate < ni->ni_rates.rs_nrates)
+            ni->ni_txrate = rs->rs_txrate;
+        if (rs->rs_nodeflags == IEEE80211_NODE_HT &&
+            rs->rs_txmcs >= 0 && rs->rs_txmcs < 80 &&
+            isset(ni->ni_rxmcs, rs->rs_txmcs))
+            ni->ni_txmcs = rs->rs_txmcs;
+    }
+    
+    if (ifp->if_flags & IFF_DEBUG)
+        XYLog("%s: link up %llu ms after wakeup (%s%s)\n", ifp->if_xname,
+              elapsed, rs->rs_hit ? "directed rejoin" : "full scan",
+              rs->rs_hit && rs->rs_pmkid ? ", PMKSA cached" : "");
+    rs->rs_hit = 0;
+}
+
+/* Forget the 802.11r key hierarchy, e.g. after leaving the mobility domain. */
+void
+ieee80211_ft_reset(struct ieee80211com *ic)
+{
+    struct ieee80211_ft *ft = &ic->ic_ft;
+    u_int32_t ntrans = ft->ft_ntrans, nfallback = ft->ft_nfallback;
+    
+    explicit_bzero(ft, sizeof(*ft));
+    ft->ft_gtkid = ft->ft_igtkid = -1;
+    ft->ft_ntrans = ntrans;
+    ft->ft_nfallback = nfallback;
+}
+
+/*
+ * Decide whether joining selbs can use an 802.11r fast transition: we must
+ * be roaming away from an AP of the same ESS and mobility domain whose
+ * FT-PSK key hierarchy was confirmed by a 4-way handshake.
+ */
+void
+ieee80211_ft_prepare(struct ieee80211com *ic, struct ieee80211_node *selbs)
+{
+    struct ieee80211_ft *ft = &ic->ic_ft;
+    struct ieee80211_node *ni = ic->ic_bss;
+    
+    ft->ft_flags &= ~(IEEE80211_FT_F_ROAM | IEEE80211_FT_F_SETKEYS);
+    if (!(ft->ft_flags & IEEE80211_FT_F_VALID))
+        return;
+    if (!(selbs->ni_flags & IEEE80211_NODE_MDE) ||
+        memcmp(selbs->ni_mdid, ft->ft_mdid, 2) != 0 ||
+        selbs->ni_esslen != ft->ft_esslen ||
+        memcmp(selbs->ni_essid, ft->ft_essid, ft->ft_esslen) != 0) {
+        ieee80211_ft_reset(ic);
+        return;
+    }
+    if (ic->ic_opmode != IEEE80211_M_STA ||
+        ic->ic_state != IEEE80211_S_RUN || ni == NULL ||
+        IEEE80211_ADDR_EQ(ni->ni_bssid, selbs->ni_bssid) ||
+        !(ic->ic_flags & IEEE80211_F_PSK) ||
+        !(selbs->ni_rsnakms & ic->ic_rsnakms & IEEE80211_AKM_FT_PSK))
+        return;
+    
+    IEEE80211_ADDR_COPY(ft->ft_prevbssid, ni->ni_bssid);
+    arc4random_buf(ft->ft_snonce, EAPOL_KEY_NONCE_LEN);
+    ft->ft_start = ieee80211_roam_uptime();
+    ft->ft_flags |= IEEE80211_FT_F_ROAM;
+}
+
+/* Whether ni is the target of an 802.11r fast transition in progress. */
+int
+ieee80211_ft_roaming(struct ieee80211com *ic, struct ieee80211_node *ni)
+{
+    return ic->ic_opmode == IEEE80211_M_STA && ni == ic->ic_bss &&
+        (ic->ic_ft.ft_flags & IEEE80211_FT_F_ROAM) &&
+        ieee80211_is_ft_akm((enum ieee80211_akm)ni->ni_rsnakms);
+}
+
+/*
+ * Install the keys obtained from an 802.11r reassociation once the driver
+ * has moved to RUN state. There is no 4-way handshake to wait for, so the
+ * port opens right away.
+ */
+void
+ieee80211_ft_setkeys(struct ieee80211com *ic, struct ieee80211_node *ni)
+{
+    struct ieee80211_ft *ft = &ic->ic_ft;
+    struct _ifnet *ifp = &ic->ic_if;
+    int kid[2] = { ft->ft_gtkid, ft->ft_igtkid };
+    int i, deferlink = 0;
+    
+    ft->ft_flags &= ~IEEE80211_FT_F_SETKEYS;
+    ft->ft_gtkid = ft->ft_igtkid = -1;
+    
+    switch ((*ic->ic_set_key)(ic, ni, &ni->ni_pairwise_key)) {
+        case 0:
+            break;
+        case EBUSY:
+            deferlink = 1;
+            break;
+        default:
+            goto fail;
+    }
+    ni->ni_flags &= ~IEEE80211_NODE_RSN_NEW_PTK;
+    ni->ni_flags |= IEEE80211_NODE_TXRXPROT;
+    for (i = 0; i < nitems(kid); i++) {
+        if (kid[i] < 0)
+            continue;
+        switch ((*ic->ic_set_key)(ic, ni, &ic->ic_nw_keys[kid[i]])) {
+            case 0:
+                break;
+            case EBUSY:
+                deferlink = 1;
+                break;
+            default:
+                goto fail;
+        }
+    }
+    
+    ni->ni_rsn_supp_state = RNSA_SUPP_PTKDONE;
+    ni->ni_assoc_fail = 0;
+    ic->ic_rsngroupcipher = ni->ni_rsngroupcipher;
+    if (deferlink == 0) {
+        ni->ni_port_valid = 1;
+        ieee80211_set_link_state(ic, LINK_STATE_UP);
+    }
+    ft->ft_ntrans++;
+    XYLog("%s: fast transition from %s ", ifp->if_xname,
+          ether_sprintf(ft->ft_prevbssid));
+    XYLog("to %s took %llu ms\n", ether_sprintf(ni->ni_bssid),
+          ieee80211_roam_uptime() - ft->ft_start);
+    return;
+fail:
+    XYLog("%s: could not install FT keys for %s\n", ifp->if_xname,
+          ether_sprintf(ni->ni_bssid));
+    ft->ft_flags &= ~IEEE80211_FT_F_VALID;
+    IEEE80211_SEND_MGMT(ic, ni, IEEE80211_FC0_SUBTYPE_DEAUTH,
+                        IEEE80211_REASON_AUTH_LEAVE);
+    ieee80211_new_state(ic, IEEE80211_S_SCAN, -1);
+}
+
+static struct ieee80211_nbr_ess *
+ieee80211_nbr_lookup(struct ieee80211com *ic, const u_int8_t *essid,
+                     int esslen, int create)
+{
+    struct ieee80211_rrm *rr = &ic->ic_rrm;
+    struct ieee80211_nbr_ess *ne, *slot = NULL;
+    int i;
+    
+    if (esslen == 0)
+        return NULL;
+    
+    for (i = 0; i < IEEE80211_NBR_ESS; i++) {
+        ne = &rr->rr_ess[i];
+        if (ne->ne_esslen == esslen &&
+            memcmp(ne->ne_essid, essid, esslen) == 0)
+            return ne;
+        if (slot == NULL || ne->ne_updated < slot->ne_updated)
+            slot = ne;
+    }
+    if (!create)
+        return NULL;
+    
+    memset(slot, 0, sizeof(*slot));
+    memcpy(slot->ne_essid, essid, esslen);
+    slot->ne_esslen = esslen;
+    return slot;
+}
+
+/*
+ * Ask our AP for a neighbor report if it supports them. Unless force is
+ * set, nothing is sent while the report we have for the ESS is recent.
+ */
+void
+ieee80211_nbr_request(struct ieee80211com *ic, int force)
+{
+    struct ieee80211_rrm *rr = &ic->ic_rrm;
+    struct ieee80211_node *ni = ic->ic_bss;
+    struct ieee80211_nbr_ess *ne;
+    u_int64_t now;
+    
+    if (ic->ic_opmode != IEEE80211_M_STA || ic->ic_state != IEEE80211_S_RUN ||
+        ni == NULL || !(ni->ni_flags & IEEE80211_NODE_RMCAP))
+        return;
+    if ((ic->ic_flags & IEEE80211_F_RSNON) && !ni->ni_port_valid)
+        return;
+    
+    now = ieee80211_roam_uptime();
+    if (rr->rr_reqtime != 0 && now - rr->rr_reqtime < IEEE80211_NBR_TIMEOUT)
+        return;
+    ne = ieee80211_nbr_lookup(ic, ni->ni_essid, ni->ni_esslen, 0);
+    if (!force && ne != NULL && now - ne->ne_updated < IEEE80211_NBR_MAXAGE)
+        return;
+    
+    if (++rr->rr_token == 0)
+        rr->rr_token = 1;
+    rr->rr_reqtime = now;
+    rr->rr_nreq++;
+    IEEE80211_SEND_ACTION(ic, ni, IEEE80211_CATEG_RADIO_MSRMNT,
+                          IEEE80211_ACTION_RM_NEIGHBOR_REQ, rr->rr_token);
+}
+
+/*
+ * Replace the neighbor list of our ESS with the APs listed in a Neighbor
+ * Report Response or BSS Transition Management Request. Our own AP, APs
+ * reported as unreachable and channels we cannot use are left out.
+ */
+static void
+ieee80211_nbr_store(struct ieee80211com *ic, const struct ieee80211_nbr *nbr,
+                    int n)
+{
+    struct ieee80211_node *ni = ic->ic_bss;
+    struct ieee80211_nbr_ess *ne;
+    struct _ifnet *ifp = &ic->ic_if;
+    int i;
+    
+    ne = ieee80211_nbr_lookup(ic, ni->ni_essid, ni->ni_esslen, 1);
+    if (ne == NULL)
+        return;
+    ne->ne_nnbr = 0;
+    for (i = 0; i < n && ne->ne_nnbr < IEEE80211_NBR_MAX; i++) {
+        if (IEEE80211_ADDR_EQ(nbr[i].nb_bssid, ni->ni_bssid))
+            continue;
+        if ((nbr[i].nb_bssinfo & IEEE80211_NBR_BSSINFO_REACH_MASK) ==
+            IEEE80211_NBR_BSSINFO_REACH_NO)
+            continue;
+        /* 6 GHz channel numbers overlap those of the other bands. */
+        if (nbr[i].nb_opclass >= 131 && nbr[i].nb_opclass <= 137)
+            continue;
+        if (nbr[i].nb_chan == 0 || nbr[i].nb_chan > IEEE80211_CHAN_MAX ||
+            ic->ic_channels[nbr[i].nb_chan].ic_flags == 0)
+            continue;
+        ne->ne_nbr[ne->ne_nnbr++] = nbr[i];
+        if (ifp->if_flags & IFF_DEBUG)
+            XYLog("%s: neighbor %s on channel %u\n", ifp->if_xname,
+                  ether_sprintf(nbr[i].nb_bssid),
+                  nbr[i].nb_chan);
+    }
+    ne->ne_updated = ieee80211_roam_uptime();
+    
+    if (ifp->if_flags & IFF_DEBUG)
+        XYLog("%s: neighbor report from %s lists %d of %d APs\n",
+              ifp->if_xname, ether_sprintf(ni->ni_bssid), ne->ne_nnbr, n);
+}
+
+/* Process the Neighbor Report Response to our last request. */
+void
+ieee80211_nbr_update(struct ieee80211com *ic, u_int8_t token,
+                     const struct ieee80211_nbr *nbr, int n)
+{
+    struct ieee80211_rrm *rr = &ic->ic_rrm;
+    
+    if (rr->rr_reqtime == 0 || token != rr->rr_token) {
+        DPRINTF(("unexpected neighbor report token %u\n", token));
+        return;
+    }
+    rr->rr_reqtime = 0;
+    rr->rr_nresp++;
+    ieee80211_nbr_store(ic, nbr, n);
+}
+
+/*
+ * Fill chans with the channels of the neighbors reported for our ESS plus
+ * our own channel. Returns zero if there is no recent report, in which
+ * case the caller uses the channel history instead.
+ */
+int
+ieee80211_nbr_prepare(struct ieee80211com *ic, u_char *chans)
+{
+    struct ieee80211_rrm *rr = &ic->ic_rrm;
+    struct ieee80211_node *ni = ic->ic_bss;
+    struct ieee80211_nbr_ess *ne;
+    int i;
+    
+    ne = ieee80211_nbr_lookup(ic, ni->ni_essid, ni->ni_esslen, 0);
+    if (ne == NULL || ne->ne_nnbr == 0 ||
+        ieee80211_roam_uptime() - ne->ne_updated >= IEEE80211_NBR_MAXAGE)
+        return 0;
+    
+    memset(chans, 0, howmany(IEEE80211_CHAN_MAX, NBBY));
+    for (i = 0; i < ne->ne_nnbr; i++)
+        setbit(chans, ne->ne_nbr[i].nb_chan);
+    setbit(chans, ieee80211_chan2ieee(ic, ni->ni_chan));
+    rr->rr_nscan++;
+    return 1;
+}
+
+/*
+ * Find the AP to move to for the last BSS Transition Management Request
+ * among the nodes of the node cache: the most preferred candidate it
+ * listed which we can use right away or, if any is set, whichever AP of
+ * our ESS we would roam to.
+ */
+static struct ieee80211_node *
+ieee80211_btm_select(struct ieee80211com *ic, int any, int *selpref)
+{
+    struct ieee80211_btm *bt = &ic->ic_btm;
+    struct ieee80211_node *bss = ic->ic_bss, *ni, *selbs = NULL;
+    const struct ieee80211_nbr *nb;
+    u_int32_t tput, seltput = 0;
+    int i;
+    
+    *selpref = 0;
+    for (i = 0; i < bt->bt_ncand; i++) {
+        nb = &bt->bt_cand[i];
+        if (nb->nb_pref == 0 ||
+            IEEE80211_ADDR_EQ(nb->nb_bssid, bss->ni_bssid))
+            continue;
+        ni = ieee80211_find_node(ic, nb->nb_bssid);
+        if (ni == NULL || ni->ni_fails ||
+            ieee80211_match_bss(ic, ni, 1) != 0)
+            continue;
+        tput = ieee80211_node_estimate_tput(ic, ni);
+        if (selbs == NULL || nb->nb_pref > *selpref ||
+            (nb->nb_pref == *selpref && tput > seltput)) {
+            selbs = ni;
+            *selpref = nb->nb_pref;
+            seltput = tput;
+        }
+    }
+    if (selbs == NULL && any) {
+        ni = ieee80211_node_choose_bss(ic, 1, NULL);
+        if (ni != NULL && ieee80211_node_cmp(bss, ni) != 0)
+            selbs = ni;
+    }
+    return selbs;
+}
+
+/*
+ * Answer the last BSS Transition Management Request: decline it, giving
+ * why, or accept it and move to selbs.
+ */
+static void
+ieee80211_btm_respond(struct ieee80211com *ic, struct ieee80211_node *selbs,
+                      int selpref, const char *why, u_int8_t status)
+{
+    struct ieee80211_btm *bt = &ic->ic_btm;
+    struct ieee80211_node *bss = ic->ic_bss;
+    struct _ifnet *ifp = &ic->ic_if;
+    
+    if (why != NULL) {
+        bt->bt_status = status;
+        XYLog("%s: BSS transition request %u from %s rejected: %s%s\n",
+              ifp->if_xname, bt->bt_token, ether_sprintf(bss->ni_bssid), why,
+              (bt->bt_mode & IEEE80211_BTM_REQ_DISASSOC) ?
+              " (disassociation imminent)" : "");
+        IEEE80211_SEND_ACTION(ic, bss, IEEE80211_CATEG_WNM,
+                              IEEE80211_ACTION_BTM_RESP, 0);
+        return;
+    }
+    
+    bt->bt_status = IEEE80211_BTM_STATUS_ACCEPT;
+    IEEE80211_ADDR_COPY(bt->bt_target, selbs->ni_bssid);
+    bt->bt_naccept++;
+    XYLog("%s: BSS transition request %u from %s accepted: moving to %s "
+          "chan %d (preference %d)\n", ifp->if_xname, bt->bt_token,
+          ether_sprintf(bss->ni_bssid), ether_sprintf(selbs->ni_bssid),
+          ieee80211_chan2ieee(ic, selbs->ni_chan), selpref);
+    IEEE80211_SEND_ACTION(ic, bss, IEEE80211_CATEG_WNM,
+                          IEEE80211_ACTION_BTM_RESP, 0);
+    
+    ic->ic_flags |= IEEE80211_F_BGSCAN;
+    if (ieee80211_node_leave_bss(ic, bss, selbs, 1) != 0)
+        ic->ic_flags &= ~IEEE80211_F_BGSCAN;
+}
+
+/*
+ * Start a background scan for the candidates of a BSS Transition
+ * Management Request. Only their channels are visited, which the request
+ * just made the neighbor list of our ESS; the request is answered by
+ * ieee80211_btm_end_scan().
+ */
+static int
+ieee80211_btm_scan(struct ieee80211com *ic)
+{
+    struct ieee80211_chanhist *ch = &ic->ic_chanhist;
+    struct ieee80211_btm *bt = &ic->ic_btm;
+    struct _ifnet *ifp = &ic->ic_if;
+    
+    if (ic->ic_bgscan_start == NULL)
+        return EOPNOTSUPP;
+    
+    ch->ch_partial = ieee80211_nbr_prepare(ic, ch->ch_scan);
+    if (ic->ic_bgscan_start(ic) != 0) {
+        ch->ch_partial = 0;
+        return EBUSY;
+    }
+    if (ch->ch_partial)
+        ch->ch_npartial++;
+    else
+        ch->ch_nfull++;
+    
+    /* As ieee80211_begin_bgscan() does; our candidates must be heard. */
+    ieee80211_free_allnodes(ic, 0 /* keep ic->ic_bss */);
+    ic->ic_flags |= IEEE80211_F_BGSCAN;
+    ic->ic_flags &= ~IEEE80211_F_DISABLE_BG_AUTO_CONNECT;
+    bt->bt_scan = 1;
+    bt->bt_nscan++;
+    if (ifp->if_flags & IFF_DEBUG)
+        XYLog("%s: scanning %s channels for BSS transition request %u\n",
+              ifp->if_xname, ch->ch_partial ? "candidate" : "all",
+              bt->bt_token);
+    return 0;
+}
+
+/*
+ * Handle a BSS Transition Management Request from our AP. We move to the
+ * most preferred candidate it lists that the node cache filled by our
+ * last scan shows we can use. Without an abridged list, any other AP of
+ * our ESS from the cache will do as well. If none qualifies, the channels
+ * of the candidates are scanned before the request is answered. The
+ * candidates also become the neighbor list of the ESS so that the next
+ * roaming scan visits them.
+ */
+void
+ieee80211_btm_request(struct ieee80211com *ic, u_int8_t token, u_int8_t mode,
+                      const struct ieee80211_nbr *nbr, int n)
+{
+    struct ieee80211_btm *bt = &ic->ic_btm;
+    struct ieee80211_node *selbs = NULL;
+    const char *why = NULL;
+    u_int8_t status = IEEE80211_BTM_STATUS_REJECT_UNSPEC;
+    int selpref = 0;
+    
+    bt->bt_nreq++;
+    bt->bt_token = token;
+    bt->bt_mode = mode;
+    bt->bt_ncand = MIN(n, IEEE80211_NBR_MAX);
+    memcpy(bt->bt_cand, nbr, bt->bt_ncand * sizeof(*nbr));
+    if (n > 0)
+        ieee80211_nbr_store(ic, nbr, n);
+    
+    if (ic->ic_flags & IEEE80211_F_BGSCAN)
+        why = "scan in progress";
+    else if (ic->ic_flags & IEEE80211_F_DESBSSID)
+        why = "BSSID is fixed";
+    else {
+        selbs = ieee80211_btm_select(ic,
+            !(mode & IEEE80211_BTM_REQ_ABRIDGED), &selpref);
+        if (selbs == NULL && ieee80211_btm_scan(ic) == 0)
+            return;
+        if (selbs == NULL) {
+            why = "no usable candidate in scan cache";
+            status = IEEE80211_BTM_STATUS_REJECT_NO_CAND;
+        }
+    }
+    ieee80211_btm_respond(ic, selbs, selpref, why, status);
+}
+
+/*
+ * Called at the end of a background scan; answers the BSS Transition
+ * Management Request the scan was started for, if any, and returns
+ * non-zero in that case. Once our AP has announced that it will
+ * disassociate us, any AP of our ESS beats losing the link.
+ */
+static int
+ieee80211_btm_end_scan(struct ieee80211com *ic, int bgscan)
+{
+    struct ieee80211_btm *bt = &ic->ic_btm;
+    struct ieee80211_node *selbs;
+    int selpref;
+    
+    if (!bt->bt_scan)
+        return 0;
+    bt->bt_scan = 0;
+    if (!bgscan)
+        return 0;
+    
+    ic->ic_flags &= ~IEEE80211_F_BGSCAN;
+    selbs = ieee80211_btm_select(ic,
+        !(bt->bt_mode & IEEE80211_BTM_REQ_ABRIDGED) ||
+        (bt->bt_mode & IEEE80211_BTM_REQ_DISASSOC), &selpref);
+    ieee80211_btm_respond(ic, selbs, selpref,
+        selbs == NULL ? "no usable candidate found by scan" : NULL,
+        IEEE80211_BTM_STATUS_REJECT_NO_CAND);
+    return 1;
+}
+
+/* Whether the current scan visits channel chan. */
+static int
+ieee80211_chan_scanned(struct ieee80211com *ic, int chan)
+{
+    struct ieee80211_chanhist *ch = &ic->ic_chanhist;
+    
+    if (ic->ic_channels[chan].ic_flags == 0)
+        return 0;
+    return (!ch->ch_partial || isset(ch->ch_scan, chan));
+}
+
+/* Share of the scan time a channel deserves, in 1/16. */
+static u_int
+ieee80211_chanstat_weight(struct ieee80211com *ic, int chan)
+{
+    struct ieee80211_chanstat *cs = &ic->ic_chanstat[chan];
+    
+    if (cs->cs_nscan == 0)
+        return 16;
+    if (cs->cs_nbss < 8)
+        return 8;
+    return MIN(16 + cs->cs_nbss / 2, 48);
+}
+
+/* Update the number of APs heard on each channel we just scanned. */
+static void
+ieee80211_chanstat_end_scan(struct ieee80211com *ic)
+{
+    u_int16_t nbss[IEEE80211_CHAN_MAX + 1];
+    struct ieee80211_chanstat *cs;
+    struct ieee80211_node *ni;
+    int chan;
+    
+    if (ic->ic_opmode != IEEE80211_M_STA)
+        return;
+    
+    memset(nbss, 0, sizeof(nbss));
+    RB_FOREACH(ni, ieee80211_tree, &ic->ic_tree) {
+        if (ni->ni_chan == NULL || ni->ni_chan == IEEE80211_CHAN_ANYC)
+            continue;
+        /* Skip cached APs we have not heard during this scan. */
+        if (ni->ni_scanseq != ic->ic_scanseq)
+            continue;
+        nbss[ieee80211_chan2ieee(ic, ni->ni_chan)]++;
+    }
+    
+    for (chan = 1; chan <= IEEE80211_CHAN_MAX; chan++) {
+        if (!ieee80211_chan_scanned(ic, chan))
+            continue;
+        cs = &ic->ic_chanstat[chan];
+        if (cs->cs_nscan == 0)
+            cs->cs_nbss = MIN(nbss[chan], 255) << 4;
+        else
+            cs->cs_nbss += ((int)(MIN(nbss[chan], 255) << 4) -
+                            (int)cs->cs_nbss) / 4;
+        if (cs->cs_nscan < 0xffff)
+            cs->cs_nscan++;
+    }
+    ic->ic_scanseq++;
+}
+
+/*
+ * Dwell time for channel c in the scan being set up. The dwell times of
+ * the scanned channels of the same band are scaled by how many APs were
+ * heard on them, keeping their sum at the fixed dwell times' total, and
+ * bounded by [min, max].
+ */
+u_int
+ieee80211_scan_dwell(struct ieee80211com *ic, struct ieee80211_channel *c,
+                     u_int dwell, u_int min, u_int max)
+{
+    u_int chan = ieee80211_chan2ieee(ic, c);
+    u_int i, n = 0, sum = 0;
+    
+    for (i = 1; i <= IEEE80211_CHAN_MAX; i++) {
+        if (!ieee80211_chan_scanned(ic, i) ||
+            IEEE80211_IS_CHAN_2GHZ(&ic->ic_channels[i]) !=
+            IEEE80211_IS_CHAN_2GHZ(c))
+            continue;
+        sum += ieee80211_chanstat_weight(ic, i);
+        n++;
+    }
+    if (sum == 0)
+        return dwell;
+    
+    dwell = dwell * ieee80211_chanstat_weight(ic, chan) * n / sum;
+    return MIN(MAX(dwell, min), max);
+}
+
+/*
+ * Number of APs to expect on a channel of the given band, for firmware
+ * which adapts dwell times itself. Returns dflt until the band has been
+ * scanned. Firmware leaves a channel once it has heard as many APs as
+ * we expect, so the counts we learn never exceed what we asked for; ask
+ * for twice as many to let them grow on crowded channels.
+ */
+u_int
+ieee80211_scan_naps(struct ieee80211com *ic, u_int flags, u_int dflt)
+{
+    struct ieee80211_chanstat *cs;
+    u_int chan, naps = 0;
+    int seen = 0;
+    
+    for (chan = 1; chan <= IEEE80211_CHAN_MAX; chan++) {
+        if ((ic->ic_channels[chan].ic_flags & flags) != flags)
+            continue;
+        cs = &ic->ic_chanstat[chan];
+        if (cs->cs_nscan == 0)
+            continue;
+        naps = MAX(naps, (u_int)(cs->cs_nbss + 15) >> 4);
+        seen = 1;
+    }
+    if (!seen)
+        return dflt;
+    
+    return MIN(2 * naps + 1, IEEE80211_SCAN_NAPS_MAX);
+}
+
+/*
+ * Report the memory held by the node cache after a scan. Nodes from the
+ * driver are larger than struct ieee80211_node, so the sizes are those
+ * the nodes and their IEs were allocated with.
+ */
+static void
+ieee80211_node_cache_stats(struct ieee80211com *ic)
+{
+    struct ieee80211_node *ni;
+    size_t bytes = 0;
+    int n = 0, full = 0;
+    
+    RB_FOREACH(ni, ieee80211_tree, &ic->ic_tree) {
+        n++;
+        if ((ni->ni_flags & IEEE80211_NODE_SCANONLY) == 0)
+            full++;
+        bytes += malloc_size(ni) + malloc_size(ni->ni_rsnie) +
+            malloc_size(ni->ni_rsnie_tlv);
+    }
+    XYLog("%s: %d scan entries (%d with driver state), %zu bytes,"
+          " %zu bytes/entry\n", ic->ic_if.if_xname, n, full, bytes,
+          n ? bytes / n : 0);
+}
+
+/*
+ * Complete a scan of potential channels.
+ */
+void
+ieee80211_end_scan(struct _ifnet *ifp)
+{
+    struct ieee80211com *ic = (struct ieee80211com *)ifp;
+    struct ieee80211_node *ni, *selbs = NULL, *curbs = NULL;
+    int bgscan = ((ic->ic_flags & IEEE80211_F_BGSCAN) &&
+                  ic->ic_opmode == IEEE80211_M_STA &&
+                  ic->ic_state == IEEE80211_S_RUN);
+    int roamscan = bgscan &&
+                (ic->ic_flags & IEEE80211_F_DISABLE_BG_AUTO_CONNECT) == 0;
+    
+    if (ic->ic_event_handler)
+        (*ic->ic_event_handler)(ic, IEEE80211_EVT_SCAN_DONE, NULL);
+    
+    if (ifp->if_flags & IFF_DEBUG)
+        XYLog("%s: end %s scan\n", ifp->if_xname,
+              bgscan ? (roamscan ? "roam" : "background") :
+              ((ic->ic_flags & IEEE80211_F_ASCAN) ?
+               "active" : "passive"));
+    
+    if (ic->ic_scan_count)
+        ic->ic_flags &= ~IEEE80211_F_ASCAN;
+    
+    if (ic->ic_opmode == IEEE80211_M_STA) {
+        ieee80211_clean_inactive_nodes(ic, IEEE80211_INACT_SCAN);
+        if (ifp->if_flags & IFF_DEBUG)
+            ieee80211_node_cache_stats(ic);
+    }
+    
+    ieee80211_chanstat_end_scan(ic);
+    ieee80211_chanhist_end_scan(ic);
+    ieee80211_resume_end_scan(ic);
+    if (ieee80211_btm_end_scan(ic, bgscan))
+        return;
+    
+    ni = RB_MIN(ieee80211_tree, &ic->ic_tree);
+    
+#ifndef IEEE80211_STA_ONLY
+    if (ic->ic_opmode == IEEE80211_M_HOSTAP) {
+        /* XXX off stack? */
+        u_char occupied[howmany(IEEE80211_CHAN_MAX, NBBY)];
+        int i, fail;
+        
+        /*
+         * The passive scan to look for existing AP's completed,
+         * select a channel to camp on.  Identify the channels
+         * that already have one or more AP's and try to locate
+         * an unoccupied one.  If that fails, pick a random
+         * channel from the active set.
+         */
+        memset(occupied, 0, sizeof(occupied));
+        RB_FOREACH(ni, ieee80211_tree, &ic->ic_tree)
+        setbit(occupied, ieee80211_chan2ieee(ic, ni->ni_chan));
+        for (i = 0; i < IEEE80211_CHAN_MAX; i++)
+            if (isset(ic->ic_chan_active, i) && isclr(occupied, i))
+                break;
+        if (i == IEEE80211_CHAN_MAX) {
+            fail = arc4random() & 3;	/* random 0-3 */
+            for (i = 0; i < IEEE80211_CHAN_MAX; i++)
+                if (isset(ic->ic_chan_active, i) && fail-- == 0)
+                    break;
+        }
+        ieee80211_create_ibss(ic, &ic->ic_channels[i]);
+        return;
+    }
+#endif
+    if (ni == NULL) {
+        DPRINTF(("no scan candidate\n"));
+    notfound:
+        
+#ifndef IEEE80211_STA_ONLY
+        if (ic->ic_opmode == IEEE80211_M_IBSS &&
+            (ic->ic_flags & IEEE80211_F_IBSSON) &&
+            ic->ic_des_esslen != 0) {
+            ieee80211_create_ibss(ic, ic->ic_ibss_chan);
+            return;
+        }
+#endif
+        if (ic->ic_state != IEEE80211_S_RUN) {
+            /*
+             * Reset the list of channels to scan and scan the next mode
+             * if nothing has been found.
+             * If the device scans all bands in one fell swoop, return
+             * current scan results to userspace regardless of mode.
+             * This will loop forever until an access point is found.
+             */
+            ieee80211_reset_scan(ifp);
+            if (ieee80211_next_mode(ifp) == IEEE80211_MODE_AUTO ||
+                (ic->ic_caps & IEEE80211_C_SCANALLBAND))
+                ic->ic_scan_count++;
+            
+            ieee80211_next_scan(ifp);
+        }
+        return;
+    }
+    
+    /* Possibly switch which ssid we are associated with */
+    if (!bgscan && ic->ic_opmode == IEEE80211_M_STA)
+        ieee80211_switch_ess(ic);
+    
+    selbs = ieee80211_node_choose_bss(ic, bgscan, &curbs);
+    if (bgscan) {
+        ic->ic_flags &= ~IEEE80211_F_DISABLE_BG_AUTO_CONNECT;
+        if (!roamscan) {
+            ic->ic_flags &= ~IEEE80211_F_BGSCAN;
+            return;
         }
         
         /* AP disappeared? Should not happen. */
@@ -1500,6 +2934,12 @@ ieee80211_end_scan(struct _ifnet *ifp)
             goto notfound;
         }
         
+        /* Stay with our AP unless the gain is worth the roam. */
+        if (selbs != curbs && !ieee80211_roam_better(ic, curbs, selbs)) {
+            ic->ic_roam.r_kept++;
+            selbs = curbs;
+        }
+        
         /*
          * After a background scan we might end up choosing the
          * same AP again. Do not change ic->ic_bss in this case,
@@ -1528,40 +2968,8 @@ ieee80211_end_scan(struct _ifnet *ifp)
             return;
         }
         
-        arg = (struct ieee80211_node_switch_bss_arg *)malloc(sizeof(*arg), 0, 0);
-        if (arg == NULL) {
-            ic->ic_flags &= ~IEEE80211_F_BGSCAN;
-            return;
-        }
-        
-        ic->ic_bgscan_fail = 0;
-        
-        /*
-         * We are going to switch APs. Stop A-MPDU Tx and
-         * queue a de-auth frame addressed to our current AP.
-         */
-        ieee80211_stop_ampdu_tx(ic, ic->ic_bss,
-                                IEEE80211_FC0_SUBTYPE_DEAUTH);
-        if (IEEE80211_SEND_MGMT(ic, ic->ic_bss,
-                                IEEE80211_FC0_SUBTYPE_DEAUTH,
-                                IEEE80211_REASON_AUTH_LEAVE) != 0) {
+        if (ieee80211_node_leave_bss(ic, curbs, selbs, 0) != 0)
             ic->ic_flags &= ~IEEE80211_F_BGSCAN;
-            free(arg);
-            return;
-        }
-        
-        /* Prevent dispatch of additional data frames to hardware. */
-        ic->ic_xflags |= IEEE80211_F_TX_MGMT_ONLY;
-        
-        /*
-         * Install a callback which will switch us to the new AP once
-         * all dispatched frames have been processed by hardware.
-         */
-        IEEE80211_ADDR_COPY(arg->cur_macaddr, curbs->ni_macaddr);
-        IEEE80211_ADDR_COPY(arg->sel_macaddr, selbs->ni_macaddr);
-        ic->ic_bss->ni_unref_arg = arg;
-        ic->ic_bss->ni_unref_arg_size = sizeof(*arg);
-        ic->ic_bss->ni_unref_cb = ieee80211_node_switch_bss;
         /* F_BGSCAN flag gets cleared in ieee80211_node_join_bss(). */
         return;
     } else if (selbs == NULL)
@@ -1590,11 +2998,15 @@ ieee80211_choose_rsnparams(struct ieee80211com *ic)
     
     /* filter out unsupported AKMPs */
     ni->ni_rsnakms &= ic->ic_rsnakms;
-    /* prefer SHA-256 based AKMPs */
+    /* prefer FT, then SHA-256 based AKMPs */
     if ((ic->ic_flags & IEEE80211_F_PSK) && (ni->ni_rsnakms &
-                                             (IEEE80211_AKM_PSK | IEEE80211_AKM_SHA256_PSK))) {
+                                             (IEEE80211_AKM_PSK | IEEE80211_AKM_SHA256_PSK |
+                                              IEEE80211_AKM_FT_PSK))) {
         /* AP supports PSK AKMP and a PSK is configured */
-        if (ni->ni_rsnakms & IEEE80211_AKM_SHA256_PSK)
+        if ((ni->ni_rsnakms & IEEE80211_AKM_FT_PSK) &&
+            (ni->ni_flags & IEEE80211_NODE_MDE))
+            ni->ni_rsnakms = IEEE80211_AKM_FT_PSK;
+        else if (ni->ni_rsnakms & IEEE80211_AKM_SHA256_PSK)
             ni->ni_rsnakms = IEEE80211_AKM_SHA256_PSK;
         else
             ni->ni_rsnakms = IEEE80211_AKM_PSK;
@@ -1668,6 +3080,10 @@ ieee80211_node_cleanup(struct ieee80211com *ic, struct ieee80211_node *ni)
     }
     ieee80211_ba_del(ni);
     ieee80211_ba_free(ni);
+    if (ni->ni_txtmpl != NULL) {
+        free(ni->ni_txtmpl);
+        ni->ni_txtmpl = NULL;
+    }
     if (ni->ni_unref_arg != NULL) {
         free(ni->ni_unref_arg);
         ni->ni_unref_arg = NULL;
@@ -1690,11 +3106,29 @@ void
 ieee80211_node_copy(struct ieee80211com *ic,
                     struct ieee80211_node *dst, const struct ieee80211_node *src)
 {
+#ifndef IEEE80211_STA_ONLY
+    CTimeout *eapol_to = dst->ni_eapol_to;
+    CTimeout *sa_query_to = dst->ni_sa_query_to;
+#endif
+    
     ieee80211_node_cleanup(ic, dst);
-    *dst = *src;
+    if (src->ni_flags & IEEE80211_NODE_SCANONLY) {
+        /* Scan entries end before the Block Ack state. */
+        memcpy(dst, src, IEEE80211_NODE_SCAN_SIZE);
+        memset((u_int8_t *)dst + IEEE80211_NODE_SCAN_SIZE, 0,
+               sizeof(*dst) - IEEE80211_NODE_SCAN_SIZE);
+        dst->ni_flags &= ~IEEE80211_NODE_SCANONLY;
+    } else
+        *dst = *src;
+#ifndef IEEE80211_STA_ONLY
+    /* Keep our own timers rather than sharing those of src. */
+    dst->ni_eapol_to = eapol_to;
+    dst->ni_sa_query_to = sa_query_to;
+#endif
     dst->ni_rsnie = NULL;
     if (src->ni_rsnie != NULL)
         ieee80211_save_ie(src->ni_rsnie, &dst->ni_rsnie);
+    dst->ni_txtmpl = NULL;
     dst->ni_rsnie_tlv = NULL;
     dst->ni_rsnie_tlv_len = 0;
     if (src->ni_rsnie_tlv != NULL) {
@@ -1714,25 +3148,32 @@ ieee80211_node_getrssi(struct ieee80211com *ic,
 }
 
 int
-ieee80211_node_checkrssi(struct ieee80211com *ic,
-                         const struct ieee80211_node *ni)
+ieee80211_rssi_checkthres(struct ieee80211com *ic,
+                          const struct ieee80211_channel *chan, u_int8_t rssi)
 {
     uint8_t thres;
     
-    if (ni->ni_chan == IEEE80211_CHAN_ANYC)
+    if (chan == IEEE80211_CHAN_ANYC)
         return 0;
     
     if (ic->ic_max_rssi) {
-        thres = (IEEE80211_IS_CHAN_2GHZ(ni->ni_chan)) ?
+        thres = (IEEE80211_IS_CHAN_2GHZ(chan)) ?
         IEEE80211_RSSI_THRES_RATIO_2GHZ :
         IEEE80211_RSSI_THRES_RATIO_5GHZ;
-        return ((ni->ni_rssi * 100) / ic->ic_max_rssi >= thres);
+        return ((rssi * 100) / ic->ic_max_rssi >= thres);
     }
     
-    thres = (IEEE80211_IS_CHAN_2GHZ(ni->ni_chan)) ?
+    thres = (IEEE80211_IS_CHAN_2GHZ(chan)) ?
     IEEE80211_RSSI_THRES_2GHZ :
     IEEE80211_RSSI_THRES_5GHZ;
-    return (ni->ni_rssi >= (u_int8_t)thres);
+    return (rssi >= (u_int8_t)thres);
+}
+
+int
+ieee80211_node_checkrssi(struct ieee80211com *ic,
+                         const struct ieee80211_node *ni)
+{
+    return ieee80211_rssi_checkthres(ic, ni->ni_chan, ni->ni_rssi);
 }
 
 void
@@ -1775,7 +3216,8 @@ ieee80211_setup_node(struct ieee80211com *ic,
 #ifndef IEEE80211_STA_ONLY
     mq_init(&ni->ni_savedq, IEEE80211_PS_MAX_QUEUE, IPL_NET);
 #endif
-    ieee80211_node_set_timeouts(ni);
+    if ((ni->ni_flags & IEEE80211_NODE_SCANONLY) == 0)
+        ieee80211_node_set_timeouts(ni);
     
     s = splnet();
     RB_INSERT(ieee80211_tree, &ic->ic_tree, ni);
@@ -1794,6 +3236,34 @@ ieee80211_alloc_node(struct ieee80211com *ic, const u_int8_t *macaddr)
     return ni;
 }
 
+/*
+ * Allocate a node for a beacon or probe response.  In STA mode the
+ * node cache only holds scan results; the driver only ever sees ic_bss,
+ * which the selected entry is copied into when we join it.  Such entries
+ * go without the driver's private node state, the per-node timers and
+ * the Block Ack state at the end of struct ieee80211_node.
+ */
+struct ieee80211_node *
+ieee80211_alloc_scan_node(struct ieee80211com *ic, const u_int8_t *macaddr)
+{
+    struct ieee80211_node *ni;
+    
+    if (ic->ic_opmode != IEEE80211_M_STA)
+        return ieee80211_alloc_node(ic, macaddr);
+    
+    if (ic->ic_nnodes >= ic->ic_max_nnodes)
+        ieee80211_clean_nodes(ic, 0);
+    if (ic->ic_nnodes >= ic->ic_max_nnodes ||
+        (ni = (struct ieee80211_node *)malloc(IEEE80211_NODE_SCAN_SIZE,
+        0, 0)) == NULL) {
+        ic->ic_stats.is_rx_nodealloc++;
+        return NULL;
+    }
+    ni->ni_flags |= IEEE80211_NODE_SCANONLY;
+    ieee80211_setup_node(ic, ni, macaddr);
+    return ni;
+}
+
 struct ieee80211_node *
 ieee80211_dup_bss(struct ieee80211com *ic, const u_int8_t *macaddr)
 {
@@ -2024,6 +3494,10 @@ ieee80211_ba_del(struct ieee80211_node *ni)
 {
     int tid;
     
+    /* Scan entries end before the Block Ack state. */
+    if (ni->ni_flags & IEEE80211_NODE_SCANONLY)
+        return;
+    
     for (tid = 0; tid < nitems(ni->ni_rx_ba); tid++) {
         struct ieee80211_rx_ba *ba = &ni->ni_rx_ba[tid];
         if (ba->ba_state != IEEE80211_BA_INIT) {
@@ -2050,10 +3524,14 @@ ieee80211_ba_del(struct ieee80211_node *ni)
     timeout_del(&ni->ni_addba_req_to[EDCA_AC_VO]);
 }
 
-void ieee80211_ba_free(struct ieee80211_node *ni)
+void
+ieee80211_ba_free(struct ieee80211_node *ni)
 {
     int tid;
     
+    if (ni->ni_flags & IEEE80211_NODE_SCANONLY)
+        return;
+    
     for (tid = 0; tid < nitems(ni->ni_rx_ba); tid++) {
         struct ieee80211_rx_ba *ba = &ni->ni_rx_ba[tid];
         timeout_free(&ba->ba_to);
@@ -2816,6 +4294,7 @@ ieee80211_setup_hecaps(struct ieee80211_node *ni, const uint8_t *data,
         memcpy(ni->ni_ppe_thres,
                &data[sizeof(ni->ni_he_cap_elem) + mcs_nss_size],
                he_ppe_size);
+    ni->ni_flags |= IEEE80211_NODE_HECAP;
 }
 
 int
@@ -304,6 +304,29 @@ struct ieee80211_rx_ba {
 	uint8_t			ba_token;
 };
 
+/*
+ * Prebuilt 802.11 data header and LLC/SNAP header used by
+ * ieee80211_encap().  Only the sequence number, the Ethernet type and
+ * the addresses taken from the Ethernet header are patched per frame.
+ * tt_sig and tt_bssid record what the template was built from (QoS,
+ * protection, ack policy, operating mode and BSSID) so that a change
+ * in any of them causes a rebuild.  Whether a frame is sent as QoS
+ * data, which follows the Block Ack agreement, picks the template.
+ * tt_hdr follows the 32-bit tt_sig so that its 16-bit fields are aligned.
+ */
+struct ieee80211_txtmpl {
+	u_int32_t		tt_sig;
+#define IEEE80211_TXTMPL_VALID	0x01
+#define IEEE80211_TXTMPL_QOS	0x02
+#define IEEE80211_TXTMPL_PROT	0x04
+#define IEEE80211_TXTMPL_NOACK	0x08
+#define IEEE80211_TXTMPL_OPMODE_SHIFT	8
+	u_int8_t		tt_hdr[sizeof(struct ieee80211_qosframe)];
+	u_int8_t		tt_llc[8];	/* LLC_SNAPFRAMELEN */
+	u_int8_t		tt_hdrlen;
+	u_int8_t		tt_bssid[IEEE80211_ADDR_LEN];
+};
+
 /*
  * Node specific information.  Note that drivers are expected
  * to derive from this structure to add device-specific per-node
@@ -317,6 +340,7 @@ struct ieee80211_node {
 
 	u_int			ni_refcnt;
 	u_int			ni_scangen;	/* gen# for timeout scan */
+	u_int			ni_scanseq;	/* ic_scanseq when last heard */
 
 	/* hardware */
 	u_int32_t		ni_rstamp;	/* recv timestamp */
@@ -336,6 +360,10 @@ struct ieee80211_node {
 	u_int8_t		*ni_country;	/* country information XXX */
 	struct ieee80211_channel *ni_chan;
 	u_int8_t		ni_erp;		/* 11g only */
+	u_int8_t		ni_bssload_chutil; /* BSS Load channel utilization */
+	u_int16_t		ni_bssload_stacnt; /* BSS Load station count */
+	u_int8_t		ni_mdid[2];	/* 11r mobility domain */
+	u_int8_t		ni_ftcap;	/* 11r FT capability and policy */
 #ifdef AIRPORT
     u_int64_t       ni_age_ts;
 #endif
@@ -429,15 +457,6 @@ struct ieee80211_node {
     uint16_t        ni_he_oper_nss_set;
     uint8_t         ni_he_optional[8];
     
-	/* Timeout handlers which trigger Tx Block Ack negotiation. */
-	CTimeout*		ni_addba_req_to[IEEE80211_NUM_TID];
-	int			ni_addba_req_intval[IEEE80211_NUM_TID];
-#define IEEE80211_ADDBA_REQ_INTVAL_MAX 30	/* in seconds */
-
-	/* Block Ack records */
-	struct ieee80211_tx_ba	ni_tx_ba[IEEE80211_NUM_TID];
-	struct ieee80211_rx_ba	ni_rx_ba[IEEE80211_NUM_TID];
-
 	int			ni_txmcs;	/* current MCS used for TX */
 	int			ni_vht_ss;	/* VHT # spatial streams */
     
@@ -448,6 +467,8 @@ struct ieee80211_node {
 	u_int16_t		ni_txseq;	/* seq to be transmitted */
 	u_int16_t		ni_rxseq;	/* seq previous received */
 	u_int16_t		ni_qos_txseqs[IEEE80211_NUM_TID];
+	/* Tx header templates per TID, plus one for non-QoS frames */
+	struct ieee80211_txtmpl	*ni_txtmpl;
 	u_int16_t		ni_qos_rxseqs[IEEE80211_NUM_TID];
 	int			ni_fails;	/* failure count to associate */
 	uint32_t		ni_assoc_fail;	/* assoc failure reasons */
@@ -489,6 +510,12 @@ struct ieee80211_node {
 #define IEEE80211_NODE_VHT_SGI80    0x80000    /* SGI on 80 MHz negotiated */
 #define IEEE80211_NODE_VHT_SGI160   0x100000    /* SGI on 160 MHz negotiated */
 #define IEEE80211_NODE_HE       0x200000    /* HE negotiated */
+#define IEEE80211_NODE_HECAP     0x400000    /* claims to support HE */
+#define IEEE80211_NODE_BSSLOAD   0x800000    /* ni_bssload_* are valid */
+#define IEEE80211_NODE_MDE       0x1000000   /* ni_mdid/ni_ftcap are valid */
+#define IEEE80211_NODE_RMCAP     0x2000000   /* AP sends neighbor reports */
+#define IEEE80211_NODE_BTM       0x4000000   /* AP supports 11v BSS transitions */
+#define IEEE80211_NODE_SCANONLY  0x8000000   /* scan entry, no driver state */
 
 	/* If not NULL, this function gets called when ni_refcnt hits zero. */
 	void			(*ni_unref_cb)(struct ieee80211com *,
@@ -499,8 +526,27 @@ struct ieee80211_node {
 #ifdef AIRPORT
     uint8_t verb[0x1024];//冗余信息 zxy
 #endif
+
+	/*
+	 * Members from here on are only used with stations we talk to.
+	 * Scan entries (IEEE80211_NODE_SCANONLY) are allocated without
+	 * them, see IEEE80211_NODE_SCAN_SIZE; keep them last.
+	 */
+
+	/* Timeout handlers which trigger Tx Block Ack negotiation. */
+	CTimeout*		ni_addba_req_to[IEEE80211_NUM_TID];
+	int			ni_addba_req_intval[IEEE80211_NUM_TID];
+#define IEEE80211_ADDBA_REQ_INTVAL_MAX 30	/* in seconds */
+
+	/* Block Ack records */
+	struct ieee80211_tx_ba	ni_tx_ba[IEEE80211_NUM_TID];
+	struct ieee80211_rx_ba	ni_rx_ba[IEEE80211_NUM_TID];
 };
 
+/* Size of a scan entry: struct ieee80211_node up to the Block Ack state. */
+#define IEEE80211_NODE_SCAN_SIZE	\
+	offsetof(struct ieee80211_node, ni_addba_req_to)
+
 RB_HEAD(ieee80211_tree, ieee80211_node);
 
 struct ieee80211_ess_rbt {
@@ -654,6 +700,8 @@ void ieee80211_end_scan(struct _ifnet *);
 void ieee80211_reset_scan(struct _ifnet *);
 struct ieee80211_node *ieee80211_alloc_node(struct ieee80211com *,
 		const u_int8_t *);
+struct ieee80211_node *ieee80211_alloc_scan_node(struct ieee80211com *,
+		const u_int8_t *);
 struct ieee80211_node *ieee80211_dup_bss(struct ieee80211com *,
 		const u_int8_t *);
 struct ieee80211_node *ieee80211_find_node(struct ieee80211com *,
@@ -698,6 +746,10 @@ void ieee80211_node_join(struct ieee80211com *,
 void ieee80211_node_leave(struct ieee80211com *,
 		struct ieee80211_node *);
 int ieee80211_match_bss(struct ieee80211com *, struct ieee80211_node *, int);
+int ieee80211_node_rssi_dbm(struct ieee80211com *,
+		const struct ieee80211_node *);
+uint32_t ieee80211_node_estimate_tput(struct ieee80211com *,
+		struct ieee80211_node *);
 struct ieee80211_node *ieee80211_node_choose_bss(struct ieee80211com *, int,
 		struct ieee80211_node **);
 void ieee80211_node_join_bss(struct ieee80211com *, struct ieee80211_node *, int force_reauth = 0);
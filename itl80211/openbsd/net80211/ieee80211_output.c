@@ -111,6 +111,10 @@ uint8_t *ieee80211_add_wme_param(uint8_t *, struct ieee80211com *);
 #endif
 mbuf_t ieee80211_get_sa_query(struct ieee80211com *,
 	    struct ieee80211_node *, u_int8_t);
+mbuf_t ieee80211_get_nbr_req(struct ieee80211com *,
+	    struct ieee80211_node *, u_int8_t);
+mbuf_t ieee80211_get_btm_resp(struct ieee80211com *,
+	    struct ieee80211_node *);
 mbuf_t ieee80211_get_action(struct ieee80211com *,
 	    struct ieee80211_node *, u_int8_t, u_int8_t, int);
 
@@ -533,6 +537,114 @@ ieee80211_tx_compressed_bar(struct ieee80211com *ic, struct ieee80211_node *ni,
  *     The convention is ic_bss is not reference counted; the caller must
  *     maintain that.
  */
+/*
+ * Build the data frame header template for TID tid (-1 for non-QoS
+ * frames) of node ni.  Addresses which come from the Ethernet header
+ * are left zero.
+ */
+static int
+ieee80211_txtmpl_build(struct ieee80211com *ic, struct ieee80211_node *ni,
+    struct ieee80211_txtmpl *tt, int tid, int prot, u_int32_t sig,
+    const u_int8_t *bssid)
+{
+    struct ieee80211_frame *wh = (struct ieee80211_frame *)tt->tt_hdr;
+    struct llc *llc = (struct llc *)tt->tt_llc;
+
+    memset(tt, 0, sizeof(*tt));
+    wh->i_fc[0] = IEEE80211_FC0_VERSION_0 | IEEE80211_FC0_TYPE_DATA;
+    if (tid >= 0) {
+        struct ieee80211_qosframe *qwh = (struct ieee80211_qosframe *)wh;
+        u_int16_t qos = tid;
+
+        if (ic->ic_tid_noack & (1 << tid))
+            qos |= IEEE80211_QOS_ACK_POLICY_NOACK;
+        else {
+            /* Use HT immediate block-ack. */
+            qos |= IEEE80211_QOS_ACK_POLICY_NORMAL;
+        }
+        qwh->i_fc[0] |= IEEE80211_FC0_SUBTYPE_QOS;
+        *(u_int16_t *)qwh->i_qos = htole16(qos);
+        tt->tt_hdrlen = sizeof(struct ieee80211_qosframe);
+    } else
+        tt->tt_hdrlen = sizeof(struct ieee80211_frame);
+    switch (ic->ic_opmode) {
+        case IEEE80211_M_STA:
+            wh->i_fc[1] = IEEE80211_FC1_DIR_TODS;
+            IEEE80211_ADDR_COPY(wh->i_addr1, bssid);
+            break;
+#ifndef IEEE80211_STA_ONLY
+        case IEEE80211_M_IBSS:
+        case IEEE80211_M_AHDEMO:
+            wh->i_fc[1] = IEEE80211_FC1_DIR_NODS;
+            IEEE80211_ADDR_COPY(wh->i_addr3, bssid);
+            break;
+        case IEEE80211_M_HOSTAP:
+            wh->i_fc[1] = IEEE80211_FC1_DIR_FROMDS;
+            IEEE80211_ADDR_COPY(wh->i_addr2, bssid);
+            break;
+#endif
+        default:
+            return EINVAL;
+    }
+    if (prot)
+        wh->i_fc[1] |= IEEE80211_FC1_PROTECTED;
+
+    llc->llc_dsap = llc->llc_ssap = LLC_SNAP_LSAP;
+    llc->llc_control = LLC_UI;
+    llc->llc_snap.org_code[0] = 0;
+    llc->llc_snap.org_code[1] = 0;
+    llc->llc_snap.org_code[2] = 0;
+
+    IEEE80211_ADDR_COPY(tt->tt_bssid, bssid);
+    tt->tt_sig = sig;
+    return 0;
+}
+
+/*
+ * Return the header template ieee80211_encap() should use for TID tid
+ * (-1 for non-QoS frames), rebuilding it if the operating mode,
+ * protection, QoS ack policy or BSSID it was built for changed.
+ * Templates are allocated on first use; if that fails the template is
+ * built in *tmp.
+ */
+static struct ieee80211_txtmpl *
+ieee80211_txtmpl_get(struct ieee80211com *ic, struct ieee80211_node *ni,
+    int tid, int prot, struct ieee80211_txtmpl *tmp)
+{
+    struct ieee80211_txtmpl *tt;
+    const u_int8_t *bssid = ni->ni_bssid;
+    u_int32_t sig;
+
+#ifndef IEEE80211_STA_ONLY
+    if (ic->ic_opmode == IEEE80211_M_IBSS ||
+        ic->ic_opmode == IEEE80211_M_AHDEMO)
+        bssid = ic->ic_bss->ni_bssid;
+#endif
+    sig = IEEE80211_TXTMPL_VALID |
+        ((u_int32_t)ic->ic_opmode << IEEE80211_TXTMPL_OPMODE_SHIFT);
+    if (prot)
+        sig |= IEEE80211_TXTMPL_PROT;
+    if (tid >= 0) {
+        sig |= IEEE80211_TXTMPL_QOS;
+        if (ic->ic_tid_noack & (1 << tid))
+            sig |= IEEE80211_TXTMPL_NOACK;
+    }
+
+    if (ni->ni_txtmpl == NULL)
+        ni->ni_txtmpl = (struct ieee80211_txtmpl *)malloc(
+            (IEEE80211_NUM_TID + 1) * sizeof(*ni->ni_txtmpl), 0, 0);
+    if (ni->ni_txtmpl == NULL)
+        tt = tmp;
+    else
+        tt = &ni->ni_txtmpl[tid >= 0 ? tid : IEEE80211_NUM_TID];
+    if (tt == tmp || tt->tt_sig != sig ||
+        !IEEE80211_ADDR_EQ(tt->tt_bssid, bssid)) {
+        if (ieee80211_txtmpl_build(ic, ni, tt, tid, prot, sig, bssid))
+            return NULL;
+    }
+    return tt;
+}
+
 mbuf_t
 ieee80211_encap(struct _ifnet *ifp, mbuf_t m, struct ieee80211_node **pni)
 {
@@ -543,8 +655,9 @@ ieee80211_encap(struct _ifnet *ifp, mbuf_t m, struct ieee80211_node **pni)
 	struct llc *llc;
 	mbuf_tag_id_t mtag;
 	u_int8_t *addr;
+	struct ieee80211_txtmpl *tt, ttbuf;
 	u_int dlt, hdrlen;
-	int addqos, tid = 0;
+	int addqos, prot, tid = 0;
 
 	/* Handle raw frames if mbuf is tagged as 802.11 */
     if (0) {
@@ -648,13 +761,17 @@ fallback:
         hdrlen = sizeof(struct ieee80211_frame);
         addqos = 0;
     }
+    prot = (ic->ic_flags & IEEE80211_F_WEPON) ||
+        ((ic->ic_flags & IEEE80211_F_RSNON) &&
+         (ni->ni_flags & IEEE80211_NODE_TXPROT));
+    tt = ieee80211_txtmpl_get(ic, ni, addqos ? tid : -1, prot, &ttbuf);
+    if (tt == NULL) {
+        /* should not get there */
+        goto bad;
+    }
     mbuf_adj(m, sizeof(struct ether_header) - LLC_SNAPFRAMELEN);
+    memcpy(mtod(m, caddr_t), tt->tt_llc, LLC_SNAPFRAMELEN);
     llc = mtod(m, struct llc *);
-    llc->llc_dsap = llc->llc_ssap = LLC_SNAP_LSAP;
-    llc->llc_control = LLC_UI;
-    llc->llc_snap.org_code[0] = 0;
-    llc->llc_snap.org_code[1] = 0;
-    llc->llc_snap.org_code[2] = 0;
     llc->llc_snap.ether_type = eh.ether_type;
     mbuf_prepend(&m, hdrlen, MBUF_DONTWAIT);
     if (m == NULL) {
@@ -662,22 +779,9 @@ fallback:
         goto bad;
     }
     wh = mtod(m, struct ieee80211_frame *);
-    wh->i_fc[0] = IEEE80211_FC0_VERSION_0 | IEEE80211_FC0_TYPE_DATA;
-    *(u_int16_t *)&wh->i_dur[0] = 0;
+    memcpy(wh, tt->tt_hdr, hdrlen);
     if (addqos) {
-        struct ieee80211_qosframe *qwh =
-        (struct ieee80211_qosframe *)wh;
-        u_int16_t qos = tid;
-        
-        if (ic->ic_tid_noack & (1 << tid))
-            qos |= IEEE80211_QOS_ACK_POLICY_NOACK;
-        else {
-            /* Use HT immediate block-ack. */
-            qos |= IEEE80211_QOS_ACK_POLICY_NORMAL;
-        }
-        qwh->i_fc[0] |= IEEE80211_FC0_SUBTYPE_QOS;
-        *(u_int16_t *)qwh->i_qos = htole16(qos);
-        *(u_int16_t *)qwh->i_seq =
+        *(u_int16_t *)((struct ieee80211_qosframe *)wh)->i_seq =
         htole16(ni->ni_qos_txseqs[tid] << IEEE80211_SEQ_SEQ_SHIFT);
         ni->ni_qos_txseqs[tid] = (ni->ni_qos_txseqs[tid] + 1) & 0xfff;
     } else {
@@ -687,36 +791,24 @@ fallback:
     }
     switch (ic->ic_opmode) {
         case IEEE80211_M_STA:
-            wh->i_fc[1] = IEEE80211_FC1_DIR_TODS;
-            IEEE80211_ADDR_COPY(wh->i_addr1, ni->ni_bssid);
             IEEE80211_ADDR_COPY(wh->i_addr2, eh.ether_shost);
             IEEE80211_ADDR_COPY(wh->i_addr3, eh.ether_dhost);
             break;
 #ifndef IEEE80211_STA_ONLY
         case IEEE80211_M_IBSS:
         case IEEE80211_M_AHDEMO:
-            wh->i_fc[1] = IEEE80211_FC1_DIR_NODS;
             IEEE80211_ADDR_COPY(wh->i_addr1, eh.ether_dhost);
             IEEE80211_ADDR_COPY(wh->i_addr2, eh.ether_shost);
-            IEEE80211_ADDR_COPY(wh->i_addr3, ic->ic_bss->ni_bssid);
             break;
         case IEEE80211_M_HOSTAP:
-            wh->i_fc[1] = IEEE80211_FC1_DIR_FROMDS;
             IEEE80211_ADDR_COPY(wh->i_addr1, eh.ether_dhost);
-            IEEE80211_ADDR_COPY(wh->i_addr2, ni->ni_bssid);
             IEEE80211_ADDR_COPY(wh->i_addr3, eh.ether_shost);
             break;
 #endif
         default:
-            /* should not get there */
-            goto bad;
+            break;
     }
     
-    if ((ic->ic_flags & IEEE80211_F_WEPON) ||
-        ((ic->ic_flags & IEEE80211_F_RSNON) &&
-         (ni->ni_flags & IEEE80211_NODE_TXPROT)))
-        wh->i_fc[1] |= IEEE80211_FC1_PROTECTED;
-    
 #ifndef IEEE80211_STA_ONLY
     if (ic->ic_opmode == IEEE80211_M_HOSTAP &&
         ieee80211_pwrsave(ic, m, ni) != 0) {
@@ -734,6 +826,190 @@ bad:
     return NULL;
 }
 
+/*
+ * Compute checksums the network stack deferred to the driver for an IP
+ * packet of the given Ethernet type starting off bytes into m.
+ */
+void
+ieee80211_csum_finalize(mbuf_t m, u_int16_t ethertype, size_t off)
+{
+    mbuf_csum_request_flags_t request;
+    u_int32_t value;
+
+    mbuf_get_csum_requested(m, &request, &value);
+    if (request == 0)
+        return;
+    if (ethertype == htons(ETHERTYPE_IP))
+        mbuf_outbound_finalize(m, PF_INET, off);
+    else if (ethertype == htons(ETHERTYPE_IPV6))
+        mbuf_outbound_finalize(m, PF_INET6, off);
+}
+
+/*
+ * Return the largest A-MSDU node ni accepts inside an A-MPDU, or 0 if
+ * it cannot receive A-MSDUs at all.
+ */
+u_int
+ieee80211_amsdu_maxlen(struct ieee80211_node *ni)
+{
+    if (ni->ni_flags & IEEE80211_NODE_VHT) {
+        switch (ni->ni_vhtcaps & IEEE80211_VHTCAP_MAX_MPDU_MASK) {
+        case IEEE80211_VHTCAP_MAX_MPDU_LENGTH_11454:
+            return IEEE80211_MAX_MPDU_LEN_VHT_11454;
+        case IEEE80211_VHTCAP_MAX_MPDU_LENGTH_7991:
+            return IEEE80211_MAX_MPDU_LEN_VHT_7991;
+        default:
+            return IEEE80211_MAX_MPDU_LEN_VHT_3895;
+        }
+    }
+    if (ni->ni_flags & IEEE80211_NODE_HT) {
+        /* HT limits A-MSDUs carried in an A-MPDU to 4095 bytes. */
+        if (ni->ni_htcaps & IEEE80211_HTCAP_AMSDU7935)
+            return IEEE80211_MAX_MPDU_LEN_HT_BA;
+        return IEEE80211_MAX_MPDU_LEN_HT_3839;
+    }
+    return 0;
+}
+
+/*
+ * Return the TID an Ethernet frame would be sent on if it may be carried
+ * in an A-MSDU to node ni, or -1 if it has to be sent in an MPDU of its own.
+ * Only unicast data on TIDs with a Block Ack agreement is eligible, and only
+ * if hardware protects the frame (the A-MSDU bit must survive encryption).
+ */
+int
+ieee80211_amsdu_tid(struct ieee80211com *ic, struct ieee80211_node *ni,
+    mbuf_t m)
+{
+    struct ether_header *eh;
+    int tid;
+
+    if (!(ic->ic_flags & IEEE80211_F_QOS) ||
+        !(ni->ni_flags & IEEE80211_NODE_QOS) ||
+        !(ni->ni_flags & IEEE80211_NODE_HT))
+        return -1;
+    if (ic->ic_flags & IEEE80211_F_WEPON)
+        return -1;
+    if ((ic->ic_flags & IEEE80211_F_RSNON) &&
+        ni->ni_rsncipher != IEEE80211_CIPHER_CCMP)
+        return -1;
+    if (mbuf_len(m) < sizeof(*eh))
+        return -1;
+
+    eh = mtod(m, struct ether_header *);
+    if (ETHER_IS_MULTICAST(eh->ether_dhost) ||
+        eh->ether_type == htons(ETHERTYPE_PAE))
+        return -1;
+
+    tid = ieee80211_classify(ic, m);
+    if (ni->ni_tx_ba[tid].ba_state != IEEE80211_BA_AGREED ||
+        (ic->ic_tid_noack & (1 << tid)))
+        return -1;
+    return tid;
+}
+
+/*
+ * Turn a QoS data MPDU built by ieee80211_encap() into an A-MSDU which
+ * carries the original payload as its first subframe. Ethernet header eh
+ * is the one the MPDU was built from.
+ */
+mbuf_t
+ieee80211_amsdu_encap(struct ieee80211com *ic, mbuf_t m,
+    const struct ether_header *eh)
+{
+    struct ieee80211_qosframe *qwh;
+    struct ether_header *sh;
+    u_int hdrlen = sizeof(*qwh);
+    u_int16_t len;
+
+    if (!ieee80211_has_qos(mtod(m, struct ieee80211_frame *)))
+        return m;
+
+    ieee80211_csum_finalize(m, eh->ether_type, hdrlen + LLC_SNAPFRAMELEN);
+
+    /* LLC header and payload. */
+    len = mbuf_pkthdr_len(m) - hdrlen;
+
+    mbuf_prepend(&m, ETHER_HDR_LEN, MBUF_DONTWAIT);
+    if (m == NULL) {
+        ic->ic_stats.is_tx_nombuf++;
+        return NULL;
+    }
+    if (mbuf_len(m) < hdrlen + ETHER_HDR_LEN &&
+        mbuf_pullup(&m, hdrlen + ETHER_HDR_LEN) != 0) {
+        ic->ic_stats.is_tx_nombuf++;
+        return NULL;
+    }
+    memmove(mtod(m, caddr_t), mtod(m, caddr_t) + ETHER_HDR_LEN, hdrlen);
+
+    qwh = mtod(m, struct ieee80211_qosframe *);
+    qwh->i_qos[0] |= IEEE80211_QOS_AMSDU;
+    /* DA and SA move to the subframe header; addr3 becomes the BSSID. */
+    switch (qwh->i_fc[1] & IEEE80211_FC1_DIR_MASK) {
+    case IEEE80211_FC1_DIR_TODS:
+        IEEE80211_ADDR_COPY(qwh->i_addr3, qwh->i_addr1);
+        break;
+    case IEEE80211_FC1_DIR_FROMDS:
+        IEEE80211_ADDR_COPY(qwh->i_addr3, qwh->i_addr2);
+        break;
+    }
+
+    sh = (struct ether_header *)((caddr_t)qwh + hdrlen);
+    IEEE80211_ADDR_COPY(sh->ether_dhost, eh->ether_dhost);
+    IEEE80211_ADDR_COPY(sh->ether_shost, eh->ether_shost);
+    sh->ether_type = htons(len);
+    return m;
+}
+
+/*
+ * Append Ethernet frame m as a new subframe to an A-MSDU returned by
+ * ieee80211_amsdu_encap(). The previous subframe is padded to a multiple
+ * of 4 bytes. m is consumed in all cases.
+ */
+int
+ieee80211_amsdu_append(struct ieee80211com *ic, mbuf_t amsdu, mbuf_t m)
+{
+    struct ether_header eh, *sh;
+    struct llc *llc;
+    caddr_t frm;
+    u_int pad, len;
+
+    memcpy(&eh, mtod(m, caddr_t), sizeof(eh));
+    ieee80211_csum_finalize(m, eh.ether_type, ETHER_HDR_LEN);
+    pad = -(mbuf_pkthdr_len(amsdu) -
+        sizeof(struct ieee80211_qosframe)) & 3;
+    len = mbuf_pkthdr_len(m) - ETHER_HDR_LEN + LLC_SNAPFRAMELEN;
+
+    mbuf_prepend(&m, pad + LLC_SNAPFRAMELEN, MBUF_DONTWAIT);
+    if (m == NULL) {
+        ic->ic_stats.is_tx_nombuf++;
+        return ENOBUFS;
+    }
+    if (mbuf_len(m) < pad + ETHER_HDR_LEN + LLC_SNAPFRAMELEN &&
+        mbuf_pullup(&m, pad + ETHER_HDR_LEN + LLC_SNAPFRAMELEN) != 0) {
+        ic->ic_stats.is_tx_nombuf++;
+        return ENOBUFS;
+    }
+
+    frm = mtod(m, caddr_t);
+    memset(frm, 0, pad);
+    sh = (struct ether_header *)(frm + pad);
+    IEEE80211_ADDR_COPY(sh->ether_dhost, eh.ether_dhost);
+    IEEE80211_ADDR_COPY(sh->ether_shost, eh.ether_shost);
+    sh->ether_type = htons(len);
+    llc = (struct llc *)&sh[1];
+    llc->llc_dsap = llc->llc_ssap = LLC_SNAP_LSAP;
+    llc->llc_control = LLC_UI;
+    llc->llc_snap.org_code[0] = 0;
+    llc->llc_snap.org_code[1] = 0;
+    llc->llc_snap.org_code[2] = 0;
+    llc->llc_snap.ether_type = eh.ether_type;
+
+    mbuf_pkthdr_setlen(amsdu, mbuf_pkthdr_len(amsdu) + mbuf_pkthdr_len(m));
+    m_cat(amsdu, m);
+    return 0;
+}
+
 /*
  * Add a Capability Information field to a frame (see 7.3.1.4).
  */
@@ -934,6 +1210,34 @@ ieee80211_add_qos_capability(u_int8_t *frm, struct ieee80211com *ic)
     return frm;
 }
 
+/*
+ * Add an RM Enabled Capabilities element to a frame (see 802.11-2016
+ * 9.4.2.45). Neighbor reports are the only measurement we support.
+ */
+u_int8_t *
+ieee80211_add_rmcap(u_int8_t *frm)
+{
+	*frm++ = IEEE80211_ELEMID_RM;
+	*frm++ = IEEE80211_RMCAP_LEN;
+	memset(frm, 0, IEEE80211_RMCAP_LEN);
+	frm[0] = IEEE80211_RMCAP_NBR_REPORT;
+	return frm + IEEE80211_RMCAP_LEN;
+}
+
+/*
+ * Add an Extended Capabilities element to a frame (see 802.11-2016
+ * 9.4.2.27). Trailing octets with no capability set are left out.
+ */
+u_int8_t *
+ieee80211_add_xcaps(u_int8_t *frm)
+{
+	*frm++ = IEEE80211_ELEMID_XCAPS;
+	*frm++ = IEEE80211_XCAPS_LEN;
+	memset(frm, 0, IEEE80211_XCAPS_LEN);
+	frm[2] = IEEE80211_XCAPS_BSS_TRANS;
+	return frm + IEEE80211_XCAPS_LEN;
+}
+
 #define    WME_OUI_BYTES        0x00, 0x50, 0xf2
 
 /*
@@ -1060,6 +1364,11 @@ ieee80211_add_rsn_body(u_int8_t *frm, struct ieee80211com *ic,
         *frm++ = 2;
         count++;
     }
+    if (!wpa && (ni->ni_rsnakms & IEEE80211_AKM_FT_PSK)) {
+        memcpy(frm, oui, 3); frm += 3;
+        *frm++ = 4;
+        count++;
+    }
     if (!wpa && (ni->ni_rsnakms & IEEE80211_AKM_SHA256_8021X)) {
         memcpy(frm, oui, 3); frm += 3;
         *frm++ = 5;
@@ -1343,6 +1652,60 @@ ieee80211_add_tie(u_int8_t *frm, u_int8_t type, u_int32_t value)
 }
 #endif
 
+/*
+ * Add a Mobility Domain element to a frame (see 802.11-2016 9.4.2.47).
+ */
+u_int8_t *
+ieee80211_add_mde(u_int8_t *frm, const struct ieee80211_node *ni)
+{
+	*frm++ = IEEE80211_ELEMID_MDE;
+	*frm++ = IEEE80211_MDE_LEN;
+	memcpy(frm, ni->ni_mdid, 2); frm += 2;
+	*frm++ = ni->ni_ftcap;
+	return frm;
+}
+
+/*
+ * Add a Fast BSS Transition element to a frame (see 802.11-2016 9.4.2.48).
+ * The FT Authentication Request carries only our SNonce and the R0KH-ID;
+ * the Reassociation Request also echoes the ANonce and R1KH-ID and is
+ * protected by a MIC which the caller fills in once the frame is built.
+ */
+u_int8_t *
+ieee80211_add_fte(u_int8_t *frm, struct ieee80211com *ic, int reassoc)
+{
+	const struct ieee80211_ft *ft = &ic->ic_ft;
+	u_int8_t *plen;
+
+	*frm++ = IEEE80211_ELEMID_FTE;
+	plen = frm++;	/* length filled in later */
+	*frm++ = 0;	/* reserved */
+	*frm++ = reassoc ? 3 : 0;	/* Element Count (RSNE, MDE, FTE) */
+	memset(frm, 0, IEEE80211_FTE_MIC_LEN);
+	frm += IEEE80211_FTE_MIC_LEN;
+	if (reassoc)
+		memcpy(frm, ft->ft_anonce, EAPOL_KEY_NONCE_LEN);
+	else
+		memset(frm, 0, EAPOL_KEY_NONCE_LEN);
+	frm += EAPOL_KEY_NONCE_LEN;
+	memcpy(frm, ft->ft_snonce, EAPOL_KEY_NONCE_LEN);
+	frm += EAPOL_KEY_NONCE_LEN;
+	if (reassoc) {
+		*frm++ = IEEE80211_FTE_SUBELEM_R1KH_ID;
+		*frm++ = IEEE80211_ADDR_LEN;
+		IEEE80211_ADDR_COPY(frm, ft->ft_r1kh);
+		frm += IEEE80211_ADDR_LEN;
+	}
+	*frm++ = IEEE80211_FTE_SUBELEM_R0KH_ID;
+	*frm++ = ft->ft_r0khlen;
+	memcpy(frm, ft->ft_r0kh, ft->ft_r0khlen);
+	frm += ft->ft_r0khlen;
+
+	/* write length field */
+	*plen = frm - plen - 1;
+	return frm;
+}
+
 mbuf_t
 ieee80211_getmgmt(int flags, int type, u_int pktlen)
 {
@@ -1487,6 +1850,48 @@ ieee80211_get_probe_resp(struct ieee80211com *ic, struct ieee80211_node *ni)
 }
 #endif	/* IEEE80211_STA_ONLY */
 
+/*-
+ * FT Authentication Request frame format (see 802.11-2016 13.5.2):
+ * [2]   Authentication algorithm number (FT)
+ * [2]   Authentication transaction sequence number
+ * [2]   Status code
+ * [tlv] RSN (802.11i), with PMKR0Name as PMKID
+ * [tlv] Mobility Domain (802.11r)
+ * [tlv] Fast BSS Transition (802.11r)
+ */
+static mbuf_t
+ieee80211_get_ft_auth(struct ieee80211com *ic, struct ieee80211_node *ni)
+{
+	mbuf_t m;
+	u_int8_t *frm;
+
+	m = ieee80211_getmgmt(MBUF_DONTWAIT, MT_DATA,
+	    2 * 3 +
+	    2 + IEEE80211_RSNIE_MAXLEN +
+	    2 + IEEE80211_MDE_LEN +
+	    2 + IEEE80211_FTE_MAXLEN);
+	if (m == NULL)
+		return NULL;
+
+	/* the R0KH looks up PMK-R0 by name */
+	memcpy(ni->ni_pmkid, ic->ic_ft.ft_pmk_r0_name, IEEE80211_PMKID_LEN);
+	ni->ni_flags |= IEEE80211_NODE_PMKID;
+
+	frm = mtod(m, u_int8_t *);
+	LE_WRITE_2(frm, IEEE80211_AUTH_ALG_FT); frm += 2;
+	LE_WRITE_2(frm, IEEE80211_AUTH_OPEN_REQUEST); frm += 2;
+	LE_WRITE_2(frm, IEEE80211_STATUS_SUCCESS); frm += 2;
+	frm = ieee80211_add_rsn(frm, ic, ni);
+	frm = ieee80211_add_mde(frm, ni);
+	frm = ieee80211_add_fte(frm, ic, 0);
+
+	size_t l = frm - mtod(m, u_int8_t *);
+	mbuf_pkthdr_setlen(m, l);
+	mbuf_setlen(m, l);
+
+	return m;
+}
+
 /*-
  * Authentication frame format:
  * [2] Authentication algorithm number
@@ -1500,6 +1905,9 @@ ieee80211_get_auth(struct ieee80211com *ic, struct ieee80211_node *ni,
 	mbuf_t m;
     u_int8_t *frm;
     
+    if (seq == IEEE80211_AUTH_OPEN_REQUEST && ieee80211_ft_roaming(ic, ni))
+        return ieee80211_get_ft_auth(ic, ni);
+    
     mbuf_gethdr(MBUF_DONTWAIT, MT_DATA, &m);
     if (m == NULL)
         return NULL;
@@ -1547,7 +1955,11 @@ ieee80211_get_deauth(struct ieee80211com *ic, struct ieee80211_node *ni,
  * [tlv] Extended Supported Rates (802.11g)
  * [tlv] RSN (802.11i)
  * [tlv] QoS Capability (802.11e)
+ * [tlv] RM Enabled Capabilities (802.11k)
+ * [tlv] Mobility Domain (802.11r)
+ * [tlv] Fast BSS Transition (802.11r, FT reassociation only)
  * [tlv] HT Capabilities (802.11n)
+ * [tlv] Extended Capabilities (802.11v)
  */
 mbuf_t
 ieee80211_get_assoc_req(struct ieee80211com *ic, struct ieee80211_node *ni,
@@ -1555,8 +1967,13 @@ ieee80211_get_assoc_req(struct ieee80211com *ic, struct ieee80211_node *ni,
 {
 	const struct ieee80211_rateset *rs = &ni->ni_rates;
 	mbuf_t m;
-	u_int8_t *frm;
+	u_int8_t *frm, *rsnie = NULL, *mde = NULL, *fte = NULL;
 	u_int16_t capinfo;
+	int ft;
+
+	ft = (ic->ic_flags & IEEE80211_F_RSNON) &&
+	    (ni->ni_flags & IEEE80211_NODE_MDE) &&
+	    ieee80211_is_ft_akm((enum ieee80211_akm)ni->ni_rsnakms);
 
 	m = ieee80211_getmgmt(MBUF_DONTWAIT, MT_DATA,
 	    2 + 2 +
@@ -1570,12 +1987,17 @@ ieee80211_get_assoc_req(struct ieee80211com *ic, struct ieee80211_node *ni,
 	      (ni->ni_rsnprotos & IEEE80211_PROTO_RSN)) ?
 		2 + IEEE80211_RSNIE_MAXLEN : 0) +
 	    ((ni->ni_flags & IEEE80211_NODE_QOS) ? 2 + 1 : 0) +
+	    ((ni->ni_flags & IEEE80211_NODE_RMCAP) ?
+		2 + IEEE80211_RMCAP_LEN : 0) +
+	    ((ni->ni_flags & IEEE80211_NODE_BTM) ?
+		2 + IEEE80211_XCAPS_LEN : 0) +
 	    (((ic->ic_flags & IEEE80211_F_RSNON) &&
 	      (ni->ni_rsnprotos & IEEE80211_PROTO_WPA)) ?
 		2 + IEEE80211_WPAIE_MAXLEN : 0) +
 	    ((ic->ic_flags & IEEE80211_F_HTON) ? sizeof(struct ieee80211_ie_htcap) + sizeof(struct ieee80211_wme_info) : 0) +
         ((ic->ic_flags & IEEE80211_F_VHTON) ? sizeof(struct ieee80211_ie_vhtcap) + 2 : 0) +
-        ((ic->ic_flags & IEEE80211_F_HEON) ? (sizeof(struct ieee80211_he_cap_elem) + 2 + 1 + sizeof(struct ieee80211_he_mcs_nss_supp) + IEEE80211_HE_PPE_THRES_MAX_LEN) : 0));
+        ((ic->ic_flags & IEEE80211_F_HEON) ? (sizeof(struct ieee80211_he_cap_elem) + 2 + 1 + sizeof(struct ieee80211_he_mcs_nss_supp) + IEEE80211_HE_PPE_THRES_MAX_LEN) : 0) +
+	    (ft ? 2 + IEEE80211_MDE_LEN + 2 + IEEE80211_FTE_MAXLEN : 0));
 	if (m == NULL)
 		return NULL;
 
@@ -1588,10 +2010,15 @@ ieee80211_get_assoc_req(struct ieee80211com *ic, struct ieee80211_node *ni,
 		capinfo |= IEEE80211_CAPINFO_SHORT_PREAMBLE;
 	if (ic->ic_caps & IEEE80211_C_SHSLOT)
 		capinfo |= IEEE80211_CAPINFO_SHORT_SLOTTIME;
+	if (ni->ni_flags & IEEE80211_NODE_RMCAP)
+		capinfo |= IEEE80211_CAPINFO_RADIO_MEASUREMENT;
 	LE_WRITE_2(frm, capinfo); frm += 2;
 	LE_WRITE_2(frm, ic->ic_lintval); frm += 2;
 	if (type == IEEE80211_FC0_SUBTYPE_REASSOC_REQ) {
-		IEEE80211_ADDR_COPY(frm, ic->ic_bss->ni_bssid);
+		if (ieee80211_ft_roaming(ic, ni))
+			IEEE80211_ADDR_COPY(frm, ic->ic_ft.ft_prevbssid);
+		else
+			IEEE80211_ADDR_COPY(frm, ic->ic_bss->ni_bssid);
 		frm += IEEE80211_ADDR_LEN;
 	}
 	frm = ieee80211_add_ssid(frm, ni->ni_essid, ni->ni_esslen);
@@ -1607,10 +2034,23 @@ ieee80211_get_assoc_req(struct ieee80211com *ic, struct ieee80211_node *ni,
 		}
 		else
 #endif
-		frm = ieee80211_add_rsn(frm, ic, ni);
+		{
+			rsnie = frm;
+			frm = ieee80211_add_rsn(frm, ic, ni);
+		}
 	}
 	if (ni->ni_flags & IEEE80211_NODE_QOS)
 		frm = ieee80211_add_qos_capability(frm, ic);
+	if (ni->ni_flags & IEEE80211_NODE_RMCAP)
+		frm = ieee80211_add_rmcap(frm);
+	if (ft) {
+		mde = frm;
+		frm = ieee80211_add_mde(frm, ni);
+		if (ieee80211_ft_roaming(ic, ni)) {
+			fte = frm;
+			frm = ieee80211_add_fte(frm, ic, 1);
+		}
+	}
 	if ((ic->ic_flags & IEEE80211_F_RSNON) &&
 		(ni->ni_rsnprotos & IEEE80211_PROTO_WPA)) {
 #ifdef USE_APPLE_SUPPLICANT
@@ -1626,6 +2066,8 @@ ieee80211_get_assoc_req(struct ieee80211com *ic, struct ieee80211_node *ni,
 		frm = ieee80211_add_htcaps(frm, ic);
 		frm = ieee80211_add_wme_info(frm, ic);
 	}
+	if (ni->ni_flags & IEEE80211_NODE_BTM)
+		frm = ieee80211_add_xcaps(frm);
     
     if (ic->ic_flags & IEEE80211_F_VHTON)
         frm = ieee80211_add_vhtcaps(frm, ic);
@@ -1633,6 +2075,11 @@ ieee80211_get_assoc_req(struct ieee80211com *ic, struct ieee80211_node *ni,
     if (ic->ic_flags & IEEE80211_F_HEON)
         frm = ieee80211_add_hecaps(frm, ic);
 
+	/* the FTE MIC covers the RSNE, MDE and FTE (transaction seq 5) */
+	if (rsnie != NULL && fte != NULL)
+		ieee80211_ft_mic(ni->ni_ptk.kck, ic->ic_myaddr, ni->ni_bssid,
+		    5, rsnie, mde, fte, &fte[2 + IEEE80211_FTE_MIC_OFF]);
+
     size_t l = frm - mtod(m, u_int8_t *);
     mbuf_pkthdr_setlen(m, l);
     mbuf_setlen(m, l);
@@ -1935,6 +2382,76 @@ ieee80211_get_sa_query(struct ieee80211com *ic, struct ieee80211_node *ni,
 	return m;
 }
 
+/*-
+ * Neighbor Report Request frame format:
+ * [1]   Category
+ * [1]   Action
+ * [1]   Dialog Token
+ * [tlv] SSID
+ */
+mbuf_t
+ieee80211_get_nbr_req(struct ieee80211com *ic, struct ieee80211_node *ni,
+    u_int8_t token)
+{
+	mbuf_t m;
+	u_int8_t *frm;
+
+	m = ieee80211_getmgmt(MBUF_DONTWAIT, MT_DATA, 3 + 2 + ni->ni_esslen);
+	if (m == NULL)
+		return NULL;
+
+	frm = mtod(m, u_int8_t *);
+	*frm++ = IEEE80211_CATEG_RADIO_MSRMNT;
+	*frm++ = IEEE80211_ACTION_RM_NEIGHBOR_REQ;
+	*frm++ = token;
+	frm = ieee80211_add_ssid(frm, ni->ni_essid, ni->ni_esslen);
+
+    size_t l = frm - mtod(m, u_int8_t *);
+    mbuf_pkthdr_setlen(m, l);
+    mbuf_setlen(m, l);
+
+	return m;
+}
+
+/*-
+ * BSS Transition Management Response frame format:
+ * [1] Category
+ * [1] Action
+ * [1] Dialog Token
+ * [1] Status Code
+ * [1] BSS Termination Delay
+ * [6] Target BSSID (if the request is accepted)
+ */
+mbuf_t
+ieee80211_get_btm_resp(struct ieee80211com *ic, struct ieee80211_node *ni)
+{
+	const struct ieee80211_btm *bt = &ic->ic_btm;
+	mbuf_t m;
+	u_int8_t *frm;
+
+	m = ieee80211_getmgmt(MBUF_DONTWAIT, MT_DATA,
+	    5 + IEEE80211_ADDR_LEN);
+	if (m == NULL)
+		return NULL;
+
+	frm = mtod(m, u_int8_t *);
+	*frm++ = IEEE80211_CATEG_WNM;
+	*frm++ = IEEE80211_ACTION_BTM_RESP;
+	*frm++ = bt->bt_token;
+	*frm++ = bt->bt_status;
+	*frm++ = 0;	/* BSS Termination Delay */
+	if (bt->bt_status == IEEE80211_BTM_STATUS_ACCEPT) {
+		IEEE80211_ADDR_COPY(frm, bt->bt_target);
+		frm += IEEE80211_ADDR_LEN;
+	}
+
+    size_t l = frm - mtod(m, u_int8_t *);
+    mbuf_pkthdr_setlen(m, l);
+    mbuf_setlen(m, l);
+
+	return m;
+}
+
 mbuf_t
 ieee80211_get_action(struct ieee80211com *ic, struct ieee80211_node *ni,
     u_int8_t categ, u_int8_t action, int arg)
@@ -1967,6 +2484,20 @@ ieee80211_get_action(struct ieee80211com *ic, struct ieee80211_node *ni,
 			break;
 		}
 		break;
+	case IEEE80211_CATEG_RADIO_MSRMNT:
+		switch (action) {
+		case IEEE80211_ACTION_RM_NEIGHBOR_REQ:
+			m = ieee80211_get_nbr_req(ic, ni, arg & 0xff);
+			break;
+		}
+		break;
+	case IEEE80211_CATEG_WNM:
+		switch (action) {
+		case IEEE80211_ACTION_BTM_RESP:
+			m = ieee80211_get_btm_resp(ic, ni);
+			break;
+		}
+		break;
 	}
 	return m;
 }
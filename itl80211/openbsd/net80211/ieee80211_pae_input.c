@@ -195,6 +195,49 @@ done:
     mbuf_freem(m);
 }
 
+/*
+ * TPTK = CalcPTK(PMK, ANonce, SNonce).  With an FT AKM the PMK is PMK-R1
+ * and the PTK is derived as described in 802.11-2016 12.7.1.7.5.
+ */
+static void
+ieee80211_calc_ptk(struct ieee80211com *ic, struct ieee80211_node *ni,
+                   const u_int8_t *anonce, struct ieee80211_ptk *ptk)
+{
+    if (ieee80211_is_ft_akm((enum ieee80211_akm)ni->ni_rsnakms))
+        ieee80211_derive_ft_ptk(ni->ni_pmk, ic->ic_nonce, anonce,
+                                ni->ni_bssid, ic->ic_myaddr, ni->ni_rsncipher, ptk);
+    else
+        ieee80211_derive_ptk((enum ieee80211_akm)ni->ni_rsnakms, ni->ni_pmk,
+                             ni->ni_macaddr, ic->ic_myaddr, anonce, ic->ic_nonce, ptk);
+}
+
+/*
+ * With an FT AKM the RSN IE of message 3 is the AP's RSN IE plus the
+ * PMKR1Name, so compare its contents rather than its bytes and check that
+ * the MDE matches the mobility domain we are associating with.
+ */
+static int
+ieee80211_ft_check_msg3(struct ieee80211com *ic, struct ieee80211_node *ni,
+                        const u_int8_t *rsnie, const u_int8_t *mde)
+{
+    struct ieee80211_rsnparams rsn, bss;
+    
+    if (ni->ni_rsnie == NULL || mde == NULL || mde[1] < IEEE80211_MDE_LEN ||
+        memcmp(&mde[2], ic->ic_ft.ft_mdid, 2) != 0)
+        return 1;
+    if (ieee80211_parse_rsn(ic, rsnie, &rsn) != 0 ||
+        ieee80211_parse_rsn(ic, ni->ni_rsnie, &bss) != 0)
+        return 1;
+    if (rsn.rsn_akms != bss.rsn_akms ||
+        rsn.rsn_ciphers != bss.rsn_ciphers ||
+        rsn.rsn_groupcipher != bss.rsn_groupcipher ||
+        rsn.rsn_npmkids != 1 ||
+        memcmp(rsn.rsn_pmkids, ic->ic_ft.ft_pmk_r1_name,
+               IEEE80211_PMKID_LEN) != 0)
+        return 1;
+    return 0;
+}
+
 /*
  * Process Message 1 of the 4-Way Handshake (sent by Authenticator).
  */
@@ -265,6 +308,23 @@ ieee80211_recv_4way_msg1(struct ieee80211com *ic,
             return;
         }
         memcpy(ni->ni_pmk, pmk->pmk_key, IEEE80211_PMK_LEN);
+    } else if (ieee80211_is_ft_akm((enum ieee80211_akm)ni->ni_rsnakms)) {
+        struct ieee80211_ft *ft = &ic->ic_ft;
+        
+        /* initial mobility domain association: PSK -> PMK-R0 -> PMK-R1 */
+        if (ft->ft_ielen == 0) {
+            DPRINTF(("no FT elements for %s\n",
+                     ether_sprintf(ni->ni_macaddr)));
+            return;
+        }
+        ieee80211_derive_pmk_r0(ic->ic_psk, ni->ni_essid, ni->ni_esslen,
+                                ft->ft_mdid, ft->ft_r0kh, ft->ft_r0khlen, ic->ic_myaddr,
+                                ft->ft_pmk_r0, ft->ft_pmk_r0_name);
+        ieee80211_derive_pmk_r1(ft->ft_pmk_r0, ft->ft_pmk_r0_name,
+                                ft->ft_r1kh, ic->ic_myaddr, ni->ni_pmk, ft->ft_pmk_r1_name);
+        /* message 2 names PMK-R1 in its RSN IE */
+        memcpy(ni->ni_pmkid, ft->ft_pmk_r1_name, IEEE80211_PMKID_LEN);
+        ni->ni_flags |= IEEE80211_NODE_PMKID;
     } else    /* use pre-shared key */
         memcpy(ni->ni_pmk, ic->ic_psk, IEEE80211_PMK_LEN);
     ni->ni_flags |= IEEE80211_NODE_PMK;
@@ -276,8 +336,7 @@ ieee80211_recv_4way_msg1(struct ieee80211com *ic,
     arc4random_buf(ic->ic_nonce, EAPOL_KEY_NONCE_LEN);
     
     /* TPTK = CalcPTK(PMK, ANonce, SNonce) */
-    ieee80211_derive_ptk((enum ieee80211_akm)ni->ni_rsnakms, ni->ni_pmk, ni->ni_macaddr,
-                         ic->ic_myaddr, ni->ni_nonce, ic->ic_nonce, &tptk);
+    ieee80211_calc_ptk(ic, ni, ni->ni_nonce, &tptk);
     
     /* We are now expecting a new pairwise key. */
     ni->ni_flags |= IEEE80211_NODE_RSN_NEW_PTK;
@@ -383,7 +442,7 @@ ieee80211_recv_4way_msg3(struct ieee80211com *ic,
     struct ieee80211_ptk tptk;
     struct ieee80211_key *k;
     const u_int8_t *frm, *efrm;
-    const u_int8_t *rsnie1, *rsnie2, *gtk, *igtk;
+    const u_int8_t *rsnie1, *rsnie2, *gtk, *igtk, *mde;
     u_int16_t info, reason = 0;
     int keylen, deferlink = 0;
     
@@ -416,8 +475,7 @@ ieee80211_recv_4way_msg3(struct ieee80211com *ic,
         return;
     }
     /* TPTK = CalcPTK(PMK, ANonce, SNonce) */
-    ieee80211_derive_ptk((enum ieee80211_akm)ni->ni_rsnakms, ni->ni_pmk, ni->ni_macaddr,
-                         ic->ic_myaddr, key->nonce, ic->ic_nonce, &tptk);
+    ieee80211_calc_ptk(ic, ni, key->nonce, &tptk);
     
     info = BE_READ_2(key->info);
     
@@ -446,11 +504,14 @@ ieee80211_recv_4way_msg3(struct ieee80211com *ic,
      * RSN IEs in message 3/4.  We only take into account the IE of the
      * version of the protocol we negotiated at association time.
      */
-    rsnie1 = rsnie2 = gtk = igtk = NULL;
+    rsnie1 = rsnie2 = gtk = igtk = mde = NULL;
     while (frm + 2 <= efrm) {
         if (frm + 2 + frm[1] > efrm)
             break;
         switch (frm[0]) {
+            case IEEE80211_ELEMID_MDE:
+                mde = frm;
+                break;
             case IEEE80211_ELEMID_RSN:
                 if (ni->ni_rsnprotos != IEEE80211_PROTO_RSN)
                     break;
@@ -513,7 +574,12 @@ ieee80211_recv_4way_msg3(struct ieee80211com *ic,
      * Check that first WPA/RSN IE is identical to the one received in
      * the beacon or probe response frame.
      */
-    if (ni->ni_rsnie == NULL || rsnie1[1] != ni->ni_rsnie[1] ||
+    if (ieee80211_is_ft_akm((enum ieee80211_akm)ni->ni_rsnakms)) {
+        if (ieee80211_ft_check_msg3(ic, ni, rsnie1, mde) != 0) {
+            reason = IEEE80211_REASON_RSN_DIFFERENT_IE;
+            goto deauth;
+        }
+    } else if (ni->ni_rsnie == NULL || rsnie1[1] != ni->ni_rsnie[1] ||
         memcmp(rsnie1, ni->ni_rsnie, 2 + rsnie1[1]) != 0) {
         reason = IEEE80211_REASON_RSN_DIFFERENT_IE;
         goto deauth;
@@ -694,6 +760,9 @@ ieee80211_recv_4way_msg3(struct ieee80211com *ic,
             ni->ni_assoc_fail = 0;
             if (ic->ic_opmode == IEEE80211_M_STA)
                 ic->ic_rsngroupcipher = ni->ni_rsngroupcipher;
+            /* the FT key hierarchy can now be used for transitions */
+            if (ieee80211_is_ft_akm((enum ieee80211_akm)ni->ni_rsnakms))
+                ic->ic_ft.ft_flags |= IEEE80211_FT_F_VALID;
         }
     }
 deauth:
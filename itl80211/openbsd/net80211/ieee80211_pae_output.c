@@ -345,7 +345,7 @@ ieee80211_send_4way_msg2(struct ieee80211com *ic, struct ieee80211_node *ni,
     m = ieee80211_get_eapol_key(MBUF_DONTWAIT, MT_DATA,
                                 (ni->ni_rsnprotos == IEEE80211_PROTO_WPA) ?
                                 2 + IEEE80211_WPAIE_MAXLEN :
-                                2 + IEEE80211_RSNIE_MAXLEN);
+                                2 + IEEE80211_RSNIE_MAXLEN + ic->ic_ft.ft_ielen);
     if (m == NULL)
         return ENOMEM;
     key = mtod(m, struct ieee80211_eapol_key *);
@@ -368,8 +368,14 @@ ieee80211_send_4way_msg2(struct ieee80211com *ic, struct ieee80211_node *ni,
         /* WPA sets the key length field here */
         keylen = ieee80211_cipher_keylen(ni->ni_rsncipher);
         BE_WRITE_2(key->keylen, keylen);
-    } else	/* RSN */
+    } else {	/* RSN */
         frm = ieee80211_add_rsn(frm, ic, ni);
+        /* FT repeats the MDE and FTE of the (Re)Association Response */
+        if (ieee80211_is_ft_akm((enum ieee80211_akm)ni->ni_rsnakms)) {
+            memcpy(frm, ic->ic_ft.ft_ie, ic->ic_ft.ft_ielen);
+            frm += ic->ic_ft.ft_ielen;
+        }
+    }
     size_t l = frm - (u_int8_t *)key;
     mbuf_pkthdr_setlen(m, l);
     mbuf_setlen(m, l);
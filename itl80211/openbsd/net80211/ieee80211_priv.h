@@ -60,7 +60,7 @@ extern int ieee80211_debug;
 	 2 +		/* Pairwise Cipher Suite Count */		\
 	 4 * 2 +	/* Pairwise Cipher Suite List (max 2) */	\
 	 2 +		/* AKM Suite List Count */			\
-	 4 * 4 +	/* AKM Suite List (max 4) */			\
+	 4 * 5 +	/* AKM Suite List (max 5) */			\
 	 2 +		/* RSN Capabilities */				\
 	 2 +		/* PMKID Count */				\
 	 16 * 1 +	/* PMKID List (max 1) */			\
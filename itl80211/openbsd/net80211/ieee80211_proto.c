@@ -1622,7 +1622,10 @@ justcleanup:
 				    ieee80211_state_name[nstate]);
 			break;
 		case IEEE80211_S_AUTH:
+			/* 802.11r transitions always use reassociation */
 			IEEE80211_SEND_MGMT(ic, ni,
+			    ieee80211_ft_roaming(ic, ni) ?
+			    IEEE80211_FC0_SUBTYPE_REASSOC_REQ :
 			    IEEE80211_FC0_SUBTYPE_ASSOC_REQ, 0);
 			break;
 		case IEEE80211_S_RUN:
@@ -1702,6 +1705,8 @@ justcleanup:
                 ni->ni_fails = 0;
 			ic->ic_mgt_timer = 0;
 			ieee80211_set_beacon_miss_threshold(ic);
+			if (ic->ic_ft.ft_flags & IEEE80211_FT_F_SETKEYS)
+				ieee80211_ft_setkeys(ic, ic->ic_bss);
 			(*ifp->if_start)(ifp);
 			break;
 		}
@@ -1734,6 +1739,8 @@ ieee80211_set_link_state(struct ieee80211com *ic, int nstate)
         ifp->if_link_state = link_state;
         if (link_state == LINK_STATE_UP) {
             XYLog("%s LINK_STATE_IS_UP\n", __FUNCTION__);
+            ieee80211_resume_linkup(ic);
+            ieee80211_nbr_request(ic, 1);
             ifp->controller->setLinkStatus(kIONetworkLinkValid | kIONetworkLinkActive, ifp->controller->getCurrentMedium());
         } else {
             XYLog("%s LINK_STATE_IS_DOWN\n", __FUNCTION__);
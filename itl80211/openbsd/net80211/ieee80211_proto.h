@@ -96,6 +96,13 @@ extern	void ieee80211_tx_compressed_bar(struct ieee80211com *,
 		struct ieee80211_node *, int, uint16_t);
 extern	mbuf_t ieee80211_encap(struct _ifnet *, mbuf_t,
 		struct ieee80211_node **);
+extern	void ieee80211_csum_finalize(mbuf_t, u_int16_t, size_t);
+extern	u_int ieee80211_amsdu_maxlen(struct ieee80211_node *);
+extern	int ieee80211_amsdu_tid(struct ieee80211com *, struct ieee80211_node *,
+		mbuf_t);
+extern	mbuf_t ieee80211_amsdu_encap(struct ieee80211com *, mbuf_t,
+		const struct ether_header *);
+extern	int ieee80211_amsdu_append(struct ieee80211com *, mbuf_t, mbuf_t);
 extern	mbuf_t ieee80211_get_rts(struct ieee80211com *,
 		const struct ieee80211_frame *, u_int16_t);
 extern	mbuf_t ieee80211_get_cts_to_self(struct ieee80211com *,
@@ -155,6 +162,10 @@ extern	u_int8_t *ieee80211_add_xrates(u_int8_t *,
 extern	u_int8_t *ieee80211_add_htcaps(u_int8_t *, struct ieee80211com *);
 extern	u_int8_t *ieee80211_add_htop(u_int8_t *, struct ieee80211com *);
 extern	u_int8_t *ieee80211_add_tie(u_int8_t *, u_int8_t, u_int32_t);
+extern	u_int8_t *ieee80211_add_rmcap(u_int8_t *);
+extern	u_int8_t *ieee80211_add_xcaps(u_int8_t *);
+extern	u_int8_t *ieee80211_add_mde(u_int8_t *, const struct ieee80211_node *);
+extern	u_int8_t *ieee80211_add_fte(u_int8_t *, struct ieee80211com *, int);
 extern  u_int8_t *ieee80211_add_vhtcaps(u_int8_t *, struct ieee80211com *);
 extern  u_int8_t *ieee80211_add_hecaps(u_int8_t *, struct ieee80211com *);
 extern	int ieee80211_parse_rsn(struct ieee80211com *, const u_int8_t *,
@@ -400,6 +400,197 @@ struct ieee80211_defrag {
 
 #define IEEE80211_GROUP_NKID	6
 
+/*
+ * Roaming state. RSSI and TX failure trends of our AP are tracked so that
+ * a background scan can start before the link degrades, and a new AP is
+ * only chosen if it offers a clear throughput gain over the current one.
+ * RSSI values are kept in units of 1/16 of ni_rssi.
+ */
+#define IEEE80211_ROAM_NEIGHBORS	8
+#define IEEE80211_ROAM_NEIGHBOR_AGE	30000	/* msec */
+#define IEEE80211_ROAM_PREDICT		2000	/* RSSI look-ahead in msec */
+#define IEEE80211_ROAM_TXFAIL_THRES	30	/* TX failures in percent */
+#define IEEE80211_ROAM_TPUT_HYST	25	/* required gain in percent */
+#define IEEE80211_ROAM_TPUT_HYST_WEAK	10	/* ... if our link is failing */
+
+/* ieee80211_roam_needed() return values */
+#define IEEE80211_ROAM_NONE		0	/* link is fine */
+#define IEEE80211_ROAM_NOW		1	/* link is failing */
+#define IEEE80211_ROAM_EARLY		2	/* link is about to fail */
+
+struct ieee80211_roam_neighbor {
+	u_int8_t		rn_macaddr[IEEE80211_ADDR_LEN];
+	int			rn_rssi;	/* smoothed RSSI */
+	u_int64_t		rn_lastseen;	/* msec uptime */
+};
+
+struct ieee80211_roam {
+	int			r_rssi;		/* smoothed RSSI of ic_bss */
+	int			r_trend;	/* RSSI change per second */
+	u_int64_t		r_lastrssi;	/* msec uptime of last sample */
+	int			r_txfail;	/* TX failures in 1/16 percent */
+	u_int32_t		r_early;	/* # of trend-triggered scans */
+	u_int32_t		r_kept;		/* # of roams below hysteresis */
+	struct ieee80211_roam_neighbor r_nbr[IEEE80211_ROAM_NEIGHBORS];
+};
+
+/*
+ * Channels on which APs of our known networks have been seen. Roaming
+ * scans only visit the channels learned for the current ESS plus a few
+ * channels taken in turn from the rest of the list, so that new APs are
+ * still discovered. A scan which finds no other AP of our ESS makes the
+ * next one cover all channels.
+ */
+#define IEEE80211_CHANHIST_ESS		4	/* networks remembered */
+#define IEEE80211_CHANHIST_EXPLORE	2	/* extra channels per scan */
+#define IEEE80211_CHANHIST_DWELL	110	/* msec spent per channel */
+
+struct ieee80211_chanhist_ess {
+	u_int8_t		ce_essid[IEEE80211_NWID_LEN];
+	u_int8_t		ce_esslen;
+	u_char			ce_chans[howmany(IEEE80211_CHAN_MAX, NBBY)];
+	u_int64_t		ce_lastseen;	/* msec uptime */
+};
+
+struct ieee80211_chanhist {
+	struct ieee80211_chanhist_ess ch_ess[IEEE80211_CHANHIST_ESS];
+	u_char			ch_scan[howmany(IEEE80211_CHAN_MAX, NBBY)];
+	int			ch_partial;	/* scan covers ch_scan only */
+	int			ch_miss;	/* next scan covers all channels */
+	int			ch_explore;	/* next channel to explore */
+	u_int32_t		ch_npartial;	/* # of partial scans */
+	u_int32_t		ch_nfull;	/* # of full roaming scans */
+	u_int32_t		ch_nmiss;	/* # of partial scans that missed */
+	u_int32_t		ch_skipped;	/* # of channels not visited */
+};
+
+/*
+ * BSS we were associated with when the interface was brought down, e.g.
+ * for system sleep. The first scan after wakeup only probes its channel
+ * so that we can reassociate (using the PMKSA cache for 802.1X networks)
+ * without scanning every channel first. If the AP is not heard on that
+ * channel the following scan covers all channels as usual.
+ */
+#define IEEE80211_RESUME_MAXAGE		(60 * 60 * 1000) /* msec */
+
+struct ieee80211_resume {
+	u_int8_t		rs_bssid[IEEE80211_ADDR_LEN];
+	u_int8_t		rs_essid[IEEE80211_NWID_LEN];
+	u_int8_t		rs_esslen;
+	struct ieee80211_channel *rs_chan;
+	u_int16_t		rs_capinfo;
+	u_int32_t		rs_nodeflags;	/* HT/VHT/HE in use */
+	int			rs_txrate;	/* last TX rate index */
+	int			rs_txmcs;	/* last TX MCS */
+	int			rs_pmkid;	/* PMKSA entry was cached */
+	u_int64_t		rs_saved;	/* msec uptime, 0 if none */
+	u_int64_t		rs_wakeup;	/* msec uptime, 0 if done */
+	int			rs_directed;	/* scan covers rs_chan only */
+	int			rs_hit;		/* directed scan found the AP */
+	u_int32_t		rs_nfast;	/* # of directed rejoins */
+	u_int32_t		rs_nfull;	/* # of fallbacks to full scan */
+};
+
+/*
+ * 802.11r Fast BSS Transition state (FT-PSK). The key hierarchy is set up
+ * by the first association within a mobility domain, which still runs the
+ * 4-way handshake. Later roams to an AP of the same mobility domain use FT
+ * authentication and get their keys from the (re)association exchange.
+ */
+struct ieee80211_ft {
+	u_int32_t		ft_flags;
+#define IEEE80211_FT_F_VALID	0x01	/* PMK-R0 usable for transitions */
+#define IEEE80211_FT_F_ROAM	0x02	/* transition in progress */
+#define IEEE80211_FT_F_SETKEYS	0x04	/* keys to install on RUN */
+	u_int8_t		ft_mdid[2];
+	u_int8_t		ft_essid[IEEE80211_NWID_LEN];
+	u_int8_t		ft_esslen;
+	u_int8_t		ft_r0kh[IEEE80211_FT_R0KH_MAXLEN];
+	u_int8_t		ft_r0khlen;
+	u_int8_t		ft_r1kh[IEEE80211_ADDR_LEN];
+	u_int8_t		ft_pmk_r0[IEEE80211_PMK_LEN];
+	u_int8_t		ft_pmk_r0_name[IEEE80211_PMKID_LEN];
+	u_int8_t		ft_pmk_r1_name[IEEE80211_PMKID_LEN];
+	u_int8_t		ft_snonce[EAPOL_KEY_NONCE_LEN];
+	u_int8_t		ft_anonce[EAPOL_KEY_NONCE_LEN];
+	u_int8_t		ft_prevbssid[IEEE80211_ADDR_LEN];
+	/* MDE and FTE of the last (re)association response */
+	u_int8_t		ft_ie[2 + IEEE80211_MDE_LEN + 2 + 255];
+	u_int			ft_ielen;
+	int			ft_gtkid;	/* -1 if none pending */
+	int			ft_igtkid;	/* -1 if none pending */
+	u_int64_t		ft_start;	/* msec uptime of transition */
+	u_int32_t		ft_ntrans;	/* # of fast transitions */
+	u_int32_t		ft_nfallback;	/* # of fallbacks to full auth */
+};
+
+/*
+ * 802.11k neighbor reports. After association we ask our AP for the other
+ * APs of the ESS it knows about, and roaming scans then only visit the
+ * channels of those neighbors instead of the learned channel history.
+ */
+#define IEEE80211_NBR_ESS	4			/* networks remembered */
+#define IEEE80211_NBR_MAX	16			/* neighbors per network */
+#define IEEE80211_NBR_MAXAGE	(30 * 60 * 1000)	/* msec */
+#define IEEE80211_NBR_TIMEOUT	(5 * 1000)		/* msec */
+
+struct ieee80211_nbr {
+	u_int8_t		nb_bssid[IEEE80211_ADDR_LEN];
+	u_int32_t		nb_bssinfo;	/* IEEE80211_NBR_BSSINFO_* */
+	u_int8_t		nb_opclass;
+	u_int8_t		nb_chan;
+	u_int8_t		nb_phytype;
+	u_int8_t		nb_pref;	/* BSS transition preference */
+};
+
+struct ieee80211_nbr_ess {
+	u_int8_t		ne_essid[IEEE80211_NWID_LEN];
+	u_int8_t		ne_esslen;
+	struct ieee80211_nbr	ne_nbr[IEEE80211_NBR_MAX];
+	int			ne_nnbr;
+	u_int64_t		ne_updated;	/* msec uptime */
+};
+
+struct ieee80211_rrm {
+	struct ieee80211_nbr_ess rr_ess[IEEE80211_NBR_ESS];
+	u_int8_t		rr_token;	/* dialog token of last request */
+	u_int64_t		rr_reqtime;	/* msec uptime, 0 if none pending */
+	u_int32_t		rr_nreq;	/* # of requests sent */
+	u_int32_t		rr_nresp;	/* # of responses received */
+	u_int32_t		rr_nscan;	/* # of scans of reported channels */
+};
+
+/*
+ * 802.11v BSS Transition Management. Our AP may ask us to move to another
+ * AP of the ESS, e.g. to balance load; the response says whether we do.
+ * If none of the candidates it lists is in the node cache, we scan for
+ * them first and answer once the scan is done.
+ */
+struct ieee80211_btm {
+	u_int8_t		bt_token;	/* dialog token of last request */
+	u_int8_t		bt_mode;	/* IEEE80211_BTM_REQ_* */
+	u_int8_t		bt_status;	/* IEEE80211_BTM_STATUS_* */
+	u_int8_t		bt_target[IEEE80211_ADDR_LEN];
+	struct ieee80211_nbr	bt_cand[IEEE80211_NBR_MAX];
+	int			bt_ncand;
+	int			bt_scan;	/* scanning for candidates */
+	u_int32_t		bt_nreq;	/* # of requests received */
+	u_int32_t		bt_naccept;	/* # of requests accepted */
+	u_int32_t		bt_nscan;	/* # of requests scanned for */
+};
+
+/*
+ * Number of APs heard on each channel. Scans give crowded channels a
+ * larger share of the dwell time than empty ones, within the time the
+ * scan would have taken with fixed dwell times.
+ */
+#define IEEE80211_SCAN_NAPS_MAX		16	/* APs per channel to expect */
+
+struct ieee80211_chanstat {
+	u_int16_t		cs_nbss;	/* smoothed # of APs, in 1/16 */
+	u_int16_t		cs_nscan;	/* # of scans of this channel */
+};
+
 struct ieee80211com {
 	struct arpcom		ic_ac;
 	LIST_ENTRY(ieee80211com) ic_list;	/* chain of all ieee80211com */
@@ -567,6 +758,15 @@ struct ieee80211com {
     uint8_t ic_ppe_thres[IEEE80211_HE_PPE_THRES_MAX_LEN]; /* Holds the PPE Thresholds data. */
     
 	TAILQ_HEAD(, ieee80211_ess)	 ic_ess;
+
+	struct ieee80211_roam	ic_roam;
+	struct ieee80211_chanhist ic_chanhist;
+	struct ieee80211_resume	ic_resume;
+	struct ieee80211_ft	ic_ft;
+	struct ieee80211_rrm	ic_rrm;
+	struct ieee80211_btm	ic_btm;
+	struct ieee80211_chanstat ic_chanstat[IEEE80211_CHAN_MAX+1];
+	u_int			ic_scanseq;	/* # of completed scans */
 };
 #define	ic_if		ic_ac.ac_if
 #define	ic_softc	ic_if.if_softc
@@ -700,6 +900,31 @@ void	ieee80211_set_ess(struct ieee80211com *, struct ieee80211_ess *,
 void    ieee80211_deselect_ess(struct ieee80211com *);
 struct ieee80211_ess *ieee80211_get_ess(struct ieee80211com *, const char *, int);
 void ieee80211_begin_cache_bgscan(struct _ifnet *);
+void ieee80211_roam_reset(struct ieee80211com *);
+void ieee80211_roam_input(struct ieee80211com *, struct ieee80211_node *);
+void ieee80211_roam_neighbor(struct ieee80211com *, struct ieee80211_node *);
+void ieee80211_roam_txstatus(struct ieee80211com *, int, int);
+int ieee80211_roam_needed(struct ieee80211com *);
+void ieee80211_chanhist_add(struct ieee80211com *, struct ieee80211_node *);
+void ieee80211_chanhist_prepare(struct ieee80211com *);
+int ieee80211_chanhist_skip(struct ieee80211com *, struct ieee80211_channel *);
+void ieee80211_resume_save(struct ieee80211com *);
+void ieee80211_resume_wakeup(struct ieee80211com *);
+int ieee80211_resume_skip(struct ieee80211com *, struct ieee80211_channel *);
+void ieee80211_resume_linkup(struct ieee80211com *);
+void ieee80211_ft_reset(struct ieee80211com *);
+void ieee80211_ft_prepare(struct ieee80211com *, struct ieee80211_node *);
+int ieee80211_ft_roaming(struct ieee80211com *, struct ieee80211_node *);
+void ieee80211_ft_setkeys(struct ieee80211com *, struct ieee80211_node *);
+void ieee80211_nbr_request(struct ieee80211com *, int);
+void ieee80211_nbr_update(struct ieee80211com *, u_int8_t,
+	    const struct ieee80211_nbr *, int);
+int ieee80211_nbr_prepare(struct ieee80211com *, u_char *);
+void ieee80211_btm_request(struct ieee80211com *, u_int8_t, u_int8_t,
+	    const struct ieee80211_nbr *, int);
+u_int ieee80211_scan_dwell(struct ieee80211com *, struct ieee80211_channel *,
+	    u_int, u_int, u_int);
+u_int ieee80211_scan_naps(struct ieee80211com *, u_int, u_int);
 
 extern	int ieee80211_cache_size;
 
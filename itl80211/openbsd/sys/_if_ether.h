@@ -189,6 +189,8 @@ struct _ifnet {                /* and the entries */
     uint32_t if_ipackets;
     uint32_t if_imcasts;
     int if_ibytes;
+    uint32_t if_icoalesced;    /* segments merged by rx coalescing */
+    uint32_t if_icoalpkts;    /* coalesced packets handed up */
     
     
 //    union {
@@ -241,6 +243,8 @@ struct _ifnet {                /* and the entries */
     void    *if_afdata[AF_MAX];
 };
 
+#define IFXF_LRO    0x200        /* [N] TCP large recv offload */
+
 /*
  * Structure shared between the ethernet driver modules and
  * the address resolution code.  For example, each ec_softc or il_softc
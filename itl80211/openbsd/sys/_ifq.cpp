@@ -7,43 +7,477 @@
 //
 
 #include <sys/_ifq.h>
+#include <sys/_arc4random.h>
+#include <sys/kpi_mbuf.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/tcp.h>
+#include <kern/clock.h>
+#include <libkern/OSAtomic.h>
 
-void ifq_init(struct _ifqueue *ifq, struct _ifnet *ifp, unsigned int maxLen)
+static uint64_t
+ifq_now(void)
+{
+    uint64_t t, ns;
+
+    clock_get_uptime(&t);
+    absolutetime_to_nanoseconds(t, &ns);
+    return ns;
+}
+
+static uint64_t
+ifq_isqrt(uint64_t x)
+{
+    uint64_t r = 0, b = 1ULL << 62;
+
+    while (b > x)
+        b >>= 2;
+    while (b != 0) {
+        if (x >= r + b) {
+            x -= r + b;
+            r = (r >> 1) + b;
+        } else
+            r >>= 1;
+        b >>= 2;
+    }
+    return r;
+}
+
+/*
+ * ifq_lock is a leaf: nothing else is taken while it is held.  Count
+ * the times a caller had to spin for it so that contention between the
+ * network stack's output thread and the work loop shows up in the
+ * statistics rather than as unexplained latency.
+ */
+static void
+ifq_lock_enter(struct _ifqueue *ifq)
+{
+    if (IOSimpleLockTryLock(ifq->ifq_lock))
+        return;
+    IOSimpleLockLock(ifq->ifq_lock);
+    ifq->ifq_stats.lock_contended++;
+}
+
+static void
+ifq_lock_exit(struct _ifqueue *ifq)
+{
+    IOSimpleLockUnlock(ifq->ifq_lock);
+}
+
+/*
+ * Map a frame to its flow: addresses, protocol and ports for IP, the
+ * ethertype and destination for everything else (EAPOL, ARP).
+ */
+static uint32_t
+ifq_classify(struct _ifqueue *ifq, mbuf_t m)
+{
+    struct ether_header eh;
+    uint32_t key[11];
+    uint32_t h = ifq->ifq_seed;
+    size_t off = ETHER_HDR_LEN, l4off = 0;
+    uint8_t proto = 0;
+    int i, n = 0;
+
+    if (mbuf_copydata(m, 0, sizeof(eh), &eh) != 0)
+        return 0;
+    switch (ntohs(eh.ether_type)) {
+    case ETHERTYPE_IP: {
+        struct ip ip;
+
+        if (mbuf_copydata(m, off, sizeof(ip), &ip) != 0)
+            break;
+        key[n++] = ip.ip_src.s_addr;
+        key[n++] = ip.ip_dst.s_addr;
+        proto = ip.ip_p;
+        if (!(ntohs(ip.ip_off) & (IP_MF | IP_OFFMASK)))
+            l4off = off + (ip.ip_hl << 2);
+        break;
+    }
+    case ETHERTYPE_IPV6: {
+        struct ip6_hdr ip6;
+
+        if (mbuf_copydata(m, off, sizeof(ip6), &ip6) != 0)
+            break;
+        memcpy(&key[n], &ip6.ip6_src, sizeof(ip6.ip6_src));
+        n += sizeof(ip6.ip6_src) / sizeof(key[0]);
+        memcpy(&key[n], &ip6.ip6_dst, sizeof(ip6.ip6_dst));
+        n += sizeof(ip6.ip6_dst) / sizeof(key[0]);
+        proto = ip6.ip6_nxt;
+        l4off = off + sizeof(ip6);
+        break;
+    }
+    default:
+        break;
+    }
+    if (n == 0) {
+        key[0] = key[1] = 0;
+        memcpy(&key[0], eh.ether_dhost, ETHER_ADDR_LEN);
+        key[2] = eh.ether_type;
+        n = 3;
+    } else {
+        key[n++] = proto;
+        if (l4off != 0 &&
+            (proto == IPPROTO_TCP || proto == IPPROTO_UDP) &&
+            mbuf_copydata(m, l4off, sizeof(key[n]), &key[n]) == 0)
+            n++;
+    }
+
+    for (i = 0; i < n; i++) {
+        h ^= key[i];
+        h *= 0x9e3779b1;
+        h ^= h >> 16;
+    }
+    return h % IFQ_FQ_FLOWS;
+}
+
+/*
+ * Whether a frame is a pure TCP ACK that may be superseded by a later
+ * one: no payload, no flag but ACK, no ECN marking and no options but
+ * timestamps.  SACK blocks and ECN echoes carry information a later
+ * cumulative ACK does not, so such ACKs are always sent.
+ */
+static bool
+ifq_pure_ack(mbuf_t m, struct ifq_ack *a)
+{
+    struct ether_header eh;
+    struct tcphdr th;
+    uint8_t opts[TCP_MAXOLEN];
+    size_t off = ETHER_HDR_LEN;
+    int optlen, i;
+
+    if (mbuf_copydata(m, 0, sizeof(eh), &eh) != 0)
+        return false;
+    a->nkey = 0;
+    switch (ntohs(eh.ether_type)) {
+    case ETHERTYPE_IP: {
+        struct ip ip;
+
+        if (mbuf_copydata(m, off, sizeof(ip), &ip) != 0)
+            return false;
+        if (ip.ip_p != IPPROTO_TCP || ip.ip_hl != sizeof(ip) >> 2 ||
+            (ntohs(ip.ip_off) & (IP_MF | IP_OFFMASK)) ||
+            (ip.ip_tos & IPTOS_ECN_MASK) != 0)
+            return false;
+        off += sizeof(ip);
+        if (mbuf_copydata(m, off, sizeof(th), &th) != 0 ||
+            ntohs(ip.ip_len) != sizeof(ip) + (th.th_off << 2))
+            return false;
+        a->key[a->nkey++] = ip.ip_src.s_addr;
+        a->key[a->nkey++] = ip.ip_dst.s_addr;
+        break;
+    }
+    case ETHERTYPE_IPV6: {
+        struct ip6_hdr ip6;
+
+        if (mbuf_copydata(m, off, sizeof(ip6), &ip6) != 0)
+            return false;
+        if (ip6.ip6_nxt != IPPROTO_TCP ||
+            (ntohl(ip6.ip6_flow) & (IPTOS_ECN_MASK << 20)) != 0)
+            return false;
+        off += sizeof(ip6);
+        if (mbuf_copydata(m, off, sizeof(th), &th) != 0 ||
+            ntohs(ip6.ip6_plen) != (th.th_off << 2))
+            return false;
+        memcpy(&a->key[a->nkey], &ip6.ip6_src, 2 * sizeof(struct in6_addr));
+        a->nkey += 2 * sizeof(struct in6_addr) / sizeof(a->key[0]);
+        break;
+    }
+    default:
+        return false;
+    }
+
+    if (th.th_flags != TH_ACK || th.th_off < sizeof(th) >> 2)
+        return false;
+    optlen = (th.th_off << 2) - (int)sizeof(th);
+    if (optlen > 0 &&
+        mbuf_copydata(m, off + sizeof(th), optlen, opts) != 0)
+        return false;
+    for (i = 0; i < optlen; ) {
+        if (opts[i] == TCPOPT_EOL)
+            break;
+        if (opts[i] == TCPOPT_NOP) {
+            i++;
+            continue;
+        }
+        if (opts[i] != TCPOPT_TIMESTAMP || i + 1 >= optlen ||
+            opts[i + 1] != TCPOLEN_TIMESTAMP)
+            return false;
+        i += TCPOLEN_TIMESTAMP;
+    }
+
+    a->key[a->nkey++] = (uint32_t)th.th_sport << 16 | th.th_dport;
+    a->seq = ntohl(th.th_seq);
+    a->ack = ntohl(th.th_ack);
+    return true;
+}
+
+/* Whether ACK a acknowledges strictly more of the same connection than b. */
+static bool
+ifq_ack_supersedes(const struct ifq_ack *a, const struct ifq_ack *b)
+{
+    return a->nkey == b->nkey &&
+        memcmp(a->key, b->key, a->nkey * sizeof(a->key[0])) == 0 &&
+        a->seq == b->seq &&
+        (int32_t)(a->ack - b->ack) > 0;
+}
+
+/*
+ * Put m where the flow's queued ACK sits, keeping its place and enqueue
+ * time, and return the replaced ACK for the caller to free.
+ */
+static mbuf_t
+ifq_ack_replace(struct _ifqueue *ifq, struct ifq_flow *f, mbuf_t m,
+    const struct ifq_ack *a)
+{
+    mbuf_t old = f->f_ack;
+
+    mbuf_setnextpkt(m, mbuf_nextpkt(old));
+    mbuf_setnextpkt(old, NULL);
+    if (f->f_ackprev != NULL)
+        mbuf_setnextpkt(f->f_ackprev, m);
+    else
+        f->f_head = m;
+    if (f->f_tail == old)
+        f->f_tail = m;
+    mbuf_pkthdr_setheader(m, mbuf_pkthdr_header(old));
+    mbuf_pkthdr_setheader(old, NULL);
+
+    f->f_backlog = f->f_backlog - mbuf_pkthdr_len(old) + mbuf_pkthdr_len(m);
+    ifq->ifq_backlog = ifq->ifq_backlog - mbuf_pkthdr_len(old) +
+        mbuf_pkthdr_len(m);
+    f->f_ack = m;
+    f->f_ackinfo = *a;
+    ifq->ifq_stats.ack_drops++;
+    return old;
+}
+
+static void
+ifq_flow_push(struct _ifqueue *ifq, struct ifq_flow *f, mbuf_t m)
 {
-    if (!ifq->queue)
-        ifq->queue = IOPacketQueue::withCapacity(maxLen);
+    mbuf_setnextpkt(m, NULL);
+    if (f->f_tail == NULL)
+        f->f_head = m;
     else
-        ifq->queue->setCapacity(maxLen);
+        mbuf_setnextpkt(f->f_tail, m);
+    f->f_tail = m;
+    f->f_len++;
+    f->f_backlog += mbuf_pkthdr_len(m);
+    ifq->ifq_len++;
+    ifq->ifq_backlog += mbuf_pkthdr_len(m);
+}
+
+/*
+ * The enqueue timestamp rides in the packet header pointer, which the
+ * stack only uses on input; it is cleared again before the packet
+ * leaves the queue.
+ */
+static mbuf_t
+ifq_flow_pop(struct _ifqueue *ifq, struct ifq_flow *f, uint64_t *tsp)
+{
+    mbuf_t m = f->f_head;
+
+    if (m == NULL)
+        return NULL;
+    f->f_head = mbuf_nextpkt(m);
+    if (f->f_head == NULL)
+        f->f_tail = NULL;
+    mbuf_setnextpkt(m, NULL);
+    if (m == f->f_ack)
+        f->f_ack = f->f_ackprev = NULL;
+    else if (m == f->f_ackprev)
+        f->f_ackprev = NULL;
+    f->f_len--;
+    f->f_backlog -= mbuf_pkthdr_len(m);
+    ifq->ifq_len--;
+    ifq->ifq_backlog -= mbuf_pkthdr_len(m);
+    if (tsp != NULL)
+        *tsp = (uint64_t)(uintptr_t)mbuf_pkthdr_header(m);
+    mbuf_pkthdr_setheader(m, NULL);
+    return m;
+}
+
+static void
+ifq_drop(mbuf_t *drops, mbuf_t m)
+{
+    mbuf_setnextpkt(m, *drops);
+    *drops = m;
+}
+
+static void
+ifq_free_drops(mbuf_t drops)
+{
+    mbuf_t m;
+
+    while ((m = drops) != NULL) {
+        drops = mbuf_nextpkt(m);
+        mbuf_setnextpkt(m, NULL);
+        mbuf_freem(m);
+    }
+}
+
+static uint64_t
+ifq_codel_control_law(uint64_t t, uint32_t count)
+{
+    /* interval / sqrt(count) */
+    return t + IFQ_CODEL_INTERVAL * 1024 / ifq_isqrt((uint64_t)count << 20);
+}
+
+static bool
+ifq_codel_should_drop(struct _ifqueue *ifq, struct ifq_flow *f,
+    uint64_t ts, uint64_t now)
+{
+    uint64_t sojourn = now - ts;
+
+    if (sojourn / 1000 > ifq->ifq_stats.max_sojourn_us)
+        ifq->ifq_stats.max_sojourn_us = (uint32_t)(sojourn / 1000);
+    if (sojourn < IFQ_CODEL_TARGET || f->f_backlog <= IFQ_FQ_QUANTUM) {
+        f->f_first_above = 0;
+        return false;
+    }
+    if (f->f_first_above == 0) {
+        f->f_first_above = now + IFQ_CODEL_INTERVAL;
+        return false;
+    }
+    return now >= f->f_first_above;
+}
+
+/* CoDel dequeue as in RFC 8289, run on a single flow. */
+static mbuf_t
+ifq_codel_dequeue(struct _ifqueue *ifq, struct ifq_flow *f, uint64_t now,
+    mbuf_t *drops)
+{
+    uint64_t ts;
+    uint32_t delta;
+    mbuf_t m;
+
+    m = ifq_flow_pop(ifq, f, &ts);
+    if (m == NULL) {
+        f->f_first_above = 0;
+        f->f_dropping = false;
+        return NULL;
+    }
+
+    if (f->f_dropping) {
+        if (!ifq_codel_should_drop(ifq, f, ts, now)) {
+            f->f_dropping = false;
+            return m;
+        }
+        while (f->f_dropping && now >= f->f_drop_next) {
+            ifq_drop(drops, m);
+            ifq->ifq_stats.codel_drops++;
+            f->f_count++;
+            m = ifq_flow_pop(ifq, f, &ts);
+            if (m == NULL || !ifq_codel_should_drop(ifq, f, ts, now)) {
+                if (m == NULL)
+                    f->f_first_above = 0;
+                f->f_dropping = false;
+            } else
+                f->f_drop_next = ifq_codel_control_law(f->f_drop_next,
+                    f->f_count);
+        }
+    } else if (ifq_codel_should_drop(ifq, f, ts, now)) {
+        ifq_drop(drops, m);
+        ifq->ifq_stats.codel_drops++;
+        m = ifq_flow_pop(ifq, f, &ts);
+        if (m != NULL)
+            ifq_codel_should_drop(ifq, f, ts, now);
+        else
+            f->f_first_above = 0;
+        f->f_dropping = true;
+        delta = f->f_count - f->f_lastcount;
+        if (delta > 1 &&
+            (int64_t)(now - f->f_drop_next) < 16 * (int64_t)IFQ_CODEL_INTERVAL)
+            f->f_count = delta;
+        else
+            f->f_count = 1;
+        f->f_lastcount = f->f_count;
+        f->f_drop_next = ifq_codel_control_law(now, f->f_count);
+    }
+    return m;
+}
+
+static void
+ifq_purge_locked(struct _ifqueue *ifq, mbuf_t *drops)
+{
+    struct ifq_flow *f;
+    mbuf_t m;
+    int i;
+
+    while ((m = ifq->ifq_requeue) != NULL) {
+        ifq->ifq_requeue = mbuf_nextpkt(m);
+        ifq_drop(drops, m);
+    }
+    for (i = 0; i < IFQ_FQ_FLOWS; i++) {
+        f = &ifq->ifq_flows[i];
+        while ((m = ifq_flow_pop(ifq, f, NULL)) != NULL)
+            ifq_drop(drops, m);
+        memset(f, 0, sizeof(*f));
+    }
+    TAILQ_INIT(&ifq->ifq_newflows);
+    TAILQ_INIT(&ifq->ifq_oldflows);
+    ifq->ifq_len = 0;
+    ifq->ifq_backlog = 0;
+}
+
+void ifq_init(struct _ifqueue *ifq, struct _ifnet *ifp, unsigned int maxLen)
+{
+    if (!ifq->ifq_flows) {
+        ifq->ifq_flows = (struct ifq_flow *)IOMalloc(IFQ_FQ_FLOWS * sizeof(struct ifq_flow));
+        if (!ifq->ifq_flows)
+            return;
+        memset(ifq->ifq_flows, 0, IFQ_FQ_FLOWS * sizeof(struct ifq_flow));
+        ifq->ifq_lock = IOSimpleLockAlloc();
+        TAILQ_INIT(&ifq->ifq_newflows);
+        TAILQ_INIT(&ifq->ifq_oldflows);
+        ifq->ifq_requeue = NULL;
+        ifq->ifq_len = 0;
+        ifq->ifq_backlog = 0;
+        ifq->ifq_seed = arc4random();
+        memset(&ifq->ifq_stats, 0, sizeof(ifq->ifq_stats));
+    }
+    ifq->ifq_start_pending = 0;
+    ifq->ifq_maxlen = maxLen;
     ifq->ifq_oactive = 0;
 }
 
 void ifq_destroy(struct _ifqueue *ifq)
 {
-    if (ifq->queue) {
-        ifq->queue->release();
-        ifq->queue = nullptr;
+    if (ifq->ifq_flows) {
+        ifq_flush(ifq);
+        IOSimpleLockFree(ifq->ifq_lock);
+        IOFree(ifq->ifq_flows, IFQ_FQ_FLOWS * sizeof(struct ifq_flow));
+        ifq->ifq_lock = nullptr;
+        ifq->ifq_flows = nullptr;
     }
 }
 
 void ifq_flush(struct _ifqueue *ifq)
 {
-    if (ifq->queue)
-        ifq->queue->lockFlush();
+    mbuf_t drops = NULL;
+
+    if (!ifq->ifq_flows)
+        return;
+    ifq_lock_enter(ifq);
+    ifq_purge_locked(ifq, &drops);
+    ifq_lock_exit(ifq);
+    ifq_free_drops(drops);
 }
 
 bool ifq_empty(struct _ifqueue *ifq)
 {
-    return ifq->queue->getSize() == 0;
+    return ifq->ifq_len == 0;
 }
 
 uint32_t ifq_len(struct _ifqueue *ifq)
 {
-    return ifq->queue->getSize();
+    return ifq->ifq_len;
 }
 
 void ifq_set_maxlen(struct _ifqueue *ifq, uint32_t maxLen)
 {
-    ifq->queue->setCapacity(maxLen);
+    ifq->ifq_maxlen = maxLen;
 }
 
 void ifq_set_oactive(struct _ifqueue *ifq)
@@ -61,13 +495,191 @@ void ifq_clr_oactive(struct _ifqueue *ifq)
     ifq->ifq_oactive = 0;
 }
 
+/*
+ * Serve flows by deficit round robin: new flows before old ones, a flow
+ * whose deficit ran out goes to the back of the old list with another
+ * quantum, and a flow that ran dry on the new list gets one more turn on
+ * the old list before going idle so it cannot jump the queue by going
+ * quiet briefly.
+ */
 mbuf_t ifq_dequeue(struct _ifqueue *ifq)
 {
-    return ifq->queue->lockDequeue();
+    struct ifq_flowlist *head;
+    struct ifq_flow *f;
+    mbuf_t m = NULL, drops = NULL;
+    uint64_t now = ifq_now();
+
+    if (!ifq->ifq_flows)
+        return NULL;
+    ifq_lock_enter(ifq);
+    if ((m = ifq->ifq_requeue) != NULL) {
+        ifq->ifq_requeue = mbuf_nextpkt(m);
+        mbuf_setnextpkt(m, NULL);
+        ifq->ifq_len--;
+        ifq->ifq_backlog -= mbuf_pkthdr_len(m);
+        goto out;
+    }
+    for (;;) {
+        head = &ifq->ifq_newflows;
+        if ((f = TAILQ_FIRST(head)) == NULL) {
+            head = &ifq->ifq_oldflows;
+            if ((f = TAILQ_FIRST(head)) == NULL)
+                break;
+        }
+        if (f->f_deficit <= 0) {
+            f->f_deficit += IFQ_FQ_QUANTUM;
+            TAILQ_REMOVE(head, f, f_entry);
+            TAILQ_INSERT_TAIL(&ifq->ifq_oldflows, f, f_entry);
+            f->f_list = IFQ_FLOW_OLD;
+            continue;
+        }
+        m = ifq_codel_dequeue(ifq, f, now, &drops);
+        if (m == NULL) {
+            TAILQ_REMOVE(head, f, f_entry);
+            if (head == &ifq->ifq_newflows &&
+                !TAILQ_EMPTY(&ifq->ifq_oldflows)) {
+                TAILQ_INSERT_TAIL(&ifq->ifq_oldflows, f, f_entry);
+                f->f_list = IFQ_FLOW_OLD;
+            } else
+                f->f_list = IFQ_FLOW_IDLE;
+            continue;
+        }
+        f->f_deficit -= mbuf_pkthdr_len(m);
+        break;
+    }
+out:
+    if (m != NULL)
+        ifq->ifq_stats.dequeued++;
+    ifq_lock_exit(ifq);
+    ifq_free_drops(drops);
+    return m;
 }
 
+/*
+ * Queue a frame on its flow.  When the queue is over its limit a packet
+ * is dropped from the head of the flow with the largest backlog, which
+ * is usually the bulk flow that caused it.  Like OpenBSD's ifq_enqueue()
+ * the frame is consumed either way; ENOBUFS tells the caller that it was
+ * the one dropped.  A pure ACK that supersedes the flow's queued one
+ * takes its place instead.
+ */
 int ifq_enqueue(struct _ifqueue *ifq, mbuf_t m)
 {
-    ifq->queue->lockEnqueueWithDrop(m);
+    struct ifq_flow *f, *fat = NULL;
+    struct ifq_ack ack;
+    mbuf_t dm = NULL;
+    uint32_t idx;
+    bool isack;
+
+    if (!ifq->ifq_flows) {
+        mbuf_freem(m);
+        return ENXIO;
+    }
+    idx = ifq_classify(ifq, m);
+    isack = ifq_pure_ack(m, &ack);
+    mbuf_pkthdr_setheader(m, (void *)(uintptr_t)ifq_now());
+
+    ifq_lock_enter(ifq);
+    f = &ifq->ifq_flows[idx];
+    ifq->ifq_stats.enqueued++;
+    if (isack && f->f_ack != NULL &&
+        ifq_ack_supersedes(&ack, &f->f_ackinfo)) {
+        dm = ifq_ack_replace(ifq, f, m, &ack);
+        ifq_lock_exit(ifq);
+        mbuf_freem(dm);
+        return 0;
+    }
+    /* Never move an ACK past anything queued after it. */
+    f->f_ack = f->f_ackprev = NULL;
+    if (isack) {
+        f->f_ack = m;
+        f->f_ackprev = f->f_tail;
+        f->f_ackinfo = ack;
+    }
+    ifq_flow_push(ifq, f, m);
+    if (f->f_list == IFQ_FLOW_IDLE) {
+        TAILQ_INSERT_TAIL(&ifq->ifq_newflows, f, f_entry);
+        f->f_list = IFQ_FLOW_NEW;
+        f->f_deficit = IFQ_FQ_QUANTUM;
+        ifq->ifq_stats.new_flows++;
+    }
+    if (ifq->ifq_len > ifq->ifq_maxlen) {
+        /* Only flows on the new and old lists hold packets. */
+        TAILQ_FOREACH(f, &ifq->ifq_newflows, f_entry) {
+            if (fat == NULL || f->f_backlog > fat->f_backlog)
+                fat = f;
+        }
+        TAILQ_FOREACH(f, &ifq->ifq_oldflows, f_entry) {
+            if (fat == NULL || f->f_backlog > fat->f_backlog)
+                fat = f;
+        }
+        dm = ifq_flow_pop(ifq, fat, NULL);
+        if (dm != NULL)
+            ifq->ifq_stats.overlimit_drops++;
+    }
+    ifq_lock_exit(ifq);
+
+    if (dm != NULL) {
+        mbuf_freem(dm);
+        if (dm == m)
+            return ENOBUFS;
+    }
     return 0;
 }
+
+void ifq_prepend(struct _ifqueue *ifq, mbuf_t m)
+{
+    if (!ifq->ifq_flows) {
+        mbuf_freem(m);
+        return;
+    }
+    ifq_lock_enter(ifq);
+    mbuf_setnextpkt(m, ifq->ifq_requeue);
+    ifq->ifq_requeue = m;
+    ifq->ifq_len++;
+    ifq->ifq_backlog += mbuf_pkthdr_len(m);
+    ifq_lock_exit(ifq);
+}
+
+uint32_t ifq_active_flows(struct _ifqueue *ifq)
+{
+    struct ifq_flow *f;
+    uint32_t n = 0;
+
+    if (!ifq->ifq_flows)
+        return 0;
+    ifq_lock_enter(ifq);
+    TAILQ_FOREACH(f, &ifq->ifq_newflows, f_entry)
+        n++;
+    TAILQ_FOREACH(f, &ifq->ifq_oldflows, f_entry)
+        n++;
+    ifq_lock_exit(ifq);
+    return n;
+}
+
+void ifq_get_stats(struct _ifqueue *ifq, struct ifq_stats *stats)
+{
+    if (!ifq->ifq_flows) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    ifq_lock_enter(ifq);
+    *stats = ifq->ifq_stats;
+    ifq_lock_exit(ifq);
+}
+
+/*
+ * The driver's start routine runs inside the work loop gate.  A producer
+ * that finds the gate busy must not block on it, so it leaves a note
+ * here instead and whoever holds the gate kicks the queue on its way out.
+ */
+void ifq_defer_start(struct _ifqueue *ifq)
+{
+    if (OSCompareAndSwap(0, 1, &ifq->ifq_start_pending))
+        OSIncrementAtomic64((volatile SInt64 *)&ifq->ifq_stats.start_deferred);
+}
+
+bool ifq_take_deferred_start(struct _ifqueue *ifq)
+{
+    return OSCompareAndSwap(1, 0, &ifq->ifq_start_pending);
+}
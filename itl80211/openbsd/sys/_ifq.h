@@ -22,11 +22,91 @@
 #ifndef _ifq_h
 #define _ifq_h
 #include <net/if_var.h>
+#include <sys/queue.h>
+#include <IOKit/IOLocks.h>
 #include <IOKit/network/IOPacketQueue.h>
 
+/*
+ * The send queue is an FQ-CoDel scheduler (RFC 8290): packets are hashed
+ * on their 5-tuple into IFQ_FQ_FLOWS flows, each flow runs CoDel on the
+ * time its packets spend queued, and flows are served by deficit round
+ * robin with newly active flows served first.  A pure TCP ACK queued
+ * behind an older one of the same connection replaces it.
+ */
+/*
+ * Locking: the driver's work loop gate is the control-plane lock and
+ * covers net80211, the HAL, the Tx/Rx rings, timers and ioctls.
+ * ifq_lock only protects the queue itself and is the one lock the
+ * network stack takes from outside the gate, so the order is always
+ * gate -> ifq_lock.  Never enter the gate or free an mbuf with ifq_lock
+ * held.
+ */
+#define IFQ_FQ_FLOWS        1024            /* RFC 8290 default */
+#define IFQ_FQ_QUANTUM      1514            /* bytes */
+#define IFQ_CODEL_TARGET    5000000ULL      /* 5ms, in ns */
+#define IFQ_CODEL_INTERVAL  100000000ULL    /* 100ms, in ns */
+
+/*
+ * A queued pure TCP ACK that a newer cumulative ACK of the same
+ * connection may replace in place (ACK filtering).
+ */
+struct ifq_ack {
+    uint32_t        key[9];         /* addresses and ports */
+    int             nkey;
+    uint32_t        seq;
+    uint32_t        ack;
+};
+
+struct ifq_flow {
+    TAILQ_ENTRY(ifq_flow) f_entry;
+    mbuf_t          f_head;
+    mbuf_t          f_tail;
+    uint32_t        f_len;          /* packets queued */
+    uint32_t        f_backlog;      /* bytes queued */
+    int             f_deficit;
+    int             f_list;         /* IFQ_FLOW_* */
+#define IFQ_FLOW_IDLE   0
+#define IFQ_FLOW_NEW    1
+#define IFQ_FLOW_OLD    2
+    /* CoDel state */
+    uint64_t        f_first_above;
+    uint64_t        f_drop_next;
+    uint32_t        f_count;
+    uint32_t        f_lastcount;
+    bool            f_dropping;
+    /* ACK filter state */
+    mbuf_t          f_ack;          /* last queued filterable ACK */
+    mbuf_t          f_ackprev;      /* its predecessor, NULL at head */
+    struct ifq_ack  f_ackinfo;
+};
+
+TAILQ_HEAD(ifq_flowlist, ifq_flow);
+
+struct ifq_stats {
+    uint64_t        enqueued;
+    uint64_t        dequeued;
+    uint64_t        overlimit_drops;    /* queue full, dropped from fattest flow */
+    uint64_t        codel_drops;        /* dropped by CoDel */
+    uint64_t        ack_drops;          /* superseded TCP ACKs */
+    uint64_t        lock_contended;     /* ifq_lock was already held */
+    uint64_t        start_deferred;     /* start kicks left for the gate holder */
+    uint32_t        new_flows;          /* flows that became active */
+    uint32_t        max_sojourn_us;     /* worst delay seen at dequeue */
+};
+
 struct _ifqueue {
     unsigned int ifq_oactive;
-    IOPacketQueue *queue;
+    IOSimpleLock *ifq_lock;
+    struct ifq_flow *ifq_flows;
+    struct ifq_flowlist ifq_newflows;
+    struct ifq_flowlist ifq_oldflows;
+    mbuf_t ifq_requeue;                 /* ifq_prepend()ed, sent first */
+    uint32_t ifq_len;
+    uint32_t ifq_backlog;
+    uint32_t ifq_maxlen;
+    uint32_t ifq_seed;
+    struct ifq_stats ifq_stats;
+    volatile UInt32 ifq_start_pending;  /* if_start owed, see ifq_defer_start() */
 };
 
 void ifq_init(struct _ifqueue *ifq, struct _ifnet *ifp, unsigned int maxLen);
@@ -51,4 +131,14 @@ mbuf_t ifq_dequeue(struct _ifqueue *ifq);
 
 int ifq_enqueue(struct _ifqueue *ifq, mbuf_t m);
 
+void ifq_prepend(struct _ifqueue *ifq, mbuf_t m);
+
+uint32_t ifq_active_flows(struct _ifqueue *ifq);
+
+void ifq_get_stats(struct _ifqueue *ifq, struct ifq_stats *stats);
+
+void ifq_defer_start(struct _ifqueue *ifq);
+
+bool ifq_take_deferred_start(struct _ifqueue *ifq);
+
 #endif /* _ifq_h */
@@ -48,4 +48,14 @@ free(void* addr)
     IOFree(actual_addr, len + sizeof(vm_size_t));
 }
 
+/* Length addr was allocated with, 0 for NULL. */
+static inline vm_size_t
+malloc_size(const void *addr)
+{
+    if (addr == NULL) {
+        return 0;
+    }
+    return *((const vm_size_t*) addr - 1);
+}
+
 #endif /* _malloc_h */
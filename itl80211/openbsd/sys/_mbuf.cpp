@@ -23,6 +23,11 @@
 extern "C" {
 #include <net/bpf.h>
 }
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/tcp.h>
 #include <IOKit/IOCommandGate.h>
 
 extern IOCommandGate *_fCommandGate;
@@ -31,32 +36,355 @@ struct network_header {
     char pad[0x48];
 };
 
-static IOReturn _if_input(OSObject *target, void *arg0, void *arg1, void *arg2, void *arg3)
+/*
+ * Rx coalescing.
+ *
+ * Everything if_input() is handed was gathered during one pass over the
+ * device's Rx ring.  In-order TCP segments of the same flow within such a
+ * batch are merged into a single chained packet before going up the stack,
+ * which saves a trip through inputPacket() and the TCP input path per
+ * segment.  A flow is flushed when a segment does not extend it, when a
+ * segment carries PSH (merged first), when it reaches IP_MAXPACKET or
+ * LRO_MAXSEGS, and at the end of the batch.  Nothing is held across
+ * batches, so no flush timer is needed.
+ *
+ * The merged packet carries no valid TCP checksum, hence only segments
+ * whose checksums were verified by the hardware are merged.  Drivers
+ * which report such verification set IFXF_LRO; today that is iwx only.
+ *
+ * The KPI offers no way to tell TCP how many segments a packet stands
+ * for, so delayed ACKs and byte counting would treat a merged packet as
+ * one segment and produce stretch ACKs.  Merging at most two segments
+ * keeps the ACK rate at what the peer would see with delayed ACKs.
+ */
+#define LRO_MAXFLOWS    8
+#define LRO_MAXSEGS     2
+
+struct lro_hdr {
+    struct ip       *ip;
+    struct ip6_hdr  *ip6;
+    struct tcphdr   *th;
+    int             hlen;   /* ether + ip + tcp header length */
+    int             plen;   /* tcp payload length */
+};
+
+struct lro_flow {
+    mbuf_t          head;
+    mbuf_t          tail;   /* last mbuf of the chain */
+    struct lro_hdr  h;
+    uint32_t        nextseq;
+    int             nsegs;
+};
+
+#define LRO_NOTTCP      (-1)
+#define LRO_UNKNOWN     1
+
+/*
+ * Locate the IP and TCP headers of an Ethernet frame.  Returns LRO_NOTTCP
+ * for anything which cannot belong to a TCP flow, LRO_UNKNOWN for frames
+ * that might but whose headers are not contiguous in the first mbuf.
+ */
+static int
+lro_parse(mbuf_t m, struct lro_hdr *h)
+{
+    struct ether_header *eh;
+    uint8_t *p = mtod(m, uint8_t *);
+    size_t len = mbuf_len(m);
+    size_t pktlen = mbuf_pkthdr_len(m);
+    size_t off = ETHER_HDR_LEN;
+    int proto;
+
+    memset(h, 0, sizeof(*h));
+    if (len < ETHER_HDR_LEN)
+        return LRO_UNKNOWN;
+    eh = (struct ether_header *)p;
+    switch (ntohs(eh->ether_type)) {
+    case ETHERTYPE_IP:
+        if (len < off + sizeof(struct ip))
+            return LRO_UNKNOWN;
+        h->ip = (struct ip *)(p + off);
+        if (h->ip->ip_p != IPPROTO_TCP)
+            return LRO_NOTTCP;
+        if (h->ip->ip_v != IPVERSION ||
+            h->ip->ip_hl != sizeof(struct ip) >> 2 ||
+            (ntohs(h->ip->ip_off) & (IP_MF | IP_OFFMASK)) ||
+            ntohs(h->ip->ip_len) != pktlen - off)
+            return LRO_UNKNOWN;
+        off += sizeof(struct ip);
+        break;
+    case ETHERTYPE_IPV6:
+        if (len < off + sizeof(struct ip6_hdr))
+            return LRO_UNKNOWN;
+        h->ip6 = (struct ip6_hdr *)(p + off);
+        proto = h->ip6->ip6_nxt;
+        if (proto == IPPROTO_UDP || proto == IPPROTO_ICMPV6)
+            return LRO_NOTTCP;
+        if (proto != IPPROTO_TCP ||
+            (h->ip6->ip6_vfc & IPV6_VERSION_MASK) != IPV6_VERSION ||
+            ntohs(h->ip6->ip6_plen) != pktlen - off - sizeof(struct ip6_hdr))
+            return LRO_UNKNOWN;
+        off += sizeof(struct ip6_hdr);
+        break;
+    default:
+        return LRO_NOTTCP;
+    }
+
+    if (len < off + sizeof(struct tcphdr))
+        return LRO_UNKNOWN;
+    h->th = (struct tcphdr *)(p + off);
+    if (h->th->th_off < sizeof(struct tcphdr) >> 2 ||
+        len < off + (h->th->th_off << 2) ||
+        pktlen < off + (h->th->th_off << 2))
+        return LRO_UNKNOWN;
+    h->hlen = (int)off + (h->th->th_off << 2);
+    h->plen = (int)(pktlen - h->hlen);
+    return 0;
+}
+
+/* Whether a parsed segment may start or extend a coalesced packet. */
+static bool
+lro_eligible(mbuf_t m, const struct lro_hdr *h)
+{
+    mbuf_csum_performed_flags_t flags = 0;
+    mbuf_csum_performed_flags_t need = MBUF_CSUM_DID_DATA |
+        MBUF_CSUM_PSEUDO_HDR;
+    u_int32_t value = 0;
+
+    if (h->plen <= 0)
+        return false;
+    if ((h->th->th_flags & ~(TH_ACK | TH_PUSH)) != 0 ||
+        !(h->th->th_flags & TH_ACK))
+        return false;
+    if (h->ip != NULL)
+        need |= MBUF_CSUM_DID_IP | MBUF_CSUM_IP_GOOD;
+    mbuf_get_csum_performed(m, &flags, &value);
+    return (flags & need) == need && value == 0xffff;
+}
+
+static bool
+lro_same_flow(const struct lro_hdr *a, const struct lro_hdr *b)
+{
+    if (a->th->th_sport != b->th->th_sport ||
+        a->th->th_dport != b->th->th_dport)
+        return false;
+    if (a->ip != NULL && b->ip != NULL)
+        return a->ip->ip_src.s_addr == b->ip->ip_src.s_addr &&
+            a->ip->ip_dst.s_addr == b->ip->ip_dst.s_addr;
+    if (a->ip6 != NULL && b->ip6 != NULL)
+        return memcmp(&a->ip6->ip6_src, &b->ip6->ip6_src,
+            sizeof(struct in6_addr)) == 0 &&
+            memcmp(&a->ip6->ip6_dst, &b->ip6->ip6_dst,
+            sizeof(struct in6_addr)) == 0;
+    return false;
+}
+
+/*
+ * Whether segment h continues flow f.  Everything but the sequence number,
+ * payload and window must match; TCP options are compared as a whole, so
+ * a timestamp change ends the run.
+ */
+static bool
+lro_can_merge(const struct lro_flow *f, const struct lro_hdr *h)
+{
+    const struct lro_hdr *fh = &f->h;
+    int optlen = (h->th->th_off << 2) - (int)sizeof(struct tcphdr);
+
+    if (f->nsegs >= LRO_MAXSEGS)
+        return false;
+    if (ntohl(h->th->th_seq) != f->nextseq ||
+        h->th->th_ack != fh->th->th_ack ||
+        h->th->th_off != fh->th->th_off)
+        return false;
+    if (optlen > 0 && memcmp(h->th + 1, fh->th + 1, optlen) != 0)
+        return false;
+    if (fh->ip != NULL) {
+        if (h->ip->ip_tos != fh->ip->ip_tos ||
+            h->ip->ip_ttl != fh->ip->ip_ttl ||
+            h->ip->ip_off != fh->ip->ip_off)
+            return false;
+        if (ntohs(fh->ip->ip_len) + h->plen > IP_MAXPACKET)
+            return false;
+    } else {
+        if (h->ip6->ip6_flow != fh->ip6->ip6_flow ||
+            h->ip6->ip6_hlim != fh->ip6->ip6_hlim)
+            return false;
+        if (ntohs(fh->ip6->ip6_plen) + h->plen > IP_MAXPACKET)
+            return false;
+    }
+    return true;
+}
+
+static void
+lro_ip_cksum(struct ip *ip)
+{
+    uint16_t *w = (uint16_t *)ip;
+    uint32_t sum = 0;
+    int i;
+
+    ip->ip_sum = 0;
+    for (i = 0; i < (int)(sizeof(struct ip) / sizeof(uint16_t)); i++)
+        sum += w[i];
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum += sum >> 16;
+    ip->ip_sum = ~sum & 0xffff;
+}
+
+static void
+lro_deliver(struct _ifnet *ifq, mbuf_t m)
+{
+    ifq->iface->inputPacket(m, 0, IONetworkInterface::kInputOptionQueuePacket);
+    if (ifq->netStat != NULL) {
+        ifq->netStat->inputPackets++;
+    }
+}
+
+static void
+lro_flush(struct _ifnet *ifq, struct lro_flow *f)
 {
+    if (f->head == NULL)
+        return;
+    if (f->nsegs > 1) {
+        if (f->h.ip != NULL)
+            lro_ip_cksum(f->h.ip);
+        ifq->if_icoalpkts++;
+    }
+    lro_deliver(ifq, f->head);
+    f->head = f->tail = NULL;
+    f->nsegs = 0;
+}
+
+static void
+lro_start(struct lro_flow *f, mbuf_t m, const struct lro_hdr *h)
+{
+    f->head = f->tail = m;
+    while (mbuf_next(f->tail) != NULL)
+        f->tail = mbuf_next(f->tail);
+    f->h = *h;
+    f->nextseq = ntohl(h->th->th_seq) + h->plen;
+    f->nsegs = 1;
+}
+
+static void
+lro_merge(struct _ifnet *ifq, struct lro_flow *f, mbuf_t m,
+    const struct lro_hdr *h)
+{
+    struct tcphdr *th = f->h.th;
+
+    th->th_win = h->th->th_win;
+    th->th_flags |= h->th->th_flags & TH_PUSH;
+    if (f->h.ip != NULL)
+        f->h.ip->ip_len = htons(ntohs(f->h.ip->ip_len) + h->plen);
+    else
+        f->h.ip6->ip6_plen = htons(ntohs(f->h.ip6->ip6_plen) + h->plen);
+    mbuf_pkthdr_setlen(f->head, mbuf_pkthdr_len(f->head) + h->plen);
+    f->nextseq += h->plen;
+    f->nsegs++;
+
+    mbuf_adj(m, h->hlen);
+    /* Only the head of the chain may carry a packet header. */
+    mbuf_setflags_mask(m, 0, MBUF_PKTHDR);
+    m_cat(f->tail, m);
+    while (mbuf_next(f->tail) != NULL)
+        f->tail = mbuf_next(f->tail);
+    ifq->if_icoalesced++;
+}
+
+/*
+ * Hand a batch up the stack, merging in-order TCP segments on interfaces
+ * with IFXF_LRO.  Frames of one flow stay in order; a held flow may be
+ * overtaken by frames of other flows.
+ */
+static void
+lro_input(struct _ifnet *ifq, struct mbuf_list *ml)
+{
+    struct lro_flow flows[LRO_MAXFLOWS];
+    struct lro_flow *f;
+    struct lro_hdr h;
     mbuf_t m;
-    bool isEmpty = true;
-    struct _ifnet *ifq = (struct _ifnet *)arg0;
-    struct mbuf_list *ml = (struct mbuf_list *)arg1;
-    
-    MBUF_LIST_FOREACH(ml, m) {
-        if (ifq->iface == NULL) {
-            panic("%s ifq->iface == NULL!!!\n", __FUNCTION__);
-            break;
+    int i, ret, nextslot = 0;
+
+    memset(flows, 0, sizeof(flows));
+    while ((m = ml_dequeue(ml)) != NULL) {
+        if (!(ifq->if_xflags & IFXF_LRO)) {
+            lro_deliver(ifq, m);
+            continue;
         }
-        if (m == NULL) {
-            XYLog("%s m == NULL!!!\n", __FUNCTION__);
+        ret = lro_parse(m, &h);
+        if (ret == LRO_NOTTCP) {
+            lro_deliver(ifq, m);
             continue;
         }
-        //        XYLog("%s %d 啊啊啊啊 ifq->iface->inputPacket(m) hdr_len=%d len=%d\n", __FUNCTION__, __LINE__, mbuf_pkthdr_len(m), mbuf_len(m));
-        isEmpty = false;
-        ifq->iface->inputPacket(m, 0, IONetworkInterface::kInputOptionQueuePacket);
-        if (ifq->netStat != NULL) {
-            ifq->netStat->inputPackets++;
+        if (ret == LRO_UNKNOWN) {
+            /* Cannot tell which flow this is; keep ordering. */
+            for (i = 0; i < LRO_MAXFLOWS; i++)
+                lro_flush(ifq, &flows[i]);
+            lro_deliver(ifq, m);
+            continue;
+        }
+
+        f = NULL;
+        for (i = 0; i < LRO_MAXFLOWS; i++) {
+            if (flows[i].head != NULL && lro_same_flow(&flows[i].h, &h)) {
+                f = &flows[i];
+                break;
+            }
+        }
+        if (!lro_eligible(m, &h)) {
+            if (f != NULL)
+                lro_flush(ifq, f);
+            lro_deliver(ifq, m);
+            continue;
         }
+        if (f != NULL && lro_can_merge(f, &h)) {
+            lro_merge(ifq, f, m, &h);
+        } else {
+            if (f != NULL) {
+                lro_flush(ifq, f);
+            } else {
+                for (i = 0; i < LRO_MAXFLOWS; i++) {
+                    if (flows[i].head == NULL) {
+                        f = &flows[i];
+                        break;
+                    }
+                }
+                if (f == NULL) {
+                    f = &flows[nextslot];
+                    nextslot = (nextslot + 1) % LRO_MAXFLOWS;
+                    lro_flush(ifq, f);
+                }
+            }
+            lro_start(f, m, &h);
+        }
+        if (f->h.th->th_flags & TH_PUSH)
+            lro_flush(ifq, f);
+    }
+    for (i = 0; i < LRO_MAXFLOWS; i++)
+        lro_flush(ifq, &flows[i]);
+}
+
+/* Still in the gate: serve a Tx kick that found it busy. */
+static void if_start_deferred(struct _ifnet *ifp)
+{
+    if (ifq_take_deferred_start(&ifp->if_snd))
+        (*ifp->if_start)(ifp);
+}
+
+static IOReturn _if_input(OSObject *target, void *arg0, void *arg1, void *arg2, void *arg3)
+{
+    struct _ifnet *ifq = (struct _ifnet *)arg0;
+    struct mbuf_list *ml = (struct mbuf_list *)arg1;
+    
+    if (ml_empty(ml)) {
+        if_start_deferred(ifq);
+        return kIOReturnSuccess;
     }
-    if (!isEmpty) {
-        ifq->iface->flushInputQueue();
+    if (ifq->iface == NULL) {
+        panic("%s ifq->iface == NULL!!!\n", __FUNCTION__);
+        return kIOReturnError;
     }
+    lro_input(ifq, ml);
+    ifq->iface->flushInputQueue();
+    if_start_deferred(ifq);
     return kIOReturnSuccess;
 }
 
@@ -32,6 +32,7 @@ const IOControlMethodAction ItlNetworkUserClient::sMethods[IOCTL_ID_MAX] {
     sSCAN_RESULT,
     sTX_POWER_LEVEL,
     sNW_BSSID,
+    sTXQ_STATS,
 };
 
 bool ItlNetworkUserClient::initWithTask(task_t owningTask, void *securityID, UInt32 type, OSDictionary *properties)
@@ -270,6 +271,36 @@ sNW_BSSID(OSObject* target, void* data, bool isSet)
     return kIOReturnSuccess;
 }
 
+IOReturn ItlNetworkUserClient::
+sTXQ_STATS(OSObject* target, void* data, bool isSet)
+{
+    ItlNetworkUserClient *that = OSDynamicCast(ItlNetworkUserClient, target);
+    struct ioctl_txq_stats *st = (struct ioctl_txq_stats *)data;
+    struct _ifqueue *ifq = &that->fIfp->if_snd;
+    struct ifq_stats stats;
+    
+    if (isSet) {
+        return kIOReturnError;
+    }
+    ifq_get_stats(ifq, &stats);
+    memset(st, 0, sizeof(*st));
+    st->version = IOCTL_VERSION;
+    st->len = ifq_len(ifq);
+    st->backlog = ifq->ifq_backlog;
+    st->maxlen = ifq->ifq_maxlen;
+    st->active_flows = ifq_active_flows(ifq);
+    st->new_flows = stats.new_flows;
+    st->max_sojourn_us = stats.max_sojourn_us;
+    st->enqueued = stats.enqueued;
+    st->dequeued = stats.dequeued;
+    st->overlimit_drops = stats.overlimit_drops;
+    st->codel_drops = stats.codel_drops;
+    st->ack_drops = stats.ack_drops;
+    st->lock_contended = stats.lock_contended;
+    st->start_deferred = stats.start_deferred;
+    return kIOReturnSuccess;
+}
+
 IOReturn ItlNetworkUserClient::
 sNW_ID(OSObject* target, void* data, bool isSet)
 {
@@ -30,7 +30,8 @@ detach(IOPCIDevice *device)
     iwm_dma_contig_free(&sc->ict_dma);
     iwm_dma_contig_free(&sc->kw_dma);
     iwm_dma_contig_free(&sc->sched_dma);
-    iwm_dma_contig_free(&sc->fw_dma);
+    for (int i = 0; i < IWM_FW_DMA_BUFS; i++)
+        iwm_dma_contig_free(&sc->fw_dma[i]);
     ieee80211_ifdetach(ifp);
     taskq_destroy(systq);
     taskq_destroy(com.sc_nswq);
@@ -192,6 +193,12 @@ supportedFeatures()
     return kIONetworkFeatureMultiPages;
 }
 
+UInt32 ItlIwm::
+supportedChecksums(bool isOutput)
+{
+    return 0;
+}
+
 const char *ItlIwm::
 getFirmwareCountryCode()
 {
@@ -32,6 +32,7 @@
 #include <HAL/ItlHalService.hpp>
 #include <HAL/ItlDriverInfo.hpp>
 #include <HAL/ItlDriverController.hpp>
+#include <HAL/ItlMvmReorder.hpp>
 
 class ItlIwm : public ItlHalService, ItlDriverInfo, ItlDriverController {
     OSDeclareDefaultStructors(ItlIwm)
@@ -71,6 +72,8 @@ public:
     
     virtual UInt32 supportedFeatures() override;
 
+    virtual UInt32 supportedChecksums(bool isOutput) override;
+
     virtual const char *getFirmwareCountryCode() override;
 
     virtual uint32_t getTxQueueSize() override;
@@ -231,8 +234,9 @@ public:
     int    iwm_nvm_init(struct iwm_softc *);
     int    iwm_firmware_load_sect(struct iwm_softc *, uint32_t, const uint8_t *,
                                   uint32_t);
-    int    iwm_firmware_load_chunk(struct iwm_softc *, uint32_t, const uint8_t *,
-                                   uint32_t);
+    int    iwm_firmware_load_chunk(struct iwm_softc *, uint32_t,
+                                   struct iwm_dma_info *, uint32_t);
+    int    iwm_firmware_wait_chunk(struct iwm_softc *, uint32_t, uint32_t);
     int    iwm_load_firmware_7000(struct iwm_softc *, enum iwm_ucode_type);
     int    iwm_load_cpu_sections_8000(struct iwm_softc *, struct iwm_fw_sects *,
                                       int , int *);
@@ -394,12 +398,9 @@ public:
     void   iwm_flip_address(uint8_t *);
     int    iwm_detect_duplicate(struct iwm_softc *, mbuf_t,
                struct iwm_rx_mpdu_desc *, struct ieee80211_rxinfo *);
-    int    iwm_is_sn_less(uint16_t, uint16_t, uint16_t);
     void   iwm_release_frames(struct iwm_softc *, struct ieee80211_node *,
                struct iwm_rxba_data *, struct iwm_reorder_buffer *, uint16_t,
                struct mbuf_list *);
-    int    iwm_oldsn_workaround(struct iwm_softc *, struct ieee80211_node *,
-               int, struct iwm_reorder_buffer *, uint32_t, uint32_t);
     int    iwm_rx_reorder(struct iwm_softc *, mbuf_t, int,
                struct iwm_rx_mpdu_desc *, int, int, uint32_t,
                struct ieee80211_rxinfo *, struct mbuf_list *);
@@ -426,4 +427,74 @@ public:
     struct iwm_softc com;
 };
 
+/* Glue for the MVM RX re-ordering code shared with ItlIwx. */
+struct ItlIwmReorderTraits {
+    typedef ItlIwm hal_type;
+    typedef struct iwm_softc softc_type;
+    typedef struct iwm_node node_type;
+    typedef struct iwm_rxba_data rxba_type;
+    typedef struct iwm_reorder_buffer buffer_type;
+    typedef struct iwm_reorder_buf_entry entry_type;
+    typedef struct iwm_rx_mpdu_desc desc_type;
+    typedef struct iwm_rxq_dup_data dup_type;
+
+    static const uint8_t max_tid_count = IWM_MAX_TID_COUNT;
+    static const uint8_t station_id = IWM_STATION_ID;
+    static const uint8_t invalid_baid = IWM_RX_REORDER_DATA_INVALID_BAID;
+    static const unsigned int consec_drops_delba = IWM_AMPDU_CONSEC_DROPS_DELBA;
+    static const uint64_t reorder_timeout_usec = RX_REORDER_BUF_TIMEOUT_MQ_USEC;
+    static const uint8_t amsdu_subframe_idx_mask =
+        IWM_RX_MPDU_AMSDU_SUBFRAME_IDX_MASK;
+    static const uint8_t amsdu_last_subframe = IWM_RX_MPDU_AMSDU_LAST_SUBFRAME;
+    static const uint8_t mflg2_amsdu = IWM_RX_MPDU_MFLG2_AMSDU;
+    static const uint32_t reorder_baid_mask = IWM_RX_MPDU_REORDER_BAID_MASK;
+    static const uint32_t reorder_baid_shift = IWM_RX_MPDU_REORDER_BAID_SHIFT;
+    static const uint32_t reorder_nssn_mask = IWM_RX_MPDU_REORDER_NSSN_MASK;
+    static const uint32_t reorder_sn_mask = IWM_RX_MPDU_REORDER_SN_MASK;
+    static const uint32_t reorder_sn_shift = IWM_RX_MPDU_REORDER_SN_SHIFT;
+    static const uint32_t reorder_ba_old_sn = IWM_RX_MPDU_REORDER_BA_OLD_SN;
+
+    static void
+    rx_frame(hal_type *hal, softc_type *sc, mbuf_t m, int chanidx,
+             uint32_t rx_pkt_status, int is_shortpre, int rate_n_flags,
+             uint32_t device_timestamp, struct ieee80211_rxinfo *rxi,
+             struct mbuf_list *ml)
+    {
+        hal->iwm_rx_frame(sc, m, chanidx, rx_pkt_status, is_shortpre,
+                          rate_n_flags, device_timestamp, rxi, ml);
+    }
+
+    static rxba_type *
+    rxba_from_buf(buffer_type *buf)
+    {
+        return iwm_rxba_data_from_reorder_buf(buf);
+    }
+
+    static buffer_type *
+    rx_buffer(rxba_type *rxba, int queue)
+    {
+        return &rxba->reorder_buf;
+    }
+
+    static entry_type *
+    rx_entries(rxba_type *rxba, buffer_type *buf)
+    {
+        return &rxba->entries[0];
+    }
+
+    static dup_type *
+    rx_dup_data(node_type *in, int queue)
+    {
+        return &in->dup_data;
+    }
+
+    static hal_type *
+    hal_from_softc(softc_type *sc)
+    {
+        return container_of(sc, ItlIwm, com);
+    }
+};
+
+typedef ItlMvmReorder<ItlIwmReorderTraits> ItlIwmReorder;
+
 #endif /* ItlIwm_hpp */
@@ -754,40 +754,65 @@ iwm_toggle_tx_ant(struct iwm_softc *sc, uint8_t *ant)
     *ant = ind;
 }
 
+/*
+ * Upload a section through the service channel in chunks of one DMA
+ * transfer. Chunks alternate between the staging buffers so that the
+ * copy of the next chunk overlaps the transfer of the current one.
+ */
 int ItlIwm::
 iwm_firmware_load_sect(struct iwm_softc *sc, uint32_t dst_addr,
                        const uint8_t *section, uint32_t byte_cnt)
 {
-    int err = EINVAL;
-    uint32_t chunk_sz, offset;
+    struct iwm_dma_info *dma;
+    struct timeval start, end, delta;
+    int err = EINVAL, buf = 0;
+    uint32_t chunk_sz, offset, next;
     
+    getmicrouptime(&start);
     chunk_sz = MIN(IWM_FH_MEM_TB_MAX_LENGTH, byte_cnt);
     
-    for (offset = 0; offset < byte_cnt; offset += chunk_sz) {
+    dma = &sc->fw_dma[buf];
+    memcpy(dma->vaddr, section, chunk_sz);
+    for (offset = 0; offset < byte_cnt; offset = next) {
         uint32_t addr, len;
-        const uint8_t *data;
         
         addr = dst_addr + offset;
         len = MIN(chunk_sz, byte_cnt - offset);
-        data = section + offset;
+        next = offset + len;
         
-        err = iwm_firmware_load_chunk(sc, addr, data, len);
+        err = iwm_firmware_load_chunk(sc, addr, dma, len);
+        if (err)
+            break;
+        
+        /* Stage the next chunk while this one is in flight. */
+        if (next < byte_cnt) {
+            buf = (buf + 1) % IWM_FW_DMA_BUFS;
+            dma = &sc->fw_dma[buf];
+            memcpy(dma->vaddr, section + next,
+                   MIN(chunk_sz, byte_cnt - next));
+        }
+        
+        err = iwm_firmware_wait_chunk(sc, addr, len);
         if (err)
             break;
     }
     
+    getmicrouptime(&end);
+    timersub(&end, &start, &delta);
+    DPRINTF(("%s: section addr 0x%x len %u loaded in %ld us\n",
+             DEVNAME(sc), dst_addr, byte_cnt,
+             (long)(delta.tv_sec * 1000000 + delta.tv_usec)));
     return err;
 }
 
+/*
+ * Start a service channel transfer of the chunk staged in dma.
+ * Completion is collected by iwm_firmware_wait_chunk().
+ */
 int ItlIwm::
 iwm_firmware_load_chunk(struct iwm_softc *sc, uint32_t dst_addr,
-                        const uint8_t *chunk, uint32_t byte_cnt)
+                        struct iwm_dma_info *dma, uint32_t byte_cnt)
 {
-    struct iwm_dma_info *dma = &sc->fw_dma;
-    int err;
-    
-    /* Copy firmware chunk into pre-allocated DMA-safe memory. */
-    memcpy(dma->vaddr, chunk, byte_cnt);
     //        bus_dmamap_sync(sc->sc_dmat,
     //            dma->map, 0, byte_cnt, BUS_DMASYNC_PREWRITE);
     
@@ -820,6 +845,14 @@ iwm_firmware_load_chunk(struct iwm_softc *sc, uint32_t dst_addr,
               IWM_FH_TCSR_TX_CONFIG_REG_VAL_CIRQ_HOST_ENDTFD);
     
     iwm_nic_unlock(sc);
+    return 0;
+}
+
+int ItlIwm::
+iwm_firmware_wait_chunk(struct iwm_softc *sc, uint32_t dst_addr,
+                        uint32_t byte_cnt)
+{
+    int err;
     
     /* Wait for this segment to load. */
     err = 0;
@@ -987,10 +1020,12 @@ int ItlIwm::
 iwm_load_firmware(struct iwm_softc *sc, enum iwm_ucode_type ucode_type)
 {
     XYLog("%s\n", __FUNCTION__);
+    struct timeval start, end, delta;
     int err/*, w*/;
     
     sc->sc_uc.uc_intr = 0;
     
+    getmicrouptime(&start);
     if (sc->sc_device_family >= IWM_DEVICE_FAMILY_8000)
         err = iwm_load_firmware_8000(sc, ucode_type);
     else
@@ -998,6 +1033,10 @@ iwm_load_firmware(struct iwm_softc *sc, enum iwm_ucode_type ucode_type)
     
     if (err)
         return err;
+    getmicrouptime(&end);
+    timersub(&end, &start, &delta);
+    DPRINTF(("%s: ucode type %d uploaded in %ld us\n", DEVNAME(sc),
+             ucode_type, (long)(delta.tv_sec * 1000000 + delta.tv_usec)));
     
     /* wait for the firmware to load */
 //    for (w = 0; !sc->sc_uc.uc_intr && w < 10; w++) {
@@ -571,7 +571,12 @@ struct iwm_softc {
 #define IWM_DEVICE_FAMILY_9000  3
 
 	struct iwm_dma_info kw_dma;
-	struct iwm_dma_info fw_dma;
+	/*
+	 * Firmware staging buffers, one DMA transfer each: the next chunk
+	 * is copied into one while the other is being transferred.
+	 */
+#define IWM_FW_DMA_BUFS	2
+	struct iwm_dma_info fw_dma[IWM_FW_DMA_BUFS];
 
 	int sc_fw_chunk_done;
 	int sc_init_complete;
@@ -378,64 +378,7 @@ iwm_rx_ba_session_expired(void *arg)
 void ItlIwm::
 iwm_reorder_timer_expired(void *arg)
 {
-    struct mbuf_list ml = MBUF_LIST_INITIALIZER();
-    struct iwm_reorder_buffer *buf = (struct iwm_reorder_buffer *)arg;
-    struct iwm_rxba_data *rxba = iwm_rxba_data_from_reorder_buf(buf);
-    struct iwm_reorder_buf_entry *entries = &rxba->entries[0];
-    struct iwm_softc *sc = rxba->sc;
-    ItlIwm *that = container_of(sc, ItlIwm, com);
-    struct ieee80211com *ic = &sc->sc_ic;
-    struct ieee80211_node *ni = ic->ic_bss;
-    int i, s;
-    uint16_t sn = 0, index = 0;
-    int expired = 0;
-    int cont = 0;
-    struct timeval now, timeout, expiry;
-    
-    if (!buf->num_stored || buf->removed)
-        return;
-    
-    s = splnet();
-    getmicrouptime(&now);
-    USEC_TO_TIMEVAL(RX_REORDER_BUF_TIMEOUT_MQ_USEC, &timeout);
-    
-    for (i = 0; i < buf->buf_size ; i++) {
-        index = (buf->head_sn + i) % buf->buf_size;
-        
-        if (ml_empty(&entries[index].frames)) {
-            /*
-             * If there is a hole and the next frame didn't expire
-             * we want to break and not advance SN.
-             */
-            cont = 0;
-            continue;
-        }
-        timeradd(&entries[index].reorder_time, &timeout, &expiry);
-        if (!cont && timercmp(&now, &expiry, <))
-            break;
-        
-        expired = 1;
-        /* continue until next hole after this expired frame */
-        cont = 1;
-        sn = (buf->head_sn + (i + 1)) & 0xfff;
-    }
-    
-    if (expired) {
-        /* SN is set to the last expired frame + 1 */
-        that->iwm_release_frames(sc, ni, rxba, buf, sn, &ml);
-        if_input(&sc->sc_ic.ic_if, &ml);
-        ic->ic_stats.is_ht_rx_ba_window_gap_timeout++;
-    } else {
-        /*
-         * If no frame expired and there are stored frames, index is now
-         * pointing to the first unexpired frame - modify reorder timeout
-         * accordingly.
-         */
-        timeout_add_usec(&buf->reorder_timer,
-                         RX_REORDER_BUF_TIMEOUT_MQ_USEC);
-    }
-    
-    splx(s);
+    ItlIwmReorder::reorder_timer_expired(arg);
 }
 
 uint8_t ItlIwm::
@@ -1352,6 +1295,10 @@ iwm_rx_tx_cmd_single(struct iwm_softc *sc, struct iwm_tx_resp *tx_resp,
             if (skb_freed > 1)
                 info->flags |= IEEE80211_TX_STAT_ACK;
 
+            if (!flushed && ieee80211_is_data(txd->fc))
+                ieee80211_roam_txstatus(&sc->sc_ic, 1,
+                    !(info->flags & IEEE80211_TX_STAT_ACK));
+
             info->status.rates[0].count = tx_resp->failure_frame + 1;
             iwl_mvm_hwrate_to_tx_status(le32_to_cpu(tx_resp->initial_rate),
                             info);
@@ -1419,7 +1366,8 @@ iwm_clear_oactive(struct iwm_softc *sc, struct iwm_tx_ring *ring)
 
     if (ring->queued < IWM_TX_RING_LOMARK) {
         sc->qfullmsk &= ~(1 << ring->qid);
-        if (sc->qfullmsk == 0 && ifq_is_oactive(&ifp->if_snd)) {
+        if (sc->qfullmsk == 0 && (ifq_is_oactive(&ifp->if_snd) ||
+            ifq_take_deferred_start(&ifp->if_snd))) {
             ifq_clr_oactive(&ifp->if_snd);
             (*ifp->if_start)(ifp);
         }
@@ -3527,6 +3475,10 @@ _iwm_start_task(OSObject *target, void *arg0, void *arg1, void *arg2, void *arg3
     mbuf_t m;
     int ac = EDCA_AC_BE; /* XXX */
     
+    KASSERT(that->getMainWorkLoop()->inGate(), "start task outside the work loop gate");
+    /* This pass serves any kick a producer deferred to the gate holder. */
+    ifq_take_deferred_start(&ifp->if_snd);
+    
     if (!(ifp->if_flags & IFF_RUNNING) || ifq_is_oactive(&ifp->if_snd)) {
         return kIOReturnOutputDropped;
     }
@@ -3601,7 +3553,12 @@ iwm_start(struct _ifnet *ifp)
 //        if (that->outputThreadSignal) {
 //            semaphore_signal(that->outputThreadSignal);
 //        }
-    that->getMainCommandGate()->attemptAction(_iwm_start_task, &that->com.sc_ic.ic_ac.ac_if);
+    /*
+     * Never block the caller on the gate: if it is busy, the kick runs
+     * as soon as the gate is released, see deferStart().
+     */
+    if (that->getMainCommandGate()->attemptAction(_iwm_start_task, &that->com.sc_ic.ic_ac.ac_if) == kIOReturnCannotLock)
+        that->deferStart(ifp);
 //    _iwm_start_task(that, &that->com.sc_ic.ic_ac.ac_if, NULL, NULL, NULL);
 }
 
@@ -4716,15 +4673,19 @@ iwm_attach(struct iwm_softc *sc, struct pci_attach_args *pa)
     XYLog("alloc contig\n");
     
     /*
-     * Allocate DMA memory for firmware transfers.
+     * Allocate DMA memory for firmware transfers. Sections are sent in
+     * chunks of at most one service channel transfer, so each staging
+     * buffer only needs to hold that much.
      * Must be aligned on a 16-byte boundary.
      */
-    err = iwm_dma_contig_alloc(sc->sc_dmat, &sc->fw_dma,
-        sc->sc_fwdmasegsz, 16);
-    if (err) {
-        XYLog("%s: could not allocate memory for firmware\n",
-            DEVNAME(sc));
-        return false;
+    for (i = 0; i < IWM_FW_DMA_BUFS; i++) {
+        err = iwm_dma_contig_alloc(sc->sc_dmat, &sc->fw_dma[i],
+            MIN(sc->sc_fwdmasegsz, IWM_FH_MEM_TB_MAX_LENGTH), 16);
+        if (err) {
+            XYLog("%s: could not allocate memory for firmware\n",
+                DEVNAME(sc));
+            goto fail1;
+        }
     }
 
     /* Allocate "Keep Warm" page, used internally by the card. */
@@ -4896,7 +4857,8 @@ fail3:    if (sc->ict_dma.vaddr != NULL)
     iwm_dma_contig_free(&sc->ict_dma);
     
 fail2:    iwm_dma_contig_free(&sc->kw_dma);
-fail1:    iwm_dma_contig_free(&sc->fw_dma);
+fail1:    for (i = 0; i < IWM_FW_DMA_BUFS; i++)
+    iwm_dma_contig_free(&sc->fw_dma[i]);
     XYLog("attach failed.\n");
     return false;
 }
@@ -5174,6 +5136,7 @@ iwm_activate(struct iwm_softc *sc, int act)
     switch (act) {
         case DVACT_QUIESCE:
             if (ifp->if_flags & IFF_RUNNING) {
+                ieee80211_resume_save(&sc->sc_ic);
                 //                rw_enter_write(&sc->ioctl_rwl);
                 iwm_stop(ifp);
                 //                rw_exit(&sc->ioctl_rwl);
@@ -5187,6 +5150,7 @@ iwm_activate(struct iwm_softc *sc, int act)
             break;
         case DVACT_WAKEUP:
             /* Hardware should be up at this point. */
+            ieee80211_resume_wakeup(&sc->sc_ic);
             if (iwm_set_hw_ready(sc))
                 task_add(systq, &sc->init_task);
             break;
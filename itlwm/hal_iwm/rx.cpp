@@ -442,74 +442,11 @@ iwm_flip_address(uint8_t *addr)
     IEEE80211_ADDR_COPY(addr, mac_addr);
 }
 
-/*
- * Drop duplicate 802.11 retransmissions
- * (IEEE 802.11-2012: 9.3.2.10 "Duplicate detection and recovery")
- * and handle pseudo-duplicate frames which result from deaggregation
- * of A-MSDU frames in hardware.
- */
 int ItlIwm::
 iwm_detect_duplicate(struct iwm_softc *sc, mbuf_t m,
                      struct iwm_rx_mpdu_desc *desc, struct ieee80211_rxinfo *rxi)
 {
-    struct ieee80211com *ic = &sc->sc_ic;
-    struct iwm_node *in = (struct iwm_node *)ic->ic_bss;
-    struct iwm_rxq_dup_data *dup_data = &in->dup_data;
-    uint8_t tid = IWM_MAX_TID_COUNT, subframe_idx;
-    struct ieee80211_frame *wh = mtod(m, struct ieee80211_frame *);
-    uint8_t type = wh->i_fc[0] & IEEE80211_FC0_TYPE_MASK;
-    uint8_t subtype = wh->i_fc[0] & IEEE80211_FC0_SUBTYPE_MASK;
-    int hasqos = ieee80211_has_qos(wh);
-    uint16_t seq;
-    
-    if (type == IEEE80211_FC0_TYPE_CTL ||
-        (hasqos && (subtype & IEEE80211_FC0_SUBTYPE_NODATA)) ||
-        IEEE80211_IS_MULTICAST(wh->i_addr1))
-        return 0;
-    
-    if (hasqos) {
-        tid = (ieee80211_get_qos(wh) & IEEE80211_QOS_TID);
-        if (tid > IWM_MAX_TID_COUNT)
-            tid = IWM_MAX_TID_COUNT;
-    }
-    
-    /* If this wasn't a part of an A-MSDU the sub-frame index will be 0 */
-    subframe_idx = desc->amsdu_info &
-    IWM_RX_MPDU_AMSDU_SUBFRAME_IDX_MASK;
-    
-    seq = letoh16(*(u_int16_t *)wh->i_seq) >> IEEE80211_SEQ_SEQ_SHIFT;
-    if ((wh->i_fc[1] & IEEE80211_FC1_RETRY) &&
-        dup_data->last_seq[tid] == seq &&
-        dup_data->last_sub_frame[tid] >= subframe_idx)
-        return 1;
-    
-    /*
-     * Allow the same frame sequence number for all A-MSDU subframes
-     * following the first subframe.
-     * Otherwise these subframes would be discarded as replays.
-     */
-    if (dup_data->last_seq[tid] == seq &&
-        subframe_idx > dup_data->last_sub_frame[tid] &&
-        (desc->mac_flags2 & IWM_RX_MPDU_MFLG2_AMSDU)) {
-        rxi->rxi_flags |= IEEE80211_RXI_SAME_SEQ;
-    }
-    
-    dup_data->last_seq[tid] = seq;
-    dup_data->last_sub_frame[tid] = subframe_idx;
-    
-    return 0;
-}
-
-/*
- * Returns true if sn2 - buffer_size < sn1 < sn2.
- * To be used only in order to compare reorder buffer head with NSSN.
- * We fully trust NSSN unless it is behind us due to reorder timeout.
- * Reorder timeout can only bring us up to buffer_size SNs ahead of NSSN.
- */
-int ItlIwm::
-iwm_is_sn_less(uint16_t sn1, uint16_t sn2, uint16_t buffer_size)
-{
-    return SEQ_LT(sn1, sn2) && !SEQ_LT(sn1, sn2 - buffer_size);
+    return ItlIwmReorder::detect_duplicate(sc, m, desc, rxi, 0);
 }
 
 void ItlIwm::
@@ -517,307 +454,17 @@ iwm_release_frames(struct iwm_softc *sc, struct ieee80211_node *ni,
                    struct iwm_rxba_data *rxba, struct iwm_reorder_buffer *reorder_buf,
                    uint16_t nssn, struct mbuf_list *ml)
 {
-    struct iwm_reorder_buf_entry *entries = &rxba->entries[0];
-    uint16_t ssn = reorder_buf->head_sn;
-    
-    /* ignore nssn smaller than head sn - this can happen due to timeout */
-    if (iwm_is_sn_less(nssn, ssn, reorder_buf->buf_size))
-        goto set_timer;
-    
-    while (iwm_is_sn_less(ssn, nssn, reorder_buf->buf_size)) {
-        int index = ssn % reorder_buf->buf_size;
-        mbuf_t m;
-        int chanidx, is_shortpre;
-        uint32_t rx_pkt_status, rate_n_flags, device_timestamp;
-        struct ieee80211_rxinfo *rxi;
-        
-        /* This data is the same for all A-MSDU subframes. */
-        chanidx = entries[index].chanidx;
-        rx_pkt_status = entries[index].rx_pkt_status;
-        is_shortpre = entries[index].is_shortpre;
-        rate_n_flags = entries[index].rate_n_flags;
-        device_timestamp = entries[index].device_timestamp;
-        rxi = &entries[index].rxi;
-        
-        /*
-         * Empty the list. Will have more than one frame for A-MSDU.
-         * Empty list is valid as well since nssn indicates frames were
-         * received.
-         */
-        while ((m = ml_dequeue(&entries[index].frames)) != NULL) {
-            iwm_rx_frame(sc, m, chanidx, rx_pkt_status, is_shortpre,
-                         rate_n_flags, device_timestamp, rxi, ml);
-            reorder_buf->num_stored--;
-            
-            /*
-             * Allow the same frame sequence number and CCMP PN for
-             * all A-MSDU subframes following the first subframe.
-             * Otherwise they would be discarded as replays.
-             */
-            rxi->rxi_flags |= IEEE80211_RXI_SAME_SEQ;
-            rxi->rxi_flags |= IEEE80211_RXI_HWDEC_SAME_PN;
-        }
-        
-        ssn = (ssn + 1) & 0xfff;
-    }
-    reorder_buf->head_sn = nssn;
-    
-set_timer:
-    if (reorder_buf->num_stored && !reorder_buf->removed) {
-        timeout_add_usec(&reorder_buf->reorder_timer,
-                         RX_REORDER_BUF_TIMEOUT_MQ_USEC);
-    } else
-        timeout_del(&reorder_buf->reorder_timer);
+    ItlIwmReorder::release_frames(this, sc, ni, rxba, reorder_buf, nssn, ml);
 }
 
-int ItlIwm::
-iwm_oldsn_workaround(struct iwm_softc *sc, struct ieee80211_node *ni, int tid,
-                     struct iwm_reorder_buffer *buffer, uint32_t reorder_data, uint32_t gp2)
-{
-    struct ieee80211com *ic = &sc->sc_ic;
-    
-    if (gp2 != buffer->consec_oldsn_ampdu_gp2) {
-        /* we have a new (A-)MPDU ... */
-        
-        /*
-         * reset counter to 0 if we didn't have any oldsn in
-         * the last A-MPDU (as detected by GP2 being identical)
-         */
-        if (!buffer->consec_oldsn_prev_drop)
-            buffer->consec_oldsn_drops = 0;
-        
-        /* either way, update our tracking state */
-        buffer->consec_oldsn_ampdu_gp2 = gp2;
-    } else if (buffer->consec_oldsn_prev_drop) {
-        /*
-         * tracking state didn't change, and we had an old SN
-         * indication before - do nothing in this case, we
-         * already noted this one down and are waiting for the
-         * next A-MPDU (by GP2)
-         */
-        return 0;
-    }
-    
-    /* return unless this MPDU has old SN */
-    if (!(reorder_data & IWM_RX_MPDU_REORDER_BA_OLD_SN))
-        return 0;
-    
-    /* update state */
-    buffer->consec_oldsn_prev_drop = 1;
-    buffer->consec_oldsn_drops++;
-    
-    /* if limit is reached, send del BA and reset state */
-    if (buffer->consec_oldsn_drops == IWM_AMPDU_CONSEC_DROPS_DELBA) {
-        XYLog("reached %d old SN frames, stopping BA session on TID %d\n",
-              IWM_AMPDU_CONSEC_DROPS_DELBA, tid);
-        ieee80211_delba_request(ic, ni, IEEE80211_REASON_UNSPECIFIED,
-                                0, tid);
-        buffer->consec_oldsn_prev_drop = 0;
-        buffer->consec_oldsn_drops = 0;
-        return 1;
-    }
-    
-    return 0;
-}
-
-/*
- * Handle re-ordering of frames which were de-aggregated in hardware.
- * Returns 1 if the MPDU was consumed (buffered or dropped).
- * Returns 0 if the MPDU should be passed to upper layer.
- */
 int ItlIwm::
 iwm_rx_reorder(struct iwm_softc *sc, mbuf_t m, int chanidx,
                struct iwm_rx_mpdu_desc *desc, int is_shortpre, int rate_n_flags,
                uint32_t device_timestamp, struct ieee80211_rxinfo *rxi,
                struct mbuf_list *ml)
 {
-    struct ieee80211com *ic = &sc->sc_ic;
-    struct ieee80211_frame *wh;
-    struct ieee80211_node *ni;
-    struct iwm_rxba_data *rxba;
-    struct iwm_reorder_buffer *buffer;
-    uint32_t reorder_data = le32toh(desc->reorder_data);
-    int is_amsdu = (desc->mac_flags2 & IWM_RX_MPDU_MFLG2_AMSDU);
-    int last_subframe =
-    (desc->amsdu_info & IWM_RX_MPDU_AMSDU_LAST_SUBFRAME);
-    uint8_t tid;
-    uint8_t subframe_idx = (desc->amsdu_info &
-                            IWM_RX_MPDU_AMSDU_SUBFRAME_IDX_MASK);
-    struct iwm_reorder_buf_entry *entries;
-    int index;
-    uint16_t nssn, sn;
-    uint8_t baid, type, subtype;
-    int hasqos;
-    
-    wh = mtod(m, struct ieee80211_frame *);
-    hasqos = ieee80211_has_qos(wh);
-    tid = hasqos ? ieee80211_get_qos(wh) & IEEE80211_QOS_TID : 0;
-    
-    type = wh->i_fc[0] & IEEE80211_FC0_TYPE_MASK;
-    subtype = wh->i_fc[0] & IEEE80211_FC0_SUBTYPE_MASK;
-    
-    /*
-     * We are only interested in Block Ack requests and unicast QoS data.
-     */
-    if (IEEE80211_IS_MULTICAST(wh->i_addr1))
-        return 0;
-    if (hasqos) {
-        if (subtype & IEEE80211_FC0_SUBTYPE_NODATA)
-            return 0;
-    } else {
-        if (type != IEEE80211_FC0_TYPE_CTL ||
-            subtype != IEEE80211_FC0_SUBTYPE_BAR)
-            return 0;
-    }
-    
-    baid = (reorder_data & IWM_RX_MPDU_REORDER_BAID_MASK) >>
-    IWM_RX_MPDU_REORDER_BAID_SHIFT;
-    if (baid == IWM_RX_REORDER_DATA_INVALID_BAID ||
-        baid >= nitems(sc->sc_rxba_data))
-        return 0;
-    
-    rxba = &sc->sc_rxba_data[baid];
-    if (rxba->reorder_buf.buf_size == 0 || tid != rxba->tid || rxba->sta_id != IWM_STATION_ID)
-        return 0;
-    
-    if (rxba->timeout != 0)
-        getmicrouptime(&rxba->last_rx);
-    
-    /* Bypass A-MPDU re-ordering in net80211. */
-    rxi->rxi_flags |= IEEE80211_RXI_AMPDU_DONE;
-    
-    nssn = reorder_data & IWM_RX_MPDU_REORDER_NSSN_MASK;
-    sn = (reorder_data & IWM_RX_MPDU_REORDER_SN_MASK) >>
-    IWM_RX_MPDU_REORDER_SN_SHIFT;
-    
-    buffer = &rxba->reorder_buf;
-    entries = &rxba->entries[0];
-    
-    if (!buffer->valid) {
-        if (reorder_data & IWM_RX_MPDU_REORDER_BA_OLD_SN)
-            return 0;
-        buffer->valid = 1;
-    }
-    
-    ni = ieee80211_find_rxnode(ic, wh);
-    if (type == IEEE80211_FC0_TYPE_CTL &&
-        subtype == IEEE80211_FC0_SUBTYPE_BAR) {
-        iwm_release_frames(sc, ni, rxba, buffer, nssn, ml);
-        goto drop;
-    }
-    
-    /*
-     * If there was a significant jump in the nssn - adjust.
-     * If the SN is smaller than the NSSN it might need to first go into
-     * the reorder buffer, in which case we just release up to it and the
-     * rest of the function will take care of storing it and releasing up to
-     * the nssn.
-     */
-    if (!iwm_is_sn_less(nssn, buffer->head_sn + buffer->buf_size,
-                        buffer->buf_size) ||
-        !SEQ_LT(sn, buffer->head_sn + buffer->buf_size)) {
-        uint16_t min_sn = SEQ_LT(sn, nssn) ? sn : nssn;
-        ic->ic_stats.is_ht_rx_frame_above_ba_winend++;
-        iwm_release_frames(sc, ni, rxba, buffer, min_sn, ml);
-    }
-    
-    if (iwm_oldsn_workaround(sc, ni, tid, buffer, reorder_data,
-                             device_timestamp)) {
-        /* BA session will be torn down. */
-        ic->ic_stats.is_ht_rx_ba_window_jump++;
-        goto drop;
-        
-    }
-    
-    /* drop any outdated packets */
-    if (SEQ_LT(sn, buffer->head_sn)) {
-        ic->ic_stats.is_ht_rx_frame_below_ba_winstart++;
-        goto drop;
-    }
-    
-    /* release immediately if allowed by nssn and no stored frames */
-    if (!buffer->num_stored && SEQ_LT(sn, nssn)) {
-        if (iwm_is_sn_less(buffer->head_sn, nssn, buffer->buf_size) &&
-            (!is_amsdu || last_subframe))
-            buffer->head_sn = nssn;
-        ieee80211_release_node(ic, ni);
-        return 0;
-    }
-    
-    /*
-     * release immediately if there are no stored frames, and the sn is
-     * equal to the head.
-     * This can happen due to reorder timer, where NSSN is behind head_sn.
-     * When we released everything, and we got the next frame in the
-     * sequence, according to the NSSN we can't release immediately,
-     * while technically there is no hole and we can move forward.
-     */
-    if (!buffer->num_stored && sn == buffer->head_sn) {
-        if (!is_amsdu || last_subframe)
-            buffer->head_sn = (buffer->head_sn + 1) & 0xfff;
-        ieee80211_release_node(ic, ni);
-        return 0;
-    }
-    
-    index = sn % buffer->buf_size;
-    
-    /*
-     * Check if we already stored this frame
-     * As AMSDU is either received or not as whole, logic is simple:
-     * If we have frames in that position in the buffer and the last frame
-     * originated from AMSDU had a different SN then it is a retransmission.
-     * If it is the same SN then if the subframe index is incrementing it
-     * is the same AMSDU - otherwise it is a retransmission.
-     */
-    if (!ml_empty(&entries[index].frames)) {
-        if (!is_amsdu) {
-            ic->ic_stats.is_ht_rx_ba_no_buf++;
-            goto drop;
-        } else if (sn != buffer->last_amsdu ||
-                   buffer->last_sub_index >= subframe_idx) {
-            ic->ic_stats.is_ht_rx_ba_no_buf++;
-            goto drop;
-        }
-    } else {
-        /* This data is the same for all A-MSDU subframes. */
-        entries[index].chanidx = chanidx;
-        entries[index].is_shortpre = is_shortpre;
-        entries[index].rate_n_flags = rate_n_flags;
-        entries[index].device_timestamp = device_timestamp;
-        memcpy(&entries[index].rxi, rxi, sizeof(entries[index].rxi));
-    }
-    
-    /* put in reorder buffer */
-    ml_enqueue(&entries[index].frames, m);
-    buffer->num_stored++;
-    getmicrouptime(&entries[index].reorder_time);
-    
-    if (is_amsdu) {
-        buffer->last_amsdu = sn;
-        buffer->last_sub_index = subframe_idx;
-    }
-    
-    /*
-     * We cannot trust NSSN for AMSDU sub-frames that are not the last.
-     * The reason is that NSSN advances on the first sub-frame, and may
-     * cause the reorder buffer to advance before all the sub-frames arrive.
-     * Example: reorder buffer contains SN 0 & 2, and we receive AMSDU with
-     * SN 1. NSSN for first sub frame will be 3 with the result of driver
-     * releasing SN 0,1, 2. When sub-frame 1 arrives - reorder buffer is
-     * already ahead and it will be dropped.
-     * If the last sub-frame is not on this queue - we will get frame
-     * release notification with up to date NSSN.
-     */
-    if (!is_amsdu || last_subframe)
-        iwm_release_frames(sc, ni, rxba, buffer, nssn, ml);
-    
-    ieee80211_release_node(ic, ni);
-    return 1;
-    
-drop:
-    mbuf_freem(m);
-    ieee80211_release_node(ic, ni);
-    return 1;
+    return ItlIwmReorder::rx_reorder(this, sc, m, chanidx, desc, is_shortpre,
+                                     rate_n_flags, device_timestamp, rxi, 0, ml);
 }
 
 void ItlIwm::
@@ -173,6 +173,10 @@ iwm_lmac_scan_fill_channels(struct iwm_softc *sc,
          c++) {
         if (c->ic_flags == 0)
             continue;
+        if (bgscan && ieee80211_chanhist_skip(ic, c))
+            continue;
+        if (!bgscan && ieee80211_resume_skip(ic, c))
+            continue;
         
         chan->channel_num = htole16(ieee80211_mhz2ieee(c->ic_freq, 0));
         chan->iter_count = htole16(1);
@@ -201,6 +205,10 @@ iwm_umac_scan_fill_channels(struct iwm_softc *sc,
          c++) {
         if (c->ic_flags == 0)
             continue;
+        if (bgscan && ieee80211_chanhist_skip(ic, c))
+            continue;
+        if (!bgscan && ieee80211_resume_skip(ic, c))
+            continue;
         
         chan->channel_num = ieee80211_mhz2ieee(c->ic_freq, 0);
         chan->iter_count = 1;
@@ -614,7 +622,8 @@ iwm_umac_scan(struct iwm_softc *sc, int bgscan)
         req->v7.adwell_default_n_aps_social =
         IWM_SCAN_ADWELL_DEFAULT_N_APS_SOCIAL;
         req->v7.adwell_default_n_aps =
-        IWM_SCAN_ADWELL_DEFAULT_LB_N_APS;
+        ieee80211_scan_naps(ic, IEEE80211_CHAN_2GHZ,
+                            IWM_SCAN_ADWELL_DEFAULT_LB_N_APS);
         
         if (ic->ic_des_esslen != 0)
             req->v7.adwell_max_budget =
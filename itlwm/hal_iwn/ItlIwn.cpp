@@ -205,6 +205,12 @@ supportedFeatures()
     return kIONetworkFeatureMultiPages;
 }
 
+UInt32 ItlIwn::
+supportedChecksums(bool isOutput)
+{
+    return 0;
+}
+
 const char *ItlIwn::
 getFirmwareCountryCode()
 {
@@ -2855,7 +2861,8 @@ iwn_clear_oactive(struct iwn_softc *sc, struct iwn_tx_ring *ring)
 
     if (ring->queued < IWN_TX_RING_LOMARK) {
         sc->qfullmsk &= ~(1 << ring->qid);
-        if (sc->qfullmsk == 0 && ifq_is_oactive(&ifp->if_snd)) {
+        if (sc->qfullmsk == 0 && (ifq_is_oactive(&ifp->if_snd) ||
+            ifq_take_deferred_start(&ifp->if_snd))) {
             ifq_clr_oactive(&ifp->if_snd);
             (*ifp->if_start)(ifp);
         }
@@ -2909,6 +2916,8 @@ iwn_tx_done(struct iwn_softc *sc, struct iwn_rx_desc *desc,
     if (txfail) {
         ifp->netStat->outputErrors++;
     }
+    if (data->ni == ic->ic_bss)
+        ieee80211_roam_txstatus(ic, 1, txfail);
 
     iwn_tx_done_free_txdata(sc, data);
 
@@ -3746,9 +3755,7 @@ iwn_tx(struct iwn_softc *sc, mbuf_t m, struct ieee80211_node *ni)
     /* Update TX scheduler. */
     ops->update_sched(sc, ring->qid, ring->cur, tx->id, totlen);
 
-    /* Kick TX ring. */
     ring->cur = (ring->cur + 1) % IWN_TX_RING_COUNT;
-    IWN_WRITE(sc, IWN_HBUS_TARG_WRPTR, ring->qid << 8 | ring->cur);
 
     /* Mark TX ring as full if we reach a certain threshold. */
     if (++ring->queued > IWN_TX_RING_HIMARK) {
@@ -3756,15 +3763,67 @@ iwn_tx(struct iwn_softc *sc, mbuf_t m, struct ieee80211_node *ni)
         sc->qfullmsk |= 1 << ring->qid;
     }
 
+    /* Kick TX ring. */
+    if (!iwn_tx_defer_kick(sc, qid))
+        IWN_WRITE(sc, IWN_HBUS_TARG_WRPTR, ring->qid << 8 | ring->cur);
+
+    return 0;
+}
+
+/*
+ * Frames for an aggregation queue are batched so that the firmware
+ * scheduler sees several subframes at once and can build larger A-MPDUs;
+ * iwn_start() kicks whatever is left. Returns non-zero if the kick of
+ * ring qid is deferred.
+ */
+int ItlIwn::
+iwn_tx_defer_kick(struct iwn_softc *sc, int qid)
+{
+    struct iwn_tx_ba *tba;
+
+    if (qid < sc->first_agg_txq)
+        return 0;
+    tba = &sc->sc_tx_ba[qid - sc->first_agg_txq];
+    if (!(sc->qfullmsk & (1 << qid)) && ++tba->nburst < IWN_AGG_BURST) {
+        sc->sc_tx_kickmsk |= 1 << qid;
+        return 1;
+    }
+    tba->nburst = 0;
+    sc->sc_tx_kickmsk &= ~(1 << qid);
     return 0;
 }
 
+/*
+ * Kick aggregation queues whose write pointer update was deferred by iwn_tx().
+ */
+void ItlIwn::
+iwn_tx_kick(struct iwn_softc *sc)
+{
+    struct iwn_tx_ring *ring;
+    int qid;
+
+    for (qid = sc->first_agg_txq; sc->sc_tx_kickmsk != 0 &&
+        qid < sc->ntxqs; qid++) {
+        if (!(sc->sc_tx_kickmsk & (1 << qid)))
+            continue;
+        ring = &sc->txq[qid];
+        IWN_WRITE(sc, IWN_HBUS_TARG_WRPTR, ring->qid << 8 | ring->cur);
+        sc->sc_tx_ba[qid - sc->first_agg_txq].nburst = 0;
+        sc->sc_tx_kickmsk &= ~(1 << qid);
+    }
+}
+
 void ItlIwn::
 iwn_start(struct _ifnet *ifp)
 {
     struct iwn_softc *sc = (struct iwn_softc*)ifp->if_softc;
     ItlIwn *that = container_of(sc, ItlIwn, com);
-    that->getMainCommandGate()->attemptAction(_iwn_start_task, &that->com.sc_ic.ic_ac.ac_if);
+    /*
+     * Never block the caller on the gate: if it is busy, the kick runs
+     * as soon as the gate is released, see deferStart().
+     */
+    if (that->getMainCommandGate()->attemptAction(_iwn_start_task, &that->com.sc_ic.ic_ac.ac_if) == kIOReturnCannotLock)
+        that->deferStart(ifp);
 }
 
 IOReturn ItlIwn::
@@ -3777,6 +3836,10 @@ _iwn_start_task(OSObject *target, void *arg0, void *arg1, void *arg2, void *arg3
     struct ieee80211_node *ni;
     mbuf_t m;
 
+    KASSERT(that->getMainWorkLoop()->inGate(), "start task outside the work loop gate");
+    /* This pass serves any kick a producer deferred to the gate holder. */
+    ifq_take_deferred_start(&ifp->if_snd);
+
     if (!(ifp->if_flags & IFF_RUNNING) || ifq_is_oactive(&ifp->if_snd))
         return kIOReturnError;
 
@@ -3825,6 +3888,8 @@ sendit:
         sc->sc_tx_timer = 5;
         ifp->if_timer = 1;
     }
+
+    that->iwn_tx_kick(sc);
     
     return kIOReturnSuccess;
 }
@@ -4793,9 +4858,38 @@ iwn5000_set_gains(struct iwn_softc *sc)
     return that->iwn_cmd(sc, IWN_CMD_PHY_CALIB, &cmd, sizeof cmd, 1);
 }
 
+/*
+ * Count consecutive beacon periods with too many (dir > 0) or too few
+ * (dir < 0) false alarms. Returns non-zero once thresholds should move.
+ */
+int ItlIwn::
+iwn_calib_trend(int *trend, int dir)
+{
+    if (dir == 0 || (dir > 0) != (*trend > 0))
+        *trend = 0;
+    *trend += dir;
+    if (*trend >= IWN_CALIB_HYST || *trend <= -IWN_CALIB_HYST) {
+        *trend = 0;
+        return 1;
+    }
+    return 0;
+}
+
+int ItlIwn::
+iwn_sensitivity_changed(struct iwn_calib_state *calib)
+{
+    return calib->ofdm_x1 != calib->sent_ofdm_x1 ||
+        calib->ofdm_mrc_x1 != calib->sent_ofdm_mrc_x1 ||
+        calib->ofdm_x4 != calib->sent_ofdm_x4 ||
+        calib->ofdm_mrc_x4 != calib->sent_ofdm_mrc_x4 ||
+        calib->cck_x4 != calib->sent_cck_x4 ||
+        calib->cck_mrc_x4 != calib->sent_cck_mrc_x4 ||
+        calib->energy_cck != calib->sent_energy_cck;
+}
+
 /*
  * Tune RF RX sensitivity based on the number of false alarms detected
- * during the last beacon period.
+ * during the last few beacon periods.
  */
 void ItlIwn::
 iwn_tune_sensitivity(struct iwn_softc *sc, const struct iwn_rx_stats *stats)
@@ -4819,40 +4913,77 @@ iwn_tune_sensitivity(struct iwn_softc *sc, const struct iwn_rx_stats *stats)
 
     const struct iwn_sensitivity_limits *limits = sc->limits;
     struct iwn_calib_state *calib = &sc->calib;
-    uint32_t val, rxena, fa;
+    uint32_t val, rxena;
+    uint64_t fa, fa_ofdm, fa_cck, rxsum;
     uint32_t energy[3], energy_min;
     uint8_t noise[3], noise_ref;
-    int i, needs_update = 0;
+    int i, w, needs_update = 0;
 
     /* Check that we've been enabled long enough. */
     if ((rxena = letoh32(stats->general.load)) == 0)
         return;
 
     /* Compute number of false alarms since last call for OFDM. */
-    fa  = letoh32(stats->ofdm.bad_plcp) - calib->bad_plcp_ofdm;
-    fa += letoh32(stats->ofdm.fa) - calib->fa_ofdm;
-    fa *= 200 * IEEE80211_DUR_TU;    /* 200TU */
+    fa_ofdm  = (uint32_t)(letoh32(stats->ofdm.bad_plcp) -
+        calib->bad_plcp_ofdm);
+    fa_ofdm += (uint32_t)(letoh32(stats->ofdm.fa) - calib->fa_ofdm);
+    fa_ofdm *= 200 * IEEE80211_DUR_TU;    /* 200TU */
 
     /* Save counters values for next call. */
     calib->bad_plcp_ofdm = letoh32(stats->ofdm.bad_plcp);
     calib->fa_ofdm = letoh32(stats->ofdm.fa);
 
-    if (fa > 50 * rxena) {
+    /* Compute number of false alarms since last call for CCK. */
+    fa_cck  = (uint32_t)(letoh32(stats->cck.bad_plcp) -
+        calib->bad_plcp_cck);
+    fa_cck += (uint32_t)(letoh32(stats->cck.fa) - calib->fa_cck);
+    fa_cck *= 200 * IEEE80211_DUR_TU;    /* 200TU */
+
+    /* Save counters values for next call. */
+    calib->bad_plcp_cck = letoh32(stats->cck.bad_plcp);
+    calib->fa_cck = letoh32(stats->cck.fa);
+
+    /*
+     * A single beacon period is too noisy a sample in a busy band and
+     * makes thresholds oscillate; judge the last IWN_CALIB_WINDOW ones.
+     */
+    w = calib->cur_win;
+    calib->fa_ofdm_win[w] = fa_ofdm;
+    calib->fa_cck_win[w] = fa_cck;
+    calib->rxena_win[w] = rxena;
+    calib->cur_win = (w + 1) % IWN_CALIB_WINDOW;
+    /* Scaled counts summed over the window overflow 32 bits. */
+    fa_ofdm = fa_cck = rxsum = 0;
+    for (i = 0; i < IWN_CALIB_WINDOW; i++) {
+        fa_ofdm += calib->fa_ofdm_win[i];
+        fa_cck += calib->fa_cck_win[i];
+        rxsum += calib->rxena_win[i];
+    }
+
+    fa = fa_ofdm;
+    if (fa > 50 * rxsum) {
         /* High false alarm count, decrease sensitivity. */
-        DPRINTFN(2, ("OFDM high false alarm count: %u\n", fa));
-        inc(calib->ofdm_x1,     1, limits->max_ofdm_x1);
-        inc(calib->ofdm_mrc_x1, 1, limits->max_ofdm_mrc_x1);
-        inc(calib->ofdm_x4,     1, limits->max_ofdm_x4);
-        inc(calib->ofdm_mrc_x4, 1, limits->max_ofdm_mrc_x4);
+        DPRINTFN(2, ("OFDM high false alarm count: %llu\n",
+            (unsigned long long)fa));
+        if (iwn_calib_trend(&calib->ofdm_trend, 1)) {
+            inc(calib->ofdm_x1,     1, limits->max_ofdm_x1);
+            inc(calib->ofdm_mrc_x1, 1, limits->max_ofdm_mrc_x1);
+            inc(calib->ofdm_x4,     1, limits->max_ofdm_x4);
+            inc(calib->ofdm_mrc_x4, 1, limits->max_ofdm_mrc_x4);
+        }
 
-    } else if (fa < 5 * rxena) {
+    } else if (fa < 5 * rxsum) {
         /* Low false alarm count, increase sensitivity. */
-        DPRINTFN(2, ("OFDM low false alarm count: %u\n", fa));
-        dec(calib->ofdm_x1,     1, limits->min_ofdm_x1);
-        dec(calib->ofdm_mrc_x1, 1, limits->min_ofdm_mrc_x1);
-        dec(calib->ofdm_x4,     1, limits->min_ofdm_x4);
-        dec(calib->ofdm_mrc_x4, 1, limits->min_ofdm_mrc_x4);
-    }
+        DPRINTFN(2, ("OFDM low false alarm count: %llu\n",
+            (unsigned long long)fa));
+        if (iwn_calib_trend(&calib->ofdm_trend, -1)) {
+            dec(calib->ofdm_x1,     1, limits->min_ofdm_x1);
+            dec(calib->ofdm_mrc_x1, 1, limits->min_ofdm_mrc_x1);
+            dec(calib->ofdm_x4,     1, limits->min_ofdm_x4);
+            dec(calib->ofdm_mrc_x4, 1, limits->min_ofdm_mrc_x4);
+        }
+    } else
+        (void)iwn_calib_trend(&calib->ofdm_trend, 0);
 
     /* Compute maximum noise among 3 receivers. */
     for (i = 0; i < 3; i++)
@@ -4883,50 +5014,49 @@ iwn_tune_sensitivity(struct iwn_softc *sc, const struct iwn_rx_stats *stats)
         energy_min = MAX(energy_min, calib->energy_samples[i]);
     energy_min += 6;
 
-    /* Compute number of false alarms since last call for CCK. */
-    fa  = letoh32(stats->cck.bad_plcp) - calib->bad_plcp_cck;
-    fa += letoh32(stats->cck.fa) - calib->fa_cck;
-    fa *= 200 * IEEE80211_DUR_TU;    /* 200TU */
-
-    /* Save counters values for next call. */
-    calib->bad_plcp_cck = letoh32(stats->cck.bad_plcp);
-    calib->fa_cck = letoh32(stats->cck.fa);
-
-    if (fa > 50 * rxena) {
+    fa = fa_cck;
+    if (fa > 50 * rxsum) {
         /* High false alarm count, decrease sensitivity. */
-        DPRINTFN(2, ("CCK high false alarm count: %u\n", fa));
+        DPRINTFN(2, ("CCK high false alarm count: %llu\n",
+            (unsigned long long)fa));
         calib->cck_state = IWN_CCK_STATE_HIFA;
         calib->low_fa = 0;
 
-        if (calib->cck_x4 > 160) {
-            calib->noise_ref = noise_ref;
-            if (calib->energy_cck > 2)
-                dec(calib->energy_cck, 2, energy_min);
-        }
-        if (calib->cck_x4 < 160) {
-            calib->cck_x4 = 161;
-            needs_update = 1;
-        } else
-            inc(calib->cck_x4, 3, limits->max_cck_x4);
+        if (iwn_calib_trend(&calib->cck_trend, 1)) {
+            if (calib->cck_x4 > 160) {
+                calib->noise_ref = noise_ref;
+                if (calib->energy_cck > 2)
+                    dec(calib->energy_cck, 2, energy_min);
+            }
+            if (calib->cck_x4 < 160) {
+                calib->cck_x4 = 161;
+                needs_update = 1;
+            } else
+                inc(calib->cck_x4, 3, limits->max_cck_x4);
 
-        inc(calib->cck_mrc_x4, 3, limits->max_cck_mrc_x4);
+            inc(calib->cck_mrc_x4, 3, limits->max_cck_mrc_x4);
+        }
 
-    } else if (fa < 5 * rxena) {
+    } else if (fa < 5 * rxsum) {
         /* Low false alarm count, increase sensitivity. */
-        DPRINTFN(2, ("CCK low false alarm count: %u\n", fa));
+        DPRINTFN(2, ("CCK low false alarm count: %llu\n",
+            (unsigned long long)fa));
         calib->cck_state = IWN_CCK_STATE_LOFA;
         calib->low_fa++;
 
         if (calib->cck_state != IWN_CCK_STATE_INIT &&
             (((int32_t)calib->noise_ref - (int32_t)noise_ref) > 2 ||
-             calib->low_fa > 100)) {
+             calib->low_fa > 100) &&
+            iwn_calib_trend(&calib->cck_trend, -1)) {
             inc(calib->energy_cck, 2, limits->min_energy_cck);
             dec(calib->cck_x4,     3, limits->min_cck_x4);
             dec(calib->cck_mrc_x4, 3, limits->min_cck_mrc_x4);
         }
     } else {
         /* Not worth to increase or decrease sensitivity. */
-        DPRINTFN(2, ("CCK normal false alarm count: %u\n", fa));
+        DPRINTFN(2, ("CCK normal false alarm count: %llu\n",
+            (unsigned long long)fa));
+        (void)iwn_calib_trend(&calib->cck_trend, 0);
         calib->low_fa = 0;
         calib->noise_ref = noise_ref;
 
@@ -4937,8 +5067,11 @@ iwn_tune_sensitivity(struct iwn_softc *sc, const struct iwn_rx_stats *stats)
         calib->cck_state = IWN_CCK_STATE_INIT;
     }
 
-    if (needs_update)
+    /* Steps in opposite directions may cancel out; skip the command then. */
+    if (needs_update && iwn_sensitivity_changed(calib))
         (void)iwn_send_sensitivity(sc);
+    else if (needs_update)
+        calib->nskipped++;
 #undef dec
 #undef inc
 }
@@ -4948,7 +5081,7 @@ iwn_send_sensitivity(struct iwn_softc *sc)
 {
     struct iwn_calib_state *calib = &sc->calib;
     struct iwn_enhanced_sensitivity_cmd cmd;
-    int len;
+    int len, error;
 
     memset(&cmd, 0, sizeof cmd);
     len = sizeof (struct iwn_sensitivity_cmd);
@@ -4980,7 +5113,21 @@ iwn_send_sensitivity(struct iwn_softc *sc)
     cmd.cck_det_slope      = htole16(476);
     cmd.cck_det_icept      = htole16(99);
 send:
-    return iwn_cmd(sc, IWN_CMD_SET_SENSITIVITY, &cmd, len, 1);
+    if ((error = iwn_cmd(sc, IWN_CMD_SET_SENSITIVITY, &cmd, len, 1)) != 0)
+        return error;
+
+    calib->sent_ofdm_x1     = calib->ofdm_x1;
+    calib->sent_ofdm_mrc_x1 = calib->ofdm_mrc_x1;
+    calib->sent_ofdm_x4     = calib->ofdm_x4;
+    calib->sent_ofdm_mrc_x4 = calib->ofdm_mrc_x4;
+    calib->sent_cck_x4      = calib->cck_x4;
+    calib->sent_cck_mrc_x4  = calib->cck_mrc_x4;
+    calib->sent_energy_cck  = calib->energy_cck;
+    calib->nupdates++;
+    DPRINTFN(2, ("sensitivity update %u (%u skipped): ofdm_x1=%u cck_x4=%u "
+        "energy_cck=%u\n", calib->nupdates, calib->nskipped,
+        calib->ofdm_x1, calib->cck_x4, calib->energy_cck));
+    return 0;
 }
 
 /*
@@ -5530,6 +5677,8 @@ iwn_scan(struct iwn_softc *sc, uint16_t flags, int bgscan)
          c <= &ic->ic_channels[IEEE80211_CHAN_MAX]; c++) {
         if ((c->ic_flags & flags) != flags)
             continue;
+        if (bgscan && ieee80211_chanhist_skip(ic, c))
+            continue;
 
         chan->chan = htole16(ieee80211_chan2ieee(ic, c));
         DPRINTFN(2, ("adding channel %d\n", chan->chan));
@@ -5547,6 +5696,9 @@ iwn_scan(struct iwn_softc *sc, uint16_t flags, int bgscan)
          */
 
         dwell_active = iwn_get_active_dwell_time(sc, flags, is_active);
+        /* Spend more time on channels where many APs answer. */
+        dwell_active = ieee80211_scan_dwell(ic, c, dwell_active,
+            dwell_active / 2, dwell_active * 2);
         dwell_passive = iwn_get_passive_dwell_time(sc, flags);
 
         /* Make sure they're valid */
@@ -5566,6 +5718,12 @@ iwn_scan(struct iwn_softc *sc, uint16_t flags, int bgscan)
         chan++;
     }
 
+    /* A partial background scan may leave nothing to do on this band. */
+    if (bgscan && hdr->nchan == 0) {
+        ::free(buf);
+        return ENOENT;
+    }
+
     buflen = (uint8_t *)chan - buf;
     hdr->len = htole16(buflen);
 
@@ -5611,6 +5769,8 @@ iwn_bgscan(struct ieee80211com *ic)
         return 0;
 
     error = that->iwn_scan(sc, IEEE80211_CHAN_2GHZ, 1);
+    if (error == ENOENT && (sc->sc_flags & IWN_FLAG_HAS_5GHZ))
+        error = that->iwn_scan(sc, IEEE80211_CHAN_5GHZ, 1);
     if (error)
         XYLog("%s: could not initiate background scan\n",
             sc->sc_dev.dv_xname);
@@ -6163,6 +6323,7 @@ iwn_ampdu_tx_start(struct ieee80211com *ic, struct ieee80211_node *ni,
     iwn_nic_unlock(sc);
 
     sc->agg_queue_mask |= (1 << qid);
+    memset(&sc->sc_tx_ba[tid], 0, sizeof(sc->sc_tx_ba[tid]));
     sc->sc_tx_ba[tid].wn = wn;
     ba->ba_bitmap = 0;
 
@@ -6191,6 +6352,7 @@ iwn_ampdu_tx_stop(struct ieee80211com *ic, struct ieee80211_node *ni,
     iwn_nic_unlock(sc);
 
     sc->agg_queue_mask &= ~(1 << qid);
+    sc->sc_tx_kickmsk &= ~(1 << qid);
     sc->sc_tx_ba[tid].wn = NULL;
     ba->ba_bitmap = 0;
 
@@ -7422,6 +7584,7 @@ iwn_init(struct _ifnet *ifp)
     memset(sc->bss_node_addr, 0, sizeof(sc->bss_node_addr));
     sc->agg_queue_mask = 0;
     memset(sc->sc_tx_ba, 0, sizeof(sc->sc_tx_ba));
+    sc->sc_tx_kickmsk = 0;
 
     if ((error = iwn_hw_prepare(sc)) != 0) {
         XYLog("%s: hardware not ready\n", sc->sc_dev.dv_xname);
@@ -103,6 +103,8 @@ public:
     
     virtual UInt32 supportedFeatures() override;
 
+    virtual UInt32 supportedChecksums(bool isOutput) override;
+
     virtual const char *getFirmwareCountryCode() override;
     
     virtual uint32_t getTxQueueSize() override;
@@ -207,6 +209,8 @@ public:
     static void        iwn5000_reset_sched(struct iwn_softc *, int, int);
     int        iwn_tx(struct iwn_softc *, mbuf_t,
                 struct ieee80211_node *);
+    int        iwn_tx_defer_kick(struct iwn_softc *, int);
+    void        iwn_tx_kick(struct iwn_softc *);
     int        iwn_rval2ridx(int);
     static void        iwn_start(struct _ifnet *);
     static void        iwn_watchdog(struct _ifnet *);
@@ -240,6 +244,8 @@ public:
     static int        iwn5000_set_gains(struct iwn_softc *);
     void        iwn_tune_sensitivity(struct iwn_softc *,
                 const struct iwn_rx_stats *);
+    int        iwn_calib_trend(int *, int);
+    int        iwn_sensitivity_changed(struct iwn_calib_state *);
     int        iwn_send_sensitivity(struct iwn_softc *);
     int        iwn_set_pslevel(struct iwn_softc *, int, int, int);
     int        iwn_send_temperature_offset(struct iwn_softc *);
@@ -163,6 +163,31 @@ struct iwn_calib_state {
     uint32_t    energy_samples[10];
     u_int        cur_energy_sample;
     uint32_t    energy_cck;
+
+    /*
+     * False alarm counts of the last beacon periods. Thresholds are only
+     * moved after the windowed count has been too high or too low for
+     * IWN_CALIB_HYST periods in a row.
+     */
+#define IWN_CALIB_WINDOW    4
+#define IWN_CALIB_HYST        2
+    uint64_t    fa_ofdm_win[IWN_CALIB_WINDOW];
+    uint64_t    fa_cck_win[IWN_CALIB_WINDOW];
+    uint32_t    rxena_win[IWN_CALIB_WINDOW];
+    u_int        cur_win;
+    int        ofdm_trend;
+    int        cck_trend;
+
+    /* Thresholds last sent to the firmware. */
+    uint32_t    sent_ofdm_x1;
+    uint32_t    sent_ofdm_mrc_x1;
+    uint32_t    sent_ofdm_x4;
+    uint32_t    sent_ofdm_mrc_x4;
+    uint32_t    sent_cck_x4;
+    uint32_t    sent_cck_mrc_x4;
+    uint32_t    sent_energy_cck;
+    u_int        nupdates;
+    u_int        nskipped;
 };
 
 struct iwn_calib_info {
@@ -209,8 +234,12 @@ struct iwn_ops {
                 uint16_t);
 };
 
+/* Aggregation queue frames to batch before kicking the TX ring. */
+#define IWN_AGG_BURST    8
+
 struct iwn_tx_ba {
     struct iwn_node *    wn;
+    int            nburst;    /* frames queued since last ring kick */
 };
 
 struct iwn_softc {
@@ -342,6 +371,7 @@ struct iwn_softc {
     int            sc_tx_timer;
 
     struct iwn_tx_ba    sc_tx_ba[IEEE80211_NUM_TID];
+    uint32_t        sc_tx_kickmsk;    /* rings with a deferred kick */
 
 #if NBPFILTER > 0
     caddr_t            sc_drvbpf;
@@ -116,6 +116,12 @@
 #include <IOKit/IOCommandGate.h>
 #include <IOKit/network/IONetworkMedium.h>
 #include <net/ethernet.h>
+#include <net/if_llc.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
 
 #include <sys/_task.h>
 #include <sys/pcireg.h>
@@ -157,9 +163,46 @@ detach(IOPCIDevice *device)
     struct _ifnet *ifp = &com.sc_ic.ic_ac.ac_if;
     struct iwx_softc *sc = &com;
     
+    for (int qid = 1; qid < IWX_MAX_RX_QUEUES; qid++) {
+        struct iwx_rx_ring *ring = &sc->rxq[qid];
+        
+        if (sc->sc_rxq_ih[qid] != NULL) {
+            sc->sc_rxq_ih[qid]->disable();
+            sc->sc_rxq_wl[qid]->removeEventSource(sc->sc_rxq_ih[qid]);
+            sc->sc_rxq_ih[qid]->release();
+            sc->sc_rxq_ih[qid] = NULL;
+        }
+        if (sc->sc_rxq_wl[qid] != NULL) {
+            sc->sc_rxq_wl[qid]->release();
+            sc->sc_rxq_wl[qid] = NULL;
+        }
+        if (ring->pending_lock != NULL) {
+            ml_purge(&ring->pending);
+            IOSimpleLockFree(ring->pending_lock);
+            ring->pending_lock = NULL;
+        }
+    }
+    if (sc->sc_rxq_deliver != NULL) {
+        sc->sc_rxq_deliver->disable();
+        pci.workloop->removeEventSource(sc->sc_rxq_deliver);
+        sc->sc_rxq_deliver->release();
+        sc->sc_rxq_deliver = NULL;
+    }
+    if (sc->sc_fw_fault_to != NULL) {
+        timeout_del(&sc->sc_fw_fault_to);
+        timeout_free(&sc->sc_fw_fault_to);
+    }
     for (int txq_i = 0; txq_i < nitems(sc->txq); txq_i++)
         iwx_free_tx_ring(sc, &sc->txq[txq_i]);
-    iwx_free_rx_ring(sc, &sc->rxq);
+    for (int qid = 0; qid < sc->sc_num_rx_queues; qid++)
+        iwx_free_rx_ring(sc, &sc->rxq[qid]);
+    for (int i = 0; i < nitems(sc->sc_rxba_data); i++) {
+        struct iwx_rxba_data *rxba = &sc->sc_rxba_data[i];
+        if (rxba->rss_entries != NULL) {
+            ::free(rxba->rss_entries);
+            rxba->rss_entries = NULL;
+        }
+    }
     iwx_dma_contig_free(&sc->ict_dma);
     iwx_dma_contig_free(&com.ctxt_info_dma);
     ieee80211_ifdetach(ifp);
@@ -294,6 +337,31 @@ supportedFeatures()
     return kIONetworkFeatureMultiPages;
 }
 
+UInt32 ItlIwx::
+supportedChecksums(bool isOutput)
+{
+    /*
+     * The stack may ask before firmware is loaded and sc_enabled_capa is
+     * known, and caches the answer. All 22000 and later firmware offloads
+     * checksums; iwx_tx_csum() falls back to software if one does not.
+     */
+    if (com.sc_device_family < IWX_DEVICE_FAMILY_22000)
+        return 0;
+    /* The IPv4 header checksum is only offloaded inside A-MSDUs. */
+    if (isOutput)
+        return IONetworkController::kChecksumTCP |
+            IONetworkController::kChecksumUDP |
+            IONetworkController::kChecksumTCPIPv6 |
+            IONetworkController::kChecksumUDPIPv6;
+    if (com.sc_device_family >= IWX_DEVICE_FAMILY_AX210)
+        return 0;
+    return IONetworkController::kChecksumIP |
+        IONetworkController::kChecksumTCP |
+        IONetworkController::kChecksumUDP |
+        IONetworkController::kChecksumTCPIPv6 |
+        IONetworkController::kChecksumUDPIPv6;
+}
+
 const char *ItlIwx::
 getFirmwareCountryCode()
 {
@@ -1055,9 +1123,9 @@ iwx_ctxt_info_init(struct iwx_softc *sc, const struct iwx_fw_sects *fws)
     
     /* initialize RX default queue */
     rx_cfg = &ctxt_info->rbd_cfg;
-    rx_cfg->free_rbd_addr = htole64(sc->rxq.free_desc_dma.paddr);
-    rx_cfg->used_rbd_addr = htole64(sc->rxq.used_desc_dma.paddr);
-    rx_cfg->status_wr_ptr = htole64(sc->rxq.stat_dma.paddr);
+    rx_cfg->free_rbd_addr = htole64(sc->rxq[0].free_desc_dma.paddr);
+    rx_cfg->used_rbd_addr = htole64(sc->rxq[0].used_desc_dma.paddr);
+    rx_cfg->status_wr_ptr = htole64(sc->rxq[0].stat_dma.paddr);
     
     /* initialize TX command queue */
     ctxt_info->hcmd_cfg.cmd_queue_addr =
@@ -1135,7 +1203,7 @@ iwx_ctxt_info_gen3_init(struct iwx_softc *sc, const struct iwx_fw_sects *fws)
     
     /* initialize RX default queue */
     prph_sc_ctrl->rbd_cfg.free_rbd_addr =
-        htole64(sc->rxq.free_desc_dma.paddr);
+        htole64(sc->rxq[0].free_desc_dma.paddr);
     
     prph_sc_ctrl->control.control_flags = htole32(control_flags);
     
@@ -1163,7 +1231,7 @@ iwx_ctxt_info_gen3_init(struct iwx_softc *sc, const struct iwx_fw_sects *fws)
     ctxt_info_gen3->prph_scratch_size =
         htole32(sizeof(*prph_scratch));
     ctxt_info_gen3->cr_head_idx_arr_base_addr =
-        htole64(sc->rxq.stat_dma.paddr);
+        htole64(sc->rxq[0].stat_dma.paddr);
     ctxt_info_gen3->tr_tail_idx_arr_base_addr =
         htole64((uint8_t *)sc->prph_info_dma.paddr + PAGE_SIZE / 2);
     ctxt_info_gen3->cr_tail_idx_arr_base_addr =
@@ -1171,7 +1239,7 @@ iwx_ctxt_info_gen3_init(struct iwx_softc *sc, const struct iwx_fw_sects *fws)
     ctxt_info_gen3->mtr_base_addr =
         htole64(sc->txq[IWX_DQA_CMD_QUEUE].desc_dma.paddr);
     ctxt_info_gen3->mcr_base_addr =
-        htole64(sc->rxq.used_desc_dma.paddr);
+        htole64(sc->rxq[0].used_desc_dma.paddr);
     ctxt_info_gen3->mtr_size =
         htole16(IWX_TFD_QUEUE_CB_SIZE(IWX_CMD_QUEUE_SIZE_GEN3));
     ctxt_info_gen3->mcr_size =
@@ -2411,13 +2479,14 @@ struct iwx_rx_transfer_desc {
 } __packed;
 
 int ItlIwx::
-iwx_alloc_rx_ring(struct iwx_softc *sc, struct iwx_rx_ring *ring)
+iwx_alloc_rx_ring(struct iwx_softc *sc, struct iwx_rx_ring *ring, int qid)
 {
     bus_size_t size;
     int i, err;
     int rb_stts_size = sc->sc_device_family >= IWX_DEVICE_FAMILY_AX210 ? sizeof(uint16_t) : sizeof(iwx_rb_status);
     int rb_stts_align = sc->sc_device_family >= IWX_DEVICE_FAMILY_AX210 ? 0 : 16;
     
+    ring->qid = qid;
     ring->cur = 0;
     
     /* Allocate RX descriptors (256-byte aligned). */
@@ -2430,13 +2499,23 @@ iwx_alloc_rx_ring(struct iwx_softc *sc, struct iwx_rx_ring *ring)
     }
     ring->desc = ring->free_desc_dma.vaddr;
     
-    /* Allocate RX status area (16-byte aligned). */
-    err = iwx_dma_contig_alloc(sc->sc_dmat, &ring->stat_dma,
-                               rb_stts_size, rb_stts_align);
-    if (err) {
-        XYLog("%s: could not allocate RX status DMA memory\n",
-              DEVNAME(sc));
-        goto fail;
+    /*
+     * Allocate RX status area (16-byte aligned). The status areas of all
+     * queues are kept in one array owned by the default queue since AX210
+     * firmware only takes the base address of that array.
+     */
+    if (qid == 0) {
+        err = iwx_dma_contig_alloc(sc->sc_dmat, &ring->stat_dma,
+                                   rb_stts_size * IWX_MAX_RX_QUEUES, rb_stts_align);
+        if (err) {
+            XYLog("%s: could not allocate RX status DMA memory\n",
+                  DEVNAME(sc));
+            goto fail;
+        }
+    } else {
+        ring->stat_dma.paddr = sc->rxq[0].stat_dma.paddr + qid * rb_stts_size;
+        ring->stat_dma.vaddr = (uint8_t *)sc->rxq[0].stat_dma.vaddr + qid * rb_stts_size;
+        ring->stat_dma.size = rb_stts_size;
     }
     ring->stat = ring->stat_dma.vaddr;
     
@@ -2462,7 +2541,7 @@ iwx_alloc_rx_ring(struct iwx_softc *sc, struct iwx_rx_ring *ring)
             goto fail;
         }
         
-        err = iwx_rx_addbuf(sc, IWX_RBUF_SIZE, i);
+        err = iwx_rx_addbuf(sc, ring, IWX_RBUF_SIZE, i);
         if (err)
             goto fail;
     }
@@ -2558,6 +2637,8 @@ iwx_tx_ring_init(struct iwx_softc *sc, struct iwx_tx_ring *ring, int size)
     ring->queued = 0;
     ring->cur = 0;
     ring->tail = 0;
+
+    ItlTxLimit::init(&ring->lim);
 }
 
 int ItlIwx::
@@ -2680,6 +2761,7 @@ iwx_reset_tx_ring(struct iwx_softc *sc, struct iwx_tx_ring *ring)
     ring->queued = 0;
     ring->cur = 0;
     ring->tail = 0;
+    ItlTxLimit::reset(&ring->lim);
 }
 
 void ItlIwx::
@@ -3035,6 +3117,8 @@ void ItlIwx::
 iwx_conf_msix_hw(struct iwx_softc *sc, int stopped)
 {
     int vector = 0;
+    uint32_t rx_causes;
+    int qid;
     
     if (!sc->sc_msix) {
         /* Newer chips default to MSIX. */
@@ -3058,13 +3142,23 @@ iwx_conf_msix_hw(struct iwx_softc *sc, int stopped)
     /* Map fallback-queue (command/mgmt) to a single vector */
     IWX_WRITE_1(sc, IWX_CSR_MSIX_RX_IVAR(0),
                 vector | IWX_MSIX_NON_AUTO_CLEAR_CAUSE);
-    /* Map RSS queue (data) to the same vector */
-    IWX_WRITE_1(sc, IWX_CSR_MSIX_RX_IVAR(1),
-                vector | IWX_MSIX_NON_AUTO_CLEAR_CAUSE);
+    rx_causes = IWX_MSIX_FH_INT_CAUSES_Q0;
+    if (sc->sc_num_rx_queues > 1) {
+        /* Map each RSS queue (data) to a vector of its own */
+        for (qid = 1; qid < sc->sc_num_rx_queues; qid++) {
+            IWX_WRITE_1(sc, IWX_CSR_MSIX_RX_IVAR(qid),
+                        qid | IWX_MSIX_AUTO_CLEAR_CAUSE);
+            rx_causes |= IWX_MSIX_FH_INT_CAUSES_Q(qid);
+        }
+    } else {
+        /* Map RSS queue (data) to the same vector */
+        IWX_WRITE_1(sc, IWX_CSR_MSIX_RX_IVAR(1),
+                    vector | IWX_MSIX_NON_AUTO_CLEAR_CAUSE);
+        rx_causes |= IWX_MSIX_FH_INT_CAUSES_Q1;
+    }
     
     /* Enable the RX queues cause interrupts */
-    IWX_CLRBITS(sc, IWX_CSR_MSIX_FH_INT_MASK_AD,
-                IWX_MSIX_FH_INT_CAUSES_Q0 | IWX_MSIX_FH_INT_CAUSES_Q1);
+    IWX_CLRBITS(sc, IWX_CSR_MSIX_FH_INT_MASK_AD, rx_causes);
     
     /* Map non-RX causes to the same vector */
     IWX_WRITE_1(sc, IWX_CSR_MSIX_IVAR(IWX_MSIX_IVAR_CAUSE_D2S_CH0_NUM),
@@ -3176,7 +3270,25 @@ iwx_stop_device(struct iwx_softc *sc)
     sc->sc_flags &= ~IWX_FLAG_USE_ICT;
     
     iwx_disable_rx_dma(sc);
-    iwx_reset_rx_ring(sc, &sc->rxq);
+    /*
+     * Wait for the RSS queue work loops to leave their rings, then drop
+     * the buffers they handed over and that were not processed yet.
+     */
+    for (qid = 1; qid < sc->sc_num_rx_queues; qid++) {
+        struct iwx_rx_ring *ring = &sc->rxq[qid];
+        struct mbuf_list ml;
+        
+        sc->sc_rxq_wl[qid]->closeGate();
+        sc->sc_rxq_wl[qid]->openGate();
+        IOSimpleLockLock(ring->pending_lock);
+        ml = ring->pending;
+        ml_init(&ring->pending);
+        ring->pending_errs = 0;
+        IOSimpleLockUnlock(ring->pending_lock);
+        ml_purge(&ml);
+    }
+    for (qid = 0; qid < sc->sc_num_rx_queues; qid++)
+        iwx_reset_rx_ring(sc, &sc->rxq[qid]);
     for (qid = 0; qid < nitems(sc->txq); qid++)
         iwx_reset_tx_ring(sc, &sc->txq[qid]);
     
@@ -3858,27 +3970,28 @@ iwx_init_reorder_buffer(struct iwx_reorder_buffer *reorder_buf,
 void ItlIwx::
 iwx_clear_reorder_buffer(struct iwx_softc *sc, struct iwx_rxba_data *rxba)
 {
-    int i;
-    struct iwx_reorder_buffer *reorder_buf = &rxba->reorder_buf;
+    int i, qid;
+    struct iwx_reorder_buffer *reorder_buf;
     struct iwx_reorder_buf_entry *entry;
     
-    for (i = 0; i < reorder_buf->buf_size; i++) {
-        entry = &rxba->entries[i];
-        ml_purge(&entry->frames);
-        timerclear(&entry->reorder_time);
+    for (qid = 0; qid < sc->sc_num_rx_queues; qid++) {
+        reorder_buf = &rxba->reorder_buf[qid];
+        for (i = 0; i < reorder_buf->buf_size; i++) {
+            entry = &reorder_buf->entries[i];
+            ml_purge(&entry->frames);
+            timerclear(&entry->reorder_time);
+        }
+        
+        reorder_buf->removed = 1;
+        timeout_del(&reorder_buf->reorder_timer);
+        timeout_free(&reorder_buf->reorder_timer);
     }
-    
-    reorder_buf->removed = 1;
-    timeout_del(&reorder_buf->reorder_timer);
-    timeout_free(&reorder_buf->reorder_timer);
     timerclear(&rxba->last_rx);
     timeout_del(&rxba->session_timer);
     timeout_free(&rxba->session_timer);
     rxba->baid = IWX_RX_REORDER_DATA_INVALID_BAID;
 }
 
-#define RX_REORDER_BUF_TIMEOUT_MQ_USEC (100000ULL)
-
 void ItlIwx::
 iwx_rx_ba_session_expired(void *arg)
 {
@@ -3911,65 +4024,7 @@ iwx_rx_ba_session_expired(void *arg)
 void ItlIwx::
 iwx_reorder_timer_expired(void *arg)
 {
-    XYLog("%s\n", __FUNCTION__);
-    struct mbuf_list ml = MBUF_LIST_INITIALIZER();
-    struct iwx_reorder_buffer *buf = (struct iwx_reorder_buffer *)arg;
-    struct iwx_rxba_data *rxba = iwx_rxba_data_from_reorder_buf(buf);
-    struct iwx_reorder_buf_entry *entries = &rxba->entries[0];
-    struct iwx_softc *sc = rxba->sc;
-    ItlIwx *that = container_of(sc, ItlIwx, com);
-    struct ieee80211com *ic = &sc->sc_ic;
-    struct ieee80211_node *ni = ic->ic_bss;
-    int i, s;
-    uint16_t sn = 0, index = 0;
-    int expired = 0;
-    int cont = 0;
-    struct timeval now, timeout, expiry;
-    
-    if (!buf->num_stored || buf->removed)
-        return;
-    
-    s = splnet();
-    getmicrouptime(&now);
-    USEC_TO_TIMEVAL(RX_REORDER_BUF_TIMEOUT_MQ_USEC, &timeout);
-    
-    for (i = 0; i < buf->buf_size ; i++) {
-        index = (buf->head_sn + i) % buf->buf_size;
-        
-        if (ml_empty(&entries[index].frames)) {
-            /*
-             * If there is a hole and the next frame didn't expire
-             * we want to break and not advance SN.
-             */
-            cont = 0;
-            continue;
-        }
-        timeradd(&entries[index].reorder_time, &timeout, &expiry);
-        if (!cont && timercmp(&now, &expiry, <))
-            break;
-        
-        expired = 1;
-        /* continue until next hole after this expired frame */
-        cont = 1;
-        sn = (buf->head_sn + (i + 1)) & 0xfff;
-    }
-    
-    if (expired) {
-        /* SN is set to the last expired frame + 1 */
-        that->iwx_release_frames(sc, ni, rxba, buf, sn, &ml);
-        if_input(&sc->sc_ic.ic_if, &ml);
-        ic->ic_stats.is_ht_rx_ba_window_gap_timeout++;
-    } else {
-        /*
-         * If no frame expired and there are stored frames, index is now
-         * pointing to the first unexpired frame - modify reorder timeout
-         * accordingly.
-         */
-        timeout_add_usec(&buf->reorder_timer,
-                         RX_REORDER_BUF_TIMEOUT_MQ_USEC);
-    }
-    
-    splx(s);
+    ItlIwxReorder::reorder_timer_expired(arg);
 }
 
 static inline uint8_t iwx_num_of_ant(uint8_t mask)
@@ -4151,11 +4206,12 @@ iwx_sta_rx_agg(struct iwx_softc *sc, struct ieee80211_node *ni, uint8_t tid,
     uint32_t status;
     struct iwx_rxba_data *rxba = NULL;
     uint8_t baid = 0;
+    int qid;
     
     s = splnet();
     
     if (start && sc->sc_rx_ba_sessions >= IWX_MAX_RX_BA_SESSIONS) {
-        ieee80211_addba_req_refuse(ic, ni, tid);
+        iwx_rx_agg_refuse(sc, ni, tid);
         splx(s);
         return;
     }
@@ -4183,7 +4239,7 @@ iwx_sta_rx_agg(struct iwx_softc *sc, struct ieee80211_node *ni, uint8_t tid,
     
     if (err || (status & IWX_ADD_STA_STATUS_MASK) != IWX_ADD_STA_SUCCESS) {
         if (start)
-            ieee80211_addba_req_refuse(ic, ni, tid);
+            iwx_rx_agg_refuse(sc, ni, tid);
         splx(s);
         return;
     }
@@ -4191,7 +4247,7 @@ iwx_sta_rx_agg(struct iwx_softc *sc, struct ieee80211_node *ni, uint8_t tid,
     /* Deaggregation is done in hardware. */
     if (start) {
         if (!(status & IWX_ADD_STA_BAID_VALID_MASK)) {
-            ieee80211_addba_req_refuse(ic, ni, tid);
+            iwx_rx_agg_refuse(sc, ni, tid);
             splx(s);
             return;
         }
@@ -4199,13 +4255,13 @@ iwx_sta_rx_agg(struct iwx_softc *sc, struct ieee80211_node *ni, uint8_t tid,
         IWX_ADD_STA_BAID_SHIFT;
         if (baid == IWX_RX_REORDER_DATA_INVALID_BAID ||
             baid >= nitems(sc->sc_rxba_data)) {
-            ieee80211_addba_req_refuse(ic, ni, tid);
+            iwx_rx_agg_refuse(sc, ni, tid);
             splx(s);
             return;
         }
         rxba = &sc->sc_rxba_data[baid];
         if (rxba->baid != IWX_RX_REORDER_DATA_INVALID_BAID) {
-            ieee80211_addba_req_refuse(ic, ni, tid);
+            iwx_rx_agg_refuse(sc, ni, tid);
             splx(s);
             return;
         }
@@ -4214,8 +4270,9 @@ iwx_sta_rx_agg(struct iwx_softc *sc, struct ieee80211_node *ni, uint8_t tid,
         rxba->baid = baid;
         rxba->timeout = timeout_val;
         getmicrouptime(&rxba->last_rx);
-        iwx_init_reorder_buffer(&rxba->reorder_buf, ssn,
-                                winsize);
+        for (qid = 0; qid < sc->sc_num_rx_queues; qid++)
+            iwx_init_reorder_buffer(&rxba->reorder_buf[qid], ssn,
+                                    winsize);
         if (timeout_val != 0) {
             struct ieee80211_rx_ba *ba;
             timeout_add_usec(&rxba->session_timer,
@@ -4240,13 +4297,32 @@ iwx_sta_rx_agg(struct iwx_softc *sc, struct ieee80211_node *ni, uint8_t tid,
     
     if (start) {
         sc->sc_rx_ba_sessions++;
-        ieee80211_addba_req_accept(ic, ni, tid);
+        /* A replayed session is already agreed with the AP. */
+        if (!(sc->sc_flags & IWX_FLAG_FW_RESTART))
+            ieee80211_addba_req_accept(ic, ni, tid);
     } else if (sc->sc_rx_ba_sessions > 0)
         sc->sc_rx_ba_sessions--;
 
     splx(s);
 }
 
+/*
+ * Refuse an ADDBA request. A session replayed after a firmware restart
+ * has already been agreed, so tear it down instead and let the AP set
+ * up a new one.
+ */
+void ItlIwx::
+iwx_rx_agg_refuse(struct iwx_softc *sc, struct ieee80211_node *ni, uint8_t tid)
+{
+    struct ieee80211com *ic = &sc->sc_ic;
+    
+    if (sc->sc_flags & IWX_FLAG_FW_RESTART)
+        ieee80211_delba_request(ic, ni, IEEE80211_REASON_UNSPECIFIED, 0,
+                                tid);
+    else
+        ieee80211_addba_req_refuse(ic, ni, tid);
+}
+
 void ItlIwx::
 iwx_mac_ctxt_task(void *arg)
 {
@@ -4795,6 +4871,66 @@ iwx_send_dqa_cmd(struct iwx_softc *sc)
     return iwx_send_cmd_pdu(sc, cmd_id, 0, sizeof(dqa_cmd), &dqa_cmd);
 }
 
+/*
+ * The context info only describes the default RX queue. Hand the rings
+ * of the RSS queues to firmware.
+ */
+int ItlIwx::
+iwx_send_rfh_queue_cmd(struct iwx_softc *sc)
+{
+    XYLog("%s\n", __FUNCTION__);
+    struct iwx_rfh_queue_config *cmd;
+    int nqueues = sc->sc_num_rx_queues - 1;
+    size_t len = sizeof(*cmd) + nqueues * sizeof(cmd->data[0]);
+    uint32_t cmd_id;
+    int i, err;
+    
+    cmd = (struct iwx_rfh_queue_config *)malloc(len, 0, 0);
+    if (cmd == NULL)
+        return ENOMEM;
+    
+    cmd->num_queues = nqueues;
+    for (i = 0; i < nqueues; i++) {
+        struct iwx_rx_ring *ring = &sc->rxq[i + 1];
+        
+        cmd->data[i].q_num = ring->qid;
+        cmd->data[i].enable = 1;
+        cmd->data[i].fr_bd_cb = htole64(ring->free_desc_dma.paddr);
+        cmd->data[i].ur_bd_cb = htole64(ring->used_desc_dma.paddr);
+        cmd->data[i].urbd_stts_wrptr = htole64(ring->stat_dma.paddr);
+        cmd->data[i].fr_bd_wid = htole32(0);
+    }
+    
+    cmd_id = iwx_cmd_id(IWX_RFH_QUEUE_CONFIG_CMD, IWX_DATA_PATH_GROUP, 0);
+    err = iwx_send_cmd_pdu(sc, cmd_id, 0, len, cmd);
+    ::free(cmd);
+    return err;
+}
+
+int ItlIwx::
+iwx_send_rss_cfg_cmd(struct iwx_softc *sc)
+{
+    XYLog("%s\n", __FUNCTION__);
+    struct iwx_rss_config_cmd cmd;
+    int i;
+    
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.flags = htole32(IWX_RSS_ENABLE);
+    cmd.hash_mask = (1 << IWX_RSS_HASH_TYPE_IPV4_TCP) |
+        (1 << IWX_RSS_HASH_TYPE_IPV4_UDP) |
+        (1 << IWX_RSS_HASH_TYPE_IPV4_PAYLOAD) |
+        (1 << IWX_RSS_HASH_TYPE_IPV6_TCP) |
+        (1 << IWX_RSS_HASH_TYPE_IPV6_UDP) |
+        (1 << IWX_RSS_HASH_TYPE_IPV6_PAYLOAD);
+    arc4random_buf(cmd.secret_key, sizeof(cmd.secret_key));
+    
+    /* Spread flows over the RSS queues; the default queue is left out. */
+    for (i = 0; i < IWX_RSS_INDIRECTION_TABLE_SIZE; i++)
+        cmd.indirection_table[i] = 1 + (i % (sc->sc_num_rx_queues - 1));
+    
+    return iwx_send_cmd_pdu(sc, IWX_RSS_CONFIG_CMD, 0, sizeof(cmd), &cmd);
+}
+
 int ItlIwx::
 iwx_load_ucode_wait_alive(struct iwx_softc *sc)
 {
@@ -4917,10 +5053,26 @@ iwx_update_rx_desc(struct iwx_softc *sc, struct iwx_rx_ring *ring, int idx)
     //        BUS_DMASYNC_PREWRITE);
 }
 
+void ItlIwx::
+iwx_update_rx_widx(struct iwx_softc *sc, struct iwx_rx_ring *ring,
+                   uint32_t widx)
+{
+    /*
+     * AX210 takes the write index of the RSS queues through the
+     * HBUS target register; the default queue keeps using its
+     * trigger register like on earlier devices.
+     */
+    if (ring->qid != 0 &&
+        sc->sc_device_family >= IWX_DEVICE_FAMILY_AX210)
+        IWX_WRITE(sc, IWX_HBUS_TARG_WRPTR,
+                  widx | IWX_HBUS_TARG_WRPTR_RX_Q(ring->qid));
+    else
+        IWX_WRITE(sc, IWX_RFH_Q_FRBDCB_WIDX_TRG(ring->qid), widx);
+}
+
 int ItlIwx::
-iwx_rx_addbuf(struct iwx_softc *sc, int size, int idx)
+iwx_rx_addbuf(struct iwx_softc *sc, struct iwx_rx_ring *ring, int size, int idx)
 {
-    struct iwx_rx_ring *ring = &sc->rxq;
     struct iwx_rx_data *data = &ring->data[idx];
     mbuf_t m;
     int err;
@@ -5223,74 +5375,11 @@ iwx_flip_address(uint8_t *addr)
     IEEE80211_ADDR_COPY(addr, mac_addr);
 }
 
-/*
- * Drop duplicate 802.11 retransmissions
- * (IEEE 802.11-2012: 9.3.2.10 "Duplicate detection and recovery")
- * and handle pseudo-duplicate frames which result from deaggregation
- * of A-MSDU frames in hardware.
- */
 int ItlIwx::
 iwx_detect_duplicate(struct iwx_softc *sc, mbuf_t m,
-    struct iwx_rx_mpdu_desc *desc, struct ieee80211_rxinfo *rxi)
-{
-    struct ieee80211com *ic = &sc->sc_ic;
-    struct iwx_node *in = (struct iwx_node *)ic->ic_bss;
-    struct iwx_rxq_dup_data *dup_data = &in->dup_data;
-    uint8_t tid = IWX_MAX_TID_COUNT, subframe_idx;
-    struct ieee80211_frame *wh = mtod(m, struct ieee80211_frame *);
-    uint8_t type = wh->i_fc[0] & IEEE80211_FC0_TYPE_MASK;
-    uint8_t subtype = wh->i_fc[0] & IEEE80211_FC0_SUBTYPE_MASK;
-    int hasqos = ieee80211_has_qos(wh);
-    uint16_t seq;
-
-    if (type == IEEE80211_FC0_TYPE_CTL ||
-        (hasqos && (subtype & IEEE80211_FC0_SUBTYPE_NODATA)) ||
-        IEEE80211_IS_MULTICAST(wh->i_addr1))
-        return 0;
-
-    if (hasqos) {
-        tid = (ieee80211_get_qos(wh) & IEEE80211_QOS_TID);
-        if (tid > IWX_MAX_TID_COUNT)
-            tid = IWX_MAX_TID_COUNT;
-    }
-
-    /* If this wasn't a part of an A-MSDU the sub-frame index will be 0 */
-    subframe_idx = desc->amsdu_info &
-        IWX_RX_MPDU_AMSDU_SUBFRAME_IDX_MASK;
-
-    seq = letoh16(*(u_int16_t *)wh->i_seq) >> IEEE80211_SEQ_SEQ_SHIFT;
-    if ((wh->i_fc[1] & IEEE80211_FC1_RETRY) &&
-        dup_data->last_seq[tid] == seq &&
-        dup_data->last_sub_frame[tid] >= subframe_idx)
-        return 1;
-
-    /*
-     * Allow the same frame sequence number for all A-MSDU subframes
-     * following the first subframe.
-     * Otherwise these subframes would be discarded as replays.
-     */
-    if (dup_data->last_seq[tid] == seq &&
-        subframe_idx > dup_data->last_sub_frame[tid] &&
-        (desc->mac_flags2 & IWX_RX_MPDU_MFLG2_AMSDU)) {
-        rxi->rxi_flags |= IEEE80211_RXI_SAME_SEQ;
-    }
-
-    dup_data->last_seq[tid] = seq;
-    dup_data->last_sub_frame[tid] = subframe_idx;
-
-    return 0;
-}
-
-/*
- * Returns true if sn2 - buffer_size < sn1 < sn2.
- * To be used only in order to compare reorder buffer head with NSSN.
- * We fully trust NSSN unless it is behind us due to reorder timeout.
- * Reorder timeout can only bring us up to buffer_size SNs ahead of NSSN.
- */
-int ItlIwx::
-iwx_is_sn_less(uint16_t sn1, uint16_t sn2, uint16_t buffer_size)
+    struct iwx_rx_mpdu_desc *desc, struct ieee80211_rxinfo *rxi, int qid)
 {
-    return SEQ_LT(sn1, sn2) && !SEQ_LT(sn1, sn2 - buffer_size);
+    return ItlIwxReorder::detect_duplicate(sc, m, desc, rxi, qid);
 }
 
 void ItlIwx::
@@ -5298,312 +5387,57 @@ iwx_release_frames(struct iwx_softc *sc, struct ieee80211_node *ni,
     struct iwx_rxba_data *rxba, struct iwx_reorder_buffer *reorder_buf,
     uint16_t nssn, struct mbuf_list *ml)
 {
-    struct iwx_reorder_buf_entry *entries = &rxba->entries[0];
-    uint16_t ssn = reorder_buf->head_sn;
-
-    /* ignore nssn smaller than head sn - this can happen due to timeout */
-    if (iwx_is_sn_less(nssn, ssn, reorder_buf->buf_size))
-        goto set_timer;
-
-    while (iwx_is_sn_less(ssn, nssn, reorder_buf->buf_size)) {
-        int index = ssn % reorder_buf->buf_size;
-        mbuf_t m;
-        int chanidx, is_shortpre;
-        uint32_t rx_pkt_status, rate_n_flags, device_timestamp;
-        struct ieee80211_rxinfo *rxi;
-
-        /* This data is the same for all A-MSDU subframes. */
-        chanidx = entries[index].chanidx;
-        rx_pkt_status = entries[index].rx_pkt_status;
-        is_shortpre = entries[index].is_shortpre;
-        rate_n_flags = entries[index].rate_n_flags;
-        device_timestamp = entries[index].device_timestamp;
-        rxi = &entries[index].rxi;
-
-        /*
-         * Empty the list. Will have more than one frame for A-MSDU.
-         * Empty list is valid as well since nssn indicates frames were
-         * received.
-         */
-        while ((m = ml_dequeue(&entries[index].frames)) != NULL) {
-            iwx_rx_frame(sc, m, chanidx, rx_pkt_status, is_shortpre,
-                rate_n_flags, device_timestamp, rxi, ml);
-            reorder_buf->num_stored--;
-
-            /*
-             * Allow the same frame sequence number and CCMP PN for
-             * all A-MSDU subframes following the first subframe.
-             * Otherwise they would be discarded as replays.
-             */
-            rxi->rxi_flags |= IEEE80211_RXI_SAME_SEQ;
-            rxi->rxi_flags |= IEEE80211_RXI_HWDEC_SAME_PN;
-        }
-
-        ssn = (ssn + 1) & 0xfff;
-    }
-    reorder_buf->head_sn = nssn;
-
-set_timer:
-    if (reorder_buf->num_stored && !reorder_buf->removed) {
-        timeout_add_usec(&reorder_buf->reorder_timer,
-            RX_REORDER_BUF_TIMEOUT_MQ_USEC);
-    } else
-        timeout_del(&reorder_buf->reorder_timer);
+    ItlIwxReorder::release_frames(this, sc, ni, rxba, reorder_buf, nssn, ml);
 }
 
 int ItlIwx::
-iwx_oldsn_workaround(struct iwx_softc *sc, struct ieee80211_node *ni, int tid,
-    struct iwx_reorder_buffer *buffer, uint32_t reorder_data, uint32_t gp2)
+iwx_rx_reorder(struct iwx_softc *sc, mbuf_t m, int chanidx,
+    struct iwx_rx_mpdu_desc *desc, int is_shortpre, int rate_n_flags,
+    uint32_t device_timestamp, struct ieee80211_rxinfo *rxi, int qid,
+    struct mbuf_list *ml)
 {
-    struct ieee80211com *ic = &sc->sc_ic;
-
-    if (gp2 != buffer->consec_oldsn_ampdu_gp2) {
-        /* we have a new (A-)MPDU ... */
-
-        /*
-         * reset counter to 0 if we didn't have any oldsn in
-         * the last A-MPDU (as detected by GP2 being identical)
-         */
-        if (!buffer->consec_oldsn_prev_drop)
-            buffer->consec_oldsn_drops = 0;
-
-        /* either way, update our tracking state */
-        buffer->consec_oldsn_ampdu_gp2 = gp2;
-    } else if (buffer->consec_oldsn_prev_drop) {
-        /*
-         * tracking state didn't change, and we had an old SN
-         * indication before - do nothing in this case, we
-         * already noted this one down and are waiting for the
-         * next A-MPDU (by GP2)
-         */
-        return 0;
-    }
-
-    /* return unless this MPDU has old SN */
-    if (!(reorder_data & IWX_RX_MPDU_REORDER_BA_OLD_SN))
-        return 0;
-
-    /* update state */
-    buffer->consec_oldsn_prev_drop = 1;
-    buffer->consec_oldsn_drops++;
-
-    /* if limit is reached, send del BA and reset state */
-    if (buffer->consec_oldsn_drops == IWX_AMPDU_CONSEC_DROPS_DELBA) {
-        XYLog("reached %d old SN frames, stopping BA session on TID %d\n",
-              IWX_AMPDU_CONSEC_DROPS_DELBA, tid);
-        ieee80211_delba_request(ic, ni, IEEE80211_REASON_UNSPECIFIED,
-            0, tid);
-        buffer->consec_oldsn_prev_drop = 0;
-        buffer->consec_oldsn_drops = 0;
-        return 1;
-    }
-
-    return 0;
+    return ItlIwxReorder::rx_reorder(this, sc, m, chanidx, desc, is_shortpre,
+        rate_n_flags, device_timestamp, rxi, qid, ml);
 }
 
 /*
- * Handle re-ordering of frames which were de-aggregated in hardware.
- * Returns 1 if the MPDU was consumed (buffered or dropped).
- * Returns 0 if the MPDU should be passed to upper layer.
+ * Mark the checksums firmware verified for this frame so that the network
+ * stack does not verify them again. The mbuf packet header carries this
+ * through decapsulation; A-MSDUs are split into subframes by hardware and
+ * each subframe comes with its own descriptor.
  */
-int ItlIwx::
-iwx_rx_reorder(struct iwx_softc *sc, mbuf_t m, int chanidx,
-    struct iwx_rx_mpdu_desc *desc, int is_shortpre, int rate_n_flags,
-    uint32_t device_timestamp, struct ieee80211_rxinfo *rxi,
-    struct mbuf_list *ml)
+void ItlIwx::
+iwx_rx_csum(struct iwx_softc *sc, mbuf_t m, struct iwx_rx_mpdu_desc *desc)
 {
-    struct ieee80211com *ic = &sc->sc_ic;
-    struct ieee80211_frame *wh;
-    struct ieee80211_node *ni;
-    struct iwx_rxba_data *rxba;
-    struct iwx_reorder_buffer *buffer;
-    uint32_t reorder_data = le32toh(desc->reorder_data);
-    int is_amsdu = (desc->mac_flags2 & IWX_RX_MPDU_MFLG2_AMSDU);
-    int last_subframe =
-        (desc->amsdu_info & IWX_RX_MPDU_AMSDU_LAST_SUBFRAME);
-    uint8_t tid;
-    uint8_t subframe_idx = (desc->amsdu_info &
-        IWX_RX_MPDU_AMSDU_SUBFRAME_IDX_MASK);
-    struct iwx_reorder_buf_entry *entries;
-    int index;
-    uint16_t nssn, sn;
-    uint8_t baid, type, subtype;
-    int hasqos;
+    uint16_t flags = le16toh(desc->l3l4_flags);
+    uint8_t l3 = (flags & IWX_RX_L3L4_L3_PROTO_MASK) >>
+        IWX_RX_L3L4_L3_PROTO_SHIFT;
+    uint8_t l4 = (flags & IWX_RX_L3L4_L4_PROTO_MASK) >>
+        IWX_RX_L3L4_L4_PROTO_SHIFT;
+    mbuf_csum_performed_flags_t csum = 0;
 
-    wh = mtod(m, struct ieee80211_frame *);
-    hasqos = ieee80211_has_qos(wh);
-    tid = hasqos ? ieee80211_get_qos(wh) & IEEE80211_QOS_TID : 0;
-
-    type = wh->i_fc[0] & IEEE80211_FC0_TYPE_MASK;
-    subtype = wh->i_fc[0] & IEEE80211_FC0_SUBTYPE_MASK;
-
-    /*
-     * We are only interested in Block Ack requests and unicast QoS data.
-     */
-    if (IEEE80211_IS_MULTICAST(wh->i_addr1))
-        return 0;
-    if (hasqos) {
-        if (subtype & IEEE80211_FC0_SUBTYPE_NODATA)
-            return 0;
-    } else {
-        if (type != IEEE80211_FC0_TYPE_CTL ||
-            subtype != IEEE80211_FC0_SUBTYPE_BAR)
-            return 0;
-    }
-
-    baid = (reorder_data & IWX_RX_MPDU_REORDER_BAID_MASK) >>
-    IWX_RX_MPDU_REORDER_BAID_SHIFT;
-    if (baid == IWX_RX_REORDER_DATA_INVALID_BAID ||
-        baid >= nitems(sc->sc_rxba_data))
-        return 0;
-
-    rxba = &sc->sc_rxba_data[baid];
-    if (rxba->reorder_buf.buf_size == 0 || tid != rxba->tid || rxba->sta_id != IWX_STATION_ID)
-        return 0;
-    
-    if (rxba->timeout != 0)
-        getmicrouptime(&rxba->last_rx);
-
-    /* Bypass A-MPDU re-ordering in net80211. */
-    rxi->rxi_flags |= IEEE80211_RXI_AMPDU_DONE;
-
-    nssn = reorder_data & IWX_RX_MPDU_REORDER_NSSN_MASK;
-    sn = (reorder_data & IWX_RX_MPDU_REORDER_SN_MASK) >>
-        IWX_RX_MPDU_REORDER_SN_SHIFT;
-
-    buffer = &rxba->reorder_buf;
-    entries = &rxba->entries[0];
-
-    if (!buffer->valid) {
-        if (reorder_data & IWX_RX_MPDU_REORDER_BA_OLD_SN)
-            return 0;
-        buffer->valid = 1;
-    }
-
-    ni = ieee80211_find_rxnode(ic, wh);
-    if (type == IEEE80211_FC0_TYPE_CTL &&
-        subtype == IEEE80211_FC0_SUBTYPE_BAR) {
-        iwx_release_frames(sc, ni, rxba, buffer, nssn, ml);
-        goto drop;
-    }
-
-    /*
-     * If there was a significant jump in the nssn - adjust.
-     * If the SN is smaller than the NSSN it might need to first go into
-     * the reorder buffer, in which case we just release up to it and the
-     * rest of the function will take care of storing it and releasing up to
-     * the nssn.
-     */
-    if (!iwx_is_sn_less(nssn, buffer->head_sn + buffer->buf_size,
-        buffer->buf_size) ||
-        !SEQ_LT(sn, buffer->head_sn + buffer->buf_size)) {
-        uint16_t min_sn = SEQ_LT(sn, nssn) ? sn : nssn;
-        ic->ic_stats.is_ht_rx_frame_above_ba_winend++;
-        iwx_release_frames(sc, ni, rxba, buffer, min_sn, ml);
-    }
-
-    if (iwx_oldsn_workaround(sc, ni, tid, buffer, reorder_data,
-        device_timestamp)) {
-         /* BA session will be torn down. */
-        ic->ic_stats.is_ht_rx_ba_window_jump++;
-        goto drop;
-
-    }
-
-    /* drop any outdated packets */
-    if (SEQ_LT(sn, buffer->head_sn)) {
-        ic->ic_stats.is_ht_rx_frame_below_ba_winstart++;
-        goto drop;
-    }
-
-    /* release immediately if allowed by nssn and no stored frames */
-    if (!buffer->num_stored && SEQ_LT(sn, nssn)) {
-        if (iwx_is_sn_less(buffer->head_sn, nssn, buffer->buf_size) &&
-           (!is_amsdu || last_subframe))
-            buffer->head_sn = nssn;
-        ieee80211_release_node(ic, ni);
-        return 0;
-    }
-
-    /*
-     * release immediately if there are no stored frames, and the sn is
-     * equal to the head.
-     * This can happen due to reorder timer, where NSSN is behind head_sn.
-     * When we released everything, and we got the next frame in the
-     * sequence, according to the NSSN we can't release immediately,
-     * while technically there is no hole and we can move forward.
-     */
-    if (!buffer->num_stored && sn == buffer->head_sn) {
-        if (!is_amsdu || last_subframe)
-            buffer->head_sn = (buffer->head_sn + 1) & 0xfff;
-        ieee80211_release_node(ic, ni);
-        return 0;
-    }
-
-    index = sn % buffer->buf_size;
+    if (!(sc->sc_flags & IWX_FLAG_RXCSUM))
+        return;
+    if (l4 != IWX_RX_L4_TYPE_TCP && l4 != IWX_RX_L4_TYPE_UDP)
+        return;
 
-    /*
-     * Check if we already stored this frame
-     * As AMSDU is either received or not as whole, logic is simple:
-     * If we have frames in that position in the buffer and the last frame
-     * originated from AMSDU had a different SN then it is a retransmission.
-     * If it is the same SN then if the subframe index is incrementing it
-     * is the same AMSDU - otherwise it is a retransmission.
-     */
-    if (!ml_empty(&entries[index].frames)) {
-        if (!is_amsdu) {
-            ic->ic_stats.is_ht_rx_ba_no_buf++;
-            goto drop;
-        } else if (sn != buffer->last_amsdu ||
-            buffer->last_sub_index >= subframe_idx) {
-            ic->ic_stats.is_ht_rx_ba_no_buf++;
-            goto drop;
-        }
+    if (l3 == IWX_RX_L3_TYPE_IPV4 && (flags & IWX_RX_L3L4_IP_HDR_CSUM_OK))
+        csum |= MBUF_CSUM_DID_IP | MBUF_CSUM_IP_GOOD;
+    if ((flags & IWX_RX_L3L4_TCP_UDP_CSUM_OK) &&
+        ((csum & MBUF_CSUM_IP_GOOD) || l3 == IWX_RX_L3_TYPE_IPV6)) {
+        csum |= MBUF_CSUM_DID_DATA | MBUF_CSUM_PSEUDO_HDR;
+        mbuf_set_csum_performed(m, csum, 0xffff);
+        sc->sc_rx_csum_hw++;
     } else {
-        /* This data is the same for all A-MSDU subframes. */
-        entries[index].chanidx = chanidx;
-        entries[index].is_shortpre = is_shortpre;
-        entries[index].rate_n_flags = rate_n_flags;
-        entries[index].device_timestamp = device_timestamp;
-        memcpy(&entries[index].rxi, rxi, sizeof(entries[index].rxi));
+        if (csum != 0)
+            mbuf_set_csum_performed(m, csum, 0);
+        sc->sc_rx_csum_sw++;
     }
-
-    /* put in reorder buffer */
-    ml_enqueue(&entries[index].frames, m);
-    buffer->num_stored++;
-    getmicrouptime(&entries[index].reorder_time);
-
-    if (is_amsdu) {
-        buffer->last_amsdu = sn;
-        buffer->last_sub_index = subframe_idx;
-    }
-
-    /*
-     * We cannot trust NSSN for AMSDU sub-frames that are not the last.
-     * The reason is that NSSN advances on the first sub-frame, and may
-     * cause the reorder buffer to advance before all the sub-frames arrive.
-     * Example: reorder buffer contains SN 0 & 2, and we receive AMSDU with
-     * SN 1. NSSN for first sub frame will be 3 with the result of driver
-     * releasing SN 0,1, 2. When sub-frame 1 arrives - reorder buffer is
-     * already ahead and it will be dropped.
-     * If the last sub-frame is not on this queue - we will get frame
-     * release notification with up to date NSSN.
-     */
-    if (!is_amsdu || last_subframe)
-        iwx_release_frames(sc, ni, rxba, buffer, nssn, ml);
-
-    ieee80211_release_node(ic, ni);
-    return 1;
-
-drop:
-    mbuf_freem(m);
-    ieee80211_release_node(ic, ni);
-    return 1;
 }
 
 void ItlIwx::
 iwx_rx_mpdu_mq(struct iwx_softc *sc, mbuf_t m, void *pktdata,
-               size_t maxlen, struct mbuf_list *ml)
+               size_t maxlen, int qid, struct mbuf_list *ml)
 {
     struct ieee80211com *ic = &sc->sc_ic;
     struct ieee80211_rxinfo rxi;
@@ -5653,6 +5487,8 @@ iwx_rx_mpdu_mq(struct iwx_softc *sc, mbuf_t m, void *pktdata,
     mbuf_pkthdr_setlen(m, len);
     mbuf_setlen(m, len);
     
+    iwx_rx_csum(sc, m, desc);
+    
     /* Account for padding following the frame header. */
     if (desc->mac_flags2 & IWX_RX_MPDU_MFLG2_PAD) {
         struct ieee80211_frame *wh = mtod(m, struct ieee80211_frame *);
@@ -5728,7 +5564,7 @@ iwx_rx_mpdu_mq(struct iwx_softc *sc, mbuf_t m, void *pktdata,
         return;
     }
     
-    if (iwx_detect_duplicate(sc, m, desc, &rxi)) {
+    if (iwx_detect_duplicate(sc, m, desc, &rxi, qid)) {
         mbuf_freem(m);
         return;
     }
@@ -5755,7 +5591,7 @@ iwx_rx_mpdu_mq(struct iwx_softc *sc, mbuf_t m, void *pktdata,
     
     if (iwx_rx_reorder(sc, m, chanidx, desc,
                        (phy_info & IWX_RX_MPDU_PHY_SHORT_PREAMBLE),
-                       rate_n_flags, device_timestamp, &rxi, ml))
+                       rate_n_flags, device_timestamp, &rxi, qid, ml))
         return;
     
     iwx_rx_frame(sc, m, chanidx, le16toh(desc->status),
@@ -5783,6 +5619,8 @@ iwx_rx_tx_cmd_single(struct iwx_softc *sc, struct iwx_rx_packet *pkt,
         if (txd->type == IEEE80211_FC0_TYPE_MGT)
             iwx_toggle_tx_ant(sc, &sc->sc_mgmt_last_antenna_idx);
     }
+    if (txd->type == IEEE80211_FC0_TYPE_DATA)
+        ieee80211_roam_txstatus(ic, 1, txfail);
 }
 
 void
@@ -5826,9 +5664,10 @@ iwx_clear_oactive(struct iwx_softc *sc, struct iwx_tx_ring *ring)
     struct ieee80211com *ic = &sc->sc_ic;
     struct _ifnet *ifp = &ic->ic_if;
 
-    if (ring->queued < ring->low_mark) {
+    if (ring->queued < ring->low_mark && ItlTxLimit::is_open(&ring->lim)) {
         sc->qfullmsk &= ~(1 << ring->qid);
-        if (sc->qfullmsk == 0 && ifq_is_oactive(&ifp->if_snd)) {
+        if (sc->qfullmsk == 0 && (ifq_is_oactive(&ifp->if_snd) ||
+            ifq_take_deferred_start(&ifp->if_snd))) {
             ifq_clr_oactive(&ifp->if_snd);
             (*ifp->if_start)(ifp);
         }
@@ -5845,6 +5684,7 @@ iwx_rx_tx_ba_notif(struct iwx_softc *sc, struct iwx_rx_packet *pkt, struct iwx_r
     struct iwx_compressed_ba_notif *ba_res = (struct iwx_compressed_ba_notif *)pkt->data;
     uint8_t tid;
     uint8_t qid;
+    uint32_t done;
     int i;
     struct iwx_tx_ring *ring;
 
@@ -5863,6 +5703,9 @@ iwx_rx_tx_ba_notif(struct iwx_softc *sc, struct iwx_rx_packet *pkt, struct iwx_r
     if (ic->ic_state != IEEE80211_S_RUN)
         return;
 
+    ieee80211_roam_txstatus(ic, le16toh(ba_res->txed),
+                            le16toh(ba_res->txed) - le16toh(ba_res->done));
+
     if (!le16toh(ba_res->tfd_cnt))
         return;
 
@@ -5877,15 +5720,21 @@ iwx_rx_tx_ba_notif(struct iwx_softc *sc, struct iwx_rx_packet *pkt, struct iwx_r
 
         sc->sc_tx_timer = 0;
 
-        iwx_ampdu_txq_advance(sc, ring, IWX_AGG_SSN_TO_TXQ_IDX(le16toh(ba_tfd->tfd_index), ring->ring_count));
+        done = iwx_ampdu_txq_advance(sc, ring, IWX_AGG_SSN_TO_TXQ_IDX(le16toh(ba_tfd->tfd_index), ring->ring_count));
+        iwx_tx_limit_done(sc, ring, done);
         iwx_clear_oactive(sc, ring);
     }
 }
 
-void ItlIwx::
+/*
+ * Reclaim ring entries up to idx. Returns the number of frame bytes
+ * released so callers can feed the ring's fill limit.
+ */
+uint32_t ItlIwx::
 iwx_ampdu_txq_advance(struct iwx_softc *sc, struct iwx_tx_ring *ring, int idx)
 {
     struct iwx_tx_data *txd;
+    uint32_t done = 0;
 
     while (ring->tail != idx) {
         txd = &ring->data[ring->tail];
@@ -5893,9 +5742,39 @@ iwx_ampdu_txq_advance(struct iwx_softc *sc, struct iwx_tx_ring *ring, int idx)
             iwx_txd_done(sc, txd);
             iwx_clear_tx_desc(sc, ring, ring->tail);
             ring->queued--;
+            done += txd->len;
+            txd->len = 0;
         }
         ring->tail = (ring->tail + 1) % ring->ring_count;
     }
+    ItlTxLimit::dequeued(&ring->lim, done);
+    return done;
+}
+
+static uint64_t
+iwx_txlim_now(void)
+{
+    uint64_t t, ns;
+
+    clock_get_uptime(&t);
+    absolutetime_to_nanoseconds(t, &ns);
+    return ns;
+}
+
+/*
+ * Adjust the ring's byte limit after 'done' bytes were reported sent.
+ * Only called from Tx completions, whose timestamps also give the drain
+ * rate used to bound the limit by airtime.
+ */
+void ItlIwx::
+iwx_tx_limit_done(struct iwx_softc *sc, struct iwx_tx_ring *ring, uint32_t done)
+{
+    uint32_t limit = ring->lim.limit;
+
+    ItlTxLimit::completed(&ring->lim, done, iwx_txlim_now());
+    if (limit != ring->lim.limit)
+        DPRINTFN(3, ("%s: qid %d limit %u -> %u rate %u B/ms\n", __func__,
+            ring->qid, limit, ring->lim.limit, ring->lim.rate));
 }
 
 #define IWX_AGG_TX_STATE_(x) case IWX_AGG_TX_STATE_ ## x: return #x
@@ -5957,7 +5836,7 @@ iwx_rx_tx_cmd(struct iwx_softc *sc, struct iwx_rx_packet *pkt,
         txd = &ring->data[idx];
         iwx_rx_tx_cmd_single(sc, pkt, txd);
         DPRINTFN(3, ("%s tid=%d ssn=%d idx=%d\n", __FUNCTION__, tid, ssn, idx));
-        iwx_ampdu_txq_advance(sc, ring, idx);
+        iwx_tx_limit_done(sc, ring, iwx_ampdu_txq_advance(sc, ring, idx));
         iwx_clear_oactive(sc, ring);
     }
 }
@@ -5991,7 +5870,8 @@ iwx_rx_bmiss(struct iwx_softc *sc, struct iwx_rx_packet *pkt,
                       "queued=%-3d\n",
                       i, ring->qid, ring->cur, ring->queued);
             }
-            XYLog("  rx ring: cur=%d\n", sc->rxq.cur);
+            for (int i = 0; i < sc->sc_num_rx_queues; i++)
+                XYLog("  rx ring %d: cur=%d\n", i, sc->rxq[i].cur);
             XYLog("  802.11 state %s\n",
                   ieee80211_state_name[sc->sc_ic.ic_state]);
         }
@@ -6761,8 +6641,15 @@ iwx_tx(struct iwx_softc *sc, mbuf_t m, struct ieee80211_node *ni, int ac)
     }
 #endif
     
-    if (wh->i_fc[1] & IEEE80211_FC1_PROTECTED) {
+    if (wh->i_fc[1] & IEEE80211_FC1_PROTECTED)
         k = ieee80211_get_txkey(ic, wh, ni);
+    
+    /* Checksums must be in place before software encryption. */
+    if (type == IEEE80211_FC0_TYPE_DATA)
+        offload_assist |= iwx_tx_csum(sc, m, hdrlen,
+            k == NULL || k->k_cipher == IEEE80211_CIPHER_CCMP);
+    
+    if (wh->i_fc[1] & IEEE80211_FC1_PROTECTED) {
         if (k->k_cipher != IEEE80211_CIPHER_CCMP) {
             if ((m = ieee80211_encrypt(ic, m, k)) == NULL)
                 return ENOBUFS;
@@ -6778,8 +6665,7 @@ iwx_tx(struct iwx_softc *sc, mbuf_t m, struct ieee80211_node *ni, int ac)
     //    totlen = m->m_pkthdr.len;
     totlen = mbuf_pkthdr_len(m);
     
-    if (hdrlen % 4)
-        offload_assist |= IWX_TX_CMD_OFFLD_PAD;
+    offload_assist |= iwx_tx_offload_hdr(wh, hdrlen);
     
     if (sc->sc_device_family >= IWX_DEVICE_FAMILY_AX210) {
         tx_gen3 = (struct iwx_tx_cmd_gen3 *)cmd->data;
@@ -6819,6 +6705,7 @@ iwx_tx(struct iwx_softc *sc, mbuf_t m, struct ieee80211_node *ni, int ac)
     data->m = m;
     data->in = in;
     data->type = type;
+    data->len = totlen;
 
     DPRINTFN(3, ("sending data: 嘤嘤嘤 tid=%d qid=%d idx=%d queued=%d len=%d nsegs=%d flags=0x%08x rate_n_flags=0x%08x offload_assist=%u\n",
           tid, ring->qid, ring->cur, ring->queued, totlen, nsegs, le32toh(flags),
@@ -6867,8 +6754,13 @@ iwx_tx(struct iwx_softc *sc, mbuf_t m, struct ieee80211_node *ni, int ac)
     ring->cur = (ring->cur + 1) % getTxQueueSize();
     IWX_WRITE(sc, IWX_HBUS_TARG_WRPTR, ring->qid << 16 | ring->cur);
     
-    /* Mark TX ring as full if we reach a certain threshold. */
-    if (++ring->queued > ring->hi_mark) {
+    /*
+     * Mark TX ring as full if we reach a certain threshold, or once it
+     * holds as many bytes as its fill limit allows.
+     */
+    ring->queued++;
+    if (ItlTxLimit::queued(&ring->lim, totlen) ||
+        ring->queued > ring->hi_mark) {
 //        XYLog("%s sc->qfullmsk is FULL qid=%d ring->cur=%d ring->queued=%d\n", __FUNCTION__, ring->qid, ring->cur, ring->queued);
         sc->qfullmsk |= 1 << ring->qid;
     }
@@ -7381,6 +7273,10 @@ iwx_umac_scan_fill_channels(struct iwx_softc *sc,
         
         if (c->ic_flags == 0)
             continue;
+        if (bgscan && ieee80211_chanhist_skip(ic, c))
+            continue;
+        if (!bgscan && ieee80211_resume_skip(ic, c))
+            continue;
         
         channel_num = ieee80211_mhz2ieee(c->ic_freq, 0);
         if (isset(sc->sc_ucode_api,
@@ -7777,10 +7673,13 @@ iwx_umac_scan(struct iwx_softc *sc, int bgscan)
         req->v7.adwell_default_n_aps_social =
         IWX_SCAN_ADWELL_DEFAULT_N_APS_SOCIAL;
         req->v7.adwell_default_n_aps =
-        IWX_SCAN_ADWELL_DEFAULT_LB_N_APS;
+        ieee80211_scan_naps(ic, IEEE80211_CHAN_2GHZ,
+                            IWX_SCAN_ADWELL_DEFAULT_LB_N_APS);
         
         if (isset(sc->sc_ucode_api, IWX_UCODE_TLV_API_ADWELL_HB_DEF_N_AP))
-            req->v9.adwell_default_hb_n_aps = IWX_SCAN_ADWELL_DEFAULT_HB_N_APS;
+            req->v9.adwell_default_hb_n_aps =
+            ieee80211_scan_naps(ic, IEEE80211_CHAN_5GHZ,
+                                IWX_SCAN_ADWELL_DEFAULT_HB_N_APS);
         
         if (ic->ic_des_esslen != 0 && !bgscan)
             req->v7.adwell_max_budget =
@@ -7951,8 +7850,10 @@ iwx_umac_scan_v12(struct iwx_softc *sc, int bgscan)
     
     general_params->adwell_default_social_chn =
         IWX_SCAN_ADWELL_DEFAULT_N_APS_SOCIAL;
-    general_params->adwell_default_2g = IWX_SCAN_ADWELL_DEFAULT_LB_N_APS;
-    general_params->adwell_default_5g = IWX_SCAN_ADWELL_DEFAULT_HB_N_APS;
+    general_params->adwell_default_2g = ieee80211_scan_naps(ic,
+        IEEE80211_CHAN_2GHZ, IWX_SCAN_ADWELL_DEFAULT_LB_N_APS);
+    general_params->adwell_default_5g = ieee80211_scan_naps(ic,
+        IEEE80211_CHAN_5GHZ, IWX_SCAN_ADWELL_DEFAULT_HB_N_APS);
 
     if (ic->ic_des_esslen != 0 && !bgscan)
         general_params->adwell_max_budget =
@@ -8050,8 +7951,10 @@ iwx_umac_scan_v14(struct iwx_softc *sc, int bgscan)
     
     general_params->adwell_default_social_chn =
         IWX_SCAN_ADWELL_DEFAULT_N_APS_SOCIAL;
-    general_params->adwell_default_2g = IWX_SCAN_ADWELL_DEFAULT_LB_N_APS;
-    general_params->adwell_default_5g = IWX_SCAN_ADWELL_DEFAULT_HB_N_APS;
+    general_params->adwell_default_2g = ieee80211_scan_naps(ic,
+        IEEE80211_CHAN_2GHZ, IWX_SCAN_ADWELL_DEFAULT_LB_N_APS);
+    general_params->adwell_default_5g = ieee80211_scan_naps(ic,
+        IEEE80211_CHAN_5GHZ, IWX_SCAN_ADWELL_DEFAULT_HB_N_APS);
     if (ic->ic_des_esslen != 0 && !bgscan)
         general_params->adwell_max_budget =
             cpu_to_le16(IWX_SCAN_ADWELL_MAX_BUDGET_DIRECTED_SCAN);
@@ -8887,6 +8790,7 @@ iwx_rs_init(struct iwx_softc *sc, struct iwx_node *in, bool update)
     struct ieee80211_rateset *rs = &ni->ni_rates;
     struct iwx_tlc_config_cmd_v4 cfg_cmd;
     uint32_t cmd_id;
+    u_int amsdu_maxlen;
     int i;
     uint16_t cmd_size;
     uint8_t cmdver;
@@ -8918,6 +8822,12 @@ iwx_rs_init(struct iwx_softc *sc, struct iwx_node *in, bool update)
     cfg_cmd.max_ch_width = update ? iwx_rs_fw_bw_from_sta_bw(ni->ni_chw) : IWX_RATE_MCS_CHAN_WIDTH_20;
     cfg_cmd.chains = iwx_rs_fw_set_active_chains(iwx_fw_valid_tx_ant(sc));
     cfg_cmd.flags = iwx_rs_fw_get_config_flags(sc);
+    /* Firmware reports per-TID A-MSDU limits once it knows the peer's. */
+    amsdu_maxlen = ieee80211_amsdu_maxlen(ni);
+    cfg_cmd.max_mpdu_len = htole16(amsdu_maxlen ? amsdu_maxlen :
+        IEEE80211_MAX_LEN);
+    sc->sc_amsdu_size = 0;
+    sc->sc_amsdu_enabled = 0;
     if ((ni->ni_flags & IEEE80211_NODE_HE) == 0) {
         if (ieee80211_node_supports_ht_sgi20(ni))
             cfg_cmd.sgi_ch_width_supp = (1 << IWX_TLC_MNG_CH_WIDTH_20MHZ);
@@ -8946,7 +8856,7 @@ iwx_rs_init(struct iwx_softc *sc, struct iwx_node *in, bool update)
             .max_ch_width = cfg_cmd.max_ch_width,
             .mode = cfg_cmd.mode,
             .chains = cfg_cmd.chains,
-            .amsdu = !!cfg_cmd.max_mpdu_len,
+            .amsdu = !!amsdu_maxlen,
             .flags = cfg_cmd.flags,
             .non_ht_rates = cfg_cmd.non_ht_rates,
             .ht_rates[0][0] = cfg_cmd.ht_rates[0][0],
@@ -9062,8 +8972,17 @@ iwx_rs_update(struct iwx_softc *sc, struct iwx_tlc_update_notif *notif)
     uint8_t notifver;
     uint32_t format;
 
-    if (notif->sta_id != IWX_STATION_ID ||
-        (le32toh(notif->flags) & IWX_TLC_NOTIF_FLAG_RATE) == 0)
+    if (notif->sta_id != IWX_STATION_ID)
+        return;
+
+    if (le32toh(notif->flags) & IWX_TLC_NOTIF_FLAG_AMSDU) {
+        sc->sc_amsdu_size = le32toh(notif->amsdu_size);
+        sc->sc_amsdu_enabled = le32toh(notif->amsdu_enabled) & 0xffff;
+        DPRINTF(("%s: amsdu size %u tids 0x%x\n", __func__,
+            sc->sc_amsdu_size, sc->sc_amsdu_enabled));
+    }
+
+    if ((le32toh(notif->flags) & IWX_TLC_NOTIF_FLAG_RATE) == 0)
         return;
 
     rate_n_flags = le32toh(notif->rate);
@@ -10097,6 +10016,35 @@ iwx_init_hw(struct iwx_softc *sc)
             return err;
     }
     
+    if (sc->sc_num_rx_queues > 1) {
+        err = iwx_send_rfh_queue_cmd(sc);
+        if (err) {
+            XYLog("%s: could not configure RSS queues (error %d)\n",
+                  DEVNAME(sc), err);
+            return err;
+        }
+        err = iwx_send_rss_cfg_cmd(sc);
+        if (err) {
+            XYLog("%s: could not send RSS configuration (error %d)\n",
+                  DEVNAME(sc), err);
+            return err;
+        }
+    }
+    
+    /*
+     * Pre-AX210 firmware with checksum support reports L3/L4 checksum
+     * status in each Rx MPDU descriptor. AX210 only provides a raw sum
+     * over the frame which the network stack has no use for.
+     */
+    if (isset(sc->sc_enabled_capa, IWX_UCODE_TLV_CAPA_CSUM_SUPPORT) &&
+        sc->sc_device_family < IWX_DEVICE_FAMILY_AX210) {
+        sc->sc_flags |= IWX_FLAG_RXCSUM;
+        sc->sc_ic.ic_if.if_xflags |= IFXF_LRO;
+    } else {
+        sc->sc_flags &= ~IWX_FLAG_RXCSUM;
+        sc->sc_ic.ic_if.if_xflags &= ~IFXF_LRO;
+    }
+    
     /* Add auxiliary station for scanning */
     err = iwx_add_aux_sta(sc);
     if (err) {
@@ -10272,15 +10220,22 @@ _iwx_start_task(OSObject *target, void *arg0, void *arg1, void *arg2, void *arg3
     ItlIwx *that = container_of(sc, ItlIwx, com);
     struct ieee80211com *ic = &sc->sc_ic;
     struct ieee80211_node *ni;
-    struct ether_header *eh;
-    mbuf_t m;
+    struct ether_header *eh, amsdu_eh;
+    mbuf_t m, held = NULL;
     int ac = EDCA_AC_BE; /* XXX */
+    int tid, nframes;
+    
+    KASSERT(that->getMainWorkLoop()->inGate(), "start task outside the work loop gate");
+    /* This pass serves any kick a producer deferred to the gate holder. */
+    ifq_take_deferred_start(&ifp->if_snd);
     
     if (!(ifp->if_flags & IFF_RUNNING) ||  ifq_is_oactive(&ifp->if_snd)) {
         return kIOReturnError;
     }
     
     for (;;) {
+        nframes = 1;
+
         /* why isn't this done per-queue? */
         if (sc->qfullmsk != 0) {
             ifq_set_oactive(&ifp->if_snd);
@@ -10306,7 +10261,12 @@ _iwx_start_task(OSObject *target, void *arg0, void *arg1, void *arg2, void *arg3
             (ic->ic_xflags & IEEE80211_F_TX_MGMT_ONLY))
             break;
         
-        m = ifq_dequeue(&ifp->if_snd);
+        /* A frame left over from A-MSDU aggregation goes first. */
+        if (held != NULL) {
+            m = held;
+            held = NULL;
+        } else
+            m = ifq_dequeue(&ifp->if_snd);
         if (!m)
             break;
         if (mbuf_len(m) < sizeof (*eh) &&
@@ -10318,10 +10278,25 @@ _iwx_start_task(OSObject *target, void *arg0, void *arg1, void *arg2, void *arg3
         if (ifp->if_bpf != NULL)
             bpf_mtap(ifp->if_bpf, m, BPF_DIRECTION_OUT);
 #endif
+        tid = -1;
+        if (sc->sc_amsdu_enabled != 0 && !ifq_empty(&ifp->if_snd)) {
+            tid = ieee80211_amsdu_tid(ic, ic->ic_bss, m);
+            if (tid != -1 && (sc->sc_amsdu_enabled & (1 << tid)))
+                memcpy(&amsdu_eh, mtod(m, caddr_t), sizeof(amsdu_eh));
+            else
+                tid = -1;
+        }
         if ((m = ieee80211_encap(ifp, m, &ni)) == NULL) {
             ifp->netStat->outputErrors++;
             continue;
         }
+        if (tid != -1 &&
+            (m = that->iwx_tx_amsdu(sc, m, &amsdu_eh, tid, &held,
+            &nframes)) == NULL) {
+            ieee80211_release_node(ic, ni);
+            ifp->netStat->outputErrors += nframes;
+            continue;
+        }
         
     sendit:
 #if NBPFILTER > 0
@@ -10333,23 +10308,204 @@ _iwx_start_task(OSObject *target, void *arg0, void *arg1, void *arg2, void *arg3
             ifp->netStat->outputErrors++;
             continue;
         }
-        ifp->netStat->outputPackets++;
+        ifp->netStat->outputPackets += nframes;
         
         if (ifp->if_flags & IFF_UP) {
             sc->sc_tx_timer = 15;
             ifp->if_timer = 1;
         }
     }
+
+    /* Put back a frame we pulled off the send queue but did not send. */
+    if (held != NULL)
+        ifq_prepend(&ifp->if_snd, held);
     
     return kIOReturnSuccess;
 }
 
+/*
+ * offload_assist layout as defined by Linux iwlwifi (TX_CMD_OFFLD_*), and
+ * the value iwx_tx() builds for a QoS data MPDU with an offloaded checksum.
+ */
+static_assert(IWX_TX_CMD_OFFLD_IP_HDR(IWX_TX_CMD_OFFLD_IP_HDR_MASK) == 0x3f,
+    "offload_assist IP header offset corrupted");
+static_assert(IWX_TX_CMD_OFFLD_L4_EN == 0x40 && IWX_TX_CMD_OFFLD_L3_EN == 0x80,
+    "offload_assist checksum enables corrupted");
+static_assert(IWX_TX_CMD_OFFLD_MH_SIZE(IWX_TX_CMD_OFFLD_MH_MASK) == 0x1f00,
+    "offload_assist MAC header size corrupted");
+static_assert(IWX_TX_CMD_OFFLD_PAD == 0x2000 && IWX_TX_CMD_OFFLD_AMSDU == 0x4000,
+    "offload_assist PAD/AMSDU corrupted");
+static_assert(sizeof(struct ieee80211_qosframe_addr4) / 2 <=
+    IWX_TX_CMD_OFFLD_MH_MASK, "802.11 header does not fit MH_SIZE");
+static_assert((IWX_TX_CMD_OFFLD_L4_EN |
+    IWX_TX_CMD_OFFLD_IP_HDR(LLC_SNAPFRAMELEN / 2) |
+    IWX_TX_CMD_OFFLD_MH_SIZE(sizeof(struct ieee80211_qosframe) / 2) |
+    IWX_TX_CMD_OFFLD_PAD) == 0x2d44, "offload_assist layout corrupted");
+
+/*
+ * offload_assist bits describing the 802.11 header of hdrlen bytes. The IV
+ * is always added by firmware with this Tx command API.
+ */
+uint16_t ItlIwx::
+iwx_tx_offload_hdr(struct ieee80211_frame *wh, u_int hdrlen)
+{
+    uint16_t offload_assist = IWX_TX_CMD_OFFLD_MH_SIZE(hdrlen / 2);
+
+    if (ieee80211_has_qos(wh) &&
+        (ieee80211_get_qos(wh) & IEEE80211_QOS_AMSDU))
+        offload_assist |= IWX_TX_CMD_OFFLD_AMSDU;
+    else if (hdrlen % 4)
+        offload_assist |= IWX_TX_CMD_OFFLD_PAD;
+    return offload_assist;
+}
+
+/*
+ * Let firmware fill in the TCP/UDP checksum the network stack deferred to us.
+ * The L3 header follows the LLC header, which follows the 802.11 header of
+ * hdrlen bytes. A-MSDUs, whose subframes are finalized as they are built,
+ * software encrypted frames, IPv4 fragments and IPv6 extension headers get
+ * their checksums computed here instead.
+ */
+uint16_t ItlIwx::
+iwx_tx_csum(struct iwx_softc *sc, mbuf_t m, u_int hdrlen, int hwcrypto)
+{
+    struct ieee80211_frame *wh = mtod(m, struct ieee80211_frame *);
+    mbuf_csum_request_flags_t request;
+    uint32_t value;
+    uint16_t ethertype, sum = 0;
+    u_int off = hdrlen + LLC_SNAPFRAMELEN, l4off, sumoff;
+    uint8_t proto;
+
+    mbuf_get_csum_requested(m, &request, &value);
+    if (request == 0)
+        return 0;
+
+    /* Too short to carry an IP packet; nothing to checksum. */
+    if (mbuf_copydata(m, off - sizeof(ethertype), sizeof(ethertype),
+        &ethertype) != 0)
+        return 0;
+    if (!hwcrypto || (request & MBUF_CSUM_REQ_IP) ||
+        !isset(sc->sc_enabled_capa, IWX_UCODE_TLV_CAPA_CSUM_SUPPORT) ||
+        (ieee80211_has_qos(wh) &&
+        (ieee80211_get_qos(wh) & IEEE80211_QOS_AMSDU)))
+        goto sw;
+
+    if (ethertype == htons(ETHERTYPE_IP)) {
+        struct ip ip;
+        if (mbuf_copydata(m, off, sizeof(ip), &ip) != 0)
+            goto sw;
+        /* Only the first fragment carries the L4 header. */
+        if (ip.ip_off & htons(IP_MF | IP_OFFMASK))
+            goto sw;
+        l4off = off + (ip.ip_hl << 2);
+        proto = ip.ip_p;
+    } else if (ethertype == htons(ETHERTYPE_IPV6)) {
+        struct ip6_hdr ip6;
+        if (mbuf_copydata(m, off, sizeof(ip6), &ip6) != 0)
+            goto sw;
+        l4off = off + sizeof(ip6);
+        proto = ip6.ip6_nxt;
+    } else
+        goto sw;
+
+    if (proto == IPPROTO_TCP)
+        sumoff = offsetof(struct tcphdr, th_sum);
+    else if (proto == IPPROTO_UDP)
+        sumoff = offsetof(struct udphdr, uh_sum);
+    else
+        goto sw;
+
+    /* Firmware computes the whole sum, pseudo header included. */
+    if (mbuf_copyback(m, l4off + sumoff, sizeof(sum), &sum,
+        MBUF_DONTWAIT) != 0)
+        goto sw;
+    sc->sc_tx_csum_hw++;
+    return IWX_TX_CMD_OFFLD_L4_EN |
+        IWX_TX_CMD_OFFLD_IP_HDR(LLC_SNAPFRAMELEN / 2);
+
+sw:
+    ieee80211_csum_finalize(m, ethertype, off);
+    sc->sc_tx_csum_sw++;
+    return 0;
+}
+
+/*
+ * Coalesce frames waiting on the send queue into the A-MSDU headed by the
+ * already encapsulated MPDU m, as long as they are for the same destination
+ * and TID and fit within the A-MSDU limits of both firmware and peer.
+ * The first frame which cannot be aggregated is returned in *held.
+ * On return *nframes holds the number of MSDUs in the frame.
+ */
+mbuf_t ItlIwx::
+iwx_tx_amsdu(struct iwx_softc *sc, mbuf_t m, const struct ether_header *eh,
+             int tid, mbuf_t *held, int *nframes)
+{
+    struct ieee80211com *ic = &sc->sc_ic;
+    struct _ifnet *ifp = &ic->ic_if;
+    struct ether_header *eh1;
+    mbuf_t m1;
+    u_int maxlen;
+
+    maxlen = MIN(sc->sc_amsdu_size, ieee80211_amsdu_maxlen(ic->ic_bss));
+    *nframes = 1;
+
+    while (*nframes < IWX_TX_AMSDU_MAXFRAMES) {
+        m1 = ifq_dequeue(&ifp->if_snd);
+        if (m1 == NULL)
+            break;
+        if (mbuf_len(m1) < sizeof(*eh1) &&
+            mbuf_pullup(&m1, sizeof(*eh1)) != 0) {
+            ifp->netStat->outputErrors++;
+            continue;
+        }
+        eh1 = mtod(m1, struct ether_header *);
+        /* Worst case: 3 bytes of padding plus the LLC header. */
+        if (!IEEE80211_ADDR_EQ(eh1->ether_dhost, eh->ether_dhost) ||
+            !IEEE80211_ADDR_EQ(eh1->ether_shost, eh->ether_shost) ||
+            ieee80211_amsdu_tid(ic, ic->ic_bss, m1) != tid ||
+            mbuf_pkthdr_len(m) + ETHER_HDR_LEN + 3 + LLC_SNAPFRAMELEN +
+            mbuf_pkthdr_len(m1) - sizeof(struct ieee80211_qosframe) >
+            maxlen) {
+            *held = m1;
+            break;
+        }
+        if (*nframes == 1) {
+            if ((m = ieee80211_amsdu_encap(ic, m, eh)) == NULL) {
+                *held = m1;
+                return NULL;
+            }
+        }
+#if NBPFILTER > 0
+        if (ifp->if_bpf != NULL)
+            bpf_mtap(ifp->if_bpf, m1, BPF_DIRECTION_OUT);
+#endif
+        if (ieee80211_amsdu_append(ic, m, m1) != 0) {
+            ifp->netStat->outputErrors++;
+            break;
+        }
+        (*nframes)++;
+    }
+
+    if (*nframes > 1) {
+        sc->sc_tx_amsdu++;
+        sc->sc_tx_amsdu_subframes += *nframes;
+        DPRINTFN(3, ("%s: tid=%d nframes=%d len=%zu\n", __func__, tid,
+            *nframes, mbuf_pkthdr_len(m)));
+    }
+    return m;
+}
+
 void ItlIwx::
 iwx_start(struct _ifnet *ifp)
 {
     struct iwx_softc *sc = (struct iwx_softc*)ifp->if_softc;
     ItlIwx *that = container_of(sc, ItlIwx, com);
-    that->getMainCommandGate()->attemptAction(_iwx_start_task, &that->com.sc_ic.ic_ac.ac_if);
+    /*
+     * Never block the caller on the gate: if it is busy, the kick runs
+     * as soon as the gate is released, see deferStart().
+     */
+    if (that->getMainCommandGate()->attemptAction(_iwx_start_task, &that->com.sc_ic.ic_ac.ac_if) == kIOReturnCannotLock)
+        that->deferStart(ifp);
 }
 
 void ItlIwx::
@@ -10401,6 +10557,7 @@ iwx_stop(struct _ifnet *ifp)
     sc->sc_flags &= ~IWX_FLAG_HW_ERR;
     sc->sc_flags &= ~IWX_FLAG_SHUTDOWN;
     sc->sc_flags &= ~IWX_FLAG_TXFLUSH;
+    sc->sc_flags &= ~IWX_FLAG_FW_RESTART;
 
     sc->sc_rx_ba_sessions = 0;
     sc->ba_rx.start_tidmask = 0;
@@ -10442,14 +10599,17 @@ iwx_watchdog(struct _ifnet *ifp)
                       "queued=%-3d\n",
                       i, ring->qid, ring->cur, ring->queued);
             }
-            XYLog("  rx ring: cur=%d\n", sc->rxq.cur);
+            for (i = 0; i < sc->sc_num_rx_queues; i++)
+                XYLog("  rx ring %d: cur=%d\n", i, sc->rxq[i].cur);
             XYLog("  802.11 state %s\n",
                   ieee80211_state_name[sc->sc_ic.ic_state]);
 
             that->iwx_nic_error(sc);
 #endif
-            if ((sc->sc_flags & IWX_FLAG_SHUTDOWN) == 0)
+            if ((sc->sc_flags & IWX_FLAG_SHUTDOWN) == 0) {
+                sc->sc_flags |= IWX_FLAG_FW_RESTART;
                 task_add(systq, &sc->init_task);
+            }
             ifp->netStat->outputErrors++;
             return;
         }
@@ -10808,7 +10968,8 @@ struct iwl_pnvm_init_complete_ntfy {
 } __packed; /* PNVM_INIT_COMPLETE_NTFY_S_VER_1 */
 
 void ItlIwx::
-iwx_rx_pkt(struct iwx_softc *sc, struct iwx_rx_data *data, struct mbuf_list *ml)
+iwx_rx_pkt(struct iwx_softc *sc, struct iwx_rx_ring *ring,
+           struct iwx_rx_data *data, struct mbuf_list *ml)
 {
     struct _ifnet *ifp = IC2IFP(&sc->sc_ic);
     struct iwx_rx_packet *pkt, *nextpkt;
@@ -10816,6 +10977,8 @@ iwx_rx_pkt(struct iwx_softc *sc, struct iwx_rx_data *data, struct mbuf_list *ml)
     mbuf_t m0, m;
     const size_t minsz = sizeof(pkt->len_n_flags) + sizeof(pkt->hdr);
     int qid, idx, code, handled = 1;
+    /* RSS queue buffers were already replaced on the ring, see iwx_intr_rxq(). */
+    int detached = ring->qid != 0;
     
     //    bus_dmamap_sync(sc->sc_dmat, data->map, 0, IWX_RBUF_SIZE,
     //        BUS_DMASYNC_POSTREAD);
@@ -10850,9 +11013,9 @@ iwx_rx_pkt(struct iwx_softc *sc, struct iwx_rx_data *data, struct mbuf_list *ml)
         if (len < minsz || len > (IWX_RBUF_SIZE - offset))
             break;
         
-        if (code == IWX_REPLY_RX_MPDU_CMD && ++nmpdu == 1) {
+        if (code == IWX_REPLY_RX_MPDU_CMD && ++nmpdu == 1 && !detached) {
             /* Take mbuf m0 off the RX ring. */
-            if (iwx_rx_addbuf(sc, IWX_RBUF_SIZE, sc->rxq.cur)) {
+            if (iwx_rx_addbuf(sc, ring, IWX_RBUF_SIZE, ring->cur)) {
                 ifp->netStat->inputErrors++;
                 break;
             }
@@ -10875,7 +11038,7 @@ iwx_rx_pkt(struct iwx_softc *sc, struct iwx_rx_data *data, struct mbuf_list *ml)
                     /* No need to copy last frame in buffer. */
                     if (offset > 0)
                         mbuf_adj(m0, offset);
-                    iwx_rx_mpdu_mq(sc, m0, pkt->data, maxlen, ml);
+                    iwx_rx_mpdu_mq(sc, m0, pkt->data, maxlen, ring->qid, ml);
                     m0 = NULL; /* stack owns m0 now; abort loop */
                 } else {
                     /*
@@ -10891,7 +11054,7 @@ iwx_rx_pkt(struct iwx_softc *sc, struct iwx_rx_data *data, struct mbuf_list *ml)
                         break;
                     }
                     mbuf_adj(m, offset);
-                    iwx_rx_mpdu_mq(sc, m, pkt->data, maxlen, ml);
+                    iwx_rx_mpdu_mq(sc, m, pkt->data, maxlen, ring->qid, ml);
                 }
                 break;
             }
@@ -11194,7 +11357,8 @@ iwx_rx_pkt(struct iwx_softc *sc, struct iwx_rx_data *data, struct mbuf_list *ml)
                     break;
                 }
                 
-                iwx_release_frames(sc, sc->sc_ic.ic_bss, baid_data, &baid_data->reorder_buf, nssn, ml);
+                iwx_release_frames(sc, sc->sc_ic.ic_bss, baid_data,
+                                   &baid_data->reorder_buf[ring->qid], nssn, ml);
                 
                 break;
             }
@@ -11225,29 +11389,29 @@ iwx_rx_pkt(struct iwx_softc *sc, struct iwx_rx_data *data, struct mbuf_list *ml)
             break;
     }
     
-    if (m0 && m0 != data->m && mbuf_type(m0) != MBUF_TYPE_FREE)
+    if (m0 && (detached || m0 != data->m) && mbuf_type(m0) != MBUF_TYPE_FREE)
         mbuf_freem(m0);
 }
 
 void ItlIwx::
-iwx_notif_intr(struct iwx_softc *sc)
+iwx_notif_intr(struct iwx_softc *sc, struct iwx_rx_ring *ring)
 {
     struct mbuf_list ml = MBUF_LIST_INITIALIZER();
     uint16_t hw;
     
-    //    bus_dmamap_sync(sc->sc_dmat, sc->rxq.stat_dma.map,
-    //        0, sc->rxq.stat_dma.size, BUS_DMASYNC_POSTREAD);
+    //    bus_dmamap_sync(sc->sc_dmat, ring->stat_dma.map,
+    //        0, ring->stat_dma.size, BUS_DMASYNC_POSTREAD);
     
     if (sc->sc_device_family >= IWX_DEVICE_FAMILY_AX210)
-        hw = le16toh(*(uint16_t *)(sc->rxq.stat)) & 0xfff;
+        hw = le16toh(*(uint16_t *)(ring->stat)) & 0xfff;
     else
-        hw = le16toh(((struct iwx_rb_status *)sc->rxq.stat)->closed_rb_num) & 0xfff;
+        hw = le16toh(((struct iwx_rb_status *)ring->stat)->closed_rb_num) & 0xfff;
     hw &= (IWX_RX_MQ_RING_COUNT - 1);
-    DPRINTFN(3, ("%s hw=%d\n", __FUNCTION__, hw));
-    while (sc->rxq.cur != hw) {
-        struct iwx_rx_data *data = &sc->rxq.data[sc->rxq.cur];
-        iwx_rx_pkt(sc, data, &ml);
-        sc->rxq.cur = (sc->rxq.cur + 1) % IWX_RX_MQ_RING_COUNT;
+    DPRINTFN(3, ("%s qid=%d hw=%d\n", __FUNCTION__, ring->qid, hw));
+    while (ring->cur != hw) {
+        struct iwx_rx_data *data = &ring->data[ring->cur];
+        iwx_rx_pkt(sc, ring, data, &ml);
+        ring->cur = (ring->cur + 1) % IWX_RX_MQ_RING_COUNT;
     }
     if_input(&sc->sc_ic.ic_if, &ml);
     
@@ -11256,7 +11420,7 @@ iwx_notif_intr(struct iwx_softc *sc)
      * Seems like the hardware gets upset unless we align the write by 8??
      */
     hw = (hw == 0) ? IWX_RX_MQ_RING_COUNT - 1 : hw - 1;
-    IWX_WRITE(sc, IWX_RFH_Q0_FRBDCB_WIDX_TRG, hw & ~7);
+    iwx_update_rx_widx(sc, ring, hw & ~7);
 }
 
 int ItlIwx::
@@ -11314,7 +11478,7 @@ iwx_intr(OSObject *object, IOInterruptEventSource* sender, int count)
         
         /* Firmware has now configured the RFH. */
         for (i = 0; i < IWX_RX_MQ_RING_COUNT; i++)
-            that->iwx_update_rx_desc(sc, &sc->rxq, i);
+            that->iwx_update_rx_desc(sc, &sc->rxq[0], i);
         IWX_WRITE(sc, IWX_RFH_Q0_FRBDCB_WIDX_TRG, 8);
     }
     
@@ -11343,14 +11507,17 @@ iwx_intr(OSObject *object, IOInterruptEventSource* sender, int count)
                   "queued=%-3d\n",
                   i, ring->qid, ring->cur, ring->queued);
         }
-        XYLog("  rx ring: cur=%d\n", sc->rxq.cur);
+        for (i = 0; i < sc->sc_num_rx_queues; i++)
+            XYLog("  rx ring %d: cur=%d\n", i, sc->rxq[i].cur);
         XYLog("  802.11 state %s\n",
               ieee80211_state_name[sc->sc_ic.ic_state]);
 #endif
         
         XYLog("%s: fatal firmware error\n", DEVNAME(sc));
-        if ((sc->sc_flags & IWX_FLAG_SHUTDOWN) == 0)
+        if ((sc->sc_flags & IWX_FLAG_SHUTDOWN) == 0) {
+            sc->sc_flags |= IWX_FLAG_FW_RESTART;
             task_add(systq, &sc->init_task);
+        }
         rv = 1;
         goto out;
         
@@ -11401,7 +11568,7 @@ iwx_intr(OSObject *object, IOInterruptEventSource* sender, int count)
             IWX_WRITE_1(sc, IWX_CSR_INT_PERIODIC_REG,
                         IWX_CSR_INT_PERIODIC_ENA);
         
-        that->iwx_notif_intr(sc);
+        that->iwx_notif_intr(sc, &sc->rxq[0]);
     }
     
     rv = 1;
@@ -11428,9 +11595,10 @@ iwx_intr_msix(OSObject *object, IOInterruptEventSource* sender, int count)
     inta_fh &= sc->sc_fh_mask;
     inta_hw &= sc->sc_hw_mask;
     
+    /* RSS queues have vectors of their own, see iwx_intr_rxq(). */
     if (inta_fh & IWX_MSIX_FH_INT_CAUSES_Q0 ||
-        inta_fh & IWX_MSIX_FH_INT_CAUSES_Q1) {
-        that->iwx_notif_intr(sc);
+        (sc->sc_num_rx_queues == 1 && inta_fh & IWX_MSIX_FH_INT_CAUSES_Q1)) {
+        that->iwx_notif_intr(sc, &sc->rxq[0]);
     }
     
     /* firmware chunk loaded */
@@ -11455,14 +11623,17 @@ iwx_intr_msix(OSObject *object, IOInterruptEventSource* sender, int count)
                   "queued=%-3d\n",
                   i, ring->qid, ring->cur, ring->queued);
         }
-        XYLog("  rx ring: cur=%d\n", sc->rxq.cur);
+        for (i = 0; i < sc->sc_num_rx_queues; i++)
+            XYLog("  rx ring %d: cur=%d\n", i, sc->rxq[i].cur);
         XYLog("  802.11 state %s\n",
               ieee80211_state_name[sc->sc_ic.ic_state]);
 #endif
         
         XYLog("%s: fatal firmware error\n", DEVNAME(sc));
-        if ((sc->sc_flags & IWX_FLAG_SHUTDOWN) == 0)
+        if ((sc->sc_flags & IWX_FLAG_SHUTDOWN) == 0) {
+            sc->sc_flags |= IWX_FLAG_FW_RESTART;
             task_add(systq, &sc->init_task);
+        }
         return 1;
     }
     
@@ -11481,12 +11652,14 @@ iwx_intr_msix(OSObject *object, IOInterruptEventSource* sender, int count)
     }
     
     if (inta_hw & IWX_MSIX_HW_INT_CAUSES_REG_ALIVE) {
-        int i;
+        int i, qid;
         
         /* Firmware has now configured the RFH. */
-        for (i = 0; i < IWX_RX_MQ_RING_COUNT; i++)
-            that->iwx_update_rx_desc(sc, &sc->rxq, i);
-        IWX_WRITE(sc, IWX_RFH_Q0_FRBDCB_WIDX_TRG, 8);
+        for (qid = 0; qid < sc->sc_num_rx_queues; qid++) {
+            for (i = 0; i < IWX_RX_MQ_RING_COUNT; i++)
+                that->iwx_update_rx_desc(sc, &sc->rxq[qid], i);
+            that->iwx_update_rx_widx(sc, &sc->rxq[qid], 8);
+        }
     }
     
     /*
@@ -11501,6 +11674,99 @@ iwx_intr_msix(OSObject *object, IOInterruptEventSource* sender, int count)
     return 1;
 }
 
+/*
+ * Interrupt handler of an RSS queue vector, run on the queue's own work
+ * loop. It takes the closed buffers off the ring and gives the ring fresh
+ * ones (mbuf allocation and DMA mapping), so queues refill in parallel.
+ * Parsing, reordering and net80211 input are not reentrant and are left
+ * to iwx_rxq_deliver() on the driver work loop. The queue cause is cleared automatically by
+ * hardware, so the vector can be unmasked as soon as the ring is done.
+ */
+int ItlIwx::
+iwx_intr_rxq(OSObject *object, IOInterruptEventSource* sender, int count)
+{
+    ItlIwx *that = (ItlIwx*)object;
+    struct iwx_softc *sc = &that->com;
+    struct mbuf_list ml = MBUF_LIST_INITIALIZER();
+    struct iwx_rx_ring *ring;
+    uint32_t errs = 0;
+    uint16_t hw;
+    mbuf_t m;
+    int qid;
+    
+    for (qid = 1; qid < sc->sc_num_rx_queues; qid++) {
+        if (sc->sc_rxq_ih[qid] == sender)
+            break;
+    }
+    if (qid == sc->sc_num_rx_queues)
+        return 0;
+    ring = &sc->rxq[qid];
+    
+    if (sc->sc_device_family >= IWX_DEVICE_FAMILY_AX210)
+        hw = le16toh(*(uint16_t *)(ring->stat)) & 0xfff;
+    else
+        hw = le16toh(((struct iwx_rb_status *)ring->stat)->closed_rb_num) & 0xfff;
+    hw &= (IWX_RX_MQ_RING_COUNT - 1);
+    while (ring->cur != hw) {
+        m = ring->data[ring->cur].m;
+        /* Without a replacement the buffer stays and its frames are lost. */
+        if (that->iwx_rx_addbuf(sc, ring, IWX_RBUF_SIZE, ring->cur) == 0)
+            ml_enqueue(&ml, m);
+        else
+            errs++;
+        ring->cur = (ring->cur + 1) % IWX_RX_MQ_RING_COUNT;
+    }
+    hw = (hw == 0) ? IWX_RX_MQ_RING_COUNT - 1 : hw - 1;
+    that->iwx_update_rx_widx(sc, ring, hw & ~7);
+    
+    if (!ml_empty(&ml) || errs) {
+        IOSimpleLockLock(ring->pending_lock);
+        ml_enlist(&ring->pending, &ml);
+        ring->pending_errs += errs;
+        IOSimpleLockUnlock(ring->pending_lock);
+        sc->sc_rxq_deliver->interruptOccurred(NULL, NULL, 0);
+    }
+    
+    IWX_WRITE(sc, IWX_CSR_MSIX_AUTOMASK_ST_AD, 1 << qid);
+    return 1;
+}
+
+/*
+ * Process the buffers the RSS queues took off their rings. Runs on the
+ * driver work loop, like the default queue, so net80211 stays single
+ * threaded; each queue keeps its own reorder and duplicate state.
+ */
+int ItlIwx::
+iwx_rxq_deliver(OSObject *object, IOInterruptEventSource* sender, int count)
+{
+    ItlIwx *that = (ItlIwx*)object;
+    struct iwx_softc *sc = &that->com;
+    struct _ifnet *ifp = IC2IFP(&sc->sc_ic);
+    struct mbuf_list ml = MBUF_LIST_INITIALIZER();
+    struct mbuf_list bufs;
+    struct iwx_rx_data rbuf;
+    struct iwx_rx_ring *ring;
+    uint32_t errs;
+    int qid;
+    
+    for (qid = 1; qid < sc->sc_num_rx_queues; qid++) {
+        ring = &sc->rxq[qid];
+        IOSimpleLockLock(ring->pending_lock);
+        bufs = ring->pending;
+        ml_init(&ring->pending);
+        errs = ring->pending_errs;
+        ring->pending_errs = 0;
+        IOSimpleLockUnlock(ring->pending_lock);
+        
+        ifp->netStat->inputErrors += errs;
+        memset(&rbuf, 0, sizeof(rbuf));
+        while ((rbuf.m = ml_dequeue(&bufs)) != NULL)
+            that->iwx_rx_pkt(sc, ring, &rbuf, &ml);
+    }
+    if_input(ifp, &ml);
+    return 1;
+}
+
 #define PCI_VENDOR_INTEL 0x8086
 
 #define IWL_PCI_DEVICE(dev, subdev, cfg) \
@@ -12790,7 +13056,8 @@ iwx_attach(struct iwx_softc *sc, struct pci_attach_args *pa)
     struct ieee80211com *ic = &sc->sc_ic;
     struct _ifnet *ifp = &ic->ic_if;
     int err;
-    int txq_i, i, j;
+    int txq_i, i, j, qid;
+    int boot_value = 0;
     
     sc->sc_pct = pa->pa_pc;
     sc->sc_pcitag = pa->pa_tag;
@@ -12878,6 +13145,63 @@ iwx_attach(struct iwx_softc *sc, struct pci_attach_args *pa)
     }
     sc->sc_ih->enable();
     
+    /*
+     * Give each RSS queue an MSI-X vector and a work loop of its own.
+     * Receive side scaling stays off unless at least one more vector is
+     * available. Buffers the queues take off their rings are processed
+     * on the driver work loop through sc_rxq_deliver.
+     */
+    sc->sc_num_rx_queues = 1;
+    if (sc->sc_msix &&
+        !PE_parse_boot_argn("-iwxnorss", &boot_value, sizeof(boot_value))) {
+        sc->sc_rxq_deliver = IOInterruptEventSource::interruptEventSource(this,
+                                                                           (IOInterruptEventSource::Action)&ItlIwx::iwx_rxq_deliver);
+        if (sc->sc_rxq_deliver != NULL &&
+            pa->workloop->addEventSource(sc->sc_rxq_deliver) != kIOReturnSuccess) {
+            sc->sc_rxq_deliver->release();
+            sc->sc_rxq_deliver = NULL;
+        }
+        for (i = 1; sc->sc_rxq_deliver != NULL && i < IWX_MAX_RX_QUEUES; i++) {
+            IOInterruptEventSource *ih;
+            IOWorkLoop *wl;
+            int interruptType;
+            
+            if (pa->pa_tag->getInterruptType(msiIntrIndex + i,
+                                             &interruptType) != kIOReturnSuccess ||
+                !(interruptType & kIOInterruptTypePCIMessaged))
+                break;
+            sc->rxq[i].pending_lock = IOSimpleLockAlloc();
+            if (sc->rxq[i].pending_lock == NULL)
+                break;
+            ml_init(&sc->rxq[i].pending);
+            wl = IOWorkLoop::workLoop();
+            if (wl == NULL)
+                break;
+            ih = IOFilterInterruptEventSource::filterInterruptEventSource(this,
+                                                                          (IOInterruptEventSource::Action)&ItlIwx::iwx_intr_rxq,
+                                                                          &ItlIwx::intrFilter
+                                                                          ,pa->pa_tag, msiIntrIndex + i);
+            if (ih == NULL) {
+                wl->release();
+                break;
+            }
+            if (wl->addEventSource(ih) != kIOReturnSuccess) {
+                ih->release();
+                wl->release();
+                break;
+            }
+            sc->sc_rxq_wl[i] = wl;
+            sc->sc_rxq_ih[i] = ih;
+            sc->sc_num_rx_queues++;
+            ih->enable();
+        }
+        if (sc->sc_rxq_deliver != NULL)
+            sc->sc_rxq_deliver->enable();
+    }
+    if (sc->sc_num_rx_queues > 1)
+        XYLog("%s: using %d RSS queues\n", DEVNAME(sc),
+              sc->sc_num_rx_queues - 1);
+    
     /* Clear pending interrupts. */
     IWX_WRITE(sc, IWX_CSR_INT_MASK, 0);
     IWX_WRITE(sc, IWX_CSR_INT, ~0);
@@ -13020,10 +13344,26 @@ iwx_attach(struct iwx_softc *sc, struct pci_attach_args *pa)
         }
     }
     
-    err = iwx_alloc_rx_ring(sc, &sc->rxq);
-    if (err) {
-        XYLog("%s: could not allocate RX ring\n", DEVNAME(sc));
-        goto fail4;
+    for (i = 0; i < sc->sc_num_rx_queues; i++) {
+        err = iwx_alloc_rx_ring(sc, &sc->rxq[i], i);
+        if (err) {
+            XYLog("%s: could not allocate RX ring %d\n", DEVNAME(sc), i);
+            goto fail4;
+        }
+    }
+    
+    /* Each RSS queue keeps its own reorder window per BA session. */
+    for (i = 0; i < nitems(sc->sc_rxba_data) && sc->sc_num_rx_queues > 1; i++) {
+        struct iwx_rxba_data *rxba = &sc->sc_rxba_data[i];
+        
+        rxba->rss_entries = (struct iwx_reorder_buf_entry *)
+        malloc((sc->sc_num_rx_queues - 1) * IEEE80211_BA_MAX_WINSZ *
+               sizeof(*rxba->rss_entries), 0, 0);
+        if (rxba->rss_entries == NULL) {
+            XYLog("%s: could not allocate RSS reorder buffers\n",
+                  DEVNAME(sc));
+            goto fail4;
+        }
     }
     
     taskq_init();
@@ -13090,12 +13430,25 @@ iwx_attach(struct iwx_softc *sc, struct pci_attach_args *pa)
         rxba->sc = sc;
         timeout_set(&rxba->session_timer, iwx_rx_ba_session_expired,
                     rxba);
-        timeout_set(&rxba->reorder_buf.reorder_timer,
-                    iwx_reorder_timer_expired, &rxba->reorder_buf);
-        for (j = 0; j < nitems(rxba->entries); j++)
-        ml_init(&rxba->entries[j].frames);
+        for (qid = 0; qid < sc->sc_num_rx_queues; qid++) {
+            struct iwx_reorder_buffer *buf = &rxba->reorder_buf[qid];
+            
+            buf->queue = qid;
+            buf->entries = qid == 0 ? &rxba->entries[0] :
+            &rxba->rss_entries[(qid - 1) * IEEE80211_BA_MAX_WINSZ];
+            timeout_set(&buf->reorder_timer,
+                        iwx_reorder_timer_expired, buf);
+            for (j = 0; j < IEEE80211_BA_MAX_WINSZ; j++)
+            ml_init(&buf->entries[j].frames);
+        }
     }
     task_set(&sc->init_task, iwx_init_task, sc, "iwx_init_task");
+    if (PE_parse_boot_argn("iwxfwfault", &sc->sc_fw_fault_sec,
+                           sizeof(sc->sc_fw_fault_sec)) &&
+        sc->sc_fw_fault_sec > 0) {
+        timeout_set(&sc->sc_fw_fault_to, iwx_fw_fault_inject, sc);
+        timeout_add_sec(&sc->sc_fw_fault_to, sc->sc_fw_fault_sec);
+    }
     task_set(&sc->newstate_task, iwx_newstate_task, sc, "iwx_newstate_task");
     task_set(&sc->ba_task, iwx_ba_task, sc, "iwx_ba_task");
     task_set(&sc->mac_ctxt_task, iwx_mac_ctxt_task, sc, "iwx_mac_ctxt_task");
@@ -13136,7 +13489,8 @@ fail5:
     }
 fail4:    while (--txq_i >= 0)
     iwx_free_tx_ring(sc, &sc->txq[txq_i]);
-    iwx_free_rx_ring(sc, &sc->rxq);
+    for (i = 0; i < sc->sc_num_rx_queues; i++)
+        iwx_free_rx_ring(sc, &sc->rxq[i]);
 fail3:    if (sc->ict_dma.vaddr != NULL)
     iwx_dma_contig_free(&sc->ict_dma);
 
@@ -13161,6 +13515,199 @@ iwx_radiotap_attach(struct iwx_softc *sc)
 }
 #endif
 
+/*
+ * Bring firmware back after an assert or a Tx timeout without leaving
+ * RUN state. The association lives on in net80211 (ic_bss, its keys and
+ * BA agreements), so instead of iwx_stop() + iwx_init(), which deauths
+ * and rescans, reload firmware and replay the MAC, PHY, binding and
+ * station contexts, rate scaling, CCMP keys and BA sessions from there.
+ * Falls back to a full reset if firmware keeps dying.
+ */
+int ItlIwx::
+iwx_fast_restart(struct iwx_softc *sc)
+{
+    struct ieee80211com *ic = &sc->sc_ic;
+    struct _ifnet *ifp = IC2IFP(ic);
+    struct iwx_node *in = (struct iwx_node *)ic->ic_bss;
+    struct ieee80211_node *ni = &in->in_ni;
+    struct ieee80211_tx_ba *txba;
+    struct ieee80211_rx_ba *rxba;
+    struct timeval now, done;
+    int err, i, tid, qid;
+    
+    getmicrouptime(&now);
+    if (sc->sc_fw_restarts != 0 &&
+        now.tv_sec - sc->sc_fw_restart_last.tv_sec < IWX_FW_RESTART_HOLDOFF)
+        return EBUSY;
+    sc->sc_fw_restart_last = now;
+    sc->sc_fw_restarts++;
+    XYLog("%s: restarting firmware, keeping association (%u)\n",
+          DEVNAME(sc), sc->sc_fw_restarts);
+    
+    iwx_del_task(sc, systq, &sc->ba_task);
+    iwx_del_task(sc, systq, &sc->mac_ctxt_task);
+    iwx_del_task(sc, systq, &sc->chan_ctxt_task);
+    
+    iwx_stop_device(sc);
+    
+    sc->sc_generation++;
+    for (i = 0; i < nitems(sc->sc_cmd_resp_pkt); i++) {
+        ::free(sc->sc_cmd_resp_pkt[i]);
+        sc->sc_cmd_resp_pkt[i] = NULL;
+        sc->sc_cmd_resp_len[i] = 0;
+    }
+    ifp->if_timer = sc->sc_tx_timer = 0;
+    sc->sc_flags &= ~(IWX_FLAG_SCANNING | IWX_FLAG_BGSCAN |
+                      IWX_FLAG_MAC_ACTIVE | IWX_FLAG_BINDING_ACTIVE |
+                      IWX_FLAG_STA_ACTIVE | IWX_FLAG_TE_ACTIVE |
+                      IWX_FLAG_TXFLUSH);
+    
+    /* ADDBA exchanges in flight are lost with the firmware. */
+    for (tid = 0; tid < IWX_MAX_TID_COUNT; tid++) {
+        if (sc->ba_rx.start_tidmask & (1 << tid))
+            ieee80211_addba_req_refuse(ic, ni, tid);
+        if (sc->ba_tx.start_tidmask & (1 << tid))
+            ieee80211_addba_resp_refuse(ic, ni, tid,
+                                        IEEE80211_STATUS_UNSPECIFIED);
+    }
+    sc->ba_rx.start_tidmask = sc->ba_rx.stop_tidmask = 0;
+    sc->ba_tx.start_tidmask = sc->ba_tx.stop_tidmask = 0;
+    sc->sc_rx_ba_sessions = 0;
+    /*
+     * iwx_sta_rx_agg() took the inactivity timeout of each session over
+     * from net80211; hand it back for the replay below. Clearing a
+     * reorder buffer frees its timers, so set them up again.
+     */
+    for (i = 0; i < nitems(sc->sc_rxba_data); i++) {
+        struct iwx_rxba_data *rxd = &sc->sc_rxba_data[i];
+        
+        if (rxd->baid != IWX_RX_REORDER_DATA_INVALID_BAID &&
+            rxd->tid < IWX_MAX_TID_COUNT)
+            ni->ni_rx_ba[rxd->tid].ba_timeout_val = rxd->timeout;
+        iwx_clear_reorder_buffer(sc, rxd);
+        timeout_set(&rxd->session_timer, iwx_rx_ba_session_expired, rxd);
+        for (qid = 0; qid < sc->sc_num_rx_queues; qid++)
+            timeout_set(&rxd->reorder_buf[qid].reorder_timer,
+                        iwx_reorder_timer_expired, &rxd->reorder_buf[qid]);
+    }
+    for (i = 0; i < ARRAY_SIZE(sc->sc_tid_data); i++)
+        sc->sc_tid_data[i].qid = IWX_INVALID_QUEUE;
+    
+    err = iwx_init_hw(sc);
+    if (err)
+        return err;
+    
+    err = iwx_phy_ctxt_update(sc, &sc->sc_phyctxt[0], ni->ni_chan, 1, 1, 0);
+    if (err)
+        return err;
+    in->in_phyctxt = &sc->sc_phyctxt[0];
+    
+    err = iwx_mac_ctxt_cmd(sc, in, IWX_FW_CTXT_ACTION_ADD, 0);
+    if (err)
+        return err;
+    sc->sc_flags |= IWX_FLAG_MAC_ACTIVE;
+    
+    err = iwx_binding_cmd(sc, in, IWX_FW_CTXT_ACTION_ADD);
+    if (err)
+        return err;
+    sc->sc_flags |= IWX_FLAG_BINDING_ACTIVE;
+    
+    err = iwx_add_sta_cmd(sc, in, 0);
+    if (err)
+        return err;
+    
+    err = iwx_enable_mgmt_queue(sc);
+    if (err)
+        return err;
+    
+    /* Associated MAC, station update, power and rate scaling. */
+    err = iwx_run(sc);
+    if (err)
+        return err;
+    
+    /*
+     * Hardware keys only; software crypto state is untouched. The Tx PN
+     * counts every CCMP frame handed to firmware so it never goes back.
+     */
+    if ((ni->ni_flags & IEEE80211_NODE_TXRXPROT) &&
+        ni->ni_pairwise_key.k_cipher == IEEE80211_CIPHER_CCMP)
+        iwx_set_key(ic, ni, &ni->ni_pairwise_key);
+    for (i = 0; i < IEEE80211_GROUP_NKID; i++) {
+        struct ieee80211_key *k = &ic->ic_nw_keys[i];
+        
+        if (k->k_cipher == IEEE80211_CIPHER_CCMP)
+            iwx_set_key(ic, ni, k);
+    }
+    
+    for (tid = 0; tid < IWX_MAX_TID_COUNT; tid++) {
+        rxba = &ni->ni_rx_ba[tid];
+        if (rxba->ba_state == IEEE80211_BA_AGREED)
+            iwx_sta_rx_agg(sc, ni, tid, rxba->ba_winstart,
+                           rxba->ba_winsize, rxba->ba_timeout_val, 1);
+        
+        txba = &ni->ni_tx_ba[tid];
+        if (txba->ba_state != IEEE80211_BA_AGREED)
+            continue;
+        qid = -1;
+        if (iwx_nic_lock(sc)) {
+            qid = iwx_tvqm_alloc_txq(sc, tid, ni->ni_qos_txseqs[tid]);
+            iwx_nic_unlock(sc);
+        }
+        if (qid < 0) {
+            ieee80211_delba_request(ic, ni, IEEE80211_REASON_UNSPECIFIED,
+                                    1, tid);
+            continue;
+        }
+        /*
+         * The agreement still holds at the peer, whose reorder window
+         * follows our sequence numbers, so carry on from where they
+         * were; TVQM reclaim goes by the firmware's TFD index and does
+         * not need them to match the new ring. Frames that died with
+         * the old queue left a hole in the window; a BAR moves it on.
+         */
+        txba->ba_winstart = ni->ni_qos_txseqs[tid];
+        txba->ba_winend = (txba->ba_winstart + txba->ba_winsize - 1) & 0xfff;
+        ieee80211_tx_compressed_bar(ic, ni, tid, txba->ba_winstart);
+    }
+    sc->sc_flags &= ~IWX_FLAG_FW_RESTART;
+    
+    getmicrouptime(&done);
+    timersub(&done, &now, &done);
+    XYLog("%s: firmware restarted in %ld ms\n", DEVNAME(sc),
+          (long)(done.tv_sec * 1000 + done.tv_usec / 1000));
+    
+    ifq_clr_oactive(&ifp->if_snd);
+    (*ifp->if_start)(ifp);
+    return 0;
+}
+
+/*
+ * Fault injection for iwx_fast_restart(). With the iwxfwfault=<seconds>
+ * boot-arg, make firmware assert at that interval while associated, the
+ * way Linux's fw_restart debugfs knob does: firmware answers an unknown
+ * REPLY_ERROR command with a SYSASSERT, which goes down the same error
+ * interrupt path as a real crash.
+ */
+void ItlIwx::
+iwx_fw_fault_inject(void *arg)
+{
+    struct iwx_softc *sc = (struct iwx_softc *)arg;
+    struct ieee80211com *ic = &sc->sc_ic;
+    ItlIwx *that = container_of(sc, ItlIwx, com);
+    int s = splnet();
+    
+    if ((sc->sc_flags & (IWX_FLAG_SHUTDOWN | IWX_FLAG_FW_RESTART |
+                         IWX_FLAG_HW_ERR)) == 0 &&
+        ic->ic_state == IEEE80211_S_RUN) {
+        XYLog("%s: injecting firmware error\n", DEVNAME(sc));
+        that->iwx_send_cmd_pdu(sc, iwx_cmd_id(IWX_REPLY_ERROR,
+                                              IWX_LONG_GROUP, 0),
+                               IWX_CMD_ASYNC, 0, NULL);
+    }
+    timeout_add_sec(&sc->sc_fw_fault_to, sc->sc_fw_fault_sec);
+    splx(s);
+}
+
 void ItlIwx::
 iwx_init_task(void *arg1)
 {
@@ -13179,6 +13726,19 @@ iwx_init_task(void *arg1)
         return;
     }
     
+    if (!fatal && (sc->sc_flags & IWX_FLAG_FW_RESTART) &&
+        (ifp->if_flags & (IFF_UP | IFF_RUNNING)) == (IFF_UP | IFF_RUNNING) &&
+        sc->sc_ic.ic_opmode == IEEE80211_M_STA &&
+        sc->sc_ic.ic_state == IEEE80211_S_RUN) {
+        if (that->iwx_fast_restart(sc) == 0) {
+            splx(s);
+            return;
+        }
+        XYLog("%s: fast restart failed, resetting the interface\n",
+              DEVNAME(sc));
+    }
+    sc->sc_flags &= ~IWX_FLAG_FW_RESTART;
+    
     if (ifp->if_flags & IFF_RUNNING)
         that->iwx_stop(ifp);
     else
@@ -13225,6 +13785,7 @@ iwx_activate(struct iwx_softc *sc, int act)
     switch (act) {
         case DVACT_QUIESCE:
             if (ifp->if_flags & IFF_RUNNING) {
+                ieee80211_resume_save(&sc->sc_ic);
                 //            rw_enter_write(&sc->ioctl_rwl);
                 iwx_stop(ifp);
                 //            rw_exit(&sc->ioctl_rwl);
@@ -13238,6 +13799,7 @@ iwx_activate(struct iwx_softc *sc, int act)
             break;
         case DVACT_WAKEUP:
             /* Hardware should be up at this point. */
+            ieee80211_resume_wakeup(&sc->sc_ic);
             if (iwx_set_hw_ready(sc))
                 task_add(systq, &sc->init_task);
             break;
@@ -140,6 +140,7 @@
 #include <HAL/ItlHalService.hpp>
 #include <HAL/ItlDriverInfo.hpp>
 #include <HAL/ItlDriverController.hpp>
+#include <HAL/ItlMvmReorder.hpp>
 
 class ItlIwx : public ItlHalService, ItlDriverInfo, ItlDriverController {
     OSDeclareDefaultStructors(ItlIwx)
@@ -174,6 +175,8 @@ public:
     
     virtual UInt32 supportedFeatures() override;
 
+    virtual UInt32 supportedChecksums(bool isOutput) override;
+
     virtual const char *getFirmwareCountryCode() override;
 
     virtual uint32_t getTxQueueSize() override;
@@ -238,7 +241,7 @@ public:
     int    iwx_dma_contig_alloc(bus_dma_tag_t, struct iwx_dma_info *, bus_size_t,
             bus_size_t);
     void    iwx_dma_contig_free(struct iwx_dma_info *);
-    int    iwx_alloc_rx_ring(struct iwx_softc *, struct iwx_rx_ring *);
+    int    iwx_alloc_rx_ring(struct iwx_softc *, struct iwx_rx_ring *, int);
     void    iwx_disable_rx_dma(struct iwx_softc *);
     void    iwx_reset_rx_ring(struct iwx_softc *, struct iwx_rx_ring *);
     void    iwx_free_rx_ring(struct iwx_softc *, struct iwx_rx_ring *);
@@ -304,6 +307,8 @@ public:
     static void    iwx_update_chw(struct ieee80211com *);
     void    iwx_sta_rx_agg(struct iwx_softc *, struct ieee80211_node *, uint8_t,
                            uint16_t, uint16_t, int, int);
+    void    iwx_rx_agg_refuse(struct iwx_softc *, struct ieee80211_node *,
+                              uint8_t);
     static int    iwx_ampdu_tx_start(struct ieee80211com *, struct ieee80211_node *,
             uint8_t);
     static void    iwx_ampdu_tx_stop(struct ieee80211com *, struct ieee80211_node *,
@@ -320,10 +325,14 @@ public:
     int    iwx_send_phy_cfg_cmd(struct iwx_softc *);
     int    iwx_load_ucode_wait_alive(struct iwx_softc *);
     int    iwx_send_dqa_cmd(struct iwx_softc *);
+    int    iwx_send_rfh_queue_cmd(struct iwx_softc *);
+    int    iwx_send_rss_cfg_cmd(struct iwx_softc *);
     int    iwx_run_init_mvm_ucode(struct iwx_softc *, int);
     int    iwx_config_ltr(struct iwx_softc *);
     void    iwx_update_rx_desc(struct iwx_softc *, struct iwx_rx_ring *, int);
-    int    iwx_rx_addbuf(struct iwx_softc *, int, int);
+    void    iwx_update_rx_widx(struct iwx_softc *, struct iwx_rx_ring *,
+            uint32_t);
+    int    iwx_rx_addbuf(struct iwx_softc *, struct iwx_rx_ring *, int, int);
     int    iwx_rxmq_get_signal_strength(struct iwx_softc *, struct iwx_rx_mpdu_desc *);
     void    iwx_rx_rx_phy_cmd(struct iwx_softc *, struct iwx_rx_packet *,
             struct iwx_rx_data *);
@@ -335,12 +344,13 @@ public:
     void    iwx_rx_frame(struct iwx_softc *, mbuf_t, int, uint32_t, int, int,
            uint32_t, struct ieee80211_rxinfo *, struct mbuf_list *);
     void iwx_rx_mpdu_mq(struct iwx_softc *sc, mbuf_t m, void *pktdata,
-                        size_t maxlen, struct mbuf_list *ml);
+                        size_t maxlen, int qid, struct mbuf_list *ml);
     void    iwx_rx_tx_cmd_single(struct iwx_softc *, struct iwx_rx_packet *,
             struct iwx_tx_data *);
     void iwx_txd_done(struct iwx_softc *sc, struct iwx_tx_data *txd);
     void iwx_clear_oactive(struct iwx_softc *sc, struct iwx_tx_ring *ring);
-    void iwx_ampdu_txq_advance(struct iwx_softc *sc, struct iwx_tx_ring *ring, int idx);
+    uint32_t iwx_ampdu_txq_advance(struct iwx_softc *sc, struct iwx_tx_ring *ring, int idx);
+    void iwx_tx_limit_done(struct iwx_softc *sc, struct iwx_tx_ring *ring, uint32_t done);
     void iwx_rx_tx_ba_notif(struct iwx_softc *sc, struct iwx_rx_packet *pkt, struct iwx_rx_data *data);
     void    iwx_rx_tx_cmd(struct iwx_softc *, struct iwx_rx_packet *,
             struct iwx_rx_data *);
@@ -368,7 +378,12 @@ public:
                             const struct iwx_rate *rinfo, int type, struct ieee80211_frame *wh);
     void    iwx_toggle_tx_ant(struct iwx_softc *sc, uint8_t *ant);
     void    iwx_tx_update_byte_tbl(struct iwx_softc *, struct iwx_tx_ring *, int, uint16_t, uint16_t);
+    void    iwx_rx_csum(struct iwx_softc *, mbuf_t, struct iwx_rx_mpdu_desc *);
     int    iwx_tx(struct iwx_softc *, mbuf_t, struct ieee80211_node *, int);
+    uint16_t    iwx_tx_offload_hdr(struct ieee80211_frame *, u_int);
+    uint16_t    iwx_tx_csum(struct iwx_softc *, mbuf_t, u_int, int);
+    mbuf_t    iwx_tx_amsdu(struct iwx_softc *, mbuf_t, const struct ether_header *,
+            int, mbuf_t *, int *);
     int    iwx_flush_sta_tids(struct iwx_softc *, int, uint16_t);
     int    iwx_flush_sta(struct iwx_softc *, struct iwx_node *);
     int    iwx_drain_sta(struct iwx_softc *sc, struct iwx_node *, int);
@@ -454,27 +469,28 @@ public:
     void    iwx_nic_umac_error(struct iwx_softc *);
     void    iwx_flip_address(uint8_t *);
     int    iwx_detect_duplicate(struct iwx_softc *, mbuf_t,
-            struct iwx_rx_mpdu_desc *, struct ieee80211_rxinfo *);
-    int    iwx_is_sn_less(uint16_t, uint16_t, uint16_t);
+            struct iwx_rx_mpdu_desc *, struct ieee80211_rxinfo *, int);
     void    iwx_release_frames(struct iwx_softc *, struct ieee80211_node *,
             struct iwx_rxba_data *, struct iwx_reorder_buffer *, uint16_t,
             struct mbuf_list *);
-    int    iwx_oldsn_workaround(struct iwx_softc *, struct ieee80211_node *,
-            int, struct iwx_reorder_buffer *, uint32_t, uint32_t);
     int    iwx_rx_reorder(struct iwx_softc *, mbuf_t, int,
             struct iwx_rx_mpdu_desc *, int, int, uint32_t,
-            struct ieee80211_rxinfo *, struct mbuf_list *);
+            struct ieee80211_rxinfo *, int, struct mbuf_list *);
     int    iwx_rx_pkt_valid(struct iwx_rx_packet *);
-    void    iwx_rx_pkt(struct iwx_softc *, struct iwx_rx_data *,
-            struct mbuf_list *);
-    void    iwx_notif_intr(struct iwx_softc *);
+    void    iwx_rx_pkt(struct iwx_softc *, struct iwx_rx_ring *,
+            struct iwx_rx_data *, struct mbuf_list *);
+    void    iwx_notif_intr(struct iwx_softc *, struct iwx_rx_ring *);
     static int    iwx_intr(OSObject *object, IOInterruptEventSource* sender, int count);
     static int    iwx_intr_msix(OSObject *object, IOInterruptEventSource* sender, int count);
+    static int    iwx_intr_rxq(OSObject *object, IOInterruptEventSource* sender, int count);
+    static int    iwx_rxq_deliver(OSObject *object, IOInterruptEventSource* sender, int count);
     static int    iwx_match(IOPCIDevice *);
     int    iwx_preinit(struct iwx_softc *);
     void    iwx_attach_hook(struct device *);
     bool    iwx_attach(struct iwx_softc *, struct pci_attach_args *);
+    int    iwx_fast_restart(struct iwx_softc *);
     static void    iwx_init_task(void *);
+    static void    iwx_fw_fault_inject(void *);
     int    iwx_activate(struct iwx_softc *, int);
     int    iwx_resume(struct iwx_softc *);
     
@@ -484,4 +500,74 @@ public:
     struct iwx_softc com;
 };
 
+/* Glue for the MVM RX re-ordering code shared with ItlIwm. */
+struct ItlIwxReorderTraits {
+    typedef ItlIwx hal_type;
+    typedef struct iwx_softc softc_type;
+    typedef struct iwx_node node_type;
+    typedef struct iwx_rxba_data rxba_type;
+    typedef struct iwx_reorder_buffer buffer_type;
+    typedef struct iwx_reorder_buf_entry entry_type;
+    typedef struct iwx_rx_mpdu_desc desc_type;
+    typedef struct iwx_rxq_dup_data dup_type;
+
+    static const uint8_t max_tid_count = IWX_MAX_TID_COUNT;
+    static const uint8_t station_id = IWX_STATION_ID;
+    static const uint8_t invalid_baid = IWX_RX_REORDER_DATA_INVALID_BAID;
+    static const unsigned int consec_drops_delba = IWX_AMPDU_CONSEC_DROPS_DELBA;
+    static const uint64_t reorder_timeout_usec = RX_REORDER_BUF_TIMEOUT_MQ_USEC;
+    static const uint8_t amsdu_subframe_idx_mask =
+        IWX_RX_MPDU_AMSDU_SUBFRAME_IDX_MASK;
+    static const uint8_t amsdu_last_subframe = IWX_RX_MPDU_AMSDU_LAST_SUBFRAME;
+    static const uint8_t mflg2_amsdu = IWX_RX_MPDU_MFLG2_AMSDU;
+    static const uint32_t reorder_baid_mask = IWX_RX_MPDU_REORDER_BAID_MASK;
+    static const uint32_t reorder_baid_shift = IWX_RX_MPDU_REORDER_BAID_SHIFT;
+    static const uint32_t reorder_nssn_mask = IWX_RX_MPDU_REORDER_NSSN_MASK;
+    static const uint32_t reorder_sn_mask = IWX_RX_MPDU_REORDER_SN_MASK;
+    static const uint32_t reorder_sn_shift = IWX_RX_MPDU_REORDER_SN_SHIFT;
+    static const uint32_t reorder_ba_old_sn = IWX_RX_MPDU_REORDER_BA_OLD_SN;
+
+    static void
+    rx_frame(hal_type *hal, softc_type *sc, mbuf_t m, int chanidx,
+             uint32_t rx_pkt_status, int is_shortpre, int rate_n_flags,
+             uint32_t device_timestamp, struct ieee80211_rxinfo *rxi,
+             struct mbuf_list *ml)
+    {
+        hal->iwx_rx_frame(sc, m, chanidx, rx_pkt_status, is_shortpre,
+                          rate_n_flags, device_timestamp, rxi, ml);
+    }
+
+    static rxba_type *
+    rxba_from_buf(buffer_type *buf)
+    {
+        return iwx_rxba_data_from_reorder_buf(buf);
+    }
+
+    static buffer_type *
+    rx_buffer(rxba_type *rxba, int queue)
+    {
+        return &rxba->reorder_buf[queue];
+    }
+
+    static entry_type *
+    rx_entries(rxba_type *rxba, buffer_type *buf)
+    {
+        return buf->entries;
+    }
+
+    static dup_type *
+    rx_dup_data(node_type *in, int queue)
+    {
+        return &in->dup_data[queue];
+    }
+
+    static hal_type *
+    hal_from_softc(softc_type *sc)
+    {
+        return container_of(sc, ItlIwx, com);
+    }
+};
+
+typedef ItlMvmReorder<ItlIwxReorderTraits> ItlIwxReorder;
+
 #endif
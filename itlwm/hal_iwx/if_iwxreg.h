@@ -1101,6 +1101,8 @@ enum iwx_fw_ini_allocation_id {
  * 11-8:  queue selector
  */
 #define IWX_HBUS_TARG_WRPTR         (IWX_HBUS_BASE+0x060)
+/* RX queue selector, AX210 and later */
+#define IWX_HBUS_TARG_WRPTR_RX_Q(q) (((q) + 512) << 16)
 
 /**********************************************************
  * CSR values
@@ -1144,6 +1146,7 @@ enum iwx_msix_fh_int_causes {
     IWX_MSIX_FH_INT_CAUSES_S2D        = (1 << 19),
     IWX_MSIX_FH_INT_CAUSES_FH_ERR        = (1 << 21),
 };
+#define IWX_MSIX_FH_INT_CAUSES_Q(q)        (1 << (q))
 
 /*
  * Causes for the HW register interrupts
@@ -1936,6 +1939,8 @@ struct iwx_tx_queue_cfg_rsp {
 
 #define IWX_MFUART_LOAD_NOTIFICATION    0xb1
 
+#define IWX_RSS_CONFIG_CMD    0xb3
+
 /* Power - new power table command */
 #define IWX_MAC_PM_POWER_TABLE    0xa9
 
@@ -2019,6 +2024,7 @@ struct iwx_tx_queue_cfg_rsp {
 
 /* DATA_PATH group subcommand IDs */
 #define IWX_DQA_ENABLE_CMD    0x00
+#define IWX_RFH_QUEUE_CONFIG_CMD    0x0d
 #define IWX_TLC_MNG_CONFIG_CMD    0x0f
 #define IWX_RX_NO_DATA_NOTIF    0xf5
 #define IWX_TLC_MNG_UPDATE_NOTIF 0xf7
@@ -2037,6 +2043,62 @@ struct iwx_dqa_enable_cmd {
     uint32_t cmd_queue;
 } __packed; /* DQA_CONTROL_CMD_API_S_VER_1 */
 
+/*
+ * struct iwx_rfh_queue_data - RX queue configuration
+ * @q_num: Q num
+ * @enable: enable queue
+ * @urbd_stts_wrptr: DMA address of urbd_stts_wrptr
+ * @fr_bd_cb: DMA address of freeRB table
+ * @ur_bd_cb: DMA address of used RB table
+ * @fr_bd_wid: Initial index of the free table
+ */
+struct iwx_rfh_queue_data {
+    uint8_t q_num;
+    uint8_t enable;
+    uint16_t reserved;
+    uint64_t urbd_stts_wrptr;
+    uint64_t fr_bd_cb;
+    uint64_t ur_bd_cb;
+    uint32_t fr_bd_wid;
+} __packed; /* RFH_QUEUE_CONFIG_S_VER_1 */
+
+/*
+ * struct iwx_rfh_queue_config - RX queue configuration
+ * @num_queues: number of queues configured
+ * @data: DMA addresses per-queue
+ */
+struct iwx_rfh_queue_config {
+    uint8_t num_queues;
+    uint8_t reserved[3];
+    struct iwx_rfh_queue_data data[];
+} __packed; /* RFH_QUEUE_CONFIG_API_S_VER_1 */
+
+#define IWX_RSS_HASH_TYPE_IPV4_TCP    0
+#define IWX_RSS_HASH_TYPE_IPV4_UDP    1
+#define IWX_RSS_HASH_TYPE_IPV4_PAYLOAD    2
+#define IWX_RSS_HASH_TYPE_IPV6_TCP    3
+#define IWX_RSS_HASH_TYPE_IPV6_UDP    4
+#define IWX_RSS_HASH_TYPE_IPV6_PAYLOAD    5
+
+#define IWX_RSS_ENABLE    1
+#define IWX_RSS_HASH_KEY_CNT    10
+#define IWX_RSS_INDIRECTION_TABLE_SIZE    128
+
+/*
+ * struct iwx_rss_config_cmd - RSS (Receive Side Scaling) configuration
+ * @flags: 1 - enable, 0 - disable
+ * @hash_mask: Type of RSS to use. Values are from IWX_RSS_HASH_TYPE_*
+ * @secret_key: 320 bit input of random key configuration from driver
+ * @indirection_table: indirection table
+ */
+struct iwx_rss_config_cmd {
+    uint32_t flags;
+    uint8_t hash_mask;
+    uint8_t reserved[3];
+    uint32_t secret_key[IWX_RSS_HASH_KEY_CNT];
+    uint8_t indirection_table[IWX_RSS_INDIRECTION_TABLE_SIZE];
+} __packed; /* RSS_CONFIG_CMD_API_S_VER_1 */
+
 struct iwx_sku_id {
     uint32_t data[3];
 } __packed; /* SKU_ID_API_S_VER_1 */
@@ -3618,6 +3680,29 @@ struct iwx_rx_mpdu_res_start {
 #define IWX_RX_MPDU_AMSDU_SUBFRAME_IDX_MASK    0x7f
 #define IWX_RX_MPDU_AMSDU_LAST_SUBFRAME        0x80
 
+#define IWX_RX_L3L4_IP_HDR_CSUM_OK        (1 << 0)
+#define IWX_RX_L3L4_TCP_UDP_CSUM_OK        (1 << 1)
+#define IWX_RX_L3L4_TCP_FIN_SYN_RST_PSH        (1 << 2)
+#define IWX_RX_L3L4_TCP_ACK            (1 << 3)
+#define IWX_RX_L3L4_L3_PROTO_MASK        (0xf << 4)
+#define IWX_RX_L3L4_L3_PROTO_SHIFT        4
+#define IWX_RX_L3L4_L4_PROTO_MASK        (0xf << 8)
+#define IWX_RX_L3L4_L4_PROTO_SHIFT        8
+#define IWX_RX_L3L4_RSS_HASH_MASK        (0xf << 12)
+
+#define IWX_RX_L3_TYPE_NONE            0
+#define IWX_RX_L3_TYPE_IPV4            1
+#define IWX_RX_L3_TYPE_IPV4_FRAG        2
+#define IWX_RX_L3_TYPE_IPV6_FRAG        3
+#define IWX_RX_L3_TYPE_IPV6            4
+#define IWX_RX_L3_TYPE_IPV6_IN_IPV4        5
+#define IWX_RX_L3_TYPE_ARP            6
+#define IWX_RX_L3_TYPE_EAPOL            7
+
+#define IWX_RX_L4_TYPE_NONE            0
+#define IWX_RX_L4_TYPE_UDP            1
+#define IWX_RX_L4_TYPE_TCP            2
+
 #define IWX_RX_MPDU_PHY_AMPDU            (1 << 5)
 #define IWX_RX_MPDU_PHY_AMPDU_TOGGLE        (1 << 6)
 #define IWX_RX_MPDU_PHY_SHORT_PREAMBLE        (1 << 7)
@@ -111,6 +111,8 @@
 #include <IOKit/network/IOMbufMemoryCursor.h>
 #include <IOKit/IODMACommand.h>
 
+#include <HAL/ItlTxLimit.hpp>
+
 #define IWL_CFG_ANY (~0)
 
 #define IWL_CFG_MAC_TYPE_PU        0x31
@@ -336,6 +338,7 @@ struct iwx_tx_data {
     int flags;
 #define IWX_TXDATA_FLAG_CMD_IS_NARROW  0x01
     uint8_t type;
+    uint32_t len;        /* frame length, for the ring byte limit */
 };
 
 struct iwx_tx_ring {
@@ -348,6 +351,7 @@ struct iwx_tx_ring {
     unsigned int    ring_count;
     unsigned int    hi_mark;
     unsigned int    low_mark;
+    struct itl_tx_limit lim;
 	int			qid;
 	int			queued;
 	int			cur;
@@ -363,6 +367,14 @@ struct iwx_rx_data {
 	bus_dmamap_t	map;
 };
 
+/*
+ * Queue 0 is the default queue which receives firmware notifications and
+ * everything RSS does not hash. Further queues are RSS queues, each with
+ * its own MSI-X vector. Every queue carries a full ring of receive
+ * buffers, so the count is kept small.
+ */
+#define IWX_MAX_RX_QUEUES	3
+
 struct iwx_rx_ring {
 	struct iwx_dma_info	free_desc_dma;
 	struct iwx_dma_info	stat_dma;
@@ -370,7 +382,12 @@ struct iwx_rx_ring {
 	void			*desc;
 	void	        *stat;
 	struct iwx_rx_data	data[IWX_RX_MQ_RING_COUNT];
+	int			qid;
 	int			cur;
+	/* RSS queues: buffers taken off the ring, not yet processed */
+	struct mbuf_list	pending;
+	uint32_t		pending_errs;
+	IOSimpleLock		*pending_lock;
 };
 
 #define IWX_FLAG_USE_ICT	0x01	/* using Interrupt Cause Table */
@@ -384,6 +401,8 @@ struct iwx_rx_ring {
 #define IWX_FLAG_SHUTDOWN	0x100	/* shutting down; new tasks forbidden */
 #define IWX_FLAG_BGSCAN		0x200	/* background scan in progress */
 #define IWX_FLAG_TXFLUSH    0x400   /* Tx queue flushing in progress */
+#define IWX_FLAG_RXCSUM     0x800   /* firmware reports Rx L3/L4 checksums */
+#define IWX_FLAG_FW_RESTART 0x1000  /* firmware died; restart keeps association */
 
 struct iwx_ucode_status {
 	uint32_t uc_lmac_error_event_table[2];
@@ -506,11 +525,13 @@ struct iwl_cfg {
  * @consec_oldsn_prev_drop: track whether or not an MPDU
  *    that was single/part of the previous A-MPDU was
  *    dropped due to old SN
+ * @entries: buffered frames, one entry per sequence number
  */
 struct iwx_reorder_buffer {
     uint16_t head_sn;
     uint16_t num_stored;
     uint16_t buf_size;
+    uint8_t queue;
     uint16_t last_amsdu;
     uint8_t last_sub_index;
     CTimeout *reorder_timer;
@@ -520,8 +541,11 @@ struct iwx_reorder_buffer {
     uint32_t consec_oldsn_ampdu_gp2;
     unsigned int consec_oldsn_prev_drop;
 #define IWX_AMPDU_CONSEC_DROPS_DELBA    20
+    struct iwx_reorder_buf_entry *entries;
 };
 
+#define RX_REORDER_BUF_TIMEOUT_MQ_USEC (100000ULL)
+
 /**
  * struct iwx_reorder_buf_entry - reorder buffer entry per frame sequence number
  * @frames: list of mbufs stored (A-MSDU subframes share a sequence number)
@@ -548,26 +572,29 @@ struct iwx_reorder_buf_entry {
  * @last_rx: last rx timestamp, updated only if timeout passed from last update
  * @session_timer: timer to check if BA session expired, runs at 2 * timeout
  * @sc: softc pointer, needed for timer context
- * @reorder_buf: reorder buffer
- * @reorder_buf_data: buffered frames, one entry per sequence number
+ * @reorder_buf: reorder buffer, one per RX queue
+ * @entries: buffered frames of the default queue
+ * @rss_entries: buffered frames of the RSS queues, allocated at attach
+ *    time if RSS is in use
  */
 struct iwx_rxba_data {
     uint8_t sta_id;
     uint8_t tid;
     uint8_t baid;
-    uint16_t timeout;
+    uint32_t timeout;    /* usec */
     uint16_t entries_per_queue;
     struct timeval last_rx;
     CTimeout *session_timer;
     struct iwx_softc *sc;
-    struct iwx_reorder_buffer reorder_buf;
+    struct iwx_reorder_buffer reorder_buf[IWX_MAX_RX_QUEUES];
     struct iwx_reorder_buf_entry entries[IEEE80211_BA_MAX_WINSZ];
+    struct iwx_reorder_buf_entry *rss_entries;
 };
 
 static inline struct iwx_rxba_data *
 iwx_rxba_data_from_reorder_buf(struct iwx_reorder_buffer *buf)
 {
-    return (struct iwx_rxba_data *)((uint8_t *)buf -
+    return (struct iwx_rxba_data *)((uint8_t *)(buf - buf->queue) -
             offsetof(struct iwx_rxba_data, reorder_buf));
 }
 
@@ -622,7 +649,11 @@ struct iwx_softc {
 
 	/* TX/RX rings. */
 	struct iwx_tx_ring txq[IWX_MAX_TVQM_QUEUES];
-	struct iwx_rx_ring rxq;
+	struct iwx_rx_ring rxq[IWX_MAX_RX_QUEUES];
+	int sc_num_rx_queues;
+	IOInterruptEventSource *sc_rxq_ih[IWX_MAX_RX_QUEUES];
+	IOWorkLoop *sc_rxq_wl[IWX_MAX_RX_QUEUES];
+	IOInterruptEventSource *sc_rxq_deliver;
 	int qfullmsk;
     struct iwx_tx_ring sc_tvqm_ring;
     int first_data_qid;
@@ -704,6 +735,29 @@ struct iwx_softc {
 	int sc_tx_timer;
 	int sc_rx_ba_sessions;
 
+	/* Firmware restarts that replayed the association in place. */
+	struct timeval sc_fw_restart_last;
+	uint32_t sc_fw_restarts;
+#define IWX_FW_RESTART_HOLDOFF	10	/* seconds before another one */
+	/* Fault injection: firmware assert every iwxfwfault= seconds. */
+	int sc_fw_fault_sec;
+	CTimeout *sc_fw_fault_to;
+
+	/* TX A-MSDU limits reported by firmware rate scaling. */
+	uint32_t sc_amsdu_size;
+	uint16_t sc_amsdu_enabled;	/* bitmap of TIDs */
+#define IWX_TX_AMSDU_MAXFRAMES	8
+	uint32_t sc_tx_amsdu;		/* A-MSDUs sent */
+	uint32_t sc_tx_amsdu_subframes;
+
+	/* Rx TCP/UDP checksums verified by firmware vs. left to the host. */
+	uint32_t sc_rx_csum_hw;
+	uint32_t sc_rx_csum_sw;
+
+	/* Tx checksums offloaded to firmware vs. computed by the driver. */
+	uint32_t sc_tx_csum_hw;
+	uint32_t sc_tx_csum_sw;
+
 	int sc_scan_last_antenna;
 
 	int sc_fixed_ridx;
@@ -770,7 +824,7 @@ struct iwx_node {
 	uint16_t in_id;
 	uint16_t in_color;
     
-    struct iwx_rxq_dup_data dup_data;
+    struct iwx_rxq_dup_data dup_data[IWX_MAX_RX_QUEUES];
 };
 #define IWX_STATION_ID 0
 #define IWX_AUX_STA_ID 1
@@ -183,7 +183,7 @@ void itlwm::joinSSID(const char *ssid_name, const char *ssid_pwd)
         wpa.i_ciphers = 0;
         wpa.i_groupcipher = 0;
         wpa.i_protos = IEEE80211_WPA_PROTO_WPA1 | IEEE80211_WPA_PROTO_WPA2;
-        wpa.i_akms = IEEE80211_WPA_AKM_PSK | IEEE80211_WPA_AKM_8021X | IEEE80211_WPA_AKM_SHA256_PSK | IEEE80211_WPA_AKM_SHA256_8021X;
+        wpa.i_akms = IEEE80211_WPA_AKM_PSK | IEEE80211_WPA_AKM_8021X | IEEE80211_WPA_AKM_SHA256_PSK | IEEE80211_WPA_AKM_SHA256_8021X | IEEE80211_WPA_AKM_FT_PSK;
         memcpy(wpa.i_name, "zxy", strlen("zxy"));
         memset(&psk, 0, sizeof(ieee80211_wpapsk));
         memcpy(psk.i_name, "zxy", strlen("zxy"));
@@ -266,7 +266,7 @@ void itlwm::associateSSID(const char *ssid, const char *pwd)
         wpa.i_ciphers = 0;
         wpa.i_groupcipher = 0;
         wpa.i_protos = IEEE80211_WPA_PROTO_WPA1 | IEEE80211_WPA_PROTO_WPA2;
-        wpa.i_akms = IEEE80211_WPA_AKM_PSK | IEEE80211_WPA_AKM_8021X | IEEE80211_WPA_AKM_SHA256_PSK | IEEE80211_WPA_AKM_SHA256_8021X;
+        wpa.i_akms = IEEE80211_WPA_AKM_PSK | IEEE80211_WPA_AKM_8021X | IEEE80211_WPA_AKM_SHA256_PSK | IEEE80211_WPA_AKM_SHA256_8021X | IEEE80211_WPA_AKM_FT_PSK;
         ieee80211_ioctl_setwpaparms(ic, &wpa);
     }
     if (ic->ic_state > IEEE80211_S_AUTH && ic->ic_bss != NULL)
@@ -600,7 +600,7 @@ UInt32 itlwm::outputPacket(mbuf_t m, void *param)
     IOReturn ret = kIOReturnOutputSuccess;
     _ifnet *ifp = &fHalService->get80211Controller()->ic_ac.ac_if;
 
-    if (fHalService->get80211Controller()->ic_state != IEEE80211_S_RUN || ifp->if_snd.queue == NULL) {
+    if (fHalService->get80211Controller()->ic_state != IEEE80211_S_RUN || ifp->if_snd.ifq_flows == NULL) {
         if (m && mbuf_type(m) != MBUF_TYPE_FREE) {
             freePacket(m);
         }
@@ -622,10 +622,8 @@ UInt32 itlwm::outputPacket(mbuf_t m, void *param)
         ifp->netStat->outputErrors++;
         ret = kIOReturnOutputDropped;
     }
-    if (!ifp->if_snd.queue->lockEnqueue(m)) {
-        freePacket(m);
+    if (ifq_enqueue(&ifp->if_snd, m) != 0)
         ret = kIOReturnOutputDropped;
-    }
     (*ifp->if_start)(ifp);
     return ret;
 }
@@ -635,6 +633,14 @@ UInt32 itlwm::getFeatures() const
     return fHalService->getDriverInfo()->supportedFeatures();
 }
 
+IOReturn itlwm::getChecksumSupport(UInt32 *checksumMask, UInt32 checksumFamily, bool isOutput)
+{
+    if (checksumFamily != kChecksumFamilyTCPIP)
+        return kIOReturnUnsupported;
+    *checksumMask = fHalService->getDriverInfo()->supportedChecksums(isOutput);
+    return kIOReturnSuccess;
+}
+
 IOReturn itlwm::setPromiscuousMode(IOEnetPromiscuousMode mode)
 {
     return kIOReturnSuccess;
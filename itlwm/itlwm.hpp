@@ -74,6 +74,7 @@ public:
     virtual IOReturn getPacketFilters(const OSSymbol *group, UInt32 *filters) const override;
     virtual IOReturn selectMedium(const IONetworkMedium *medium) override;
     virtual UInt32 getFeatures() const override;
+    virtual IOReturn getChecksumSupport(UInt32 *checksumMask, UInt32 checksumFamily, bool isOutput) override;
     virtual IOReturn registerWithPolicyMaker( IOService * policyMaker ) override;
     virtual IOReturn setPowerState( unsigned long powerStateOrdinal,
                                     IOService *   policyMaker) override;
@@ -0,0 +1,672 @@
+/*
+ * Trace replay of the ACK filter in the send queue: frames a station
+ * sends while downloading go through ifq_enqueue() and ifq_dequeue() of
+ * _ifq.cpp, built as is, and the uplink airtime they take is set
+ * against sending every frame.
+ *
+ * The medium is shared with an AP that always has download data: it
+ * alternates between an AP TXOP of DL_TXOP (an A-MPDU of up to 64
+ * segments) and, when the station has a frame queued, one station
+ * frame, which pays for contention, preamble and its ACK on its own.
+ * Pure ACKs that arrive while an older one of the same connection waits
+ * are the ones the filter can fold.
+ *
+ * The built-in traces are the frames a receiver sends for segments that
+ * arrive an A-MPDU at a time: a delayed ACK every second segment, a dup
+ * ACK with SACK blocks for each segment past a loss, ECE on ACKs after a
+ * CE mark, and, in the mixed trace, an upload and a voice call next to
+ * four downloads, one of them without SACK, whose dup ACKs are pure.  pcap captures of a station's own frames during a
+ * download (tcpdump -Q out -w) can be given on the command line and are
+ * replayed at their capture times.
+ *
+ * Every replay is checked against the frames put in: only pure ACKs by
+ * the rules of ifq_pure_ack() (no payload, no flag but ACK, no ECN, no
+ * option but timestamps) are ever folded, never SACK, ECE, data or
+ * non-TCP frames; each connection's frames leave in the order they
+ * came; and each folded ACK is followed on its connection by an ACK of
+ * the same sequence number that acknowledges more.  Frames CoDel drops
+ * from a standing queue are counted apart; the airtime saved is that
+ * of the folded ACKs only.
+ *
+ *   c++ -std=c++11 -g -fsanitize=address,undefined -I compat \
+ *       -idirafter ../itl80211/openbsd -o ack_filter_replay \
+ *       ack_filter_replay.cpp
+ *   ./ack_filter_replay [capture.pcap ...]
+ */
+
+#include "ifq_env.h"
+#include <sys/_ifq.cpp>
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+
+#define IFQ_MAXLEN      2048            /* ieee80211_ifattach() */
+#define DLT_EN10MB      1               /* <pcap/dlt.h> */
+#define USEC            1000ULL         /* ns */
+#define MSEC            1000000ULL
+#define MSS             1448
+#define TH_ECE          0x40            /* BSD <netinet/tcp.h> */
+
+/*
+ * Airtime of one station frame: DIFS, a mean CWmin backoff of 7.5
+ * slots, the VHT preamble, SIFS and a legacy ACK at 24 Mbit/s, plus the
+ * MPDU (802.11 QoS header, LLC/SNAP and FCS for the Ethernet header) at
+ * 433 Mbit/s, VHT80 MCS 9 with one stream.
+ */
+#define AIR_OVERHEAD    ((34 + 68 + 40 + 16 + 28) * USEC)
+#define AIR_MBPS        433
+#define AIR_MPDU_EXTRA  (26 + 8 + 4 - ETHER_HDR_LEN)
+#define DL_TXOP         (2 * MSEC)
+#define DL_BURST        64              /* segments per AP TXOP */
+#define RX_PER_SEG      (2 * USEC)      /* receive processing */
+
+struct tframe {
+    u_int64_t t;                /* ns */
+    std::vector<u_int8_t> d;    /* headers */
+    size_t len;
+};
+
+struct trace {
+    std::string name;
+    std::vector<struct tframe> frames;
+};
+
+/* What the checks need to know of a frame. */
+struct finfo {
+    std::string conn;           /* empty if not TCP or UDP */
+    bool pure_ack;
+    bool sack, ece;
+    u_int32_t seq, ack;
+};
+
+/* What became of a frame put in the queue */
+#define FATE_QUEUED     0
+#define FATE_SENT       1
+#define FATE_FOLDED     2       /* superseded by a later ACK */
+#define FATE_DROPPED    3       /* by CoDel or the queue limit */
+
+struct result {
+    size_t frames, pure_acks, sacks, eces, folded, dropped;
+    u_int64_t air, air_all;     /* ns, sent, and of every frame */
+    u_int64_t air_folded;       /* ns */
+    struct ifq_stats stats;
+    std::string why;
+};
+
+static std::vector<u_int32_t> *cur_freed;
+static int failures;
+
+static void
+check(const char *what, bool ok)
+{
+    printf("%-4s %s\n", ok ? "ok" : "FAIL", what);
+    if (!ok)
+        failures++;
+}
+
+static u_int64_t
+airtime(size_t len)
+{
+    return AIR_OVERHEAD + (len + AIR_MPDU_EXTRA) * 8 * 1000 / AIR_MBPS;
+}
+
+/* The frame as the checks see it, independently of _ifq.cpp. */
+static struct finfo
+parse(const struct tframe &f)
+{
+    struct finfo fi = { "", false, false, false, 0, 0 };
+    struct ether_header eh;
+    struct tcphdr th;
+    size_t off = ETHER_HDR_LEN, i;
+    u_int16_t sport, dport;
+    u_int8_t proto, ecn;
+    size_t payload;
+    bool frag;
+    char key[128];
+
+    if (f.d.size() < sizeof(eh))
+        return fi;
+    memcpy(&eh, f.d.data(), sizeof(eh));
+    if (ntohs(eh.ether_type) == ETHERTYPE_IP) {
+        struct ip ip;
+        char src[INET_ADDRSTRLEN], dst[INET_ADDRSTRLEN];
+
+        if (f.d.size() < off + sizeof(ip))
+            return fi;
+        memcpy(&ip, &f.d[off], sizeof(ip));
+        proto = ip.ip_p;
+        ecn = ip.ip_tos & IPTOS_ECN_MASK;
+        frag = (ntohs(ip.ip_off) & (IP_MF | IP_OFFMASK)) != 0;
+        inet_ntop(AF_INET, &ip.ip_src, src, sizeof(src));
+        inet_ntop(AF_INET, &ip.ip_dst, dst, sizeof(dst));
+        snprintf(key, sizeof(key), "%s %s %u", src, dst, proto);
+        off += ip.ip_hl << 2;
+        if (ip.ip_hl != sizeof(ip) >> 2)
+            frag = true;        /* options: never filtered */
+        payload = ntohs(ip.ip_len) - (ip.ip_hl << 2);
+    } else if (ntohs(eh.ether_type) == ETHERTYPE_IPV6) {
+        struct ip6_hdr ip6;
+        char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+
+        if (f.d.size() < off + sizeof(ip6))
+            return fi;
+        memcpy(&ip6, &f.d[off], sizeof(ip6));
+        proto = ip6.ip6_nxt;
+        ecn = (ntohl(ip6.ip6_flow) >> 20) & IPTOS_ECN_MASK;
+        frag = false;
+        inet_ntop(AF_INET6, &ip6.ip6_src, src, sizeof(src));
+        inet_ntop(AF_INET6, &ip6.ip6_dst, dst, sizeof(dst));
+        snprintf(key, sizeof(key), "%s %s %u", src, dst, proto);
+        off += sizeof(ip6);
+        payload = ntohs(ip6.ip6_plen);
+    } else
+        return fi;
+
+    if (proto != IPPROTO_TCP && proto != IPPROTO_UDP)
+        return fi;
+    if (f.d.size() < off + 4)
+        return fi;
+    memcpy(&sport, &f.d[off], 2);
+    memcpy(&dport, &f.d[off + 2], 2);
+    fi.conn = std::string(key) + " " + std::to_string(ntohs(sport)) + " " +
+        std::to_string(ntohs(dport));
+    if (proto != IPPROTO_TCP || f.d.size() < off + sizeof(th))
+        return fi;
+    memcpy(&th, &f.d[off], sizeof(th));
+    fi.seq = ntohl(th.th_seq);
+    fi.ack = ntohl(th.th_ack);
+    fi.ece = (th.th_flags & TH_ECE) != 0;
+    fi.pure_ack = payload == (size_t)th.th_off << 2 && !frag && ecn == 0 &&
+        th.th_flags == TH_ACK && f.d.size() >= off + (th.th_off << 2);
+    for (i = off + sizeof(th); i < off + (th.th_off << 2) &&
+        i < f.d.size(); ) {
+        if (f.d[i] == TCPOPT_EOL)
+            break;
+        if (f.d[i] == TCPOPT_NOP) {
+            i++;
+            continue;
+        }
+        if (f.d[i] == TCPOPT_SACK)
+            fi.sack = true;
+        if (f.d[i] != TCPOPT_TIMESTAMP)
+            fi.pure_ack = false;
+        if (i + 1 >= f.d.size() || f.d[i + 1] < 2)
+            break;
+        i += f.d[i + 1];
+    }
+    return fi;
+}
+
+/* Frames freed before they were sent, by the operation running. */
+static void
+freed(mbuf_t m)
+{
+    cur_freed->push_back(m->m_seq);
+}
+
+/*
+ * Check a replay: what was folded, the order frames left in and that
+ * every folded ACK was superseded by the next frame of its connection
+ * that was not folded itself.  CoDel may drop any frame; such a frame
+ * still stands for the ACKs folded into it.
+ */
+static std::string
+verify(const struct trace &t, const std::vector<struct finfo> &fi,
+    const std::vector<int> &fate, const std::vector<size_t> &order)
+{
+    std::map<std::string, size_t> last;
+    std::map<std::string, std::vector<size_t>> pending;
+    size_t i, j;
+
+    for (i = 0; i < order.size(); i++) {
+        j = order[i];
+        if (fi[j].conn.empty())
+            continue;
+        if (last.count(fi[j].conn) && last[fi[j].conn] > j)
+            return "frame " + std::to_string(j) + " sent out of order";
+        last[fi[j].conn] = j;
+    }
+    for (i = 0; i < t.frames.size(); i++) {
+        if (fate[i] == FATE_QUEUED)
+            return "frame " + std::to_string(i) + " lost";
+        if (fate[i] == FATE_FOLDED) {
+            if (!fi[i].pure_ack)
+                return "frame " + std::to_string(i) +
+                    " folded, not a pure ACK";
+            pending[fi[i].conn].push_back(i);
+            continue;
+        }
+        if (fi[i].conn.empty())
+            continue;
+        for (auto k : pending[fi[i].conn]) {
+            if (!fi[i].pure_ack || fi[i].seq != fi[k].seq ||
+                (int32_t)(fi[i].ack - fi[k].ack) <= 0)
+                return "ACK " + std::to_string(k) + " folded, frame " +
+                    std::to_string(i) + " does not supersede it";
+        }
+        pending[fi[i].conn].clear();
+    }
+    for (auto &p : pending)
+        if (!p.second.empty())
+            return "ACK " + std::to_string(p.second.back()) +
+                " folded, nothing sent after it";
+    return "";
+}
+
+static void
+settle(std::vector<int> &fate, std::vector<u_int32_t> &fr, int how,
+    const char **why)
+{
+    for (auto k : fr) {
+        if (fate[k] != FATE_QUEUED)
+            *why = "frame freed twice";
+        fate[k] = how;
+    }
+    fr.clear();
+}
+
+static struct result
+replay(const struct trace &t)
+{
+    struct _ifqueue ifq;
+    struct result r = result();
+    std::vector<struct finfo> fi;
+    std::vector<int> fate(t.frames.size(), FATE_QUEUED);
+    std::vector<u_int32_t> fr;
+    std::vector<size_t> order;
+    const char *why = NULL;
+    u_int64_t now = 0, folds;
+    size_t i = 0;
+    mbuf_t m;
+
+    r.frames = t.frames.size();
+    for (auto &f : t.frames) {
+        fi.push_back(parse(f));
+        r.pure_acks += fi.back().pure_ack;
+        r.sacks += fi.back().sack;
+        r.eces += fi.back().ece;
+        r.air_all += airtime(f.len);
+    }
+
+    memset(&ifq, 0, sizeof(ifq));
+    ifq_init(&ifq, NULL, IFQ_MAXLEN);
+    cur_freed = &fr;
+    env_dropped = freed;
+    while (i < t.frames.size() || ifq.ifq_len != 0) {
+        env_now = now;
+        for (; i < t.frames.size() && t.frames[i].t <= now; i++) {
+            m = env_mbuf(t.frames[i].d.data(), t.frames[i].d.size(),
+                t.frames[i].len);
+            m->m_seq = (u_int32_t)i;
+            folds = ifq.ifq_stats.ack_drops;
+            ifq_enqueue(&ifq, m);
+            settle(fate, fr, ifq.ifq_stats.ack_drops != folds ?
+                FATE_FOLDED : FATE_DROPPED, &why);
+        }
+        m = ifq_dequeue(&ifq);
+        settle(fate, fr, FATE_DROPPED, &why);
+        if (m != NULL) {
+            m->m_sent = true;
+            fate[m->m_seq] = FATE_SENT;
+            order.push_back(m->m_seq);
+            r.air += airtime(mbuf_pkthdr_len(m));
+            now += airtime(mbuf_pkthdr_len(m));
+            mbuf_freem(m);
+        }
+        now += DL_TXOP;
+    }
+    ifq_get_stats(&ifq, &r.stats);
+    env_dropped = NULL;
+    ifq_destroy(&ifq);
+
+    for (i = 0; i < fate.size(); i++) {
+        if (fate[i] == FATE_FOLDED) {
+            r.folded++;
+            r.air_folded += airtime(t.frames[i].len);
+        } else if (fate[i] == FATE_DROPPED)
+            r.dropped++;
+    }
+    r.why = why != NULL ? why : verify(t, fi, fate, order);
+    if (r.why.empty() && r.stats.ack_drops != r.folded)
+        r.why = "ack_drops " + std::to_string(r.stats.ack_drops) +
+            ", folded " + std::to_string(r.folded);
+    if (r.why.empty() &&
+        r.stats.codel_drops + r.stats.overlimit_drops != r.dropped)
+        r.why = "codel_drops and overlimit_drops " +
+            std::to_string(r.stats.codel_drops + r.stats.overlimit_drops) +
+            ", dropped " + std::to_string(r.dropped);
+    return r;
+}
+
+struct conn {
+    struct env_flow id;
+    u_int32_t snd_nxt;          /* sender */
+    std::vector<u_int32_t> lost;        /* resent in the next burst */
+    std::vector<u_int32_t> rexmit;
+    u_int32_t rcv_nxt;          /* receiver */
+    std::set<u_int32_t> ooo;
+    int unacked;
+    bool ece;
+    bool sack;                  /* SACK permitted */
+    u_int32_t iss;              /* of the receiver's own data */
+};
+
+static u_int32_t rng = 0x2545f491;
+
+static u_int32_t
+rand32(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static bool
+chance(double p)
+{
+    return rand32() < p * 4294967296.0;
+}
+
+/*
+ * A station frame on connection c: Ethernet, IPv4 and TCP with a
+ * timestamp option and up to three SACK blocks, or UDP.
+ */
+static struct tframe
+frame(u_int64_t t, const struct env_flow &id, u_int8_t flags, u_int32_t seq,
+    u_int32_t ack, const std::vector<u_int32_t> &sack, size_t payload)
+{
+    struct tframe f;
+    struct ether_header eh;
+    struct ip ip;
+    struct tcphdr th;
+    struct udphdr uh;
+    std::vector<u_int8_t> opt = { TCPOPT_NOP, TCPOPT_NOP, TCPOPT_TIMESTAMP,
+        TCPOLEN_TIMESTAMP, 0, 0, 0, 1, 0, 0, 0, 1 };
+    size_t hl, i;
+    u_int32_t v;
+
+    if (!sack.empty()) {
+        opt.push_back(TCPOPT_NOP);
+        opt.push_back(TCPOPT_NOP);
+        opt.push_back(TCPOPT_SACK);
+        opt.push_back((u_int8_t)(2 + 4 * sack.size()));
+        for (i = 0; i < sack.size(); i++) {
+            v = htonl(sack[i]);
+            opt.insert(opt.end(), (u_int8_t *)&v, (u_int8_t *)&v + 4);
+        }
+    }
+    hl = id.proto == IPPROTO_TCP ? sizeof(th) + opt.size() : sizeof(uh);
+
+    memset(&eh, 0, sizeof(eh));
+    eh.ether_dhost[0] = 0x02;
+    eh.ether_type = htons(ETHERTYPE_IP);
+    memset(&ip, 0, sizeof(ip));
+    ip.ip_v = IPVERSION;
+    ip.ip_hl = sizeof(ip) >> 2;
+    ip.ip_len = htons(sizeof(ip) + hl + payload);
+    ip.ip_off = htons(IP_DF);
+    ip.ip_ttl = 64;
+    ip.ip_p = id.proto;
+    ip.ip_src.s_addr = id.src;
+    ip.ip_dst.s_addr = id.dst;
+
+    f.t = t;
+    f.len = sizeof(eh) + sizeof(ip) + hl + payload;
+    f.d.insert(f.d.end(), (u_int8_t *)&eh, (u_int8_t *)(&eh + 1));
+    f.d.insert(f.d.end(), (u_int8_t *)&ip, (u_int8_t *)(&ip + 1));
+    if (id.proto == IPPROTO_TCP) {
+        memset(&th, 0, sizeof(th));
+        th.th_sport = id.sport;
+        th.th_dport = id.dport;
+        th.th_seq = htonl(seq);
+        th.th_ack = htonl(ack);
+        th.th_off = (sizeof(th) + opt.size()) >> 2;
+        th.th_flags = flags;
+        th.th_win = htons(2048);
+        f.d.insert(f.d.end(), (u_int8_t *)&th, (u_int8_t *)(&th + 1));
+        f.d.insert(f.d.end(), opt.begin(), opt.end());
+    } else {
+        memset(&uh, 0, sizeof(uh));
+        uh.uh_sport = id.sport;
+        uh.uh_dport = id.dport;
+        uh.uh_ulen = htons(sizeof(uh) + payload);
+        f.d.insert(f.d.end(), (u_int8_t *)&uh, (u_int8_t *)(&uh + 1));
+    }
+    return f;
+}
+
+/* The receiver's answer to a segment arriving at t. */
+static void
+receive(struct trace &tr, u_int64_t t, struct conn &c, u_int32_t seq,
+    bool ce)
+{
+    std::vector<u_int32_t> sack;
+    bool hole = !c.ooo.empty(), dup;
+    u_int8_t flags;
+
+    if (ce)
+        c.ece = true;
+    if (seq == c.rcv_nxt) {
+        c.rcv_nxt += MSS;
+        while (c.ooo.erase(c.rcv_nxt))
+            c.rcv_nxt += MSS;
+    } else if ((int32_t)(seq - c.rcv_nxt) > 0)
+        c.ooo.insert(seq);
+    /* One SACK block per run of out-of-order segments, at most three. */
+    for (auto it = c.ooo.begin(); c.sack && it != c.ooo.end() &&
+        sack.size() < 6; ) {
+        u_int32_t start = *it, end = start + MSS;
+
+        while (++it != c.ooo.end() && *it == end)
+            end += MSS;
+        sack.push_back(start);
+        sack.push_back(end);
+    }
+    /* Delayed ACK every second segment, at once around a hole. */
+    dup = !c.ooo.empty();
+    if (!hole && !dup && ++c.unacked < 2)
+        return;
+    c.unacked = 0;
+    flags = TH_ACK | (c.ece ? TH_ECE : 0);
+    tr.frames.push_back(frame(t, c.id, flags, c.iss, c.rcv_nxt, sack, 0));
+}
+
+/*
+ * nconn downloads of burst segments every period, with segment loss
+ * and CE marks at the given rates; an upload segment every upload ns
+ * and a voice frame every 20ms, if asked.
+ */
+static struct trace
+download(const char *name, int nconn, int burst, u_int64_t period,
+    double loss, double ce, u_int64_t upload, bool voice, u_int64_t dur)
+{
+    struct trace tr, side;
+    std::vector<struct conn> c(nconn);
+    struct env_flow up = { IPPROTO_TCP, htonl(0x0a000002),
+        htonl(0xc6336464), htons(50000), htons(22) };
+    struct env_flow rtp = { IPPROTO_UDP, htonl(0x0a000002),
+        htonl(0x08080808), htons(5004), htons(5004) };
+    u_int64_t t, rx;
+    u_int32_t upseq = 1, seq;
+    int i, k;
+
+    tr.name = name;
+    for (i = 0; i < nconn; i++) {
+        c[i].id.proto = IPPROTO_TCP;
+        c[i].id.src = htonl(0x0a000002);
+        c[i].id.dst = htonl(0xc6336401 + i);
+        c[i].id.sport = htons(49152 + i);
+        c[i].id.dport = htons(443);
+        c[i].snd_nxt = c[i].rcv_nxt = 1000 * (i + 1);
+        c[i].unacked = 0;
+        c[i].ece = false;
+        c[i].sack = i != 3;
+        c[i].iss = 7000 * (i + 1);
+    }
+    for (t = 0; t < dur; t += period) {
+        rx = t;
+        for (i = 0; i < nconn; i++) {
+            c[i].ece = false;   /* CWR seen */
+            c[i].rexmit.insert(c[i].rexmit.end(), c[i].lost.begin(),
+                c[i].lost.end());
+            c[i].lost.clear();
+        }
+        for (k = 0; k < burst; k++) {
+            struct conn &cc = c[k % nconn];
+
+            rx += RX_PER_SEG;
+            if (!cc.rexmit.empty()) {
+                seq = cc.rexmit.front();
+                cc.rexmit.erase(cc.rexmit.begin());
+            } else {
+                seq = cc.snd_nxt;
+                cc.snd_nxt += MSS;
+            }
+            if (chance(loss)) {
+                cc.lost.push_back(seq);
+                continue;
+            }
+            receive(tr, rx, cc, seq, chance(ce));
+        }
+    }
+    for (t = 0; upload != 0 && t < dur; t += upload) {
+        side.frames.push_back(frame(t + 50 * USEC, up, TH_ACK, upseq, 1,
+            std::vector<u_int32_t>(), MSS));
+        upseq += MSS;
+    }
+    for (t = 0; voice && t < dur; t += 20 * MSEC)
+        side.frames.push_back(frame(t + 70 * USEC, rtp, 0, 0, 0,
+            std::vector<u_int32_t>(), 160));
+    tr.frames.insert(tr.frames.end(), side.frames.begin(),
+        side.frames.end());
+    std::stable_sort(tr.frames.begin(), tr.frames.end(),
+        [](const struct tframe &a, const struct tframe &b) {
+            return a.t < b.t;
+        });
+    return tr;
+}
+
+/* Ethernet frames of a pcap capture, timed from the first one. */
+static bool
+read_pcap(const char *path, struct trace &t)
+{
+    u_int8_t gh[24], rh[16];
+    u_int32_t magic, linktype, sec, frac, caplen, len;
+    u_int64_t first = 0, ts;
+    std::vector<u_int8_t> d;
+    struct tframe f;
+    bool swap, nsec;
+    FILE *fp;
+
+    if ((fp = fopen(path, "rb")) == NULL) {
+        perror(path);
+        return false;
+    }
+    if (fread(gh, sizeof(gh), 1, fp) != 1)
+        goto bad;
+    memcpy(&magic, gh, 4);
+    swap = magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1;
+    nsec = magic == 0xa1b23c4d || magic == 0x4d3cb2a1;
+    if (!swap && magic != 0xa1b2c3d4 && magic != 0xa1b23c4d)
+        goto bad;
+    memcpy(&linktype, gh + 20, 4);
+    if ((swap ? __builtin_bswap32(linktype) : linktype) != DLT_EN10MB) {
+        fprintf(stderr, "%s: not Ethernet\n", path);
+        fclose(fp);
+        return false;
+    }
+    while (fread(rh, sizeof(rh), 1, fp) == 1) {
+        memcpy(&sec, rh, 4);
+        memcpy(&frac, rh + 4, 4);
+        memcpy(&caplen, rh + 8, 4);
+        memcpy(&len, rh + 12, 4);
+        if (swap) {
+            sec = __builtin_bswap32(sec);
+            frac = __builtin_bswap32(frac);
+            caplen = __builtin_bswap32(caplen);
+            len = __builtin_bswap32(len);
+        }
+        if (caplen > 65535 || caplen > len)
+            goto bad;
+        d.resize(caplen);
+        if (caplen > 0 && fread(d.data(), caplen, 1, fp) != 1)
+            goto bad;
+        ts = (u_int64_t)sec * 1000 * MSEC + frac * (nsec ? 1 : USEC);
+        if (t.frames.empty())
+            first = ts;
+        f.t = ts >= first ? ts - first : 0;
+        f.d.assign(d.begin(), d.begin() + MIN(caplen, ENV_HDRLEN));
+        f.len = len;
+        t.frames.push_back(f);
+    }
+    fclose(fp);
+    t.name = path;
+    return true;
+bad:
+    fprintf(stderr, "%s: not a pcap capture\n", path);
+    fclose(fp);
+    return false;
+}
+
+int
+main(int argc, char **argv)
+{
+    std::vector<struct trace> traces;
+    std::vector<struct result> res;
+    struct trace t;
+    std::string what;
+    u_int64_t cycle = DL_TXOP + airtime(78);
+    char buf[160];
+    size_t i;
+
+    traces.push_back(download("download", 1, DL_BURST, cycle, 0.002,
+        0.001, 0, false, 10000 * MSEC));
+    traces.push_back(download("4-down+up", 4, DL_BURST, cycle, 0.002,
+        0.001, MSEC, true, 10000 * MSEC));
+    traces.push_back(download("slow-download", 1, 1, 4 * MSEC, 0.002, 0,
+        0, false, 10000 * MSEC));
+    for (i = 1; i < (size_t)argc; i++) {
+        t = trace();
+        if (!read_pcap(argv[i], t))
+            return 2;
+        traces.push_back(t);
+    }
+
+    printf("%-14s %7s %7s %5s %5s %7s %7s %9s %9s %8s\n", "trace",
+        "frames", "acks", "sack", "ece", "folded", "dropped", "air ms",
+        "folded ms", "saved %");
+    for (i = 0; i < traces.size(); i++) {
+        res.push_back(replay(traces[i]));
+        struct result &r = res.back();
+        printf("%-14s %7zu %7zu %5zu %5zu %7zu %7zu %9.1f %9.1f %8.1f\n",
+            traces[i].name.c_str(), r.frames, r.pure_acks, r.sacks, r.eces,
+            r.folded, r.dropped, (double)r.air_all / MSEC,
+            (double)r.air_folded / MSEC,
+            r.air_all != 0 ? 100.0 * r.air_folded / r.air_all : 0);
+    }
+
+    for (i = 0; i < traces.size(); i++) {
+        what = traces[i].name + ": only superseded pure ACKs folded, " +
+            "order kept" + (res[i].why.empty() ? "" : ": " + res[i].why);
+        check(what.c_str(), res[i].why.empty());
+    }
+    check("download traces carry SACK and ECE ACKs",
+        res[0].sacks > 0 && res[0].eces > 0 && res[1].sacks > 0 &&
+        res[1].eces > 0);
+    check("download: over half the pure ACKs folded",
+        res[0].folded * 2 > res[0].pure_acks);
+    check("4-down+up: over half the pure ACKs folded",
+        res[1].folded * 2 > res[1].pure_acks);
+    check("slow-download: no ACK folded when none waits",
+        res[2].folded == 0);
+    snprintf(buf, sizeof(buf), "no mbufs left (%d)", env_mbufs);
+    check(buf, env_mbufs == 0);
+
+    printf("%d failed\n", failures);
+    return failures != 0;
+}
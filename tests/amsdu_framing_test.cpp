@@ -0,0 +1,641 @@
+/*
+ * Tests of the A-MSDU framing of ieee80211_amsdu_encap() and
+ * ieee80211_amsdu_append(): the A-MSDU present bit, addr3 becoming the
+ * BSSID in both directions, subframe headers and lengths, the padding of
+ * every subframe but the last to 4 bytes, deferred checksums computed
+ * at the IP header, headers split across mbufs, and the accounting when
+ * an mbuf cannot be allocated. The resulting A-MSDU is parsed back the
+ * way a receiver does and compared with the frames put in.
+ *
+ * The benchmark then frames 1500-byte MSDUs into A-MSDUs of 1 to 7
+ * subframes, as many as fit the VHT maximum MPDU lengths, and prints
+ * the cost per MSDU of building and framing it along with the MPDUs and
+ * MSDUs per second that fit the air at VHT MCS 9, 80 MHz, 2 streams, in A-MPDUs of 64
+ * MPDUs. Build it with -O2 and without the sanitizers for meaningful
+ * framing costs.
+ *
+ *   N=../itl80211/openbsd/net80211
+ *   awk -v defines="IEEE80211_ADDR_COPY IEEE80211_ADDR_EQ" \
+ *       -f extract.awk $N/ieee80211_var.h > amsdu_defs.inc
+ *   awk -v fns="ieee80211_csum_finalize ieee80211_amsdu_encap \
+ *       ieee80211_amsdu_append" -f extract.awk $N/ieee80211_output.c \
+ *       > amsdu.inc
+ *   c++ -std=c++11 -g -fsanitize=address,undefined -I compat \
+ *       -idirafter ../itl80211/openbsd -o amsdu_framing_test \
+ *       amsdu_framing_test.cpp
+ *   ./amsdu_framing_test [msdus]
+ */
+
+#include <sys/systm.h>
+#include <sys/endian.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <net/ethernet.h>
+#include <arpa/inet.h>
+#include <errno.h>
+
+#define letoh16(x)  le16toh(x)
+
+/* For the frame helpers ieee80211.h keeps to the kernel. */
+#define _KERNEL
+#include <net80211/ieee80211.h>
+#undef _KERNEL
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "amsdu_defs.inc"
+
+/* <net/if_llc.h> of the macOS SDK. */
+struct llc {
+    u_int8_t llc_dsap;
+    u_int8_t llc_ssap;
+    u_int8_t llc_control;
+    struct {
+        u_int8_t org_code[3];
+        u_int16_t ether_type;
+    } __attribute__((packed)) llc_snap;
+} __attribute__((packed));
+
+#define LLC_SNAP_LSAP       0xaa
+#define LLC_UI              0x03
+#define LLC_SNAPFRAMELEN    8
+
+/*
+ * A minimal mbuf chain. Only the first mbuf carries the packet header:
+ * its length and whether the stack left the checksums to the driver.
+ */
+#define MLEN    2048
+
+struct __mbuf {
+    struct __mbuf *m_next;
+    u_int8_t *m_data;
+    size_t m_len;
+    size_t m_pktlen;
+    int m_csum;
+    u_int8_t m_buf[MLEN];
+};
+
+typedef int mbuf_how_t;
+typedef u_int32_t mbuf_csum_request_flags_t;
+
+#define MBUF_DONTWAIT   1
+#define mtod(m, t)      ((t)(m)->m_data)
+
+static int nomem;           /* fail the next allocation */
+static int nmbufs;          /* mbufs allocated and not freed */
+
+/* Offsets mbuf_outbound_finalize() was called with, and the byte there. */
+struct finalize {
+    int family;
+    size_t off;
+    u_int8_t first;
+};
+static std::vector<struct finalize> finalized;
+
+static mbuf_t
+mbuf_alloc(size_t lead)
+{
+    mbuf_t m;
+
+    if (nomem) {
+        nomem = 0;
+        return NULL;
+    }
+    m = (mbuf_t)calloc(1, sizeof(*m));
+    m->m_data = m->m_buf + lead;
+    nmbufs++;
+    return m;
+}
+
+static void
+mbuf_freem(mbuf_t m)
+{
+    mbuf_t n;
+
+    for (; m != NULL; m = n) {
+        n = m->m_next;
+        free(m);
+        nmbufs--;
+    }
+}
+
+static size_t
+mbuf_len(mbuf_t m)
+{
+    return m->m_len;
+}
+
+static size_t
+mbuf_pkthdr_len(mbuf_t m)
+{
+    return m->m_pktlen;
+}
+
+static void
+mbuf_pkthdr_setlen(mbuf_t m, size_t len)
+{
+    m->m_pktlen = len;
+}
+
+/* Like the KPI, free the chain if no mbuf can be had. */
+static int
+mbuf_prepend(mbuf_t *mp, size_t len, mbuf_how_t how)
+{
+    mbuf_t m = *mp, n;
+
+    if ((size_t)(m->m_data - m->m_buf) >= len) {
+        m->m_data -= len;
+        m->m_len += len;
+        m->m_pktlen += len;
+        return 0;
+    }
+    if ((n = mbuf_alloc(MLEN - len)) == NULL) {
+        mbuf_freem(m);
+        *mp = NULL;
+        return ENOMEM;
+    }
+    n->m_len = len;
+    n->m_pktlen = m->m_pktlen + len;
+    n->m_csum = m->m_csum;
+    n->m_next = m;
+    *mp = n;
+    return 0;
+}
+
+static int
+mbuf_pullup(mbuf_t *mp, size_t len)
+{
+    mbuf_t m = *mp, n;
+    size_t k;
+
+    if (m->m_pktlen < len || (n = mbuf_alloc(0)) == NULL) {
+        mbuf_freem(m);
+        *mp = NULL;
+        return ENOMEM;
+    }
+    n->m_pktlen = m->m_pktlen;
+    n->m_csum = m->m_csum;
+    while (n->m_len < len) {
+        k = MIN(len - n->m_len, m->m_len);
+        memcpy(n->m_data + n->m_len, m->m_data, k);
+        n->m_len += k;
+        m->m_data += k;
+        m->m_len -= k;
+        if (m->m_len == 0) {
+            mbuf_t next = m->m_next;
+
+            free(m);
+            nmbufs--;
+            m = next;
+        }
+    }
+    n->m_next = m;
+    *mp = n;
+    return 0;
+}
+
+static void
+m_cat(mbuf_t m, mbuf_t n)
+{
+    while (m->m_next != NULL)
+        m = m->m_next;
+    m->m_next = n;
+}
+
+/* Copy len bytes at off in chain m to buf. */
+static void
+m_copydata(mbuf_t m, size_t off, size_t len, u_int8_t *buf)
+{
+    size_t k;
+
+    for (; off >= m->m_len; m = m->m_next)
+        off -= m->m_len;
+    for (; len > 0; m = m->m_next, off = 0) {
+        k = MIN(len, m->m_len - off);
+        memcpy(buf, m->m_data + off, k);
+        buf += k;
+        len -= k;
+    }
+}
+
+static void
+mbuf_get_csum_requested(mbuf_t m, mbuf_csum_request_flags_t *request,
+    u_int32_t *value)
+{
+    *request = m->m_csum;
+    *value = 0;
+}
+
+static void
+mbuf_outbound_finalize(mbuf_t m, int family, size_t off)
+{
+    u_int8_t b;
+
+    m_copydata(m, off, 1, &b);
+    finalized.push_back({ family, off, b });
+}
+
+struct ieee80211_stats {
+    u_int32_t is_tx_nombuf;
+};
+
+struct ieee80211com {
+    struct ieee80211_stats ic_stats;
+};
+
+#include "amsdu.inc"
+
+#define HDRLEN  sizeof(struct ieee80211_qosframe)
+
+static int failures;
+
+static const u_int8_t bssid[] = { 0x00, 0x11, 0x22, 0x33, 0x44, 0x55 };
+static const u_int8_t sta[] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+static const u_int8_t peer[] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 };
+
+static void
+check(const char *what, bool ok)
+{
+    printf("%-4s %s\n", ok ? "ok" : "FAIL", what);
+    if (!ok)
+        failures++;
+}
+
+/* An IPv4 packet of len bytes whose payload bytes are seed, seed + 1... */
+static std::vector<u_int8_t>
+packet(size_t len, u_int8_t seed)
+{
+    std::vector<u_int8_t> p(len);
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        p[i] = seed + i;
+    p[0] = 0x45;
+    return p;
+}
+
+/* An Ethernet frame in a single mbuf with lead bytes in front. */
+static mbuf_t
+ether(const u_int8_t *dst, const u_int8_t *src,
+    const std::vector<u_int8_t> &pkt, size_t lead, int csum)
+{
+    mbuf_t m = mbuf_alloc(lead);
+    struct ether_header *eh = mtod(m, struct ether_header *);
+
+    IEEE80211_ADDR_COPY(eh->ether_dhost, dst);
+    IEEE80211_ADDR_COPY(eh->ether_shost, src);
+    eh->ether_type = htons(ETHERTYPE_IP);
+    memcpy(eh + 1, pkt.data(), pkt.size());
+    m->m_len = m->m_pktlen = sizeof(*eh) + pkt.size();
+    m->m_csum = csum;
+    return m;
+}
+
+/*
+ * The QoS data MPDU ieee80211_encap() builds from eh and pkt, sent to
+ * (dir IEEE80211_FC1_DIR_TODS) or from (IEEE80211_FC1_DIR_FROMDS) the AP.
+ */
+static mbuf_t
+mpdu(int dir, const struct ether_header *eh,
+    const std::vector<u_int8_t> &pkt, size_t lead, int csum)
+{
+    mbuf_t m = mbuf_alloc(lead);
+    struct ieee80211_qosframe *qwh = mtod(m, struct ieee80211_qosframe *);
+    struct llc *llc = (struct llc *)(qwh + 1);
+
+    memset(qwh, 0, sizeof(*qwh));
+    qwh->i_fc[0] = IEEE80211_FC0_VERSION_0 | IEEE80211_FC0_TYPE_DATA |
+        IEEE80211_FC0_SUBTYPE_QOS;
+    qwh->i_fc[1] = dir;
+    if (dir == IEEE80211_FC1_DIR_TODS) {
+        IEEE80211_ADDR_COPY(qwh->i_addr1, bssid);
+        IEEE80211_ADDR_COPY(qwh->i_addr2, eh->ether_shost);
+        IEEE80211_ADDR_COPY(qwh->i_addr3, eh->ether_dhost);
+    } else {
+        IEEE80211_ADDR_COPY(qwh->i_addr1, eh->ether_dhost);
+        IEEE80211_ADDR_COPY(qwh->i_addr2, bssid);
+        IEEE80211_ADDR_COPY(qwh->i_addr3, eh->ether_shost);
+    }
+    qwh->i_qos[0] = 5;  /* TID */
+    llc->llc_dsap = llc->llc_ssap = LLC_SNAP_LSAP;
+    llc->llc_control = LLC_UI;
+    llc->llc_snap.org_code[0] = llc->llc_snap.org_code[1] =
+        llc->llc_snap.org_code[2] = 0;
+    llc->llc_snap.ether_type = eh->ether_type;
+    memcpy(llc + 1, pkt.data(), pkt.size());
+    m->m_len = m->m_pktlen = HDRLEN + LLC_SNAPFRAMELEN + pkt.size();
+    m->m_csum = csum;
+    return m;
+}
+
+/*
+ * Parse A-MSDU m as a receiver does and compare its subframes with
+ * pkts, all from src to dst. Returns a description of the first
+ * difference, or NULL.
+ */
+static const char *
+parse(mbuf_t m, const u_int8_t *dst, const u_int8_t *src,
+    const std::vector<std::vector<u_int8_t> > &pkts)
+{
+    std::vector<u_int8_t> f(mbuf_pkthdr_len(m));
+    const struct ether_header *sh;
+    const struct llc *llc;
+    size_t off, len, i, chain = 0;
+    mbuf_t n;
+
+    for (n = m; n != NULL; n = n->m_next)
+        chain += n->m_len;
+    if (chain != f.size())
+        return "packet header length differs from the chain";
+    m_copydata(m, 0, f.size(), f.data());
+
+    for (i = 0, off = HDRLEN; i < pkts.size(); i++) {
+        if ((off - HDRLEN) % 4 != 0)
+            return "subframe not aligned to 4 bytes";
+        if (off + sizeof(*sh) + LLC_SNAPFRAMELEN > f.size())
+            return "truncated subframe header";
+        sh = (const struct ether_header *)&f[off];
+        if (!IEEE80211_ADDR_EQ(sh->ether_dhost, dst) ||
+            !IEEE80211_ADDR_EQ(sh->ether_shost, src))
+            return "wrong subframe addresses";
+        len = ntohs(sh->ether_type);
+        if (len != LLC_SNAPFRAMELEN + pkts[i].size())
+            return "wrong subframe length";
+        llc = (const struct llc *)(sh + 1);
+        if (llc->llc_dsap != LLC_SNAP_LSAP ||
+            llc->llc_ssap != LLC_SNAP_LSAP || llc->llc_control != LLC_UI ||
+            llc->llc_snap.ether_type != htons(ETHERTYPE_IP))
+            return "wrong LLC header";
+        if (off + sizeof(*sh) + len > f.size() ||
+            memcmp(llc + 1, pkts[i].data(), pkts[i].size()) != 0)
+            return "payload differs";
+        off += sizeof(*sh) + len;
+        if (i + 1 < pkts.size()) {
+            for (; (off - HDRLEN) % 4 != 0; off++)
+                if (off >= f.size() || f[off] != 0)
+                    return "padding not zero";
+        }
+    }
+    return off == f.size() ? NULL : "trailing bytes";
+}
+
+static void
+test_encap(int dir, const char *name)
+{
+    struct ieee80211com ic;
+    struct ieee80211_qosframe *qwh;
+    std::vector<std::vector<u_int8_t> > pkts;
+    struct ether_header eh;
+    const u_int8_t *dst, *src;
+    char what[128];
+    mbuf_t m;
+
+    memset(&ic, 0, sizeof(ic));
+    dst = dir == IEEE80211_FC1_DIR_TODS ? peer : sta;
+    src = dir == IEEE80211_FC1_DIR_TODS ? sta : peer;
+    IEEE80211_ADDR_COPY(eh.ether_dhost, dst);
+    IEEE80211_ADDR_COPY(eh.ether_shost, src);
+    eh.ether_type = htons(ETHERTYPE_IP);
+    pkts.push_back(packet(101, 1));
+
+    m = mpdu(dir, &eh, pkts[0], 64, 0);
+    m = ieee80211_amsdu_encap(&ic, m, &eh);
+    qwh = mtod(m, struct ieee80211_qosframe *);
+    snprintf(what, sizeof(what), "%s: A-MSDU present bit set, TID kept",
+        name);
+    check(what, qwh->i_qos[0] == (IEEE80211_QOS_AMSDU | 5));
+    snprintf(what, sizeof(what), "%s: addr3 is the BSSID", name);
+    check(what, IEEE80211_ADDR_EQ(qwh->i_addr3, bssid));
+    snprintf(what, sizeof(what), "%s: addr1 and addr2 kept", name);
+    check(what, dir == IEEE80211_FC1_DIR_TODS ?
+        IEEE80211_ADDR_EQ(qwh->i_addr1, bssid) &&
+        IEEE80211_ADDR_EQ(qwh->i_addr2, src) :
+        IEEE80211_ADDR_EQ(qwh->i_addr1, dst) &&
+        IEEE80211_ADDR_EQ(qwh->i_addr2, bssid));
+    snprintf(what, sizeof(what), "%s: one subframe with DA, SA and length",
+        name);
+    check(what, mbuf_pkthdr_len(m) == HDRLEN + ETHER_HDR_LEN +
+        LLC_SNAPFRAMELEN + 101 && parse(m, dst, src, pkts) == NULL);
+    mbuf_freem(m);
+}
+
+static void
+test_nonqos(void)
+{
+    struct ieee80211com ic;
+    struct ether_header eh;
+    mbuf_t m, m0;
+
+    memset(&ic, 0, sizeof(ic));
+    IEEE80211_ADDR_COPY(eh.ether_dhost, peer);
+    IEEE80211_ADDR_COPY(eh.ether_shost, sta);
+    eh.ether_type = htons(ETHERTYPE_IP);
+    m0 = m = mpdu(IEEE80211_FC1_DIR_TODS, &eh, packet(60, 0), 64, 0);
+    mtod(m, struct ieee80211_frame *)->i_fc[0] = IEEE80211_FC0_VERSION_0 |
+        IEEE80211_FC0_TYPE_DATA | IEEE80211_FC0_SUBTYPE_DATA;
+    m = ieee80211_amsdu_encap(&ic, m, &eh);
+    check("non-QoS MPDU left alone", m == m0 &&
+        mbuf_pkthdr_len(m) == HDRLEN + LLC_SNAPFRAMELEN + 60);
+    mbuf_freem(m);
+}
+
+/*
+ * Subframes of every length modulo 4 after each other, in mbufs with
+ * and without room in front, so that headers end up split.
+ */
+static void
+test_append(void)
+{
+    struct ieee80211com ic;
+    std::vector<std::vector<u_int8_t> > pkts;
+    struct ether_header eh;
+    const char *err = NULL;
+    size_t lead;
+    int i, n = 0;
+    mbuf_t m;
+
+    memset(&ic, 0, sizeof(ic));
+    IEEE80211_ADDR_COPY(eh.ether_dhost, peer);
+    IEEE80211_ADDR_COPY(eh.ether_shost, sta);
+    eh.ether_type = htons(ETHERTYPE_IP);
+
+    for (lead = 0; lead <= 64 && err == NULL; lead += 64) {
+        for (i = 0; i < 8 && err == NULL; i++) {
+            pkts.clear();
+            pkts.push_back(packet(40 + i, i));
+            m = mpdu(IEEE80211_FC1_DIR_TODS, &eh, pkts[0], lead, 0);
+            if ((m = ieee80211_amsdu_encap(&ic, m, &eh)) == NULL) {
+                err = "encap failed";
+                break;
+            }
+            for (n = 1; n < 6; n++) {
+                pkts.push_back(packet(40 + (i + n) % 8 + 100 * n, n));
+                if (ieee80211_amsdu_append(&ic, m, ether(peer, sta,
+                    pkts.back(), lead, 0)) != 0) {
+                    err = "append failed";
+                    break;
+                }
+            }
+            if (err == NULL)
+                err = parse(m, peer, sta, pkts);
+            mbuf_freem(m);
+        }
+    }
+    check("append: subframes padded, aligned and intact",
+        err == NULL && ic.ic_stats.is_tx_nombuf == 0);
+    if (err != NULL)
+        printf("     %s\n", err);
+    check("append: no mbufs leaked", nmbufs == 0);
+}
+
+/* Deferred checksums are computed at the IP header of each subframe. */
+static void
+test_csum(void)
+{
+    struct ieee80211com ic;
+    struct ether_header eh;
+    size_t i;
+    bool ok;
+    mbuf_t m;
+
+    memset(&ic, 0, sizeof(ic));
+    IEEE80211_ADDR_COPY(eh.ether_dhost, peer);
+    IEEE80211_ADDR_COPY(eh.ether_shost, sta);
+    eh.ether_type = htons(ETHERTYPE_IP);
+    finalized.clear();
+    m = mpdu(IEEE80211_FC1_DIR_TODS, &eh, packet(200, 9), 64, 1);
+    m = ieee80211_amsdu_encap(&ic, m, &eh);
+    (void)ieee80211_amsdu_append(&ic, m, ether(peer, sta, packet(99, 3),
+        64, 1));
+    (void)ieee80211_amsdu_append(&ic, m, ether(peer, sta, packet(99, 4),
+        64, 0));
+    ok = finalized.size() == 2;
+    for (i = 0; ok && i < finalized.size(); i++)
+        ok = finalized[i].family == PF_INET && finalized[i].first == 0x45;
+    check("checksums finalized at the IP header, only when requested", ok);
+    mbuf_freem(m);
+}
+
+static void
+test_nomem(void)
+{
+    struct ieee80211com ic;
+    std::vector<std::vector<u_int8_t> > pkts;
+    struct ether_header eh;
+    size_t len;
+    mbuf_t m, m1;
+    int error;
+
+    memset(&ic, 0, sizeof(ic));
+    IEEE80211_ADDR_COPY(eh.ether_dhost, peer);
+    IEEE80211_ADDR_COPY(eh.ether_shost, sta);
+    eh.ether_type = htons(ETHERTYPE_IP);
+
+    /* No room in front: the prepend needs an mbuf. */
+    m = mpdu(IEEE80211_FC1_DIR_TODS, &eh, packet(80, 0), 0, 0);
+    nomem = 1;
+    m = ieee80211_amsdu_encap(&ic, m, &eh);
+    check("encap: no mbuf counted and the MPDU freed",
+        m == NULL && ic.ic_stats.is_tx_nombuf == 1 && nmbufs == 0);
+
+    pkts.push_back(packet(80, 0));
+    m = mpdu(IEEE80211_FC1_DIR_TODS, &eh, pkts[0], 64, 0);
+    m = ieee80211_amsdu_encap(&ic, m, &eh);
+    len = mbuf_pkthdr_len(m);
+    m1 = ether(peer, sta, packet(80, 1), 0, 0);
+    nomem = 1;
+    error = ieee80211_amsdu_append(&ic, m, m1);
+    check("append: no mbuf counted, frame freed, A-MSDU unchanged",
+        error == ENOBUFS && ic.ic_stats.is_tx_nombuf == 2 &&
+        nmbufs == 1 && mbuf_pkthdr_len(m) == len &&
+        parse(m, peer, sta, pkts) == NULL);
+    mbuf_freem(m);
+}
+
+#define PHY_MBPS    866.7   /* VHT MCS 9, 80 MHz, 2 streams, short GI */
+#define PPDU_MAX    5484.0  /* usec */
+#define AMPDU_MAX   64      /* MPDUs */
+#define TXOP_FIXED  (34 + 67.5 + 44 + 16 + 44)  /* AIFS, backoff, preamble,
+                                                 * SIFS, Block Ack */
+#define CCMP_LEN    (8 + 8) /* header and MIC */
+#define FCS_LEN     4
+#define DELIM_LEN   4
+
+static double
+now_usec(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+static void
+bench(int msdus)
+{
+    static const u_int maxlen[] = { 0, IEEE80211_MAX_MPDU_LEN_VHT_3895,
+        IEEE80211_MAX_MPDU_LEN_VHT_7991, IEEE80211_MAX_MPDU_LEN_VHT_11454 };
+    std::vector<u_int8_t> pkt = packet(1500 - 20, 0);
+    struct ieee80211com ic;
+    struct ether_header eh;
+    double t, mpdu_us, ppdu_us;
+    size_t len, onair;
+    u_int i, k, per, n;
+    mbuf_t m;
+
+    memset(&ic, 0, sizeof(ic));
+    IEEE80211_ADDR_COPY(eh.ether_dhost, peer);
+    IEEE80211_ADDR_COPY(eh.ether_shost, sta);
+    eh.ether_type = htons(ETHERTYPE_IP);
+
+    printf("     max MPDU  MSDUs/MPDU  ns/MSDU  kMPDU/s  kMSDU/s\n");
+    for (i = 0; i < nitems(maxlen); i++) {
+        /* Subframes of 14 + 8 + 1480 bytes, padded, that fit. */
+        per = 1;
+        if (maxlen[i] != 0) {
+            while (HDRLEN + CCMP_LEN + FCS_LEN + (per + 1) *
+                roundup(ETHER_HDR_LEN + LLC_SNAPFRAMELEN + pkt.size(), 4) <=
+                maxlen[i])
+                per++;
+        }
+
+        t = now_usec();
+        len = 0;
+        for (n = 0; n < (u_int)msdus; n += per) {
+            m = mpdu(IEEE80211_FC1_DIR_TODS, &eh, pkt, 64, 0);
+            if (per > 1)
+                m = ieee80211_amsdu_encap(&ic, m, &eh);
+            for (k = 1; k < per; k++)
+                (void)ieee80211_amsdu_append(&ic, m,
+                    ether(peer, sta, pkt, 64, 0));
+            len = mbuf_pkthdr_len(m);
+            mbuf_freem(m);
+        }
+        t = now_usec() - t;
+
+        /* A-MPDUs of up to 64 MPDUs within the PPDU limit. */
+        onair = roundup(DELIM_LEN + len + CCMP_LEN + FCS_LEN, 4);
+        mpdu_us = onair * 8 / PHY_MBPS;
+        k = MIN(AMPDU_MAX, (u_int)(PPDU_MAX / mpdu_us));
+        ppdu_us = TXOP_FIXED + k * mpdu_us;
+        printf("     %8u %11u %8.0f %8.1f %8.1f\n", maxlen[i], per,
+            t * 1000 / n, k / ppdu_us * 1000, k * per / ppdu_us * 1000);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    test_encap(IEEE80211_FC1_DIR_TODS, "to DS");
+    test_encap(IEEE80211_FC1_DIR_FROMDS, "from DS");
+    test_nonqos();
+    test_append();
+    test_csum();
+    test_nomem();
+    bench(argc > 1 ? atoi(argv[1]) : 200000);
+
+    printf("%d failed\n", failures);
+    return failures != 0;
+}
@@ -0,0 +1,495 @@
+/*
+ * Frame level tests of 802.11v BSS Transition Management: requests from
+ * our AP go through ieee80211_recv_btm_req() in ieee80211_input.c and
+ * ieee80211_btm_request() in ieee80211_node.c, and the answer is built by
+ * ieee80211_get_btm_resp() in ieee80211_output.c.
+ *
+ * The node cache, the choice of an AP and the move to it are stand-ins:
+ * the tests fill the cache with what a scan would have found and check
+ * which candidate is taken, when the channels of the candidates are
+ * scanned instead, and how ieee80211_btm_end_scan() answers the request
+ * with the scan results, with and without Disassociation Imminent. The
+ * request frames are also replayed cut off at every length under
+ * AddressSanitizer.
+ *
+ *   Generate net80211_defs.inc as net80211_env.h says, then:
+ *
+ *   N=../itl80211/openbsd/net80211
+ *   (awk -v fns="ieee80211_roam_uptime ieee80211_nbr_lookup \
+ *        ieee80211_nbr_store ieee80211_nbr_prepare ieee80211_btm_select \
+ *        ieee80211_btm_respond ieee80211_btm_scan ieee80211_btm_request \
+ *        ieee80211_btm_end_scan" -f extract.awk $N/ieee80211_node.c &&
+ *    awk -v fns="ieee80211_parse_nbr ieee80211_recv_btm_req" \
+ *        -f extract.awk $N/ieee80211_input.c &&
+ *    awk -v fns=ieee80211_get_btm_resp -f extract.awk \
+ *        $N/ieee80211_output.c) > btm.inc
+ *   c++ -std=c++11 -g -fsanitize=address,undefined -I compat \
+ *       -idirafter ../itl80211/openbsd -o btm_test btm_test.cpp
+ *   ./btm_test [-v]
+ */
+
+#include "net80211_env.h"
+
+#include <errno.h>
+
+#ifndef MBUF_DONTWAIT
+#define MBUF_DONTWAIT   0
+#endif
+#ifndef MT_DATA
+#define MT_DATA         1
+#endif
+
+/* The node cache as the last scan left it. */
+struct cache_entry {
+    struct ieee80211_node ni;
+    int fail;           /* what ieee80211_match_bss() returns */
+    u_int32_t tput;     /* kbit/s */
+};
+static struct cache_entry cache[8];
+static int ncache, nfree;
+
+static struct ieee80211_node *
+ieee80211_find_node(struct ieee80211com *, const u_int8_t *macaddr)
+{
+    for (int i = 0; i < ncache; i++)
+        if (IEEE80211_ADDR_EQ(cache[i].ni.ni_macaddr, macaddr))
+            return &cache[i].ni;
+    return NULL;
+}
+
+static struct cache_entry *
+entry(const struct ieee80211_node *ni)
+{
+    return (struct cache_entry *)ni;
+}
+
+static int
+ieee80211_match_bss(struct ieee80211com *, struct ieee80211_node *ni, int)
+{
+    return entry(ni)->fail;
+}
+
+static u_int32_t
+ieee80211_node_estimate_tput(struct ieee80211com *, struct ieee80211_node *ni)
+{
+    return entry(ni)->tput;
+}
+
+static int
+ieee80211_node_cmp(const struct ieee80211_node *a,
+    const struct ieee80211_node *b)
+{
+    return memcmp(a->ni_macaddr, b->ni_macaddr, IEEE80211_ADDR_LEN);
+}
+
+/* The fastest AP of our ESS we can use, our own AP included. */
+static struct ieee80211_node *
+ieee80211_node_choose_bss(struct ieee80211com *ic, int,
+    struct ieee80211_node **)
+{
+    struct ieee80211_node *bss = ic->ic_bss, *selbs = NULL;
+
+    for (int i = 0; i < ncache; i++) {
+        struct ieee80211_node *ni = &cache[i].ni;
+
+        if (cache[i].fail || ni->ni_esslen != bss->ni_esslen ||
+            memcmp(ni->ni_essid, bss->ni_essid, bss->ni_esslen) != 0)
+            continue;
+        if (selbs == NULL || cache[i].tput > entry(selbs)->tput)
+            selbs = ni;
+    }
+    return selbs;
+}
+
+static void
+ieee80211_free_allnodes(struct ieee80211com *, int)
+{
+    ncache = 0;
+    nfree++;
+}
+
+/* Moves to another AP, as ieee80211_node_leave_bss() starts them. */
+struct leave {
+    struct ieee80211_node *curbs;
+    u_int8_t bssid[IEEE80211_ADDR_LEN];
+    int steered;
+};
+static std::vector<struct leave> leaves;
+
+static int
+ieee80211_node_leave_bss(struct ieee80211com *, struct ieee80211_node *curbs,
+    struct ieee80211_node *selbs, int steered)
+{
+    struct leave l = { curbs, {}, steered };
+
+    IEEE80211_ADDR_COPY(l.bssid, selbs->ni_bssid);
+    leaves.push_back(l);
+    return 0;
+}
+
+/* Background scans started, with the channels they visit. */
+struct scan {
+    int partial;
+    u_char chans[howmany(IEEE80211_CHAN_MAX, NBBY)];
+};
+static std::vector<struct scan> scans;
+static int bgscan_err;
+
+static int
+env_bgscan_start(struct ieee80211com *ic)
+{
+    struct scan s;
+
+    if (bgscan_err)
+        return bgscan_err;
+    s.partial = ic->ic_chanhist.ch_partial;
+    memcpy(s.chans, ic->ic_chanhist.ch_scan, sizeof(s.chans));
+    scans.push_back(s);
+    return 0;
+}
+
+static mbuf_t
+ieee80211_getmgmt(int, int, u_int pktlen)
+{
+    mbuf_t m = (mbuf_t)calloc(1, sizeof(*m));
+
+    m->m_data = (u_int8_t *)calloc(1, pktlen);
+    m->m_len = pktlen;
+    return m;
+}
+
+static void mbuf_pkthdr_setlen(mbuf_t, size_t) {}
+static void mbuf_setlen(mbuf_t m, size_t len) { m->m_len = len; }
+
+#include "btm.inc"
+
+/* BSS Transition Management Response frames sent. */
+static std::vector<std::vector<u_int8_t> > responses;
+
+static int
+btm_send_mgmt(struct ieee80211com *ic, struct ieee80211_node *ni, int type,
+    int arg1, int arg2)
+{
+    mbuf_t m;
+
+    env_send_mgmt(ic, ni, type, arg1, arg2);
+    if (arg1 >> 16 != IEEE80211_CATEG_WNM ||
+        (arg1 & 0xffff) != IEEE80211_ACTION_BTM_RESP)
+        return 0;
+    m = ieee80211_get_btm_resp(ic, ni);
+    responses.push_back(std::vector<u_int8_t>(m->m_data,
+        m->m_data + m->m_len));
+    free(m->m_data);
+    free(m);
+    return 0;
+}
+
+static const u_int8_t ap[IEEE80211_ADDR_LEN] =
+    { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+
+static struct ieee80211com ic;
+static struct ieee80211_node bss;
+
+static void
+setup(void)
+{
+    env_init(&ic, &bss, "corp", ap);
+    ic.ic_send_mgmt = btm_send_mgmt;
+    ic.ic_bgscan_start = env_bgscan_start;
+    ncache = nfree = bgscan_err = 0;
+    leaves.clear();
+    scans.clear();
+    responses.clear();
+}
+
+/* An AP 02:00:00:00:01:<id> of the ESS named essid heard on chan. */
+static struct ieee80211_node *
+cached(u_int8_t id, int chan, u_int32_t tput, const char *essid = "corp")
+{
+    struct cache_entry *ce = &cache[ncache++];
+    const u_int8_t addr[IEEE80211_ADDR_LEN] = { 0x02, 0, 0, 0, 0x01, id };
+
+    memset(ce, 0, sizeof(*ce));
+    IEEE80211_ADDR_COPY(ce->ni.ni_macaddr, addr);
+    IEEE80211_ADDR_COPY(ce->ni.ni_bssid, addr);
+    ce->ni.ni_esslen = strlen(essid);
+    memcpy(ce->ni.ni_essid, essid, ce->ni.ni_esslen);
+    ce->ni.ni_chan = &ic.ic_channels[chan];
+    ce->tput = tput;
+    return &ce->ni;
+}
+
+/* BSS Transition Candidate List Entry for 02:00:00:00:01:<id>. */
+static std::vector<u_int8_t>
+cand(u_int8_t id, u_int8_t chan, int pref = -1)
+{
+    std::vector<u_int8_t> e = {
+        IEEE80211_ELEMID_NBR_REPORT, 0, 0x02, 0x00, 0x00, 0x00, 0x01, id,
+        IEEE80211_NBR_BSSINFO_REACH_YES, 0, 0, 0,
+        (u_int8_t)(chan <= 14 ? 81 : 115), chan, 7
+    };
+
+    if (pref >= 0) {
+        e.push_back(IEEE80211_NBR_SUBELEM_BTM_PREF);
+        e.push_back(1);
+        e.push_back(pref);
+    }
+    e[1] = e.size() - 2;
+    return e;
+}
+
+static std::vector<u_int8_t>
+req(u_int8_t token, u_int8_t mode,
+    const std::vector<std::vector<u_int8_t> > &cands = {},
+    const std::vector<u_int8_t> &opt = {})
+{
+    std::vector<u_int8_t> body = {
+        IEEE80211_CATEG_WNM, IEEE80211_ACTION_BTM_REQ, token, mode,
+        100, 0,         /* Disassociation Timer */
+        255             /* Validity Interval */
+    };
+
+    body.insert(body.end(), opt.begin(), opt.end());
+    for (auto &c : cands)
+        body.insert(body.end(), c.begin(), c.end());
+    return env_action(ap, body);
+}
+
+static void
+recv(const std::vector<u_int8_t> &f, size_t len)
+{
+    env_recv(ieee80211_recv_btm_req, &ic, &bss, f, len);
+}
+
+static void
+recv(const std::vector<u_int8_t> &f)
+{
+    recv(f, f.size());
+}
+
+/* Whether the only response so far has this token, status and target. */
+static bool
+answered(u_int8_t token, u_int8_t status, int id = -1)
+{
+    std::vector<u_int8_t> want = {
+        IEEE80211_CATEG_WNM, IEEE80211_ACTION_BTM_RESP, token, status, 0
+    };
+
+    if (id >= 0) {
+        const u_int8_t target[] = { 0x02, 0, 0, 0, 0x01, (u_int8_t)id };
+
+        want.insert(want.end(), target, target + sizeof(target));
+    }
+    return responses.size() == 1 && responses[0] == want;
+}
+
+/* Whether the only move so far was to 02:00:00:00:01:<id>. */
+static bool
+moved(u_int8_t id)
+{
+    return leaves.size() == 1 && leaves[0].curbs == &bss &&
+        leaves[0].bssid[5] == id && leaves[0].steered &&
+        (ic.ic_flags & IEEE80211_F_BGSCAN);
+}
+
+#define CAND    IEEE80211_BTM_REQ_CAND_LIST
+#define ABRIDGED IEEE80211_BTM_REQ_ABRIDGED
+#define DISASSOC IEEE80211_BTM_REQ_DISASSOC
+
+static void
+test_cached(void)
+{
+    setup();
+    cached(1, 6, 50000);
+    cached(2, 40, 20000);
+    recv(req(1, CAND | ABRIDGED, { cand(1, 6, 100), cand(2, 40, 200) }));
+    check("most preferred cached candidate accepted",
+        answered(1, IEEE80211_BTM_STATUS_ACCEPT, 2) && moved(2));
+    check("no scan when a candidate is cached", scans.empty());
+
+    setup();
+    cached(1, 6, 50000);
+    cached(2, 40, 20000);
+    recv(req(2, CAND | ABRIDGED, { cand(1, 6, 100), cand(2, 40, 100) }));
+    check("faster of equally preferred candidates",
+        answered(2, IEEE80211_BTM_STATUS_ACCEPT, 1) && moved(1));
+
+    setup();
+    cached(1, 6, 50000);
+    cached(2, 40, 20000)->ni_fails = 1;
+    cached(3, 44, 20000);
+    cache[2].fail = 1;
+    cached(4, 48, 20000);
+    recv(req(3, CAND | ABRIDGED,
+        { cand(1, 6, 0), cand(2, 40), cand(3, 44, 250), cand(4, 48, 10) }));
+    check("excluded, failed and unusable candidates are passed over",
+        answered(3, IEEE80211_BTM_STATUS_ACCEPT, 4) && moved(4));
+
+    setup();
+    cached(7, 11, 30000);
+    recv(req(4, 0));
+    check("without a list any AP of the ESS will do",
+        answered(4, IEEE80211_BTM_STATUS_ACCEPT, 7) && moved(7));
+}
+
+static void
+test_scan(void)
+{
+    const struct scan *s;
+
+    setup();
+    cached(9, 1, 90000);
+    recv(req(5, CAND | ABRIDGED, { cand(1, 6, 100), cand(2, 100, 200) }));
+    check("candidates not cached: no answer before scanning",
+        responses.empty() && leaves.empty() && ic.ic_btm.bt_scan);
+    check("one background scan started",
+        scans.size() == 1 && (ic.ic_flags & IEEE80211_F_BGSCAN) &&
+        ic.ic_btm.bt_nscan == 1);
+    check("node cache emptied for the scan", nfree == 1 && ncache == 0);
+    s = &scans[0];
+    check("scan visits the candidates' channels and ours only",
+        s->partial && isset(s->chans, 6) && isset(s->chans, 100) &&
+        isset(s->chans, 36) && !isset(s->chans, 1) &&
+        !isset(s->chans, 11) && !isset(s->chans, 40) &&
+        !isset(s->chans, 104));
+
+    cached(1, 6, 10000);
+    cached(2, 100, 60000);
+    check("end of the scan answers the request",
+        ieee80211_btm_end_scan(&ic, 1) != 0 && !ic.ic_btm.bt_scan);
+    check("most preferred candidate found by the scan accepted",
+        answered(5, IEEE80211_BTM_STATUS_ACCEPT, 2) && moved(2));
+    check("a later scan is left alone", ieee80211_btm_end_scan(&ic, 1) == 0);
+
+    setup();
+    recv(req(6, CAND | ABRIDGED, { cand(1, 6, 100) }));
+    cached(8, 11, 90000);
+    check("scan without candidates ends the request",
+        ieee80211_btm_end_scan(&ic, 1) != 0 &&
+        !(ic.ic_flags & IEEE80211_F_BGSCAN));
+    check("abridged list: other APs are declined",
+        answered(6, IEEE80211_BTM_STATUS_REJECT_NO_CAND) && leaves.empty());
+
+    setup();
+    recv(req(7, CAND | ABRIDGED | DISASSOC, { cand(1, 6, 100) }));
+    cached(8, 11, 90000);
+    cached(5, 13, 99000, "guest");
+    ieee80211_btm_end_scan(&ic, 1);
+    check("disassociation imminent: any AP of the ESS rather than none",
+        answered(7, IEEE80211_BTM_STATUS_ACCEPT, 8) && moved(8));
+
+    setup();
+    recv(req(8, DISASSOC));
+    check("nothing cached: all channels scanned",
+        scans.size() == 1 && !scans[0].partial && responses.empty());
+    ieee80211_btm_end_scan(&ic, 1);
+    check("disassociation imminent, no AP found: declined",
+        answered(8, IEEE80211_BTM_STATUS_REJECT_NO_CAND) && leaves.empty() &&
+        !(ic.ic_flags & IEEE80211_F_BGSCAN));
+
+    setup();
+    recv(req(9, CAND | ABRIDGED, { cand(1, 165, 100), cand(2, 14, 100) }));
+    check("no usable candidate channel: all channels scanned",
+        scans.size() == 1 && !scans[0].partial);
+
+    setup();
+    recv(req(10, CAND | ABRIDGED, { cand(1, 6, 100) }));
+    ic.ic_flags &= ~IEEE80211_F_BGSCAN;
+    check("scan ended after leaving the AP: nothing sent",
+        ieee80211_btm_end_scan(&ic, 0) == 0 && !ic.ic_btm.bt_scan &&
+        responses.empty());
+}
+
+static void
+test_reject(void)
+{
+    setup();
+    bgscan_err = EBUSY;
+    recv(req(11, CAND | ABRIDGED, { cand(1, 6, 100) }));
+    check("scan cannot start: declined at once",
+        answered(11, IEEE80211_BTM_STATUS_REJECT_NO_CAND) &&
+        !ic.ic_chanhist.ch_partial && !ic.ic_btm.bt_scan &&
+        !(ic.ic_flags & IEEE80211_F_BGSCAN));
+
+    setup();
+    ic.ic_bgscan_start = NULL;
+    recv(req(12, CAND | ABRIDGED, { cand(1, 6, 100) }));
+    check("driver without background scans: declined at once",
+        answered(12, IEEE80211_BTM_STATUS_REJECT_NO_CAND));
+
+    setup();
+    cached(1, 6, 50000);
+    ic.ic_flags |= IEEE80211_F_BGSCAN;
+    recv(req(13, CAND | ABRIDGED, { cand(1, 6, 100) }));
+    check("declined while scanning",
+        answered(13, IEEE80211_BTM_STATUS_REJECT_UNSPEC) && leaves.empty() &&
+        scans.empty());
+
+    setup();
+    cached(1, 6, 50000);
+    ic.ic_flags |= IEEE80211_F_DESBSSID;
+    recv(req(14, CAND | ABRIDGED, { cand(1, 6, 100) }));
+    check("declined with a fixed BSSID",
+        answered(14, IEEE80211_BTM_STATUS_REJECT_UNSPEC) && leaves.empty());
+}
+
+static void
+test_frame(void)
+{
+    std::vector<u_int8_t> term(IEEE80211_BTM_BSS_TERM_LEN, 0x11);
+    std::vector<u_int8_t> url = { 4, 'h', 't', 't', 'p' };
+    std::vector<u_int8_t> opt = term;
+    std::vector<u_int8_t> f;
+    size_t len;
+    bool ok = true;
+
+    opt.insert(opt.end(), url.begin(), url.end());
+    setup();
+    cached(3, 44, 50000);
+    recv(req(20, CAND | ABRIDGED | IEEE80211_BTM_REQ_BSS_TERM |
+        IEEE80211_BTM_REQ_ESS_DISASSOC, { cand(3, 44, 10) }, opt));
+    check("candidates after BSS termination and session URL",
+        answered(20, IEEE80211_BTM_STATUS_ACCEPT, 3) && moved(3));
+
+    setup();
+    f = req(21, CAND | IEEE80211_BTM_REQ_BSS_TERM, {}, { 1, 2, 3 });
+    recv(f);
+    check("truncated BSS termination: ignored",
+        responses.empty() && ic.ic_btm.bt_nreq == 0);
+
+    setup();
+    bss.ni_port_valid = 0;
+    ic.ic_flags |= IEEE80211_F_RSNON;
+    recv(req(22, 0));
+    check("ignored before the port is valid", ic.ic_btm.bt_nreq == 0);
+
+    setup();
+    ic.ic_state = IEEE80211_S_ASSOC;
+    recv(req(23, 0));
+    check("ignored unless associated", ic.ic_btm.bt_nreq == 0);
+
+    f = req(24, CAND | ABRIDGED | DISASSOC | IEEE80211_BTM_REQ_BSS_TERM |
+        IEEE80211_BTM_REQ_ESS_DISASSOC, { cand(1, 6, 100), cand(2, 40) },
+        opt);
+    for (len = 0; len <= f.size(); len++) {
+        setup();
+        recv(f, len);
+        if (responses.size() + scans.size() > 1 ||
+            ic.ic_btm.bt_ncand < 0 ||
+            ic.ic_btm.bt_ncand > IEEE80211_NBR_MAX)
+            ok = false;
+    }
+    printf("     replayed %zu frames\n", len);
+    check("request cut off at every length", ok);
+}
+
+int
+main(int argc, char **argv)
+{
+    env_verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+    test_cached();
+    test_scan();
+    test_reject();
+    test_frame();
+    return failures != 0;
+}
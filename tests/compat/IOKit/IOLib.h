@@ -0,0 +1,27 @@
+/*
+ * The allocator sys/_malloc.h builds on; nothing else the sources under
+ * test use from here.
+ */
+
+#ifndef _COMPAT_IOKIT_IOLIB_H_
+#define _COMPAT_IOKIT_IOLIB_H_
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <strings.h>
+
+typedef size_t vm_size_t;
+
+static inline void *
+IOMalloc(vm_size_t size)
+{
+    return ::malloc(size);
+}
+
+static inline void
+IOFree(void *addr, vm_size_t)
+{
+    ::free(addr);
+}
+
+#endif /* _COMPAT_IOKIT_IOLIB_H_ */
@@ -0,0 +1,49 @@
+/*
+ * IOSimpleLock over a pthread mutex, for sys/_ifq.h and the queue code
+ * built from _ifq.cpp.
+ */
+
+#ifndef _COMPAT_IOKIT_IOLOCKS_H_
+#define _COMPAT_IOKIT_IOLOCKS_H_
+
+#include <libkern/OSTypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+typedef pthread_mutex_t IOSimpleLock;
+
+static inline IOSimpleLock *
+IOSimpleLockAlloc(void)
+{
+    IOSimpleLock *lock = (IOSimpleLock *)malloc(sizeof(*lock));
+
+    pthread_mutex_init(lock, NULL);
+    return lock;
+}
+
+static inline void
+IOSimpleLockFree(IOSimpleLock *lock)
+{
+    pthread_mutex_destroy(lock);
+    free(lock);
+}
+
+static inline void
+IOSimpleLockLock(IOSimpleLock *lock)
+{
+    pthread_mutex_lock(lock);
+}
+
+static inline bool
+IOSimpleLockTryLock(IOSimpleLock *lock)
+{
+    return pthread_mutex_trylock(lock) == 0;
+}
+
+static inline void
+IOSimpleLockUnlock(IOSimpleLock *lock)
+{
+    pthread_mutex_unlock(lock);
+}
+
+#endif /* _COMPAT_IOKIT_IOLOCKS_H_ */
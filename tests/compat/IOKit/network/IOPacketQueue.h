@@ -0,0 +1,3 @@
+/*
+ * sys/_ifq.h still includes this; nothing in it is used by the queue.
+ */
@@ -0,0 +1,14 @@
+/*
+ * The uptime clock, declared only: a test that builds code reading it
+ * defines both functions, usually on a simulated clock.
+ */
+
+#ifndef _COMPAT_KERN_CLOCK_H_
+#define _COMPAT_KERN_CLOCK_H_
+
+#include <stdint.h>
+
+void clock_get_uptime(uint64_t *result);
+void absolutetime_to_nanoseconds(uint64_t abstime, uint64_t *result);
+
+#endif /* _COMPAT_KERN_CLOCK_H_ */
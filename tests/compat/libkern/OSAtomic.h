@@ -0,0 +1,23 @@
+/*
+ * The atomics the send queue uses, on the compiler builtins.
+ */
+
+#ifndef _COMPAT_LIBKERN_OSATOMIC_H_
+#define _COMPAT_LIBKERN_OSATOMIC_H_
+
+#include <libkern/OSTypes.h>
+
+static inline bool
+OSCompareAndSwap(UInt32 oldValue, UInt32 newValue, volatile UInt32 *address)
+{
+    return __atomic_compare_exchange_n(address, &oldValue, newValue, false,
+        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline SInt64
+OSIncrementAtomic64(volatile SInt64 *address)
+{
+    return __atomic_fetch_add(address, 1, __ATOMIC_SEQ_CST);
+}
+
+#endif /* _COMPAT_LIBKERN_OSATOMIC_H_ */
@@ -0,0 +1,15 @@
+/*
+ * The fixed-size types of the macOS kernel headers.
+ */
+
+#ifndef _COMPAT_LIBKERN_OSTYPES_H_
+#define _COMPAT_LIBKERN_OSTYPES_H_
+
+#include <stdint.h>
+
+typedef uint32_t UInt32;
+typedef int32_t SInt32;
+typedef uint64_t UInt64;
+typedef int64_t SInt64;
+
+#endif /* _COMPAT_LIBKERN_OSTYPES_H_ */
@@ -0,0 +1,4 @@
+/*
+ * sys/_ifq.h includes this for struct ifnet; the queue only passes a
+ * pointer to it around.
+ */
@@ -0,0 +1,26 @@
+/*
+ * A fixed sequence in place of the kernel's arc4random(), so that the
+ * flow hash seed and with it every simulation run repeats.  Like the
+ * real header it brings in IOKit/IOLib.h.
+ */
+
+#ifndef _COMPAT_SYS__ARC4RANDOM_H_
+#define _COMPAT_SYS__ARC4RANDOM_H_
+
+#include <IOKit/IOLib.h>
+#include <stdint.h>
+
+#define arc4random  compat_arc4random   /* glibc has its own */
+
+static inline uint32_t
+arc4random(void)
+{
+    static uint32_t x = 2463534242U;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+#endif /* _COMPAT_SYS__ARC4RANDOM_H_ */
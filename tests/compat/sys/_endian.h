@@ -0,0 +1,7 @@
+#ifndef _COMPAT_SYS__ENDIAN_H_
+#define _COMPAT_SYS__ENDIAN_H_
+
+#define _OSSwapInt32    __builtin_bswap32
+#define _OSSwapInt64    __builtin_bswap64
+
+#endif /* _COMPAT_SYS__ENDIAN_H_ */
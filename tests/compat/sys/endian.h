@@ -0,0 +1,10 @@
+#ifndef _COMPAT_SYS_ENDIAN_H_
+#define _COMPAT_SYS_ENDIAN_H_
+
+#include <endian.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define __packed    __attribute__((__packed__))
+
+#endif /* _COMPAT_SYS_ENDIAN_H_ */
@@ -0,0 +1,23 @@
+/*
+ * The part of the mbuf KPI the send queue uses, declared only: a test
+ * that builds _ifq.cpp defines these on its own struct __mbuf.
+ */
+
+#ifndef _COMPAT_SYS_KPI_MBUF_H_
+#define _COMPAT_SYS_KPI_MBUF_H_
+
+#include <sys/systm.h>
+#include <errno.h>
+
+typedef int errno_t;
+
+errno_t mbuf_copydata(const mbuf_t mbuf, size_t offset, size_t length,
+    void *out_data);
+mbuf_t mbuf_nextpkt(const mbuf_t mbuf);
+void mbuf_setnextpkt(mbuf_t mbuf, mbuf_t nextpkt);
+size_t mbuf_pkthdr_len(const mbuf_t mbuf);
+void *mbuf_pkthdr_header(const mbuf_t mbuf);
+void mbuf_pkthdr_setheader(mbuf_t mbuf, void *header);
+void mbuf_freem(mbuf_t mbuf);
+
+#endif /* _COMPAT_SYS_KPI_MBUF_H_ */
@@ -0,0 +1,34 @@
+/*
+ * Userspace stand-ins for the kernel headers the OpenBSD crypto and
+ * net80211 sources include, enough to build them into the tests here.
+ */
+
+#ifndef _COMPAT_SYS_SYSTM_H_
+#define _COMPAT_SYS_SYSTM_H_
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/queue.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct __mbuf *mbuf_t;
+
+#define nitems(_a)          (sizeof((_a)) / sizeof((_a)[0]))
+#define DIV_ROUND_UP(n, d)  (((n) + (d) - 1) / (d))
+#define hweight8(w)         __builtin_popcount((uint8_t)(w))
+
+static inline int
+timingsafe_bcmp(const void *b1, const void *b2, size_t n)
+{
+    const unsigned char *p1 = (const unsigned char *)b1;
+    const unsigned char *p2 = (const unsigned char *)b2;
+    int ret = 0;
+
+    for (; n > 0; n--)
+        ret |= *p1++ ^ *p2++;
+    return ret != 0;
+}
+
+#endif /* _COMPAT_SYS_SYSTM_H_ */
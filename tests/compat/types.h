@@ -0,0 +1,14 @@
+/* For crypto/sha1.h, which takes the Linux compat types. */
+
+#ifndef _COMPAT_TYPES_H_
+#define _COMPAT_TYPES_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#endif /* _COMPAT_TYPES_H_ */
@@ -0,0 +1,581 @@
+/*
+ * Tests of the per-node header templates of ieee80211_encap(): the
+ * 802.11 and LLC/SNAP headers of QoS data frames when a Block Ack
+ * agreement exists and of plain data frames otherwise, per-TID sequence
+ * numbers, EAPOL frames before the port is open, and templates that are
+ * reused until what they were built from (protection, ack policy, BSSID)
+ * changes, also when the template array cannot be allocated.
+ *
+ * The benchmark encapsulates 1500-byte frames and prints the cost per
+ * frame of ieee80211_encap() with its templates against rebuilding the
+ * template for every frame, which is the work the headers took before,
+ * less the cost of setting up the frame. Build it with -O2 and without
+ * the sanitizers for meaningful costs.
+ *
+ *   N=../itl80211/openbsd/net80211
+ *   (awk -v types=ieee80211_opmode -v defines="IEEE80211_STA_ONLY \
+ *        IEEE80211_ADDR_COPY IEEE80211_ADDR_EQ IEEE80211_F_WEPON \
+ *        IEEE80211_F_RSNON IEEE80211_F_QOS IEEE80211_F_COUNTERM \
+ *        IEEE80211_C_TX_AMPDU_SETUP_IN_RS" -f extract.awk \
+ *        $N/ieee80211_var.h &&
+ *    awk -v types="ieee80211_node_state ieee80211_txtmpl" \
+ *        -v defines="IEEE80211_BA_AGREED IEEE80211_NODE_QOS \
+ *        IEEE80211_NODE_TXPROT" -f extract.awk $N/ieee80211_node.h &&
+ *    awk -v types=ieee80211_cipher -f extract.awk \
+ *        $N/ieee80211_crypto.h) > encap_defs.inc
+ *   awk -v fns="ieee80211_classify ieee80211_txtmpl_build \
+ *       ieee80211_txtmpl_get ieee80211_encap" -f extract.awk \
+ *       $N/ieee80211_output.c > encap.inc
+ *   c++ -std=c++11 -g -fsanitize=address,undefined -I compat \
+ *       -idirafter ../itl80211/openbsd -o encap_template_test \
+ *       encap_template_test.cpp
+ *   ./encap_template_test [frames]
+ */
+
+#include <sys/systm.h>
+#include <sys/endian.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <arpa/inet.h>
+#include <errno.h>
+
+#define letoh16(x)  le16toh(x)
+
+/* For the frame helpers ieee80211.h keeps to the kernel. */
+#define _KERNEL
+#include <net80211/ieee80211.h>
+#undef _KERNEL
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "encap_defs.inc"
+
+/* <net/if_llc.h> of the macOS SDK. */
+struct llc {
+    u_int8_t llc_dsap;
+    u_int8_t llc_ssap;
+    u_int8_t llc_control;
+    struct {
+        u_int8_t org_code[3];
+        u_int16_t ether_type;
+    } __attribute__((packed)) llc_snap;
+} __attribute__((packed));
+
+#define LLC_SNAP_LSAP       0xaa
+#define LLC_UI              0x03
+#define LLC_SNAPFRAMELEN    8
+
+#define ETHERTYPE_PAE       0x888e
+#define DLT_IEEE802_11      105
+#define DLT_IEEE802_11_RADIO 127
+
+#define DPRINTF(x)
+#define XYLog(...)          printf(__VA_ARGS__)
+
+/* A single mbuf with room to prepend the 802.11 header. */
+#define MLEN    2048
+#define LEAD    64
+
+struct __mbuf {
+    u_int8_t *m_data;
+    size_t m_len;
+    size_t m_pktlen;
+    u_int8_t m_buf[MLEN];
+};
+
+typedef int mbuf_how_t;
+typedef uintptr_t mbuf_tag_id_t;     /* u_int32_t, cast to a pointer */
+
+#define MBUF_DONTWAIT   1
+#define mtod(m, t)      ((t)(m)->m_data)
+
+static int nomem;           /* fail the next template allocation */
+static int nmbufs;          /* mbufs allocated and not freed */
+static int addba;           /* ADDBA requests triggered */
+
+static mbuf_t
+mbuf_alloc(void)
+{
+    mbuf_t m = (mbuf_t)calloc(1, sizeof(*m));
+
+    m->m_data = m->m_buf + LEAD;
+    nmbufs++;
+    return m;
+}
+
+static void
+mbuf_freem(mbuf_t m)
+{
+    free(m);
+    nmbufs--;
+}
+
+static size_t
+mbuf_len(mbuf_t m)
+{
+    return m->m_len;
+}
+
+static int
+mbuf_pullup(mbuf_t *mp, size_t len)
+{
+    if ((*mp)->m_len < len) {
+        mbuf_freem(*mp);
+        *mp = NULL;
+        return ENOMEM;
+    }
+    return 0;
+}
+
+static int
+mbuf_copydata(mbuf_t m, size_t off, size_t len, void *out)
+{
+    if (off + len > m->m_len)
+        return EINVAL;
+    memcpy(out, m->m_data + off, len);
+    return 0;
+}
+
+static void
+mbuf_adj(mbuf_t m, int len)
+{
+    m->m_data += len;
+    m->m_len -= len;
+    m->m_pktlen -= len;
+}
+
+static int
+mbuf_prepend(mbuf_t *mp, size_t len, mbuf_how_t how)
+{
+    mbuf_t m = *mp;
+
+    if ((size_t)(m->m_data - m->m_buf) < len) {
+        mbuf_freem(m);
+        *mp = NULL;
+        return ENOMEM;
+    }
+    m->m_data -= len;
+    m->m_len += len;
+    m->m_pktlen += len;
+    return 0;
+}
+
+/* sys/_malloc.h: zeroed. */
+static void *
+malloc(size_t len, int type, int how)
+{
+    if (nomem) {
+        nomem = 0;
+        return NULL;
+    }
+    return calloc(1, len);
+}
+
+struct _ifnet {
+    char if_xname[16];
+};
+
+struct ieee80211_tx_ba {
+    u_int8_t ba_state;
+};
+
+struct ieee80211_node {
+    u_int8_t ni_bssid[IEEE80211_ADDR_LEN];
+    enum ieee80211_node_state ni_state;
+    enum ieee80211_cipher ni_rsncipher;
+    int ni_port_valid;
+    u_int16_t ni_txseq;
+    u_int16_t ni_qos_txseqs[IEEE80211_NUM_TID];
+    struct ieee80211_tx_ba ni_tx_ba[IEEE80211_NUM_TID];
+    struct ieee80211_txtmpl *ni_txtmpl;
+    int ni_inact;
+    u_int32_t ni_flags;
+    int ni_refcnt;
+};
+
+struct ieee80211_stats {
+    u_int32_t is_tx_nombuf;
+    u_int32_t is_tx_nonode;
+    u_int32_t is_tx_noauth;
+};
+
+struct ieee80211com {
+    struct _ifnet ic_if;
+    enum ieee80211_opmode ic_opmode;
+    struct ieee80211_node *ic_bss;
+    u_int32_t ic_flags;
+    u_int32_t ic_caps;
+    u_int16_t ic_tid_noack;
+    struct ieee80211_stats ic_stats;
+};
+
+static const char *
+ether_sprintf(const u_int8_t *ap)
+{
+    static char buf[3 * IEEE80211_ADDR_LEN];
+
+    snprintf(buf, sizeof(buf), "%02x:%02x:%02x:%02x:%02x:%02x",
+        ap[0], ap[1], ap[2], ap[3], ap[4], ap[5]);
+    return buf;
+}
+
+static struct ieee80211_node *
+ieee80211_ref_node(struct ieee80211_node *ni)
+{
+    ni->ni_refcnt++;
+    return ni;
+}
+
+static void
+ieee80211_release_node(struct ieee80211com *ic, struct ieee80211_node *ni)
+{
+    ni->ni_refcnt--;
+}
+
+/* A station has a single peer, the AP. */
+static struct ieee80211_node *
+ieee80211_find_txnode(struct ieee80211com *ic, const u_int8_t *macaddr)
+{
+    return ieee80211_ref_node(ic->ic_bss);
+}
+
+static int
+ieee80211_can_use_ampdu(struct ieee80211com *ic, struct ieee80211_node *ni)
+{
+    return 1;
+}
+
+static void
+ieee80211_node_trigger_addba_req(struct ieee80211_node *ni, int tid)
+{
+    addba++;
+}
+
+#include "encap.inc"
+
+static int failures;
+
+static const u_int8_t bssid[] = { 0x00, 0x11, 0x22, 0x33, 0x44, 0x55 };
+static const u_int8_t bssid2[] = { 0x00, 0x11, 0x22, 0x33, 0x44, 0x66 };
+static const u_int8_t sta[] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+static const u_int8_t peer[] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 };
+
+static struct ieee80211com ic;
+static struct ieee80211_node bss;
+
+static void
+check(const char *what, bool ok)
+{
+    printf("%-4s %s\n", ok ? "ok" : "FAIL", what);
+    if (!ok)
+        failures++;
+}
+
+/* An associated station with QoS, RSN and Tx protection on. */
+static void
+setup(void)
+{
+    free(bss.ni_txtmpl);
+    memset(&ic, 0, sizeof(ic));
+    memset(&bss, 0, sizeof(bss));
+    snprintf(ic.ic_if.if_xname, sizeof(ic.ic_if.if_xname), "itlwm0");
+    ic.ic_opmode = IEEE80211_M_STA;
+    ic.ic_bss = &bss;
+    ic.ic_flags = IEEE80211_F_QOS | IEEE80211_F_RSNON;
+    IEEE80211_ADDR_COPY(bss.ni_bssid, bssid);
+    bss.ni_state = IEEE80211_STA_BSS;
+    bss.ni_rsncipher = IEEE80211_CIPHER_CCMP;
+    bss.ni_port_valid = 1;
+    bss.ni_flags = IEEE80211_NODE_QOS | IEEE80211_NODE_TXPROT;
+    bss.ni_tx_ba[0].ba_state = IEEE80211_BA_AGREED;
+    bss.ni_tx_ba[3].ba_state = IEEE80211_BA_AGREED;
+    addba = 0;
+}
+
+/* An Ethernet frame of len bytes with the given type and IP TOS. */
+static mbuf_t
+ether(u_int16_t type, u_int8_t tos, size_t len)
+{
+    mbuf_t m = mbuf_alloc();
+    struct ether_header *eh = mtod(m, struct ether_header *);
+    size_t i;
+
+    IEEE80211_ADDR_COPY(eh->ether_dhost, peer);
+    IEEE80211_ADDR_COPY(eh->ether_shost, sta);
+    eh->ether_type = htons(type);
+    for (i = sizeof(*eh); i < len; i++)
+        m->m_data[i] = i;
+    m->m_data[sizeof(*eh)] = 0x45;
+    m->m_data[sizeof(*eh) + 1] = tos;
+    m->m_len = m->m_pktlen = len;
+    return m;
+}
+
+/*
+ * Whether m is the MPDU ieee80211_encap() should make of ether(type,
+ * tos, len): a QoS data frame of TID tid, or a plain one for tid -1.
+ */
+static bool
+is_mpdu(mbuf_t m, u_int16_t type, size_t len, int tid, u_int16_t seq,
+    bool prot, bool noack, const u_int8_t *bs)
+{
+    u_int8_t want[sizeof(struct ieee80211_qosframe) + LLC_SNAPFRAMELEN];
+    struct ieee80211_qosframe *qwh = (struct ieee80211_qosframe *)want;
+    struct llc *llc;
+    size_t hdrlen, i;
+
+    memset(want, 0, sizeof(want));
+    qwh->i_fc[0] = IEEE80211_FC0_VERSION_0 | IEEE80211_FC0_TYPE_DATA;
+    qwh->i_fc[1] = IEEE80211_FC1_DIR_TODS;
+    if (prot)
+        qwh->i_fc[1] |= IEEE80211_FC1_PROTECTED;
+    IEEE80211_ADDR_COPY(qwh->i_addr1, bs);
+    IEEE80211_ADDR_COPY(qwh->i_addr2, sta);
+    IEEE80211_ADDR_COPY(qwh->i_addr3, peer);
+    qwh->i_seq[0] = seq << IEEE80211_SEQ_SEQ_SHIFT;
+    qwh->i_seq[1] = seq >> (8 - IEEE80211_SEQ_SEQ_SHIFT);
+    if (tid >= 0) {
+        qwh->i_fc[0] |= IEEE80211_FC0_SUBTYPE_QOS;
+        qwh->i_qos[0] = tid | (noack ? IEEE80211_QOS_ACK_POLICY_NOACK : 0);
+        hdrlen = sizeof(struct ieee80211_qosframe);
+    } else
+        hdrlen = sizeof(struct ieee80211_frame);
+    llc = (struct llc *)(want + hdrlen);
+    llc->llc_dsap = llc->llc_ssap = LLC_SNAP_LSAP;
+    llc->llc_control = LLC_UI;
+    llc->llc_snap.ether_type = htons(type);
+
+    if (m == NULL || m->m_len != len - ETHER_HDR_LEN + LLC_SNAPFRAMELEN +
+        hdrlen || m->m_pktlen != m->m_len)
+        return false;
+    if (memcmp(m->m_data, want, hdrlen + LLC_SNAPFRAMELEN) != 0)
+        return false;
+    for (i = ETHER_HDR_LEN + 2; i < len; i++)
+        if (m->m_data[hdrlen + LLC_SNAPFRAMELEN + i - ETHER_HDR_LEN] !=
+            (u_int8_t)i)
+            return false;
+    return true;
+}
+
+static mbuf_t
+encap(u_int16_t type, u_int8_t tos, size_t len)
+{
+    struct ieee80211_node *ni;
+    mbuf_t m;
+
+    m = ieee80211_encap(&ic.ic_if, ether(type, tos, len), &ni);
+    if (m != NULL)
+        ieee80211_release_node(&ic, ni);
+    return m;
+}
+
+/* Encapsulate a frame and check it, then free it. */
+static bool
+encap_ok(u_int16_t type, u_int8_t tos, size_t len, int tid, u_int16_t seq,
+    bool prot, bool noack, const u_int8_t *bs)
+{
+    mbuf_t m = encap(type, tos, len);
+    bool ok = is_mpdu(m, type, len, tid, seq, prot, noack, bs);
+
+    if (m != NULL)
+        mbuf_freem(m);
+    return ok;
+}
+
+static void
+test_qos(void)
+{
+    bool ok = true;
+    int i;
+
+    setup();
+    for (i = 0; i < 3; i++) {
+        ok = ok && encap_ok(ETHERTYPE_IP, 0, 1514, 0, i, true, false,
+            bssid);
+        ok = ok && encap_ok(ETHERTYPE_IP, IPTOS_PREC_NETCONTROL, 1514, 3,
+            i, true, false, bssid);
+    }
+    check("Block Ack agreed: QoS data, LLC/SNAP, payload, per-TID seq", ok);
+    check("Block Ack agreed: no ADDBA request", addba == 0);
+
+    ok = encap_ok(ETHERTYPE_IP, IPTOS_PREC_IMMEDIATE, 100, -1, 0, true,
+        false, bssid) &&
+        encap_ok(ETHERTYPE_IP, IPTOS_PREC_IMMEDIATE, 100, -1, 1, true,
+        false, bssid);
+    check("no agreement: plain data frame, node seq", ok);
+    check("no agreement: ADDBA requested", addba == 2);
+
+    bss.ni_tx_ba[1].ba_state = IEEE80211_BA_AGREED;
+    ok = encap_ok(ETHERTYPE_IP, IPTOS_PREC_IMMEDIATE, 100, 1, 0, true,
+        false, bssid);
+    check("agreement made: same TID now QoS", ok);
+    check("node reference released", bss.ni_refcnt == 0);
+}
+
+static void
+test_eapol(void)
+{
+    setup();
+    bss.ni_port_valid = 0;
+    bss.ni_flags &= ~IEEE80211_NODE_TXPROT;
+    check("EAPOL before the port is open: plain data frame",
+        encap_ok(ETHERTYPE_PAE, 0, 121, -1, 0, false, false, bssid));
+    check("data before the port is open: dropped",
+        encap(ETHERTYPE_IP, 0, 1514) == NULL &&
+        ic.ic_stats.is_tx_noauth == 1 && bss.ni_refcnt == 0);
+}
+
+/*
+ * A template stays in use until what it was built from changes: mark
+ * the one in use and see whether the next frame carries the mark.
+ */
+static bool
+marked(void)
+{
+    mbuf_t m = encap(ETHERTYPE_IP, 0, 200);
+    bool mark = m != NULL && m->m_data[2] == 0xa5;
+
+    if (m != NULL)
+        mbuf_freem(m);
+    return mark;
+}
+
+static void
+mark(void)
+{
+    if (bss.ni_txtmpl != NULL)
+        bss.ni_txtmpl[0].tt_hdr[2] = 0xa5;      /* i_dur */
+}
+
+static void
+test_reuse(void)
+{
+    bool ok;
+
+    setup();
+    encap_ok(ETHERTYPE_IP, 0, 200, 0, 0, true, false, bssid);
+    mark();
+    check("template reused for the next frame", marked());
+
+    bss.ni_flags &= ~IEEE80211_NODE_TXPROT;
+    ok = !marked() && encap_ok(ETHERTYPE_IP, 0, 200, 0, 3, false, false,
+        bssid);
+    mark();
+    bss.ni_flags |= IEEE80211_NODE_TXPROT;
+    ok = ok && !marked() && encap_ok(ETHERTYPE_IP, 0, 200, 0, 5, true,
+        false, bssid);
+    check("rebuilt when Tx protection changes", ok);
+
+    mark();
+    ic.ic_tid_noack = 1 << 0;
+    ok = !marked() && encap_ok(ETHERTYPE_IP, 0, 200, 0, 7, true, true,
+        bssid);
+    mark();
+    ic.ic_tid_noack = 0;
+    ok = ok && !marked() && encap_ok(ETHERTYPE_IP, 0, 200, 0, 9, true,
+        false, bssid);
+    check("rebuilt when the ack policy changes", ok);
+
+    mark();
+    IEEE80211_ADDR_COPY(bss.ni_bssid, bssid2);
+    ok = !marked() && encap_ok(ETHERTYPE_IP, 0, 200, 0, 11, true, false,
+        bssid2);
+    check("rebuilt when the BSSID changes", ok);
+
+    setup();
+    nomem = 1;
+    ok = encap_ok(ETHERTYPE_IP, 0, 200, 0, 0, true, false, bssid) &&
+        bss.ni_txtmpl == NULL;
+    ok = ok && encap_ok(ETHERTYPE_IP, 0, 200, 0, 1, true, false, bssid) &&
+        bss.ni_txtmpl != NULL;
+    check("no memory for templates: header built per frame", ok);
+}
+
+static double
+now_usec(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+/*
+ * ns per frame to set a 1514-byte frame up and, unless mode is 0,
+ * encapsulate it: with the templates (1) or rebuilding the template
+ * for every frame (2).
+ */
+static double
+bench_run(int frames, int mode, u_int8_t tos)
+{
+    struct ieee80211_node *ni;
+    mbuf_t m = mbuf_alloc(), n;
+    struct ether_header *eh;
+    double t;
+    int i;
+
+    t = now_usec();
+    for (i = 0; i < frames; i++) {
+        m->m_data = m->m_buf + LEAD;
+        m->m_len = m->m_pktlen = 1514;
+        eh = mtod(m, struct ether_header *);
+        IEEE80211_ADDR_COPY(eh->ether_dhost, peer);
+        IEEE80211_ADDR_COPY(eh->ether_shost, sta);
+        eh->ether_type = htons(ETHERTYPE_IP);
+        m->m_data[sizeof(*eh)] = 0x45;
+        m->m_data[sizeof(*eh) + 1] = tos;
+        if (mode == 0)
+            continue;
+        if (mode == 2 && bss.ni_txtmpl != NULL) {
+            bss.ni_txtmpl[0].tt_sig = 0;
+            bss.ni_txtmpl[IEEE80211_NUM_TID].tt_sig = 0;
+        }
+        n = ieee80211_encap(&ic.ic_if, m, &ni);
+        if (n != m)
+            abort();
+        ieee80211_release_node(&ic, ni);
+    }
+    t = now_usec() - t;
+    mbuf_freem(m);
+    return t * 1000 / frames;
+}
+
+static void
+bench(int frames)
+{
+    double base, cached, rebuilt;
+    int i;
+
+    printf("     frame  setup ns  encap ns  rebuilt ns\n");
+    for (i = 0; i < 2; i++) {
+        setup();
+        base = bench_run(frames, 0, 0);
+        cached = bench_run(frames, 1, i == 0 ? 0 : IPTOS_PREC_IMMEDIATE);
+        rebuilt = bench_run(frames, 2, i == 0 ? 0 : IPTOS_PREC_IMMEDIATE);
+        printf("     %-5s %9.1f %9.1f %11.1f\n", i == 0 ? "QoS" : "plain",
+            base, cached - base, rebuilt - base);
+    }
+    free(bss.ni_txtmpl);
+    bss.ni_txtmpl = NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+    char buf[64];
+
+    test_qos();
+    test_eapol();
+    test_reuse();
+    bench(argc > 1 ? atoi(argv[1]) : 2000000);
+    snprintf(buf, sizeof(buf), "no mbufs left (%d)", nmbufs);
+    check(buf, nmbufs == 0);
+
+    printf("%d failed\n", failures);
+    return failures != 0;
+}
@@ -0,0 +1,119 @@
+#
+# Print definitions from a source file in KNF, so that the tests here
+# can build parts of the kernel sources that cannot be linked in
+# userspace as a whole. Names are separated by spaces:
+#
+#   fns      functions: the return type on the line before "name(" in
+#            column one, through the closing brace in column one
+#   types    "struct name {", "enum name {" or "union name {" through "};"
+#            or "} __packed;"
+#   defines  "#define name" and its continuation lines
+#   vars     tables and structures: "name[] = {" or "name = {" through
+#            "};", with the lines from the "static" that opens the
+#            definition
+#
+#   awk -v fns="ieee80211_kdf ieee80211_ft_mic" -f extract.awk file.c
+#
+
+function want_names(list, set,    n, i, names) {
+    n = split(list, names, " ")
+    for (i = 1; i <= n; i++)
+        set[names[i]] = 1
+}
+
+BEGIN {
+    want_names(fns, wantfn)
+    want_names(types, wantty)
+    want_names(defines, wantdef)
+    want_names(vars, wantvar)
+}
+
+inbody {
+    print
+    if ($0 ~ endpat) {
+        inbody = 0
+        if (endpat != "[^\\\\]$|^$")
+            print ""
+    }
+    next
+}
+
+match($0, /^[A-Za-z_][A-Za-z0-9_]*\(/) {
+    name = substr($0, 1, RLENGTH - 1)
+    if ((name in wantfn) && prev !~ /;[ \t]*$/) {
+        print prev
+        print
+        found[name] = 1
+        inbody = 1
+        endpat = "^}"
+        next
+    }
+}
+
+/^static[ \t]/ { decl = "" }
+
+/^[^ \t#\/].*[A-Za-z0-9_](\[[^]]*\])?[ \t]*=[ \t]*\{[ \t]*$/ {
+    name = $0
+    sub(/[ \t]*=.*/, "", name)
+    sub(/\[.*/, "", name)
+    sub(/.*[^A-Za-z0-9_]/, "", name)
+    if (name in wantvar) {
+        if ($0 !~ /^static[ \t]/)
+            printf "%s", decl
+        print
+        found[name] = 1
+        inbody = 1
+        endpat = "^};"
+        next
+    }
+}
+
+/^(struct|enum|union)[ \t]+[A-Za-z0-9_]+[ \t]*\{/ {
+    name = $2
+    sub(/\{.*/, "", name)
+    if (name in wantty) {
+        print
+        found[name] = 1
+        inbody = 1
+        endpat = "^}[^;]*;"
+        next
+    }
+}
+
+/^#define[ \t]/ {
+    name = $2
+    sub(/\(.*/, "", name)
+    if (name in wantdef) {
+        print
+        found[name] = 1
+        if ($0 ~ /\\$/) {
+            inbody = 1
+            endpat = "[^\\\\]$|^$"
+        }
+        next
+    }
+}
+
+{
+    prev = $0
+    decl = decl $0 "\n"
+}
+
+END {
+    for (name in wantfn)
+        if (!(name in found))
+            missing = missing " " name
+    for (name in wantty)
+        if (!(name in found))
+            missing = missing " " name
+    for (name in wantdef)
+        if (!(name in found))
+            missing = missing " " name
+    for (name in wantvar)
+        if (!(name in found))
+            missing = missing " " name
+    if (missing != "") {
+        print FILENAME ":" missing " not found" > "/dev/stderr"
+        exit 1
+    }
+}
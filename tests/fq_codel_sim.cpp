@@ -0,0 +1,354 @@
+/*
+ * Latency under load of the interface send queue: the FQ-CoDel queue of
+ * _ifq.cpp, built as is, against the tail-drop FIFO of the same length
+ * it replaced.
+ *
+ * Bulk TCP uploads with Reno congestion control keep the queue loaded:
+ * each sends while its window allows, takes an ACK one base RTT after
+ * its segment left the link and halves its window, at most once per RTT,
+ * one base RTT after a segment was dropped. A sparse flow sends a small
+ * UDP frame every 20ms, as a voice call would. The link takes a frame
+ * off the queue with ifq_dequeue() whenever it is idle and holds it for
+ * its transmit time. The queue reads its CoDel sojourn clock from the
+ * simulated uptime, so the delays it acts on are the ones measured here.
+ * The Tx ring after the queue is not modelled; ItlTxLimit keeps that
+ * within its airtime cap (see txlim_sim).
+ *
+ * For each link rate and number of bulk flows it prints link
+ * utilization, the queueing delay of the sparse flow and of the bulk
+ * flows (median and 99th percentile), drops, and Jain's fairness index
+ * over the bulk flows' goodput. Then it checks that FQ-CoDel keeps the
+ * link busy, serves the sparse flow within a few frame times, holds the
+ * bulk flows near the CoDel target and shares the link fairly, where
+ * the FIFO queues the sparse flow behind hundreds of milliseconds.  When
+ * the path holds fewer than four frames per bulk flow (16 flows at 20
+ * Mbit/s), one or two frames queued per flow already wait longer than
+ * the target in the round robin; there only the tail and the gain over
+ * the FIFO are checked.
+ *
+ *   c++ -std=c++11 -g -fsanitize=address,undefined -I compat \
+ *       -idirafter ../itl80211/openbsd -o fq_codel_sim fq_codel_sim.cpp
+ *   ./fq_codel_sim [seconds]
+ */
+
+#include "ifq_env.h"
+#include <sys/_ifq.cpp>
+
+#include <algorithm>
+#include <deque>
+#include <queue>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+
+#define IFQ_MAXLEN      2048            /* ieee80211_ifattach() */
+#define MSEC            1000000ULL      /* ns */
+#define RTT_BASE        (20 * MSEC)
+#define BULK_LEN        1514
+#define SPARSE_LEN      200
+#define SPARSE_EVERY    (20 * MSEC)
+#define WARMUP          (5000 * MSEC)
+
+struct tcp {
+    struct env_flow id;
+    double cwnd, ssthresh;
+    u_int32_t inflight;
+    u_int32_t seq;
+    u_int64_t recover;          /* ns, no further decrease before */
+    u_int64_t srtt;             /* ns */
+    u_int64_t delivered;        /* bytes after the warmup */
+};
+
+struct event {
+    u_int64_t at;
+    int flow;
+    bool loss;
+    u_int64_t sent;             /* ns, when the segment was queued */
+
+    bool operator>(const struct event &e) const { return at > e.at; }
+};
+
+struct result {
+    double util;
+    double sparse50, sparse99, bulk50, bulk99;      /* ms */
+    u_int64_t drops;
+    double jain;
+    u_int64_t max_sojourn_ns;
+    struct ifq_stats stats;
+};
+
+struct sim {
+    bool fq;
+    struct _ifqueue ifq;
+    std::deque<mbuf_t> fifo;
+    std::vector<struct tcp> bulk;
+    std::priority_queue<struct event, std::vector<struct event>,
+        std::greater<struct event>> events;
+    u_int64_t drops;
+};
+
+static struct sim *cur;
+static int failures;
+
+static void
+check(const char *what, bool ok)
+{
+    printf("%-4s %s\n", ok ? "ok" : "FAIL", what);
+    if (!ok)
+        failures++;
+}
+
+/* A bulk segment freed before it was sent: the sender sees the loss. */
+static void
+dropped(mbuf_t m)
+{
+    struct event e;
+
+    cur->drops++;
+    if (m->m_flow < 0)
+        return;
+    e.at = env_now + RTT_BASE;
+    e.flow = m->m_flow;
+    e.loss = true;
+    e.sent = m->m_enq;
+    cur->events.push(e);
+}
+
+static void
+sim_enqueue(struct sim *s, mbuf_t m)
+{
+    m->m_enq = env_now;
+    if (s->fq) {
+        ifq_enqueue(&s->ifq, m);
+        return;
+    }
+    if (s->fifo.size() >= IFQ_MAXLEN) {
+        mbuf_freem(m);
+        return;
+    }
+    s->fifo.push_back(m);
+}
+
+static mbuf_t
+sim_dequeue(struct sim *s)
+{
+    mbuf_t m;
+
+    if (s->fq)
+        return ifq_dequeue(&s->ifq);
+    if (s->fifo.empty())
+        return NULL;
+    m = s->fifo.front();
+    s->fifo.pop_front();
+    return m;
+}
+
+static void
+tcp_send(struct sim *s, int i)
+{
+    struct tcp *t = &s->bulk[i];
+    mbuf_t m;
+
+    while (t->inflight < (u_int32_t)t->cwnd) {
+        m = env_frame(&t->id, BULK_LEN, TH_ACK, t->seq, 1,
+            (u_int32_t)(env_now / MSEC));
+        m->m_flow = i;
+        t->seq += BULK_LEN - 66;
+        t->inflight++;
+        sim_enqueue(s, m);
+    }
+}
+
+static void
+tcp_event(struct sim *s, const struct event &e)
+{
+    struct tcp *t = &s->bulk[e.flow];
+
+    t->inflight--;
+    if (!e.loss) {
+        t->srtt = t->srtt == 0 ? e.at - e.sent :
+            (7 * t->srtt + (e.at - e.sent)) / 8;
+        if (env_now >= WARMUP)
+            t->delivered += BULK_LEN - 66;
+        if (t->cwnd < t->ssthresh)
+            t->cwnd += 1;
+        else
+            t->cwnd += 1 / t->cwnd;
+    } else if (env_now >= t->recover) {
+        t->ssthresh = std::max(t->cwnd / 2, 2.0);
+        t->cwnd = t->ssthresh;
+        t->recover = env_now + (t->srtt != 0 ? t->srtt : RTT_BASE);
+    }
+    tcp_send(s, e.flow);
+}
+
+static double
+percentile(std::vector<u_int64_t> &v, double p)
+{
+    if (v.empty())
+        return 0;
+    std::sort(v.begin(), v.end());
+    return (double)v[std::min(v.size() - 1, (size_t)(p * v.size()))] / MSEC;
+}
+
+static struct result
+run(bool fq, double mbps, int nbulk, u_int64_t dur)
+{
+    struct sim s;
+    struct result r;
+    struct env_flow sparse = { IPPROTO_UDP, htonl(0x0a000002),
+        htonl(0x08080808), htons(5004), htons(5004) };
+    std::vector<u_int64_t> sparse_d, bulk_d;
+    u_int64_t busy_until = 0, next_sparse = 0, busy = 0, next, d, tx;
+    double sum = 0, sumsq = 0;
+    struct event e;
+    mbuf_t m;
+    int i;
+
+    memset(&r, 0, sizeof(r));
+    env_now = 0;
+    s.fq = fq;
+    s.drops = 0;
+    memset(&s.ifq, 0, sizeof(s.ifq));
+    ifq_init(&s.ifq, NULL, IFQ_MAXLEN);
+    cur = &s;
+    env_dropped = dropped;
+
+    for (i = 0; i < nbulk; i++) {
+        struct tcp t;
+
+        memset(&t, 0, sizeof(t));
+        t.id.proto = IPPROTO_TCP;
+        t.id.src = htonl(0x0a000002);
+        t.id.dst = htonl(0xc6336401 + i);
+        t.id.sport = htons(49152 + i);
+        t.id.dport = htons(443);
+        t.cwnd = 10;
+        t.ssthresh = 1e9;
+        s.bulk.push_back(t);
+    }
+    for (i = 0; i < nbulk; i++)
+        tcp_send(&s, i);
+
+    while (env_now < dur) {
+        while (!s.events.empty() && s.events.top().at <= env_now) {
+            e = s.events.top();
+            s.events.pop();
+            tcp_event(&s, e);
+        }
+        if (env_now >= next_sparse) {
+            m = env_frame(&sparse, SPARSE_LEN, 0, 0, 0, 0);
+            m->m_flow = -1;
+            sim_enqueue(&s, m);
+            next_sparse += SPARSE_EVERY;
+        }
+        if (env_now >= busy_until && (m = sim_dequeue(&s)) != NULL) {
+            m->m_sent = true;
+            d = env_now - m->m_enq;
+            r.max_sojourn_ns = std::max(r.max_sojourn_ns, d);
+            tx = (u_int64_t)(m->m_pktlen * 8 * 1000 / mbps);
+            busy_until = env_now + tx;
+            if (env_now >= WARMUP) {
+                busy += tx;
+                (m->m_flow < 0 ? sparse_d : bulk_d).push_back(d);
+            }
+            if (m->m_flow >= 0) {
+                e.at = busy_until + RTT_BASE;
+                e.flow = m->m_flow;
+                e.loss = false;
+                e.sent = m->m_enq;
+                s.events.push(e);
+            }
+            mbuf_freem(m);
+            continue;
+        }
+        next = next_sparse;
+        if (!s.events.empty())
+            next = std::min(next, s.events.top().at);
+        if (busy_until > env_now)
+            next = std::min(next, busy_until);
+        env_now = next;
+    }
+
+    r.util = (double)busy / (dur - WARMUP);
+    r.sparse50 = percentile(sparse_d, 0.5);
+    r.sparse99 = percentile(sparse_d, 0.99);
+    r.bulk50 = percentile(bulk_d, 0.5);
+    r.bulk99 = percentile(bulk_d, 0.99);
+    r.drops = s.drops;
+    for (i = 0; i < nbulk; i++) {
+        sum += s.bulk[i].delivered;
+        sumsq += (double)s.bulk[i].delivered * s.bulk[i].delivered;
+    }
+    r.jain = sumsq != 0 ? sum * sum / (nbulk * sumsq) : 0;
+    ifq_get_stats(&s.ifq, &r.stats);
+
+    env_dropped = NULL;
+    for (auto m : s.fifo)
+        mbuf_freem(m);
+    ifq_destroy(&s.ifq);
+    return r;
+}
+
+int
+main(int argc, char **argv)
+{
+    static const double rates[] = { 20, 100 };
+    static const int flows[] = { 1, 4, 16 };
+    u_int64_t dur = (argc > 1 ? atoi(argv[1]) : 30) * 1000 * MSEC;
+    struct result fifo, fq;
+    std::string what;
+    char buf[160];
+    bool util = true, sparse = true, bulk = true, bulk99 = true,
+        cut = true, fair = true, clock = true, bloat = true;
+    double bdp;
+    size_t i, j;
+
+    printf("%-8s %6s %4s %6s %17s %17s %7s %6s\n", "queue", "Mbit/s",
+        "bulk", "util", "sparse p50/p99 ms", "bulk p50/p99 ms", "drops",
+        "jain");
+    for (i = 0; i < nitems(rates); i++) {
+        for (j = 0; j < nitems(flows); j++) {
+            fifo = run(false, rates[i], flows[j], dur);
+            fq = run(true, rates[i], flows[j], dur);
+            printf("%-8s %6.0f %4d %6.3f %8.1f %8.1f %8.1f %8.1f %7llu "
+                "%6.3f\n", "fifo", rates[i], flows[j], fifo.util,
+                fifo.sparse50, fifo.sparse99, fifo.bulk50, fifo.bulk99,
+                (unsigned long long)fifo.drops, fifo.jain);
+            printf("%-8s %6.0f %4d %6.3f %8.1f %8.1f %8.1f %8.1f %7llu "
+                "%6.3f\n", "fq_codel", rates[i], flows[j], fq.util,
+                fq.sparse50, fq.sparse99, fq.bulk50, fq.bulk99,
+                (unsigned long long)fq.drops, fq.jain);
+
+            /* Frames the path holds per bulk flow at the base RTT */
+            bdp = rates[i] * 1e6 * RTT_BASE / 1e9 / (BULK_LEN * 8) /
+                flows[j];
+            util = util && fq.util > 0.9;
+            sparse = sparse && fq.sparse99 < 1.5;
+            bulk = bulk && (bdp < 4 || fq.bulk50 < 10);
+            bulk99 = bulk99 && fq.bulk99 < 50;
+            cut = cut && fq.bulk50 * 10 < fifo.bulk50;
+            fair = fair && (flows[j] == 1 || fq.jain > 0.95);
+            clock = clock &&
+                fq.stats.max_sojourn_us == fq.max_sojourn_ns / 1000 &&
+                fq.stats.codel_drops > 0;
+            bloat = bloat && fifo.sparse50 > 100;
+        }
+    }
+
+    check("fq_codel keeps the link over 90% busy", util);
+    check("fq_codel: sparse flow waits under 1.5ms (99%)", sparse);
+    check("fq_codel: bulk flows wait under 10ms (median) where the path "
+        "holds 4 frames per flow", bulk);
+    check("fq_codel: bulk flows wait under 50ms (99%)", bulk99);
+    check("fq_codel: bulk flows wait a tenth of the fifo's time (median)",
+        cut);
+    check("fq_codel: bulk flows share the link (Jain > 0.95)", fair);
+    check("fq_codel: CoDel acts on the simulated sojourn time", clock);
+    check("fifo: sparse flow waits over 100ms behind bulk", bloat);
+    snprintf(buf, sizeof(buf), "no mbufs left (%d)", env_mbufs);
+    check(buf, env_mbufs == 0);
+
+    printf("%d failed\n", failures);
+    return failures != 0;
+}
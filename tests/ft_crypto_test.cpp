@@ -0,0 +1,232 @@
+/*
+ * Known answer tests for the 802.11r key hierarchy and FTE MIC in
+ * net80211/ieee80211_crypto.c: ieee80211_derive_pmk_r0(),
+ * ieee80211_derive_pmk_r1(), ieee80211_derive_ft_ptk(), ieee80211_ft_mic()
+ * and ieee80211_ft_unwrap_key(), built from the kernel sources together
+ * with the OpenBSD crypto code they use.
+ *
+ * The primitives are checked against RFC 4231 (HMAC-SHA-256), RFC 4493
+ * (AES-CMAC) and RFC 3394 (AES key wrap). The FT vectors follow
+ * 802.11-2016 12.7.1.7 and 13.8.4 for a FT-PSK transition; their expected
+ * values come from a separate implementation (Python's hmac and hashlib,
+ * OpenSSL's CMAC), not from this code.
+ *
+ *   awk -v fns="ieee80211_cipher_keylen ieee80211_kdf \
+ *       ieee80211_derive_pmk_r0 ieee80211_derive_pmk_r1 \
+ *       ieee80211_derive_ft_ptk ieee80211_ft_mic ieee80211_ft_unwrap_key" \
+ *       -f extract.awk ../itl80211/openbsd/net80211/ieee80211_crypto.c \
+ *       > ft_crypto.inc
+ *   c++ -I compat -idirafter ../itl80211/openbsd -o ft_crypto_test \
+ *       -x c++ ft_crypto_test.cpp ../itl80211/openbsd/crypto/{sha2,sha1,md5,hmac,aes,cmac,key_wrap}.c
+ *   ./ft_crypto_test
+ */
+
+#include <sys/systm.h>
+
+#include <net80211/ieee80211.h>
+#include <net80211/ieee80211_crypto.h>
+
+#include <crypto/md5.h>
+#include <crypto/sha1.h>
+#include <crypto/sha2.h>
+#include <crypto/hmac.h>
+#include <crypto/aes.h>
+#include <crypto/cmac.h>
+#include <crypto/key_wrap.h>
+
+#include <stdio.h>
+
+#define IEEE80211_ADDR_COPY(dst, src)   memcpy(dst, src, IEEE80211_ADDR_LEN)
+
+#include "ft_crypto.inc"
+
+static int failures;
+
+static void
+hex(const char *s, u_int8_t *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        sscanf(&s[2 * i], "%2hhx", &buf[i]);
+}
+
+static void
+check(const char *what, const u_int8_t *got, const char *want)
+{
+    u_int8_t buf[128];
+    size_t len = strlen(want) / 2;
+
+    hex(want, buf, len);
+    if (memcmp(got, buf, len) == 0) {
+        printf("ok   %s\n", what);
+        return;
+    }
+    printf("FAIL %s\n     got  ", what);
+    for (size_t i = 0; i < len; i++)
+        printf("%02x", got[i]);
+    printf("\n     want %s\n", want);
+    failures++;
+}
+
+static void
+check_true(const char *what, bool ok)
+{
+    printf("%-4s %s\n", ok ? "ok" : "FAIL", what);
+    if (!ok)
+        failures++;
+}
+
+static void
+test_hmac_sha256(void)
+{
+    HMAC_SHA256_CTX ctx;
+    u_int8_t key[20], out[SHA256_DIGEST_LENGTH];
+
+    memset(key, 0x0b, sizeof(key));
+    HMAC_SHA256_Init(&ctx, key, sizeof(key));
+    HMAC_SHA256_Update(&ctx, (const u_int8_t *)"Hi There", 8);
+    HMAC_SHA256_Final(out, &ctx);
+    check("RFC 4231 test case 1", out,
+        "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7");
+
+    HMAC_SHA256_Init(&ctx, (const u_int8_t *)"Jefe", 4);
+    HMAC_SHA256_Update(&ctx,
+        (const u_int8_t *)"what do ya want for nothing?", 28);
+    HMAC_SHA256_Final(out, &ctx);
+    check("RFC 4231 test case 2", out,
+        "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843");
+}
+
+static void
+test_aes_cmac(void)
+{
+    static const struct {
+        size_t len;
+        const char *mac;
+    } ex[] = {
+        { 0,  "bb1d6929e95937287fa37d129b756746" },
+        { 16, "070a16b46b4d4144f79bdd9dd04a287c" },
+        { 40, "dfa66747de9ae63030ca32611497c827" },
+        { 64, "51f0bebf7e3b9d92fc49741779363cfe" },
+    };
+    AES_CMAC_CTX ctx;
+    u_int8_t key[16], msg[64], mac[AES_CMAC_DIGEST_LENGTH];
+    char what[32];
+
+    hex("2b7e151628aed2a6abf7158809cf4f3c", key, sizeof(key));
+    hex("6bc1bee22e409f96e93d7e117393172a"
+        "ae2d8a571e03ac9c9eb76fac45af8e51"
+        "30c81c46a35ce411e5fbc1191a0a52ef"
+        "f69f2445df4f9b17ad2b417be66c3710", msg, sizeof(msg));
+    for (size_t i = 0; i < nitems(ex); i++) {
+        AES_CMAC_Init(&ctx);
+        AES_CMAC_SetKey(&ctx, key);
+        AES_CMAC_Update(&ctx, msg, ex[i].len);
+        AES_CMAC_Final(mac, &ctx);
+        snprintf(what, sizeof(what), "RFC 4493 example %zu", i + 1);
+        check(what, mac, ex[i].mac);
+    }
+}
+
+static void
+test_unwrap(void)
+{
+    u_int8_t kek[16], in[24], out[16];
+
+    hex("000102030405060708090a0b0c0d0e0f", kek, sizeof(kek));
+    hex("1fa68b0a8112b447aef34bd8fb5a7b829d3e862371d2cfe5", in, sizeof(in));
+    check_true("RFC 3394 4.1 unwraps",
+        ieee80211_ft_unwrap_key(kek, in, sizeof(in), out) == 0);
+    check("RFC 3394 4.1 key data", out, "00112233445566778899aabbccddeeff");
+
+    in[0] ^= 1;
+    check_true("corrupted wrapped key is rejected",
+        ieee80211_ft_unwrap_key(kek, in, sizeof(in), out) != 0);
+    check_true("wrapped key shorter than 24 bytes is rejected",
+        ieee80211_ft_unwrap_key(kek, in, 16, out) != 0);
+    check_true("wrapped key not a multiple of 8 is rejected",
+        ieee80211_ft_unwrap_key(kek, in, 23, out) != 0);
+}
+
+static void
+test_ft(void)
+{
+    static const u_int8_t ssid[] = "ft-test";
+    static const u_int8_t r0kh[] = "r0kh.example.net";
+    u_int8_t xxkey[IEEE80211_PMK_LEN], mdid[2] = { 0x34, 0x12 };
+    u_int8_t sta[IEEE80211_ADDR_LEN] = { 0x02, 0, 0, 0, 0, 0x01 };
+    u_int8_t r1kh[IEEE80211_ADDR_LEN] = { 0x02, 0, 0, 0, 0x01, 0 };
+    u_int8_t bssid[IEEE80211_ADDR_LEN] = { 0x02, 0, 0, 0, 0x02, 0 };
+    u_int8_t snonce[EAPOL_KEY_NONCE_LEN], anonce[EAPOL_KEY_NONCE_LEN];
+    u_int8_t pmk_r0[IEEE80211_PMK_LEN], pmk_r0_name[IEEE80211_PMKID_LEN];
+    u_int8_t pmk_r1[IEEE80211_PMK_LEN], pmk_r1_name[IEEE80211_PMKID_LEN];
+    u_int8_t rsnie[2 + 38], mde[2 + IEEE80211_MDE_LEN], fte[2 + 108];
+    u_int8_t mic[IEEE80211_FTE_MIC_LEN], mic2[IEEE80211_FTE_MIC_LEN];
+    struct ieee80211_ptk ptk;
+    int i;
+
+    for (i = 0; i < IEEE80211_PMK_LEN; i++)
+        xxkey[i] = i;
+    for (i = 0; i < EAPOL_KEY_NONCE_LEN; i++) {
+        snonce[i] = 0x10 + i;
+        anonce[i] = 0x80 + i;
+    }
+
+    ieee80211_derive_pmk_r0(xxkey, ssid, sizeof(ssid) - 1, mdid, r0kh,
+        sizeof(r0kh) - 1, sta, pmk_r0, pmk_r0_name);
+    check("PMK-R0", pmk_r0,
+        "e9f2f916ed5aeb81c886136b3d9665bba979d4bf94f2d954d29148742cbcaba9");
+    check("PMKR0Name", pmk_r0_name, "1fb68c6617b8fb156ed0aee640fa46ac");
+
+    ieee80211_derive_pmk_r1(pmk_r0, pmk_r0_name, r1kh, sta, pmk_r1,
+        pmk_r1_name);
+    check("PMK-R1", pmk_r1,
+        "4259ba9efa96ba617a3f70f6ae518fa812ae606ab234be7983722809bb707709");
+    check("PMKR1Name", pmk_r1_name, "208ea17a884c81fd19dfa11e88dccfa4");
+
+    memset(&ptk, 0xff, sizeof(ptk));
+    ieee80211_derive_ft_ptk(pmk_r1, snonce, anonce, bssid, sta,
+        IEEE80211_CIPHER_CCMP, &ptk);
+    check("PTK (CCMP)", (const u_int8_t *)&ptk,
+        "76d109d66fd7f8164d2853d7a13152bd"
+        "d7bede0283b3e0bd74c7d8965f808576"
+        "577c7036de112bbd8494c5a811744eb3");
+    check("PTK beyond the CCMP TK is cleared", &ptk.tk[16],
+        "00000000000000000000000000000000");
+
+    /* RSNE with PMKR1Name, MDE and FTE of a Reassociation Request. */
+    hex("30260100000fac040100000fac040100000fac0400000100"
+        "208ea17a884c81fd19dfa11e88dccfa4", rsnie, sizeof(rsnie));
+    hex("3603341201", mde, sizeof(mde));
+    hex("376c0003eeeeeeeeeeeeeeeeeeeeeeeeeeeeeeee"
+        "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+        "101112131415161718191a1b1c1d1e1f202122232425262728292a2b2c2d2e2f"
+        "010602000000010003107230"
+        "6b682e6578616d706c652e6e6574", fte, sizeof(fte));
+    check_true("RSNE carries PMKR1Name",
+        memcmp(&rsnie[2 + 22], pmk_r1_name, IEEE80211_PMKID_LEN) == 0);
+
+    ieee80211_ft_mic(ptk.kck, sta, bssid, 5, rsnie, mde, fte, mic);
+    check("FTE MIC, Reassociation Request", mic,
+        "af06875fde6746de96503dc0d4f4b5e2");
+    ieee80211_ft_mic(ptk.kck, sta, bssid, 6, rsnie, mde, fte, mic);
+    check("FTE MIC, Reassociation Response", mic,
+        "7677a0ee244a235ae6a58e2e87baf86d");
+
+    /* The MIC field itself is not covered, everything else is. */
+    memset(&fte[2 + IEEE80211_FTE_MIC_OFF], 0, IEEE80211_FTE_MIC_LEN);
+    ieee80211_ft_mic(ptk.kck, sta, bssid, 6, rsnie, mde, fte, mic2);
+    check_true("MIC field is taken as zero", memcmp(mic, mic2, 16) == 0);
+    fte[2 + IEEE80211_FTE_SNONCE_OFF] ^= 1;
+    ieee80211_ft_mic(ptk.kck, sta, bssid, 6, rsnie, mde, fte, mic2);
+    check_true("SNonce is covered", memcmp(mic, mic2, 16) != 0);
+}
+
+int
+main(void)
+{
+    test_hmac_sha256();
+    test_aes_cmac();
+    test_unwrap();
+    test_ft();
+    return failures != 0;
+}
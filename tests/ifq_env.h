@@ -0,0 +1,194 @@
+/*
+ * Stand-ins for the kernel the send queue in _ifq.cpp runs on: mbufs
+ * that carry only their headers and what a simulation needs to follow
+ * them, and an uptime clock the simulation sets. Include this, then
+ * <sys/_ifq.cpp> itself:
+ *
+ *   c++ -std=c++11 -I compat -idirafter ../itl80211/openbsd ...
+ *
+ * The kernel headers _ifq.cpp includes are in compat/.
+ */
+
+#ifndef _IFQ_ENV_H_
+#define _IFQ_ENV_H_
+
+#include <sys/systm.h>
+#include <sys/kpi_mbuf.h>
+#include <kern/clock.h>
+#include <arpa/inet.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+
+#include <stdio.h>
+
+#define TCP_MAXOLEN     (60 - sizeof(struct tcphdr))    /* BSD <netinet/tcp.h> */
+
+#define ENV_HDRLEN      128     /* header bytes an mbuf carries */
+
+struct __mbuf {
+    struct __mbuf *m_nextpkt;
+    void *m_header;
+    size_t m_pktlen;
+    size_t m_len;
+    u_int8_t m_data[ENV_HDRLEN];
+    /* For the simulation, the queue never looks at these. */
+    int m_flow;
+    u_int32_t m_seq;
+    u_int64_t m_enq;            /* ns, when it was queued */
+    bool m_sent;                /* taken off the queue */
+};
+
+static u_int64_t env_now;       /* ns */
+static int env_mbufs;           /* allocated and not freed */
+static void (*env_dropped)(mbuf_t);     /* freed before it was sent */
+
+void
+clock_get_uptime(uint64_t *result)
+{
+    *result = env_now;
+}
+
+void
+absolutetime_to_nanoseconds(uint64_t abstime, uint64_t *result)
+{
+    *result = abstime;
+}
+
+errno_t
+mbuf_copydata(const mbuf_t m, size_t off, size_t len, void *out)
+{
+    if (off + len > m->m_len)
+        return EINVAL;
+    memcpy(out, m->m_data + off, len);
+    return 0;
+}
+
+mbuf_t
+mbuf_nextpkt(const mbuf_t m)
+{
+    return m->m_nextpkt;
+}
+
+void
+mbuf_setnextpkt(mbuf_t m, mbuf_t n)
+{
+    m->m_nextpkt = n;
+}
+
+size_t
+mbuf_pkthdr_len(const mbuf_t m)
+{
+    return m->m_pktlen;
+}
+
+void *
+mbuf_pkthdr_header(const mbuf_t m)
+{
+    return m->m_header;
+}
+
+void
+mbuf_pkthdr_setheader(mbuf_t m, void *header)
+{
+    m->m_header = header;
+}
+
+void
+mbuf_freem(mbuf_t m)
+{
+    if (!m->m_sent && env_dropped != NULL)
+        env_dropped(m);
+    free(m);
+    env_mbufs--;
+}
+
+/* A frame of pktlen bytes whose first len bytes are data. */
+static mbuf_t
+env_mbuf(const void *data, size_t len, size_t pktlen)
+{
+    mbuf_t m;
+
+    m = (mbuf_t)calloc(1, sizeof(*m));
+    env_mbufs++;
+    m->m_pktlen = pktlen;
+    m->m_len = MIN(MIN(len, pktlen), sizeof(m->m_data));
+    memcpy(m->m_data, data, m->m_len);
+    return m;
+}
+
+/* Addresses and ports of an IPv4 TCP or UDP flow. */
+struct env_flow {
+    u_int8_t proto;
+    u_int32_t src, dst;
+    u_int16_t sport, dport;
+};
+
+/*
+ * An Ethernet frame of pktlen bytes on flow f: TCP with the given flags,
+ * sequence and ACK numbers and a timestamp option, or UDP.
+ */
+static mbuf_t
+env_frame(const struct env_flow *f, size_t pktlen, u_int8_t flags,
+    u_int32_t seq, u_int32_t ack, u_int32_t tsval)
+{
+    u_int8_t ts[12] = { TCPOPT_NOP, TCPOPT_NOP, TCPOPT_TIMESTAMP,
+        TCPOLEN_TIMESTAMP };
+    struct ether_header eh;
+    struct tcphdr th;
+    struct udphdr uh;
+    struct ip ip;
+    mbuf_t m;
+
+    m = (mbuf_t)calloc(1, sizeof(*m));
+    env_mbufs++;
+    m->m_pktlen = pktlen;
+
+    memset(&eh, 0, sizeof(eh));
+    eh.ether_dhost[0] = 0x02;
+    eh.ether_type = htons(ETHERTYPE_IP);
+    memcpy(m->m_data, &eh, sizeof(eh));
+    m->m_len = sizeof(eh);
+
+    memset(&ip, 0, sizeof(ip));
+    ip.ip_v = IPVERSION;
+    ip.ip_hl = sizeof(ip) >> 2;
+    ip.ip_len = htons(pktlen - sizeof(eh));
+    ip.ip_off = htons(IP_DF);
+    ip.ip_ttl = 64;
+    ip.ip_p = f->proto;
+    ip.ip_src.s_addr = f->src;
+    ip.ip_dst.s_addr = f->dst;
+    memcpy(m->m_data + m->m_len, &ip, sizeof(ip));
+    m->m_len += sizeof(ip);
+
+    if (f->proto == IPPROTO_TCP) {
+        memset(&th, 0, sizeof(th));
+        th.th_sport = f->sport;
+        th.th_dport = f->dport;
+        th.th_seq = htonl(seq);
+        th.th_ack = htonl(ack);
+        th.th_off = (sizeof(th) + sizeof(ts)) >> 2;
+        th.th_flags = flags;
+        th.th_win = htons(2048);
+        memcpy(m->m_data + m->m_len, &th, sizeof(th));
+        m->m_len += sizeof(th);
+        tsval = htonl(tsval);
+        memcpy(&ts[4], &tsval, sizeof(tsval));
+        memcpy(m->m_data + m->m_len, ts, sizeof(ts));
+        m->m_len += sizeof(ts);
+    } else {
+        memset(&uh, 0, sizeof(uh));
+        uh.uh_sport = f->sport;
+        uh.uh_dport = f->dport;
+        uh.uh_ulen = htons(pktlen - sizeof(eh) - sizeof(ip));
+        memcpy(m->m_data + m->m_len, &uh, sizeof(uh));
+        m->m_len += sizeof(uh);
+    }
+    m->m_len = MIN(m->m_len, pktlen);
+    return m;
+}
+
+#endif /* _IFQ_ENV_H_ */
@@ -0,0 +1,234 @@
+/*
+ * Stress test of the deferred Tx start protocol: ifq_defer_start(),
+ * ifq_take_deferred_start() and ItlHalService::deferStart().
+ *
+ * The work loop gate is a recursive mutex that producers only try to
+ * take, as IOCommandGate::attemptAction() does.  Producers put a frame
+ * on the send queue and kick if_start; when the gate is busy they leave
+ * the kick pending and signal the deferred start event, which a work
+ * loop thread serves once the gate is free.  Other threads hold the gate
+ * like timers and ioctls do and never look at pending kicks, and an Rx
+ * thread runs if_input with empty lists.  Last, one frame is kicked while
+ * a timer holds the gate.  No frame may be left on the send queue.  With
+ * -n neither the event nor an empty if_input serves the kick, which is
+ * how kicks used to be lost.
+ *
+ * deferStart() publishes the ifnet the work loop kicks, as the HAL does;
+ * every event must find it.  Build with -fsanitize=thread as well to
+ * check the publication is not a data race.
+ *
+ *   c++ -std=c++11 -O2 -pthread -o ifq_kick_stress ifq_kick_stress.cpp
+ *   ./ifq_kick_stress [-n]
+ *   c++ -std=c++11 -O1 -g -fsanitize=thread -o ifq_kick_stress ifq_kick_stress.cpp
+ *   ./ifq_kick_stress
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PRODUCERS       4
+#define FRAMES          200000  /* per producer */
+#define GATE_HOLDERS    2
+
+struct ifnet {
+    std::atomic<unsigned> if_start_pending;
+    void (*if_start)(struct ifnet *);
+};
+
+static std::recursive_mutex gate;
+static struct ifnet *deferred_ifp;      /* ItlHalService::deferredStartIfp */
+static std::atomic<uint64_t> enqueued;
+static uint64_t sent;                   /* under the gate */
+static uint64_t deferred, served_by_event, events_without_ifp;
+static bool fixed = true;
+static std::atomic<bool> stop;
+
+static std::mutex ev_mtx;
+static std::condition_variable ev_cv;
+static unsigned ev_count;
+
+static void
+ifq_defer_start(struct ifnet *ifp)
+{
+    unsigned zero = 0;
+
+    if (ifp->if_start_pending.compare_exchange_strong(zero, 1))
+        __atomic_fetch_add(&deferred, 1, __ATOMIC_RELAXED);
+}
+
+static bool
+ifq_take_deferred_start(struct ifnet *ifp)
+{
+    unsigned one = 1;
+
+    return ifp->if_start_pending.compare_exchange_strong(one, 0);
+}
+
+/* The start task: runs in the gate and empties the send queue. */
+static void
+start_task(struct ifnet *ifp)
+{
+    ifq_take_deferred_start(ifp);
+    sent = enqueued.load();
+}
+
+static struct ifnet ifnet = { {0}, start_task };
+
+/* ItlHalService::deferStart(): publish the ifnet, then signal. */
+static void
+defer_start(struct ifnet *ifp)
+{
+    struct ifnet *null = NULL;
+
+    __atomic_compare_exchange_n(&deferred_ifp, &null, ifp, false,
+        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    ifq_defer_start(ifp);
+    if (fixed) {
+        std::lock_guard<std::mutex> lk(ev_mtx);
+        ev_count++;
+        ev_cv.notify_one();
+    }
+}
+
+static void
+if_start(void)
+{
+    if (gate.try_lock()) {
+        start_task(&ifnet);
+        gate.unlock();
+        return;
+    }
+    defer_start(&ifnet);
+}
+
+static void
+producer(void)
+{
+    for (int i = 0; i < FRAMES; i++) {
+        enqueued++;
+        if_start();
+    }
+}
+
+/* Timers and ioctls: hold the gate, ignore pending kicks. */
+static void
+gate_holder(void)
+{
+    while (!stop) {
+        gate.lock();
+        std::this_thread::sleep_for(std::chrono::microseconds(20));
+        gate.unlock();
+        std::this_thread::yield();
+    }
+}
+
+/* Rx interrupts without data frames: if_input with an empty list. */
+static void
+rx_empty_input(void)
+{
+    while (!stop) {
+        gate.lock();
+        if (fixed && ifq_take_deferred_start(&ifnet))
+            start_task(&ifnet);
+        gate.unlock();
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+    }
+}
+
+/*
+ * The work loop serving the deferred start event source: the action
+ * runs without ev_mtx, as interruptOccurred() only counts the event, so
+ * the ifnet it kicks is the one deferStart() published.
+ */
+static void
+work_loop(void)
+{
+    std::unique_lock<std::mutex> lk(ev_mtx);
+    struct ifnet *ifp;
+
+    while (!stop) {
+        if (ev_count == 0) {
+            ev_cv.wait_for(lk, std::chrono::milliseconds(10));
+            continue;
+        }
+        ev_count = 0;
+        lk.unlock();
+        gate.lock();
+        ifp = __atomic_load_n(&deferred_ifp, __ATOMIC_ACQUIRE);
+        if (ifp == NULL)
+            events_without_ifp++;
+        else if (ifq_take_deferred_start(ifp)) {
+            (*ifp->if_start)(ifp);
+            served_by_event++;
+        }
+        gate.unlock();
+        lk.lock();
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    std::vector<std::thread> producers, others;
+    std::thread timer;
+    std::atomic<bool> held(false), kicked(false);
+    uint64_t left;
+
+    if (argc > 1 && strcmp(argv[1], "-n") == 0)
+        fixed = false;
+
+    for (int i = 0; i < GATE_HOLDERS; i++)
+        others.emplace_back(gate_holder);
+    others.emplace_back(work_loop);
+    for (int i = 0; i < PRODUCERS; i++)
+        producers.emplace_back(producer);
+    for (auto &t : producers)
+        t.join();
+
+    /*
+     * The last frame is kicked while a timer is in the gate. After that,
+     * gate holders and Rx without data frames are the only activity, as
+     * on an idle link.
+     */
+    timer = std::thread([&] {
+        gate.lock();
+        held = true;
+        while (!kicked)
+            std::this_thread::yield();
+        gate.unlock();
+    });
+    while (!held)
+        std::this_thread::yield();
+    enqueued++;
+    if_start();
+    kicked = true;
+    timer.join();
+    others.emplace_back(rx_empty_input);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    stop = true;
+    for (auto &t : others)
+        t.join();
+
+    left = enqueued - sent;
+    printf("frames %llu, kicks deferred %llu, served by event %llu, "
+        "stranded %llu\n", (unsigned long long)enqueued.load(),
+        (unsigned long long)deferred, (unsigned long long)served_by_event,
+        (unsigned long long)left);
+    if (events_without_ifp != 0) {
+        printf("FAIL: %llu events found no ifnet\n",
+            (unsigned long long)events_without_ifp);
+        return 1;
+    }
+    if (fixed && left != 0) {
+        printf("FAIL: frames left on the send queue\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,431 @@
+/*
+ * Simulates an iwn aggregation queue to compare kicking the TX ring after
+ * every frame with the batching of iwn_tx_defer_kick() and iwn_tx_kick().
+ *
+ * The host side runs the iwn_start() loop: it dequeues frames until the
+ * ring passes IWN_TX_RING_HIMARK, spending HOST_TX usec on each, and
+ * writes the ring's write pointer as the engine says. Firmware only sees
+ * frames up to the last write pointer. When the air is idle it contends
+ * for it and then sends an A-MPDU of the frames it sees within the Block
+ * Ack window of 64, holes first, up to 4 msec long. Each subframe is
+ * lost with a probability of 5% and retransmitted in a later A-MPDU; the
+ * eighth loss drops it. The window moves past acknowledged and dropped
+ * frames and frees their ring slots, restarting a stopped queue below
+ * IWN_TX_RING_LOMARK as iwn_clear_oactive() does.
+ *
+ * Frames beyond IFQ_MAXLEN waiting for the ring are dropped on arrival
+ * and not counted. For each traffic profile the goodput, the A-MPDU
+ * size, the write pointer updates per frame and the latency of a frame
+ * from its arrival to its acknowledgement are printed.
+ *
+ *   (awk -v defines="IWN_TX_RING_COUNT IWN_TX_RING_LOMARK \
+ *        IWN_TX_RING_HIMARK IWN_HBUS_TARG_WRPTR" \
+ *        -f extract.awk ../itlwm/hal_iwn/if_iwnreg.h &&
+ *    awk -v types=iwn_tx_ba -v defines=IWN_AGG_BURST \
+ *        -f extract.awk ../itlwm/hal_iwn/if_iwnvar.h) > iwn_agg_kick_defs.inc
+ *   awk -v fns="iwn_tx_defer_kick iwn_tx_kick" \
+ *       -f extract.awk ../itlwm/hal_iwn/ItlIwn.cpp > iwn_agg_kick.inc
+ *   c++ -std=c++11 -g -fsanitize=address,undefined -I compat \
+ *       -idirafter ../itl80211/openbsd -o iwn_agg_kick_sim \
+ *       iwn_agg_kick_sim.cpp
+ *   ./iwn_agg_kick_sim
+ */
+
+#include <sys/systm.h>
+
+#include <deque>
+#include <math.h>
+#include <queue>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "iwn_agg_kick_defs.inc"
+
+#define IEEE80211_NUM_TID   16
+#define FIRST_AGG_TXQ       10  /* IWN5000_FIRST_AGG_TXQUEUE */
+#define NTXQS               20
+
+struct iwn_tx_ring {
+    int qid;
+    int queued;
+    int cur;
+};
+
+struct iwn_softc {
+    int first_agg_txq;
+    int ntxqs;
+    uint32_t qfullmsk;
+    uint32_t sc_tx_kickmsk;
+    struct iwn_tx_ba sc_tx_ba[IEEE80211_NUM_TID];
+    struct iwn_tx_ring txq[NTXQS];
+};
+
+static void doorbell(struct iwn_softc *, uint32_t, uint32_t);
+
+#define IWN_WRITE(sc, reg, val) doorbell(sc, reg, val)
+
+class ItlIwn {
+public:
+    int iwn_tx_defer_kick(struct iwn_softc *, int);
+    void iwn_tx_kick(struct iwn_softc *);
+};
+
+#include "iwn_agg_kick.inc"
+
+#define SIMTIME     2000000.0   /* usec of traffic */
+#define SEEDS       5
+#define HOST_TX     1.5         /* usec per frame in iwn_tx() */
+#define AIFS        34.0
+#define SLOT        9.0
+#define CWMIN       15
+#define PREAMBLE    40.0
+#define SUBFRAME    (1538 * 8 / 144.4)  /* usec at MCS 15, short GI */
+#define SIFS        16.0
+#define BLOCKACK    32.0
+#define AMPDU_MAX   4000.0      /* usec */
+#define BA_WINDOW   64
+#define LOSS        0.05
+#define RETRIES     8
+#define IFQ_MAXLEN  256         /* if_snd, tail dropped beyond */
+
+enum { ENGINE_KICK, ENGINE_BATCH, ENGINES };
+static const char *engines[ENGINES] = { "kick", "batch" };
+
+enum { EV_ARRIVE, EV_START, EV_DOORBELL, EV_ACCESS, EV_BA };
+
+struct event {
+    double t;
+    int type;
+    u_int64_t arg;
+    bool operator<(const struct event &e) const { return t > e.t; }
+};
+
+enum { F_PENDING, F_ACKED, F_DROPPED };
+
+struct frame {
+    double arrive;
+    int state;
+    int tries;
+};
+
+struct profile {
+    const char *name;
+    double mbps;        /* offered load */
+    int burst;          /* frames per burst, uniform from 1 */
+};
+
+struct result {
+    double goodput;     /* Mbit/s */
+    double latency;     /* usec from arrival to acknowledgement */
+    u_int64_t frames, acked, dropped, lost, late;
+    u_int64_t nampdu, subframes, doorbells;
+};
+
+static const struct profile profiles[] = {
+    { "bulk", 300.0, 32 },
+    { "web", 40.0, 16 },
+    { "light", 5.0, 3 },
+};
+
+static u_int64_t rng;
+static int failures;
+
+static std::priority_queue<struct event> events;
+static std::vector<struct frame> frames;
+static std::deque<u_int64_t> ifq;   /* frames waiting in if_snd */
+static ItlIwn that;
+static struct iwn_softc sc;
+static int engine;
+static double now, host_free;
+static bool oactive, start_pending, air_busy, access_pending;
+static u_int64_t submitted, fw_wp, winstart, ndoorbells;
+static std::vector<u_int64_t> ampdu;
+static struct result res;
+
+static double
+uniform(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return (rng >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void
+check(const char *what, bool ok)
+{
+    printf("%-4s %s\n", ok ? "ok" : "FAIL", what);
+    if (!ok)
+        failures++;
+}
+
+static void
+post(double t, int type, u_int64_t arg)
+{
+    events.push({ t, type, arg });
+}
+
+/* The write pointer as firmware sees it; submitted is its absolute value. */
+static void
+doorbell(struct iwn_softc *sc, uint32_t reg, uint32_t val)
+{
+    if (reg != IWN_HBUS_TARG_WRPTR ||
+        (val & 0xff) != submitted % IWN_TX_RING_COUNT)
+        abort();
+    ndoorbells++;
+    post(host_free, EV_DOORBELL, submitted);
+}
+
+/* iwn_start(): host_free is the host's clock while the loop runs. */
+static void
+start(void)
+{
+    int qid = FIRST_AGG_TXQ;
+    struct iwn_tx_ring *ring = &sc.txq[qid];
+
+    host_free = MAX(host_free, now);
+    for (;;) {
+        if (sc.qfullmsk != 0) {
+            oactive = true;
+            break;
+        }
+        if (ifq.empty())
+            break;
+        ifq.pop_front();
+        host_free += HOST_TX;
+
+        /* iwn_tx() */
+        ring->cur = (ring->cur + 1) % IWN_TX_RING_COUNT;
+        submitted++;
+        if (++ring->queued > IWN_TX_RING_HIMARK)
+            sc.qfullmsk |= 1 << ring->qid;
+        if (engine == ENGINE_KICK || !that.iwn_tx_defer_kick(&sc, qid))
+            IWN_WRITE(&sc, IWN_HBUS_TARG_WRPTR, ring->qid << 8 | ring->cur);
+    }
+    if (engine == ENGINE_BATCH)
+        that.iwn_tx_kick(&sc);
+    /* Nothing may be left behind a deferred kick. */
+    if (sc.sc_tx_kickmsk != 0)
+        res.late++;
+}
+
+static void
+kick_start(void)
+{
+    if (!oactive && !start_pending) {
+        start_pending = true;
+        post(MAX(now, host_free), EV_START, 0);
+    }
+}
+
+static bool
+eligible(u_int64_t n)
+{
+    return n < fw_wp && n < winstart + BA_WINDOW &&
+        frames[n].state == F_PENDING;
+}
+
+static void
+contend(void)
+{
+    u_int64_t n;
+
+    if (air_busy || access_pending)
+        return;
+    for (n = winstart; n < fw_wp && n < winstart + BA_WINDOW; n++) {
+        if (eligible(n)) {
+            access_pending = true;
+            post(now + AIFS + SLOT * (int)(uniform() * (CWMIN + 1)),
+                EV_ACCESS, 0);
+            return;
+        }
+    }
+}
+
+static void
+access(void)
+{
+    double air = PREAMBLE;
+    u_int64_t n;
+
+    access_pending = false;
+    ampdu.clear();
+    for (n = winstart; n < fw_wp && n < winstart + BA_WINDOW; n++) {
+        if (!eligible(n))
+            continue;
+        if (air + SUBFRAME > AMPDU_MAX)
+            break;
+        ampdu.push_back(n);
+        air += SUBFRAME;
+    }
+    if (ampdu.empty())
+        return;
+    air_busy = true;
+    res.nampdu++;
+    res.subframes += ampdu.size();
+    post(now + air + SIFS + BLOCKACK, EV_BA, ampdu.size());
+}
+
+static void
+blockack(void)
+{
+    struct iwn_tx_ring *ring = &sc.txq[FIRST_AGG_TXQ];
+    struct frame *f;
+    u_int64_t old;
+    size_t i;
+
+    air_busy = false;
+    for (i = 0; i < ampdu.size(); i++) {
+        f = &frames[ampdu[i]];
+        if (uniform() < LOSS) {
+            res.lost++;
+            if (++f->tries >= RETRIES) {
+                f->state = F_DROPPED;
+                res.dropped++;
+            }
+            continue;
+        }
+        f->state = F_ACKED;
+        res.acked++;
+        res.latency += now - f->arrive;
+    }
+    ampdu.clear();
+
+    /* iwn_ampdu_txq_advance() and iwn_clear_oactive() */
+    old = winstart;
+    while (winstart < fw_wp && frames[winstart].state != F_PENDING)
+        winstart++;
+    ring->queued -= winstart - old;
+    if (ring->queued < IWN_TX_RING_LOMARK) {
+        sc.qfullmsk &= ~(1 << ring->qid);
+        if (oactive) {
+            oactive = false;
+            kick_start();
+        }
+    }
+    contend();
+}
+
+static void
+run(const struct profile *p, int eng, u_int64_t seed, struct result *out)
+{
+    double t, frame_us;
+    struct event ev;
+    int k;
+
+    while (!events.empty())
+        events.pop();
+    frames.clear();
+    ifq.clear();
+    memset(&sc, 0, sizeof(sc));
+    sc.first_agg_txq = FIRST_AGG_TXQ;
+    sc.ntxqs = NTXQS;
+    for (k = 0; k < NTXQS; k++)
+        sc.txq[k].qid = k;
+    engine = eng;
+    rng = seed * 0x9e3779b97f4a7c15ULL + 1;
+    now = host_free = 0;
+    oactive = start_pending = air_busy = access_pending = false;
+    submitted = fw_wp = winstart = ndoorbells = 0;
+    memset(&res, 0, sizeof(res));
+
+    /* Bursts with exponential gaps making up the offered load. */
+    frame_us = 1500 * 8 / p->mbps;
+    for (t = 0; t < SIMTIME; ) {
+        k = 1 + (int)(uniform() * p->burst);
+        post(t, EV_ARRIVE, k);
+        t += -log(1 - uniform()) * frame_us * (p->burst + 1) / 2;
+    }
+
+    while (!events.empty()) {
+        ev = events.top();
+        events.pop();
+        now = ev.t;
+        switch (ev.type) {
+        case EV_ARRIVE:
+            for (k = 0; k < (int)ev.arg && ifq.size() < IFQ_MAXLEN; k++) {
+                ifq.push_back(frames.size());
+                frames.push_back({ now, F_PENDING, 0 });
+            }
+            kick_start();
+            break;
+        case EV_START:
+            start_pending = false;
+            start();
+            break;
+        case EV_DOORBELL:
+            fw_wp = MAX(fw_wp, ev.arg);
+            contend();
+            break;
+        case EV_ACCESS:
+            access();
+            break;
+        case EV_BA:
+            blockack();
+            break;
+        }
+    }
+
+    res.frames = frames.size();
+    out->frames += res.frames;
+    out->acked += res.acked;
+    out->dropped += res.dropped;
+    out->lost += res.lost;
+    out->late += res.late + (submitted != frames.size());
+    out->goodput += res.acked * 1500 * 8 / now / SEEDS;
+    out->nampdu += res.nampdu;
+    out->subframes += res.subframes;
+    out->doorbells += ndoorbells;
+    out->latency += res.latency;
+}
+
+int
+main(int argc, char **argv)
+{
+    struct result r[nitems(profiles)][ENGINES];
+    u_int64_t seed;
+    size_t i;
+    int e;
+    char what[128];
+
+    memset(r, 0, sizeof(r));
+    for (i = 0; i < nitems(profiles); i++) {
+        printf("%s: %.0f Mbit/s offered in bursts of 1-%d frames\n",
+            profiles[i].name, profiles[i].mbps, profiles[i].burst);
+        printf("  engine  Mbit/s  A-MPDU  kicks/frame  latency/us  dropped\n");
+        for (e = 0; e < ENGINES; e++) {
+            struct result *res = &r[i][e];
+
+            for (seed = 0; seed < SEEDS; seed++)
+                run(&profiles[i], e, seed, res);
+            printf("  %-6s %7.1f %7.1f %12.3f %11.0f %8llu\n", engines[e],
+                res->goodput, (double)res->subframes / res->nampdu,
+                (double)res->doorbells / res->frames,
+                res->latency / res->acked, (unsigned long long)res->dropped);
+        }
+    }
+
+    for (i = 0; i < nitems(profiles); i++) {
+        struct result *k = &r[i][ENGINE_KICK], *b = &r[i][ENGINE_BATCH];
+
+        snprintf(what, sizeof(what), "%s: every frame acked or dropped",
+            profiles[i].name);
+        check(what, b->acked + b->dropped == b->frames &&
+            k->acked + k->dropped == k->frames);
+        snprintf(what, sizeof(what), "%s: no kick left deferred",
+            profiles[i].name);
+        check(what, b->late == 0);
+        snprintf(what, sizeof(what), "%s: goodput within 1%% of kicking "
+            "every frame", profiles[i].name);
+        check(what, b->goodput >= 0.99 * k->goodput);
+    }
+    check("bulk: a quarter of the ring kicks or fewer",
+        r[0][ENGINE_BATCH].doorbells * 4 <= r[0][ENGINE_KICK].doorbells);
+    check("light: latency grows by less than 10 usec",
+        r[2][ENGINE_BATCH].latency / r[2][ENGINE_BATCH].acked <
+        r[2][ENGINE_KICK].latency / r[2][ENGINE_KICK].acked + 10);
+
+    printf("%d failed\n", failures);
+    return failures != 0;
+}
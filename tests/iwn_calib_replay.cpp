@@ -0,0 +1,341 @@
+/*
+ * Replays beacon period statistics through iwn_tune_sensitivity() and
+ * checks how the thresholds move: false alarm counts are judged over
+ * IWN_CALIB_WINDOW periods and thresholds only move after the judgement
+ * held for IWN_CALIB_HYST periods in a row.
+ *
+ * A trace gives, per line, a number of beacon periods and the OFDM and
+ * CCK false alarms seen in each, optionally followed by the time the
+ * receiver was enabled in usec (102400 by default). "counters n" starts
+ * the firmware's cumulative counters at n. Lines starting with "#" are
+ * ignored. The built-in traces are checked; traces given as arguments
+ * are replayed and the thresholds printed for each period. The limits
+ * are those of the 6000 series.
+ *
+ *   (awk -v types="iwn_rx_phy_stats iwn_rx_general_stats \
+ *        iwn_rx_ht_phy_stats iwn_rx_stats iwn_sensitivity_cmd \
+ *        iwn_enhanced_sensitivity_cmd iwn_sensitivity_limits" \
+ *        -v defines="IWN_CMD_GET_STATISTICS IWN_CMD_SET_SENSITIVITY" \
+ *        -v vars="iwn6000_sensitivity_limits" \
+ *        -f extract.awk ../itlwm/hal_iwn/if_iwnreg.h &&
+ *    awk -v types=iwn_calib_state -v defines=IWN_FLAG_ENH_SENS \
+ *        -f extract.awk ../itlwm/hal_iwn/if_iwnvar.h) > iwn_calib_defs.inc
+ *   awk -v fns="iwn_init_sensitivity iwn_calib_trend \
+ *        iwn_sensitivity_changed iwn_tune_sensitivity \
+ *        iwn_send_sensitivity" -f extract.awk ../itlwm/hal_iwn/ItlIwn.cpp \
+ *       > iwn_calib.inc
+ *   c++ -std=c++11 -g -fsanitize=address,undefined -I compat \
+ *       -idirafter ../itl80211/openbsd -o iwn_calib_replay \
+ *       iwn_calib_replay.cpp
+ *   ./iwn_calib_replay [trace ...]
+ */
+
+#include <sys/systm.h>
+#include <sys/endian.h>
+
+#include <net80211/ieee80211.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#define __packed    __attribute__((packed))
+#define letoh32(x)  le32toh(x)
+
+#define DPRINTFN(n, x)  do { ; } while (0)
+
+#include "iwn_calib_defs.inc"
+
+struct iwn_softc;
+
+struct iwn_ops {
+    int (*init_gains)(struct iwn_softc *);
+};
+
+struct iwn_softc {
+    struct iwn_ops ops;
+    const struct iwn_sensitivity_limits *limits;
+    struct iwn_calib_state calib;
+    int sc_flags;
+    u_int nsent;
+};
+
+class ItlIwn {
+public:
+    int iwn_cmd(struct iwn_softc *, int, const void *, int, int);
+    int iwn_init_sensitivity(struct iwn_softc *);
+    void iwn_tune_sensitivity(struct iwn_softc *,
+        const struct iwn_rx_stats *);
+    int iwn_calib_trend(int *, int);
+    int iwn_sensitivity_changed(struct iwn_calib_state *);
+    int iwn_send_sensitivity(struct iwn_softc *);
+};
+
+int ItlIwn::
+iwn_cmd(struct iwn_softc *sc, int code, const void *buf, int size, int async)
+{
+    if (code == IWN_CMD_SET_SENSITIVITY)
+        sc->nsent++;
+    return 0;
+}
+
+static int
+init_gains(struct iwn_softc *sc)
+{
+    return 0;
+}
+
+#include "iwn_calib.inc"
+
+#define RXENA   102400  /* usec of a 100 TU beacon period */
+
+struct step {
+    uint32_t fa_ofdm, fa_cck, rxena;
+};
+
+struct trace {
+    std::string name;
+    uint32_t counters;
+    std::vector<struct step> steps;
+};
+
+/* Thresholds after each period. */
+struct state {
+    uint32_t ofdm_x1, cck_x4, energy_cck;
+    u_int nsent;
+};
+
+static int failures;
+static ItlIwn that;
+
+static void
+check(const char *what, bool ok)
+{
+    printf("%-4s %s\n", ok ? "ok" : "FAIL", what);
+    if (!ok)
+        failures++;
+}
+
+static bool
+parse(const std::vector<std::string> &lines, struct trace &tr,
+    std::string &err)
+{
+    unsigned long n, ofdm, cck, rxena;
+    int k;
+    size_t i;
+
+    for (i = 0; i < lines.size(); i++) {
+        const char *l = lines[i].c_str();
+
+        if (l[strspn(l, " \t")] == '\0' || l[strspn(l, " \t")] == '#')
+            continue;
+        if (sscanf(l, " counters %lu", &n) == 1) {
+            tr.counters = n;
+            continue;
+        }
+        rxena = RXENA;
+        k = sscanf(l, "%lu %lu %lu %lu", &n, &ofdm, &cck, &rxena);
+        if (k < 3 || rxena == 0) {
+            err = "line " + std::to_string(i + 1) + ": " + lines[i];
+            return false;
+        }
+        while (n-- > 0)
+            tr.steps.push_back({ (uint32_t)ofdm, (uint32_t)cck,
+                (uint32_t)rxena });
+    }
+    return true;
+}
+
+static void
+replay(const struct trace &tr, std::vector<struct state> &out, bool print)
+{
+    struct iwn_softc sc;
+    struct iwn_rx_stats stats;
+    struct iwn_calib_state *calib = &sc.calib;
+    size_t i;
+    int j;
+
+    memset(&sc, 0, sizeof(sc));
+    sc.ops.init_gains = init_gains;
+    sc.limits = &iwn6000_sensitivity_limits;
+    sc.sc_flags = IWN_FLAG_ENH_SENS;
+    (void)that.iwn_init_sensitivity(&sc);
+    calib->state = IWN_CALIB_STATE_RUN;
+
+    memset(&stats, 0, sizeof(stats));
+    stats.ofdm.fa = stats.cck.fa = htole32(tr.counters);
+    /* The first statistics only set the counters' base. */
+    calib->fa_ofdm = calib->fa_cck = tr.counters;
+    for (j = 0; j < 3; j++) {
+        stats.general.noise[j] = htole32(40 << 8);
+        stats.general.energy[j] = htole32(100);
+    }
+
+    out.clear();
+    if (print)
+        printf("%s\n period  fa_ofdm  fa_cck  ofdm_x1  cck_x4  energy_cck"
+            "  sent\n", tr.name.c_str());
+    for (i = 0; i < tr.steps.size(); i++) {
+        stats.ofdm.fa = htole32(letoh32(stats.ofdm.fa) +
+            tr.steps[i].fa_ofdm);
+        stats.cck.fa = htole32(letoh32(stats.cck.fa) + tr.steps[i].fa_cck);
+        stats.general.load = htole32(tr.steps[i].rxena);
+        that.iwn_tune_sensitivity(&sc, &stats);
+        out.push_back({ calib->ofdm_x1, calib->cck_x4, calib->energy_cck,
+            sc.nsent });
+        if (print)
+            printf(" %6zu %8u %7u %8u %7u %11u %5u\n", i + 1,
+                tr.steps[i].fa_ofdm, tr.steps[i].fa_cck, calib->ofdm_x1,
+                calib->cck_x4, calib->energy_cck, sc.nsent);
+    }
+}
+
+/* First period (from 1) after which the OFDM threshold differs from v. */
+static size_t
+first_move(const std::vector<struct state> &st, size_t from, uint32_t v)
+{
+    size_t i;
+
+    for (i = from; i < st.size(); i++)
+        if (st[i].ofdm_x1 != v)
+            return i + 1;
+    return 0;
+}
+
+/*
+ * Steady load of 60 false alarms per period, above the 25 which make a
+ * period busy, and the band going quiet after it.
+ */
+static const char *busy[] = {
+    "30 60 60",
+    "40 0 0",
+};
+
+/* Two busy periods and two quiet ones: busy on average only in halves. */
+static const char *pairs[] = {
+    "20 60 0",
+    "1 45 0", "1 45 0", "1 0 0", "1 0 0",
+    "1 45 0", "1 45 0", "1 0 0", "1 0 0",
+    "1 45 0", "1 45 0", "1 0 0", "1 0 0",
+    "1 45 0", "1 45 0", "1 0 0", "1 0 0",
+    "1 45 0", "1 45 0", "1 0 0", "1 0 0",
+    "1 45 0", "1 45 0", "1 0 0", "1 0 0",
+    "1 45 0", "1 45 0", "1 0 0", "1 0 0",
+    "1 45 0", "1 45 0", "1 0 0", "1 0 0",
+};
+
+/* A single burst in a quiet band. */
+static const char *spike[] = {
+    "20 1 1",
+    "1 400 1",
+    "20 1 1",
+};
+
+/* Counts whose windowed sum, scaled by 200 TU, does not fit 32 bits. */
+static const char *storm[] = {
+    "12 8000 8000",
+};
+
+/* The firmware's 32-bit counters wrapping during a busy stretch. */
+static const char *wrap[] = {
+    "counters 4294967000",
+    "30 60 60",
+};
+
+int
+main(int argc, char **argv)
+{
+    const struct iwn_sensitivity_limits *lim = &iwn6000_sensitivity_limits;
+    std::vector<struct state> st, ref;
+    std::vector<std::string> lines;
+    struct trace tr;
+    std::string err;
+    char buf[512];
+    size_t i, n;
+    uint32_t hi, lo;
+    FILE *fp;
+
+#define BUILTIN(t) \
+    tr = trace(); \
+    tr.name = #t; \
+    parse(std::vector<std::string>(t, t + nitems(t)), tr, err); \
+    replay(tr, st, false)
+
+    BUILTIN(busy);
+    check("busy: OFDM threshold does not move on the first busy period",
+        first_move(st, 0, lim->min_ofdm_x1) == 2);
+    check("busy: OFDM threshold reaches its maximum",
+        st[29].ofdm_x1 == lim->max_ofdm_x1);
+    check("busy: CCK threshold reaches its maximum",
+        st[29].cck_x4 == lim->max_cck_x4);
+    /* One step per IWN_CALIB_HYST periods. */
+    n = first_move(st, 0, lim->min_ofdm_x1);
+    for (i = n; i < st.size() && st[i].ofdm_x1 < lim->max_ofdm_x1; i++)
+        ;
+    check("busy: at most one step every two periods",
+        i - n + 1 >= (lim->max_ofdm_x1 - lim->min_ofdm_x1 - 1) * 2);
+    check("busy: thresholds are held while the window is still busy",
+        first_move(st, 30, lim->max_ofdm_x1) > 30 + IWN_CALIB_WINDOW / 2);
+    check("quiet: OFDM threshold back at its minimum",
+        st.back().ofdm_x1 == lim->min_ofdm_x1);
+
+    /*
+     * A window of four periods sees the same two busy ones whatever the
+     * phase; judged one period at a time the thresholds would go up and
+     * down every four.
+     */
+    BUILTIN(pairs);
+    for (i = 20 + IWN_CALIB_WINDOW, n = 0; i < st.size(); i++)
+        n += st[i].ofdm_x1 != st[i - 1].ofdm_x1;
+    check("pairs: OFDM threshold does not oscillate", n == 0);
+    check("pairs: no commands once the window has filled",
+        st.back().nsent == st[20 + IWN_CALIB_WINDOW].nsent);
+
+    BUILTIN(spike);
+    hi = lo = st[19].ofdm_x1;
+    for (i = 20; i < st.size(); i++) {
+        hi = MAX(hi, st[i].ofdm_x1);
+        lo = MIN(lo, st[i].ofdm_x1);
+    }
+    /* It stays in the window for four periods: two steps. */
+    check("spike: one burst moves the OFDM threshold at most two steps",
+        hi - lo <= 2);
+    check("spike: thresholds return afterwards",
+        st.back().ofdm_x1 == st[19].ofdm_x1);
+
+    BUILTIN(storm);
+    check("storm: windowed sums beyond 32 bits read as busy",
+        st.back().ofdm_x1 > lim->min_ofdm_x1 &&
+        st.back().cck_x4 > 125);
+
+    BUILTIN(busy);
+    ref = st;
+    BUILTIN(wrap);
+    for (i = 0, n = 0; i < st.size(); i++)
+        n += st[i].ofdm_x1 != ref[i].ofdm_x1 || st[i].cck_x4 != ref[i].cck_x4;
+    check("wrap: counters wrapping do not change the outcome", n == 0);
+
+    for (i = 1; i < (size_t)argc; i++) {
+        if ((fp = fopen(argv[i], "r")) == NULL) {
+            perror(argv[i]);
+            return 2;
+        }
+        lines.clear();
+        while (fgets(buf, sizeof(buf), fp) != NULL) {
+            buf[strcspn(buf, "\r\n")] = '\0';
+            lines.push_back(buf);
+        }
+        fclose(fp);
+        tr = trace();
+        tr.name = argv[i];
+        if (!parse(lines, tr, err)) {
+            check((std::string(argv[i]) + ": " + err).c_str(), false);
+            continue;
+        }
+        replay(tr, st, true);
+    }
+
+    printf("%d failed\n", failures);
+    return failures != 0;
+}
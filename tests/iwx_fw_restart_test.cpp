@@ -0,0 +1,867 @@
+/*
+ * Fault injection test of iwx_fast_restart() against a fake firmware.
+ * The fake keeps the contexts, keys, Rx BA sessions and Tx queues the
+ * driver hands it, and loses all of them when it asserts. A station is
+ * associated with CCMP keys, two Rx BA sessions (one with an inactivity
+ * timeout) and a Tx BA session, and an ADDBA request is in flight. Then
+ * the iwxfwfault timer makes firmware assert and the error interrupt
+ * queues iwx_init_task(), which must bring everything back without a
+ * reset: the same state in firmware, Rx BA sessions with their timeout
+ * and reorder timers, the Tx BA queue at the sequence number net80211
+ * is at with a BAR, and the ADDBA refused. The restored timeout must
+ * still tear an idle session down. A second assert within the holdoff,
+ * a command failing during the restart and an assert outside RUN state
+ * must fall back to a reset or do nothing.
+ *
+ *   N=../itl80211/openbsd/net80211 X=../itlwm/hal_iwx
+ *   (awk -v types="ieee80211_rxinfo ieee80211_tx_ba ieee80211_rx_ba" \
+ *        -v defines="IEEE80211_NODE_RXPROT IEEE80211_NODE_TXPROT \
+ *        IEEE80211_NODE_TXRXPROT" -f extract.awk $N/ieee80211_node.h &&
+ *    awk -v types=ieee80211_opmode -v defines=IEEE80211_GROUP_NKID \
+ *        -f extract.awk $N/ieee80211_var.h &&
+ *    awk -v types=ieee80211_state -f extract.awk $N/ieee80211_proto.h &&
+ *    awk -v types=iwx_add_sta_cmd -v fns=iwx_cmd_id \
+ *        -v defines="IWX_RX_REORDER_DATA_INVALID_BAID IWX_FW_CTXT_ACTION_ADD \
+ *        IWX_STA_MODE_MODIFY IWX_STA_MODIFY_ADD_BA_TID \
+ *        IWX_STA_MODIFY_REMOVE_BA_TID IWX_ADD_STA IWX_REPLY_ERROR \
+ *        IWX_LONG_GROUP IWX_FW_CTXT_ID_POS IWX_FW_CTXT_COLOR_POS \
+ *        IWX_FW_CMD_ID_AND_COLOR IWX_ADD_STA_SUCCESS IWX_ADD_STA_STATUS_MASK \
+ *        IWX_ADD_STA_BAID_VALID_MASK IWX_ADD_STA_BAID_MASK \
+ *        IWX_ADD_STA_BAID_SHIFT" -f extract.awk $X/if_iwxreg.h &&
+ *    awk -v types="iwx_reorder_buffer iwx_reorder_buf_entry iwx_rxba_data \
+ *        iwx_ba_task_data iwx_tid_data IWX_CMD_MODE" \
+ *        -v defines="IWX_FLAG_RFKILL IWX_FLAG_SCANNING IWX_FLAG_MAC_ACTIVE \
+ *        IWX_FLAG_BINDING_ACTIVE IWX_FLAG_STA_ACTIVE IWX_FLAG_TE_ACTIVE \
+ *        IWX_FLAG_HW_ERR IWX_FLAG_SHUTDOWN IWX_FLAG_BGSCAN IWX_FLAG_TXFLUSH \
+ *        IWX_FLAG_FW_RESTART IWX_FW_RESTART_HOLDOFF IWX_STATION_ID \
+ *        IWX_MAX_TID_COUNT IWX_INVALID_QUEUE IWX_MAX_RX_QUEUES IWX_MAX_BAID \
+ *        RX_REORDER_BUF_TIMEOUT_MQ_USEC" -f extract.awk $X/if_iwxvar.h) \
+ *       > iwx_fw_restart_defs.inc
+ *   awk -v defines=IWX_MAX_RX_BA_SESSIONS \
+ *       -v fns="iwx_init_reorder_buffer iwx_clear_reorder_buffer \
+ *       iwx_rx_ba_session_expired iwx_sta_rx_agg iwx_rx_agg_refuse \
+ *       iwx_fast_restart iwx_fw_fault_inject iwx_init_task" \
+ *       -f extract.awk $X/ItlIwx.cpp > iwx_fw_restart.inc
+ *   c++ -std=c++11 -g -fsanitize=address,undefined -I compat \
+ *       -idirafter ../itl80211/openbsd -o iwx_fw_restart_test \
+ *       iwx_fw_restart_test.cpp
+ *   ./iwx_fw_restart_test [-v]
+ */
+
+#include <sys/systm.h>
+#include <sys/endian.h>
+#include <sys/time.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stddef.h>
+
+#define letoh16(x)  le16toh(x)
+
+#include <net80211/ieee80211.h>
+#include <net80211/ieee80211_crypto.h>
+
+#include <stdio.h>
+#include <set>
+#include <vector>
+
+/* Timeouts run off a clock the test sets. */
+struct CTimeout {
+    void (*to_func)(void *);
+    void *to_arg;
+    bool isPending;
+    u_int64_t to_time;      /* usec */
+};
+
+static u_int64_t env_usec = 1000000;
+static std::set<CTimeout *> env_timeouts;
+
+static void
+timeout_set(CTimeout **t, void (*fn)(void *), void *arg)
+{
+    if (*t == NULL) {
+        *t = new CTimeout;
+        env_timeouts.insert(*t);
+    }
+    (*t)->to_func = fn;
+    (*t)->to_arg = arg;
+    (*t)->isPending = false;
+}
+
+/* Like CTimeout::timeout_add_msec, a freed timeout is never armed. */
+static int
+timeout_add_usec(CTimeout **to, int usecs)
+{
+    if (*to == NULL)
+        return 0;
+    (*to)->isPending = true;
+    (*to)->to_time = env_usec + usecs;
+    return 1;
+}
+
+static int
+timeout_add_sec(CTimeout **to, int secs)
+{
+    return timeout_add_usec(to, secs * 1000000);
+}
+
+static int
+timeout_del(CTimeout **to)
+{
+    if (*to != NULL)
+        (*to)->isPending = false;
+    return 1;
+}
+
+static int
+timeout_free(CTimeout **to)
+{
+    if (*to != NULL) {
+        env_timeouts.erase(*to);
+        delete *to;
+        *to = NULL;
+    }
+    return 1;
+}
+
+static bool
+timeout_pending(CTimeout *to)
+{
+    return to != NULL && to->isPending;
+}
+
+static void
+getmicrouptime(struct timeval *tv)
+{
+    tv->tv_sec = env_usec / 1000000;
+    tv->tv_usec = env_usec % 1000000;
+}
+
+static inline void
+USEC_TO_TIMEVAL(uint64_t us, struct timeval *tv)
+{
+    tv->tv_sec = us / 1000000;
+    tv->tv_usec = us % 1000000;
+}
+
+static int splnet(void) { return 1; }
+static void splx(int s) { }
+
+static bool env_verbose;
+
+static void
+XYLog(const char *fmt, ...)
+{
+    va_list ap;
+
+    if (!env_verbose)
+        return;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+}
+
+struct task {
+    void (*t_func)(void *);
+    void *t_arg;
+    bool t_queued;
+};
+struct taskq;
+static struct taskq *systq;
+
+static void
+task_set(struct task *t, void (*fn)(void *), void *arg, const char *name)
+{
+    t->t_func = fn;
+    t->t_arg = arg;
+    t->t_queued = false;
+}
+
+static void
+task_add(struct taskq *tq, struct task *t)
+{
+    t->t_queued = true;
+}
+
+struct mbuf_list {
+    mbuf_t ml_head;
+    mbuf_t ml_tail;
+    u_int ml_len;
+};
+
+static void
+ml_init(struct mbuf_list *ml)
+{
+    memset(ml, 0, sizeof(*ml));
+}
+
+/* No frames are received here. */
+static void
+ml_purge(struct mbuf_list *ml)
+{
+    ml_init(ml);
+}
+
+#include "iwx_fw_restart_defs.inc"
+
+#define ARRAY_SIZE(a)   nitems(a)
+#define DEVNAME(_s)     "iwx0"
+#define IC2IFP(_ic_)    (&(_ic_)->ic_if)
+#define container_of(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+
+struct _ifqueue {
+    bool ifq_oactive;
+};
+
+static void
+ifq_clr_oactive(struct _ifqueue *ifq)
+{
+    ifq->ifq_oactive = false;
+}
+
+struct _ifnet {
+    int if_flags;
+    int if_timer;
+    struct _ifqueue if_snd;
+    void (*if_start)(struct _ifnet *);
+};
+
+struct ieee80211_channel {
+    u_int16_t ic_freq;
+};
+
+struct ieee80211_node {
+    struct ieee80211_channel *ni_chan;
+    u_int32_t ni_flags;
+    struct ieee80211_key ni_pairwise_key;
+    struct ieee80211_rx_ba ni_rx_ba[IEEE80211_NUM_TID];
+    struct ieee80211_tx_ba ni_tx_ba[IEEE80211_NUM_TID];
+    u_int16_t ni_qos_txseqs[IEEE80211_NUM_TID];
+};
+
+struct ieee80211_stats {
+    u_int32_t is_ht_rx_ba_timeout;
+};
+
+struct ieee80211com {
+    struct _ifnet ic_if;
+    enum ieee80211_opmode ic_opmode;
+    enum ieee80211_state ic_state;
+    struct ieee80211_node *ic_bss;
+    struct ieee80211_key ic_nw_keys[IEEE80211_GROUP_NKID];
+    struct ieee80211_stats ic_stats;
+};
+
+/* What the driver told net80211 and sent over the air. */
+enum { EV_ADDBA_ACCEPT, EV_ADDBA_REFUSE, EV_ADDBA_RESP_REFUSE, EV_DELBA,
+    EV_BAR };
+struct event {
+    int what;
+    int tid;
+    int arg;        /* DELBA reason, BAR start sequence */
+};
+static std::vector<struct event> events;
+
+static void
+ieee80211_addba_req_accept(struct ieee80211com *ic, struct ieee80211_node *ni,
+    uint8_t tid)
+{
+    events.push_back({ EV_ADDBA_ACCEPT, tid, 0 });
+}
+
+static void
+ieee80211_addba_req_refuse(struct ieee80211com *ic, struct ieee80211_node *ni,
+    uint8_t tid)
+{
+    events.push_back({ EV_ADDBA_REFUSE, tid, 0 });
+}
+
+static void
+ieee80211_addba_resp_refuse(struct ieee80211com *ic,
+    struct ieee80211_node *ni, uint8_t tid, uint16_t status)
+{
+    events.push_back({ EV_ADDBA_RESP_REFUSE, tid, status });
+}
+
+static int
+ieee80211_delba_request(struct ieee80211com *ic, struct ieee80211_node *ni,
+    u_int16_t reason, u_int8_t dir, u_int8_t tid)
+{
+    events.push_back({ EV_DELBA, tid, reason });
+    return 0;
+}
+
+static int
+ieee80211_tx_compressed_bar(struct ieee80211com *ic,
+    struct ieee80211_node *ni, int tid, uint16_t ssn)
+{
+    events.push_back({ EV_BAR, tid, ssn });
+    return 0;
+}
+
+static bool
+happened(int what, int tid, int arg = -1)
+{
+    for (auto &e : events)
+        if (e.what == what && e.tid == tid && (arg == -1 || e.arg == arg))
+            return true;
+    return false;
+}
+
+struct iwx_phy_ctxt {
+    struct ieee80211_channel *channel;
+};
+
+struct iwx_node {
+    struct ieee80211_node in_ni;
+    struct iwx_phy_ctxt *in_phyctxt;
+    uint16_t in_id;
+    uint16_t in_color;
+};
+
+struct iwx_softc {
+    struct ieee80211com sc_ic;
+    int sc_flags;
+    int sc_generation;
+    int sc_tx_timer;
+    int sc_num_rx_queues;
+    int sc_rx_ba_sessions;
+    struct timeval sc_fw_restart_last;
+    uint32_t sc_fw_restarts;
+    int sc_fw_fault_sec;
+    CTimeout *sc_fw_fault_to;
+    uint8_t *sc_cmd_resp_pkt[4];
+    size_t sc_cmd_resp_len[4];
+    struct task init_task;
+    struct task ba_task;
+    struct task mac_ctxt_task;
+    struct task chan_ctxt_task;
+    struct iwx_ba_task_data ba_rx;
+    struct iwx_ba_task_data ba_tx;
+    struct iwx_tid_data sc_tid_data[IWX_MAX_TID_COUNT + 1];
+    struct iwx_rxba_data sc_rxba_data[IWX_MAX_BAID];
+    struct iwx_phy_ctxt sc_phyctxt[4];
+};
+
+/*
+ * The firmware: what the driver has configured since it was loaded. An
+ * assert loses all of it.
+ */
+struct fakefw {
+    bool alive;
+    int loads;
+    struct ieee80211_channel *phy_chan;
+    bool mac, binding, sta, mgmtq, assoc;
+    std::set<int> keys;             /* k_id, -1 for the pairwise key */
+    bool rxba[IWX_MAX_TID_COUNT];
+    uint16_t rxba_ssn[IWX_MAX_TID_COUNT];
+    uint16_t rxba_win[IWX_MAX_TID_COUNT];
+    int txq[IWX_MAX_TID_COUNT];
+    uint16_t txq_ssn[IWX_MAX_TID_COUNT];
+    int next_baid;
+    int next_qid;
+    bool fail_binding;              /* refuse the binding command */
+};
+static struct fakefw fw;
+
+static void
+fw_load(void)
+{
+    int loads = fw.loads, next_baid = fw.next_baid;
+    bool fail_binding = fw.fail_binding;
+
+    fw = fakefw();
+    fw.alive = true;
+    fw.loads = loads + 1;
+    /* Hand out BAIDs and queues the driver has not seen yet. */
+    fw.next_baid = next_baid + 3;
+    fw.next_qid = 5 + fw.loads;
+    fw.fail_binding = fail_binding;
+    for (int tid = 0; tid < IWX_MAX_TID_COUNT; tid++)
+        fw.txq[tid] = -1;
+}
+
+static int stops, inits, if_starts;
+
+class ItlIwx {
+public:
+    struct iwx_softc com;
+
+    int iwx_nic_lock(struct iwx_softc *) { return 1; }
+    void iwx_nic_unlock(struct iwx_softc *) { }
+    void iwx_del_task(struct iwx_softc *, struct taskq *, struct task *t)
+    {
+        t->t_queued = false;
+    }
+    void iwx_stop_device(struct iwx_softc *) { fw.alive = false; }
+    int iwx_init_hw(struct iwx_softc *) { fw_load(); return 0; }
+
+    int iwx_phy_ctxt_update(struct iwx_softc *, struct iwx_phy_ctxt *phy,
+        struct ieee80211_channel *chan, uint8_t, uint8_t, uint32_t)
+    {
+        if (!fw.alive)
+            return EIO;
+        phy->channel = fw.phy_chan = chan;
+        return 0;
+    }
+
+    int iwx_mac_ctxt_cmd(struct iwx_softc *, struct iwx_node *, uint32_t,
+        int)
+    {
+        if (!fw.alive)
+            return EIO;
+        fw.mac = true;
+        return 0;
+    }
+
+    int iwx_binding_cmd(struct iwx_softc *, struct iwx_node *, uint32_t)
+    {
+        if (!fw.alive || fw.fail_binding)
+            return EIO;
+        fw.binding = true;
+        return 0;
+    }
+
+    int iwx_add_sta_cmd(struct iwx_softc *, struct iwx_node *, int)
+    {
+        if (!fw.alive)
+            return EIO;
+        fw.sta = true;
+        return 0;
+    }
+
+    int iwx_enable_mgmt_queue(struct iwx_softc *)
+    {
+        if (!fw.alive)
+            return EIO;
+        fw.mgmtq = true;
+        return 0;
+    }
+
+    int iwx_run(struct iwx_softc *)
+    {
+        if (!fw.alive || !fw.sta)
+            return EIO;
+        fw.assoc = true;
+        return 0;
+    }
+
+    static int iwx_set_key(struct ieee80211com *ic, struct ieee80211_node *ni,
+        struct ieee80211_key *k)
+    {
+        if (!fw.alive || !fw.sta)
+            return EIO;
+        fw.keys.insert(k == &ni->ni_pairwise_key ? -1 : k->k_id);
+        return 0;
+    }
+
+    int iwx_tvqm_alloc_txq(struct iwx_softc *sc, int tid, int ssn)
+    {
+        if (!fw.alive)
+            return -1;
+        fw.txq[tid] = fw.next_qid++;
+        fw.txq_ssn[tid] = ssn;
+        sc->sc_tid_data[tid].qid = fw.txq[tid];
+        return fw.txq[tid];
+    }
+
+    int iwx_send_cmd_pdu(struct iwx_softc *, uint32_t, uint32_t, uint16_t,
+        const void *);
+    int iwx_send_cmd_pdu_status(struct iwx_softc *, uint32_t, uint16_t,
+        const void *, uint32_t *);
+
+    void iwx_stop(struct _ifnet *ifp)
+    {
+        stops++;
+        fw.alive = false;
+        ifp->if_flags &= ~IFF_RUNNING;
+        com.sc_ic.ic_state = IEEE80211_S_INIT;
+    }
+
+    int iwx_init(struct _ifnet *ifp)
+    {
+        inits++;
+        ifp->if_flags |= IFF_RUNNING;
+        return 0;
+    }
+
+    void iwx_init_reorder_buffer(struct iwx_reorder_buffer *, uint16_t,
+        uint16_t);
+    void iwx_clear_reorder_buffer(struct iwx_softc *, struct iwx_rxba_data *);
+    static void iwx_rx_ba_session_expired(void *);
+    static void iwx_reorder_timer_expired(void *) { }
+    void iwx_sta_rx_agg(struct iwx_softc *, struct ieee80211_node *, uint8_t,
+        uint16_t, uint16_t, int, int);
+    void iwx_rx_agg_refuse(struct iwx_softc *, struct ieee80211_node *,
+        uint8_t);
+    int iwx_fast_restart(struct iwx_softc *);
+    static void iwx_init_task(void *);
+    static void iwx_fw_fault_inject(void *);
+};
+
+/* The error interrupt, as iwx_intr() handles IWX_CSR_INT_BIT_SW_ERR. */
+static void
+fw_assert(struct iwx_softc *sc)
+{
+    fw.alive = false;
+    if ((sc->sc_flags & IWX_FLAG_SHUTDOWN) == 0) {
+        sc->sc_flags |= IWX_FLAG_FW_RESTART;
+        task_add(systq, &sc->init_task);
+    }
+}
+
+/* Firmware asserts on a command it does not know, like REPLY_ERROR. */
+int ItlIwx::
+iwx_send_cmd_pdu(struct iwx_softc *sc, uint32_t id, uint32_t flags,
+    uint16_t len, const void *data)
+{
+    if (!fw.alive)
+        return EIO;
+    if (id == iwx_cmd_id(IWX_REPLY_ERROR, IWX_LONG_GROUP, 0))
+        fw_assert(sc);
+    return 0;
+}
+
+int ItlIwx::
+iwx_send_cmd_pdu_status(struct iwx_softc *sc, uint32_t id, uint16_t len,
+    const void *data, uint32_t *status)
+{
+    const struct iwx_add_sta_cmd *cmd = (const struct iwx_add_sta_cmd *)data;
+    int tid;
+
+    if (!fw.alive || id != IWX_ADD_STA || !fw.sta)
+        return EIO;
+    if (cmd->modify_mask & IWX_STA_MODIFY_ADD_BA_TID) {
+        tid = cmd->add_immediate_ba_tid;
+        fw.rxba[tid] = true;
+        fw.rxba_ssn[tid] = le16toh(cmd->add_immediate_ba_ssn);
+        fw.rxba_win[tid] = le16toh(cmd->rx_ba_window);
+        *status = IWX_ADD_STA_SUCCESS | IWX_ADD_STA_BAID_VALID_MASK |
+            (fw.next_baid++ << IWX_ADD_STA_BAID_SHIFT);
+    } else if (cmd->modify_mask & IWX_STA_MODIFY_REMOVE_BA_TID) {
+        fw.rxba[cmd->remove_immediate_ba_tid] = false;
+        *status = IWX_ADD_STA_SUCCESS;
+    }
+    return 0;
+}
+
+#include "iwx_fw_restart.inc"
+
+#define AGG_TIMEOUT     (100 * IEEE80211_DUR_TU)    /* usec */
+#define AGG_TID         0       /* Rx with an inactivity timeout, and Tx */
+#define AGG_TID2        5       /* Rx without one */
+#define ADDBA_TID       3       /* ADDBA request in flight */
+#define TXSEQ           1234
+
+static ItlIwx *that;
+static struct iwx_node *in;
+static struct ieee80211_channel chan = { 5180 };
+static struct iwx_reorder_buf_entry rss_entries[IEEE80211_BA_MAX_WINSZ];
+
+static void
+env_if_start(struct _ifnet *ifp)
+{
+    if_starts++;
+}
+
+/* Run the timeouts due up to usec from now, and the tasks they queue. */
+static void
+run(u_int64_t usec)
+{
+    struct iwx_softc *sc = &that->com;
+    struct task *tasks[] = { &sc->init_task, &sc->ba_task,
+        &sc->mac_ctxt_task, &sc->chan_ctxt_task };
+    u_int64_t end = env_usec + usec;
+    CTimeout *next;
+
+    for (;;) {
+        for (struct task *t : tasks)
+            if (t->t_queued) {
+                t->t_queued = false;
+                (*t->t_func)(t->t_arg);
+            }
+        next = NULL;
+        for (CTimeout *to : env_timeouts)
+            if (to->isPending && to->to_time <= end &&
+                (next == NULL || to->to_time < next->to_time))
+                next = to;
+        if (next == NULL)
+            break;
+        env_usec = MAX(env_usec, next->to_time);
+        next->isPending = false;
+        (*next->to_func)(next->to_arg);
+    }
+    env_usec = end;
+}
+
+/* Frames keep arriving on the Rx BA sessions for usec. */
+static void
+traffic(u_int64_t usec)
+{
+    struct iwx_softc *sc = &that->com;
+
+    for (u_int64_t t = 0; t < usec; t += 50000) {
+        for (int i = 0; i < nitems(sc->sc_rxba_data); i++)
+            if (sc->sc_rxba_data[i].baid !=
+                IWX_RX_REORDER_DATA_INVALID_BAID)
+                getmicrouptime(&sc->sc_rxba_data[i].last_rx);
+        run(MIN(usec - t, 50000));
+    }
+}
+
+static void
+teardown(void)
+{
+    for (CTimeout *to : env_timeouts)
+        delete to;
+    env_timeouts.clear();
+    delete in;
+    delete that;
+    events.clear();
+    fw = fakefw();
+    stops = inits = if_starts = 0;
+}
+
+/*
+ * Attach, associate and agree on Block Ack like net80211 and the BA task
+ * do, with firmware asserting every fault_sec seconds.
+ */
+static void
+setup(int fault_sec)
+{
+    struct iwx_softc *sc;
+    struct ieee80211com *ic;
+    struct ieee80211_node *ni;
+    struct ieee80211_rx_ba *rxba;
+    struct ieee80211_tx_ba *txba;
+
+    that = new ItlIwx();
+    in = new iwx_node();
+    sc = &that->com;
+    ic = &sc->sc_ic;
+    ni = &in->in_ni;
+
+    sc->sc_num_rx_queues = 2;
+    for (int i = 0; i < nitems(sc->sc_rxba_data); i++) {
+        struct iwx_rxba_data *rxd = &sc->sc_rxba_data[i];
+
+        rxd->baid = IWX_RX_REORDER_DATA_INVALID_BAID;
+        rxd->sc = sc;
+        rxd->rss_entries = rss_entries;
+        timeout_set(&rxd->session_timer, ItlIwx::iwx_rx_ba_session_expired,
+            rxd);
+        for (int qid = 0; qid < sc->sc_num_rx_queues; qid++) {
+            struct iwx_reorder_buffer *buf = &rxd->reorder_buf[qid];
+
+            buf->queue = qid;
+            buf->entries = qid == 0 ? &rxd->entries[0] : &rxd->rss_entries[0];
+            timeout_set(&buf->reorder_timer,
+                ItlIwx::iwx_reorder_timer_expired, buf);
+        }
+    }
+    task_set(&sc->init_task, ItlIwx::iwx_init_task, sc, "iwx_init_task");
+    sc->sc_fw_fault_sec = fault_sec;
+    timeout_set(&sc->sc_fw_fault_to, ItlIwx::iwx_fw_fault_inject, sc);
+    timeout_add_sec(&sc->sc_fw_fault_to, sc->sc_fw_fault_sec);
+
+    that->iwx_init_hw(sc);
+    ic->ic_if.if_flags = IFF_UP | IFF_RUNNING;
+    ic->ic_if.if_start = env_if_start;
+    ic->ic_opmode = IEEE80211_M_STA;
+    ic->ic_state = IEEE80211_S_RUN;
+    ic->ic_bss = &in->in_ni;
+    ni->ni_chan = &chan;
+    in->in_id = 0;
+    in->in_color = 1;
+    that->iwx_phy_ctxt_update(sc, &sc->sc_phyctxt[0], &chan, 1, 1, 0);
+    in->in_phyctxt = &sc->sc_phyctxt[0];
+    that->iwx_mac_ctxt_cmd(sc, in, IWX_FW_CTXT_ACTION_ADD, 0);
+    that->iwx_binding_cmd(sc, in, IWX_FW_CTXT_ACTION_ADD);
+    that->iwx_add_sta_cmd(sc, in, 0);
+    that->iwx_enable_mgmt_queue(sc);
+    that->iwx_run(sc);
+
+    ni->ni_flags = IEEE80211_NODE_TXRXPROT;
+    ni->ni_pairwise_key.k_cipher = IEEE80211_CIPHER_CCMP;
+    ItlIwx::iwx_set_key(ic, ni, &ni->ni_pairwise_key);
+    ic->ic_nw_keys[1].k_id = 1;
+    ic->ic_nw_keys[1].k_cipher = IEEE80211_CIPHER_CCMP;
+    ItlIwx::iwx_set_key(ic, ni, &ic->ic_nw_keys[1]);
+
+    rxba = &ni->ni_rx_ba[AGG_TID];
+    rxba->ba_state = IEEE80211_BA_AGREED;
+    rxba->ba_winstart = 100;
+    rxba->ba_winsize = 64;
+    rxba->ba_timeout_val = AGG_TIMEOUT;
+    that->iwx_sta_rx_agg(sc, ni, AGG_TID, rxba->ba_winstart,
+        rxba->ba_winsize, rxba->ba_timeout_val, 1);
+    rxba = &ni->ni_rx_ba[AGG_TID2];
+    rxba->ba_state = IEEE80211_BA_AGREED;
+    rxba->ba_winstart = 7;
+    rxba->ba_winsize = 32;
+    that->iwx_sta_rx_agg(sc, ni, AGG_TID2, rxba->ba_winstart,
+        rxba->ba_winsize, rxba->ba_timeout_val, 1);
+
+    txba = &ni->ni_tx_ba[AGG_TID];
+    txba->ba_state = IEEE80211_BA_AGREED;
+    txba->ba_winsize = 64;
+    that->iwx_tvqm_alloc_txq(sc, AGG_TID, 0);
+    ni->ni_qos_txseqs[AGG_TID] = TXSEQ;
+
+    sc->ba_rx.start_tidmask = 1 << ADDBA_TID;
+    events.clear();
+}
+
+/* The driver's Rx BA session for tid, NULL if there is none. */
+static struct iwx_rxba_data *
+rx_session(int tid)
+{
+    struct iwx_softc *sc = &that->com;
+
+    for (int i = 0; i < nitems(sc->sc_rxba_data); i++)
+        if (sc->sc_rxba_data[i].baid != IWX_RX_REORDER_DATA_INVALID_BAID &&
+            sc->sc_rxba_data[i].tid == tid)
+            return &sc->sc_rxba_data[i];
+    return NULL;
+}
+
+static int failures;
+
+static void
+check(bool ok, const char *what)
+{
+    printf("%-4s %s\n", ok ? "ok" : "FAIL", what);
+    if (!ok)
+        failures++;
+}
+
+static void
+test_restart(void)
+{
+    struct iwx_softc *sc;
+    struct ieee80211_node *ni;
+    struct iwx_rxba_data *rxd, *rxd2;
+    bool timers;
+
+    setup(30);
+    sc = &that->com;
+    ni = &in->in_ni;
+
+    traffic(30 * 1000000);
+
+    check(fw.loads == 2 && stops == 0 && inits == 0 &&
+        sc->sc_ic.ic_state == IEEE80211_S_RUN &&
+        (sc->sc_flags & IWX_FLAG_FW_RESTART) == 0 &&
+        sc->sc_fw_restarts == 1,
+        "injected assert restarts firmware in place");
+    check(fw.alive && fw.phy_chan == &chan && fw.mac && fw.binding &&
+        fw.sta && fw.mgmtq && fw.assoc &&
+        (sc->sc_flags & (IWX_FLAG_MAC_ACTIVE | IWX_FLAG_BINDING_ACTIVE)) ==
+        (IWX_FLAG_MAC_ACTIVE | IWX_FLAG_BINDING_ACTIVE),
+        "PHY, MAC, binding and station contexts replayed");
+    check(fw.keys == std::set<int>({ -1, 1 }),
+        "pairwise and group CCMP keys replayed");
+    check(fw.rxba[AGG_TID] && fw.rxba_ssn[AGG_TID] == 100 &&
+        fw.rxba_win[AGG_TID] == 64 && fw.rxba[AGG_TID2] &&
+        fw.rxba_ssn[AGG_TID2] == 7 && fw.rxba_win[AGG_TID2] == 32 &&
+        sc->sc_rx_ba_sessions == 2 &&
+        !happened(EV_ADDBA_ACCEPT, AGG_TID) &&
+        !happened(EV_DELBA, AGG_TID) && !happened(EV_DELBA, AGG_TID2),
+        "Rx BA sessions replayed with their window, not renegotiated");
+
+    rxd = rx_session(AGG_TID);
+    rxd2 = rx_session(AGG_TID2);
+    check(rxd != NULL && rxd->timeout == AGG_TIMEOUT &&
+        timeout_pending(rxd->session_timer) &&
+        ni->ni_rx_ba[AGG_TID].ba_timeout_val == 0 &&
+        rxd2 != NULL && rxd2->timeout == 0 &&
+        !timeout_pending(rxd2->session_timer),
+        "Rx BA inactivity timeout kept across the restart");
+    timers = rxd != NULL && rxd2 != NULL;
+    for (int q = 0; timers && q < sc->sc_num_rx_queues; q++)
+        timers = rxd->reorder_buf[q].reorder_timer != NULL &&
+            rxd2->reorder_buf[q].reorder_timer != NULL;
+    check(timers, "reorder timers set up again");
+
+    check(fw.txq[AGG_TID] >= 0 && fw.txq_ssn[AGG_TID] == TXSEQ &&
+        sc->sc_tid_data[AGG_TID].qid == fw.txq[AGG_TID] &&
+        ni->ni_tx_ba[AGG_TID].ba_winstart == TXSEQ &&
+        happened(EV_BAR, AGG_TID, TXSEQ),
+        "Tx BA queue replayed at the sequence number, BAR sent");
+    check(happened(EV_ADDBA_REFUSE, ADDBA_TID) &&
+        sc->ba_rx.start_tidmask == 0,
+        "ADDBA request in flight refused");
+    check(if_starts == 1 && timeout_pending(sc->sc_fw_fault_to),
+        "Tx restarted and the next fault scheduled");
+
+    /* No traffic: the session with a timeout ends, the other one stays. */
+    run(AGG_TIMEOUT + 50000);
+    check(happened(EV_DELBA, AGG_TID, IEEE80211_REASON_TIMEOUT) &&
+        !happened(EV_DELBA, AGG_TID2) &&
+        sc->sc_ic.ic_stats.is_ht_rx_ba_timeout == 1,
+        "idle Rx BA session times out after the restart");
+    teardown();
+}
+
+static void
+test_holdoff(void)
+{
+    struct iwx_softc *sc;
+
+    setup(IWX_FW_RESTART_HOLDOFF / 2);
+    sc = &that->com;
+    run(IWX_FW_RESTART_HOLDOFF / 2 * 1000000);
+    check(fw.loads == 2 && stops == 0, "first assert restarts in place");
+    run(IWX_FW_RESTART_HOLDOFF / 2 * 1000000);
+    check(stops == 1 && inits == 1 && sc->sc_fw_restarts == 1 &&
+        (sc->sc_flags & IWX_FLAG_FW_RESTART) == 0,
+        "second assert within the holdoff resets the interface");
+    teardown();
+}
+
+static void
+test_failed_restart(void)
+{
+    struct iwx_softc *sc;
+
+    setup(30);
+    sc = &that->com;
+    fw.fail_binding = true;
+    run(30 * 1000000);
+    check(fw.loads == 2 && !fw.binding && stops == 1 && inits == 1 &&
+        (sc->sc_flags & IWX_FLAG_FW_RESTART) == 0,
+        "command failing during the restart resets the interface");
+    teardown();
+}
+
+static void
+test_not_associated(void)
+{
+    struct iwx_softc *sc;
+
+    setup(30);
+    sc = &that->com;
+    sc->sc_ic.ic_state = IEEE80211_S_SCAN;
+    run(30 * 1000000);
+    check(fw.alive && fw.loads == 1 && stops == 0 &&
+        timeout_pending(sc->sc_fw_fault_to),
+        "no fault injected outside RUN state");
+    teardown();
+}
+
+int
+main(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "-v") == 0)
+        env_verbose = true;
+
+    test_restart();
+    test_holdoff();
+    test_failed_restart();
+    test_not_associated();
+
+    printf("%d failed\n", failures);
+    return failures != 0;
+}
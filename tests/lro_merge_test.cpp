@@ -0,0 +1,1021 @@
+/*
+ * Tests and benchmark of the Rx coalescing stage if_input() runs over a
+ * batch: lro_input() and the lro_*() helpers of _mbuf.cpp, with the mbuf
+ * list and m_cat() of _mbuf.h, over a mock mbuf KPI whose buffers are
+ * IWX_RBUF_SIZE like the iwx Rx ring's.
+ *
+ * Every packet handed up is checked against the segments put in: only
+ * the head of a chain keeps the packet header, IP lengths and the IPv4
+ * header checksum match the merged packet, and per flow the packets
+ * cover the segments in order, each merge of at most LRO_MAXSEGS
+ * contiguous segments with the same ACK, the latest window and PSH only
+ * at its end, carrying their payloads byte for byte. The tests then pin
+ * the flush rules: sequence holes, PSH, FIN, ACK or option changes,
+ * unverified checksums, pure ACKs, frames that cannot be parsed, other
+ * protocols, more flows than slots, and interfaces without IFXF_LRO.
+ *
+ * The benchmark replays TCP traces in batches of 1 to 64 frames, the
+ * frames one pass over the Rx ring hands to if_input(). The built-in
+ * traces are synthetic downloads; pcap captures with Ethernet framing
+ * (tcpdump -w) can be given on the command line, with every frame
+ * taken as checksum-verified by hardware. It prints the packets handed
+ * to inputPacket() per frame received and the cost per frame of the
+ * stage against handing every frame up as is. The saving is the
+ * inputPacket() and TCP input calls avoided, which only the packet
+ * ratio shows; build with -O2 and without the sanitizers for
+ * meaningful costs.
+ *
+ *   N=../itl80211/openbsd/sys
+ *   (awk -v defines=IFXF_LRO -f extract.awk $N/_if_ether.h &&
+ *    awk -v types=mbuf_list -v defines=mtod \
+ *        -v fns="ml_init ml_enqueue ml_dequeue m_cat" -f extract.awk \
+ *        $N/_mbuf.h) > lro_defs.inc
+ *   awk -v types="lro_hdr lro_flow" -v defines="LRO_MAXFLOWS LRO_MAXSEGS \
+ *       LRO_NOTTCP LRO_UNKNOWN" -v fns="lro_parse lro_eligible \
+ *       lro_same_flow lro_can_merge lro_ip_cksum lro_deliver lro_flush \
+ *       lro_start lro_merge lro_input" -f extract.awk $N/_mbuf.cpp \
+ *       > lro.inc
+ *   c++ -std=c++11 -g -fsanitize=address,undefined -I compat \
+ *       -o lro_merge_test lro_merge_test.cpp
+ *   ./lro_merge_test [capture.pcap ...]
+ */
+
+#include <sys/systm.h>
+#include <arpa/inet.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define IPV6_VERSION        0x60    /* BSD <netinet/ip6.h> */
+#define IPV6_VERSION_MASK   0xf0
+#define DLT_EN10MB          1       /* <pcap/dlt.h> */
+
+/* <sys/kpi_mbuf.h> */
+typedef u_int32_t mbuf_flags_t;
+typedef u_int32_t mbuf_csum_performed_flags_t;
+
+#define MBUF_PKTHDR             0x0002
+#define MBUF_CSUM_DID_IP        0x0100
+#define MBUF_CSUM_IP_GOOD       0x0200
+#define MBUF_CSUM_DID_DATA      0x0400
+#define MBUF_CSUM_PSEUDO_HDR    0x0800
+#define MBUF_CSUM_HW            (MBUF_CSUM_DID_IP | MBUF_CSUM_IP_GOOD | \
+                                 MBUF_CSUM_DID_DATA | MBUF_CSUM_PSEUDO_HDR)
+
+#define MBUF_SIZE   4096        /* IWX_RBUF_SIZE */
+#define ETHER_ALIGN 2
+#define MBUF_LEAD   (64 + ETHER_ALIGN)  /* IP header 4-byte aligned */
+
+struct __mbuf {
+    struct __mbuf *m_next;
+    struct __mbuf *m_nextpkt;
+    u_int8_t *m_data;
+    size_t m_len;
+    size_t m_pktlen;
+    mbuf_flags_t m_flags;
+    mbuf_csum_performed_flags_t m_csum;
+    u_int8_t m_buf[MBUF_SIZE];
+};
+
+static int nmbufs;          /* mbufs allocated and not freed */
+
+static void *
+mbuf_data(mbuf_t m)
+{
+    return m->m_data;
+}
+
+static size_t
+mbuf_len(mbuf_t m)
+{
+    return m->m_len;
+}
+
+static void
+mbuf_setlen(mbuf_t m, size_t len)
+{
+    m->m_len = len;
+}
+
+static size_t
+mbuf_trailingspace(mbuf_t m)
+{
+    return m->m_buf + MBUF_SIZE - (m->m_data + m->m_len);
+}
+
+static mbuf_t
+mbuf_next(mbuf_t m)
+{
+    return m->m_next;
+}
+
+static void
+mbuf_setnext(mbuf_t m, mbuf_t n)
+{
+    m->m_next = n;
+}
+
+static mbuf_t
+mbuf_nextpkt(mbuf_t m)
+{
+    return m->m_nextpkt;
+}
+
+static void
+mbuf_setnextpkt(mbuf_t m, mbuf_t n)
+{
+    m->m_nextpkt = n;
+}
+
+static size_t
+mbuf_pkthdr_len(mbuf_t m)
+{
+    return m->m_pktlen;
+}
+
+static void
+mbuf_pkthdr_setlen(mbuf_t m, size_t len)
+{
+    m->m_pktlen = len;
+}
+
+static mbuf_flags_t
+mbuf_flags(mbuf_t m)
+{
+    return m->m_flags;
+}
+
+static void
+mbuf_setflags_mask(mbuf_t m, mbuf_flags_t flags, mbuf_flags_t mask)
+{
+    m->m_flags = (m->m_flags & ~mask) | (flags & mask);
+}
+
+static void
+mbuf_get_csum_performed(mbuf_t m, mbuf_csum_performed_flags_t *flags,
+    u_int32_t *value)
+{
+    *flags = m->m_csum;
+    *value = m->m_csum & MBUF_CSUM_DID_DATA ? 0xffff : 0;
+}
+
+/* Trim len bytes off the front of the chain, as m_adj() does. */
+static void
+mbuf_adj(mbuf_t m, int len)
+{
+    mbuf_t n;
+    size_t cut;
+
+    if (m->m_flags & MBUF_PKTHDR)
+        m->m_pktlen -= len;
+    for (n = m; n != NULL && len > 0; n = n->m_next) {
+        cut = MIN((size_t)len, n->m_len);
+        n->m_data += cut;
+        n->m_len -= cut;
+        len -= cut;
+    }
+}
+
+static mbuf_t
+mbuf_free(mbuf_t m)
+{
+    mbuf_t n = m->m_next;
+
+    free(m);
+    nmbufs--;
+    return n;
+}
+
+static void
+mbuf_freem(mbuf_t m)
+{
+    while (m != NULL)
+        m = mbuf_free(m);
+}
+
+/* <IOKit/network/IONetworkInterface.h> */
+struct IONetworkStats {
+    u_int32_t inputPackets;
+};
+
+class IONetworkInterface {
+public:
+    enum { kInputOptionQueuePacket = 0x1 };
+    std::vector<mbuf_t> input;
+
+    u_int32_t
+    inputPacket(mbuf_t m, u_int32_t length, u_int32_t options)
+    {
+        input.push_back(m);
+        return 0;
+    }
+};
+
+/* The part of <sys/_if_ether.h> the stage uses. */
+struct _ifnet {
+    IONetworkInterface *iface;
+    IONetworkStats *netStat;
+    int if_xflags;
+    uint32_t if_icoalesced;
+    uint32_t if_icoalpkts;
+};
+
+#include "lro_defs.inc"
+#include "lro.inc"
+
+/* A TCP or UDP flow and the next segment to build for it. */
+struct flow {
+    bool v6;
+    bool udp;
+    u_int16_t sport, dport;
+    u_int32_t seq, ack;
+    u_int16_t win;
+    u_int8_t tos, ttl;
+    u_int32_t tsval;            /* 0: no timestamp option */
+};
+
+/* What went in, per flow, for checking what comes out. */
+struct segment {
+    u_int32_t seq, ack;
+    u_int16_t win;
+    u_int8_t flags;
+    std::vector<u_int8_t> payload;
+};
+
+struct run {
+    struct _ifnet ifp;
+    IONetworkInterface iface;
+    IONetworkStats stats;
+    struct mbuf_list ml;
+    std::map<std::string, std::deque<struct segment>> sent;
+    size_t frames, packets, bad;
+    const char *why;            /* first mismatch */
+};
+
+static int failures;
+
+static void
+check(const char *what, bool ok)
+{
+    printf("%-4s %s\n", ok ? "ok" : "FAIL", what);
+    if (!ok)
+        failures++;
+}
+
+static void
+put(std::vector<u_int8_t> &v, const void *p, size_t len)
+{
+    v.insert(v.end(), (const u_int8_t *)p, (const u_int8_t *)p + len);
+}
+
+static void
+run_init(struct run &r, bool lro)
+{
+    memset(&r.ifp, 0, sizeof(r.ifp));
+    r.ifp.iface = &r.iface;
+    r.ifp.netStat = &r.stats;
+    r.ifp.if_xflags = lro ? IFXF_LRO : 0;
+    r.iface.input.clear();
+    r.stats.inputPackets = 0;
+    ml_init(&r.ml);
+    r.sent.clear();
+    r.frames = r.packets = r.bad = 0;
+    r.why = NULL;
+}
+
+static void
+mismatch(struct run &r, const char *why)
+{
+    if (r.why == NULL)
+        r.why = why;
+    r.bad++;
+}
+
+/*
+ * Headers of an Ethernet frame: the flow key, the TCP header and the
+ * payload offset. Returns false for frames that are not TCP over IPv4
+ * without options or IPv6 without extension headers.
+ */
+static bool
+frame_tcp(const u_int8_t *p, size_t len, std::string &key,
+    struct tcphdr *th, size_t *hlen)
+{
+    struct ether_header eh;
+    struct ip ip;
+    struct ip6_hdr ip6;
+    size_t off = ETHER_HDR_LEN;
+
+    if (len < off)
+        return false;
+    memcpy(&eh, p, sizeof(eh));
+    if (ntohs(eh.ether_type) == ETHERTYPE_IP) {
+        if (len < off + sizeof(ip))
+            return false;
+        memcpy(&ip, p + off, sizeof(ip));
+        if (ip.ip_p != IPPROTO_TCP || ip.ip_hl != 5)
+            return false;
+        key.assign((const char *)&ip.ip_src, 8);
+        off += sizeof(ip);
+    } else if (ntohs(eh.ether_type) == ETHERTYPE_IPV6) {
+        if (len < off + sizeof(ip6))
+            return false;
+        memcpy(&ip6, p + off, sizeof(ip6));
+        if (ip6.ip6_nxt != IPPROTO_TCP)
+            return false;
+        key.assign((const char *)&ip6.ip6_src, 32);
+        off += sizeof(ip6);
+    } else
+        return false;
+    if (len < off + sizeof(*th))
+        return false;
+    memcpy(th, p + off, sizeof(*th));
+    if (len < off + th->th_off * 4)
+        return false;
+    key.append((const char *)&th->th_sport, 4);
+    *hlen = off + th->th_off * 4;
+    return true;
+}
+
+/* Queue an Ethernet frame as the Rx path would, checksums verified or not. */
+static void
+input(struct run &r, const u_int8_t *p, size_t len, bool hwcsum)
+{
+    struct segment s;
+    struct tcphdr th;
+    std::string key;
+    size_t hlen;
+    mbuf_t m;
+
+    m = (mbuf_t)malloc(sizeof(*m));
+    m->m_next = m->m_nextpkt = NULL;
+    m->m_data = m->m_buf + MBUF_LEAD;
+    memcpy(m->m_data, p, len);
+    m->m_len = m->m_pktlen = len;
+    m->m_flags = MBUF_PKTHDR;
+    m->m_csum = hwcsum ? MBUF_CSUM_HW : 0;
+    nmbufs++;
+    ml_enqueue(&r.ml, m);
+    r.frames++;
+
+    memset(&th, 0, sizeof(th));
+    if (!frame_tcp(p, len, key, &th, &hlen))
+        key = "";
+    s.seq = ntohl(th.th_seq);
+    s.ack = th.th_ack;
+    s.win = th.th_win;
+    s.flags = th.th_flags;
+    s.payload.assign(p + (key.empty() ? 0 : hlen), p + len);
+    r.sent[key].push_back(s);
+}
+
+/* The next frame of flow f, with len bytes of payload. */
+static std::vector<u_int8_t>
+frame(struct flow &f, size_t len, u_int8_t flags)
+{
+    std::vector<u_int8_t> d;
+    struct ether_header eh;
+    struct ip ip;
+    struct ip6_hdr ip6;
+    struct tcphdr th;
+    struct udphdr uh;
+    u_int8_t opts[12] = { TCPOPT_NOP, TCPOPT_NOP, TCPOPT_TIMESTAMP,
+        TCPOLEN_TIMESTAMP };
+    size_t l4len, i;
+    u_int32_t v;
+    u_int16_t *w;
+    u_int32_t sum;
+
+    memset(&th, 0, sizeof(th));
+    th.th_sport = htons(f.sport);
+    th.th_dport = htons(f.dport);
+    th.th_seq = htonl(f.seq);
+    th.th_ack = htonl(f.ack);
+    th.th_off = (sizeof(th) + (f.tsval ? sizeof(opts) : 0)) >> 2;
+    th.th_flags = flags;
+    th.th_win = htons(f.win);
+    l4len = f.udp ? sizeof(uh) + len : th.th_off * 4 + len;
+
+    memset(&eh, 0, sizeof(eh));
+    eh.ether_type = htons(f.v6 ? ETHERTYPE_IPV6 : ETHERTYPE_IP);
+    put(d, &eh, sizeof(eh));
+    if (!f.v6) {
+        memset(&ip, 0, sizeof(ip));
+        ip.ip_v = IPVERSION;
+        ip.ip_hl = sizeof(ip) >> 2;
+        ip.ip_tos = f.tos;
+        ip.ip_len = htons(sizeof(ip) + l4len);
+        ip.ip_off = htons(IP_DF);
+        ip.ip_ttl = f.ttl;
+        ip.ip_p = f.udp ? IPPROTO_UDP : IPPROTO_TCP;
+        ip.ip_src.s_addr = htonl(0xc0a80001);
+        ip.ip_dst.s_addr = htonl(0xc0a80164);
+        w = (u_int16_t *)&ip;
+        for (i = 0, sum = 0; i < sizeof(ip) / 2; i++)
+            sum += w[i];
+        sum = (sum >> 16) + (sum & 0xffff);
+        ip.ip_sum = ~(sum + (sum >> 16));
+        put(d, &ip, sizeof(ip));
+    } else {
+        memset(&ip6, 0, sizeof(ip6));
+        ip6.ip6_flow = htonl(f.tos << 20);
+        ip6.ip6_vfc = IPV6_VERSION;
+        ip6.ip6_plen = htons(l4len);
+        ip6.ip6_nxt = f.udp ? IPPROTO_UDP : IPPROTO_TCP;
+        ip6.ip6_hlim = f.ttl;
+        ip6.ip6_src.s6_addr[0] = ip6.ip6_dst.s6_addr[0] = 0xfd;
+        ip6.ip6_src.s6_addr[15] = 1;
+        ip6.ip6_dst.s6_addr[15] = 0x64;
+        put(d, &ip6, sizeof(ip6));
+    }
+    if (f.udp) {
+        memset(&uh, 0, sizeof(uh));
+        uh.uh_sport = htons(f.sport);
+        uh.uh_dport = htons(f.dport);
+        uh.uh_ulen = htons(l4len);
+        put(d, &uh, sizeof(uh));
+    } else {
+        put(d, &th, sizeof(th));
+        if (f.tsval) {
+            v = htonl(f.tsval);
+            memcpy(&opts[4], &v, 4);
+            v = htonl(0x1000);
+            memcpy(&opts[8], &v, 4);
+            put(d, opts, sizeof(opts));
+        }
+    }
+    for (i = 0; i < len; i++)
+        d.push_back((f.seq + i) * 7 + f.sport);
+    if (!f.udp)
+        f.seq += len + (flags & (TH_SYN | TH_FIN) ? 1 : 0);
+    return d;
+}
+
+static void
+build(struct run &r, struct flow &f, size_t len, u_int8_t flags,
+    bool hwcsum = true)
+{
+    std::vector<u_int8_t> d = frame(f, len, flags);
+
+    input(r, d.data(), d.size(), hwcsum);
+}
+
+static bool
+ip_cksum_ok(const u_int8_t *p)
+{
+    u_int16_t w[10];
+    u_int32_t sum = 0;
+    int i;
+
+    memcpy(w, p, sizeof(w));
+    for (i = 0; i < 10; i++)
+        sum += w[i];
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum += sum >> 16;
+    return (sum & 0xffff) == 0xffff;
+}
+
+/* Check one packet handed to inputPacket() against the segments sent. */
+static void
+verify(struct run &r, mbuf_t m)
+{
+    std::vector<u_int8_t> d;
+    std::deque<struct segment> *q;
+    struct ip ip;
+    struct ip6_hdr ip6;
+    struct tcphdr th;
+    std::string key;
+    size_t hlen, used, nsegs, iplen;
+    u_int32_t seq;
+    u_int8_t flags = 0;
+    u_int16_t win = 0;
+    mbuf_t n;
+
+    r.packets++;
+    if (!(m->m_flags & MBUF_PKTHDR)) {
+        mismatch(r, "head without packet header");
+        return;
+    }
+    for (n = m; n != NULL; n = n->m_next) {
+        if (n != m && (n->m_flags & MBUF_PKTHDR))
+            mismatch(r, "packet header past the head");
+        put(d, n->m_data, n->m_len);
+    }
+    if (d.size() != m->m_pktlen) {
+        mismatch(r, "packet length differs from the chain");
+        return;
+    }
+    if (!frame_tcp(d.data(), d.size(), key, &th, &hlen))
+        key = "";
+    q = &r.sent[key];
+    if (q->empty()) {
+        mismatch(r, "more packets than sent");
+        return;
+    }
+    if (key.empty()) {
+        if (q->front().payload != d)
+            mismatch(r, "other frame changed or reordered");
+        q->pop_front();
+        return;
+    }
+
+    if (ntohs(((struct ether_header *)d.data())->ether_type) ==
+        ETHERTYPE_IP) {
+        memcpy(&ip, &d[ETHER_HDR_LEN], sizeof(ip));
+        iplen = ntohs(ip.ip_len);
+        if (!ip_cksum_ok(&d[ETHER_HDR_LEN]))
+            mismatch(r, "bad IPv4 header checksum");
+        if (iplen != d.size() - ETHER_HDR_LEN)
+            mismatch(r, "IPv4 length differs from the packet");
+    } else {
+        memcpy(&ip6, &d[ETHER_HDR_LEN], sizeof(ip6));
+        iplen = ntohs(ip6.ip6_plen);
+        if (iplen != d.size() - ETHER_HDR_LEN - sizeof(struct ip6_hdr))
+            mismatch(r, "IPv6 payload length differs from the packet");
+    }
+
+    /* Consume the segments this packet covers, in order. */
+    seq = ntohl(th.th_seq);
+    for (used = 0, nsegs = 0; used < d.size() - hlen || nsegs == 0;
+        nsegs++) {
+        if (q->empty()) {
+            mismatch(r, "payload beyond the segments sent");
+            return;
+        }
+        const struct segment &s = q->front();
+        if (s.seq != seq + used)
+            mismatch(r, "segments out of order or not contiguous");
+        if (s.ack != th.th_ack)
+            mismatch(r, "segments with different ACKs merged");
+        if (flags & TH_PUSH)
+            mismatch(r, "merged past PSH");
+        if (used + s.payload.size() > d.size() - hlen ||
+            (!s.payload.empty() &&
+            memcmp(&d[hlen + used], s.payload.data(), s.payload.size())))
+            mismatch(r, "payload differs");
+        used += s.payload.size();
+        flags |= s.flags;
+        win = s.win;
+        q->pop_front();
+    }
+    if (nsegs > LRO_MAXSEGS)
+        mismatch(r, "more than LRO_MAXSEGS merged");
+    if (th.th_win != win)
+        mismatch(r, "window is not the latest");
+    if (th.th_flags != flags)
+        mismatch(r, "flags are not those of the segments");
+}
+
+/* Run the stage over the queued batch and check what it handed up. */
+static void
+deliver(struct run &r)
+{
+    size_t i;
+
+    lro_input(&r.ifp, &r.ml);
+    for (i = 0; i < r.iface.input.size(); i++) {
+        verify(r, r.iface.input[i]);
+        mbuf_freem(r.iface.input[i]);
+    }
+    for (auto &q : r.sent)
+        if (!q.second.empty())
+            mismatch(r, "segments not handed up");
+    r.sent.clear();
+}
+
+static struct flow
+tcp_flow(u_int16_t sport, bool v6 = false)
+{
+    struct flow f;
+
+    memset(&f, 0, sizeof(f));
+    f.v6 = v6;
+    f.sport = sport;
+    f.dport = 50000;
+    f.seq = 1000000;
+    f.ack = 7000;
+    f.win = 512;
+    f.ttl = 64;
+    f.tsval = 100;
+    return f;
+}
+
+#define MSS 1448
+
+/* A check that also fails on anything verify() found. */
+static void
+check_run(const char *what, struct run &r, bool ok)
+{
+    std::string msg(what);
+
+    if (r.why != NULL)
+        msg = msg + ": " + r.why;
+    check(msg.c_str(), ok && r.bad == 0 && nmbufs == 0);
+}
+
+/* Run a batch; returns the packets handed up. */
+static size_t
+batch(struct run &r)
+{
+    deliver(r);
+    return r.iface.input.size();
+}
+
+static void
+test_merge(void)
+{
+    struct run r;
+    struct flow f, g;
+    mbuf_t m;
+    int i;
+
+    run_init(r, true);
+    f = tcp_flow(443);
+    build(r, f, MSS, TH_ACK);
+    build(r, f, MSS, TH_ACK);
+    lro_input(&r.ifp, &r.ml);
+    m = r.iface.input.empty() ? NULL : r.iface.input[0];
+    check("two segments: one packet of both payloads",
+        r.iface.input.size() == 1 && m->m_pktlen ==
+        ETHER_HDR_LEN + 20 + 32 + 2 * MSS);
+    check("two segments: counted", r.ifp.if_icoalesced == 1 &&
+        r.ifp.if_icoalpkts == 1 && r.stats.inputPackets == 1);
+    for (i = 0; i < (int)r.iface.input.size(); i++) {
+        verify(r, r.iface.input[i]);
+        mbuf_freem(r.iface.input[i]);
+    }
+    check_run("two segments: headers and payload", r, true);
+
+    /* Segments that do not fit the head's buffer are chained. */
+    run_init(r, true);
+    f = tcp_flow(443);
+    build(r, f, 3000, TH_ACK);
+    build(r, f, 3000, TH_ACK);
+    check_run("chained: only the head keeps the packet header", r,
+        batch(r) == 1);
+
+    run_init(r, true);
+    f = tcp_flow(443);
+    for (i = 0; i < 5; i++)
+        build(r, f, MSS, TH_ACK);
+    check_run("five segments: three packets of at most two", r,
+        batch(r) == 3 && r.ifp.if_icoalesced == 2);
+
+    run_init(r, true);
+    f = tcp_flow(443, true);
+    f.tos = 0x28;
+    for (i = 0; i < 4; i++)
+        build(r, f, MSS, TH_ACK);
+    check_run("IPv6: merged with the payload length fixed up", r,
+        batch(r) == 2);
+
+    run_init(r, true);
+    f = tcp_flow(443);
+    build(r, f, MSS, TH_ACK);
+    f.win = 1024;
+    build(r, f, MSS, TH_ACK);
+    check_run("window update: merged, latest window kept", r,
+        batch(r) == 1);
+
+    run_init(r, true);
+    f = tcp_flow(443);
+    g = tcp_flow(8443);
+    for (i = 0; i < 4; i++) {
+        build(r, f, MSS, TH_ACK);
+        build(r, g, MSS, TH_ACK);
+    }
+    check_run("two interleaved flows: each merged", r,
+        batch(r) == 4);
+}
+
+static void
+test_flush(void)
+{
+    struct run r;
+    struct flow f, g, u;
+    std::vector<struct flow> flows;
+    std::vector<u_int8_t> d;
+    bool ok;
+    int i;
+
+    run_init(r, true);
+    f = tcp_flow(443);
+    build(r, f, MSS, TH_ACK);
+    f.seq += MSS;
+    build(r, f, MSS, TH_ACK);
+    check_run("hole: not merged", r, batch(r) == 2);
+
+    run_init(r, true);
+    f = tcp_flow(443);
+    build(r, f, MSS, TH_ACK);
+    build(r, f, 200, TH_ACK | TH_PUSH);
+    build(r, f, MSS, TH_ACK);
+    build(r, f, MSS, TH_ACK);
+    check_run("PSH: merged, then the flow starts over", r,
+        batch(r) == 2);
+
+    run_init(r, true);
+    f = tcp_flow(443);
+    build(r, f, MSS, TH_ACK);
+    build(r, f, 0, TH_ACK | TH_FIN);
+    check_run("FIN: data handed up before it", r, batch(r) == 2);
+
+    run_init(r, true);
+    f = tcp_flow(443);
+    build(r, f, MSS, TH_ACK);
+    build(r, f, 0, TH_ACK);
+    build(r, f, MSS, TH_ACK);
+    check_run("pure ACK: not merged, nothing reordered", r,
+        batch(r) == 3);
+
+    run_init(r, true);
+    f = tcp_flow(443);
+    build(r, f, MSS, TH_ACK);
+    f.ack += 100;
+    build(r, f, MSS, TH_ACK);
+    f.tsval++;
+    build(r, f, MSS, TH_ACK);
+    check_run("ACK and timestamp changes: not merged", r,
+        batch(r) == 3);
+
+    run_init(r, true);
+    f = tcp_flow(443);
+    build(r, f, MSS, TH_ACK);
+    build(r, f, MSS, TH_ACK, false);
+    build(r, f, MSS, TH_ACK);
+    check_run("checksum not verified: not merged", r,
+        batch(r) == 3);
+
+    run_init(r, true);
+    f = tcp_flow(443);
+    u = tcp_flow(53);
+    u.udp = true;
+    build(r, f, MSS, TH_ACK);
+    build(r, u, 100, 0);
+    build(r, f, MSS, TH_ACK);
+    check_run("UDP in between: passed up, flow still merged", r,
+        batch(r) == 2 && r.ifp.if_icoalesced == 1);
+
+    /* IPv4 options: cannot be parsed, so everything open goes first. */
+    run_init(r, true);
+    f = tcp_flow(443);
+    g = tcp_flow(8443);
+    build(r, f, MSS, TH_ACK);
+    d = frame(g, MSS, TH_ACK);
+    d[ETHER_HDR_LEN] = 0x46;
+    input(r, d.data(), d.size(), true);
+    lro_input(&r.ifp, &r.ml);
+    ok = r.iface.input.size() == 2 &&
+        r.iface.input[0]->m_data[ETHER_HDR_LEN] == 0x45 &&
+        r.iface.input[1]->m_data[ETHER_HDR_LEN] == 0x46;
+    for (i = 0; i < (int)r.iface.input.size(); i++) {
+        verify(r, r.iface.input[i]);
+        mbuf_freem(r.iface.input[i]);
+    }
+    check_run("unparsable frame: open flows handed up before it", r, ok);
+
+    run_init(r, true);
+    for (i = 0; i < LRO_MAXFLOWS + 3; i++)
+        flows.push_back(tcp_flow(1000 + i));
+    for (i = 0; i < 3 * (LRO_MAXFLOWS + 3); i++)
+        build(r, flows[i % flows.size()], MSS, TH_ACK);
+    check_run("more flows than slots: all handed up in order", r,
+        batch(r) > 0);
+
+    run_init(r, false);
+    f = tcp_flow(443);
+    for (i = 0; i < 4; i++)
+        build(r, f, MSS, TH_ACK);
+    check_run("no IFXF_LRO: every frame handed up as is", r,
+        batch(r) == 4 && r.ifp.if_icoalesced == 0);
+}
+
+/* Ethernet frames of a trace. */
+struct trace {
+    std::string name;
+    std::vector<std::vector<u_int8_t>> frames;
+};
+
+static u_int32_t rng = 1;
+
+static u_int32_t
+rand32(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+/*
+ * Synthetic downloads: a bulk flow whose sender timestamp ticks every
+ * millisecond (about 80 segments at 1 Gbps), the same over IPv6 with
+ * PSH at the end of every 64 KB, four flows arriving in A-MPDU bursts
+ * of 1 to 32 frames, and a bulk flow that loses 1% of its segments and
+ * gets them retransmitted a few frames later.
+ */
+static void
+builtin(std::vector<struct trace> &traces, size_t nframes)
+{
+    struct trace t;
+    struct flow f;
+    std::vector<struct flow> flows;
+    std::deque<u_int32_t> lost;
+    u_int32_t seq;
+    size_t i, j, n;
+
+    t.name = "bulk";
+    f = tcp_flow(443);
+    for (i = 0; i < nframes; i++) {
+        t.frames.push_back(frame(f, MSS, TH_ACK));
+        if (i % 80 == 79)
+            f.tsval++;
+    }
+    traces.push_back(t);
+
+    t = trace();
+    t.name = "bulk-v6-psh";
+    f = tcp_flow(443, true);
+    for (i = 0; i < nframes; i++) {
+        t.frames.push_back(frame(f, MSS,
+            TH_ACK | (i % 45 == 44 ? TH_PUSH : 0)));
+        if (i % 80 == 79)
+            f.tsval++;
+    }
+    traces.push_back(t);
+
+    t = trace();
+    t.name = "4-flows";
+    for (i = 0; i < 4; i++)
+        flows.push_back(tcp_flow(443 + i));
+    for (i = 0; i < nframes; i += n) {
+        struct flow &g = flows[rand32() % flows.size()];
+        n = 1 + rand32() % 32;
+        for (j = 0; j < n; j++)
+            t.frames.push_back(frame(g, MSS, TH_ACK));
+        g.tsval++;
+    }
+    traces.push_back(t);
+
+    t = trace();
+    t.name = "lossy";
+    f = tcp_flow(443);
+    for (i = 0; i < nframes; i++) {
+        if (!lost.empty() && i % 7 == 0) {
+            seq = f.seq;
+            f.seq = lost.front();
+            lost.pop_front();
+            t.frames.push_back(frame(f, MSS, TH_ACK));
+            f.seq = seq;
+        } else if (rand32() % 100 == 0) {
+            lost.push_back(f.seq);
+            f.seq += MSS;
+            continue;
+        } else
+            t.frames.push_back(frame(f, MSS, TH_ACK));
+        if (i % 80 == 79)
+            f.tsval++;
+    }
+    traces.push_back(t);
+}
+
+/* Ethernet frames of a pcap capture. */
+static bool
+read_pcap(const char *path, struct trace &t)
+{
+    u_int8_t gh[24], rh[16];
+    u_int32_t magic, linktype, caplen;
+    std::vector<u_int8_t> d;
+    bool swap;
+    FILE *fp;
+
+    if ((fp = fopen(path, "rb")) == NULL) {
+        perror(path);
+        return false;
+    }
+    if (fread(gh, sizeof(gh), 1, fp) != 1)
+        goto bad;
+    memcpy(&magic, gh, 4);
+    swap = magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1;
+    if (!swap && magic != 0xa1b2c3d4 && magic != 0xa1b23c4d)
+        goto bad;
+    memcpy(&linktype, gh + 20, 4);
+    if ((swap ? __builtin_bswap32(linktype) : linktype) != DLT_EN10MB) {
+        fprintf(stderr, "%s: not Ethernet\n", path);
+        fclose(fp);
+        return false;
+    }
+    while (fread(rh, sizeof(rh), 1, fp) == 1) {
+        memcpy(&caplen, rh + 8, 4);
+        if (swap)
+            caplen = __builtin_bswap32(caplen);
+        if (caplen > MBUF_SIZE - MBUF_LEAD)
+            goto bad;
+        d.resize(caplen);
+        if (caplen > 0 && fread(d.data(), caplen, 1, fp) != 1)
+            goto bad;
+        t.frames.push_back(d);
+    }
+    fclose(fp);
+    t.name = path;
+    return true;
+bad:
+    fprintf(stderr, "%s: not a pcap capture of at most %d-byte frames\n",
+        path, MBUF_SIZE - MBUF_LEAD);
+    fclose(fp);
+    return false;
+}
+
+/* Replay a trace in batches; returns ns per frame spent in lro_input(). */
+static double
+replay(const struct trace &t, size_t batch, bool lro, struct run &r)
+{
+    std::chrono::steady_clock::duration spent(0);
+    size_t i, j, k;
+
+    run_init(r, lro);
+    for (i = 0; i < t.frames.size(); i += batch) {
+        for (j = i; j < t.frames.size() && j < i + batch; j++)
+            input(r, t.frames[j].data(), t.frames[j].size(), true);
+        r.iface.input.clear();
+        auto start = std::chrono::steady_clock::now();
+        lro_input(&r.ifp, &r.ml);
+        spent += std::chrono::steady_clock::now() - start;
+        for (k = 0; k < r.iface.input.size(); k++) {
+            verify(r, r.iface.input[k]);
+            mbuf_freem(r.iface.input[k]);
+        }
+        for (auto &q : r.sent)
+            if (!q.second.empty())
+                mismatch(r, "segments not handed up");
+        r.sent.clear();
+    }
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        spent).count() / r.frames;
+}
+
+static void
+bench(const std::vector<struct trace> &traces)
+{
+    static const size_t batches[] = { 1, 4, 16, 64 };
+    struct run r;
+    std::vector<std::string> why(traces.size());
+    std::string what;
+    double off, on;
+    size_t i, j;
+
+    printf("%-14s %5s %8s %10s %9s %9s\n", "trace", "batch", "frames",
+        "pkts/frame", "ns/frame", "no LRO");
+    for (i = 0; i < traces.size(); i++) {
+        for (j = 0; j < nitems(batches); j++) {
+            off = replay(traces[i], batches[j], false, r);
+            on = replay(traces[i], batches[j], true, r);
+            printf("%-14s %5zu %8zu %10.3f %9.1f %9.1f\n",
+                traces[i].name.c_str(), batches[j], r.frames,
+                (double)r.packets / r.frames, on, off);
+            if (r.why != NULL && why[i].empty())
+                why[i] = std::string(": batch ") +
+                    std::to_string(batches[j]) + ": " + r.why;
+            else if (nmbufs != 0 && why[i].empty())
+                why[i] = ": mbufs leaked";
+        }
+    }
+    for (i = 0; i < traces.size(); i++) {
+        what = traces[i].name + ": every segment handed up once, in order" +
+            why[i];
+        check(what.c_str(), why[i].empty());
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    std::vector<struct trace> traces;
+    struct trace t;
+    int i;
+
+    test_merge();
+    test_flush();
+
+    builtin(traces, 20000);
+    for (i = 1; i < argc; i++) {
+        t = trace();
+        if (!read_pcap(argv[i], t))
+            return 2;
+        traces.push_back(t);
+    }
+    bench(traces);
+
+    printf("%d failed\n", failures);
+    return failures != 0;
+}
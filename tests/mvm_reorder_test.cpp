@@ -0,0 +1,790 @@
+/*
+ * Tests of the MVM RX re-ordering of include/HAL/ItlMvmReorder.hpp, run
+ * against a mock traits class with the iwx descriptor layout. Frames go
+ * through rx_reorder() like iwx_rx_mpdu_mq() hands them over, and what
+ * rx_frame() releases is checked for order and completeness: in-order
+ * frames, a hole filled late, an NSSN jump past the window, a Block Ack
+ * Request, A-MSDU subframes, the old SN workaround which tears the
+ * session down, and the reorder timer.
+ *
+ * The benchmark then feeds a stream of 64-frame A-MPDUs with 2% of the
+ * MPDUs lost and retransmitted in the next one, and a few never, and
+ * reports MPDUs per second through the reorder buffer; build it with -O2
+ * and without the sanitizers for meaningful numbers.
+ *
+ *   (awk -v types=ieee80211_rxinfo -v defines="IEEE80211_RXI_HWDEC \
+ *        IEEE80211_RXI_AMPDU_DONE IEEE80211_RXI_HWDEC_SAME_PN \
+ *        IEEE80211_RXI_SAME_SEQ IEEE80211_BA_MAX_WINSZ" \
+ *        -f extract.awk ../itl80211/openbsd/net80211/ieee80211_node.h &&
+ *    awk -v defines="IWX_RX_MPDU_MFLG2_AMSDU \
+ *        IWX_RX_MPDU_AMSDU_SUBFRAME_IDX_MASK \
+ *        IWX_RX_MPDU_AMSDU_LAST_SUBFRAME IWX_RX_REORDER_DATA_INVALID_BAID \
+ *        IWX_RX_MPDU_REORDER_NSSN_MASK IWX_RX_MPDU_REORDER_SN_MASK \
+ *        IWX_RX_MPDU_REORDER_SN_SHIFT IWX_RX_MPDU_REORDER_BAID_MASK \
+ *        IWX_RX_MPDU_REORDER_BAID_SHIFT IWX_RX_MPDU_REORDER_BA_OLD_SN" \
+ *        -f extract.awk ../itlwm/hal_iwx/if_iwxreg.h) > mvm_reorder_defs.inc
+ *   c++ -std=c++11 -g -fsanitize=address,undefined -I compat -I ../include \
+ *       -idirafter ../itl80211/openbsd -o mvm_reorder_test \
+ *       mvm_reorder_test.cpp
+ *   ./mvm_reorder_test [mpdus]
+ */
+
+#include <sys/systm.h>
+#include <sys/time.h>
+
+#define letoh16(x)  le16toh(x)
+
+/* For the frame helpers ieee80211.h keeps to the kernel. */
+#define _KERNEL
+#include <net80211/ieee80211.h>
+#undef _KERNEL
+
+#include <chrono>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <vector>
+
+/*
+ * ItlMvmReorder.hpp includes net80211/ieee80211_var.h for the kernel
+ * environment; what it uses of that is provided here instead.
+ */
+#define _NET80211_IEEE80211_VAR_H_
+
+#include "mvm_reorder_defs.inc"
+
+struct __mbuf {
+    struct __mbuf *m_nextpkt;
+    u_int8_t m_data[64];
+};
+
+#define mtod(m, t)      ((t)(m)->m_data)
+
+struct mbuf_list {
+    mbuf_t ml_head;
+    mbuf_t ml_tail;
+    u_int ml_len;
+};
+
+#define MBUF_LIST_INITIALIZER() { NULL, NULL, 0 }
+
+static void
+ml_enqueue(struct mbuf_list *ml, mbuf_t m)
+{
+    m->m_nextpkt = NULL;
+    if (ml->ml_tail == NULL)
+        ml->ml_head = m;
+    else
+        ml->ml_tail->m_nextpkt = m;
+    ml->ml_tail = m;
+    ml->ml_len++;
+}
+
+static mbuf_t
+ml_dequeue(struct mbuf_list *ml)
+{
+    mbuf_t m = ml->ml_head;
+
+    if (m != NULL) {
+        if ((ml->ml_head = m->m_nextpkt) == NULL)
+            ml->ml_tail = NULL;
+        m->m_nextpkt = NULL;
+        ml->ml_len--;
+    }
+    return m;
+}
+
+#define ml_empty(ml)    ((ml)->ml_len == 0)
+
+static int ndropped;
+
+static void
+mbuf_freem(mbuf_t m)
+{
+    ndropped++;
+    free(m);
+}
+
+/* Simulated uptime in usec, and the one timer callout. */
+static u_int64_t now;
+
+static void
+getmicrouptime(struct timeval *tv)
+{
+    tv->tv_sec = now / 1000000;
+    tv->tv_usec = now % 1000000;
+}
+
+#define USEC_TO_TIMEVAL(us, tv) \
+    do { (tv)->tv_sec = (us) / 1000000; (tv)->tv_usec = (us) % 1000000; } \
+    while (0)
+
+struct mock_timeout {
+    bool pending;
+    u_int64_t when;
+};
+
+static void
+timeout_add_usec(struct mock_timeout *t, u_int64_t usec)
+{
+    t->pending = true;
+    t->when = now + usec;
+}
+
+static void
+timeout_del(struct mock_timeout *t)
+{
+    t->pending = false;
+}
+
+static int
+splnet(void)
+{
+    return 0;
+}
+
+static void
+splx(int)
+{
+}
+
+static void
+XYLog(const char *, ...)
+{
+}
+
+struct _ifnet {
+    char if_xname[16];
+};
+
+struct ieee80211_node {
+    int ni_refcnt;
+};
+
+struct ieee80211_stats {
+    u_int32_t is_ht_rx_frame_above_ba_winend;
+    u_int32_t is_ht_rx_frame_below_ba_winstart;
+    u_int32_t is_ht_rx_ba_window_jump;
+    u_int32_t is_ht_rx_ba_no_buf;
+    u_int32_t is_ht_rx_ba_window_gap_timeout;
+};
+
+struct ieee80211com {
+    struct _ifnet ic_if;
+    struct ieee80211_node *ic_bss;
+    struct ieee80211_stats ic_stats;
+};
+
+static struct ieee80211_node *
+ieee80211_find_rxnode(struct ieee80211com *ic, const struct ieee80211_frame *)
+{
+    ic->ic_bss->ni_refcnt++;
+    return ic->ic_bss;
+}
+
+static void
+ieee80211_release_node(struct ieee80211com *, struct ieee80211_node *ni)
+{
+    ni->ni_refcnt--;
+}
+
+static int ndelba;
+
+static int
+ieee80211_delba_request(struct ieee80211com *, struct ieee80211_node *,
+    u_int16_t, u_int8_t, u_int8_t)
+{
+    ndelba++;
+    return 0;
+}
+
+/* Sequence numbers handed up, in order. */
+static std::vector<u_int16_t> up;
+
+static u_int16_t
+frame_sn(mbuf_t m)
+{
+    return letoh16(*(u_int16_t *)mtod(m, struct ieee80211_frame *)->i_seq) >>
+        IEEE80211_SEQ_SEQ_SHIFT;
+}
+
+static void
+deliver(struct mbuf_list *ml)
+{
+    mbuf_t m;
+
+    while ((m = ml_dequeue(ml)) != NULL) {
+        up.push_back(frame_sn(m));
+        free(m);
+    }
+}
+
+static void
+if_input(struct _ifnet *, struct mbuf_list *ml)
+{
+    deliver(ml);
+}
+
+#define MOCK_QUEUES     2
+#define MOCK_BAID       4
+
+struct mock_softc;
+
+struct mock_desc {
+    u_int8_t mac_flags2;
+    u_int8_t amsdu_info;
+    u_int32_t reorder_data;
+};
+
+struct mock_entry {
+    struct mbuf_list frames;
+    struct timeval reorder_time;
+    u_int32_t rx_pkt_status;
+    int chanidx;
+    int is_shortpre;
+    u_int32_t rate_n_flags;
+    u_int32_t device_timestamp;
+    struct ieee80211_rxinfo rxi;
+};
+
+struct mock_buffer {
+    u_int16_t head_sn;
+    u_int16_t num_stored;
+    u_int16_t buf_size;
+    u_int8_t queue;
+    u_int16_t last_amsdu;
+    u_int8_t last_sub_index;
+    struct mock_timeout reorder_timer;
+    int removed;
+    int valid;
+    unsigned int consec_oldsn_drops;
+    u_int32_t consec_oldsn_ampdu_gp2;
+    unsigned int consec_oldsn_prev_drop;
+    struct mock_entry *entries;
+};
+
+struct mock_rxba {
+    u_int8_t sta_id;
+    u_int8_t tid;
+    u_int16_t timeout;
+    struct timeval last_rx;
+    struct mock_softc *sc;
+    struct mock_buffer reorder_buf[MOCK_QUEUES];
+    struct mock_entry entries[MOCK_QUEUES][IEEE80211_BA_MAX_WINSZ];
+};
+
+struct mock_dup {
+    u_int16_t last_seq[9];
+    u_int8_t last_sub_frame[9];
+};
+
+struct mock_node {
+    struct ieee80211_node in_ni;
+    struct mock_dup dup_data[MOCK_QUEUES];
+};
+
+struct mock_softc {
+    struct ieee80211com sc_ic;
+    struct mock_rxba sc_rxba_data[MOCK_BAID];
+};
+
+struct mock_hal {
+    struct mock_softc sc;
+};
+
+struct MockReorderTraits {
+    typedef struct mock_hal hal_type;
+    typedef struct mock_softc softc_type;
+    typedef struct mock_node node_type;
+    typedef struct mock_rxba rxba_type;
+    typedef struct mock_buffer buffer_type;
+    typedef struct mock_entry entry_type;
+    typedef struct mock_desc desc_type;
+    typedef struct mock_dup dup_type;
+
+    static const u_int8_t max_tid_count = 8;
+    static const u_int8_t station_id = 0;
+    static const u_int8_t invalid_baid = IWX_RX_REORDER_DATA_INVALID_BAID;
+    static const unsigned int consec_drops_delba = 20;
+    static const u_int64_t reorder_timeout_usec = 100000;
+    static const u_int8_t amsdu_subframe_idx_mask =
+        IWX_RX_MPDU_AMSDU_SUBFRAME_IDX_MASK;
+    static const u_int8_t amsdu_last_subframe =
+        IWX_RX_MPDU_AMSDU_LAST_SUBFRAME;
+    static const u_int8_t mflg2_amsdu = IWX_RX_MPDU_MFLG2_AMSDU;
+    static const u_int32_t reorder_baid_mask = IWX_RX_MPDU_REORDER_BAID_MASK;
+    static const u_int32_t reorder_baid_shift = IWX_RX_MPDU_REORDER_BAID_SHIFT;
+    static const u_int32_t reorder_nssn_mask = IWX_RX_MPDU_REORDER_NSSN_MASK;
+    static const u_int32_t reorder_sn_mask = IWX_RX_MPDU_REORDER_SN_MASK;
+    static const u_int32_t reorder_sn_shift = IWX_RX_MPDU_REORDER_SN_SHIFT;
+    static const u_int32_t reorder_ba_old_sn = IWX_RX_MPDU_REORDER_BA_OLD_SN;
+
+    static void
+    rx_frame(hal_type *, softc_type *, mbuf_t m, int, u_int32_t, int, int,
+             u_int32_t, struct ieee80211_rxinfo *, struct mbuf_list *ml)
+    {
+        ml_enqueue(ml, m);
+    }
+
+    static rxba_type *
+    rxba_from_buf(buffer_type *buf)
+    {
+        return (rxba_type *)((u_int8_t *)(buf - buf->queue) -
+            offsetof(rxba_type, reorder_buf));
+    }
+
+    static buffer_type *
+    rx_buffer(rxba_type *rxba, int queue)
+    {
+        return &rxba->reorder_buf[queue];
+    }
+
+    static entry_type *
+    rx_entries(rxba_type *, buffer_type *buf)
+    {
+        return buf->entries;
+    }
+
+    static dup_type *
+    rx_dup_data(node_type *in, int queue)
+    {
+        return &in->dup_data[queue];
+    }
+
+    static hal_type *
+    hal_from_softc(softc_type *sc)
+    {
+        return (hal_type *)((u_int8_t *)sc - offsetof(hal_type, sc));
+    }
+};
+
+#include <HAL/ItlMvmReorder.hpp>
+
+typedef ItlMvmReorder<MockReorderTraits> Reorder;
+
+#define BAID    1
+#define TID     0
+
+static struct mock_hal hal;
+static struct mock_node bss;
+static struct mock_softc *sc = &hal.sc;
+
+/* Set up a BA session with a window of winsz on BAID for TID. */
+static void
+session(int winsz)
+{
+    struct mock_rxba *rxba = &sc->sc_rxba_data[BAID];
+    int q, i;
+
+    memset(&hal, 0, sizeof(hal));
+    memset(&bss, 0, sizeof(bss));
+    sc->sc_ic.ic_bss = &bss.in_ni;
+    for (i = 0; i < MOCK_BAID; i++)
+        sc->sc_rxba_data[i].sc = sc;
+    rxba->tid = TID;
+    rxba->sta_id = 0;
+    for (q = 0; q < MOCK_QUEUES; q++) {
+        rxba->reorder_buf[q].buf_size = winsz;
+        rxba->reorder_buf[q].queue = q;
+        rxba->reorder_buf[q].entries = rxba->entries[q];
+    }
+    up.clear();
+    ndropped = ndelba = 0;
+}
+
+static void
+teardown(void)
+{
+    struct mock_rxba *rxba = &sc->sc_rxba_data[BAID];
+    mbuf_t m;
+    int q, i;
+
+    for (q = 0; q < MOCK_QUEUES; q++)
+        for (i = 0; i < IEEE80211_BA_MAX_WINSZ; i++)
+            while ((m = ml_dequeue(&rxba->entries[q][i].frames)) != NULL)
+                free(m);
+}
+
+struct rx {
+    u_int16_t sn;
+    u_int16_t nssn;
+    int amsdu;          /* subframe index + 1, 0 if no A-MSDU */
+    int last;           /* last subframe */
+    int oldsn;
+    u_int32_t gp2;
+    int bar;
+};
+
+/*
+ * Hand a frame to rx_reorder() on queue 0 and pass what it does not
+ * consume, and what it releases, up in order.
+ */
+static int
+input(const struct rx &f)
+{
+    struct ieee80211_qosframe *wh;
+    struct ieee80211_rxinfo rxi;
+    struct mbuf_list ml = MBUF_LIST_INITIALIZER();
+    struct mock_desc desc;
+    mbuf_t m;
+    int consumed;
+
+    m = (mbuf_t)calloc(1, sizeof(*m));
+    wh = mtod(m, struct ieee80211_qosframe *);
+    if (f.bar)
+        wh->i_fc[0] = IEEE80211_FC0_TYPE_CTL | IEEE80211_FC0_SUBTYPE_BAR;
+    else {
+        wh->i_fc[0] = IEEE80211_FC0_TYPE_DATA | IEEE80211_FC0_SUBTYPE_QOS;
+        wh->i_qos[0] = TID;
+    }
+    wh->i_addr1[0] = 0x02;
+    *(u_int16_t *)wh->i_seq = htole16(f.sn << IEEE80211_SEQ_SEQ_SHIFT);
+
+    memset(&desc, 0, sizeof(desc));
+    if (f.amsdu) {
+        desc.mac_flags2 = IWX_RX_MPDU_MFLG2_AMSDU;
+        desc.amsdu_info = (f.amsdu - 1) |
+            (f.last ? IWX_RX_MPDU_AMSDU_LAST_SUBFRAME : 0);
+    }
+    desc.reorder_data = htole32((BAID << IWX_RX_MPDU_REORDER_BAID_SHIFT) |
+        (f.sn << IWX_RX_MPDU_REORDER_SN_SHIFT) | f.nssn |
+        (f.oldsn ? IWX_RX_MPDU_REORDER_BA_OLD_SN : 0));
+
+    memset(&rxi, 0, sizeof(rxi));
+    consumed = Reorder::rx_reorder(&hal, sc, m, 0, &desc, 0, 0, f.gp2, &rxi,
+        0, &ml);
+    deliver(&ml);
+    if (!consumed) {
+        up.push_back(frame_sn(m));
+        free(m);
+    }
+    return consumed;
+}
+
+/* Run the reorder timer of queue 0 if it is due at the current time. */
+static void
+run_timer(void)
+{
+    struct mock_buffer *buf = &sc->sc_rxba_data[BAID].reorder_buf[0];
+
+    if (buf->reorder_timer.pending && now >= buf->reorder_timer.when) {
+        buf->reorder_timer.pending = false;
+        Reorder::reorder_timer_expired(buf);
+    }
+}
+
+static int failures;
+
+static void
+check(const char *what, bool ok)
+{
+    printf("%-4s %s\n", ok ? "ok" : "FAIL", what);
+    if (!ok)
+        failures++;
+}
+
+static bool
+up_is(std::vector<u_int16_t> want)
+{
+    return up == want;
+}
+
+static void
+test_inorder(void)
+{
+    struct mock_buffer *buf = &sc->sc_rxba_data[BAID].reorder_buf[0];
+    bool passed = true;
+    int sn;
+
+    session(64);
+    for (sn = 0; sn < 200; sn++)
+        passed &= input({ (u_int16_t)sn, (u_int16_t)(sn + 1) }) == 0;
+    check("in order: every frame passes through", passed && up.size() == 200);
+    check("in order: nothing stored, no timer",
+        buf->num_stored == 0 && !buf->reorder_timer.pending);
+    check("in order: window head follows", buf->head_sn == 200);
+    teardown();
+}
+
+static void
+test_hole(void)
+{
+    struct mock_buffer *buf = &sc->sc_rxba_data[BAID].reorder_buf[0];
+
+    session(64);
+    input({ 0, 1 });
+    input({ 1, 2 });
+    check("hole: later frames are held",
+        input({ 3, 2 }) == 1 && input({ 4, 2 }) == 1 &&
+        up_is({ 0, 1 }) && buf->num_stored == 2);
+    check("hole: reorder timer armed", buf->reorder_timer.pending);
+    input({ 2, 5 });
+    check("hole: filling it releases in order", up_is({ 0, 1, 2, 3, 4 }));
+    check("hole: buffer empty, timer stopped",
+        buf->num_stored == 0 && !buf->reorder_timer.pending &&
+        buf->head_sn == 5);
+    check("hole: retransmission below the window is dropped",
+        input({ 3, 5 }) == 1 && ndropped == 1 &&
+        sc->sc_ic.ic_stats.is_ht_rx_frame_below_ba_winstart == 1);
+    check("hole: node references balanced", bss.in_ni.ni_refcnt == 0);
+    teardown();
+}
+
+static void
+test_nssn_jump(void)
+{
+    struct mock_buffer *buf = &sc->sc_rxba_data[BAID].reorder_buf[0];
+
+    session(64);
+    input({ 0, 1 });
+    input({ 2, 1 });
+    input({ 3, 1 });
+    /* The sender moved on; firmware flushed its window past ours. */
+    input({ 200, 201 });
+    check("NSSN jump: held frames released before the new one",
+        up_is({ 0, 2, 3, 200 }));
+    check("NSSN jump: counted as above the window",
+        sc->sc_ic.ic_stats.is_ht_rx_frame_above_ba_winend == 1);
+    check("NSSN jump: window moved", buf->head_sn == 201 &&
+        buf->num_stored == 0);
+
+    /* Wrap of the 12-bit sequence space. */
+    session(64);
+    buf->head_sn = 4094;
+    input({ 4094, 4095 });
+    input({ 0, 4095 });
+    input({ 1, 4095 });
+    input({ 4095, 2 });
+    check("NSSN wrap: released in order across 4095",
+        up_is({ 4094, 4095, 0, 1 }) && buf->head_sn == 2);
+    teardown();
+}
+
+static void
+test_bar(void)
+{
+    struct mock_buffer *buf = &sc->sc_rxba_data[BAID].reorder_buf[0];
+
+    session(64);
+    input({ 0, 1 });
+    input({ 2, 1 });
+    input({ 5, 1 });
+    check("BAR: consumed", input({ 0, 3, 0, 0, 0, 0, 1 }) == 1);
+    check("BAR: releases up to its SSN", up_is({ 0, 2 }) &&
+        buf->head_sn == 3 && buf->num_stored == 1);
+    input({ 0, 6, 0, 0, 0, 0, 1 });
+    check("BAR: releases across holes", up_is({ 0, 2, 5 }) &&
+        buf->num_stored == 0 && !buf->reorder_timer.pending);
+    teardown();
+}
+
+static void
+test_amsdu(void)
+{
+    struct mock_buffer *buf = &sc->sc_rxba_data[BAID].reorder_buf[0];
+
+    session(64);
+    input({ 0, 1 });
+    /* SN 2 before 1; NSSN advances on the first subframe already. */
+    input({ 2, 1, 1 });
+    input({ 2, 1, 2, 1 });
+    check("A-MSDU: subframes held together", buf->num_stored == 2);
+    input({ 1, 3, 1 });
+    check("A-MSDU: no release before the last subframe",
+        up_is({ 0 }) && buf->num_stored == 3);
+    input({ 1, 3, 2, 1 });
+    check("A-MSDU: released whole and in order", up_is({ 0, 1, 1, 2, 2 }));
+    check("A-MSDU: repeated subframe dropped",
+        input({ 4, 3, 1 }) == 1 && input({ 4, 3, 1 }) == 1 &&
+        sc->sc_ic.ic_stats.is_ht_rx_ba_no_buf == 1);
+    teardown();
+}
+
+static void
+test_oldsn(void)
+{
+    struct mock_buffer *buf = &sc->sc_rxba_data[BAID].reorder_buf[0];
+    int i;
+
+    session(64);
+    input({ 0, 100 });
+    buf->head_sn = 100;
+    /* Every A-MPDU carries frames firmware flags as old. */
+    for (i = 0; i < 19; i++) {
+        input({ (u_int16_t)(50 + i), 100, 0, 0, 1, (u_int32_t)(1000 + i) });
+        input({ (u_int16_t)(50 + i), 100, 0, 0, 1, (u_int32_t)(1000 + i) });
+    }
+    check("old SN: no DELBA below the limit", ndelba == 0 &&
+        buf->consec_oldsn_drops == 19);
+    input({ 70, 100, 0, 0, 1, 2000 });
+    check("old SN: DELBA after 20 A-MPDUs", ndelba == 1 &&
+        buf->consec_oldsn_drops == 0 &&
+        sc->sc_ic.ic_stats.is_ht_rx_ba_window_jump == 1);
+
+    /* An A-MPDU without old SN frames resets the count. */
+    session(64);
+    input({ 0, 100 });
+    buf->head_sn = 100;
+    for (i = 0; i < 30; i++) {
+        input({ (u_int16_t)(50 + i), 100, 0, 0, 1, (u_int32_t)(1000 + 2 * i) });
+        if (i % 10 == 9)
+            input({ (u_int16_t)(100 + i), (u_int16_t)(101 + i), 0, 0, 0,
+                (u_int32_t)(1001 + 2 * i) });
+        buf->head_sn = 100 + i + 1;
+    }
+    check("old SN: count restarts after a good A-MPDU", ndelba == 0);
+    teardown();
+}
+
+static void
+test_timer(void)
+{
+    struct mock_buffer *buf = &sc->sc_rxba_data[BAID].reorder_buf[0];
+
+    session(64);
+    now = 1000000;
+    input({ 0, 1 });
+    input({ 2, 1 });
+    now += 40000;
+    input({ 3, 1 });
+    input({ 6, 1 });
+    now += 59999;
+    run_timer();
+    check("timer: nothing released early", up_is({ 0 }) &&
+        buf->reorder_timer.pending);
+    /* 2 has expired, 3 follows it without a hole, 6 is still young. */
+    now = 1000000 + 100000;
+    Reorder::reorder_timer_expired(buf);
+    check("timer: expired frames released up to the next hole",
+        up_is({ 0, 2, 3 }) && buf->head_sn == 4 && buf->num_stored == 1);
+    now += 100000;
+    Reorder::reorder_timer_expired(buf);
+    check("timer: all released in order", up_is({ 0, 2, 3, 6 }) &&
+        buf->num_stored == 0 && buf->head_sn == 7);
+    check("timer: gap timeouts counted",
+        sc->sc_ic.ic_stats.is_ht_rx_ba_window_gap_timeout >= 1);
+    check("timer: late frame of the hole dropped",
+        input({ 1, 7 }) == 1 && ndropped == 1);
+    check("timer: stream resumes", input({ 7, 8 }) == 0 &&
+        up.back() == 7);
+    teardown();
+}
+
+static void
+test_duplicate(void)
+{
+    struct mock_desc desc;
+    struct ieee80211_rxinfo rxi;
+    struct ieee80211_qosframe *wh;
+    mbuf_t m;
+    int first, retry, next;
+
+    session(64);
+    m = (mbuf_t)calloc(1, sizeof(*m));
+    wh = mtod(m, struct ieee80211_qosframe *);
+    wh->i_fc[0] = IEEE80211_FC0_TYPE_DATA | IEEE80211_FC0_SUBTYPE_QOS;
+    wh->i_addr1[0] = 0x02;
+    *(u_int16_t *)wh->i_seq = htole16(7 << IEEE80211_SEQ_SEQ_SHIFT);
+    memset(&desc, 0, sizeof(desc));
+    memset(&rxi, 0, sizeof(rxi));
+    first = Reorder::detect_duplicate(sc, m, &desc, &rxi, 0);
+    wh->i_fc[1] |= IEEE80211_FC1_RETRY;
+    retry = Reorder::detect_duplicate(sc, m, &desc, &rxi, 1) +
+        2 * Reorder::detect_duplicate(sc, m, &desc, &rxi, 0);
+    *(u_int16_t *)wh->i_seq = htole16(8 << IEEE80211_SEQ_SEQ_SHIFT);
+    next = Reorder::detect_duplicate(sc, m, &desc, &rxi, 0);
+    check("duplicate: retry dropped on its queue only",
+        first == 0 && retry == 2 && next == 0);
+    free(m);
+}
+
+/*
+ * A-MPDUs of up to 64 MPDUs, one every 500 usec. Each MPDU is lost with
+ * a probability of 2% and sent again first in the next A-MPDU; one loss
+ * in 50 is given up on. NSSN is the first SN firmware has not received
+ * or the sender has given up on.
+ */
+static void
+bench(int mpdus)
+{
+    std::vector<u_int8_t> got(4096);
+    std::vector<u_int16_t> retry, next;
+    u_int64_t rng = 1;
+    u_int16_t sn = 0, nssn = 0, s;
+    size_t i, sent = 0, lost = 0, gaps = 0;
+    bool ordered = true;
+
+    session(64);
+    now = 1000000;
+    auto start = std::chrono::steady_clock::now();
+    while ((int)sent < mpdus) {
+        next.clear();
+        for (u_int16_t r : retry)
+            next.push_back(r);
+        /* The sender keeps within 64 of its oldest unacknowledged SN. */
+        while (next.size() < 64 && (retry.empty() ||
+            Reorder::seq_lt(sn & 0xfff, (retry[0] + 64) & 0xfff)))
+            next.push_back(sn++ & 0xfff);
+        retry.clear();
+        for (i = 0; i < next.size(); i++) {
+            s = next[i];
+            rng ^= rng << 13;
+            rng ^= rng >> 7;
+            rng ^= rng << 17;
+            if (rng % 1000 < 20) {
+                lost++;
+                if (rng % 50000 >= 1000)
+                    retry.push_back(s);
+                else {
+                    got[s] = 1;
+                    gaps++;
+                }
+                continue;
+            }
+            got[s] = 1;
+            while (got[nssn] && nssn != (sn & 0xfff)) {
+                got[nssn] = 0;
+                nssn = (nssn + 1) & 0xfff;
+            }
+            input({ s, nssn, 0, 0, 0, (u_int32_t)(now / 500) });
+            sent++;
+            if (up.size() > 4096) {
+                for (size_t j = 1; j < up.size(); j++)
+                    ordered &= Reorder::seq_lt(up[j - 1], up[j]);
+                up.erase(up.begin(), up.end() - 1);
+            }
+        }
+        now += 500;
+        run_timer();
+    }
+    auto usec = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    for (i = 1; i < up.size(); i++)
+        ordered &= Reorder::seq_lt(up[i - 1], up[i]);
+
+    printf("     %zu MPDUs, %zu lost, %zu never sent again: %.1f M MPDU/s, "
+        "%.0f ns each\n", sent, lost, gaps, sent / (double)MAX(usec, 1),
+        usec * 1000.0 / sent);
+    printf("     %u gap timeouts, %u window jumps, %d dropped\n",
+        sc->sc_ic.ic_stats.is_ht_rx_ba_window_gap_timeout,
+        sc->sc_ic.ic_stats.is_ht_rx_frame_above_ba_winend, ndropped);
+    check("stream: released in order", ordered);
+    teardown();
+}
+
+int
+main(int argc, char **argv)
+{
+    test_inorder();
+    test_hole();
+    test_nssn_jump();
+    test_bar();
+    test_amsdu();
+    test_oldsn();
+    test_timer();
+    test_duplicate();
+    bench(argc > 1 ? atoi(argv[1]) : 200000);
+
+    printf("%d failed\n", failures);
+    return failures != 0;
+}
@@ -0,0 +1,429 @@
+/*
+ * Tests of the 802.11k neighbor report code: ieee80211_parse_nbr() and
+ * ieee80211_recv_nbr_resp() in ieee80211_input.c, ieee80211_nbr_request(),
+ * ieee80211_nbr_update() and ieee80211_nbr_prepare() in ieee80211_node.c.
+ *
+ * The unit tests check the parsed neighbor lists, what is filtered out,
+ * malformed elements, dialog tokens, request pacing and the per-ESS
+ * table. The replay test plays a set of response frames back the way
+ * they arrive after a request, then again cut off at every length and
+ * with every byte changed; built with -fsanitize=address as below, this
+ * catches any read past the end of a frame.
+ *
+ *   Generate net80211_defs.inc as net80211_env.h says, then:
+ *
+ *   N=../itl80211/openbsd/net80211
+ *   (awk -v fns="ieee80211_roam_uptime ieee80211_nbr_lookup \
+ *        ieee80211_nbr_request ieee80211_nbr_store ieee80211_nbr_update \
+ *        ieee80211_nbr_prepare" -f extract.awk $N/ieee80211_node.c &&
+ *    awk -v fns="ieee80211_parse_nbr ieee80211_recv_nbr_resp" \
+ *        -f extract.awk $N/ieee80211_input.c) > nbr_report.inc
+ *   c++ -std=c++11 -g -fsanitize=address,undefined -I compat \
+ *       -idirafter ../itl80211/openbsd -o nbr_report_test nbr_report_test.cpp
+ *   ./nbr_report_test [-v]
+ */
+
+#include "net80211_env.h"
+#include "nbr_report.inc"
+
+static const u_int8_t ap[IEEE80211_ADDR_LEN] =
+    { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+static const u_int8_t other[IEEE80211_ADDR_LEN] =
+    { 0x02, 0x00, 0x00, 0x00, 0x00, 0x99 };
+
+static struct ieee80211com ic;
+static struct ieee80211_node bss;
+
+/* BSSID 02:00:00:00:01:<id> */
+static std::vector<u_int8_t>
+nbr(u_int8_t id, u_int8_t opclass, u_int8_t chan, u_int32_t bssinfo,
+    const std::vector<u_int8_t> &sub = {})
+{
+    std::vector<u_int8_t> e = {
+        IEEE80211_ELEMID_NBR_REPORT, 0,
+        0x02, 0x00, 0x00, 0x00, 0x01, id,
+        (u_int8_t)bssinfo, (u_int8_t)(bssinfo >> 8),
+        (u_int8_t)(bssinfo >> 16), (u_int8_t)(bssinfo >> 24),
+        opclass, chan, 7 /* HT */
+    };
+
+    e.insert(e.end(), sub.begin(), sub.end());
+    e[1] = e.size() - 2;
+    return e;
+}
+
+static std::vector<u_int8_t>
+resp(u_int8_t token, const std::vector<std::vector<u_int8_t> > &elems)
+{
+    std::vector<u_int8_t> body = {
+        IEEE80211_CATEG_RADIO_MSRMNT, IEEE80211_ACTION_RM_NEIGHBOR_RESP,
+        token
+    };
+
+    for (auto &e : elems)
+        body.insert(body.end(), e.begin(), e.end());
+    return env_action(ap, body);
+}
+
+static void
+recv(const std::vector<u_int8_t> &f, struct ieee80211_node *ni = &bss)
+{
+    env_recv(ieee80211_recv_nbr_resp, &ic, ni, f, f.size());
+}
+
+static struct ieee80211_nbr_ess *
+ess(void)
+{
+    return ieee80211_nbr_lookup(&ic, bss.ni_essid, bss.ni_esslen, 0);
+}
+
+static const struct ieee80211_nbr *
+find(u_int8_t id)
+{
+    struct ieee80211_nbr_ess *ne = ess();
+    int i;
+
+    for (i = 0; ne != NULL && i < ne->ne_nnbr; i++)
+        if (ne->ne_nbr[i].nb_bssid[5] == id)
+            return &ne->ne_nbr[i];
+    return NULL;
+}
+
+static int
+nnbr(void)
+{
+    struct ieee80211_nbr_ess *ne = ess();
+
+    return ne != NULL ? ne->ne_nnbr : -1;
+}
+
+/* Associate with a fresh state and send a request. */
+static u_int8_t
+setup(void)
+{
+    env_init(&ic, &bss, "corp", ap);
+    bss.ni_flags |= IEEE80211_NODE_RMCAP;
+    ieee80211_nbr_request(&ic, 0);
+    return ic.ic_rrm.rr_token;
+}
+
+#define REACH   IEEE80211_NBR_BSSINFO_REACH_YES
+#define PREF(p) std::vector<u_int8_t>{ IEEE80211_NBR_SUBELEM_BTM_PREF, 1, (p) }
+
+static void
+test_parse(void)
+{
+    u_char chans[howmany(IEEE80211_CHAN_MAX, NBBY)];
+    u_int8_t token = setup();
+    const struct ieee80211_nbr *nb;
+
+    check("request sent to an AP with neighbor reports",
+        sent.size() == 1 && sent[0].categ == IEEE80211_CATEG_RADIO_MSRMNT &&
+        sent[0].action == IEEE80211_ACTION_RM_NEIGHBOR_REQ &&
+        sent[0].arg == token && token != 0);
+
+    /* TSF information and HT capabilities subelements around the pref. */
+    recv(resp(token, {
+        nbr(1, 81, 6, REACH | IEEE80211_NBR_BSSINFO_HT,
+            { 1, 4, 0, 0, 0, 0, 3, 1, 200, 45, 2, 0, 0 }),
+        nbr(2, 121, 100, IEEE80211_NBR_BSSINFO_REACH_UNKNOWN),
+    }));
+    check("two neighbors stored", nnbr() == 2);
+    nb = find(1);
+    check("fields of the first neighbor",
+        nb != NULL && nb->nb_opclass == 81 && nb->nb_chan == 6 &&
+        nb->nb_phytype == 7 &&
+        nb->nb_bssinfo == (REACH | IEEE80211_NBR_BSSINFO_HT));
+    check("BSS transition preference found among subelements",
+        nb != NULL && nb->nb_pref == 200);
+    nb = find(2);
+    check("preference 1 without the subelement",
+        nb != NULL && nb->nb_pref == 1 && nb->nb_chan == 100);
+    check("response consumes the request",
+        ic.ic_rrm.rr_reqtime == 0 && ic.ic_rrm.rr_nresp == 1);
+
+    check("reported channels are prepared",
+        ieee80211_nbr_prepare(&ic, chans) == 1);
+    check("neighbors' and own channels set",
+        isset(chans, 6) && isset(chans, 100) && isset(chans, 36));
+    check("no other channels set",
+        !isset(chans, 1) && !isset(chans, 11) && !isset(chans, 40) &&
+        !isset(chans, 104));
+}
+
+static void
+test_filter(void)
+{
+    u_int8_t token = setup();
+
+    recv(resp(token, {
+        /* our own AP */
+        { IEEE80211_ELEMID_NBR_REPORT, 13, 0x02, 0, 0, 0, 0, 0x01,
+          REACH, 0, 0, 0, 115, 36, 7 },
+        nbr(1, 81, 1, IEEE80211_NBR_BSSINFO_REACH_NO),
+        nbr(2, 131, 37, REACH),         /* 6 GHz */
+        nbr(3, 81, 0, REACH),
+        nbr(4, 82, 14, REACH),          /* not usable here */
+        nbr(5, 125, 165, REACH),        /* not usable here */
+        nbr(6, 115, 44, REACH),
+    }));
+    check("only the usable neighbor is kept",
+        nnbr() == 1 && find(6) != NULL);
+}
+
+static void
+test_malformed(void)
+{
+    u_int8_t token = setup();
+    std::vector<u_int8_t> f;
+
+    recv(resp(token, {
+        { IEEE80211_ELEMID_VENDOR, 3, 0x00, 0x50, 0xf2 },
+        { IEEE80211_ELEMID_NBR_REPORT, 12, 0x02, 0, 0, 0, 1, 1,
+          REACH, 0, 0, 0, 81, 1 },
+        nbr(2, 81, 11, REACH, { IEEE80211_NBR_SUBELEM_BTM_PREF, 5, 9 }),
+        nbr(3, 115, 40, REACH, PREF(0)),
+    }));
+    check("element shorter than the fixed part is skipped",
+        find(1) == NULL && ic.ic_stats.is_rx_elem_toosmall == 1);
+    check("other elements are skipped", nnbr() == 2);
+    check("subelement running past its element is ignored",
+        find(2) != NULL && find(2)->nb_pref == 1);
+    check("preference 0 is kept as is",
+        find(3) != NULL && find(3)->nb_pref == 0);
+
+    token = setup();
+    f = resp(token, { nbr(1, 81, 1, REACH), nbr(2, 81, 6, REACH) });
+    f.pop_back();
+    recv(f);
+    check("element running past the frame ends parsing",
+        nnbr() == 1 && find(1) != NULL &&
+        ic.ic_stats.is_rx_elem_toobig == 1);
+
+    token = setup();
+    f = resp(token, {});
+    f.pop_back();
+    recv(f);
+    check("frame without a dialog token is dropped",
+        ic.ic_rrm.rr_reqtime != 0 && nnbr() == -1);
+}
+
+static void
+test_many(void)
+{
+    std::vector<std::vector<u_int8_t> > elems;
+    u_int8_t token = setup();
+
+    for (int i = 0; i < IEEE80211_NBR_MAX + 4; i++)
+        elems.push_back(nbr(i + 1, 115, 36 + 4 * (i % 8), REACH));
+    recv(resp(token, elems));
+    check("at most IEEE80211_NBR_MAX neighbors",
+        nnbr() == IEEE80211_NBR_MAX && find(IEEE80211_NBR_MAX) != NULL &&
+        find(IEEE80211_NBR_MAX + 1) == NULL);
+}
+
+static void
+test_token(void)
+{
+    u_int8_t token = setup();
+    struct ieee80211_node stranger = bss;
+
+    IEEE80211_ADDR_COPY(stranger.ni_macaddr, other);
+    recv(resp(token, { nbr(1, 81, 1, REACH) }), &stranger);
+    check("response from another AP is ignored", nnbr() == -1);
+
+    recv(resp(token + 1, { nbr(1, 81, 1, REACH) }));
+    check("wrong dialog token is ignored",
+        nnbr() == -1 && ic.ic_rrm.rr_reqtime != 0);
+
+    recv(resp(token, { nbr(1, 81, 1, REACH) }));
+    recv(resp(token, { nbr(2, 81, 6, REACH) }));
+    check("a repeated response is ignored",
+        nnbr() == 1 && find(1) != NULL && ic.ic_rrm.rr_nresp == 1);
+
+    setup();
+    ic.ic_rrm.rr_reqtime = 0;
+    recv(resp(0, { nbr(1, 81, 1, REACH) }));
+    check("unsolicited response is ignored", nnbr() == -1);
+
+    token = setup();
+    ic.ic_opmode = IEEE80211_M_HOSTAP;
+    recv(resp(token, { nbr(1, 81, 1, REACH) }));
+    check("ignored unless a station", nnbr() == -1);
+}
+
+static void
+test_request(void)
+{
+    u_char chans[howmany(IEEE80211_CHAN_MAX, NBBY)];
+    u_int8_t token;
+
+    setup();
+    env_msec += IEEE80211_NBR_TIMEOUT - 1;
+    ieee80211_nbr_request(&ic, 1);
+    check("no second request while one is outstanding", sent.size() == 1);
+    env_msec += 1;
+    ieee80211_nbr_request(&ic, 0);
+    check("request repeated after the timeout", sent.size() == 2);
+    token = ic.ic_rrm.rr_token;
+    check("with a new dialog token", sent[1].arg == token &&
+        sent[1].arg != sent[0].arg);
+
+    recv(resp(token, { nbr(1, 81, 1, REACH) }));
+    ieee80211_nbr_request(&ic, 0);
+    check("no request while the report is recent", sent.size() == 2);
+    ieee80211_nbr_request(&ic, 1);
+    check("unless forced", sent.size() == 3);
+
+    recv(resp(ic.ic_rrm.rr_token, { nbr(1, 81, 1, REACH) }));
+    env_msec += IEEE80211_NBR_MAXAGE;
+    check("an old report is not used",
+        ieee80211_nbr_prepare(&ic, chans) == 0);
+    ieee80211_nbr_request(&ic, 0);
+    check("and is asked for again", sent.size() == 4);
+
+    setup();
+    sent.clear();
+    bss.ni_flags &= ~IEEE80211_NODE_RMCAP;
+    ic.ic_rrm.rr_reqtime = 0;
+    ieee80211_nbr_request(&ic, 1);
+    check("no request to an AP without neighbor reports", sent.empty());
+
+    setup();
+    sent.clear();
+    ic.ic_rrm.rr_reqtime = 0;
+    ic.ic_flags |= IEEE80211_F_RSNON;
+    bss.ni_port_valid = 0;
+    ieee80211_nbr_request(&ic, 1);
+    check("no request before the port is valid", sent.empty());
+}
+
+static void
+test_ess(void)
+{
+    u_char chans[howmany(IEEE80211_CHAN_MAX, NBBY)];
+    const char *names[] = { "a", "b", "c", "d", "e" };
+    u_int8_t token = setup();
+    int i;
+
+    recv(resp(token, { nbr(1, 81, 1, REACH) }));
+    for (i = 0; i < 5; i++) {
+        env_msec += 1000;
+        bss.ni_esslen = 1;
+        memcpy(bss.ni_essid, names[i], 1);
+        check(i == 0 ? "other ESS has no report" : "...nor the next",
+            ieee80211_nbr_prepare(&ic, chans) == 0);
+        ic.ic_rrm.rr_reqtime = 0;
+        ieee80211_nbr_request(&ic, 1);
+        recv(resp(ic.ic_rrm.rr_token, { nbr(i + 2, 81, 6, REACH) }));
+    }
+    check("the latest ESSes are remembered", nnbr() == 1 &&
+        find(6) != NULL);
+    bss.ni_esslen = 4;
+    memcpy(bss.ni_essid, "corp", 4);
+    check("the least recently updated one was dropped", nnbr() == -1);
+}
+
+/* Response frames as APs send them, token patched in by the replay. */
+static std::vector<std::vector<u_int8_t> >
+corpus(void)
+{
+    return {
+        resp(0, {}),
+        resp(0, { nbr(1, 81, 1, REACH) }),
+        /* TSF info, condensed country, BSS transition preference. */
+        resp(0, {
+            nbr(1, 81, 6, REACH | IEEE80211_NBR_BSSINFO_SECURITY |
+                IEEE80211_NBR_BSSINFO_KEYSCOPE | IEEE80211_NBR_BSSINFO_HT,
+                { 1, 4, 0x10, 0x00, 0x64, 0x00, 2, 2, 'U', 'S', 3, 1, 255 }),
+            nbr(2, 128, 42, REACH | IEEE80211_NBR_BSSINFO_VHT,
+                { 6, 3, 1, 42, 0 }),
+            nbr(3, 125, 149, REACH),
+        }),
+        /* Measurement report and vendor elements in between. */
+        resp(0, {
+            { IEEE80211_ELEMID_VENDOR, 7, 0x00, 0x50, 0xf2, 0x11, 1, 2, 3 },
+            nbr(4, 115, 48, IEEE80211_NBR_BSSINFO_REACH_UNKNOWN, PREF(128)),
+            { 39, 5, 1, 0, 5, 0, 0 },
+            nbr(5, 118, 60, REACH | IEEE80211_NBR_BSSINFO_MDID),
+        }),
+    };
+}
+
+static void
+check_invariants(bool *ok)
+{
+    struct ieee80211_nbr_ess *ne = ess();
+    int i;
+
+    if (ne == NULL)
+        return;
+    if (ne->ne_nnbr < 0 || ne->ne_nnbr > IEEE80211_NBR_MAX)
+        *ok = false;
+    for (i = 0; i < ne->ne_nnbr && i < IEEE80211_NBR_MAX; i++) {
+        const struct ieee80211_nbr *nb = &ne->ne_nbr[i];
+
+        if (nb->nb_chan == 0 || ic.ic_channels[nb->nb_chan].ic_flags == 0 ||
+            IEEE80211_ADDR_EQ(nb->nb_bssid, bss.ni_bssid))
+            *ok = false;
+    }
+}
+
+static void
+test_replay(void)
+{
+    static const u_int8_t values[] = { 0x00, 0x01, 0x0d, 0x34, 0x7f, 0xff };
+    size_t off = sizeof(struct ieee80211_frame) + 2;
+    bool ok = true;
+    int frames = 0;
+
+    for (auto f : corpus()) {
+        u_int8_t token;
+        size_t len, i, v;
+
+        token = setup();
+        f[off] = token;
+        recv(f);
+        check_invariants(&ok);
+        if (ic.ic_rrm.rr_nresp != 1)
+            ok = false;
+        frames++;
+
+        for (len = 0; len < f.size(); len++) {
+            token = setup();
+            f[off] = token;
+            env_recv(ieee80211_recv_nbr_resp, &ic, &bss, f, len);
+            check_invariants(&ok);
+            frames++;
+        }
+        for (i = off + 1; i < f.size(); i++) {
+            for (v = 0; v < nitems(values); v++) {
+                std::vector<u_int8_t> g = f;
+
+                token = setup();
+                g[off] = token;
+                g[i] = values[v];
+                recv(g);
+                check_invariants(&ok);
+                frames++;
+            }
+        }
+    }
+    printf("     replayed %d frames\n", frames);
+    check("replayed, cut short and corrupted frames", ok);
+}
+
+int
+main(int argc, char **argv)
+{
+    env_verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+    test_parse();
+    test_filter();
+    test_malformed();
+    test_many();
+    test_token();
+    test_request();
+    test_ess();
+    test_replay();
+    return failures != 0;
+}
@@ -0,0 +1,220 @@
+/*
+ * Stand-ins for the parts of the net80211 state and of the kernel that
+ * the roaming code under test touches. The definitions they need are
+ * taken from the real headers by extract.awk:
+ *
+ *   N=../itl80211/openbsd/net80211
+ *   (awk -v types="ieee80211_opmode ieee80211_channel ieee80211_nbr \
+ *        ieee80211_nbr_ess ieee80211_rrm ieee80211_btm \
+ *        ieee80211_chanhist_ess ieee80211_chanhist" \
+ *        -v defines="IEEE80211_CHAN_MAX IEEE80211_CHAN_2GHZ \
+ *        IEEE80211_CHAN_5GHZ IEEE80211_ADDR_COPY IEEE80211_ADDR_EQ \
+ *        IEEE80211_F_DESBSSID IEEE80211_F_RSNON IEEE80211_F_BGSCAN \
+ *        IEEE80211_F_DISABLE_BG_AUTO_CONNECT IEEE80211_NBR_ESS \
+ *        IEEE80211_NBR_MAX IEEE80211_NBR_MAXAGE IEEE80211_NBR_TIMEOUT \
+ *        IEEE80211_CHANHIST_ESS" -f extract.awk $N/ieee80211_var.h &&
+ *    awk -v types=ieee80211_state -v defines=IEEE80211_SEND_ACTION \
+ *        -f extract.awk $N/ieee80211_proto.h &&
+ *    awk -v defines=IEEE80211_NODE_RMCAP -f extract.awk $N/ieee80211_node.h) \
+ *       > net80211_defs.inc
+ *
+ * The structures here only carry the members that code uses, under their
+ * real names, so it builds unchanged.
+ */
+
+#ifndef _NET80211_ENV_H_
+#define _NET80211_ENV_H_
+
+#include <sys/systm.h>
+#include <sys/time.h>
+#include <net/if.h>
+
+#include <net80211/ieee80211.h>
+#include <net80211/ieee80211_crypto.h>
+#include <net80211/ieee80211_priv.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <vector>
+
+#include "net80211_defs.inc"
+
+struct __mbuf {
+    u_int8_t *m_data;
+    size_t m_len;
+};
+
+#define mtod(m, t)      ((t)(m)->m_data)
+#define mbuf_len(m)     ((m)->m_len)
+
+struct _ifnet {
+    char if_xname[16];
+    int if_flags;
+};
+
+struct ieee80211_node {
+    u_int8_t ni_macaddr[IEEE80211_ADDR_LEN];
+    u_int8_t ni_bssid[IEEE80211_ADDR_LEN];
+    u_int8_t ni_essid[IEEE80211_NWID_LEN];
+    u_int8_t ni_esslen;
+    struct ieee80211_channel *ni_chan;
+    u_int32_t ni_flags;
+    int ni_fails;
+    int ni_port_valid;
+};
+
+struct ieee80211_stats {
+    u_int32_t is_rx_elem_toobig;
+    u_int32_t is_rx_elem_toosmall;
+};
+
+struct ieee80211com {
+    struct _ifnet ic_if;
+    enum ieee80211_opmode ic_opmode;
+    enum ieee80211_state ic_state;
+    u_int32_t ic_flags;
+    struct ieee80211_node *ic_bss;
+    struct ieee80211_stats ic_stats;
+    struct ieee80211_rrm ic_rrm;
+    struct ieee80211_btm ic_btm;
+    struct ieee80211_chanhist ic_chanhist;
+    struct ieee80211_channel ic_channels[IEEE80211_CHAN_MAX + 1];
+    int (*ic_send_mgmt)(struct ieee80211com *, struct ieee80211_node *,
+        int, int, int);
+    int (*ic_bgscan_start)(struct ieee80211com *);
+};
+
+/* Management frames sent, as IEEE80211_SEND_ACTION() encodes them. */
+struct sent_mgmt {
+    int type;
+    int categ;
+    int action;
+    int arg;
+};
+static std::vector<struct sent_mgmt> sent;
+
+static int
+env_send_mgmt(struct ieee80211com *, struct ieee80211_node *, int type,
+    int arg1, int arg2)
+{
+    sent.push_back({ type, arg1 >> 16, arg1 & 0xffff, arg2 });
+    return 0;
+}
+
+static u_int64_t env_msec = 1000;
+
+static void
+getmicrouptime(struct timeval *tv)
+{
+    tv->tv_sec = env_msec / 1000;
+    tv->tv_usec = (env_msec % 1000) * 1000;
+}
+
+static bool env_verbose;
+
+static void
+XYLog(const char *fmt, ...)
+{
+    va_list ap;
+
+    if (!env_verbose)
+        return;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+}
+
+static const char *
+ether_sprintf(const u_int8_t *ap)
+{
+    static char buf[18];
+
+    snprintf(buf, sizeof(buf), "%02x:%02x:%02x:%02x:%02x:%02x",
+        ap[0], ap[1], ap[2], ap[3], ap[4], ap[5]);
+    return buf;
+}
+
+static u_int
+ieee80211_chan2ieee(struct ieee80211com *ic, const struct ieee80211_channel *c)
+{
+    return c - ic->ic_channels;
+}
+
+/*
+ * An associated station: 2 GHz channels 1-13 and 5 GHz channels
+ * 36-64 and 100-140 are usable, the AP is on channel 36.
+ */
+static void
+env_init(struct ieee80211com *ic, struct ieee80211_node *bss,
+    const char *essid, const u_int8_t *bssid)
+{
+    int i;
+
+    memset(ic, 0, sizeof(*ic));
+    memset(bss, 0, sizeof(*bss));
+    strcpy(ic->ic_if.if_xname, "itlwm0");
+    ic->ic_if.if_flags = IFF_UP | IFF_RUNNING;
+    ic->ic_opmode = IEEE80211_M_STA;
+    ic->ic_state = IEEE80211_S_RUN;
+    ic->ic_send_mgmt = env_send_mgmt;
+    for (i = 1; i <= 13; i++)
+        ic->ic_channels[i].ic_flags = IEEE80211_CHAN_2GHZ;
+    for (i = 36; i <= 64; i += 4)
+        ic->ic_channels[i].ic_flags = IEEE80211_CHAN_5GHZ;
+    for (i = 100; i <= 140; i += 4)
+        ic->ic_channels[i].ic_flags = IEEE80211_CHAN_5GHZ;
+
+    IEEE80211_ADDR_COPY(bss->ni_macaddr, bssid);
+    IEEE80211_ADDR_COPY(bss->ni_bssid, bssid);
+    bss->ni_esslen = strlen(essid);
+    memcpy(bss->ni_essid, essid, bss->ni_esslen);
+    bss->ni_chan = &ic->ic_channels[36];
+    bss->ni_port_valid = 1;
+    ic->ic_bss = bss;
+    sent.clear();
+}
+
+/* An action frame from addr with the given body. */
+static std::vector<u_int8_t>
+env_action(const u_int8_t *addr, const std::vector<u_int8_t> &body)
+{
+    std::vector<u_int8_t> f(sizeof(struct ieee80211_frame));
+    struct ieee80211_frame *wh = (struct ieee80211_frame *)f.data();
+
+    wh->i_fc[0] = IEEE80211_FC0_VERSION_0 | IEEE80211_FC0_TYPE_MGT |
+        IEEE80211_FC0_SUBTYPE_ACTION;
+    IEEE80211_ADDR_COPY(wh->i_addr2, addr);
+    IEEE80211_ADDR_COPY(wh->i_addr3, addr);
+    f.insert(f.end(), body.begin(), body.end());
+    return f;
+}
+
+/*
+ * Pass the first len bytes of f to recv in a buffer of exactly that
+ * size, so that AddressSanitizer catches reads past the end.
+ */
+static void
+env_recv(void (*recv)(struct ieee80211com *, mbuf_t, struct ieee80211_node *),
+    struct ieee80211com *ic, struct ieee80211_node *ni,
+    const std::vector<u_int8_t> &f, size_t len)
+{
+    struct __mbuf m;
+
+    m.m_len = len;
+    m.m_data = (u_int8_t *)malloc(len ? len : 1);
+    memcpy(m.m_data, f.data(), len);
+    (*recv)(ic, &m, ni);
+    free(m.m_data);
+}
+
+static int failures;
+
+static void
+check(const char *what, bool ok)
+{
+    printf("%-4s %s\n", ok ? "ok" : "FAIL", what);
+    if (!ok)
+        failures++;
+}
+
+#endif /* _NET80211_ENV_H_ */
@@ -0,0 +1,368 @@
+/*
+ * Tests of the slim scan entries of the STA mode node cache: nodes with
+ * IEEE80211_NODE_SCANONLY are allocated with IEEE80211_NODE_SCAN_SIZE
+ * bytes only, so nothing may touch the Block Ack state behind that.
+ * ieee80211_node_copy(), ieee80211_node_cleanup() and the Block Ack
+ * teardown from ieee80211_node.c run on such entries built with the
+ * allocator of sys/_malloc.h; AddressSanitizer reports any access past
+ * their end. The test also fills the cache with 1000 BSSes and checks
+ * what ieee80211_node_cache_stats() reports for them against full nodes.
+ *
+ *   N=../itl80211/openbsd/net80211
+ *   (awk -v types="ieee80211_rateset ieee80211_tx_ba ieee80211_rx_ba \
+ *        ieee80211_node" -v defines="IEEE80211_PS_MAX_QUEUE \
+ *        IEEE80211_NODE_SCAN_SIZE" -f extract.awk $N/ieee80211_node.h) \
+ *       > node_cache_defs.inc
+ *   (awk -v fns="ieee80211_node_cmp ieee80211_ba_del ieee80211_ba_free \
+ *        ieee80211_node_cleanup ieee80211_node_copy \
+ *        ieee80211_node_set_timeouts ieee80211_node_cache_stats" \
+ *        -f extract.awk $N/ieee80211_node.c &&
+ *    awk -v fns="ieee80211_save_ie ieee80211_save_ie_tlv" \
+ *        -f extract.awk $N/ieee80211_input.c) > node_cache.inc
+ *   c++ -std=c++11 -g -fsanitize=address,undefined [-DAIRPORT] -I compat \
+ *       -idirafter ../itl80211/openbsd -o node_cache_test node_cache_test.cpp
+ *   ./node_cache_test
+ */
+
+#include <sys/systm.h>
+#include <sys/tree.h>
+#include <sys/time.h>
+
+#ifdef AIRPORT
+/* ieee80211.h keeps time in AIRPORT builds. */
+static void
+microuptime(struct timeval *tv)
+{
+    gettimeofday(tv, NULL);
+}
+#endif
+
+#include <net80211/ieee80211.h>
+#include <net80211/ieee80211_crypto.h>
+
+#include <IOKit/IOLib.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string>
+
+#define IPL_NET         6
+
+class CTimeout {
+public:
+    void (*fn)(void *);
+    void *arg;
+    bool pending;
+};
+static int ntimeouts;
+
+static void
+timeout_set(CTimeout **t, void (*fn)(void *), void *arg)
+{
+    if (*t == NULL) {
+        *t = new CTimeout;
+        ntimeouts++;
+    }
+    **t = { fn, arg, false };
+}
+
+static int
+timeout_pending(CTimeout **t)
+{
+    return *t != NULL && (*t)->pending;
+}
+
+static int
+timeout_del(CTimeout **t)
+{
+    if (*t != NULL)
+        (*t)->pending = false;
+    return 0;
+}
+
+static int
+timeout_free(CTimeout **t)
+{
+    if (*t != NULL) {
+        delete *t;
+        *t = NULL;
+        ntimeouts--;
+    }
+    return 0;
+}
+
+struct mbuf_list {
+    mbuf_t ml_head;
+    mbuf_t ml_tail;
+    u_int ml_len;
+};
+
+struct mbuf_queue {
+    void *mq_mtx;
+    struct mbuf_list mq_list;
+    u_int mq_maxlen;
+    u_int mq_drops;
+};
+
+static void
+mq_init(struct mbuf_queue *mq, u_int maxlen, int)
+{
+    memset(mq, 0, sizeof(*mq));
+    mq->mq_maxlen = maxlen;
+}
+
+static u_int
+mq_purge(struct mbuf_queue *)
+{
+    return 0;
+}
+
+#include "node_cache_defs.inc"
+
+RB_HEAD(ieee80211_tree, ieee80211_node);
+
+struct _ifnet {
+    char if_xname[16];
+};
+
+struct ieee80211com {
+    struct _ifnet ic_if;
+    struct ieee80211_tree ic_tree;
+};
+
+static std::string logged;
+
+static void
+XYLog(const char *fmt, ...)
+{
+    char buf[256];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    logged += buf;
+}
+
+/* The kernel allocator and the code under test, kept apart from libc. */
+namespace kern {
+#include <sys/_malloc.h>
+
+/* Argument lookup would find the free() of libc for ni_txtmpl as well. */
+static inline void
+free(::ieee80211_txtmpl *addr)
+{
+    free((void *)addr);
+}
+
+static void ieee80211_eapol_timeout(void *) {}
+static void ieee80211_sa_query_timeout(void *) {}
+static void ieee80211_node_addba_request_ac_be_to(void *) {}
+static void ieee80211_node_addba_request_ac_bk_to(void *) {}
+static void ieee80211_node_addba_request_ac_vi_to(void *) {}
+static void ieee80211_node_addba_request_ac_vo_to(void *) {}
+
+int ieee80211_node_cmp(const struct ieee80211_node *,
+    const struct ieee80211_node *);
+void ieee80211_ba_del(struct ieee80211_node *);
+void ieee80211_ba_free(struct ieee80211_node *);
+void ieee80211_node_set_timeouts(struct ieee80211_node *);
+int ieee80211_save_ie(const u_int8_t *, u_int8_t **);
+int ieee80211_save_ie_tlv(const u_int8_t *, u_int8_t **, u_int32_t *,
+    u_int32_t);
+
+RB_GENERATE_STATIC(ieee80211_tree, ieee80211_node, ni_node,
+    ieee80211_node_cmp)
+
+#include "node_cache.inc"
+}
+using namespace kern;
+
+static int failures;
+
+static void
+check(const char *what, bool ok)
+{
+    printf("%-4s %s\n", ok ? "ok" : "FAIL", what);
+    if (!ok)
+        failures++;
+}
+
+/* RSN element of a WPA2-PSK CCMP network. */
+static const u_int8_t rsnie[] = {
+    IEEE80211_ELEMID_RSN, 20, 1, 0, 0x00, 0x0f, 0xac, 4, 1, 0,
+    0x00, 0x0f, 0xac, 4, 1, 0, 0x00, 0x0f, 0xac, 2, 0x0c, 0
+};
+
+/* A scan entry as ieee80211_alloc_scan_node() makes them. */
+static struct ieee80211_node *
+scan_node(struct ieee80211com *ic, int i)
+{
+    struct ieee80211_node *ni;
+
+    ni = (struct ieee80211_node *)malloc(IEEE80211_NODE_SCAN_SIZE, 0, 0);
+    ni->ni_flags = IEEE80211_NODE_SCANONLY;
+    ni->ni_macaddr[0] = 0x02;
+    ni->ni_macaddr[4] = i >> 8;
+    ni->ni_macaddr[5] = i;
+    memcpy(ni->ni_bssid, ni->ni_macaddr, IEEE80211_ADDR_LEN);
+    ni->ni_esslen = 4;
+    memcpy(ni->ni_essid, "corp", 4);
+    ni->ni_rssi = 40 + i % 30;
+    ieee80211_save_ie(rsnie, &ni->ni_rsnie);
+    if (ic != NULL)
+        RB_INSERT(ieee80211_tree, &ic->ic_tree, ni);
+    return ni;
+}
+
+static void
+flush(struct ieee80211com *ic)
+{
+    struct ieee80211_node *ni;
+
+    while ((ni = RB_MIN(ieee80211_tree, &ic->ic_tree)) != NULL) {
+        RB_REMOVE(ieee80211_tree, &ic->ic_tree, ni);
+        ieee80211_node_cleanup(ic, ni);
+        kern::free(ni);
+    }
+}
+
+static void
+test_layout(void)
+{
+    printf("     struct ieee80211_node %zu bytes, scan entry %zu bytes\n",
+        sizeof(struct ieee80211_node), (size_t)IEEE80211_NODE_SCAN_SIZE);
+    check("Block Ack state is left out of scan entries",
+        offsetof(struct ieee80211_node, ni_tx_ba) >=
+        IEEE80211_NODE_SCAN_SIZE &&
+        offsetof(struct ieee80211_node, ni_rx_ba) >=
+        IEEE80211_NODE_SCAN_SIZE &&
+        offsetof(struct ieee80211_node, ni_addba_req_intval) >=
+        IEEE80211_NODE_SCAN_SIZE);
+    check("scan entries keep everything else",
+        offsetof(struct ieee80211_node, ni_unref_arg_size) +
+        sizeof(size_t) <= IEEE80211_NODE_SCAN_SIZE);
+#ifdef AIRPORT
+    /* getSCAN_RESULT() builds its results in there. */
+    check("and the scan result buffer",
+        offsetof(struct ieee80211_node, verb) + sizeof(((struct
+        ieee80211_node *)0)->verb) <= IEEE80211_NODE_SCAN_SIZE);
+#endif
+}
+
+static void
+test_copy(void)
+{
+    struct ieee80211com ic;
+    struct ieee80211_node *bss, *ni;
+    CTimeout *eapol_to;
+    bool zero = true;
+    size_t i;
+
+    memset(&ic, 0, sizeof(ic));
+    bss = (struct ieee80211_node *)malloc(sizeof(*bss), 0, 0);
+    ieee80211_node_set_timeouts(bss);
+    bss->ni_tx_ba[3].ba_state = IEEE80211_BA_AGREED;
+    bss->ni_rx_ba[5].ba_winsize = 64;
+    eapol_to = bss->ni_eapol_to;
+
+    ni = scan_node(NULL, 7);
+    ni->ni_chan = (struct ieee80211_channel *)&ic;
+    ieee80211_node_copy(&ic, bss, ni);
+    check("scan entry copied into our BSS node",
+        memcmp(bss->ni_macaddr, ni->ni_macaddr, IEEE80211_ADDR_LEN) == 0 &&
+        bss->ni_esslen == 4 && bss->ni_rssi == ni->ni_rssi &&
+        bss->ni_chan == ni->ni_chan);
+    check("with a flag of its own",
+        !(bss->ni_flags & IEEE80211_NODE_SCANONLY));
+    check("and its own copy of the RSN element",
+        bss->ni_rsnie != NULL && bss->ni_rsnie != ni->ni_rsnie &&
+        memcmp(bss->ni_rsnie, rsnie, sizeof(rsnie)) == 0);
+    check("timers kept or made anew",
+        bss->ni_eapol_to == eapol_to &&
+        bss->ni_addba_req_to[EDCA_AC_BE] != NULL &&
+        bss->ni_addba_req_intval[EDCA_AC_VO] == 1);
+    for (i = 0; i < IEEE80211_NUM_TID; i++)
+        if (bss->ni_tx_ba[i].ba_state != IEEE80211_BA_INIT ||
+            bss->ni_tx_ba[i].ba_to != NULL ||
+            bss->ni_rx_ba[i].ba_state != IEEE80211_BA_INIT ||
+            bss->ni_rx_ba[i].ba_winsize != 0)
+            zero = false;
+    check("Block Ack state starts afresh", zero);
+
+    ieee80211_node_cleanup(&ic, ni);
+    kern::free(ni);
+    check("scan entry freed", true);
+
+    timeout_free(&bss->ni_eapol_to);
+    timeout_free(&bss->ni_sa_query_to);
+    ieee80211_node_cleanup(&ic, bss);
+    kern::free(bss);
+    check("no timer left behind", ntimeouts == 0);
+}
+
+static size_t
+stats_bytes(struct ieee80211com *ic, int *n)
+{
+    size_t bytes = 0;
+
+    logged.clear();
+    ieee80211_node_cache_stats(ic);
+    *n = 0;
+    sscanf(logged.c_str(), "%*[^:]: %d scan entries (%*d with driver "
+        "state), %zu bytes", n, &bytes);
+    return bytes;
+}
+
+static void
+test_stats(void)
+{
+    struct ieee80211com ic;
+    struct ieee80211_node *ni;
+    size_t slim, full, driver;
+    int i, n;
+
+    memset(&ic, 0, sizeof(ic));
+    strcpy(ic.ic_if.if_xname, "itlwm0");
+    RB_INIT(&ic.ic_tree);
+
+    for (i = 0; i < 1000; i++)
+        scan_node(&ic, i);
+    slim = stats_bytes(&ic, &n);
+    check("1000 scan entries counted", n == 1000 &&
+        slim == 1000 * (IEEE80211_NODE_SCAN_SIZE + sizeof(rsnie)));
+    flush(&ic);
+
+    /* The same BSSes as full nodes, as before scan entries. */
+    for (i = 0; i < 1000; i++) {
+        ni = (struct ieee80211_node *)malloc(sizeof(*ni), 0, 0);
+        ni->ni_macaddr[4] = i >> 8;
+        ni->ni_macaddr[5] = i;
+        ieee80211_save_ie(rsnie, &ni->ni_rsnie);
+        RB_INSERT(ieee80211_tree, &ic.ic_tree, ni);
+    }
+    full = stats_bytes(&ic, &n);
+    check("1000 full nodes counted",
+        full == 1000 * (sizeof(*ni) + sizeof(rsnie)));
+    flush(&ic);
+
+    /* A driver node carries its own state behind struct ieee80211_node. */
+    ni = (struct ieee80211_node *)malloc(sizeof(*ni) + 200, 0, 0);
+    RB_INSERT(ieee80211_tree, &ic.ic_tree, ni);
+    driver = stats_bytes(&ic, &n);
+    check("driver nodes counted with their own state",
+        driver == sizeof(*ni) + 200);
+    flush(&ic);
+
+    printf("     1000 BSSes: %zu bytes in scan entries, %zu bytes in full "
+        "nodes, %zu bytes (%zu%%) saved\n", slim, full, full - slim,
+        (full - slim) * 100 / full);
+}
+
+int
+main(void)
+{
+    test_layout();
+    test_copy();
+    test_stats();
+    return failures != 0;
+}
@@ -0,0 +1,422 @@
+/*
+ * Tests of the offload_assist word iwx_tx() hands to firmware: what
+ * iwx_tx_csum() returns for the checksum the network stack deferred and
+ * what iwx_tx_offload_hdr() adds for the 802.11 header. Frames are built
+ * for IPv4 and IPv6, TCP and UDP, with and without QoS; the L4 checksum
+ * field must be zeroed for firmware to fill in, the IP header offset must
+ * point at the IP header, and nothing else may change. The cases
+ * firmware cannot handle must fall back to a software checksum at the IP
+ * header: A-MSDUs, software encryption, firmware without the capability,
+ * an IPv4 header checksum request, IPv4 fragments, IPv6 extension
+ * headers and other protocols.
+ *
+ *   N=../itl80211/openbsd/net80211 X=../itlwm/hal_iwx
+ *   (awk -v defines="IWX_TX_CMD_OFFLD_IP_HDR IWX_TX_CMD_OFFLD_L4_EN \
+ *        IWX_TX_CMD_OFFLD_L3_EN IWX_TX_CMD_OFFLD_MH_SIZE \
+ *        IWX_TX_CMD_OFFLD_PAD IWX_TX_CMD_OFFLD_AMSDU \
+ *        IWX_UCODE_TLV_CAPA_CSUM_SUPPORT IWX_NUM_UCODE_TLV_CAPA" \
+ *        -f extract.awk $X/if_iwxreg.h) > offload_assist_defs.inc
+ *   (awk -v fns=ieee80211_csum_finalize -f extract.awk \
+ *        $N/ieee80211_output.c &&
+ *    awk -v fns="iwx_tx_offload_hdr iwx_tx_csum" -f extract.awk \
+ *        $X/ItlIwx.cpp) \
+ *       > offload_assist.inc
+ *   c++ -std=c++11 -g -fsanitize=address,undefined -I compat \
+ *       -idirafter ../itl80211/openbsd -o offload_assist_test \
+ *       offload_assist_test.cpp
+ *   ./offload_assist_test
+ */
+
+#include <sys/systm.h>
+#include <sys/endian.h>
+#include <sys/socket.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <errno.h>
+#include <stddef.h>
+
+#define letoh16(x)  le16toh(x)
+
+/* For the frame helpers ieee80211.h keeps to the kernel. */
+#define _KERNEL
+#include <net80211/ieee80211.h>
+#undef _KERNEL
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "offload_assist_defs.inc"
+
+#define LLC_SNAPFRAMELEN    8   /* <net/if_llc.h> */
+#define IPV6_VERSION        0x60    /* BSD <netinet/ip6.h> */
+
+/* <sys/kpi_mbuf.h> */
+typedef u_int32_t mbuf_csum_request_flags_t;
+typedef int mbuf_how_t;
+
+#define MBUF_DONTWAIT           1
+#define MBUF_CSUM_REQ_IP        0x0001
+#define MBUF_CSUM_REQ_TCP       0x0002
+#define MBUF_CSUM_REQ_UDP       0x0004
+#define MBUF_CSUM_REQ_TCPIPV6   0x0020
+#define MBUF_CSUM_REQ_UDPIPV6   0x0040
+
+/* A frame in one buffer and the checksums the stack left to the driver. */
+struct __mbuf {
+    std::vector<u_int8_t> m_data;
+    mbuf_csum_request_flags_t m_csum;
+};
+
+#define mtod(m, t)  ((t)(m)->m_data.data())
+
+/* Calls of mbuf_outbound_finalize(). */
+struct finalize {
+    int family;
+    size_t off;
+};
+static std::vector<struct finalize> finalized;
+
+static void
+mbuf_get_csum_requested(mbuf_t m, mbuf_csum_request_flags_t *request,
+    u_int32_t *value)
+{
+    *request = m->m_csum;
+    *value = 0;
+}
+
+static int
+mbuf_copydata(mbuf_t m, size_t off, size_t len, void *out)
+{
+    if (off + len > m->m_data.size())
+        return EINVAL;
+    memcpy(out, &m->m_data[off], len);
+    return 0;
+}
+
+static int
+mbuf_copyback(mbuf_t m, size_t off, size_t len, const void *data,
+    mbuf_how_t how)
+{
+    if (off + len > m->m_data.size())
+        return EINVAL;
+    memcpy(&m->m_data[off], data, len);
+    return 0;
+}
+
+static void
+mbuf_outbound_finalize(mbuf_t m, int family, size_t off)
+{
+    finalized.push_back({ family, off });
+}
+
+struct iwx_softc {
+    uint8_t sc_enabled_capa[howmany(IWX_NUM_UCODE_TLV_CAPA, NBBY)];
+    uint32_t sc_tx_csum_hw;
+    uint32_t sc_tx_csum_sw;
+};
+
+class ItlIwx {
+public:
+    uint16_t iwx_tx_offload_hdr(struct ieee80211_frame *, u_int);
+    uint16_t iwx_tx_csum(struct iwx_softc *, mbuf_t, u_int, int);
+};
+
+#include "offload_assist.inc"
+
+enum { L3_IPV4, L3_IPV6, L3_IPV6_HBH, L3_ARP };
+enum { L4_TCP, L4_UDP, L4_ICMP };
+
+#define SUM_SEED    0xabcd  /* what the stack left in the checksum field */
+
+struct frame {
+    bool qos, amsdu, frag, ipopts;
+    int l3, l4;
+};
+
+struct built {
+    struct __mbuf m;
+    u_int hdrlen;
+    size_t l3off;       /* IP header */
+    size_t sumoff;      /* L4 checksum field */
+};
+
+static int failures;
+static ItlIwx that;
+
+static void
+check(const char *what, bool ok)
+{
+    printf("%-4s %s\n", ok ? "ok" : "FAIL", what);
+    if (!ok)
+        failures++;
+}
+
+static void
+put(std::vector<u_int8_t> &v, const void *p, size_t len)
+{
+    v.insert(v.end(), (const u_int8_t *)p, (const u_int8_t *)p + len);
+}
+
+/* A data frame from a station to its AP, ready for iwx_tx_csum(). */
+static void
+build(const struct frame &f, struct built &b)
+{
+    struct ieee80211_qosframe qwh;
+    u_int8_t llc[LLC_SNAPFRAMELEN] = { 0xaa, 0xaa, 0x03, 0, 0, 0 };
+    u_int8_t payload[64], opts[4] = { IPOPT_NOP, IPOPT_NOP, IPOPT_NOP,
+        IPOPT_EOL };
+    u_int8_t hbh[8] = { IPPROTO_TCP, 0, IP6OPT_PADN, 4, 0, 0, 0, 0 };
+    u_int16_t type, sum = htons(SUM_SEED);
+    std::vector<u_int8_t> &d = b.m.m_data;
+    struct tcphdr th;
+    struct udphdr uh;
+    struct ip ip;
+    struct ip6_hdr ip6;
+    size_t l4len, i;
+    u_int8_t proto;
+
+    memset(&qwh, 0, sizeof(qwh));
+    qwh.i_fc[0] = IEEE80211_FC0_VERSION_0 | IEEE80211_FC0_TYPE_DATA |
+        (f.qos ? IEEE80211_FC0_SUBTYPE_QOS : IEEE80211_FC0_SUBTYPE_DATA);
+    qwh.i_fc[1] = IEEE80211_FC1_DIR_TODS | IEEE80211_FC1_PROTECTED;
+    if (f.amsdu)
+        qwh.i_qos[0] = IEEE80211_QOS_AMSDU;
+    b.hdrlen = f.qos ? sizeof(qwh) : sizeof(struct ieee80211_frame);
+
+    d.clear();
+    put(d, &qwh, b.hdrlen);
+    type = htons(f.l3 == L3_IPV4 ? ETHERTYPE_IP :
+        f.l3 == L3_ARP ? ETHERTYPE_ARP : ETHERTYPE_IPV6);
+    memcpy(&llc[6], &type, sizeof(type));
+    put(d, llc, sizeof(llc));
+    b.l3off = d.size();
+
+    proto = f.l4 == L4_TCP ? IPPROTO_TCP : f.l4 == L4_UDP ? IPPROTO_UDP :
+        IPPROTO_ICMP;
+    l4len = (f.l4 == L4_UDP ? sizeof(uh) : sizeof(th)) + sizeof(payload);
+    if (f.l3 == L3_IPV4) {
+        memset(&ip, 0, sizeof(ip));
+        ip.ip_v = 4;
+        ip.ip_hl = (sizeof(ip) + (f.ipopts ? sizeof(opts) : 0)) >> 2;
+        ip.ip_len = htons((ip.ip_hl << 2) + l4len);
+        ip.ip_off = htons(f.frag ? IP_MF : IP_DF);
+        ip.ip_ttl = 64;
+        ip.ip_p = proto;
+        put(d, &ip, sizeof(ip));
+        if (f.ipopts)
+            put(d, opts, sizeof(opts));
+    } else if (f.l3 != L3_ARP) {
+        memset(&ip6, 0, sizeof(ip6));
+        ip6.ip6_vfc = IPV6_VERSION;
+        ip6.ip6_plen = htons(l4len +
+            (f.l3 == L3_IPV6_HBH ? sizeof(hbh) : 0));
+        ip6.ip6_nxt = f.l3 == L3_IPV6_HBH ? IPPROTO_HOPOPTS : proto;
+        ip6.ip6_hlim = 64;
+        put(d, &ip6, sizeof(ip6));
+        if (f.l3 == L3_IPV6_HBH) {
+            hbh[0] = proto;
+            put(d, hbh, sizeof(hbh));
+        }
+    }
+
+    if (f.l4 == L4_UDP) {
+        memset(&uh, 0, sizeof(uh));
+        uh.uh_sport = htons(5353);
+        uh.uh_dport = htons(5353);
+        uh.uh_ulen = htons(l4len);
+        b.sumoff = d.size() + offsetof(struct udphdr, uh_sum);
+        put(d, &uh, sizeof(uh));
+    } else {
+        memset(&th, 0, sizeof(th));
+        th.th_sport = htons(49152);
+        th.th_dport = htons(443);
+        th.th_off = sizeof(th) >> 2;
+        th.th_flags = TH_ACK;
+        b.sumoff = d.size() + offsetof(struct tcphdr, th_sum);
+        put(d, &th, sizeof(th));
+    }
+    memcpy(&d[b.sumoff], &sum, sizeof(sum));
+    for (i = 0; i < sizeof(payload); i++)
+        payload[i] = i;
+    put(d, payload, sizeof(payload));
+
+    if (f.l3 == L3_IPV4)
+        b.m.m_csum = f.l4 == L4_UDP ? MBUF_CSUM_REQ_UDP : MBUF_CSUM_REQ_TCP;
+    else
+        b.m.m_csum = f.l4 == L4_UDP ? MBUF_CSUM_REQ_UDPIPV6 :
+            MBUF_CSUM_REQ_TCPIPV6;
+}
+
+static void
+softc_init(struct iwx_softc *sc, bool capa)
+{
+    memset(sc, 0, sizeof(*sc));
+    if (capa)
+        setbit(sc->sc_enabled_capa, IWX_UCODE_TLV_CAPA_CSUM_SUPPORT);
+}
+
+static void
+test_offload(void)
+{
+    static const char *l3names[] = { "IPv4", "IPv6" };
+    static const char *l4names[] = { "TCP", "UDP" };
+    struct iwx_softc sc;
+    struct frame f;
+    struct built b;
+    std::vector<u_int8_t> orig;
+    uint16_t oa, hdr, want;
+    u_int16_t sum;
+    char what[128];
+    int qos, l3, l4;
+    size_t i, ndiff;
+
+    for (qos = 0; qos < 2; qos++) {
+        for (l3 = L3_IPV4; l3 <= L3_IPV6; l3++) {
+            for (l4 = L4_TCP; l4 <= L4_UDP; l4++) {
+                memset(&f, 0, sizeof(f));
+                f.qos = qos;
+                f.l3 = l3;
+                f.l4 = l4;
+                build(f, b);
+                orig = b.m.m_data;
+                softc_init(&sc, true);
+                finalized.clear();
+
+                oa = that.iwx_tx_csum(&sc, &b.m, b.hdrlen, 1);
+                hdr = that.iwx_tx_offload_hdr(
+                    mtod(&b.m, struct ieee80211_frame *), b.hdrlen);
+                want = qos ? 0x2d44 : 0x0c44;
+                memcpy(&sum, &b.m.m_data[b.sumoff], sizeof(sum));
+                for (i = ndiff = 0; i < orig.size(); i++)
+                    ndiff += i != b.sumoff && i != b.sumoff + 1 &&
+                        orig[i] != b.m.m_data[i];
+
+                snprintf(what, sizeof(what), "%s %s %s: offload_assist "
+                    "0x%04x", qos ? "QoS" : "non-QoS", l3names[l3],
+                    l4names[l4], want);
+                check(what, (oa | hdr) == want);
+                snprintf(what, sizeof(what), "%s %s %s: IP header offset "
+                    "points at the IP header", qos ? "QoS" : "non-QoS",
+                    l3names[l3], l4names[l4]);
+                check(what, b.hdrlen + 2 * (oa & IWX_TX_CMD_OFFLD_IP_HDR(
+                    0x3f)) == b.l3off && (IWX_TX_CMD_OFFLD_MH_SIZE(0x1f) &
+                    hdr) >> 8 == b.hdrlen / 2);
+                snprintf(what, sizeof(what), "%s %s %s: only the L4 "
+                    "checksum zeroed", qos ? "QoS" : "non-QoS",
+                    l3names[l3], l4names[l4]);
+                check(what, sum == 0 && ndiff == 0);
+                snprintf(what, sizeof(what), "%s %s %s: left to firmware",
+                    qos ? "QoS" : "non-QoS", l3names[l3], l4names[l4]);
+                check(what, sc.sc_tx_csum_hw == 1 &&
+                    sc.sc_tx_csum_sw == 0 && finalized.empty());
+            }
+        }
+    }
+}
+
+/*
+ * Frame f must go to ieee80211_csum_finalize() at its IP header, untouched,
+ * with nothing offloaded.
+ */
+static void
+fallback(const char *what, const struct frame &f, bool capa, int hwcrypto,
+    mbuf_csum_request_flags_t extra)
+{
+    struct iwx_softc sc;
+    struct built b;
+    std::vector<u_int8_t> orig;
+    uint16_t oa;
+    int family;
+
+    build(f, b);
+    b.m.m_csum |= extra;
+    orig = b.m.m_data;
+    softc_init(&sc, capa);
+    finalized.clear();
+
+    oa = that.iwx_tx_csum(&sc, &b.m, b.hdrlen, hwcrypto);
+    family = f.l3 == L3_IPV4 ? PF_INET : PF_INET6;
+    check(what, oa == 0 && b.m.m_data == orig &&
+        sc.sc_tx_csum_hw == 0 && sc.sc_tx_csum_sw == 1 &&
+        (f.l3 == L3_ARP ? finalized.empty() :
+        finalized.size() == 1 && finalized[0].family == family &&
+        finalized[0].off == b.l3off));
+}
+
+static void
+test_fallback(void)
+{
+    struct iwx_softc sc;
+    struct frame f;
+    struct built b;
+    uint16_t oa;
+
+    memset(&f, 0, sizeof(f));
+    f.qos = true;
+    f.amsdu = true;
+    fallback("A-MSDU: software checksum", f, true, 1, 0);
+    build(f, b);
+    check("A-MSDU: offload_assist 0x4d00, no padding",
+        that.iwx_tx_offload_hdr(mtod(&b.m, struct ieee80211_frame *),
+        b.hdrlen) == 0x4d00);
+
+    memset(&f, 0, sizeof(f));
+    f.qos = true;
+    fallback("software crypto: software checksum", f, true, 0, 0);
+    fallback("no firmware capability: software checksum", f, false, 1, 0);
+    fallback("IPv4 header checksum requested: software checksum", f, true,
+        1, MBUF_CSUM_REQ_IP);
+    f.frag = true;
+    fallback("IPv4 fragment: software checksum", f, true, 1, 0);
+    f.frag = false;
+    f.l3 = L3_IPV6_HBH;
+    fallback("IPv6 hop-by-hop header: software checksum", f, true, 1, 0);
+    f.l3 = L3_IPV6;
+    f.l4 = L4_ICMP;
+    fallback("ICMPv6: software checksum", f, true, 1, 0);
+    f.l3 = L3_ARP;
+    f.l4 = L4_TCP;
+    fallback("not IP: nothing offloaded", f, true, 1, 0);
+
+    /* IPv4 options move the L4 header, not the IP header offset. */
+    memset(&f, 0, sizeof(f));
+    f.qos = true;
+    f.ipopts = true;
+    build(f, b);
+    softc_init(&sc, true);
+    oa = that.iwx_tx_csum(&sc, &b.m, b.hdrlen, 1);
+    check("IPv4 options: checksum after the options zeroed",
+        oa == 0x44 && b.m.m_data[b.sumoff] == 0 &&
+        b.m.m_data[b.sumoff + 1] == 0);
+
+    /* Nothing requested, or too short for an IP header. */
+    build(f, b);
+    b.m.m_csum = 0;
+    softc_init(&sc, true);
+    finalized.clear();
+    oa = that.iwx_tx_csum(&sc, &b.m, b.hdrlen, 1);
+    check("no checksum requested: nothing done",
+        oa == 0 && sc.sc_tx_csum_hw + sc.sc_tx_csum_sw == 0 &&
+        finalized.empty());
+    build(f, b);
+    b.m.m_data.resize(b.hdrlen + 4);
+    oa = that.iwx_tx_csum(&sc, &b.m, b.hdrlen, 1);
+    check("truncated frame: nothing done",
+        oa == 0 && sc.sc_tx_csum_hw + sc.sc_tx_csum_sw == 0 &&
+        finalized.empty());
+}
+
+int
+main(int argc, char **argv)
+{
+    test_offload();
+    test_fallback();
+
+    printf("%d failed\n", failures);
+    return failures != 0;
+}
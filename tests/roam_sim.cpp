@@ -0,0 +1,694 @@
+/*
+ * Walks a station past a row of APs and compares the roaming logic of
+ * ieee80211_node.c with the one it replaced.
+ *
+ * A mobility trace places the APs and gives the station position over
+ * time:
+ *
+ *   # what the trace is about
+ *   ap <id> <chan> <x> <y>
+ *   at <sec> <x> <y>
+ *
+ * The station moves in a straight line between "at" points. The RSSI of
+ * each AP follows log-distance path loss with 4 dB of shadowing that
+ * decorrelates over 5 m, 2 dB more from people moving about that
+ * decorrelates over 3 s, and fast fading on every frame. All APs are 2x2 VHT
+ * 80 MHz in one ESS, and we are a 2x2 HE station like the AX200 with iwx.
+ *
+ * A voice call sends one frame each way every 20 ms; a frame is lost with
+ * the PER of its RSSI and every frame from our AP is received like
+ * ieee80211_input() does: "roam" feeds ieee80211_roam_input() and asks
+ * ieee80211_roam_needed() whether to arm the background scan timer, and
+ * TX reports go to ieee80211_roam_txstatus(). Beacons come every 100 ms
+ * from the APs on our channel and from all APs during a scan, and go to
+ * ieee80211_roam_neighbor(). At the end of a scan "roam" chooses with
+ * ieee80211_node_choose_bss() and only moves if ieee80211_roam_better()
+ * agrees, as ieee80211_end_scan() does; "nohyst" moves to any AP
+ * ieee80211_node_choose_bss() picks. "base" is the previous logic:
+ * the scan timer follows ieee80211_node_checkrssi() of the last frame,
+ * the strongest AP is chosen and we move whenever it is not ours.
+ *
+ * Each trace runs with several seeds and prints per engine the roams,
+ * roams back to the AP we left less than 10 s before, lost voice frames,
+ * stalls (100 ms or more without a voice frame, not counting the time
+ * it takes to reassociate) and the throughput
+ * ieee80211_estimate_tput() gives for our AP at its mean RSSI, halved
+ * while scanning and zero while reassociating.
+ *
+ *   N=../itl80211/openbsd/net80211
+ *   (awk -v types="ieee80211_channel ieee80211_phymode ieee80211_opmode \
+ *        ieee80211_roam_neighbor ieee80211_roam" \
+ *        -v defines="IEEE80211_CHAN_MAX IEEE80211_CHAN_ANYC \
+ *        IEEE80211_ADDR_COPY IEEE80211_ADDR_EQ \
+ *        IEEE80211_CHAN_2GHZ IEEE80211_CHAN_5GHZ IEEE80211_CHAN_HT20 \
+ *        IEEE80211_CHAN_HT40U IEEE80211_CHAN_HT40D IEEE80211_CHAN_HT40 \
+ *        IEEE80211_IS_CHAN_2GHZ IEEE80211_IS_CHAN_5GHZ \
+ *        IEEE80211_PROTO_NONE IEEE80211_PROTO_RSN IEEE80211_F_HTON \
+ *        IEEE80211_F_VHTON IEEE80211_F_HEON \
+ *        IEEE80211_RSSI_THRES_2GHZ IEEE80211_RSSI_THRES_5GHZ \
+ *        IEEE80211_RSSI_THRES_RATIO_2GHZ IEEE80211_RSSI_THRES_RATIO_5GHZ \
+ *        IEEE80211_BGSCAN_FAIL_MAX IEEE80211_ROAM_NEIGHBORS \
+ *        IEEE80211_ROAM_NEIGHBOR_AGE IEEE80211_ROAM_PREDICT \
+ *        IEEE80211_ROAM_TXFAIL_THRES IEEE80211_ROAM_TPUT_HYST \
+ *        IEEE80211_ROAM_TPUT_HYST_WEAK IEEE80211_ROAM_NONE \
+ *        IEEE80211_ROAM_NOW IEEE80211_ROAM_EARLY" \
+ *        -f extract.awk $N/ieee80211_var.h &&
+ *    awk -v types=ieee80211_state -f extract.awk $N/ieee80211_proto.h &&
+ *    awk -v defines="IEEE80211_F_NOVHT IEEE80211_F_NOHT40" \
+ *        -f extract.awk $N/ieee80211_ioctl.h &&
+ *    awk -v types="ieee80211_rateset ieee80211_tx_ba ieee80211_rx_ba \
+ *        ieee80211_node" -v fns="ieee80211_node_supports_ht \
+ *        ieee80211_node_supports_vht ieee80211_node_supports_ht_sgi20 \
+ *        ieee80211_node_supports_ht_sgi40 \
+ *        ieee80211_node_supports_ht_chan40" \
+ *        -f extract.awk $N/ieee80211_node.h) > roam_sim_defs.inc
+ *   awk -v vars="ieee80211_mcs_min_rssi ieee80211_mcs_bits12 \
+ *        ieee80211_legacy_min_rssi" -v defines=IEEE80211_TPUT_MAX_NSS \
+ *        -v fns="ieee80211_rssi_dbm ieee80211_node_rssi_dbm \
+ *        ieee80211_tput_ht_allowed ieee80211_tput_vht_allowed \
+ *        ieee80211_tput_he_allowed ieee80211_tput_chw \
+ *        ieee80211_tput_max_mcs ieee80211_tput_phy_rate \
+ *        ieee80211_tput_legacy ieee80211_estimate_tput \
+ *        ieee80211_node_estimate_tput ieee80211_node_choose_bss \
+ *        ieee80211_node_cmp ieee80211_roam_uptime ieee80211_roam_reset \
+ *        ieee80211_roam_input ieee80211_roam_txstatus \
+ *        ieee80211_roam_neighbor ieee80211_roam_node_rssi \
+ *        ieee80211_roam_needed ieee80211_roam_better \
+ *        ieee80211_rssi_checkthres ieee80211_node_checkrssi" \
+ *        -f extract.awk $N/ieee80211_node.c > roam_sim.inc
+ *   c++ -std=c++11 -g -O1 -fsanitize=address,undefined -I compat \
+ *       -idirafter ../itl80211/openbsd -o roam_sim roam_sim.cpp
+ *   ./roam_sim [-v] [trace ...]
+ */
+
+#include <sys/systm.h>
+#include <sys/time.h>
+#include <sys/tree.h>
+
+#include <net/if.h>
+
+#include <net80211/ieee80211.h>
+#include <net80211/ieee80211_crypto.h>
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#define DPRINTF(x)
+
+class CTimeout;
+
+struct mbuf_list {
+    mbuf_t ml_head;
+    mbuf_t ml_tail;
+    u_int ml_len;
+};
+
+struct mbuf_queue {
+    void *mq_mtx;
+    struct mbuf_list mq_list;
+    u_int mq_maxlen;
+    u_int mq_drops;
+};
+
+#include "roam_sim_defs.inc"
+
+RB_HEAD(ieee80211_tree, ieee80211_node);
+
+struct _ifnet {
+    char if_xname[16];
+    int if_flags;
+};
+
+struct ieee80211com {
+    struct _ifnet ic_if;
+    struct ieee80211_tree ic_tree;
+    struct ieee80211_node *ic_bss;
+    enum ieee80211_opmode ic_opmode;
+    enum ieee80211_state ic_state;
+    u_int32_t ic_flags;
+    u_int32_t ic_userflags;
+    u_int16_t ic_modecaps;
+    u_int16_t ic_htcaps;
+    u_int8_t ic_sup_mcs[howmany(80, NBBY)];
+    struct ieee80211_he_mcs_nss_supp ic_he_mcs_nss_supp;
+    u_int8_t ic_max_rssi;
+    struct ieee80211_channel ic_channels[IEEE80211_CHAN_MAX + 1];
+    int (*ic_node_checkrssi)(struct ieee80211com *,
+        const struct ieee80211_node *);
+    struct ieee80211_roam ic_roam;
+};
+
+int ieee80211_node_cmp(const struct ieee80211_node *,
+    const struct ieee80211_node *);
+int ieee80211_rssi_checkthres(struct ieee80211com *,
+    const struct ieee80211_channel *, u_int8_t);
+RB_GENERATE_STATIC(ieee80211_tree, ieee80211_node, ni_node,
+    ieee80211_node_cmp)
+
+/* Simulated uptime in msec. */
+static u_int64_t now;
+
+static void
+getmicrouptime(struct timeval *tv)
+{
+    tv->tv_sec = now / 1000;
+    tv->tv_usec = (now % 1000) * 1000;
+}
+
+static void
+XYLog(const char *, ...)
+{
+}
+
+static const char *
+ether_sprintf(const u_int8_t *)
+{
+    return "";
+}
+
+static u_int
+ieee80211_chan2ieee(struct ieee80211com *ic, const struct ieee80211_channel *c)
+{
+    return c - ic->ic_channels;
+}
+
+static int
+ieee80211_match_bss(struct ieee80211com *, struct ieee80211_node *, int)
+{
+    return 0;
+}
+
+static void
+ieee80211_free_node(struct ieee80211com *ic, struct ieee80211_node *ni)
+{
+    RB_REMOVE(ieee80211_tree, &ic->ic_tree, ni);
+}
+
+#include "roam_sim.inc"
+
+#define STEP        10      /* msec */
+#define VOICE       20      /* msec between voice frames */
+#define BEACON      100     /* msec between beacons */
+#define SCAN        500     /* msec a background scan takes */
+#define REASSOC     150     /* msec without a link when moving */
+#define PINGPONG    10000   /* msec */
+#define STALL       5       /* lost voice frames in a row */
+
+/* The 2x2 HE station of tput_select_test, on 5 GHz only. */
+static void
+sta_init(struct ieee80211com *ic)
+{
+    int i;
+
+    memset(ic, 0, sizeof(*ic));
+    strcpy(ic->ic_if.if_xname, "itlwm0");
+    RB_INIT(&ic->ic_tree);
+    ic->ic_opmode = IEEE80211_M_STA;
+    ic->ic_state = IEEE80211_S_RUN;
+    ic->ic_flags = IEEE80211_F_HTON | IEEE80211_F_VHTON | IEEE80211_F_HEON;
+    ic->ic_modecaps = (1 << IEEE80211_MODE_11N) |
+        (1 << IEEE80211_MODE_11AC) | (1 << IEEE80211_MODE_11AX);
+    ic->ic_htcaps = IEEE80211_HTCAP_SGI20 | IEEE80211_HTCAP_SGI40 |
+        IEEE80211_HTCAP_CBW20_40;
+    ic->ic_sup_mcs[0] = ic->ic_sup_mcs[1] = 0xff;
+    ic->ic_he_mcs_nss_supp.tx_mcs_80 = htole16(0xfffa);
+    ic->ic_he_mcs_nss_supp.tx_mcs_160 = htole16(0xfffa);
+    ic->ic_max_rssi = 100 - 33;
+    ic->ic_node_checkrssi = ieee80211_node_checkrssi;
+    for (i = 36; i <= 165; i += 4) {
+        if (i == 148)
+            i = 149;
+        ic->ic_channels[i].ic_flags = IEEE80211_CHAN_5GHZ |
+            IEEE80211_CHAN_HT20 | IEEE80211_CHAN_HT40;
+    }
+}
+
+struct ap {
+    int id, chan;
+    double x, y;
+    double shadow;          /* dB, over distance */
+    double fade;            /* dB, over time */
+    struct ieee80211_node ni;
+};
+
+struct waypoint {
+    double t, x, y;
+};
+
+struct trace {
+    std::string name;
+    std::vector<ap> aps;
+    std::vector<waypoint> path;
+};
+
+/* A 2x2 VHT 80 MHz AP of the "corp" ESS. */
+static void
+ap_init(struct ieee80211com *ic, struct ap *ap)
+{
+    struct ieee80211_node *ni = &ap->ni;
+
+    memset(ni, 0, sizeof(*ni));
+    ni->ni_macaddr[0] = 0x02;
+    ni->ni_macaddr[5] = ap->id;
+    IEEE80211_ADDR_COPY(ni->ni_bssid, ni->ni_macaddr);
+    memcpy(ni->ni_essid, "corp", 4);
+    ni->ni_esslen = 4;
+    ni->ni_chan = &ic->ic_channels[ap->chan];
+    ni->ni_rates.rs_nrates = 8;
+    memcpy(ni->ni_rates.rs_rates, "\x0c\x12\x18\x24\x30\x48\x60\x6c", 8);
+    ni->ni_flags = IEEE80211_NODE_HTCAP | IEEE80211_NODE_VHTCAP;
+    ni->ni_rxmcs[0] = ni->ni_rxmcs[1] = 0xff;
+    ni->ni_htcaps = IEEE80211_HTCAP_SGI20 | IEEE80211_HTCAP_SGI40 |
+        IEEE80211_HTCAP_CBW20_40;
+    ni->ni_htop0 = IEEE80211_HTOP0_CHW;
+    ni->ni_vht_mcsinfo.rx_mcs_map = htole16(0xfffa);
+    ni->ni_vhtcaps = IEEE80211_VHTCAP_SHORT_GI_80;
+    ni->ni_vht_chanwidth = IEEE80211_VHT_CHANWIDTH_80MHZ;
+}
+
+static u_int64_t rng;
+
+static double
+uniform(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return (rng >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double
+gauss(void)
+{
+    return sqrt(-2 * log(1 - uniform())) * cos(2 * M_PI * uniform());
+}
+
+/* Mean RSSI of an AP in dBm: 18 dBm EIRP, 46 dB at 1 m, exponent 3.5. */
+static double
+mean_dbm(const struct ap *ap, double x, double y)
+{
+    double d = hypot(ap->x - x, ap->y - y);
+
+    return 18 - 46 - 35 * log10(MAX(d, 1.0)) + ap->shadow + ap->fade;
+}
+
+/* RSSI of one frame, as ni_rssi of iwx. */
+static u_int8_t
+frame_rssi(double dbm)
+{
+    dbm += 3 * gauss();
+    return (u_int8_t)MIN(MAX(lround(dbm) + 100, 0), 100);
+}
+
+/* Voice frames go at a robust rate; half are lost at -84 dBm. */
+static bool
+frame_lost(u_int8_t rssi)
+{
+    return uniform() < 1 / (1 + exp((rssi - 100 + 84) / 1.5));
+}
+
+struct result {
+    double roams, pingpong, lost, stalls, stallms, kbps;
+};
+
+enum { ENGINE_ROAM, ENGINE_NOHYST, ENGINE_BASE, ENGINES };
+static const char *const engines[] = { "roam", "nohyst", "base" };
+static bool verbose;
+
+/* The strongest AP of a scan, which ieee80211_node_choose_bss() took. */
+static struct ieee80211_node *
+choose_strongest(struct ieee80211com *ic)
+{
+    struct ieee80211_node *ni, *selbs = NULL;
+
+    RB_FOREACH(ni, ieee80211_tree, &ic->ic_tree)
+        if (selbs == NULL || ni->ni_rssi > selbs->ni_rssi)
+            selbs = ni;
+    return selbs;
+}
+
+static void
+run(const struct trace &tr, int engine, u_int64_t seed, struct result *res)
+{
+    struct ieee80211com ic;
+    struct ieee80211_node bss, *selbs, *curbs;
+    std::vector<ap> aps = tr.aps;
+    u_int64_t end, bgscan = 0, scanend = 0, linkup = 0, left = 0;
+    double x, y, dx, dy, a;
+    size_t i, w = 0, cur = 0, prev = SIZE_MAX;
+    int bgscan_fail = 0, inrow = 0, nsamples = 0;
+    u_int8_t rssi;
+    bool lost;
+
+    sta_init(&ic);
+    rng = seed * 0x9e3779b97f4a7c15ULL + 1;
+    for (ap &ap : aps) {
+        ap_init(&ic, &ap);
+        ap.shadow = 4 * gauss();
+        ap.fade = 2 * gauss();
+    }
+    end = (u_int64_t)(tr.path.back().t * 1000);
+    memset(res, 0, sizeof(*res));
+
+    x = tr.path[0].x;
+    y = tr.path[0].y;
+    for (i = 1; i < aps.size(); i++)
+        if (mean_dbm(&aps[i], x, y) > mean_dbm(&aps[cur], x, y))
+            cur = i;
+    bss = aps[cur].ni;
+    ic.ic_bss = &bss;
+
+    for (now = 1000; now < end + 1000; now += STEP) {
+        while (w + 1 < tr.path.size() && tr.path[w + 1].t * 1000 <= now - 1000)
+            w++;
+        dx = x;
+        dy = y;
+        if (w + 1 < tr.path.size()) {
+            a = ((now - 1000) / 1000.0 - tr.path[w].t) /
+                (tr.path[w + 1].t - tr.path[w].t);
+            x = tr.path[w].x + a * (tr.path[w + 1].x - tr.path[w].x);
+            y = tr.path[w].y + a * (tr.path[w + 1].y - tr.path[w].y);
+        }
+        a = exp(-hypot(x - dx, y - dy) / 5);
+        for (ap &ap : aps)
+            ap.shadow = a * ap.shadow + sqrt(1 - a * a) * 4 * gauss();
+        a = exp(-STEP / 3000.0);
+        for (ap &ap : aps)
+            ap.fade = a * ap.fade + sqrt(1 - a * a) * 2 * gauss();
+
+        if (now < linkup) {
+            if (now % VOICE == 0)
+                res->lost += 2;
+            nsamples++;
+            continue;
+        }
+
+        if (scanend != 0 && now >= scanend) {
+            scanend = 0;
+            for (ap &ap : aps) {
+                rssi = frame_rssi(mean_dbm(&ap, x, y));
+                if (rssi < 100 - 92)
+                    continue;
+                ap.ni.ni_rssi = rssi;
+                RB_INSERT(ieee80211_tree, &ic.ic_tree, &ap.ni);
+                if (engine != ENGINE_BASE)
+                    ieee80211_roam_neighbor(&ic, &ap.ni);
+            }
+            curbs = NULL;
+            if (engine != ENGINE_BASE) {
+                selbs = ieee80211_node_choose_bss(&ic, 1, &curbs);
+                if (engine == ENGINE_ROAM && selbs != NULL &&
+                    curbs != NULL && selbs != curbs &&
+                    !ieee80211_roam_better(&ic, curbs, selbs))
+                    selbs = curbs;
+            } else {
+                selbs = choose_strongest(&ic);
+                RB_FOREACH(curbs, ieee80211_tree, &ic.ic_tree)
+                    if (ieee80211_node_cmp(&bss, curbs) == 0)
+                        break;
+            }
+            while ((curbs = RB_MIN(ieee80211_tree, &ic.ic_tree)) != NULL)
+                RB_REMOVE(ieee80211_tree, &ic.ic_tree, curbs);
+
+            if (selbs == NULL || selbs == &aps[cur].ni) {
+                if (bgscan_fail < IEEE80211_BGSCAN_FAIL_MAX)
+                    bgscan_fail++;
+            } else {
+                for (i = 0; &aps[i].ni != selbs; i++)
+                    ;
+                if (i == prev && now - left < PINGPONG)
+                    res->pingpong++;
+                if (verbose)
+                    printf("     %6.1fs %s AP %d -> AP %d at %.0f m %.0f dBm\n",
+                        (now - 1000) / 1000.0, engines[engine],
+                        aps[cur].id, aps[i].id, x, mean_dbm(&aps[cur], x, y));
+                if (inrow >= STALL) {
+                    res->stalls++;
+                    res->stallms += inrow * VOICE / 2;
+                }
+                inrow = 0;
+                prev = cur;
+                left = now;
+                cur = i;
+                bss = aps[cur].ni;
+                bgscan_fail = 0;
+                ieee80211_roam_reset(&ic);
+                res->roams++;
+                linkup = now + REASSOC;
+                continue;
+            }
+        }
+        if (bgscan != 0 && now >= bgscan) {
+            bgscan = 0;
+            scanend = now + SCAN;
+        }
+
+        nsamples++;
+        res->kbps += ieee80211_estimate_tput(&ic, &aps[cur].ni,
+            lround(mean_dbm(&aps[cur], x, y))) / (scanend ? 2 : 1);
+
+        if (now % VOICE == 0) {
+            /* Our frame and the reply. */
+            lost = frame_lost(frame_rssi(mean_dbm(&aps[cur], x, y)));
+            if (engine != ENGINE_BASE)
+                ieee80211_roam_txstatus(&ic, 1, lost);
+            res->lost += lost;
+            rssi = frame_rssi(mean_dbm(&aps[cur], x, y));
+            if (frame_lost(rssi)) {
+                res->lost++;
+                inrow += 1 + lost;
+            } else {
+                if (inrow >= STALL) {
+                    res->stalls++;
+                    res->stallms += inrow * VOICE / 2;
+                }
+                inrow = lost;
+                bss.ni_rssi = rssi;
+                if (engine != ENGINE_BASE) {
+                    ieee80211_roam_input(&ic, &bss);
+                    if (ieee80211_roam_needed(&ic) == IEEE80211_ROAM_NONE)
+                        bgscan = 0;
+                    else if (bgscan == 0 && scanend == 0)
+                        bgscan = now + 500 * (bgscan_fail + 1);
+                } else {
+                    if (ieee80211_node_checkrssi(&ic, &bss))
+                        bgscan = 0;
+                    else if (bgscan == 0 && scanend == 0)
+                        bgscan = now + 500 * (bgscan_fail + 1);
+                }
+            }
+        }
+
+        if (now % BEACON == 0 && engine != ENGINE_BASE) {
+            for (ap &ap : aps) {
+                if (&ap == &aps[cur] || ap.chan != aps[cur].chan)
+                    continue;
+                rssi = frame_rssi(mean_dbm(&ap, x, y));
+                if (frame_lost(rssi))
+                    continue;
+                ap.ni.ni_rssi = rssi;
+                ieee80211_roam_neighbor(&ic, &ap.ni);
+            }
+        }
+    }
+    if (inrow >= STALL) {
+        res->stalls++;
+        res->stallms += inrow * VOICE / 2;
+    }
+    res->lost = res->lost * 100 / (2 * nsamples * STEP / VOICE);
+    res->kbps /= nsamples;
+}
+
+static int failures;
+
+static void
+check(const char *what, bool ok)
+{
+    printf("%-4s %s\n", ok ? "ok" : "FAIL", what);
+    if (!ok)
+        failures++;
+}
+
+#define SEEDS   40
+
+/* Average the runs of a trace over SEEDS seeds for each engine. */
+static void
+replay(const struct trace &tr, struct result res[ENGINES])
+{
+    struct result r;
+    int e, s;
+
+    printf("%s\n", tr.name.c_str());
+    printf("     engine roams back  lost%% stalls stall-ms  Mbit/s\n");
+    for (e = 0; e < ENGINES; e++) {
+        memset(&res[e], 0, sizeof(res[e]));
+        for (s = 0; s < SEEDS; s++) {
+            run(tr, e, s, &r);
+            res[e].roams += r.roams / SEEDS;
+            res[e].pingpong += r.pingpong / SEEDS;
+            res[e].lost += r.lost / SEEDS;
+            res[e].stalls += r.stalls / SEEDS;
+            res[e].stallms += r.stallms / SEEDS;
+            res[e].kbps += r.kbps / SEEDS;
+        }
+        printf("     %-6s %5.1f %4.1f %5.2f %6.1f %8.0f %7.1f\n", engines[e],
+            res[e].roams, res[e].pingpong, res[e].lost, res[e].stalls,
+            res[e].stallms, res[e].kbps / 1000);
+    }
+}
+
+static bool
+parse(const std::vector<std::string> &lines, struct trace &tr, std::string &err)
+{
+    struct ap ap;
+    struct waypoint wp;
+    int lineno = 0;
+
+    err.clear();
+    for (const std::string &l : lines) {
+        lineno++;
+        if (l.empty())
+            continue;
+        if (l[0] == '#') {
+            tr.name = l.substr(l.find_first_not_of("# "));
+        } else if (sscanf(l.c_str(), "ap %d %d %lf %lf", &ap.id, &ap.chan,
+            &ap.x, &ap.y) == 4) {
+            if (ap.id < 1 || ap.id > 255 || ap.chan < 36 || ap.chan > 165 ||
+                (ap.chan < 149 && ap.chan % 4 != 0) ||
+                (ap.chan >= 149 && ap.chan % 4 != 1)) {
+                err = "bad AP";
+                break;
+            }
+            tr.aps.push_back(ap);
+        } else if (sscanf(l.c_str(), "at %lf %lf %lf", &wp.t, &wp.x,
+            &wp.y) == 3) {
+            if (!tr.path.empty() && wp.t <= tr.path.back().t) {
+                err = "time goes back";
+                break;
+            }
+            tr.path.push_back(wp);
+        } else {
+            err = "unknown line";
+            break;
+        }
+    }
+    if (err.empty() && (tr.aps.size() < 2 || tr.path.size() < 2))
+        err = "need two APs and two points";
+    else if (!err.empty())
+        err = "line " + std::to_string(lineno) + ": " + err;
+    return err.empty();
+}
+
+/*
+ * APs 30 m apart along a corridor, 4 m to the side, on two channels so
+ * that we hear every other AP between scans.
+ */
+#define CORRIDOR \
+    "ap 1 36 0 4", "ap 2 149 30 4", "ap 3 36 60 4", "ap 4 149 90 4"
+
+static const char *const walk[] = {
+    "# walking down the corridor",
+    CORRIDOR,
+    "at 0 -5 0",
+    "at 80 95 0",
+};
+
+static const char *const edge[] = {
+    "# standing between two APs",
+    CORRIDOR,
+    "at 0 15 0",
+    "at 60 15 0",
+};
+
+static const char *const stopgo[] = {
+    "# walking, stopping at a desk, walking back",
+    CORRIDOR,
+    "at 0 0 0",
+    "at 35 42 0",
+    "at 65 42 0",
+    "at 100 0 0",
+};
+
+static const char *const fast[] = {
+    "# riding a cart down the corridor",
+    CORRIDOR,
+    "at 0 -5 0",
+    "at 25 95 0",
+};
+
+int
+main(int argc, char **argv)
+{
+    struct result res[ENGINES];
+    std::vector<std::string> lines;
+    struct trace tr;
+    std::string err;
+    char buf[512];
+    FILE *fp;
+    int i;
+
+    for (i = 1; i < argc && strcmp(argv[i], "-v") == 0; i++)
+        verbose = true;
+
+#define BUILTIN(t) \
+    tr = trace(); \
+    parse(std::vector<std::string>(t, t + nitems(t)), tr, err); \
+    replay(tr, res)
+
+    /*
+     * Moving through the cells we have to roam at least once per AP
+     * passed. Starting the scan on the smoothed RSSI and its trend
+     * rather than on the last frame must not cost voice frames.
+     */
+    BUILTIN(walk);
+    check("walk: roams along the corridor", res[ENGINE_ROAM].roams >= 3);
+    check("walk: no more lost voice than before",
+        res[ENGINE_ROAM].lost <= res[ENGINE_BASE].lost);
+
+    /*
+     * At the cell edge we keep scanning, and without the margin of
+     * ieee80211_roam_better() every change in shadowing moves us.
+     */
+    BUILTIN(edge);
+    check("edge: fewer roams than without hysteresis",
+        res[ENGINE_ROAM].roams < res[ENGINE_NOHYST].roams / 2);
+    check("edge: fewer roams back than without hysteresis",
+        res[ENGINE_ROAM].pingpong < res[ENGINE_NOHYST].pingpong / 2);
+
+    BUILTIN(stopgo);
+    check("stop and go: fewer roams than without hysteresis",
+        res[ENGINE_ROAM].roams < res[ENGINE_NOHYST].roams);
+    check("stop and go: no more lost voice than before",
+        res[ENGINE_ROAM].lost <= res[ENGINE_BASE].lost);
+
+    BUILTIN(fast);
+    check("cart: no more lost voice than before",
+        res[ENGINE_ROAM].lost <= res[ENGINE_BASE].lost);
+
+    for (; i < argc; i++) {
+        if ((fp = fopen(argv[i], "r")) == NULL) {
+            perror(argv[i]);
+            return 2;
+        }
+        lines.clear();
+        while (fgets(buf, sizeof(buf), fp) != NULL) {
+            buf[strcspn(buf, "\r\n")] = '\0';
+            lines.push_back(buf);
+        }
+        fclose(fp);
+        tr = trace();
+        tr.name = argv[i];
+        if (!parse(lines, tr, err)) {
+            check((std::string(argv[i]) + ": " + err).c_str(), false);
+            continue;
+        }
+        replay(tr, res);
+    }
+
+    printf("%d failed\n", failures);
+    return failures != 0;
+}
@@ -0,0 +1,197 @@
+/*
+ * Microbenchmark of the iwx RSS receive split (iwx_intr_rxq() and
+ * iwx_rxq_deliver()), modelled in userspace.
+ *
+ * Each RSS queue thread plays both the device, which fills a receive
+ * buffer, and the queue work loop, which takes the buffer off the ring,
+ * allocates and touches its replacement and hands the filled buffer to
+ * a single delivery thread under a spinlock.  The delivery thread stands
+ * for the driver work loop: it parses each buffer and checks that frames
+ * of every queue arrive in ring order.  The baseline does all of this on
+ * one thread, like a single Rx queue does.  Buffer and parse costs are
+ * rough stand-ins, so only the scaling between the two runs means
+ * anything, not the absolute rates.
+ *
+ *   c++ -std=c++11 -O2 -pthread -o rss_rxq_bench rss_rxq_bench.cpp
+ *   ./rss_rxq_bench [queues] [buffers per queue]
+ */
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RBUF_SIZE       4096
+#define RING_COUNT      512
+#define PARSE_BYTES     128     /* descriptor and 802.11 header */
+
+struct rbuf {
+    struct rbuf *next;
+    uint32_t qid;
+    uint64_t seq;
+    uint8_t data[RBUF_SIZE - 24];
+};
+
+struct pending {
+    std::atomic_flag lock = ATOMIC_FLAG_INIT;
+    struct rbuf *head = NULL, **tailp = &head;
+    char pad[64];
+};
+
+static std::vector<pending> queues;
+static std::atomic<int> producers;
+static std::atomic<uint64_t> sink;
+static uint64_t order_errors;
+
+static struct rbuf *
+rbuf_alloc(void)
+{
+    struct rbuf *rb = (struct rbuf *)malloc(sizeof(*rb));
+
+    /* The device writes the whole buffer; make the pages resident. */
+    memset(rb, 0, sizeof(*rb));
+    return rb;
+}
+
+static void
+rbuf_fill(struct rbuf *rb, uint32_t qid, uint64_t seq)
+{
+    rb->qid = qid;
+    rb->seq = seq;
+    for (int i = 0; i < PARSE_BYTES; i++)
+        rb->data[i] = (uint8_t)(seq + i);
+}
+
+/* Stand-in for descriptor parsing, reordering and net80211 input. */
+static void
+rbuf_process(struct rbuf *rb, std::vector<uint64_t> &next)
+{
+    uint64_t sum = 0;
+
+    if (rb->seq != next[rb->qid])
+        order_errors++;
+    next[rb->qid] = rb->seq + 1;
+    for (int i = 0; i < PARSE_BYTES; i++)
+        sum = sum * 31 + rb->data[i];
+    sink += sum;
+    free(rb);
+}
+
+static void
+queue_loop(uint32_t qid, uint64_t nbufs)
+{
+    std::vector<struct rbuf *> ring(RING_COUNT);
+    pending *p = &queues[qid];
+
+    for (auto &rb : ring)
+        rb = rbuf_alloc();
+    for (uint64_t seq = 0; seq < nbufs; seq++) {
+        int idx = seq % RING_COUNT;
+        struct rbuf *rb = ring[idx];
+
+        rbuf_fill(rb, qid, seq);
+        ring[idx] = rbuf_alloc();
+        rb->next = NULL;
+        while (p->lock.test_and_set(std::memory_order_acquire))
+            std::this_thread::yield();
+        *p->tailp = rb;
+        p->tailp = &rb->next;
+        p->lock.clear(std::memory_order_release);
+    }
+    for (auto rb : ring)
+        free(rb);
+    producers--;
+}
+
+static void
+deliver_loop(uint32_t nqueues)
+{
+    std::vector<uint64_t> next(nqueues);
+    bool more = true;
+
+    while (more) {
+        bool idle = true;
+
+        more = producers > 0;
+        for (uint32_t qid = 0; qid < nqueues; qid++) {
+            pending *p = &queues[qid];
+            struct rbuf *rb, *nrb;
+
+            while (p->lock.test_and_set(std::memory_order_acquire))
+                std::this_thread::yield();
+            rb = p->head;
+            p->head = NULL;
+            p->tailp = &p->head;
+            p->lock.clear(std::memory_order_release);
+            for (; rb != NULL; rb = nrb, idle = false) {
+                nrb = rb->next;
+                rbuf_process(rb, next);
+            }
+        }
+        if (idle)
+            std::this_thread::yield();
+    }
+}
+
+static double
+run_single(uint64_t nbufs)
+{
+    std::vector<struct rbuf *> ring(RING_COUNT);
+    std::vector<uint64_t> next(1);
+    auto t0 = std::chrono::steady_clock::now();
+
+    for (auto &rb : ring)
+        rb = rbuf_alloc();
+    for (uint64_t seq = 0; seq < nbufs; seq++) {
+        int idx = seq % RING_COUNT;
+        struct rbuf *rb = ring[idx];
+
+        rbuf_fill(rb, 0, seq);
+        ring[idx] = rbuf_alloc();
+        rbuf_process(rb, next);
+    }
+    for (auto rb : ring)
+        free(rb);
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+static double
+run_rss(uint32_t nqueues, uint64_t nbufs)
+{
+    std::vector<std::thread> threads;
+    auto t0 = std::chrono::steady_clock::now();
+
+    queues = std::vector<pending>(nqueues);
+    producers = nqueues;
+    for (uint32_t qid = 0; qid < nqueues; qid++)
+        threads.emplace_back(queue_loop, qid, nbufs);
+    deliver_loop(nqueues);
+    for (auto &t : threads)
+        t.join();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+int
+main(int argc, char **argv)
+{
+    uint32_t nqueues = argc > 1 ? atoi(argv[1]) : 2;
+    uint64_t nbufs = argc > 2 ? strtoull(argv[2], NULL, 0) : 500000;
+    double t1, tn;
+
+    if (nqueues < 1 || nbufs < 1) {
+        fprintf(stderr, "usage: %s [queues] [buffers per queue]\n", argv[0]);
+        return 2;
+    }
+
+    t1 = run_single(nbufs * nqueues);
+    tn = run_rss(nqueues, nbufs);
+    printf("single queue:     %8.0f kbuf/s\n", nbufs * nqueues / t1 / 1000);
+    printf("%u RSS queue(s):   %8.0f kbuf/s (%.2fx)\n", nqueues,
+        nbufs * nqueues / tn / 1000, t1 / tn);
+    printf("out of order:     %llu\n", (unsigned long long)order_errors);
+    return order_errors != 0;
+}
@@ -0,0 +1,356 @@
+/*
+ * Runs repeated scans of simulated radio environments and compares how
+ * long they take and how many of the APs present they find, with fixed
+ * dwell times and with those learned by ieee80211_scan_dwell() and
+ * ieee80211_scan_naps().
+ *
+ * An environment gives the number of APs on each channel; DFS channels
+ * are scanned passively. After the probe request every AP of an active
+ * channel answers with a probability of 90%, after a processing delay of
+ * 1 ms plus an exponential one of 5 ms mean, and the answers go out one
+ * after the other: 1 ms each on 2 GHz, where a third of the APs answer
+ * at 1 Mbit/s and take 3 ms, and 0.4 ms each on 5 GHz. A passive channel
+ * hears 90% of its APs. Switching channels takes 2 ms.
+ *
+ * "iwn" sets the active dwell of each channel, 36 ms on 2 GHz and 24 ms
+ * on 5 GHz as iwn_get_active_dwell_time() gives them, or what
+ * ieee80211_scan_dwell() makes of it, as iwn_scan() does. "iwx" leaves
+ * the dwell to firmware: we take it to leave a channel 10 ms after the
+ * probe if nothing answered, 2 ms after the answer which makes the
+ * expected number of APs, or at 110 ms; the expected number is the
+ * driver's default or what ieee80211_scan_naps() returns.
+ *
+ * Every environment is scanned 8 times, the first time without any
+ * history, and the APs heard feed ieee80211_chanstat_end_scan(). For each
+ * engine the first and the average of the later scans are printed.
+ *
+ *   N=../itl80211/openbsd/net80211
+ *   (awk -v types="ieee80211_channel ieee80211_opmode \
+ *        ieee80211_chanhist_ess ieee80211_chanhist ieee80211_chanstat" \
+ *        -v defines="IEEE80211_CHAN_MAX IEEE80211_CHAN_ANYC \
+ *        IEEE80211_CHAN_2GHZ IEEE80211_CHAN_5GHZ IEEE80211_CHAN_PASSIVE \
+ *        IEEE80211_IS_CHAN_2GHZ IEEE80211_CHANHIST_ESS \
+ *        IEEE80211_SCAN_NAPS_MAX" \
+ *        -f extract.awk $N/ieee80211_var.h &&
+ *    awk -v defines="IWN_ACTIVE_DWELL_TIME_2GHZ IWN_ACTIVE_DWELL_TIME_5GHZ \
+ *        IWN_ACTIVE_DWELL_FACTOR_2GHZ IWN_ACTIVE_DWELL_FACTOR_5GHZ" \
+ *        -f extract.awk ../itlwm/hal_iwn/if_iwnreg.h &&
+ *    awk -v defines="IWX_SCAN_ADWELL_DEFAULT_HB_N_APS \
+ *        IWX_SCAN_ADWELL_DEFAULT_LB_N_APS" \
+ *        -f extract.awk ../itlwm/hal_iwx/ItlIwx.cpp) > scan_dwell_defs.inc
+ *   awk -v fns="ieee80211_chan_scanned ieee80211_chanstat_weight \
+ *        ieee80211_chanstat_end_scan ieee80211_scan_dwell \
+ *        ieee80211_scan_naps" -f extract.awk $N/ieee80211_node.c \
+ *       > scan_dwell.inc
+ *   c++ -std=c++11 -g -fsanitize=address,undefined -I compat \
+ *       -idirafter ../itl80211/openbsd -o scan_dwell_sim scan_dwell_sim.cpp
+ *   ./scan_dwell_sim
+ */
+
+#include <sys/systm.h>
+#include <sys/tree.h>
+
+#include <net80211/ieee80211.h>
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "scan_dwell_defs.inc"
+
+struct ieee80211_node {
+    RB_ENTRY(ieee80211_node) ni_node;
+    u_int8_t ni_macaddr[IEEE80211_ADDR_LEN];
+    struct ieee80211_channel *ni_chan;
+    u_int ni_scanseq;
+};
+
+RB_HEAD(ieee80211_tree, ieee80211_node);
+
+struct ieee80211com {
+    enum ieee80211_opmode ic_opmode;
+    struct ieee80211_tree ic_tree;
+    struct ieee80211_chanhist ic_chanhist;
+    struct ieee80211_chanstat ic_chanstat[IEEE80211_CHAN_MAX + 1];
+    u_int ic_scanseq;
+    struct ieee80211_channel ic_channels[IEEE80211_CHAN_MAX + 1];
+};
+
+static int
+node_cmp(const struct ieee80211_node *a, const struct ieee80211_node *b)
+{
+    return memcmp(a->ni_macaddr, b->ni_macaddr, IEEE80211_ADDR_LEN);
+}
+
+RB_GENERATE_STATIC(ieee80211_tree, ieee80211_node, ni_node, node_cmp)
+
+static u_int
+ieee80211_chan2ieee(struct ieee80211com *ic, const struct ieee80211_channel *c)
+{
+    return c - ic->ic_channels;
+}
+
+#include "scan_dwell.inc"
+
+#define SCANS       8
+#define SEEDS       50
+#define SWITCH      2.0     /* msec to change channels */
+#define PASSIVE     110.0   /* msec on a passive channel */
+#define ADWELL_MAX  110.0   /* msec at most on an active channel */
+#define ADWELL_IDLE 10.0    /* msec to wait for a first answer */
+#define ADWELL_DONE 2.0     /* msec to stay after the last expected one */
+
+static u_int64_t rng;
+
+static double
+uniform(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return (rng >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * 2 GHz channels 1-13, 5 GHz 36-48 and 149-165 scanned actively, 52-144
+ * passively.
+ */
+static void
+sta_init(struct ieee80211com *ic)
+{
+    int i;
+
+    memset(ic, 0, sizeof(*ic));
+    ic->ic_opmode = IEEE80211_M_STA;
+    RB_INIT(&ic->ic_tree);
+    for (i = 1; i <= 13; i++)
+        ic->ic_channels[i].ic_flags = IEEE80211_CHAN_2GHZ;
+    for (i = 36; i <= 165; i += 4) {
+        if (i == 148)
+            i = 149;
+        ic->ic_channels[i].ic_flags = IEEE80211_CHAN_5GHZ;
+        if (i >= 52 && i <= 144)
+            ic->ic_channels[i].ic_flags |= IEEE80211_CHAN_PASSIVE;
+    }
+}
+
+/* iwn_get_active_dwell_time() for one probe request. */
+static u_int
+iwn_active_dwell(const struct ieee80211_channel *c)
+{
+    if (IEEE80211_IS_CHAN_2GHZ(c))
+        return IWN_ACTIVE_DWELL_TIME_2GHZ + IWN_ACTIVE_DWELL_FACTOR_2GHZ * 2;
+    return IWN_ACTIVE_DWELL_TIME_5GHZ + IWN_ACTIVE_DWELL_FACTOR_5GHZ * 2;
+}
+
+/* When the probe responses of n APs arrive, msec after the probe. */
+static std::vector<double>
+answers(int n, bool is2ghz)
+{
+    std::vector<double> ready, at;
+    double t = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+        if (uniform() < 0.9)
+            ready.push_back(1 - 5 * log(1 - uniform()));
+    std::sort(ready.begin(), ready.end());
+    for (double r : ready) {
+        t = MAX(t, r) + (is2ghz ? (uniform() < 1.0 / 3 ? 3 : 1) : 0.4);
+        at.push_back(t);
+    }
+    return at;
+}
+
+enum { IWN_FIXED, IWN_LEARNED, IWX_DEFAULT, IWX_LEARNED, ENGINES };
+static const char *const engines[] = {
+    "iwn fixed", "iwn learned", "iwx default", "iwx learned"
+};
+
+struct result {
+    double msec, found, present;
+};
+
+/*
+ * One scan of env with the given engine. The APs heard are entered into
+ * the node tree for ieee80211_chanstat_end_scan().
+ */
+static void
+scan(struct ieee80211com *ic, const u_int8_t *env, int engine,
+    struct result *res)
+{
+    struct ieee80211_channel *c;
+    struct ieee80211_node *ni;
+    std::vector<double> at;
+    double dwell;
+    u_int naps = 0;
+    int chan, i, heard;
+
+    for (chan = 1; chan <= IEEE80211_CHAN_MAX; chan++) {
+        c = &ic->ic_channels[chan];
+        if (c->ic_flags == 0)
+            continue;
+        res->present += env[chan];
+        res->msec += SWITCH;
+
+        if (c->ic_flags & IEEE80211_CHAN_PASSIVE) {
+            res->msec += PASSIVE;
+            for (heard = i = 0; i < env[chan]; i++)
+                heard += uniform() < 0.9;
+        } else {
+            at = answers(env[chan], IEEE80211_IS_CHAN_2GHZ(c));
+            switch (engine) {
+            case IWN_FIXED:
+                dwell = iwn_active_dwell(c);
+                break;
+            case IWN_LEARNED:
+                dwell = iwn_active_dwell(c);
+                dwell = ieee80211_scan_dwell(ic, c, dwell, dwell / 2,
+                    dwell * 2);
+                break;
+            default:
+                if (IEEE80211_IS_CHAN_2GHZ(c))
+                    naps = IWX_SCAN_ADWELL_DEFAULT_LB_N_APS;
+                else
+                    naps = IWX_SCAN_ADWELL_DEFAULT_HB_N_APS;
+                if (engine == IWX_LEARNED)
+                    naps = ieee80211_scan_naps(ic,
+                        c->ic_flags & (IEEE80211_CHAN_2GHZ |
+                        IEEE80211_CHAN_5GHZ), naps);
+                if (at.empty() || at[0] > ADWELL_IDLE)
+                    dwell = ADWELL_IDLE;
+                else if (at.size() >= naps)
+                    dwell = MIN(at[naps - 1] + ADWELL_DONE, ADWELL_MAX);
+                else
+                    dwell = ADWELL_MAX;
+                break;
+            }
+            res->msec += dwell;
+            for (heard = 0; heard < (int)at.size() && at[heard] <= dwell;
+                heard++)
+                ;
+        }
+        res->found += heard;
+
+        for (i = 0; i < heard; i++) {
+            ni = (struct ieee80211_node *)calloc(1, sizeof(*ni));
+            ni->ni_macaddr[4] = chan;
+            ni->ni_macaddr[5] = i;
+            ni->ni_chan = c;
+            ni->ni_scanseq = ic->ic_scanseq;
+            RB_INSERT(ieee80211_tree, &ic->ic_tree, ni);
+        }
+    }
+    ieee80211_chanstat_end_scan(ic);
+    while ((ni = RB_MIN(ieee80211_tree, &ic->ic_tree)) != NULL) {
+        RB_REMOVE(ieee80211_tree, &ic->ic_tree, ni);
+        free(ni);
+    }
+}
+
+/* First scan and the later ones of each engine, over SEEDS seeds. */
+static void
+run(const char *name, const u_int8_t *env, struct result first[ENGINES],
+    struct result later[ENGINES])
+{
+    struct ieee80211com ic;
+    struct result r, *to;
+    int e, s, n;
+
+    printf("%s\n", name);
+    printf("     engine       first ms  found%%  later ms  found%%\n");
+    for (e = 0; e < ENGINES; e++) {
+        memset(&first[e], 0, sizeof(first[e]));
+        memset(&later[e], 0, sizeof(later[e]));
+        for (s = 0; s < SEEDS; s++) {
+            sta_init(&ic);
+            rng = s * 0x9e3779b97f4a7c15ULL + 1;
+            for (n = 0; n < SCANS; n++) {
+                memset(&r, 0, sizeof(r));
+                scan(&ic, env, e, &r);
+                to = n == 0 ? &first[e] : &later[e];
+                to->msec += r.msec;
+                to->found += r.found;
+                to->present += r.present;
+            }
+        }
+        first[e].msec /= SEEDS;
+        later[e].msec /= SEEDS * (SCANS - 1);
+        printf("     %-12s %8.0f %7.1f %9.0f %7.1f\n", engines[e],
+            first[e].msec, 100 * first[e].found / first[e].present,
+            later[e].msec, 100 * later[e].found / later[e].present);
+    }
+}
+
+static int failures;
+
+static void
+check(const char *what, bool ok)
+{
+    printf("%-4s %s\n", ok ? "ok" : "FAIL", what);
+    if (!ok)
+        failures++;
+}
+
+static double
+recall(const struct result *r)
+{
+    return r->found / r->present;
+}
+
+/* Per channel AP counts of an environment, as "chan:naps" pairs. */
+static void
+env_init(u_int8_t *env, const char *desc)
+{
+    int chan, n, len;
+
+    memset(env, 0, IEEE80211_CHAN_MAX + 1);
+    while (sscanf(desc, "%d:%d%n", &chan, &n, &len) == 2) {
+        env[chan] = n;
+        desc += len;
+    }
+}
+
+int
+main(void)
+{
+    struct result first[ENGINES], later[ENGINES];
+    u_int8_t env[IEEE80211_CHAN_MAX + 1];
+
+    /* Crowded 2 GHz band, few APs on 5 GHz. */
+    env_init(env, "1:9 3:1 6:14 9:1 11:11 36:4 44:3 149:2 157:1");
+    run("apartment block", env, first, later);
+    check("apartment: learned dwell finds no fewer on iwn",
+        recall(&later[IWN_LEARNED]) >= recall(&later[IWN_FIXED]));
+    check("apartment: learned dwell takes no longer on iwn",
+        later[IWN_LEARNED].msec <= later[IWN_FIXED].msec * 1.05);
+    check("apartment: learned AP count finds 80% on iwx",
+        recall(&later[IWX_LEARNED]) >= 0.8);
+
+    /* An enterprise network on every 5 GHz channel. */
+    env_init(env, "1:6 6:8 11:6 36:10 40:9 44:10 48:8 52:3 56:3 "
+        "60:2 64:3 100:2 104:2 108:2 112:1 116:2 132:1 136:2 149:7 "
+        "153:8 157:7 161:6 165:2");
+    run("office", env, first, later);
+    check("office: learned dwell finds no fewer on iwn",
+        recall(&later[IWN_LEARNED]) >= recall(&later[IWN_FIXED]));
+    check("office: learned dwell takes no longer on iwn",
+        later[IWN_LEARNED].msec <= later[IWN_FIXED].msec * 1.05);
+    check("office: learned AP count finds more on iwx",
+        recall(&later[IWX_LEARNED]) > recall(&later[IWX_DEFAULT]));
+    check("office: learned AP count costs iwx at most a quarter more",
+        later[IWX_LEARNED].msec <= later[IWX_DEFAULT].msec * 1.25);
+
+    /* One AP on each band: nothing to gain, nothing may be lost. */
+    env_init(env, "6:1 36:1");
+    run("house", env, first, later);
+    check("house: learned dwell finds as much on iwn",
+        recall(&later[IWN_LEARNED]) >= recall(&later[IWN_FIXED]) - 0.01);
+    check("house: learned AP count is not slower on iwx",
+        later[IWX_LEARNED].msec <= later[IWX_DEFAULT].msec * 1.05);
+
+    printf("%d failed\n", failures);
+    return failures != 0;
+}
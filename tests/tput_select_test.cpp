@@ -0,0 +1,419 @@
+/*
+ * Replays scan tables through ieee80211_node_choose_bss() and the
+ * throughput estimate of ieee80211_node.c, and checks which AP is chosen.
+ *
+ * We are a 2x2 HE station like the AX200 with iwx. A scan table lists
+ * the APs of one scan, one per line, and ends with the AP that has to be
+ * chosen:
+ *
+ *   # what the scan is about
+ *   ap <id> <chan> <MHz> <phy> <nss> <dBm> <load> <sec> [fail]
+ *   expect <id>
+ *
+ * phy is b, g (or a), n, ac or ax, load the channel utilization of the
+ * BSS Load element (0-255) or - without one, sec open, ccmp or tkip, and
+ * fail makes ieee80211_match_bss() reject the AP. The built-in tables
+ * run first, then those of the files given; -v prints each estimate.
+ *
+ *   N=../itl80211/openbsd/net80211
+ *   (awk -v types="ieee80211_channel ieee80211_phymode" \
+ *        -v defines="IEEE80211_CHAN_MAX IEEE80211_CHAN_ANYC \
+ *        IEEE80211_ADDR_COPY \
+ *        IEEE80211_CHAN_2GHZ IEEE80211_CHAN_5GHZ IEEE80211_CHAN_HT20 \
+ *        IEEE80211_CHAN_HT40U IEEE80211_CHAN_HT40D IEEE80211_CHAN_HT40 \
+ *        IEEE80211_IS_CHAN_2GHZ IEEE80211_IS_CHAN_5GHZ \
+ *        IEEE80211_PROTO_NONE IEEE80211_PROTO_RSN IEEE80211_F_HTON \
+ *        IEEE80211_F_VHTON IEEE80211_F_HEON" \
+ *        -f extract.awk $N/ieee80211_var.h &&
+ *    awk -v defines="IEEE80211_F_NOVHT IEEE80211_F_NOHT40" \
+ *        -f extract.awk $N/ieee80211_ioctl.h &&
+ *    awk -v types="ieee80211_rateset ieee80211_tx_ba ieee80211_rx_ba \
+ *        ieee80211_node" -v fns="ieee80211_node_supports_ht \
+ *        ieee80211_node_supports_vht ieee80211_node_supports_ht_sgi20 \
+ *        ieee80211_node_supports_ht_sgi40 \
+ *        ieee80211_node_supports_ht_chan40" \
+ *        -f extract.awk $N/ieee80211_node.h) > tput_select_defs.inc
+ *   awk -v vars="ieee80211_mcs_min_rssi ieee80211_mcs_bits12 \
+ *        ieee80211_legacy_min_rssi" -v defines=IEEE80211_TPUT_MAX_NSS \
+ *        -v fns="ieee80211_rssi_dbm ieee80211_node_rssi_dbm \
+ *        ieee80211_tput_ht_allowed ieee80211_tput_vht_allowed \
+ *        ieee80211_tput_he_allowed ieee80211_tput_chw \
+ *        ieee80211_tput_max_mcs ieee80211_tput_phy_rate \
+ *        ieee80211_tput_legacy ieee80211_estimate_tput \
+ *        ieee80211_node_estimate_tput ieee80211_node_choose_bss \
+ *        ieee80211_node_cmp" -f extract.awk $N/ieee80211_node.c \
+ *       > tput_select.inc
+ *   c++ -std=c++11 -g -fsanitize=address,undefined -I compat \
+ *       -idirafter ../itl80211/openbsd -o tput_select_test \
+ *       tput_select_test.cpp
+ *   ./tput_select_test [-v] [table ...]
+ */
+
+#include <sys/systm.h>
+#include <sys/tree.h>
+
+#include <net80211/ieee80211.h>
+#include <net80211/ieee80211_crypto.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#define DPRINTF(x)
+
+class CTimeout;
+
+struct mbuf_list {
+    mbuf_t ml_head;
+    mbuf_t ml_tail;
+    u_int ml_len;
+};
+
+struct mbuf_queue {
+    void *mq_mtx;
+    struct mbuf_list mq_list;
+    u_int mq_maxlen;
+    u_int mq_drops;
+};
+
+#include "tput_select_defs.inc"
+
+RB_HEAD(ieee80211_tree, ieee80211_node);
+
+struct _ifnet {
+    char if_xname[16];
+};
+
+struct ieee80211com {
+    struct _ifnet ic_if;
+    struct ieee80211_tree ic_tree;
+    struct ieee80211_node *ic_bss;
+    u_int32_t ic_flags;
+    u_int32_t ic_userflags;
+    u_int16_t ic_modecaps;
+    u_int16_t ic_htcaps;
+    u_int8_t ic_sup_mcs[howmany(80, NBBY)];
+    struct ieee80211_he_mcs_nss_supp ic_he_mcs_nss_supp;
+    u_int8_t ic_max_rssi;
+    struct ieee80211_channel ic_channels[IEEE80211_CHAN_MAX + 1];
+};
+
+int ieee80211_node_cmp(const struct ieee80211_node *,
+    const struct ieee80211_node *);
+RB_GENERATE_STATIC(ieee80211_tree, ieee80211_node, ni_node,
+    ieee80211_node_cmp)
+
+static void
+XYLog(const char *, ...)
+{
+}
+
+static u_int
+ieee80211_chan2ieee(struct ieee80211com *ic, const struct ieee80211_channel *c)
+{
+    return c - ic->ic_channels;
+}
+
+/* What ieee80211_match_bss() says about each AP, 0 to accept it. */
+static int
+ieee80211_match_bss(struct ieee80211com *, struct ieee80211_node *ni, int)
+{
+    return ni->ni_assoc_fail;
+}
+
+static void
+ieee80211_free_node(struct ieee80211com *ic, struct ieee80211_node *ni)
+{
+    RB_REMOVE(ieee80211_tree, &ic->ic_tree, ni);
+    free(ni);
+}
+
+#include "tput_select.inc"
+
+/*
+ * A 2x2 HE station: HT 40, VHT and HE on 80 and 160 MHz, MCS 0-11 on
+ * both streams, with RSSI normalized to -100 dBm like iwx reports it.
+ * 2 GHz channels 1-13 and 5 GHz channels 36-144 and 149-165 allow
+ * 40 MHz.
+ */
+static void
+sta_init(struct ieee80211com *ic)
+{
+    int i;
+
+    memset(ic, 0, sizeof(*ic));
+    strcpy(ic->ic_if.if_xname, "itlwm0");
+    RB_INIT(&ic->ic_tree);
+    ic->ic_flags = IEEE80211_F_HTON | IEEE80211_F_VHTON | IEEE80211_F_HEON;
+    ic->ic_modecaps = (1 << IEEE80211_MODE_11N) |
+        (1 << IEEE80211_MODE_11AC) | (1 << IEEE80211_MODE_11AX);
+    ic->ic_htcaps = IEEE80211_HTCAP_SGI20 | IEEE80211_HTCAP_SGI40 |
+        IEEE80211_HTCAP_CBW20_40;
+    ic->ic_sup_mcs[0] = ic->ic_sup_mcs[1] = 0xff;
+    ic->ic_he_mcs_nss_supp.tx_mcs_80 = htole16(0xfffa);
+    ic->ic_he_mcs_nss_supp.tx_mcs_160 = htole16(0xfffa);
+    ic->ic_max_rssi = 100 - 33;
+    for (i = 1; i <= 13; i++)
+        ic->ic_channels[i].ic_flags = IEEE80211_CHAN_2GHZ |
+            IEEE80211_CHAN_HT20 | (i <= 9 ? IEEE80211_CHAN_HT40U :
+            IEEE80211_CHAN_HT40D);
+    for (i = 36; i <= 165; i += 4) {
+        if (i == 148)
+            i = 149;
+        ic->ic_channels[i].ic_flags = IEEE80211_CHAN_5GHZ |
+            IEEE80211_CHAN_HT20 | IEEE80211_CHAN_HT40;
+    }
+}
+
+static const u_int8_t rates_b[] = { 2, 4, 11, 22 };
+static const u_int8_t rates_ofdm[] = { 12, 18, 24, 36, 48, 72, 96, 108 };
+
+/*
+ * VHT or HE MCS map with the highest MCS set (0-9 or 0-11) on nss
+ * streams and none on the others.
+ */
+static u_int16_t
+mcs_map(int nss)
+{
+    u_int16_t map = 0xffff;
+    int i;
+
+    for (i = 0; i < nss; i++)
+        map &= ~(1 << (2 * i));
+    return map;
+}
+
+/* An AP as one line of a scan table describes it. */
+static struct ieee80211_node *
+ap_parse(struct ieee80211com *ic, const char *line, std::string &err)
+{
+    struct ieee80211_node *ni;
+    char phy[8], load[8], sec[8], fail[8] = "";
+    int id, chan, mhz, nss, dbm, i, n;
+
+    n = sscanf(line, "ap %d %d %d %7s %d %d %7s %7s %7s", &id, &chan, &mhz,
+        phy, &nss, &dbm, load, sec, fail);
+    if (n < 8 || id < 1 || id > 255 || chan < 1 || chan > 165 ||
+        ic->ic_channels[chan].ic_flags == 0 || nss < 1 || nss > 4 ||
+        (mhz != 20 && mhz != 40 && mhz != 80 && mhz != 160)) {
+        err = "bad AP line";
+        return NULL;
+    }
+
+    ni = (struct ieee80211_node *)calloc(1, sizeof(*ni));
+    ni->ni_macaddr[0] = 0x02;
+    ni->ni_macaddr[5] = id;
+    IEEE80211_ADDR_COPY(ni->ni_bssid, ni->ni_macaddr);
+    ni->ni_chan = &ic->ic_channels[chan];
+    ni->ni_rssi = dbm + 100;
+
+    if (strcmp(phy, "b") == 0) {
+        memcpy(ni->ni_rates.rs_rates, rates_b, sizeof(rates_b));
+        ni->ni_rates.rs_nrates = sizeof(rates_b);
+    } else {
+        memcpy(ni->ni_rates.rs_rates, rates_ofdm, sizeof(rates_ofdm));
+        ni->ni_rates.rs_nrates = sizeof(rates_ofdm);
+    }
+    if (strcmp(phy, "n") == 0 || strcmp(phy, "ac") == 0 ||
+        strcmp(phy, "ax") == 0) {
+        ni->ni_flags |= IEEE80211_NODE_HTCAP;
+        for (i = 0; i < nss; i++)
+            ni->ni_rxmcs[i] = 0xff;
+        ni->ni_htcaps = IEEE80211_HTCAP_SGI20 | IEEE80211_HTCAP_SGI40;
+        if (mhz >= 40) {
+            ni->ni_htcaps |= IEEE80211_HTCAP_CBW20_40;
+            ni->ni_htop0 |= IEEE80211_HTOP0_CHW;
+        }
+    }
+    if ((strcmp(phy, "ac") == 0 || strcmp(phy, "ax") == 0) && chan > 14) {
+        ni->ni_flags |= IEEE80211_NODE_VHTCAP;
+        ni->ni_vht_mcsinfo.rx_mcs_map = htole16(mcs_map(nss));
+        ni->ni_vhtcaps = IEEE80211_VHTCAP_SHORT_GI_80;
+        if (mhz >= 80)
+            ni->ni_vht_chanwidth = IEEE80211_VHT_CHANWIDTH_80MHZ;
+        if (mhz == 160) {
+            ni->ni_vht_chanwidth = IEEE80211_VHT_CHANWIDTH_160MHZ;
+            ni->ni_vhtcaps |= IEEE80211_VHTCAP_SHORT_GI_160 |
+                IEEE80211_VHTCAP_SUPP_CHAN_WIDTH_160MHZ;
+        }
+    }
+    if (strcmp(phy, "ax") == 0) {
+        ni->ni_flags |= IEEE80211_NODE_HECAP;
+        ni->ni_he_mcs_nss_supp.rx_mcs_80 = htole16(mcs_map(nss));
+        ni->ni_he_mcs_nss_supp.rx_mcs_160 = htole16(mcs_map(nss));
+    }
+
+    if (strcmp(load, "-") != 0) {
+        ni->ni_flags |= IEEE80211_NODE_BSSLOAD;
+        ni->ni_bssload_chutil = atoi(load);
+    }
+    if (strcmp(sec, "ccmp") == 0 || strcmp(sec, "tkip") == 0) {
+        ni->ni_capinfo |= IEEE80211_CAPINFO_PRIVACY;
+        ni->ni_rsnprotos = IEEE80211_PROTO_RSN;
+        ni->ni_rsnciphers = strcmp(sec, "ccmp") == 0 ?
+            IEEE80211_CIPHER_CCMP : IEEE80211_CIPHER_TKIP;
+    } else if (strcmp(sec, "open") != 0) {
+        free(ni);
+        err = "bad security";
+        return NULL;
+    }
+    if (strcmp(fail, "fail") == 0)
+        ni->ni_assoc_fail = IEEE80211_NODE_ASSOCFAIL_ESSID;
+    return ni;
+}
+
+static int failures, nscans;
+static bool verbose;
+
+static void
+check(const char *what, bool ok)
+{
+    printf("%-4s %s\n", ok ? "ok" : "FAIL", what);
+    if (!ok)
+        failures++;
+}
+
+static void
+flush(struct ieee80211com *ic)
+{
+    struct ieee80211_node *ni;
+
+    while ((ni = RB_MIN(ieee80211_tree, &ic->ic_tree)) != NULL)
+        ieee80211_free_node(ic, ni);
+}
+
+/* Run the scans of a table, what says where it comes from. */
+static void
+replay(const char *what, const std::vector<std::string> &lines)
+{
+    struct ieee80211com ic;
+    struct ieee80211_node *ni, *selbs;
+    std::string name, err;
+    char msg[256];
+    int expect, lineno = 0;
+
+    sta_init(&ic);
+    for (const std::string &l : lines) {
+        lineno++;
+        if (l.empty())
+            continue;
+        if (l[0] == '#') {
+            name = l.substr(l.find_first_not_of("# "));
+        } else if (l.compare(0, 3, "ap ") == 0) {
+            if ((ni = ap_parse(&ic, l.c_str(), err)) == NULL)
+                break;
+            if (RB_INSERT(ieee80211_tree, &ic.ic_tree, ni) != NULL) {
+                free(ni);
+                err = "duplicate AP";
+                break;
+            }
+            if (verbose)
+                printf("     AP %d: %u kbit/s\n", ni->ni_macaddr[5],
+                    ieee80211_node_estimate_tput(&ic, ni));
+        } else if (sscanf(l.c_str(), "expect %d", &expect) == 1) {
+            selbs = ieee80211_node_choose_bss(&ic, 0, NULL);
+            snprintf(msg, sizeof(msg), "%s (AP %d chosen)", name.c_str(),
+                selbs ? selbs->ni_macaddr[5] : 0);
+            check(msg, selbs != NULL && selbs->ni_macaddr[5] == expect);
+            flush(&ic);
+            name.clear();
+            nscans++;
+        } else {
+            err = "unknown line";
+            break;
+        }
+    }
+    if (!err.empty()) {
+        snprintf(msg, sizeof(msg), "%s:%d: %s", what, lineno, err.c_str());
+        check(msg, false);
+    }
+    flush(&ic);
+}
+
+static const char *const builtin[] = {
+    "# 80 MHz HE AP over a stronger 20 MHz 2 GHz one",
+    "ap 1 6 20 n 2 -50 - ccmp",
+    "ap 2 36 80 ax 2 -62 - ccmp",
+    "expect 2",
+
+    "# strong 2 GHz AP over a 5 GHz one at the edge of its range",
+    "ap 1 1 20 n 2 -45 - ccmp",
+    "ap 2 44 80 ac 2 -86 - ccmp",
+    "expect 1",
+
+    "# two streams over one",
+    "ap 1 36 80 ax 1 -55 - ccmp",
+    "ap 2 149 80 ax 2 -55 - ccmp",
+    "expect 2",
+
+    "# the idle one of two equal APs",
+    "ap 1 36 80 ac 2 -60 230 ccmp",
+    "ap 2 52 80 ac 2 -60 20 ccmp",
+    "expect 2",
+
+    "# a busy HE 160 MHz AP still beats an idle 11g one",
+    "ap 1 11 20 g 1 -40 0 ccmp",
+    "ap 2 36 160 ax 2 -50 255 ccmp",
+    "expect 2",
+
+    "# TKIP keeps an AP to legacy rates",
+    "ap 1 36 40 n 2 -45 - tkip",
+    "ap 2 40 20 n 2 -60 - ccmp",
+    "expect 2",
+
+    "# equal estimates go to the stronger AP",
+    "ap 1 36 80 ax 2 -35 - ccmp",
+    "ap 2 100 80 ax 2 -30 - ccmp",
+    "ap 3 149 80 ax 2 -38 - ccmp",
+    "expect 2",
+
+    "# APs which do not match are never chosen",
+    "ap 1 36 160 ax 2 -40 - ccmp fail",
+    "ap 2 6 40 n 2 -55 - ccmp",
+    "ap 3 11 20 b 1 -30 - open",
+    "expect 2",
+
+    "# 11b rates lose to OFDM ones of the same strength",
+    "ap 1 1 20 b 1 -60 - open",
+    "ap 2 6 20 g 1 -60 - open",
+    "expect 2",
+
+    "# below every sensitivity the weaker AP is still ranked lower",
+    "ap 1 36 20 n 1 -95 - ccmp",
+    "ap 2 40 20 n 1 -90 - ccmp",
+    "expect 2",
+};
+
+int
+main(int argc, char **argv)
+{
+    std::vector<std::string> lines;
+    char buf[512];
+    FILE *fp;
+    int i;
+
+    for (i = 1; i < argc && strcmp(argv[i], "-v") == 0; i++)
+        verbose = true;
+
+    replay("built-in", std::vector<std::string>(builtin,
+        builtin + nitems(builtin)));
+
+    for (; i < argc; i++) {
+        if ((fp = fopen(argv[i], "r")) == NULL) {
+            perror(argv[i]);
+            return 2;
+        }
+        lines.clear();
+        while (fgets(buf, sizeof(buf), fp) != NULL) {
+            buf[strcspn(buf, "\r\n")] = '\0';
+            lines.push_back(buf);
+        }
+        fclose(fp);
+        replay(argv[i], lines);
+    }
+
+    printf("%d scans, %d failed\n", nscans, failures);
+    return failures != 0;
+}
@@ -0,0 +1,132 @@
+/*
+ * Simulator for the adaptive Tx ring byte limit in HAL/ItlTxLimit.hpp.
+ *
+ * A ring is drained at a fixed link rate and reports completions in
+ * batches, the way block ack notifications do.  The network stack refills
+ * the ring some time after the driver reopens it, as the deferred start
+ * would.  Checks that a saturated ring keeps the link busy, also when the
+ * refill lands after the next completion, that the limit stays within the
+ * airtime cap, and that it follows changes in link rate.
+ *
+ *   c++ -std=c++11 -I../include -o txlim_sim txlim_sim.cpp && ./txlim_sim
+ */
+
+#include <HAL/ItlTxLimit.hpp>
+
+#include <deque>
+#include <stdio.h>
+
+struct sim {
+    struct itl_tx_limit lim;
+    std::deque<uint32_t> ring;  /* frame lengths, oldest first */
+    bool full;                  /* driver stopped the send queue */
+    uint64_t reopen;            /* ns, when the stack refills the ring */
+    uint64_t now;               /* ns */
+    double credit;              /* bytes the link could have sent */
+    uint64_t busy, total;       /* ns, for utilization */
+};
+
+#define STEP_NS         10000ULL        /* 10us */
+#define RING_SLOTS      256
+#define FRAME_LEN       1500
+
+static void
+sim_run(struct sim *s, uint64_t dur_ns, uint32_t rate, uint64_t batch_ns,
+    uint64_t delay_ns, bool (*offered)(uint64_t))
+{
+    uint64_t end = s->now + dur_ns, next_batch = s->now + batch_ns;
+    uint32_t done = 0;
+
+    while (s->now < end) {
+        /* The stack fills the ring until the driver stops it. */
+        while (!s->full && s->now >= s->reopen &&
+            s->ring.size() < RING_SLOTS && offered(s->now)) {
+            s->ring.push_back(FRAME_LEN);
+            if (ItlTxLimit::queued(&s->lim, FRAME_LEN))
+                s->full = true;
+        }
+
+        /* The link sends what is on the ring, one frame at a time. */
+        s->total += STEP_NS;
+        if (!s->ring.empty()) {
+            s->busy += STEP_NS;
+            s->credit += (double)rate * STEP_NS / 1000000;
+            while (!s->ring.empty() && s->credit >= s->ring.front()) {
+                s->credit -= s->ring.front();
+                done += s->ring.front();
+                s->ring.pop_front();
+            }
+        } else
+            s->credit = 0;
+
+        s->now += STEP_NS;
+        if (s->now >= next_batch) {
+            next_batch += batch_ns;
+            if (done != 0) {
+                ItlTxLimit::dequeued(&s->lim, done);
+                ItlTxLimit::completed(&s->lim, done, s->now);
+                if (s->full && ItlTxLimit::is_open(&s->lim)) {
+                    s->full = false;
+                    s->reopen = s->now + delay_ns;
+                }
+                done = 0;
+            }
+        }
+    }
+}
+
+static bool always(uint64_t) { return true; }
+static bool bursty(uint64_t now) { return (now / 50000000ULL) % 2 == 0; }
+
+static int failures;
+
+static void
+check(bool ok, const char *what, double v)
+{
+    printf("%-4s %-44s %.2f\n", ok ? "ok" : "FAIL", what, v);
+    if (!ok)
+        failures++;
+}
+
+int
+main(void)
+{
+    struct sim s = sim();
+    double util;
+
+    ItlTxLimit::init(&s.lim);
+
+    /* 400 Mbit/s, block acks every 2ms, immediate refill. */
+    sim_run(&s, 1000000000ULL, 50000, 2000000, 0, always);
+    s.busy = s.total = 0;
+    sim_run(&s, 1000000000ULL, 50000, 2000000, 0, always);
+    util = (double)s.busy / s.total;
+    check(util > 0.99, "saturated link stays busy", util);
+    check(s.lim.limit >= 2 * 50000 && s.lim.limit <= 8 * 50000,
+        "limit covers a BA interval, within 8ms", s.lim.limit);
+
+    /* The refill lands 1.5ms after the ring reopens. */
+    s.busy = s.total = 0;
+    sim_run(&s, 2000000000ULL, 50000, 2000000, 1500000, always);
+    util = (double)s.busy / s.total;
+    check(util > 0.99, "late refill: link stays busy", util);
+    check(s.lim.limit <= 8 * 50000, "late refill: limit within 8ms",
+        s.lim.limit);
+
+    /* The link slows down to 20 Mbit/s. */
+    s.busy = s.total = 0;
+    sim_run(&s, 2000000000ULL, 2500, 2000000, 0, always);
+    util = (double)s.busy / s.total;
+    check(util > 0.99, "slow link stays busy", util);
+    check(s.lim.limit <= (ITL_TXLIM_MIN > 8 * 2500 ? ITL_TXLIM_MIN : 8 * 2500),
+        "limit follows the 8ms airtime cap down", s.lim.limit);
+
+    /* Back to 400 Mbit/s with an on/off source. */
+    s.busy = s.total = 0;
+    sim_run(&s, 2000000000ULL, 50000, 2000000, 0, bursty);
+    util = (double)s.busy / s.total;
+    check(util > 0.49, "bursty source is served while on", util);
+    check(s.lim.limit <= 8 * 50000, "limit stays within 8ms", s.lim.limit);
+
+    return failures != 0;
+}